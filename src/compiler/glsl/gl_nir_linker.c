@@ -35,6 +35,7 @@
 #include "main/shaderobj.h"
 #include "util/glheader.h"
 #include "util/perf/cpu_trace.h"
+#include "util/u_queue.h"
 
 /**
  * This file included general link methods, using NIR.
@@ -47,60 +48,62 @@ gl_nir_opts(nir_shader *nir)
 
    MESA_TRACE_FUNC();
 
+   nir_pass_scheduler *sched = nir_pass_scheduler_create(NULL);
+
    do {
       progress = false;
 
-      NIR_PASS(_, nir, nir_lower_vars_to_ssa);
+      NIR_SCHED_PASS(_, sched, nir, nir_lower_vars_to_ssa);
 
       /* Linking deals with unused inputs/outputs, but here we can remove
        * things local to the shader in the hopes that we can cleanup other
        * things. This pass will also remove variables with only stores, so we
        * might be able to make progress after it.
        */
-      NIR_PASS(progress, nir, nir_remove_dead_variables,
-               nir_var_function_temp | nir_var_shader_temp |
-               nir_var_mem_shared,
-               NULL);
+      NIR_SCHED_PASS(progress, sched, nir, nir_remove_dead_variables,
+                     nir_var_function_temp | nir_var_shader_temp |
+                     nir_var_mem_shared,
+                     NULL);
 
-      NIR_PASS(progress, nir, nir_opt_find_array_copies);
-      NIR_PASS(progress, nir, nir_opt_copy_prop_vars);
-      NIR_PASS(progress, nir, nir_opt_dead_write_vars);
+      NIR_SCHED_PASS(progress, sched, nir, nir_opt_find_array_copies);
+      NIR_SCHED_PASS(progress, sched, nir, nir_opt_copy_prop_vars);
+      NIR_SCHED_PASS(progress, sched, nir, nir_opt_dead_write_vars);
 
       if (nir->options->lower_to_scalar) {
-         NIR_PASS(_, nir, nir_lower_alu_to_scalar,
-                    nir->options->lower_to_scalar_filter, NULL);
-         NIR_PASS(_, nir, nir_lower_phis_to_scalar, false);
+         NIR_SCHED_PASS(_, sched, nir, nir_lower_alu_to_scalar,
+                        nir->options->lower_to_scalar_filter, NULL);
+         NIR_SCHED_PASS(_, sched, nir, nir_lower_phis_to_scalar, false);
       }
 
-      NIR_PASS(_, nir, nir_lower_alu);
-      NIR_PASS(_, nir, nir_lower_pack);
-      NIR_PASS(progress, nir, nir_copy_prop);
-      NIR_PASS(progress, nir, nir_opt_remove_phis);
-      NIR_PASS(progress, nir, nir_opt_dce);
+      NIR_SCHED_PASS(_, sched, nir, nir_lower_alu);
+      NIR_SCHED_PASS(_, sched, nir, nir_lower_pack);
+      NIR_SCHED_PASS(progress, sched, nir, nir_copy_prop);
+      NIR_SCHED_PASS(progress, sched, nir, nir_opt_remove_phis);
+      NIR_SCHED_PASS(progress, sched, nir, nir_opt_dce);
 
       bool opt_loop_progress = false;
-      NIR_PASS(opt_loop_progress, nir, nir_opt_loop);
+      NIR_SCHED_PASS(opt_loop_progress, sched, nir, nir_opt_loop);
       if (opt_loop_progress) {
          progress = true;
-         NIR_PASS(progress, nir, nir_copy_prop);
-         NIR_PASS(progress, nir, nir_opt_dce);
+         NIR_SCHED_PASS(progress, sched, nir, nir_copy_prop);
+         NIR_SCHED_PASS(progress, sched, nir, nir_opt_dce);
       }
-      NIR_PASS(progress, nir, nir_opt_if, 0);
-      NIR_PASS(progress, nir, nir_opt_dead_cf);
-      NIR_PASS(progress, nir, nir_opt_cse);
+      NIR_SCHED_PASS(progress, sched, nir, nir_opt_if, 0);
+      NIR_SCHED_PASS(progress, sched, nir, nir_opt_dead_cf);
+      NIR_SCHED_PASS(progress, sched, nir, nir_opt_cse);
 
       nir_opt_peephole_select_options peephole_select_options = {
          .limit = 8,
          .indirect_load_ok = true,
          .expensive_alu_ok = true,
       };
-      NIR_PASS(progress, nir, nir_opt_peephole_select, &peephole_select_options);
+      NIR_SCHED_PASS(progress, sched, nir, nir_opt_peephole_select, &peephole_select_options);
 
-      NIR_PASS(progress, nir, nir_opt_phi_precision);
-      NIR_PASS(progress, nir, nir_opt_algebraic);
-      NIR_PASS(progress, nir, nir_opt_constant_folding);
-      NIR_PASS(progress, nir, nir_io_add_const_offset_to_base,
-               nir_var_shader_in | nir_var_shader_out);
+      NIR_SCHED_PASS(progress, sched, nir, nir_opt_phi_precision);
+      NIR_SCHED_PASS(progress, sched, nir, nir_opt_algebraic);
+      NIR_SCHED_PASS(progress, sched, nir, nir_opt_constant_folding);
+      NIR_SCHED_PASS(progress, sched, nir, nir_io_add_const_offset_to_base,
+                     nir_var_shader_in | nir_var_shader_out);
 
       if (!nir->info.flrp_lowered) {
          unsigned lower_flrp =
@@ -111,12 +114,12 @@ gl_nir_opts(nir_shader *nir)
          if (lower_flrp) {
             bool lower_flrp_progress = false;
 
-            NIR_PASS(lower_flrp_progress, nir, nir_lower_flrp,
-                     lower_flrp,
-                     false /* always_precise */);
+            NIR_SCHED_PASS(lower_flrp_progress, sched, nir, nir_lower_flrp,
+                           lower_flrp,
+                           false /* always_precise */);
             if (lower_flrp_progress) {
-               NIR_PASS(progress, nir,
-                        nir_opt_constant_folding);
+               NIR_SCHED_PASS(progress, sched, nir,
+                              nir_opt_constant_folding);
                progress = true;
             }
          }
@@ -127,23 +130,83 @@ gl_nir_opts(nir_shader *nir)
          nir->info.flrp_lowered = true;
       }
 
-      NIR_PASS(progress, nir, nir_opt_undef);
+      NIR_SCHED_PASS(progress, sched, nir, nir_opt_undef);
 
       peephole_select_options = (nir_opt_peephole_select_options){
          .limit = 0,
          .discard_ok = true,
       };
-      NIR_PASS(progress, nir, nir_opt_peephole_select, &peephole_select_options);
+      NIR_SCHED_PASS(progress, sched, nir, nir_opt_peephole_select, &peephole_select_options);
       if (nir->options->max_unroll_iterations ||
             (nir->options->max_unroll_iterations_fp64 &&
                (nir->options->lower_doubles_options & nir_lower_fp64_full_software))) {
-         NIR_PASS(progress, nir, nir_opt_loop_unroll);
+         NIR_SCHED_PASS(progress, sched, nir, nir_opt_loop_unroll);
       }
    } while (progress);
 
+   ralloc_free(sched);
+
    NIR_PASS(_, nir, nir_lower_var_copies);
 }
 
+struct link_stage_job {
+   struct gl_linked_shader *shader;
+   gl_nir_link_stage_cb cb;
+   void *data;
+
+   struct util_queue_fence fence;
+};
+
+static void
+link_stage_job_execute(void *_job, UNUSED void *gdata, UNUSED int thread_index)
+{
+   struct link_stage_job *job = _job;
+
+   job->cb(job->shader, job->data);
+}
+
+/**
+ * Call \p cb for each linked shader, running the calls in parallel on
+ * \p queue if it is not NULL.
+ *
+ * The callback may only change the shader it is given and must not report
+ * link errors, because the calls for other stages run at the same time.
+ * Errors should be stored per stage and reported in stage order after this
+ * returns, so that the info log does not depend on the scheduling.
+ */
+void
+gl_nir_link_foreach_stage(struct util_queue *queue,
+                          struct gl_linked_shader **linked_shader,
+                          unsigned num_shaders,
+                          gl_nir_link_stage_cb cb, void *data)
+{
+   if (!queue || num_shaders <= 1) {
+      for (unsigned i = 0; i < num_shaders; i++)
+         cb(linked_shader[i], data);
+      return;
+   }
+
+   struct link_stage_job jobs[MESA_SHADER_STAGES];
+   assert(num_shaders <= ARRAY_SIZE(jobs));
+
+   /* The last stage runs on this thread instead of waiting idle. */
+   for (unsigned i = 0; i < num_shaders - 1; i++) {
+      jobs[i].shader = linked_shader[i];
+      jobs[i].cb = cb;
+      jobs[i].data = data;
+      util_queue_fence_init(&jobs[i].fence);
+      util_queue_add_job(queue, &jobs[i], &jobs[i].fence,
+                         link_stage_job_execute, NULL, 0);
+   }
+
+   cb(linked_shader[num_shaders - 1], data);
+
+   for (unsigned i = 0; i < num_shaders - 1; i++) {
+      util_queue_fence_wait(&jobs[i].fence);
+      util_queue_fence_destroy(&jobs[i].fence);
+   }
+}
+
 static void
 replace_tex_src(nir_tex_src *dst, nir_tex_src_type src_type, nir_def *src_def,
                 nir_instr *src_parent)
@@ -1365,45 +1428,80 @@ preprocess_shader(const struct gl_constants *consts,
    NIR_PASS(_, nir, nir_opt_constant_folding);
 }
 
+static void
+inline_functions_stage(struct gl_linked_shader *shader, UNUSED void *data)
+{
+   gl_nir_inline_functions(shader->Program->nir);
+}
+
+struct prelink_state {
+   const struct gl_constants *consts;
+   const struct gl_extensions *exts;
+   struct gl_shader_program *shader_program;
+   /* The shader at index MESA_SHADER_VERTEX of the linked shaders. */
+   struct gl_linked_shader *vertex_index_shader;
+};
+
+static void
+prelink_lower_stage(struct gl_linked_shader *shader, void *data)
+{
+   const struct prelink_state *state = data;
+   const struct gl_constants *consts = state->consts;
+   const struct gl_extensions *exts = state->exts;
+   struct gl_shader_program *shader_program = state->shader_program;
+   const nir_shader_compiler_options *options =
+      consts->ShaderCompilerOptions[shader->Stage].NirOptions;
+   struct gl_program *prog = shader->Program;
+
+   /* NIR drivers that support tess shaders and compact arrays need to use
+   * GLSLTessLevelsAsInputs / pipe_caps.glsl_tess_levels_as_inputs. The NIR
+   * linker doesn't support linking these as compat arrays of sysvals.
+   */
+   assert(consts->GLSLTessLevelsAsInputs || !options->compact_arrays ||
+          !exts->ARB_tessellation_shader);
+
+
+   /* ES 3.0+ vertex shaders may still have dead varyings but its now safe
+    * to remove them as validation is now done according to the spec.
+    */
+   if (shader_program->IsES && shader_program->GLSL_Version >= 300 &&
+       shader == state->vertex_index_shader)
+      remove_dead_varyings_pre_linking(prog->nir);
+
+   preprocess_shader(consts, exts, prog, shader_program, shader->Stage);
+
+   if (options->lower_to_scalar) {
+      NIR_PASS(_, shader->Program->nir, nir_lower_load_const_to_scalar);
+   }
+}
+
 static bool
 prelink_lowering(const struct gl_constants *consts,
                  const struct gl_extensions *exts,
+                 struct util_queue *queue,
                  struct gl_shader_program *shader_program,
                  struct gl_linked_shader **linked_shader, unsigned num_shaders)
 {
-   for (unsigned i = 0; i < num_shaders; i++) {
-      struct gl_linked_shader *shader = linked_shader[i];
-      const nir_shader_compiler_options *options =
-         consts->ShaderCompilerOptions[shader->Stage].NirOptions;
-      struct gl_program *prog = shader->Program;
+   struct prelink_state state = {
+      .consts = consts,
+      .exts = exts,
+      .shader_program = shader_program,
+      .vertex_index_shader = num_shaders > MESA_SHADER_VERTEX ?
+                             linked_shader[MESA_SHADER_VERTEX] : NULL,
+   };
 
-      /* NIR drivers that support tess shaders and compact arrays need to use
-      * GLSLTessLevelsAsInputs / pipe_caps.glsl_tess_levels_as_inputs. The NIR
-      * linker doesn't support linking these as compat arrays of sysvals.
-      */
-      assert(consts->GLSLTessLevelsAsInputs || !options->compact_arrays ||
-             !exts->ARB_tessellation_shader);
-
-
-      /* ES 3.0+ vertex shaders may still have dead varyings but its now safe
-       * to remove them as validation is now done according to the spec.
-       */
-      if (shader_program->IsES && shader_program->GLSL_Version >= 300 &&
-          i == MESA_SHADER_VERTEX)
-         remove_dead_varyings_pre_linking(prog->nir);
+   gl_nir_link_foreach_stage(queue, linked_shader, num_shaders,
+                             prelink_lower_stage, &state);
 
-      preprocess_shader(consts, exts, prog, shader_program, shader->Stage);
+   for (unsigned i = 0; i < num_shaders; i++) {
+      nir_shader *nir = linked_shader[i]->Program->nir;
 
-      if (prog->nir->info.shared_size > consts->MaxComputeSharedMemorySize) {
+      if (nir->info.shared_size > consts->MaxComputeSharedMemorySize) {
          linker_error(shader_program, "Too much shared memory used (%u/%u)\n",
-                      prog->nir->info.shared_size,
+                      nir->info.shared_size,
                       consts->MaxComputeSharedMemorySize);
          return false;
       }
-
-      if (options->lower_to_scalar) {
-         NIR_PASS(_, shader->Program->nir, nir_lower_load_const_to_scalar);
-      }
    }
 
    lower_patch_vertices_in(shader_program);
@@ -1604,7 +1702,7 @@ gl_nir_link_spirv(const struct gl_constants *consts,
 
    gl_nir_link_assign_xfb_resources(consts, prog);
 
-   if (!prelink_lowering(consts, exts, prog, linked_shader, num_shaders))
+   if (!prelink_lowering(consts, exts, NULL, prog, linked_shader, num_shaders))
       return false;
 
    gl_nir_lower_optimize_varyings(consts, prog, true);
@@ -3814,6 +3912,9 @@ gl_nir_link_glsl(struct gl_context *ctx, struct gl_shader_program *prog)
    if (!prog->data->LinkStatus)
       goto done;
 
+   struct gl_linked_shader *stages[MESA_SHADER_STAGES];
+   unsigned num_stages = 0;
+
    for (unsigned i = 0; i < MESA_SHADER_STAGES; i++) {
       if (prog->_LinkedShaders[i] == NULL)
          continue;
@@ -3823,9 +3924,12 @@ gl_nir_link_glsl(struct gl_context *ctx, struct gl_shader_program *prog)
       if (!prog->data->LinkStatus)
          goto done;
 
-      gl_nir_inline_functions(prog->_LinkedShaders[i]->Program->nir);
+      stages[num_stages++] = prog->_LinkedShaders[i];
    }
 
+   gl_nir_link_foreach_stage(ctx->LinkQueue, stages, num_stages,
+                             inline_functions_stage, NULL);
+
    resize_tes_inputs(consts, prog);
    set_geom_shader_input_array_size(prog);
 
@@ -3955,7 +4059,8 @@ gl_nir_link_glsl(struct gl_context *ctx, struct gl_shader_program *prog)
    if (!gl_assign_attribute_or_color_locations(consts, prog))
       goto done;
 
-   if (!prelink_lowering(consts, exts, prog, linked_shader, num_linked_shaders))
+   if (!prelink_lowering(consts, exts, ctx->LinkQueue, prog, linked_shader,
+                         num_linked_shaders))
       goto done;
 
    if (!gl_nir_link_varyings(consts, exts, api, prog))
@@ -46,6 +46,7 @@ struct gl_program;
 struct gl_transform_feedback_info;
 struct xfb_decl;
 struct nir_xfb_info;
+struct util_queue;
 
 struct gl_nir_linker_options {
    bool fill_parameters;
@@ -59,6 +60,14 @@ struct gl_nir_linker_options {
 
 void gl_nir_opts(nir_shader *nir);
 
+typedef void (*gl_nir_link_stage_cb)(struct gl_linked_shader *shader,
+                                     void *data);
+
+void gl_nir_link_foreach_stage(struct util_queue *queue,
+                               struct gl_linked_shader **linked_shader,
+                               unsigned num_shaders,
+                               gl_nir_link_stage_cb cb, void *data);
+
 void gl_nir_detect_recursion_linked(struct gl_shader_program *prog,
                                     nir_shader *shader);
 
@@ -0,0 +1,208 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/*
+ * Benchmarks linking GLSL programs with the stages linked one after another
+ * against linking them in parallel.
+ *
+ * Each argument is a .shader_test file, e.g. captured with
+ * MESA_SHADER_CAPTURE_PATH.  Every program is compiled and linked a number
+ * of times in each mode, and only the time spent in gl_nir_link_glsl() is
+ * measured.  The linked shaders and the info log must be identical for both
+ * modes.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gl_nir_linker.h"
+#include "glsl_parser_extras.h"
+#include "builtin_functions.h"
+#include "linker_util.h"
+#include "standalone.h"
+#include "standalone_scaffolding.h"
+#include "main/mtypes.h"
+#include "nir.h"
+#include "nir_serialize.h"
+#include "util/blob.h"
+#include "util/os_file.h"
+#include "util/os_time.h"
+#include "util/u_cpu_detect.h"
+#include "util/u_queue.h"
+
+static struct gl_context ctx;
+
+/* Returns the GLSL version required by a .shader_test file. */
+static int
+shader_test_version(const char *text)
+{
+   const char *req = strstr(text, "GLSL ES >= ");
+   unsigned major, minor;
+
+   if (req && sscanf(req, "GLSL ES >= %u.%u", &major, &minor) == 2)
+      return major * 100 + minor;
+
+   req = strstr(text, "GLSL >= ");
+   if (req && sscanf(req, "GLSL >= %u.%u", &major, &minor) == 2)
+      return major * 100 + minor;
+
+   return 110;
+}
+
+/* Compiles and links a program, and returns the time spent linking in
+ * nanoseconds, or -1 if the program doesn't compile.
+ */
+static int64_t
+link_program(const char *file, int version, struct util_queue *queue,
+             struct blob *result)
+{
+   struct standalone_options options;
+   memset(&options, 0, sizeof(options));
+   options.glsl_version = version;
+   options.just_log = true;
+
+   char *files[] = { (char *)file };
+   struct gl_shader_program *prog =
+      standalone_compile_shader(&options, 1, files, &ctx);
+   if (!prog)
+      return -1;
+
+   bool compiled = prog->NumShaders > 0;
+   for (unsigned i = 0; i < prog->NumShaders; i++)
+      compiled &= prog->Shaders[i]->CompileStatus == COMPILE_SUCCESS;
+
+   if (!compiled) {
+      standalone_compiler_cleanup(prog);
+      return -1;
+   }
+
+   ctx.LinkQueue = queue;
+
+   _mesa_clear_shader_program_data(&ctx, prog);
+   prog->data->LinkStatus = LINKING_SUCCESS;
+
+   int64_t start = os_time_get_nano();
+   link_shaders_init(&ctx, prog);
+   gl_nir_link_glsl(&ctx, prog);
+   int64_t time_ns = os_time_get_nano() - start;
+
+   ctx.LinkQueue = NULL;
+
+   if (result) {
+      blob_write_uint32(result, prog->data->LinkStatus);
+      blob_write_string(result, prog->data->InfoLog);
+
+      for (unsigned i = 0; i < MESA_SHADER_STAGES; i++) {
+         struct gl_linked_shader *sh = prog->_LinkedShaders[i];
+         if (sh)
+            nir_serialize(result, sh->Program->nir, false);
+      }
+   }
+
+   standalone_compiler_cleanup(prog);
+
+   return time_ns;
+}
+
+static void
+usage(const char *name)
+{
+   fprintf(stderr, "usage: %s [-n <iterations>] [-j <threads>] "
+                   "<program.shader_test>...\n", name);
+}
+
+int
+main(int argc, char **argv)
+{
+   unsigned iterations = 10;
+   unsigned num_threads =
+      MIN2(util_get_cpu_caps()->nr_cpus, MESA_SHADER_FRAGMENT + 1) - 1;
+   int first = 1;
+
+   while (first + 1 < argc && argv[first][0] == '-') {
+      if (strcmp(argv[first], "-n") == 0)
+         iterations = MAX2(atoi(argv[first + 1]), 1);
+      else if (strcmp(argv[first], "-j") == 0)
+         num_threads = MAX2(atoi(argv[first + 1]), 1);
+      else
+         break;
+      first += 2;
+   }
+
+   if (first >= argc) {
+      usage(argv[0]);
+      return 1;
+   }
+
+   num_threads = MAX2(num_threads, 1);
+
+   struct util_queue queue;
+   if (!util_queue_init(&queue, "gllink", MESA_SHADER_STAGES, num_threads,
+                        0, NULL)) {
+      fprintf(stderr, "failed to create the link queue\n");
+      return 1;
+   }
+
+   /* Keep the built-in functions around between the programs. */
+   _mesa_glsl_builtin_functions_init_or_ref();
+
+   int64_t total_ns[2] = { 0 };
+   int ret = 0;
+
+   for (int i = first; i < argc; i++) {
+      size_t size;
+      char *text = os_read_file(argv[i], &size);
+      if (!text) {
+         fprintf(stderr, "%s: failed to read file\n", argv[i]);
+         ret = 1;
+         continue;
+      }
+
+      int version = shader_test_version(text);
+      free(text);
+
+      struct blob results[2];
+      int64_t time_ns[2] = { 0 };
+      for (unsigned m = 0; m < 2; m++) {
+         blob_init(&results[m]);
+
+         for (unsigned n = 0; n < iterations && time_ns[m] >= 0; n++) {
+            int64_t t = link_program(argv[i], version, m ? &queue : NULL,
+                                     n == 0 ? &results[m] : NULL);
+            time_ns[m] = t < 0 ? t : time_ns[m] + t;
+         }
+      }
+
+      if (time_ns[0] < 0 || time_ns[1] < 0) {
+         fprintf(stderr, "%s: failed to compile program\n", argv[i]);
+      } else if (results[0].size != results[1].size ||
+                 memcmp(results[0].data, results[1].data, results[0].size)) {
+         fprintf(stderr, "%s: serial and parallel linking disagree\n",
+                 argv[i]);
+         ret = 1;
+      } else {
+         printf("%s: serial %" PRId64 " us, parallel %" PRId64 " us\n",
+                argv[i], time_ns[0] / 1000, time_ns[1] / 1000);
+         total_ns[0] += time_ns[0];
+         total_ns[1] += time_ns[1];
+      }
+
+      blob_finish(&results[0]);
+      blob_finish(&results[1]);
+   }
+
+   printf("total: serial %" PRId64 " us, parallel %" PRId64 " us "
+          "(%u threads)", total_ns[0] / 1000, total_ns[1] / 1000,
+          num_threads);
+   if (total_ns[1] > 0)
+      printf(", speedup %.2fx", (double)total_ns[0] / total_ns[1]);
+   printf("\n");
+
+   _mesa_glsl_builtin_functions_decref();
+   util_queue_destroy(&queue);
+
+   return ret;
+}
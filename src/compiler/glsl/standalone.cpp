@@ -320,6 +320,82 @@ compile_shader(struct gl_context *ctx, struct gl_shader *shader)
                              options->dump_hir, true);
 }
 
+static bool
+add_and_compile_shader(struct gl_context *ctx,
+                       struct gl_shader_program *whole_program,
+                       const char *name, GLenum type, const char *source)
+{
+   struct gl_shader *shader = standalone_add_shader_source(ctx, whole_program, type, source);
+
+   compile_shader(ctx, shader);
+
+   if (strlen(shader->InfoLog) > 0) {
+      if (!options->just_log)
+         printf("Info log for %s:\n", name);
+
+      printf("%s", shader->InfoLog);
+      if (!options->just_log)
+         printf("\n");
+   }
+
+   return shader->CompileStatus;
+}
+
+static const struct {
+   const char *section;
+   GLenum type;
+} shader_test_sections[] = {
+   { "[vertex shader]", GL_VERTEX_SHADER },
+   { "[tessellation control shader]", GL_TESS_CONTROL_SHADER },
+   { "[tessellation evaluation shader]", GL_TESS_EVALUATION_SHADER },
+   { "[geometry shader]", GL_GEOMETRY_SHADER },
+   { "[fragment shader]", GL_FRAGMENT_SHADER },
+   { "[compute shader]", GL_COMPUTE_SHADER },
+};
+
+/**
+ * Compile the shaders of a .shader_test file, as written by
+ * MESA_SHADER_CAPTURE_PATH.  Sections other than the shader sources are
+ * ignored.
+ */
+static bool
+compile_shader_test(struct gl_context *ctx,
+                    struct gl_shader_program *whole_program,
+                    const char *name, const char *text)
+{
+   const char *line = text;
+
+   while (*line) {
+      const char *next = strchr(line, '\n');
+      next = next ? next + 1 : line + strlen(line);
+
+      for (unsigned i = 0; i < ARRAY_SIZE(shader_test_sections); i++) {
+         const char *section = shader_test_sections[i].section;
+         if (strncmp(line, section, strlen(section)) != 0)
+            continue;
+
+         /* The source ends at the next section. */
+         const char *end = next;
+         while (*end && *end != '[') {
+            const char *eol = strchr(end, '\n');
+            end = eol ? eol + 1 : end + strlen(end);
+         }
+
+         const char *source = ralloc_strndup(whole_program, next, end - next);
+         if (!add_and_compile_shader(ctx, whole_program, name,
+                                     shader_test_sections[i].type, source))
+            return false;
+
+         next = end;
+         break;
+      }
+
+      line = next;
+   }
+
+   return true;
+}
+
 extern "C" struct gl_shader_program *
 standalone_compile_shader(const struct standalone_options *_options,
       unsigned num_files, char* const* files, struct gl_context *ctx)
@@ -382,8 +458,21 @@ standalone_compile_shader(const struct standalone_options *_options,
       if (len < 6)
          goto fail;
 
+      if (len > 12 && strcmp(".shader_test", &files[i][len - 12]) == 0) {
+         const char *source = load_text_file(whole_program, files[i]);
+         if (source == NULL) {
+            printf("File \"%s\" does not exist.\n", files[i]);
+            exit(EXIT_FAILURE);
+         }
+
+         if (!compile_shader_test(ctx, whole_program, files[i], source)) {
+            status = EXIT_FAILURE;
+            break;
+         }
+         continue;
+      }
+
       const char *const ext = & files[i][len - 5];
-      /* TODO add support to read a .shader_test */
       GLenum type;
       if (strncmp(".vert", ext, 5) == 0 || strncmp(".glsl", ext, 5) == 0)
          type = GL_VERTEX_SHADER;
@@ -406,20 +495,7 @@ standalone_compile_shader(const struct standalone_options *_options,
          exit(EXIT_FAILURE);
       }
 
-      struct gl_shader *shader = standalone_add_shader_source(ctx, whole_program, type, source);
-
-      compile_shader(ctx, shader);
-
-      if (strlen(shader->InfoLog) > 0) {
-         if (!options->just_log)
-            printf("Info log for %s:\n", files[i]);
-
-         printf("%s", shader->InfoLog);
-         if (!options->just_log)
-            printf("\n");
-      }
-
-      if (!shader->CompileStatus) {
+      if (!add_and_compile_shader(ctx, whole_program, files[i], type, source)) {
          status = EXIT_FAILURE;
          break;
       }
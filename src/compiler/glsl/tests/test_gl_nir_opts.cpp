@@ -0,0 +1,328 @@
+/*
+ * Copyright © 2024 Google LLC
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/* Checks that gl_nir_opts() produces the same shaders whether or not the
+ * pass scheduler skips passes which cannot make progress.
+ */
+
+#include <gtest/gtest.h>
+
+#include "main/mtypes.h"
+#include "standalone_scaffolding.h"
+#include "ir.h"
+#include "nir.h"
+#include "builtin_functions.h"
+#include "gl_nir.h"
+#include "gl_nir_linker.h"
+#include "glsl_parser_extras.h"
+#include "linker_util.h"
+
+namespace
+{
+   struct shader_pair {
+      const char *vs;
+      const char *fs;
+   };
+
+   class gl_nir_opts_test : public ::testing::TestWithParam<shader_pair>
+   {
+   protected:
+      gl_nir_opts_test();
+      ~gl_nir_opts_test();
+
+      void link(bool scheduled, char *out[MESA_SHADER_STAGES]);
+
+      struct gl_context local_ctx;
+      struct gl_context *ctx;
+      nir_shader_compiler_options compiler_options;
+      void *mem_ctx;
+   };
+
+   gl_nir_opts_test::gl_nir_opts_test()
+      : ctx(&local_ctx), compiler_options(), mem_ctx(ralloc_context(NULL))
+   {
+      glsl_type_singleton_init_or_ref();
+      _mesa_glsl_builtin_functions_init_or_ref();
+
+      compiler_options.lower_flrp32 = true;
+      compiler_options.lower_to_scalar = true;
+      compiler_options.max_unroll_iterations = 16;
+   }
+
+   gl_nir_opts_test::~gl_nir_opts_test()
+   {
+      ralloc_free(mem_ctx);
+      _mesa_glsl_builtin_functions_decref();
+      glsl_type_singleton_decref();
+   }
+
+   static void
+   set_scheduler_enabled(bool enabled)
+   {
+#ifdef _WIN32
+      _putenv_s("NIR_PASS_SCHEDULER", enabled ? "" : "false");
+#else
+      if (enabled)
+         unsetenv("NIR_PASS_SCHEDULER");
+      else
+         setenv("NIR_PASS_SCHEDULER", "false", 1);
+#endif
+   }
+
+   void
+   gl_nir_opts_test::link(bool scheduled, char *out[MESA_SHADER_STAGES])
+   {
+      const shader_pair &sources = GetParam();
+
+      initialize_context_to_defaults(ctx, API_OPENGLES2);
+      ctx->Version = 31;
+      for (int i = 0; i < MESA_SHADER_STAGES; i++)
+         ctx->Const.ShaderCompilerOptions[i].NirOptions = &compiler_options;
+
+      struct gl_shader_program *prog = standalone_create_shader_program();
+      prog->IsES = true;
+
+      struct gl_shader *shaders[] = {
+         standalone_add_shader_source(ctx, prog, GL_VERTEX_SHADER, sources.vs),
+         standalone_add_shader_source(ctx, prog, GL_FRAGMENT_SHADER, sources.fs),
+      };
+      for (struct gl_shader *shader : shaders) {
+         _mesa_glsl_compile_shader(ctx, shader, NULL, false, false, true);
+         if (shader->CompileStatus != COMPILE_SUCCESS)
+            fprintf(stderr, "Compiler error: %s", shader->InfoLog);
+         ASSERT_EQ(shader->CompileStatus, COMPILE_SUCCESS);
+      }
+
+      set_scheduler_enabled(scheduled);
+      link_shaders_init(ctx, prog);
+      gl_nir_link_glsl(ctx, prog);
+      set_scheduler_enabled(true);
+
+      if (prog->data->LinkStatus != LINKING_SUCCESS)
+         fprintf(stderr, "Linker error: %s", prog->data->InfoLog);
+      EXPECT_EQ(prog->data->LinkStatus, LINKING_SUCCESS);
+
+      for (int i = 0; i < MESA_SHADER_STAGES; i++) {
+         struct gl_linked_shader *sh = prog->_LinkedShaders[i];
+         out[i] = sh ? nir_shader_as_str(sh->Program->nir, mem_ctx) : NULL;
+      }
+
+      standalone_destroy_shader_program(prog);
+   }
+} // namespace
+
+TEST_P(gl_nir_opts_test, scheduled_matches_unscheduled)
+{
+   char *unscheduled[MESA_SHADER_STAGES];
+   char *scheduled[MESA_SHADER_STAGES];
+
+   ASSERT_NO_FATAL_FAILURE(link(false, unscheduled));
+   ASSERT_NO_FATAL_FAILURE(link(true, scheduled));
+
+   for (int i = 0; i < MESA_SHADER_STAGES; i++) {
+      if (!unscheduled[i] || !scheduled[i]) {
+         EXPECT_EQ(unscheduled[i], scheduled[i]);
+         continue;
+      }
+      EXPECT_STREQ(unscheduled[i], scheduled[i])
+         << "stage " << _mesa_shader_stage_to_string(i);
+   }
+}
+
+static const char passthrough_vs[] = R"(#version 310 es
+   in vec4 pos;
+   in vec4 attr;
+   out vec4 color;
+   void main()
+   {
+      gl_Position = pos;
+      color = attr;
+   })";
+
+static const shader_pair corpus[] = {
+   /* Straight-line arithmetic for the algebraic passes and flrp lowering */
+   {
+      passthrough_vs,
+      R"(#version 310 es
+      precision highp float;
+      in vec4 color;
+      uniform vec4 a, b;
+      uniform float t;
+      out vec4 result;
+      void main()
+      {
+         vec4 x = mix(a, b, t) * 1.0 + vec4(0.0);
+         result = x * color + mix(color, a, 0.5);
+      })",
+   },
+   /* Branches for peephole select, opt_if and dead_cf */
+   {
+      passthrough_vs,
+      R"(#version 310 es
+      precision highp float;
+      in vec4 color;
+      uniform int mode;
+      out vec4 result;
+      void main()
+      {
+         vec4 x;
+         if (mode == 0)
+            x = color;
+         else if (mode == 1)
+            x = color.wzyx;
+         else
+            x = vec4(1.0);
+         if (false)
+            x = vec4(0.0);
+         result = x;
+      })",
+   },
+   /* A constant loop which gets unrolled */
+   {
+      passthrough_vs,
+      R"(#version 310 es
+      precision highp float;
+      in vec4 color;
+      uniform vec4 weights[8];
+      out vec4 result;
+      void main()
+      {
+         vec4 sum = vec4(0.0);
+         for (int i = 0; i < 8; i++)
+            sum += weights[i] * color;
+         result = sum;
+      })",
+   },
+   /* A uniform-bounded loop with a break, kept as a loop with phis */
+   {
+      passthrough_vs,
+      R"(#version 310 es
+      precision highp float;
+      in vec4 color;
+      uniform int count;
+      uniform float limit;
+      out vec4 result;
+      void main()
+      {
+         vec4 x = color;
+         for (int i = 0; i < count; i++) {
+            x = x * 0.5 + color;
+            if (x.x > limit)
+               break;
+         }
+         result = x;
+      })",
+   },
+   /* Local arrays for the variable passes */
+   {
+      passthrough_vs,
+      R"(#version 310 es
+      precision highp float;
+      in vec4 color;
+      uniform int idx;
+      out vec4 result;
+      void main()
+      {
+         float a[4] = float[4](color.x, color.y, color.z, color.w);
+         float b[4];
+         b = a;
+         b[1] = 2.0;
+         result = vec4(b[idx & 3], b[1], a[0], 1.0);
+      })",
+   },
+   /* Functions which get inlined, and a vertex shader doing some work */
+   {
+      R"(#version 310 es
+      in vec4 pos;
+      uniform mat4 mvp;
+      uniform bool flip;
+      out vec2 uv;
+      vec4 transform(vec4 p)
+      {
+         return flip ? mvp * p.yxzw : mvp * p;
+      }
+      void main()
+      {
+         gl_Position = transform(pos);
+         uv = pos.xy * 0.5 + 0.5;
+      })",
+      R"(#version 310 es
+      precision highp float;
+      in vec2 uv;
+      uniform sampler2D tex;
+      out vec4 result;
+      vec4 fetch(vec2 c)
+      {
+         return texture(tex, clamp(c, 0.0, 1.0));
+      }
+      void main()
+      {
+         result = fetch(uv) + fetch(uv.yx) * 0.25;
+      })",
+   },
+   /* Nested loops with a continue */
+   {
+      passthrough_vs,
+      R"(#version 310 es
+      precision highp float;
+      in vec4 color;
+      uniform int n, m;
+      out vec4 result;
+      void main()
+      {
+         vec4 acc = vec4(0.0);
+         for (int i = 0; i < n; i++) {
+            for (int j = 0; j < m; j++) {
+               if (((i + j) & 1) == 0)
+                  continue;
+               acc += color * float(i * j);
+            }
+         }
+         result = acc;
+      })",
+   },
+   /* Integer and bit manipulation */
+   {
+      R"(#version 310 es
+      in vec4 pos;
+      in ivec4 attr;
+      flat out ivec4 bits;
+      void main()
+      {
+         gl_Position = pos;
+         bits = attr;
+      })",
+      R"(#version 310 es
+      precision highp float;
+      precision highp int;
+      flat in ivec4 bits;
+      out uvec4 result;
+      void main()
+      {
+         uvec4 u = uvec4(bits);
+         result = (u << 3u) | (u >> 29u) ^ uvec4(bitCount(u.x)) + (u & 0u);
+      })",
+   },
+};
+
+INSTANTIATE_TEST_SUITE_P(corpus, gl_nir_opts_test, testing::ValuesIn(corpus));
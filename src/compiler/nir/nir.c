@@ -35,6 +35,8 @@
 #include "util/u_qsort.h"
 #include "nir_builder.h"
 #include "nir_control_flow_private.h"
+#include "nir_parallel_private.h"
+#include "nir_pass_scheduler_private.h"
 #include "nir_worklist.h"
 
 #ifndef NDEBUG
@@ -200,11 +202,15 @@ nir_shader_create(void *mem_ctx,
 {
    nir_shader *shader = rzalloc(mem_ctx, nir_shader);
 
-   shader->gctx = gc_context(shader);
+   if (options && options->linear_instr_alloc)
+      shader->gctx = gc_context_linear(shader);
+   else
+      shader->gctx = gc_context(shader);
 
 #ifndef NDEBUG
    nir_process_debug_variable();
 #endif
+   nir_pass_stats_init();
 
    exec_list_make_empty(&shader->variables);
 
@@ -823,6 +829,9 @@ nir_tex_instr_create(nir_shader *shader, unsigned num_srcs)
 static gc_ctx *
 nir_instr_get_gc_context(nir_instr *instr)
 {
+   if (unlikely(nir_parallel_gctx))
+      return nir_parallel_gctx;
+
    return gc_get_context(nir_instr_get_gc_pointer(instr));
 }
 
@@ -840,7 +849,7 @@ nir_tex_instr_add_src(nir_tex_instr *tex,
                          &tex->src[i].src);
    }
 
-   gc_free(tex->src);
+   nir_gc_free(tex->src);
    tex->src = new_srcs;
 
    tex->src[tex->num_srcs].src_type = src_type;
@@ -904,6 +913,9 @@ nir_phi_instr_add_src(nir_phi_instr *instr, nir_block *pred, nir_def *src)
    nir_src_set_parent_instr(&phi_src->src, &instr->instr);
    exec_list_push_tail(&instr->srcs, &phi_src->node);
 
+   nir_pass_record_changes(NIR_PASS_CHANGE_INSTR(nir_instr_type_phi) |
+                           NIR_PASS_CHANGE_INSTR(src->parent_instr->type));
+
    return phi_src;
 }
 
@@ -1154,6 +1166,8 @@ nir_instr_insert(nir_cursor cursor, nir_instr *instr)
    if (instr->type == nir_instr_type_jump)
       nir_handle_add_jump(instr->block);
 
+   nir_pass_record_instr(instr);
+
    nir_function_impl *impl = nir_cf_node_get_function(&instr->block->cf_node);
    impl->valid_metadata &= ~nir_metadata_instr_index;
 }
@@ -1214,6 +1228,7 @@ remove_defs_uses(nir_instr *instr)
 void
 nir_instr_remove_v(nir_instr *instr)
 {
+   nir_pass_record_instr(instr);
    remove_defs_uses(instr);
    exec_node_remove(&instr->node);
 
@@ -1228,13 +1243,13 @@ nir_instr_free(nir_instr *instr)
 {
    switch (instr->type) {
    case nir_instr_type_tex:
-      gc_free(nir_instr_as_tex(instr)->src);
+      nir_gc_free(nir_instr_as_tex(instr)->src);
       break;
 
    case nir_instr_type_phi: {
       nir_phi_instr *phi = nir_instr_as_phi(instr);
       nir_foreach_phi_src_safe(phi_src, phi)
-         gc_free(phi_src);
+         nir_gc_free(phi_src);
       break;
    }
 
@@ -1242,7 +1257,7 @@ nir_instr_free(nir_instr *instr)
       break;
    }
 
-   gc_free(nir_instr_get_gc_pointer(instr));
+   nir_gc_free(nir_instr_get_gc_pointer(instr));
 }
 
 void
@@ -1543,11 +1558,13 @@ nir_instr_init_src(nir_instr *instr, nir_src *src, nir_def *def)
 {
    *src = nir_src_for_ssa(def);
    src_add_all_uses(src, instr, NULL);
+   nir_pass_record_instr(instr);
 }
 
 void
 nir_instr_clear_src(nir_instr *instr, nir_src *src)
 {
+   nir_pass_record_instr(instr);
    src_remove_all_uses(src);
    *src = NIR_SRC_INIT;
 }
@@ -1562,6 +1579,7 @@ nir_instr_move_src(nir_instr *dest_instr, nir_src *dest, nir_src *src)
    *dest = *src;
    *src = NIR_SRC_INIT;
    src_add_all_uses(dest, dest_instr, NULL);
+   nir_pass_record_instr(dest_instr);
 }
 
 void
@@ -1592,6 +1610,8 @@ void
 nir_def_rewrite_uses(nir_def *def, nir_def *new_ssa)
 {
    assert(def != new_ssa);
+   nir_pass_record_def_uses(def);
+   nir_pass_record_changes(NIR_PASS_CHANGE_INSTR(new_ssa->parent_instr->type));
    nir_foreach_use_including_if_safe(use_src, def) {
       nir_src_rewrite(use_src, new_ssa);
    }
@@ -1658,6 +1678,9 @@ nir_def_rewrite_uses_after(nir_def *def, nir_def *new_ssa,
    if (def == new_ssa)
       return;
 
+   nir_pass_record_def_uses(def);
+   nir_pass_record_changes(NIR_PASS_CHANGE_INSTR(new_ssa->parent_instr->type));
+
    nir_foreach_use_including_if_safe(use_src, def) {
       if (!nir_src_is_if(use_src)) {
          assert(nir_src_parent_instr(use_src) != def->parent_instr);
@@ -4674,6 +4674,56 @@ should_print_nir(UNUSED nir_shader *shader)
 }
 #endif /* NDEBUG */
 
+/** Aggregated statistics of NIR_PASS invocations, see nir_pass_stats.c */
+struct nir_pass_stats {
+   uint64_t calls;
+   uint64_t progress_calls;
+   /* Wall time, including the time of passes called from the pass. */
+   uint64_t time_ns;
+   uint64_t no_progress_time_ns;
+   /* Change in the number of instructions, summed over all calls. */
+   int64_t instr_delta;
+};
+
+typedef struct {
+   const char *pass;
+   const char *file;
+   unsigned line;
+   unsigned num_instrs;
+   bool traced;
+   int64_t start_ns;
+} nir_pass_stats_scope;
+
+extern bool nir_pass_stats_enabled;
+
+void nir_pass_stats_init(void);
+void nir_pass_stats_enable(bool enable);
+void nir_pass_stats_reset(void);
+bool nir_pass_stats_get(const char *pass, struct nir_pass_stats *stats);
+void nir_pass_stats_write_json(FILE *fp);
+
+void _nir_pass_stats_begin(nir_pass_stats_scope *scope, nir_shader *shader,
+                           const char *pass, const char *file, unsigned line);
+void _nir_pass_stats_end(nir_pass_stats_scope *scope, nir_shader *shader,
+                         bool progress);
+
+static inline void
+nir_pass_stats_begin(nir_pass_stats_scope *scope, nir_shader *shader,
+                     const char *pass, const char *file, unsigned line)
+{
+   scope->pass = NULL;
+   if (unlikely(nir_pass_stats_enabled))
+      _nir_pass_stats_begin(scope, shader, pass, file, line);
+}
+
+static inline void
+nir_pass_stats_end(nir_pass_stats_scope *scope, nir_shader *shader,
+                   bool progress)
+{
+   if (unlikely(scope->pass))
+      _nir_pass_stats_end(scope, shader, progress);
+}
+
 #define _PASS(pass, nir, do_pass)                                       \
    do {                                                                 \
       if (should_skip_nir(#pass)) {                                     \
@@ -4701,7 +4751,11 @@ should_print_nir(UNUSED nir_shader *shader)
    nir_metadata_set_validation_flag(nir);                                                   \
    if (should_print_nir(nir))                                                               \
       printf("%s\n", #pass);                                                                \
-   if (pass(nir, ##__VA_ARGS__)) {                                                          \
+   nir_pass_stats_scope _pass_stats;                                                        \
+   nir_pass_stats_begin(&_pass_stats, nir, #pass, __FILE__, __LINE__);                      \
+   bool _pass_progress = pass(nir, ##__VA_ARGS__);                                          \
+   nir_pass_stats_end(&_pass_stats, nir, _pass_progress);                                   \
+   if (_pass_progress) {                                                                    \
       nir_validate_shader(nir, "after " #pass " in " __FILE__ ":" NIR_STRINGIZE(__LINE__)); \
       UNUSED bool _;                                                                        \
       progress = true;                                                                      \
@@ -4720,7 +4774,12 @@ should_print_nir(UNUSED nir_shader *shader)
 #define NIR_PASS_V(nir, pass, ...) _PASS(pass, nir, {        \
    if (should_print_nir(nir))                                \
       printf("%s\n", #pass);                                 \
+   nir_pass_stats_scope _pass_stats;                         \
+   nir_pass_stats_begin(&_pass_stats, nir, #pass, __FILE__,  \
+                        __LINE__);                           \
    pass(nir, ##__VA_ARGS__);                                 \
+   /* There is no progress information, assume progress. */ \
+   nir_pass_stats_end(&_pass_stats, nir, true);              \
    nir_validate_shader(nir, "after " #pass " in " __FILE__); \
    if (should_print_nir(nir))                                \
       nir_print_shader(nir, stdout);                         \
@@ -4771,6 +4830,84 @@ do {                                                                 \
 #define NIR_LOOP_PASS_NOT_IDEMPOTENT(progress, skip, nir, pass, ...) \
    _NIR_LOOP_PASS(progress, false, skip, nir, pass, ##__VA_ARGS__)
 
+/** Classes of IR changes tracked by nir_pass_scheduler */
+#define NIR_PASS_CHANGE_INSTR(type) BITFIELD_BIT(type)
+#define NIR_PASS_CHANGE_CF          BITFIELD_BIT(31)
+#define NIR_PASS_CHANGE_ALL         (~0u)
+
+typedef struct nir_pass_scheduler nir_pass_scheduler;
+
+/* State of one scheduled pass run, kept by NIR_SCHED_PASS */
+typedef struct nir_pass_scheduler_frame {
+   uint32_t changes;
+   uint32_t *prev_changes;
+} nir_pass_scheduler_frame;
+
+nir_pass_scheduler *nir_pass_scheduler_create(void *mem_ctx);
+void nir_pass_scheduler_invalidate(nir_pass_scheduler *sched, uint32_t changes);
+bool nir_pass_scheduler_begin(nir_pass_scheduler *sched, const void *site,
+                              const char *name,
+                              nir_pass_scheduler_frame *frame);
+void nir_pass_scheduler_end(nir_pass_scheduler *sched, const void *site,
+                            nir_pass_scheduler_frame *frame, bool progress);
+
+/* Like NIR_LOOP_PASS, but skips a pass only if nothing it depends on changed
+ * since it last ran without making progress. "sched" is a
+ * nir_pass_scheduler, which tracks the changes made by the passes run
+ * through it, see nir_pass_scheduler.c.
+ *
+ * Example:
+ * nir_pass_scheduler *sched = nir_pass_scheduler_create(NULL);
+ * bool progress;
+ * do {
+ *    progress = false;
+ *    NIR_SCHED_PASS(progress, sched, nir, nir_copy_prop);
+ *    NIR_SCHED_PASS(progress, sched, nir, nir_opt_algebraic);
+ *    ...
+ * } while (progress);
+ * ralloc_free(sched);
+ *
+ * Passes are tracked per call site, so calling the same pass with different
+ * options is fine. All passes modifying the shader between two runs of a
+ * scheduled pass must run through the scheduler too, otherwise
+ * nir_pass_scheduler_invalidate() must be called. A scheduled pass may run
+ * scheduled passes itself. A NULL scheduler runs every pass.
+ */
+#define NIR_SCHED_PASS(progress, sched, nir, pass, ...)                    \
+do {                                                                       \
+   const char *nir_sched_pass_site = __FILE__ ":" NIR_STRINGIZE(__LINE__); \
+   nir_pass_scheduler_frame nir_sched_pass_frame;                          \
+   if (nir_pass_scheduler_begin(sched, nir_sched_pass_site, #pass,         \
+                                &nir_sched_pass_frame)) {                  \
+      bool nir_sched_pass_progress = false;                                \
+      NIR_PASS(nir_sched_pass_progress, nir, pass, ##__VA_ARGS__);         \
+      nir_pass_scheduler_end(sched, nir_sched_pass_site,                   \
+                             &nir_sched_pass_frame,                        \
+                             nir_sched_pass_progress);                     \
+      UNUSED bool _ = false;                                               \
+      progress |= nir_sched_pass_progress;                                 \
+   }                                                                       \
+} while (0)
+
+struct util_queue;
+
+typedef bool (*nir_parallel_impl_cb)(nir_shader *shader, void *data);
+
+/**
+ * Calls cb for every function with a body, in parallel on the threads of
+ * queue, and returns whether any call returned true.
+ *
+ * Each call gets a temporary shader containing only the function, which
+ * shares the shader_info and the variables of the original shader, so cb may
+ * only run passes that are local to a function body. They must not change
+ * the shader_info, the variables or the function list, nor call nir_sweep().
+ * The result is the same as calling cb on the shader itself, which is also
+ * what happens if queue is NULL or there is at most one function body.
+ */
+bool nir_shader_foreach_impl_parallel(nir_shader *shader,
+                                      struct util_queue *queue,
+                                      nir_parallel_impl_cb cb, void *data);
+
 #define NIR_SKIP(name) should_skip_nir(#name)
 
 /** An instruction filtering callback with writemask
@@ -6064,6 +6201,15 @@ typedef struct nir_opt_access_options {
 } nir_opt_access_options;
 
 bool nir_opt_access(nir_shader *shader, const nir_opt_access_options *options);
+
+/**
+ * Makes the algebraic passes interpret their search tables instead of using
+ * the generated matchers.
+ *
+ * This is only meant for testing and benchmarking the generated matchers.
+ */
+extern bool nir_search_use_interpreter;
+
 bool nir_opt_algebraic(nir_shader *shader);
 bool nir_opt_algebraic_before_ffma(nir_shader *shader);
 bool nir_opt_algebraic_before_lower_int64(nir_shader *shader);
@@ -6236,6 +6382,7 @@ bool nir_opt_ray_query_ranges(nir_shader *shader);
 bool nir_opt_tex_skip_helpers(nir_shader *shader, bool no_add_divergence);
 
 void nir_sweep(nir_shader *shader);
+void nir_steal_impl(void *mem_ctx, nir_function_impl *impl);
 
 nir_intrinsic_op nir_intrinsic_from_system_value(gl_system_value val);
 gl_system_value nir_system_value_from_intrinsic(nir_intrinsic_op intrin);
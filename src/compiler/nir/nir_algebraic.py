@@ -23,6 +23,7 @@
 import ast
 from collections import defaultdict
 import itertools
+import math
 import struct
 import sys
 import mako.template
@@ -31,7 +32,7 @@ import traceback
 
 from nir_opcodes import opcodes, type_sizes
 
-# This should be the same as NIR_SEARCH_MAX_COMM_OPS in nir_search.c
+# This should be the same as NIR_SEARCH_MAX_COMM_OPS in nir_search.h
 nir_search_max_comm_ops = 8
 
 # These opcodes are only employed by nir_search.  This provides a mapping from
@@ -281,6 +282,17 @@ class Constant(Value):
       elif isinstance(self.value, float):
          return "nir_type_float"
 
+   def c_literal(self):
+      """Returns the value as a C literal of the type the matcher compares
+      the constant with."""
+      if not isinstance(self.value, float):
+         return self.hex()
+      if math.isnan(self.value):
+         return 'NAN'
+      if math.isinf(self.value):
+         return 'INFINITY' if self.value > 0 else '-INFINITY'
+      return repr(self.value)
+
    def equivalent(self, other):
       """Check that two constants are equivalent.
 
@@ -465,10 +477,166 @@ class Expression(Value):
    def c_opcode(self):
       return get_c_opcode(self.opcode)
 
+   def c_opcode_test(self, instr):
+      """Returns a C expression checking that the nir_alu_instr named instr
+      matches the opcode of this expression."""
+      if self.opcode not in conv_opcode_types:
+         return '{}->op == nir_op_{}'.format(instr, self.opcode)
+
+      if conv_opcode_types[self.opcode] == 'float':
+         sizes = (16, 32, 64)
+      else:
+         sizes = (8, 16, 32, 64)
+      return ' || '.join('{}->op == nir_op_{}{}'.format(instr, self.opcode, size)
+                         for size in sizes)
+
    def render(self, cache):
       srcs = "".join(src.render(cache) for src in self.sources)
       return srcs + super(Expression, self).render(cache)
 
+   __matcher_template = mako.template.Template("""
+static bool
+${name}(nir_alu_instr *instr, unsigned num_components,
+${' ' * len(name)} const uint8_t *swizzle, nir_search_state *state)
+{
+   /* ${expr} */
+   if (!(${expr.c_opcode_test('instr')}))
+      return false;
+% if expr.c_bit_size > 0:
+   if (instr->def.bit_size != ${expr.c_bit_size})
+      return false;
+% endif
+% if expr.nsz:
+   if (nir_alu_instr_is_signed_zero_preserve(instr))
+      return false;
+% endif
+% if expr.nnan:
+   if (nir_alu_instr_is_nan_preserve(instr))
+      return false;
+% endif
+% if expr.ninf:
+   if (nir_alu_instr_is_inf_preserve(instr))
+      return false;
+% endif
+% if expr.cond:
+   if (!${expr.cond}(instr))
+      return false;
+% endif
+
+% if expr.inexact:
+   state->inexact_match = true;
+% endif
+% if not expr.ignore_exact:
+   state->has_exact_alu |= instr->exact;
+% endif
+   if (state->inexact_match && state->has_exact_alu)
+      return false;
+
+% if expr.swizzle >= 0:
+   if (num_components != 1 || swizzle[0] != ${expr.swizzle})
+      return false;
+
+% elif output_size != 0:
+   for (unsigned i = 0; i < num_components; i++) {
+      if (swizzle[i] != i)
+         return false;
+   }
+
+% endif
+% if flip:
+   const unsigned flip = (state->comm_op_direction >> ${expr.comm_expr_idx}) & 1;
+
+% endif
+% if any(isinstance(src, (Constant, Expression)) for src in expr.sources):
+   /* Reject on the constants and opcodes of the sources before binding any
+    * variables.
+    */
+% endif
+% for i, src in enumerate(expr.sources):
+% if src.c_bit_size > 0:
+   if (nir_src_bit_size(instr->src[${src_index(i)}].src) != ${src.c_bit_size})
+      return false;
+% endif
+% if isinstance(src, Constant):
+   uint8_t swizzle${i}[NIR_MAX_VEC_COMPONENTS];
+   const unsigned num_components${i} =
+      nir_search_src_swizzle(instr, ${src_index(i)}, num_components, swizzle, swizzle${i});
+% if src.type() == 'nir_type_float':
+   if (!nir_search_src_is_float_const(instr->src[${src_index(i)}].src, num_components${i},
+                                      swizzle${i}, ${src.c_literal()}))
+% else:
+   if (!nir_search_src_is_int_const(instr->src[${src_index(i)}].src, num_components${i},
+                                    swizzle${i}, ${src.c_literal()}))
+% endif
+      return false;
+% elif isinstance(src, Expression):
+   nir_alu_instr *src${i} = nir_src_as_alu_instr(instr->src[${src_index(i)}].src);
+   if (src${i} == NULL || !(${src.c_opcode_test('src' + str(i))}))
+      return false;
+% endif
+% endfor
+% for i, src in enumerate(expr.sources):
+% if not isinstance(src, Constant):
+% if i > 0 or any(isinstance(src, (Constant, Expression)) for src in expr.sources):
+
+% endif
+   uint8_t swizzle${i}[NIR_MAX_VEC_COMPONENTS];
+   const unsigned num_components${i} =
+      nir_search_src_swizzle(instr, ${src_index(i)}, num_components, swizzle, swizzle${i});
+% if isinstance(src, Variable):
+   if (!nir_search_match_variable(state, &${values}[${src.array_index}].variable,
+                                  instr, ${src_index(i)}, num_components${i}, swizzle${i}))
+      return false;
+% else:
+   if (!${src.matcher_name}(src${i}, num_components${i}, swizzle${i}, state))
+      return false;
+% endif
+% endif
+% endfor
+
+   return true;
+}
+""")
+
+   def render_matcher(self, pass_name, cache):
+      """Generates the C matcher function for this search expression and
+      its subexpressions, and stores its name in self.matcher_name.
+
+      Identical matchers are only emitted once.  The values must have been
+      rendered before, so that variables know their index in the values
+      array.
+      """
+      code = "".join(src.render_matcher(pass_name, cache)
+                     for src in self.sources if isinstance(src, Expression))
+
+      flip = 0 <= self.comm_expr_idx < nir_search_max_comm_ops
+      if self.opcode in conv_opcode_types:
+         output_size = 0
+      else:
+         output_size = opcodes[self.opcode].output_size
+
+      def src_index(i):
+         return '{} ^ flip'.format(i) if flip and i < 2 else str(i)
+
+      def render(name):
+         return self.__matcher_template.render(name=name, expr=self,
+                                               flip=flip,
+                                               output_size=output_size,
+                                               src_index=src_index,
+                                               values=pass_name + '_values',
+                                               Constant=Constant,
+                                               Variable=Variable,
+                                               Expression=Expression)
+
+      key = render('match')
+      if key in cache:
+         self.matcher_name = cache[key]
+         return code
+
+      self.matcher_name = '{}_match_{}'.format(pass_name, len(cache))
+      cache[key] = self.matcher_name
+      return code + render(self.matcher_name)
+
 class BitSizeValidator(object):
    """A class for validating bit sizes of expressions.
 
@@ -1085,6 +1253,8 @@ class TreeAutomaton(object):
          process_new_states()
 
 _algebraic_pass_template = mako.template.Template("""
+#include <math.h>
+
 #include "nir.h"
 #include "nir_builder.h"
 #include "nir_search.h"
@@ -1122,12 +1292,19 @@ static const nir_search_variable_cond ${pass_name}_variable_cond[] = {
 };
 % endif
 
+<%
+  matchers = {}
+  matcher_code = "".join(xform.search.render_matcher(pass_name, matchers)
+                         for xform in xforms)
+%>
+${matcher_code}
+
 static const struct transform ${pass_name}_transforms[] = {
 % for i in automaton.state_patterns:
 % if i is not None:
-   { ${xforms[i].search.array_index}, ${xforms[i].replace.array_index}, ${xforms[i].condition_index} },
+   { ${xforms[i].search.array_index}, ${xforms[i].replace.array_index}, ${xforms[i].condition_index}, ${xforms[i].search.matcher_name} },
 % else:
-   { ~0, ~0, ~0 }, /* Sentinel */
+   { ~0, ~0, ~0, NULL }, /* Sentinel */
 
 % endif
 % endfor
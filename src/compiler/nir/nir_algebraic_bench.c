@@ -0,0 +1,136 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/*
+ * Benchmarks nir_opt_algebraic with the generated matchers against the
+ * interpreted search tables.
+ *
+ * Each argument is a file containing a shader serialized with
+ * nir_serialize().  Every shader is run through a small optimization loop
+ * once with each matcher, and only the time spent in nir_opt_algebraic is
+ * measured.  The optimized shaders must be identical for both matchers.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nir.h"
+#include "nir_serialize.h"
+#include "util/blob.h"
+#include "util/os_file.h"
+#include "util/os_time.h"
+
+static const nir_shader_compiler_options options = { 0 };
+
+static int64_t
+optimize(const void *data, size_t size, unsigned iterations,
+         bool interpret, struct blob *result)
+{
+   int64_t time_ns = 0;
+
+   nir_search_use_interpreter = interpret;
+
+   for (unsigned i = 0; i < iterations; i++) {
+      struct blob_reader reader;
+      blob_reader_init(&reader, data, size);
+
+      nir_shader *nir = nir_deserialize(NULL, &options, &reader);
+      if (!nir)
+         return -1;
+
+      bool progress;
+      do {
+         int64_t start = os_time_get_nano();
+         progress = nir_opt_algebraic(nir);
+         time_ns += os_time_get_nano() - start;
+
+         progress |= nir_opt_constant_folding(nir);
+         progress |= nir_copy_prop(nir);
+         progress |= nir_opt_dce(nir);
+      } while (progress);
+
+      if (i == 0)
+         nir_serialize(result, nir, false);
+
+      ralloc_free(nir);
+   }
+
+   return time_ns;
+}
+
+static void
+usage(const char *name)
+{
+   fprintf(stderr, "usage: %s [-n <iterations>] <serialized NIR>...\n", name);
+}
+
+int
+main(int argc, char **argv)
+{
+   unsigned iterations = 10;
+   int first = 1;
+
+   if (argc > 2 && strcmp(argv[1], "-n") == 0) {
+      iterations = MAX2(atoi(argv[2]), 1);
+      first = 3;
+   }
+
+   if (first >= argc) {
+      usage(argv[0]);
+      return 1;
+   }
+
+   glsl_type_singleton_init_or_ref();
+
+   int64_t total_ns[2] = { 0 };
+   int ret = 0;
+
+   for (int i = first; i < argc; i++) {
+      size_t size;
+      char *data = os_read_file(argv[i], &size);
+      if (!data) {
+         fprintf(stderr, "%s: failed to read file\n", argv[i]);
+         ret = 1;
+         continue;
+      }
+
+      struct blob results[2];
+      int64_t time_ns[2];
+      for (unsigned m = 0; m < 2; m++) {
+         blob_init(&results[m]);
+         time_ns[m] = optimize(data, size, iterations, m == 1, &results[m]);
+      }
+
+      if (time_ns[0] < 0 || time_ns[1] < 0) {
+         fprintf(stderr, "%s: failed to deserialize shader\n", argv[i]);
+         ret = 1;
+      } else if (results[0].size != results[1].size ||
+                 memcmp(results[0].data, results[1].data, results[0].size)) {
+         fprintf(stderr, "%s: generated and interpreted matchers disagree\n",
+                 argv[i]);
+         ret = 1;
+      } else {
+         printf("%s: generated %" PRId64 " us, interpreted %" PRId64 " us\n",
+                argv[i], time_ns[0] / 1000, time_ns[1] / 1000);
+         total_ns[0] += time_ns[0];
+         total_ns[1] += time_ns[1];
+      }
+
+      blob_finish(&results[0]);
+      blob_finish(&results[1]);
+      free(data);
+   }
+
+   printf("total: generated %" PRId64 " us, interpreted %" PRId64 " us",
+          total_ns[0] / 1000, total_ns[1] / 1000);
+   if (total_ns[0] > 0)
+      printf(", speedup %.2fx", (double)total_ns[1] / total_ns[0]);
+   printf("\n");
+
+   glsl_type_singleton_decref();
+
+   return ret;
+}
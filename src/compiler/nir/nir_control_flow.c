@@ -26,6 +26,8 @@
  */
 
 #include "nir_control_flow_private.h"
+#include "nir_parallel_private.h"
+#include "nir_pass_scheduler_private.h"
 
 /**
  * \name Control flow modification
@@ -45,6 +47,14 @@
  */
 /*@{*/
 
+/* Changes to the control flow also change the predecessors of phis. */
+static inline void
+record_cf_change(void)
+{
+   nir_pass_record_changes(NIR_PASS_CHANGE_CF |
+                           NIR_PASS_CHANGE_INSTR(nir_instr_type_phi));
+}
+
 static inline void
 block_add_pred(nir_block *block, nir_block *pred)
 {
@@ -430,6 +440,7 @@ void
 nir_loop_add_continue_construct(nir_loop *loop)
 {
    assert(!nir_loop_has_continue_construct(loop));
+   record_cf_change();
 
    nir_block *cont = nir_block_create(ralloc_parent(loop));
    exec_list_push_tail(&loop->continue_list, &cont->cf_node.node);
@@ -451,6 +462,7 @@ void
 nir_loop_remove_continue_construct(nir_loop *loop)
 {
    assert(nir_cf_list_is_empty_block(&loop->continue_list));
+   record_cf_change();
 
    /* change predecessors and successors */
    nir_block *header = nir_loop_first_block(loop);
@@ -472,7 +484,7 @@ remove_phi_src(nir_block *block, nir_block *pred)
          if (src->pred == pred) {
             list_del(&src->src.use_link);
             exec_node_remove(&src->node);
-            gc_free(src);
+            nir_gc_free(src);
          }
       }
    }
@@ -619,6 +631,7 @@ nir_cf_node_insert(nir_cursor cursor, nir_cf_node *node)
 {
    nir_block *before, *after;
 
+   record_cf_change();
    split_block_cursor(cursor, &before, &after);
 
    if (node->type == nir_cf_node_block) {
@@ -720,6 +733,8 @@ nir_cf_extract(nir_cf_list *extracted, nir_cursor begin, nir_cursor end)
       return begin;
    }
 
+   record_cf_change();
+
    split_block_cursor(begin, &block_before, &block_begin);
 
    /* Splitting a block twice with two cursors created before either split is
@@ -832,6 +847,8 @@ nir_cf_reinsert(nir_cf_list *cf_list, nir_cursor cursor)
    if (exec_list_is_empty(&cf_list->list))
       return cursor;
 
+   record_cf_change();
+
    nir_function_impl *cursor_impl =
       nir_cf_node_get_function(&nir_cursor_current_block(cursor)->cf_node);
    if (cf_list->impl != cursor_impl) {
@@ -856,6 +873,9 @@ nir_cf_reinsert(nir_cf_list *cf_list, nir_cursor cursor)
 void
 nir_cf_delete(nir_cf_list *cf_list)
 {
+   /* The deleted instructions don't record their removal. */
+   nir_pass_record_changes(NIR_PASS_CHANGE_ALL);
+
    foreach_list_typed(nir_cf_node, node, node, &cf_list->list) {
       cleanup_cf_node(node, cf_list->impl);
    }
@@ -0,0 +1,146 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/*
+ * Runs function-local passes on the function bodies of a shader in parallel.
+ *
+ * Every function with a body is moved to a temporary shader of its own
+ * before the jobs are queued, together with the ralloc-allocated memory of
+ * the body. The temporary shader shares the shader_info and the variable
+ * list of the original shader, so that passes and the validator see the
+ * same global state. Instructions and blocks created by the passes are
+ * allocated from the temporary shader, and instructions of the original
+ * shader are not freed while the jobs run, because the GC context of the
+ * original shader is shared by all threads.
+ *
+ * Once all jobs finished, the memory of the temporary shaders is merged back
+ * and the functions are put back in their original order.
+ */
+
+#include "nir.h"
+#include "nir_parallel_private.h"
+
+#include "util/u_queue.h"
+
+__THREAD_INITIAL_EXEC gc_ctx *nir_parallel_gctx;
+
+struct parallel_job {
+   nir_shader *shader;
+   nir_parallel_impl_cb cb;
+   void *data;
+   bool progress;
+
+   struct util_queue_fence fence;
+};
+
+static void
+parallel_job_execute(void *_job, UNUSED void *gdata, UNUSED int thread_index)
+{
+   struct parallel_job *job = _job;
+
+   nir_parallel_gctx = job->shader->gctx;
+   job->progress = job->cb(job->shader, job->data);
+   nir_parallel_gctx = NULL;
+}
+
+static nir_shader *
+create_function_shader(nir_shader *shader, nir_function *func)
+{
+   nir_shader *fs = nir_shader_create(NULL, shader->info.stage,
+                                      shader->options, NULL);
+
+   fs->info = shader->info;
+   fs->has_debug_info = shader->has_debug_info;
+
+   /* Share the variables without copying the list, so that the nodes still
+    * link to the list of the original shader. Iterating works as long as
+    * nothing is added or removed.
+    */
+   if (!exec_list_is_empty(&shader->variables))
+      fs->variables = shader->variables;
+
+   exec_node_remove(&func->node);
+   exec_list_push_tail(&fs->functions, &func->node);
+   func->shader = fs;
+
+   nir_steal_impl(fs, func->impl);
+
+   return fs;
+}
+
+static void
+merge_function_shader(nir_shader *shader, nir_shader *fs)
+{
+   gc_context_merge(shader->gctx, fs->gctx);
+   ralloc_free(fs->gctx);
+   fs->gctx = NULL;
+
+   ralloc_adopt(shader, fs);
+   ralloc_free(fs);
+}
+
+bool
+nir_shader_foreach_impl_parallel(nir_shader *shader, struct util_queue *queue,
+                                 nir_parallel_impl_cb cb, void *data)
+{
+   unsigned num_functions = 0, num_impls = 0;
+   nir_foreach_function(func, shader) {
+      num_functions++;
+      if (func->impl)
+         num_impls++;
+   }
+
+   if (!queue || num_impls <= 1)
+      return cb(shader, data);
+
+   nir_function **functions = malloc(num_functions * sizeof(*functions));
+   struct parallel_job *jobs = calloc(num_impls, sizeof(*jobs));
+   if (!functions || !jobs) {
+      free(functions);
+      free(jobs);
+      return cb(shader, data);
+   }
+
+   unsigned i = 0, j = 0;
+   nir_foreach_function_safe(func, shader) {
+      functions[i++] = func;
+      if (!func->impl)
+         continue;
+
+      struct parallel_job *job = &jobs[j++];
+      job->shader = create_function_shader(shader, func);
+      job->cb = cb;
+      job->data = data;
+      util_queue_fence_init(&job->fence);
+   }
+
+   for (j = 0; j < num_impls; j++) {
+      util_queue_add_job(queue, &jobs[j], &jobs[j].fence,
+                         parallel_job_execute, NULL, 0);
+   }
+
+   bool progress = false;
+   for (j = 0; j < num_impls; j++) {
+      util_queue_fence_wait(&jobs[j].fence);
+      util_queue_fence_destroy(&jobs[j].fence);
+      progress |= jobs[j].progress;
+   }
+
+   /* Put everything back. */
+   for (i = 0; i < num_functions; i++)
+      exec_node_remove(&functions[i]->node);
+
+   for (i = 0; i < num_functions; i++) {
+      exec_list_push_tail(&shader->functions, &functions[i]->node);
+      functions[i]->shader = shader;
+   }
+
+   for (j = 0; j < num_impls; j++)
+      merge_function_shader(shader, jobs[j].shader);
+
+   free(functions);
+   free(jobs);
+
+   return progress;
+}
@@ -0,0 +1,31 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef NIR_PARALLEL_PRIVATE_H
+#define NIR_PARALLEL_PRIVATE_H
+
+#include "util/u_thread.h"
+#include "nir.h"
+
+/* The GC context of the temporary shader that the current thread works on in
+ * nir_shader_foreach_impl_parallel(), or NULL.
+ *
+ * The instructions that existed before belong to the GC context of the
+ * original shader, which is shared by all threads. Objects allocated for
+ * them are taken from this context instead, and freeing them is left to the
+ * next nir_sweep().
+ */
+extern __THREAD_INITIAL_EXEC gc_ctx *nir_parallel_gctx;
+
+static inline void
+nir_gc_free(void *ptr)
+{
+   if (unlikely(nir_parallel_gctx) && ptr &&
+       gc_get_context(ptr) != nir_parallel_gctx)
+      return;
+
+   gc_free(ptr);
+}
+
+#endif /* NIR_PARALLEL_PRIVATE_H */
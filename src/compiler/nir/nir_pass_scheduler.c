@@ -0,0 +1,229 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/*
+ * Skips passes of an optimization loop that cannot make progress.
+ *
+ * While a pass runs through NIR_SCHED_PASS, the core IR helpers (instruction
+ * insertion and removal, nir_def_rewrite_uses, control flow manipulation)
+ * record which classes of the IR are changed: one class per instruction
+ * type, plus control flow. Changing the sources of an instruction changes
+ * its class and the classes of the instructions it reads, whose uses
+ * changed.
+ *
+ * Each pass known to the scheduler declares the classes whose changes may
+ * give it new opportunities, and the classes it changes behind the back of
+ * the recording helpers, e.g. with nir_src_rewrite() or by changing the
+ * opcode of an instruction. A pass that ran without progress is skipped as
+ * long as none of the classes it reads changed since then. Passes that are
+ * not in the table read and change everything, so they are only skipped if
+ * nothing changed at all.
+ *
+ * NIR_PASS_SCHEDULER=false makes nir_pass_scheduler_create() return NULL,
+ * which runs every pass, to compare the results and compile times.
+ */
+
+#include "nir.h"
+#include "nir_pass_scheduler_private.h"
+
+#include <string.h>
+
+#include "util/hash_table.h"
+#include "util/u_debug.h"
+
+__THREAD_INITIAL_EXEC uint32_t *nir_pass_changes;
+
+#define ALU       NIR_PASS_CHANGE_INSTR(nir_instr_type_alu)
+#define DEREF     NIR_PASS_CHANGE_INSTR(nir_instr_type_deref)
+#define TEX       NIR_PASS_CHANGE_INSTR(nir_instr_type_tex)
+#define INTRINSIC NIR_PASS_CHANGE_INSTR(nir_instr_type_intrinsic)
+#define UNDEF     NIR_PASS_CHANGE_INSTR(nir_instr_type_undef)
+#define PHI       NIR_PASS_CHANGE_INSTR(nir_instr_type_phi)
+#define CF        NIR_PASS_CHANGE_CF
+#define ALL       NIR_PASS_CHANGE_ALL
+
+struct pass_info {
+   const char *name;
+
+   /* Changes which may let the pass make progress again. */
+   uint32_t reads;
+
+   /* Changes made by the pass that are not recorded by the IR helpers. */
+   uint32_t modifies;
+
+   /* Running the pass again right after it made progress does nothing. */
+   bool idempotent;
+};
+
+static const struct pass_info pass_infos[] = {
+   { "nir_copy_prop",              ALU,                        ALL,       true },
+   { "nir_opt_algebraic",          ALU | PHI | INTRINSIC | CF, 0,         false },
+   { "nir_opt_constant_folding",   ALU | DEREF | INTRINSIC | TEX, TEX,    true },
+   { "nir_opt_cse",                ALL,                        0,         true },
+   { "nir_opt_dce",                ALL,                        0,         true },
+   { "nir_opt_phi_precision",      ALU | PHI,                  ALU,       false },
+   { "nir_opt_remove_phis",        PHI,                        0,         true },
+   { "nir_opt_undef",              ALU | INTRINSIC | UNDEF | CF, INTRINSIC, false },
+};
+
+static const struct pass_info unknown_pass_info = {
+   .reads = ALL,
+   .modifies = ALL,
+};
+
+struct scheduled_pass {
+   const struct pass_info *info;
+
+   /* Generation at which the pass last ran without making progress, or 0
+    * if it has to run.
+    */
+   uint64_t clean_generation;
+};
+
+struct nir_pass_scheduler {
+   struct hash_table *passes;
+
+   uint64_t generation;
+   uint64_t change_generation[32];
+};
+
+static const struct pass_info *
+lookup_pass_info(const char *name)
+{
+   for (unsigned i = 0; i < ARRAY_SIZE(pass_infos); i++) {
+      if (strcmp(pass_infos[i].name, name) == 0)
+         return &pass_infos[i];
+   }
+
+   return &unknown_pass_info;
+}
+
+static bool
+record_src_cb(nir_src *src, void *_changes)
+{
+   uint32_t *changes = _changes;
+
+   if (src->ssa)
+      *changes |= NIR_PASS_CHANGE_INSTR(src->ssa->parent_instr->type);
+   return true;
+}
+
+void
+_nir_pass_record_instr(nir_instr *instr)
+{
+   uint32_t changes = NIR_PASS_CHANGE_INSTR(instr->type);
+
+   if (instr->type == nir_instr_type_jump)
+      changes |= NIR_PASS_CHANGE_CF;
+
+   nir_foreach_src(instr, record_src_cb, &changes);
+
+   *nir_pass_changes |= changes;
+}
+
+void
+_nir_pass_record_def_uses(nir_def *def)
+{
+   uint32_t changes = NIR_PASS_CHANGE_INSTR(def->parent_instr->type);
+
+   nir_foreach_use_including_if(src, def) {
+      if (nir_src_is_if(src))
+         changes |= NIR_PASS_CHANGE_CF;
+      else
+         changes |= NIR_PASS_CHANGE_INSTR(nir_src_parent_instr(src)->type);
+   }
+
+   *nir_pass_changes |= changes;
+}
+
+nir_pass_scheduler *
+nir_pass_scheduler_create(void *mem_ctx)
+{
+   if (!debug_get_bool_option("NIR_PASS_SCHEDULER", true))
+      return NULL;
+
+   nir_pass_scheduler *sched = rzalloc(mem_ctx, nir_pass_scheduler);
+   if (!sched)
+      return NULL;
+
+   sched->passes = _mesa_pointer_hash_table_create(sched);
+   sched->generation = 1;
+   return sched;
+}
+
+void
+nir_pass_scheduler_invalidate(nir_pass_scheduler *sched, uint32_t changes)
+{
+   if (!sched)
+      return;
+
+   sched->generation++;
+   u_foreach_bit(i, changes)
+      sched->change_generation[i] = sched->generation;
+}
+
+bool
+nir_pass_scheduler_begin(nir_pass_scheduler *sched, const void *site,
+                         const char *name, nir_pass_scheduler_frame *frame)
+{
+   if (!sched)
+      return true;
+
+   struct hash_entry *entry = _mesa_hash_table_search(sched->passes, site);
+   struct scheduled_pass *pass;
+
+   if (entry) {
+      pass = entry->data;
+   } else {
+      pass = rzalloc(sched, struct scheduled_pass);
+      pass->info = lookup_pass_info(name);
+      _mesa_hash_table_insert(sched->passes, site, pass);
+   }
+
+   if (pass->clean_generation) {
+      bool dirty = false;
+      u_foreach_bit(i, pass->info->reads) {
+         if (sched->change_generation[i] > pass->clean_generation) {
+            dirty = true;
+            break;
+         }
+      }
+
+      if (!dirty)
+         return false;
+   }
+
+   /* Scheduled passes may be nested, e.g. when a pass runs its own
+    * optimization loop, so each one records into the frame of its caller.
+    */
+   frame->changes = 0;
+   frame->prev_changes = nir_pass_changes;
+   nir_pass_changes = &frame->changes;
+   return true;
+}
+
+void
+nir_pass_scheduler_end(nir_pass_scheduler *sched, const void *site,
+                       nir_pass_scheduler_frame *frame, bool progress)
+{
+   if (!sched)
+      return;
+
+   struct hash_entry *entry = _mesa_hash_table_search(sched->passes, site);
+   struct scheduled_pass *pass = entry->data;
+
+   /* The changes of a nested pass are changes of the enclosing one too. */
+   nir_pass_changes = frame->prev_changes;
+
+   if (!progress) {
+      pass->clean_generation = sched->generation;
+      return;
+   }
+
+   uint32_t changes = frame->changes | pass->info->modifies;
+   nir_pass_record_changes(changes);
+
+   nir_pass_scheduler_invalidate(sched, changes);
+   pass->clean_generation = pass->info->idempotent ? sched->generation : 0;
+}
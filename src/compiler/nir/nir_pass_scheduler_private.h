@@ -0,0 +1,53 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef NIR_PASS_SCHEDULER_PRIVATE_H
+#define NIR_PASS_SCHEDULER_PRIVATE_H
+
+#include "util/u_thread.h"
+#include "nir.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Changes made by the pass currently run by nir_pass_scheduler on this
+ * thread, as a mask of NIR_PASS_CHANGE_* bits, or NULL if no scheduled pass
+ * is running.
+ */
+extern __THREAD_INITIAL_EXEC uint32_t *nir_pass_changes;
+
+void _nir_pass_record_instr(nir_instr *instr);
+void _nir_pass_record_def_uses(nir_def *def);
+
+static inline void
+nir_pass_record_changes(uint32_t changes)
+{
+   if (unlikely(nir_pass_changes))
+      *nir_pass_changes |= changes;
+}
+
+/* Records that an instruction was inserted, removed or had its sources
+ * changed. This also changes the uses of the instructions it reads.
+ */
+static inline void
+nir_pass_record_instr(nir_instr *instr)
+{
+   if (unlikely(nir_pass_changes))
+      _nir_pass_record_instr(instr);
+}
+
+/* Records that the uses of a def are about to be rewritten. */
+static inline void
+nir_pass_record_def_uses(nir_def *def)
+{
+   if (unlikely(nir_pass_changes))
+      _nir_pass_record_def_uses(def);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NIR_PASS_SCHEDULER_PRIVATE_H */
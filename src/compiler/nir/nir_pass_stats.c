@@ -0,0 +1,329 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/*
+ * Per-pass profiling for NIR_PASS/NIR_PASS_V.
+ *
+ * When enabled, every pass invocation records its wall time, the change in
+ * the number of instructions of the shader and whether it made progress.
+ * Results are aggregated per call site for the whole process, so running
+ * shader-db with NIR_PASS_STATS set gives a summary of where optimization
+ * loops spend their time, including time spent in passes that end up not
+ * making progress.
+ *
+ * NIR_PASS_STATS=<path> enables the profiling at startup and writes a JSON
+ * summary to <path> (or to stderr for "stderr") when the process exits.
+ * If perfetto tracing is active, each pass invocation is also emitted as a
+ * slice and the instruction count as a counter track.
+ */
+
+#include "nir.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util/hash_table.h"
+#include "util/os_misc.h"
+#include "util/os_time.h"
+#include "util/perf/u_perfetto.h"
+#include "util/simple_mtx.h"
+
+bool nir_pass_stats_enabled = false;
+
+struct pass_site {
+   const char *pass;
+   const char *file;
+   unsigned line;
+
+   struct nir_pass_stats stats;
+};
+
+static simple_mtx_t pass_stats_mtx = SIMPLE_MTX_INITIALIZER;
+static struct hash_table *pass_sites;
+static const char *pass_stats_path;
+
+static uint32_t
+pass_site_hash(const void *key)
+{
+   const struct pass_site *site = key;
+   uint32_t hash = _mesa_hash_string(site->pass);
+
+   hash = _mesa_hash_data_with_seed(site->file, strlen(site->file), hash);
+   return _mesa_hash_data_with_seed(&site->line, sizeof(site->line), hash);
+}
+
+static bool
+pass_site_equal(const void *a, const void *b)
+{
+   const struct pass_site *sa = a, *sb = b;
+
+   return sa->line == sb->line &&
+          strcmp(sa->pass, sb->pass) == 0 &&
+          strcmp(sa->file, sb->file) == 0;
+}
+
+static unsigned
+count_instrs(nir_shader *shader)
+{
+   unsigned count = 0;
+
+   nir_foreach_function_impl(impl, shader) {
+      nir_foreach_block(block, impl) {
+         count += exec_list_length(&block->instr_list);
+      }
+   }
+
+   return count;
+}
+
+static void
+stats_accumulate(struct nir_pass_stats *dst, const struct nir_pass_stats *src)
+{
+   dst->calls += src->calls;
+   dst->progress_calls += src->progress_calls;
+   dst->time_ns += src->time_ns;
+   dst->no_progress_time_ns += src->no_progress_time_ns;
+   dst->instr_delta += src->instr_delta;
+}
+
+void
+_nir_pass_stats_begin(nir_pass_stats_scope *scope, nir_shader *shader,
+                      const char *pass, const char *file, unsigned line)
+{
+   scope->pass = pass;
+   scope->file = file;
+   scope->line = line;
+   scope->num_instrs = count_instrs(shader);
+
+   scope->traced = util_perfetto_is_tracing_enabled();
+   if (scope->traced)
+      util_perfetto_trace_begin(pass);
+
+   /* Take the start time last so that the instruction counting above is not
+    * attributed to the pass.
+    */
+   scope->start_ns = os_time_get_nano();
+}
+
+void
+_nir_pass_stats_end(nir_pass_stats_scope *scope, nir_shader *shader,
+                    bool progress)
+{
+   int64_t time_ns = os_time_get_nano() - scope->start_ns;
+   unsigned num_instrs = count_instrs(shader);
+
+   if (scope->traced) {
+      util_perfetto_trace_end();
+      util_perfetto_counter_set("NIR instructions", num_instrs);
+   }
+
+   struct nir_pass_stats stats = {
+      .calls = 1,
+      .progress_calls = progress ? 1 : 0,
+      .time_ns = time_ns,
+      .no_progress_time_ns = progress ? 0 : time_ns,
+      .instr_delta = (int64_t)num_instrs - scope->num_instrs,
+   };
+
+   struct pass_site key = {
+      .pass = scope->pass,
+      .file = scope->file,
+      .line = scope->line,
+   };
+
+   simple_mtx_lock(&pass_stats_mtx);
+
+   if (!pass_sites)
+      pass_sites = _mesa_hash_table_create(NULL, pass_site_hash, pass_site_equal);
+
+   struct hash_entry *entry = _mesa_hash_table_search(pass_sites, &key);
+   struct pass_site *site;
+   if (entry) {
+      site = entry->data;
+   } else {
+      /* The names are string literals from the NIR_PASS call sites, so
+       * they outlive the table.
+       */
+      site = rzalloc(pass_sites, struct pass_site);
+      *site = key;
+      _mesa_hash_table_insert(pass_sites, site, site);
+   }
+   stats_accumulate(&site->stats, &stats);
+
+   simple_mtx_unlock(&pass_stats_mtx);
+}
+
+void
+nir_pass_stats_enable(bool enable)
+{
+   p_atomic_set(&nir_pass_stats_enabled, enable);
+}
+
+void
+nir_pass_stats_reset(void)
+{
+   simple_mtx_lock(&pass_stats_mtx);
+   _mesa_hash_table_destroy(pass_sites, NULL);
+   pass_sites = NULL;
+   simple_mtx_unlock(&pass_stats_mtx);
+}
+
+bool
+nir_pass_stats_get(const char *pass, struct nir_pass_stats *stats)
+{
+   bool found = false;
+
+   memset(stats, 0, sizeof(*stats));
+
+   simple_mtx_lock(&pass_stats_mtx);
+   if (pass_sites) {
+      hash_table_foreach(pass_sites, entry) {
+         const struct pass_site *site = entry->data;
+         if (strcmp(site->pass, pass) == 0) {
+            stats_accumulate(stats, &site->stats);
+            found = true;
+         }
+      }
+   }
+   simple_mtx_unlock(&pass_stats_mtx);
+
+   return found;
+}
+
+static int
+pass_site_compare_time(const void *a, const void *b)
+{
+   const struct pass_site *sa = *(const struct pass_site **)a;
+   const struct pass_site *sb = *(const struct pass_site **)b;
+
+   if (sa->stats.time_ns != sb->stats.time_ns)
+      return sa->stats.time_ns < sb->stats.time_ns ? 1 : -1;
+   return 0;
+}
+
+static void
+write_json_stats(FILE *fp, const struct nir_pass_stats *stats)
+{
+   fprintf(fp, "\"calls\": %" PRIu64 ", \"progress_calls\": %" PRIu64 ", "
+               "\"time_ns\": %" PRIu64 ", \"no_progress_time_ns\": %" PRIu64 ", "
+               "\"instr_delta\": %" PRId64,
+           stats->calls, stats->progress_calls, stats->time_ns,
+           stats->no_progress_time_ns, stats->instr_delta);
+}
+
+static void
+write_json_string(FILE *fp, const char *str)
+{
+   fputc('"', fp);
+   for (const char *c = str; *c; c++) {
+      if (*c == '"' || *c == '\\')
+         fputc('\\', fp);
+      fputc(*c, fp);
+   }
+   fputc('"', fp);
+}
+
+void
+nir_pass_stats_write_json(FILE *fp)
+{
+   simple_mtx_lock(&pass_stats_mtx);
+
+   unsigned num_sites = pass_sites ? _mesa_hash_table_num_entries(pass_sites) : 0;
+   struct pass_site **sites = malloc(MAX2(num_sites, 1) * sizeof(*sites));
+   struct pass_site **totals = malloc(MAX2(num_sites, 1) * sizeof(*totals));
+   struct hash_table *passes = _mesa_string_hash_table_create(NULL);
+   if (!sites || !totals || !passes) {
+      simple_mtx_unlock(&pass_stats_mtx);
+      goto out;
+   }
+
+   unsigned i = 0;
+   if (pass_sites) {
+      hash_table_foreach(pass_sites, entry)
+         sites[i++] = entry->data;
+   }
+   qsort(sites, num_sites, sizeof(*sites), pass_site_compare_time);
+
+   /* Per-pass totals over all call sites. */
+   unsigned num_passes = 0;
+   for (i = 0; i < num_sites; i++) {
+      struct hash_entry *entry = _mesa_hash_table_search(passes, sites[i]->pass);
+      struct pass_site *total;
+      if (entry) {
+         total = entry->data;
+      } else {
+         total = rzalloc(passes, struct pass_site);
+         total->pass = sites[i]->pass;
+         _mesa_hash_table_insert(passes, total->pass, total);
+         totals[num_passes++] = total;
+      }
+      stats_accumulate(&total->stats, &sites[i]->stats);
+   }
+   qsort(totals, num_passes, sizeof(*totals), pass_site_compare_time);
+
+   fprintf(fp, "{\n  \"passes\": [");
+   for (i = 0; i < num_passes; i++) {
+      fprintf(fp, "%s\n    { \"pass\": ", i ? "," : "");
+      write_json_string(fp, totals[i]->pass);
+      fprintf(fp, ", ");
+      write_json_stats(fp, &totals[i]->stats);
+      fprintf(fp, " }");
+   }
+   fprintf(fp, "\n  ],\n  \"call_sites\": [");
+   for (i = 0; i < num_sites; i++) {
+      fprintf(fp, "%s\n    { \"pass\": ", i ? "," : "");
+      write_json_string(fp, sites[i]->pass);
+      fprintf(fp, ", \"file\": ");
+      write_json_string(fp, sites[i]->file);
+      fprintf(fp, ", \"line\": %u, ", sites[i]->line);
+      write_json_stats(fp, &sites[i]->stats);
+      fprintf(fp, " }");
+   }
+   fprintf(fp, "\n  ]\n}\n");
+
+   simple_mtx_unlock(&pass_stats_mtx);
+
+out:
+   _mesa_hash_table_destroy(passes, NULL);
+   free(totals);
+   free(sites);
+}
+
+static void
+nir_pass_stats_write_at_exit(void)
+{
+   if (strcmp(pass_stats_path, "stderr") == 0) {
+      nir_pass_stats_write_json(stderr);
+      return;
+   }
+
+   FILE *fp = fopen(pass_stats_path, "w");
+   if (!fp) {
+      fprintf(stderr, "NIR: failed to open %s for writing pass statistics\n",
+              pass_stats_path);
+      return;
+   }
+
+   nir_pass_stats_write_json(fp);
+   fclose(fp);
+}
+
+static void
+nir_pass_stats_init_once(void)
+{
+   pass_stats_path = os_get_option("NIR_PASS_STATS");
+   if (!pass_stats_path || !pass_stats_path[0])
+      return;
+
+   nir_pass_stats_enable(true);
+   atexit(nir_pass_stats_write_at_exit);
+}
+
+void
+nir_pass_stats_init(void)
+{
+   static once_flag flag = ONCE_FLAG_INIT;
+   call_once(&flag, nir_pass_stats_init_once);
+}
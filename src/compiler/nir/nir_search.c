@@ -27,28 +27,12 @@
 #include "nir_builder.h"
 #include "nir_worklist.h"
 
-/* This should be the same as nir_search_max_comm_ops in nir_algebraic.py. */
-#define NIR_SEARCH_MAX_COMM_OPS 8
-
-struct match_state {
-   bool inexact_match;
-   bool has_exact_alu;
-   uint8_t comm_op_direction;
-   unsigned variables_seen;
-
-   /* Used for running the automaton on newly-constructed instructions. */
-   struct util_dynarray *states;
-   const struct per_op_table *pass_op_table;
-   const nir_algebraic_table *table;
-
-   nir_alu_src variables[NIR_SEARCH_MAX_VARIABLES];
-   struct hash_table *range_ht;
-};
+bool nir_search_use_interpreter = false;
 
 static bool
 match_expression(const nir_algebraic_table *table, const nir_search_expression *expr, nir_alu_instr *instr,
                  unsigned num_components, const uint8_t *swizzle,
-                 struct match_state *state);
+                 nir_search_state *state);
 static bool
 nir_algebraic_automaton(nir_instr *instr, struct util_dynarray *states,
                         const struct per_op_table *pass_op_table);
@@ -77,8 +61,8 @@ static const uint8_t identity_swizzle[NIR_MAX_VEC_COMPONENTS] = {
  *
  * Used for satisfying 'a@type' constraints.
  */
-static bool
-src_is_type(nir_src src, nir_alu_type type)
+bool
+nir_search_src_is_type(nir_src src, nir_alu_type type)
 {
    assert(type != nir_type_invalid);
 
@@ -91,10 +75,10 @@ src_is_type(nir_src src, nir_alu_type type)
          case nir_op_iand:
          case nir_op_ior:
          case nir_op_ixor:
-            return src_is_type(src_alu->src[0].src, nir_type_bool) &&
-                   src_is_type(src_alu->src[1].src, nir_type_bool);
+            return nir_search_src_is_type(src_alu->src[0].src, nir_type_bool) &&
+                   nir_search_src_is_type(src_alu->src[1].src, nir_type_bool);
          case nir_op_inot:
-            return src_is_type(src_alu->src[0].src, nir_type_bool);
+            return nir_search_src_is_type(src_alu->src[0].src, nir_type_bool);
          default:
             break;
          }
@@ -241,20 +225,12 @@ static bool
 match_value(const nir_algebraic_table *table,
             const nir_search_value *value, nir_alu_instr *instr, unsigned src,
             unsigned num_components, const uint8_t *swizzle,
-            struct match_state *state)
+            nir_search_state *state)
 {
    uint8_t new_swizzle[NIR_MAX_VEC_COMPONENTS];
 
-   /* If the source is an explicitly sized source, then we need to reset
-    * both the number of components and the swizzle.
-    */
-   if (nir_op_infos[instr->op].input_sizes[src] != 0) {
-      num_components = nir_op_infos[instr->op].input_sizes[src];
-      swizzle = identity_swizzle;
-   }
-
-   for (unsigned i = 0; i < num_components; ++i)
-      new_swizzle[i] = instr->src[src].swizzle[swizzle[i]];
+   num_components = nir_search_src_swizzle(instr, src, num_components,
+                                           swizzle, new_swizzle);
 
    /* If the value has a specific bit size and it doesn't match, bail */
    if (value->bit_size > 0 &&
@@ -270,87 +246,23 @@ match_value(const nir_algebraic_table *table,
                               nir_instr_as_alu(instr->src[src].src.ssa->parent_instr),
                               num_components, new_swizzle, state);
 
-   case nir_search_value_variable: {
-      nir_search_variable *var = nir_search_value_as_variable(value);
-      assert(var->variable < NIR_SEARCH_MAX_VARIABLES);
-
-      if (state->variables_seen & (1 << var->variable)) {
-         if (state->variables[var->variable].src.ssa != instr->src[src].src.ssa)
-            return false;
-
-         for (unsigned i = 0; i < num_components; ++i) {
-            if (state->variables[var->variable].swizzle[i] != new_swizzle[i])
-               return false;
-         }
-
-         return true;
-      } else {
-         if (var->is_constant &&
-             instr->src[src].src.ssa->parent_instr->type != nir_instr_type_load_const)
-            return false;
-
-         if (var->cond_index != -1 && !table->variable_cond[var->cond_index](state->range_ht, instr,
-                                                                             src, num_components, new_swizzle))
-            return false;
-
-         if (var->type != nir_type_invalid &&
-             !src_is_type(instr->src[src].src, var->type))
-            return false;
-
-         state->variables_seen |= (1 << var->variable);
-         state->variables[var->variable].src = instr->src[src].src;
-
-         for (unsigned i = 0; i < NIR_MAX_VEC_COMPONENTS; ++i) {
-            if (i < num_components)
-               state->variables[var->variable].swizzle[i] = new_swizzle[i];
-            else
-               state->variables[var->variable].swizzle[i] = 0;
-         }
-
-         return true;
-      }
-   }
+   case nir_search_value_variable:
+      return nir_search_match_variable(state, nir_search_value_as_variable(value),
+                                       instr, src, num_components, new_swizzle);
 
    case nir_search_value_constant: {
       nir_search_constant *const_val = nir_search_value_as_constant(value);
 
-      if (!nir_src_is_const(instr->src[src].src))
-         return false;
-
       switch (const_val->type) {
-      case nir_type_float: {
-         nir_load_const_instr *const load =
-            nir_instr_as_load_const(instr->src[src].src.ssa->parent_instr);
-
-         /* There are 8-bit and 1-bit integer types, but there are no 8-bit or
-          * 1-bit float types.  This prevents potential assertion failures in
-          * nir_src_comp_as_float.
-          */
-         if (load->def.bit_size < 16)
-            return false;
-
-         for (unsigned i = 0; i < num_components; ++i) {
-            double val = nir_src_comp_as_float(instr->src[src].src,
-                                               new_swizzle[i]);
-            if (val != const_val->data.d)
-               return false;
-         }
-         return true;
-      }
+      case nir_type_float:
+         return nir_search_src_is_float_const(instr->src[src].src, num_components,
+                                              new_swizzle, const_val->data.d);
 
       case nir_type_int:
       case nir_type_uint:
-      case nir_type_bool: {
-         unsigned bit_size = nir_src_bit_size(instr->src[src].src);
-         uint64_t mask = u_uintN_max(bit_size);
-         for (unsigned i = 0; i < num_components; ++i) {
-            uint64_t val = nir_src_comp_as_uint(instr->src[src].src,
-                                                new_swizzle[i]);
-            if ((val & mask) != (const_val->data.u & mask))
-               return false;
-         }
-         return true;
-      }
+      case nir_type_bool:
+         return nir_search_src_is_int_const(instr->src[src].src, num_components,
+                                            new_swizzle, const_val->data.u);
 
       default:
          unreachable("Invalid alu source type");
@@ -365,7 +277,7 @@ match_value(const nir_algebraic_table *table,
 static bool
 match_expression(const nir_algebraic_table *table, const nir_search_expression *expr, nir_alu_instr *instr,
                  unsigned num_components, const uint8_t *swizzle,
-                 struct match_state *state)
+                 nir_search_state *state)
 {
    if (expr->cond_index != -1 && !table->expression_cond[expr->cond_index](instr))
       return false;
@@ -442,7 +354,7 @@ match_expression(const nir_algebraic_table *table, const nir_search_expression *
 
 static unsigned
 replace_bitsize(const nir_search_value *value, unsigned search_bitsize,
-                struct match_state *state)
+                nir_search_state *state)
 {
    if (value->bit_size > 0)
       return value->bit_size;
@@ -455,7 +367,7 @@ static nir_alu_src
 construct_value(nir_builder *build,
                 const nir_search_value *value,
                 unsigned num_components, unsigned search_bitsize,
-                struct match_state *state,
+                nir_search_state *state,
                 nir_instr *instr)
 {
    switch (value->type) {
@@ -677,19 +589,21 @@ nir_replace_instr(nir_builder *build, nir_alu_instr *instr,
                   struct hash_table *range_ht,
                   struct util_dynarray *states,
                   const nir_algebraic_table *table,
-                  const nir_search_expression *search,
-                  const nir_search_value *replace,
+                  const struct transform *xform,
                   nir_instr_worklist *algebraic_worklist,
                   struct exec_list *dead_instrs)
 {
+   const nir_search_expression *search = &table->values[xform->search].expression;
+   const nir_search_value *replace = &table->values[xform->replace].value;
+   const nir_search_matcher match =
+      nir_search_use_interpreter ? NULL : xform->match;
+
    uint8_t swizzle[NIR_MAX_VEC_COMPONENTS] = { 0 };
 
    for (unsigned i = 0; i < instr->def.num_components; ++i)
       swizzle[i] = i;
 
-   struct match_state state;
-   state.inexact_match = false;
-   state.has_exact_alu = false;
+   nir_search_state state;
    state.range_ht = range_ht;
    state.pass_op_table = table->pass_op_table;
    state.table = table;
@@ -706,10 +620,19 @@ nir_replace_instr(nir_builder *build, nir_alu_instr *instr,
        */
       state.comm_op_direction = comb;
       state.variables_seen = 0;
+      state.inexact_match = false;
+      state.has_exact_alu = false;
+
+      bool matched;
+      if (match) {
+         matched = match(instr, instr->def.num_components, swizzle, &state);
+      } else {
+         matched = match_expression(table, search, instr,
+                                    instr->def.num_components,
+                                    swizzle, &state);
+      }
 
-      if (match_expression(table, search, instr,
-                           instr->def.num_components,
-                           swizzle, &state)) {
+      if (matched) {
          found = true;
          break;
       }
@@ -877,9 +800,8 @@ nir_algebraic_instr(nir_builder *build, nir_instr *instr,
         xform++) {
       if (condition_flags[xform->condition_offset] &&
           !(table->values[xform->search].expression.inexact && ignore_inexact) &&
-          nir_replace_instr(build, alu, range_ht, states, table,
-                            &table->values[xform->search].expression,
-                            &table->values[xform->replace].value, worklist, dead_instrs)) {
+          nir_replace_instr(build, alu, range_ht, states, table, xform,
+                            worklist, dead_instrs)) {
          _mesa_hash_table_clear(range_ht, NULL);
          return true;
       }
@@ -30,7 +30,11 @@
 
 #define NIR_SEARCH_MAX_VARIABLES 24
 
+/* This should be the same as nir_search_max_comm_ops in nir_algebraic.py. */
+#define NIR_SEARCH_MAX_COMM_OPS 8
+
 struct nir_builder;
+struct nir_search_state;
 
 typedef enum ENUM_PACKED {
    nir_search_value_expression,
@@ -184,10 +188,25 @@ struct per_op_table {
    const uint16_t *table;
 };
 
+/**
+ * Generated matcher for a search expression
+ *
+ * This matches the same values as the interpreter does when walking the
+ * search expression in table->values[], but with the opcodes, bit sizes and
+ * constants of the expression compiled in.
+ */
+typedef bool (*nir_search_matcher)(nir_alu_instr *instr,
+                                   unsigned num_components,
+                                   const uint8_t *swizzle,
+                                   struct nir_search_state *state);
+
 struct transform {
    uint16_t search;  /* Index in table->values[] for the search expression. */
    uint16_t replace; /* Index in table->values[] for the replace value. */
    unsigned condition_offset;
+
+   /* Generated matcher for the search expression, or NULL to interpret it. */
+   nir_search_matcher match;
 };
 
 typedef union {
@@ -226,6 +245,21 @@ typedef struct {
    const nir_search_variable_cond *variable_cond;
 } nir_algebraic_table;
 
+typedef struct nir_search_state {
+   bool inexact_match;
+   bool has_exact_alu;
+   uint8_t comm_op_direction;
+   unsigned variables_seen;
+
+   /* Used for running the automaton on newly-constructed instructions. */
+   struct util_dynarray *states;
+   const struct per_op_table *pass_op_table;
+   const nir_algebraic_table *table;
+
+   nir_alu_src variables[NIR_SEARCH_MAX_VARIABLES];
+   struct hash_table *range_ht;
+} nir_search_state;
+
 /* Note: these must match the start states created in
  * TreeAutomaton._build_table()
  */
@@ -243,6 +277,117 @@ NIR_DEFINE_CAST(nir_search_value_as_expression, nir_search_value,
                 nir_search_expression, value,
                 type, nir_search_value_expression)
 
+bool nir_search_src_is_type(nir_src src, nir_alu_type type);
+
+/**
+ * Computes the swizzle of the values read from source src of instr when the
+ * instruction is read with the given swizzle, and returns the number of
+ * components read.
+ */
+static inline unsigned
+nir_search_src_swizzle(const nir_alu_instr *instr, unsigned src,
+                       unsigned num_components, const uint8_t *swizzle,
+                       uint8_t *src_swizzle)
+{
+   /* If the source is an explicitly sized source, then we need to reset
+    * both the number of components and the swizzle.
+    */
+   const unsigned input_size = nir_op_infos[instr->op].input_sizes[src];
+   if (input_size != 0) {
+      for (unsigned i = 0; i < input_size; ++i)
+         src_swizzle[i] = instr->src[src].swizzle[i];
+      return input_size;
+   }
+
+   for (unsigned i = 0; i < num_components; ++i)
+      src_swizzle[i] = instr->src[src].swizzle[swizzle[i]];
+   return num_components;
+}
+
+static inline bool
+nir_search_src_is_float_const(nir_src src, unsigned num_components,
+                              const uint8_t *swizzle, double value)
+{
+   if (!nir_src_is_const(src))
+      return false;
+
+   /* There are 8-bit and 1-bit integer types, but there are no 8-bit or
+    * 1-bit float types.  This prevents potential assertion failures in
+    * nir_src_comp_as_float.
+    */
+   if (nir_src_bit_size(src) < 16)
+      return false;
+
+   for (unsigned i = 0; i < num_components; ++i) {
+      if (nir_src_comp_as_float(src, swizzle[i]) != value)
+         return false;
+   }
+   return true;
+}
+
+static inline bool
+nir_search_src_is_int_const(nir_src src, unsigned num_components,
+                            const uint8_t *swizzle, uint64_t value)
+{
+   if (!nir_src_is_const(src))
+      return false;
+
+   const uint64_t mask = u_uintN_max(nir_src_bit_size(src));
+   for (unsigned i = 0; i < num_components; ++i) {
+      if ((nir_src_comp_as_uint(src, swizzle[i]) & mask) != (value & mask))
+         return false;
+   }
+   return true;
+}
+
+/**
+ * Matches source src of instr, read with the given swizzle, against a search
+ * variable.  The first match binds the variable, later ones must read the
+ * same value.
+ */
+static inline bool
+nir_search_match_variable(nir_search_state *state,
+                          const nir_search_variable *var,
+                          nir_alu_instr *instr, unsigned src,
+                          unsigned num_components, const uint8_t *swizzle)
+{
+   assert(var->variable < NIR_SEARCH_MAX_VARIABLES);
+   nir_alu_src *bound = &state->variables[var->variable];
+
+   if (state->variables_seen & (1 << var->variable)) {
+      if (bound->src.ssa != instr->src[src].src.ssa)
+         return false;
+
+      for (unsigned i = 0; i < num_components; ++i) {
+         if (bound->swizzle[i] != swizzle[i])
+            return false;
+      }
+
+      return true;
+   }
+
+   if (var->is_constant &&
+       instr->src[src].src.ssa->parent_instr->type != nir_instr_type_load_const)
+      return false;
+
+   if (var->cond_index != -1 &&
+       !state->table->variable_cond[var->cond_index](state->range_ht, instr, src,
+                                                     num_components, swizzle))
+      return false;
+
+   if (var->type != nir_type_invalid &&
+       !nir_search_src_is_type(instr->src[src].src, var->type))
+      return false;
+
+   state->variables_seen |= (1 << var->variable);
+   bound->src = instr->src[src].src;
+
+   for (unsigned i = 0; i < NIR_MAX_VEC_COMPONENTS; ++i)
+      bound->swizzle[i] = i < num_components ? swizzle[i] : 0;
+
+   return true;
+}
+
 bool
 nir_algebraic_impl(nir_function_impl *impl,
                    const bool *condition_flags,
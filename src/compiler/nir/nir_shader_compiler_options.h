@@ -830,6 +830,15 @@ typedef struct nir_shader_compiler_options {
     * the next shader according to default_varying_estimate_instr_cost.
     */
    unsigned max_varying_expression_cost;
+
+   /**
+    * Allocate instructions from linear slabs in creation order instead of
+    * size-class slabs. This makes walking the instructions of a block more
+    * cache-friendly, but the space of freed instructions is mostly reclaimed
+    * by nir_sweep(), which also compacts the function bodies in program order
+    * and thus changes the nir_function_impl and instruction pointers.
+    */
+   bool linear_instr_alloc;
 } nir_shader_compiler_options;
 
 #ifdef __cplusplus
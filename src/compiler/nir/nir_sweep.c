@@ -34,6 +34,9 @@
  * The expectation is that drivers should call this when finished compiling the shader
  * (after any optimization, lowering, and so on).  However, it's also fine to call it
  * earlier, and even many times, trading CPU cycles for memory savings.
+ *
+ * If nir_shader_compiler_options::linear_instr_alloc is set, the function bodies are
+ * also rebuilt in program order, so pointers into them are not preserved.
  */
 
 #define steal_list(mem_ctx, type, list)        \
@@ -41,32 +44,36 @@
       ralloc_steal(mem_ctx, obj);              \
    }
 
-static void sweep_cf_node(nir_shader *nir, nir_cf_node *cf_node);
+static void sweep_cf_node(void *mem_ctx, gc_ctx *gctx, nir_cf_node *cf_node);
 
 static void
-sweep_block(nir_shader *nir, nir_block *block)
+sweep_block(void *mem_ctx, gc_ctx *gctx, nir_block *block)
 {
-   ralloc_steal(nir, block);
+   ralloc_steal(mem_ctx, block);
 
    nir_foreach_instr(instr, block) {
-      gc_mark_live(nir->gctx, nir_instr_get_gc_pointer(instr));
+      if (gctx)
+         gc_mark_live(gctx, nir_instr_get_gc_pointer(instr));
 
       if (instr->has_debug_info) {
          nir_instr_debug_info *debug_info = nir_instr_get_debug_info(instr);
-         ralloc_steal(nir, debug_info->filename);
-         ralloc_steal(nir, debug_info->variable_name);
+         ralloc_steal(mem_ctx, debug_info->filename);
+         ralloc_steal(mem_ctx, debug_info->variable_name);
       }
 
       switch (instr->type) {
       case nir_instr_type_tex:
-         gc_mark_live(nir->gctx, nir_instr_as_tex(instr)->src);
+         if (gctx)
+            gc_mark_live(gctx, nir_instr_as_tex(instr)->src);
          break;
       case nir_instr_type_phi:
-         nir_foreach_phi_src(src, nir_instr_as_phi(instr))
-            gc_mark_live(nir->gctx, src);
+         if (gctx) {
+            nir_foreach_phi_src(src, nir_instr_as_phi(instr))
+               gc_mark_live(gctx, src);
+         }
          break;
       case nir_instr_type_intrinsic:
-         ralloc_steal(nir, (void *)nir_instr_as_intrinsic(instr)->name);
+         ralloc_steal(mem_ctx, (void *)nir_instr_as_intrinsic(instr)->name);
          break;
       default:
          break;
@@ -75,42 +82,42 @@ sweep_block(nir_shader *nir, nir_block *block)
 }
 
 static void
-sweep_if(nir_shader *nir, nir_if *iff)
+sweep_if(void *mem_ctx, gc_ctx *gctx, nir_if *iff)
 {
-   ralloc_steal(nir, iff);
+   ralloc_steal(mem_ctx, iff);
 
    foreach_list_typed(nir_cf_node, cf_node, node, &iff->then_list) {
-      sweep_cf_node(nir, cf_node);
+      sweep_cf_node(mem_ctx, gctx, cf_node);
    }
 
    foreach_list_typed(nir_cf_node, cf_node, node, &iff->else_list) {
-      sweep_cf_node(nir, cf_node);
+      sweep_cf_node(mem_ctx, gctx, cf_node);
    }
 }
 
 static void
-sweep_loop(nir_shader *nir, nir_loop *loop)
+sweep_loop(void *mem_ctx, gc_ctx *gctx, nir_loop *loop)
 {
    assert(!nir_loop_has_continue_construct(loop));
-   ralloc_steal(nir, loop);
+   ralloc_steal(mem_ctx, loop);
 
    foreach_list_typed(nir_cf_node, cf_node, node, &loop->body) {
-      sweep_cf_node(nir, cf_node);
+      sweep_cf_node(mem_ctx, gctx, cf_node);
    }
 }
 
 static void
-sweep_cf_node(nir_shader *nir, nir_cf_node *cf_node)
+sweep_cf_node(void *mem_ctx, gc_ctx *gctx, nir_cf_node *cf_node)
 {
    switch (cf_node->type) {
    case nir_cf_node_block:
-      sweep_block(nir, nir_cf_node_as_block(cf_node));
+      sweep_block(mem_ctx, gctx, nir_cf_node_as_block(cf_node));
       break;
    case nir_cf_node_if:
-      sweep_if(nir, nir_cf_node_as_if(cf_node));
+      sweep_if(mem_ctx, gctx, nir_cf_node_as_if(cf_node));
       break;
    case nir_cf_node_loop:
-      sweep_loop(nir, nir_cf_node_as_loop(cf_node));
+      sweep_loop(mem_ctx, gctx, nir_cf_node_as_loop(cf_node));
       break;
    default:
       unreachable("Invalid CF node type");
@@ -118,17 +125,17 @@ sweep_cf_node(nir_shader *nir, nir_cf_node *cf_node)
 }
 
 static void
-sweep_impl(nir_shader *nir, nir_function_impl *impl)
+sweep_impl(void *mem_ctx, gc_ctx *gctx, nir_function_impl *impl)
 {
-   ralloc_steal(nir, impl);
+   ralloc_steal(mem_ctx, impl);
 
-   steal_list(nir, nir_variable, &impl->locals);
+   steal_list(mem_ctx, nir_variable, &impl->locals);
 
    foreach_list_typed(nir_cf_node, cf_node, node, &impl->body) {
-      sweep_cf_node(nir, cf_node);
+      sweep_cf_node(mem_ctx, gctx, cf_node);
    }
 
-   sweep_block(nir, impl->end_block);
+   sweep_block(mem_ctx, gctx, impl->end_block);
 
    /* Wipe out all the metadata, if any. */
    nir_progress(true, impl, nir_metadata_none);
@@ -144,12 +151,46 @@ sweep_function(nir_shader *nir, nir_function *f)
       ralloc_steal(nir, (char *)f->params[i].name);
 
    if (f->impl)
-      sweep_impl(nir, f->impl);
+      sweep_impl(nir, nir->gctx, f->impl);
+}
+
+/* With linear instruction allocation, freed instructions leave holes in the
+ * slabs. Rebuild the function bodies so that their instructions are packed
+ * in program order, and the slabs only holding dead instructions are freed
+ * by the sweep.
+ */
+static void
+compact_impls(nir_shader *nir)
+{
+   nir_foreach_function_with_impl(func, impl, nir) {
+      nir_function_impl *compact = nir_function_impl_clone(nir, impl);
+
+      compact->structured = impl->structured;
+      compact->loop_analysis_indirect_mask = impl->loop_analysis_indirect_mask;
+      compact->loop_analysis_force_unroll_sampler_indirect =
+         impl->loop_analysis_force_unroll_sampler_indirect;
+
+      nir_function_set_impl(func, compact);
+   }
+}
+
+/**
+ * Move the ralloc-allocated memory of a function body to a different context,
+ * e.g. to work on it without touching the memory of the shader. This drops
+ * all metadata.
+ */
+void
+nir_steal_impl(void *mem_ctx, nir_function_impl *impl)
+{
+   sweep_impl(mem_ctx, NULL, impl);
 }
 
 void
 nir_sweep(nir_shader *nir)
 {
+   if (nir->options && nir->options->linear_instr_alloc)
+      compact_impls(nir);
+
    void *rubbish = ralloc_context(NULL);
 
    struct list_head instr_gc_list;
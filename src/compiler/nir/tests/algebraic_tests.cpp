@@ -186,6 +186,82 @@ TEST_F(nir_opt_algebraic_test, msad)
    require_one_alu(nir_op_msad_4x8);
 }
 
+TEST_F(nir_opt_algebraic_test, generated_matchers)
+{
+   nir_def *x = nir_load_var(b, nir_local_variable_create(b->impl, glsl_vec4_type(), "x"));
+   nir_def *y = nir_load_var(b, nir_local_variable_create(b->impl, glsl_vec4_type(), "y"));
+   nir_def *i = nir_load_var(b, nir_local_variable_create(b->impl, glsl_ivec4_type(), "i"));
+   const unsigned wzyx[] = { 3, 2, 1, 0 };
+
+   /* Constants on either side of commutative operations, nested patterns,
+    * swizzles and exact instructions.
+    */
+   nir_def *res[] = {
+      nir_fadd(b, nir_imm_float(b, 0.0), x),
+      nir_fmul(b, nir_channel(b, y, 2), nir_imm_float(b, 1.0)),
+      nir_fneg(b, nir_fneg(b, nir_swizzle(b, x, wzyx, 4))),
+      nir_fabs(b, nir_fneg(b, y)),
+      nir_iand(b, i, nir_imm_int(b, -1)),
+      nir_ior(b, nir_ishl(b, i, nir_imm_int(b, 0)), i),
+      nir_ineg(b, nir_ineg(b, nir_channel(b, i, 1))),
+      nir_fsub(b, x, nir_fadd(b, x, y)),
+   };
+   nir_instr_as_alu(res[0]->parent_instr)->exact = true;
+   nir_instr_as_alu(res[7]->parent_instr)->exact = true;
+
+   for (unsigned j = 0; j < ARRAY_SIZE(res); j++)
+      nir_store_var(b, res_var, nir_channel(b, nir_u2u32(b, res[j]), 0), 0x1);
+
+   nir_shader *clone = nir_shader_clone(NULL, b->shader);
+
+   ASSERT_TRUE(nir_opt_algebraic(b->shader));
+
+   nir_search_use_interpreter = true;
+   bool progress = nir_opt_algebraic(clone);
+   nir_search_use_interpreter = false;
+   ASSERT_TRUE(progress);
+
+   nir_index_ssa_defs(b->impl);
+   nir_index_ssa_defs(nir_shader_get_entrypoint(clone));
+   char *generated = nir_shader_as_str(b->shader, clone);
+   char *interpreted = nir_shader_as_str(clone, clone);
+   EXPECT_STREQ(generated, interpreted);
+
+   ralloc_free(clone);
+}
+
+TEST_F(nir_opt_algebraic_test, exact_in_failed_commutative_match)
+{
+   nir_variable *var = nir_local_variable_create(b->impl, glsl_float_type(), "x");
+   nir_def *x = nir_load_var(b, var);
+
+   /* ~fadd(fneg(a), a) first tries fneg(a) against the exact fneg, which
+    * must fail.  The exact instruction is only a variable in the flipped
+    * match, so that must still succeed.
+    */
+   nir_def *neg = nir_fneg(b, x);
+   nir_instr_as_alu(neg->parent_instr)->exact = true;
+   nir_def *sum = nir_fadd(b, neg, nir_fneg(b, neg));
+   nir_intrinsic_instr *store = nir_build_store_deref(
+      b, &nir_build_deref_var(b, var)->def, sum, 0x1);
+
+   nir_shader *clone = nir_shader_clone(NULL, b->shader);
+   nir_function_impl *clone_impl = nir_shader_get_entrypoint(clone);
+   nir_intrinsic_instr *clone_store =
+      nir_instr_as_intrinsic(nir_block_last_instr(nir_start_block(clone_impl)));
+
+   ASSERT_TRUE(nir_opt_algebraic(b->shader));
+   EXPECT_TRUE(nir_src_is_const(store->src[1]));
+
+   nir_search_use_interpreter = true;
+   bool progress = nir_opt_algebraic(clone);
+   nir_search_use_interpreter = false;
+   ASSERT_TRUE(progress);
+   EXPECT_TRUE(nir_src_is_const(clone_store->src[1]));
+
+   ralloc_free(clone);
+}
+
 TEST_F(nir_opt_mqsad_test, mqsad)
 {
    options.lower_bitfield_extract = true;
@@ -22,6 +22,10 @@
  */
 
 #include "nir_test.h"
+#include "nir_pass_scheduler_private.h"
+#include "nir_serialize.h"
+#include "util/u_atomic.h"
+#include "util/u_queue.h"
 
 namespace {
 
@@ -117,4 +121,280 @@ TEST_F(nir_core_test, nir_instr_free_and_dce_multiple_src_test)
    nir_validate_shader(b->shader, "after remove_and_dce");
 }
 
+TEST_F(nir_core_test, pass_stats_test)
+{
+   nir_def *one = nir_imm_int(b, 1);
+   nir_def *add = nir_iadd(b, one, one);
+   nir_iadd(b, add, add);
+
+   nir_pass_stats_reset();
+   nir_pass_stats_enable(true);
+
+   bool progress = false;
+   NIR_PASS(progress, b->shader, nir_opt_dce);
+   ASSERT_TRUE(progress);
+
+   progress = false;
+   NIR_PASS(progress, b->shader, nir_opt_dce);
+   ASSERT_FALSE(progress);
+
+   nir_pass_stats_enable(false);
+
+   /* Not recorded while disabled. */
+   NIR_PASS(progress, b->shader, nir_opt_dce);
+
+   struct nir_pass_stats stats;
+   ASSERT_TRUE(nir_pass_stats_get("nir_opt_dce", &stats));
+   EXPECT_EQ(stats.calls, 2);
+   EXPECT_EQ(stats.progress_calls, 1);
+   EXPECT_EQ(stats.instr_delta, -3);
+   EXPECT_LE(stats.no_progress_time_ns, stats.time_ns);
+
+   ASSERT_FALSE(nir_pass_stats_get("nir_opt_cse", &stats));
+   EXPECT_EQ(stats.calls, 0);
+
+   nir_pass_stats_reset();
+   ASSERT_FALSE(nir_pass_stats_get("nir_opt_dce", &stats));
+}
+
+static unsigned count_pass_calls;
+
+static bool
+count_pass(nir_shader *shader)
+{
+   count_pass_calls++;
+   return false;
+}
+
+static void
+run_count_pass(nir_pass_scheduler *sched, nir_shader *shader)
+{
+   NIR_SCHED_PASS(_, sched, shader, count_pass);
+}
+
+static void
+run_remove_phis(nir_pass_scheduler *sched, nir_shader *shader)
+{
+   NIR_SCHED_PASS(_, sched, shader, nir_opt_remove_phis);
+}
+
+TEST_F(nir_core_test, pass_scheduler_test)
+{
+   nir_def *one = nir_imm_int(b, 1);
+   nir_iadd(b, one, one);
+
+   nir_pass_scheduler *sched = nir_pass_scheduler_create(NULL);
+   struct nir_pass_stats stats;
+
+   nir_pass_stats_reset();
+   nir_pass_stats_enable(true);
+   count_pass_calls = 0;
+
+   run_count_pass(sched, b->shader);
+   run_remove_phis(sched, b->shader);
+   EXPECT_EQ(count_pass_calls, 1);
+
+   /* Nothing changed since the passes ran without progress. */
+   run_count_pass(sched, b->shader);
+   run_remove_phis(sched, b->shader);
+   EXPECT_EQ(count_pass_calls, 1);
+   nir_pass_stats_get("nir_opt_remove_phis", &stats);
+   EXPECT_EQ(stats.calls, 1);
+
+   bool progress = false;
+   NIR_SCHED_PASS(progress, sched, b->shader, nir_opt_dce);
+   ASSERT_TRUE(progress);
+
+   /* Unknown passes depend on everything, nir_opt_remove_phis only on phis,
+    * which nir_opt_dce didn't touch.
+    */
+   run_count_pass(sched, b->shader);
+   run_remove_phis(sched, b->shader);
+   EXPECT_EQ(count_pass_calls, 2);
+   nir_pass_stats_get("nir_opt_remove_phis", &stats);
+   EXPECT_EQ(stats.calls, 1);
+
+   /* Invalidating phis makes both run again. */
+   nir_pass_scheduler_invalidate(sched, NIR_PASS_CHANGE_INSTR(nir_instr_type_phi));
+   run_count_pass(sched, b->shader);
+   run_remove_phis(sched, b->shader);
+   EXPECT_EQ(count_pass_calls, 3);
+   nir_pass_stats_get("nir_opt_remove_phis", &stats);
+   EXPECT_EQ(stats.calls, 2);
+
+   nir_pass_stats_enable(false);
+   nir_pass_stats_reset();
+   ralloc_free(sched);
+}
+
+static nir_pass_scheduler *nested_sched;
+
+static bool
+nested_dce_pass(nir_shader *shader)
+{
+   bool progress = false;
+   NIR_SCHED_PASS(progress, nested_sched, shader, nir_opt_dce);
+   return progress;
+}
+
+TEST_F(nir_core_test, pass_scheduler_nested_test)
+{
+   nir_def *one = nir_imm_int(b, 1);
+   nir_iadd(b, one, one);
+
+   nir_pass_scheduler *sched = nir_pass_scheduler_create(NULL);
+   nested_sched = sched;
+   count_pass_calls = 0;
+
+   run_count_pass(sched, b->shader);
+   EXPECT_EQ(count_pass_calls, 1);
+
+   bool progress = false;
+   NIR_SCHED_PASS(progress, sched, b->shader, nested_dce_pass);
+   ASSERT_TRUE(progress);
+
+   /* Recording stopped with the outer pass, and what the inner pass changed
+    * was changed by the outer one too.
+    */
+   EXPECT_EQ(nir_pass_changes, nullptr);
+   run_count_pass(sched, b->shader);
+   EXPECT_EQ(count_pass_calls, 2);
+
+   ralloc_free(sched);
+}
+
+TEST_F(nir_core_test, linear_instr_alloc_sweep_test)
+{
+   nir_shader_compiler_options linear_options = {};
+   linear_options.linear_instr_alloc = true;
+
+   nir_builder lb = nir_builder_init_simple_shader(MESA_SHADER_COMPUTE, &linear_options,
+                                                   "linear");
+   nir_def *x = nir_load_global(&lb, nir_imm_int64(&lb, 0), 4, 1, 32);
+   for (unsigned i = 0; i < 256; i++) {
+      nir_def *dead = nir_imul_imm(&lb, x, i);
+      x = nir_iadd_imm(&lb, x, i);
+      nir_iadd(&lb, dead, x);
+   }
+   nir_store_global(&lb, nir_imm_int64(&lb, 0), 4, x, 0x1);
+
+   ASSERT_TRUE(nir_opt_dce(lb.shader));
+
+   nir_function_impl *impl = nir_shader_get_entrypoint(lb.shader);
+   unsigned num_live = 0;
+   nir_foreach_block(block, impl)
+      num_live += exec_list_length(&block->instr_list);
+
+   nir_sweep(lb.shader);
+   nir_validate_shader(lb.shader, "after sweep");
+
+   /* The live instructions were packed in program order, so the next
+    * instruction is right after the previous one unless a new slab was
+    * started.
+    */
+   impl = nir_shader_get_entrypoint(lb.shader);
+   unsigned num_instrs = 0, num_jumps = 0;
+   nir_instr *prev = NULL;
+   nir_foreach_block(block, impl) {
+      nir_foreach_instr(instr, block) {
+         if (prev && ((uintptr_t)instr <= (uintptr_t)prev ||
+                      (uintptr_t)instr - (uintptr_t)prev > 512))
+            num_jumps++;
+         prev = instr;
+         num_instrs++;
+      }
+   }
+   EXPECT_EQ(num_instrs, num_live);
+   EXPECT_LE(num_jumps, num_instrs / 64 + 1);
+
+   /* Instructions can still be added after compaction. */
+   lb.cursor = nir_before_impl(impl);
+   nir_phi_instr *phi = nir_phi_instr_create(lb.shader);
+   nir_def_init(&phi->instr, &phi->def, 1, 32);
+   nir_instr_free(&phi->instr);
+   nir_imm_int(&lb, 7);
+   nir_validate_shader(lb.shader, "after adding instructions");
+
+   ralloc_free(lb.shader);
+}
+
+static bool
+optimize_cb(nir_shader *shader, void *data)
+{
+   bool progress = false, loop_progress;
+   do {
+      loop_progress = false;
+      NIR_PASS(loop_progress, shader, nir_opt_algebraic);
+      NIR_PASS(loop_progress, shader, nir_opt_constant_folding);
+      NIR_PASS(loop_progress, shader, nir_copy_prop);
+      NIR_PASS(loop_progress, shader, nir_opt_cse);
+      NIR_PASS(loop_progress, shader, nir_opt_dce);
+      NIR_PASS(loop_progress, shader, nir_opt_remove_phis);
+      progress |= loop_progress;
+   } while (loop_progress);
+
+   /* Called concurrently from the worker threads. */
+   p_atomic_inc((unsigned *)data);
+   return progress;
+}
+
+static void
+build_helper(nir_builder *b, unsigned k)
+{
+   nir_def *addr = nir_imm_int64(b, k * 16);
+   nir_def *x = nir_load_global(b, addr, 4, 1, 32);
+   nir_def *zero = nir_iadd_imm(b, nir_imul_imm(b, x, 0), 0);
+
+   nir_push_if(b, nir_ilt_imm(b, x, k));
+   nir_def *then_val = nir_iadd_imm(b, nir_imul_imm(b, x, k + 2), 1);
+   nir_push_else(b, NULL);
+   nir_def *else_val = nir_iadd(b, nir_iadd(b, x, x), nir_iadd(b, x, x));
+   nir_pop_if(b, NULL);
+
+   nir_def *y = nir_if_phi(b, then_val, else_val);
+   nir_store_global(b, addr, 4, nir_iadd(b, y, zero), 0x1);
+}
+
+TEST_F(nir_core_test, foreach_impl_parallel_test)
+{
+   for (unsigned k = 0; k < 4; k++) {
+      nir_function *helper = nir_function_create(b->shader, ralloc_asprintf(b->shader, "helper%u", k));
+      nir_builder hb = nir_builder_at(nir_after_impl(nir_function_impl_create(helper)));
+      build_helper(&hb, k);
+      nir_call(b, helper);
+   }
+   build_helper(b, 4);
+
+   nir_shader *serial = nir_shader_clone(NULL, b->shader);
+   unsigned serial_calls = 0;
+   EXPECT_TRUE(optimize_cb(serial, &serial_calls));
+
+   struct util_queue queue;
+   ASSERT_TRUE(util_queue_init(&queue, "nir_test", 8, 4, 0, NULL));
+   unsigned parallel_calls = 0;
+   EXPECT_TRUE(nir_shader_foreach_impl_parallel(b->shader, &queue, optimize_cb,
+                                                &parallel_calls));
+   util_queue_destroy(&queue);
+
+   EXPECT_EQ(serial_calls, 1);
+   EXPECT_EQ(parallel_calls, 5);
+   nir_validate_shader(b->shader, "after parallel optimization");
+
+   struct blob serial_blob, parallel_blob;
+   blob_init(&serial_blob);
+   blob_init(&parallel_blob);
+   nir_serialize(&serial_blob, serial, false);
+   nir_serialize(&parallel_blob, b->shader, false);
+   ASSERT_EQ(serial_blob.size, parallel_blob.size);
+   EXPECT_EQ(memcmp(serial_blob.data, parallel_blob.data, serial_blob.size), 0);
+   blob_finish(&serial_blob);
+   blob_finish(&parallel_blob);
+
+   /* The merged shader can still be swept. */
+   nir_sweep(b->shader);
+   nir_validate_shader(b->shader, "after sweep");
+
+   ralloc_free(serial);
+}
+
 }
@@ -1292,3 +1292,15 @@ draw_set_constant_buffer_stride(struct draw_context *draw, unsigned num_bytes)
 {
    draw->constant_buffer_stride = num_bytes;
 }
+
+
+/**
+ * Shade the vertices of large draws on up to num_threads worker threads.
+ * Everything after the vertex shader still runs on the calling thread, in
+ * submission order.  Only the LLVM path supports this, 0 or 1 disables it.
+ */
+void
+draw_set_num_threads(struct draw_context *draw, unsigned num_threads)
+{
+   draw->pt.num_threads = MIN2(num_threads, DRAW_MAX_THREADS);
+}
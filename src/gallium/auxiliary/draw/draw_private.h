@@ -123,6 +123,9 @@ struct draw_vertex_buffer {
 /* maximum number of shader variants we can cache */
 #define DRAW_MAX_SHADER_VARIANTS 512
 
+/* maximum number of vertex shading worker threads */
+#define DRAW_MAX_THREADS 8
+
 struct draw_buffer_info {
    const void *ptr;
    unsigned size;
@@ -214,6 +217,9 @@ struct draw_context
       bool test_fse;         /* enable FSE even though its not correct (eg for softpipe) */
       bool no_fse;           /* disable FSE even when it is correct */
 
+      /* worker threads for vertex shading, 0 shades on the calling thread */
+      unsigned num_threads;
+
       /* user-space vertex data, buffers */
       struct {
          /** vertex element/index buffer (ex: glDrawElements) */
@@ -505,6 +511,7 @@ draw_pipeline_flush(struct draw_context *draw,
 #define DRAW_FLUSH_PARAMETER_CHANGE 0x1  /**< Constants, viewport, etc */
 #define DRAW_FLUSH_STATE_CHANGE     0x2  /**< Other/heavy state changes */
 #define DRAW_FLUSH_BACKEND          0x4  /**< Flush the output buffer */
+#define DRAW_FLUSH_VERTICES         0x8  /**< Finish asynchronous vertex shading */
 
 
 void
@@ -493,6 +493,12 @@ draw_instances(struct draw_context *draw,
          draw_pt_arrays(draw, info->mode, info->index_bias_varies,
                         draws, num_draws);
       }
+
+      /* The vertices shaded on worker threads must be drawn before the
+       * next instance resets the primitive IDs, and before the caller
+       * unmaps the buffers.
+       */
+      draw_pt_flush(draw, DRAW_FLUSH_VERTICES);
    }
 }
 
@@ -125,6 +125,11 @@ struct draw_pt_middle_end {
 
    int (*get_max_vertex_count)(struct draw_pt_middle_end *);
 
+   /* Optional, complete the runs whose vertices are still being shaded
+    * asynchronously.
+    */
+   void (*flush)(struct draw_pt_middle_end *);
+
    void (*finish)(struct draw_pt_middle_end *);
    void (*destroy)(struct draw_pt_middle_end *);
 };
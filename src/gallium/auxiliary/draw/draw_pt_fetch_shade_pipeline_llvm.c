@@ -28,6 +28,7 @@
 #include "util/u_math.h"
 #include "util/u_memory.h"
 #include "util/u_prim.h"
+#include "util/u_queue.h"
 #include "draw/draw_context.h"
 #include "draw/draw_gs.h"
 #include "draw/draw_tess.h"
@@ -41,6 +42,45 @@
 #include "gallivm/lp_bld_debug.h"
 
 
+/* Smaller runs are shaded on the calling thread, unless runs are queued
+ * already, as handing them off costs more than it saves.
+ */
+#define LLVM_VS_JOB_MIN_VERTICES 128
+
+
+/* Vertex shader inputs of a run.  They're captured from the draw state,
+ * which moves on while the run is shaded on a worker thread.
+ */
+struct llvm_vs_params {
+   const unsigned *elts;
+   unsigned count;
+   unsigned start;
+   unsigned vertex_id_offset;
+   unsigned instance_id;
+   unsigned start_instance;
+   unsigned draw_id;
+   unsigned view_id;
+};
+
+
+struct llvm_vs_job {
+   struct util_queue_fence fence;
+   struct llvm_middle_end *fpme;
+
+   struct llvm_vs_params params;
+   unsigned *fetch_elts;
+   unsigned fetch_elts_size;
+
+   struct draw_prim_info prim_info;
+   uint16_t *draw_elts;
+   unsigned draw_elts_size;
+   unsigned primitive_length;
+
+   struct draw_vertex_info vert_info;
+   bool clipped;
+};
+
+
 struct llvm_middle_end {
    struct draw_pt_middle_end base;
    struct draw_context *draw;
@@ -58,6 +98,18 @@ struct llvm_middle_end {
 
    struct draw_llvm *llvm;
    struct draw_llvm_variant *current_variant;
+
+   /* Runs whose vertices are shaded on the worker threads.  The rest of
+    * the pipeline is run for them on the calling thread, in submission
+    * order, as they complete.
+    */
+   struct util_queue vs_queue;
+   bool vs_queue_initialized;
+   struct llvm_vs_job *vs_jobs;
+   unsigned max_vs_jobs;
+   unsigned first_vs_job;
+   unsigned num_vs_jobs;
+   bool completing_vs_jobs;
 };
 
 
@@ -286,6 +338,7 @@ llvm_middle_end_prepare(struct draw_pt_middle_end *middle,
    struct draw_geometry_shader *gs = draw->gs.geometry_shader;
    struct draw_tess_ctrl_shader *tcs = draw->tcs.tess_ctrl_shader;
    struct draw_tess_eval_shader *tes = draw->tes.tess_eval_shader;
+   assert(!fpme->num_vs_jobs);
    const enum mesa_prim out_prim =
       gs ? gs->output_primitive : tes ? get_tes_output_prim(tes) :
       u_assembled_prim(in_prim);
@@ -431,6 +484,8 @@ llvm_middle_end_bind_parameters(struct draw_pt_middle_end *middle)
    struct draw_llvm *llvm = fpme->llvm;
    unsigned i;
 
+   assert(!fpme->num_vs_jobs);
+
    for (enum pipe_shader_type shader_type = PIPE_SHADER_VERTEX; shader_type <= PIPE_SHADER_GEOMETRY; shader_type++) {
       for (i = 0; i < ARRAY_SIZE(llvm->jit_resources[shader_type].constants); ++i) {
          /*
@@ -490,11 +545,80 @@ emit(struct pt_emit *emit,
 
 
 static void
-llvm_pipeline_generic(struct draw_pt_middle_end *middle,
-                      const struct draw_fetch_info *fetch_info,
-                      const struct draw_prim_info *in_prim_info)
+llvm_vs_params_init(struct llvm_middle_end *fpme,
+                    const struct draw_fetch_info *fetch_info,
+                    struct llvm_vs_params *params)
+{
+   struct draw_context *draw = fpme->draw;
+
+   if (fetch_info->linear) {
+      params->start = fetch_info->start;
+      params->vertex_id_offset = draw->start_index;
+      params->elts = NULL;
+   } else {
+      params->start = draw->pt.user.eltMax;
+      params->vertex_id_offset = draw->pt.user.eltBias;
+      params->elts = fetch_info->elts;
+   }
+
+   params->count = fetch_info->count;
+   params->instance_id = draw->instance_id;
+   params->start_instance = draw->start_instance;
+   params->draw_id = draw->pt.user.drawid;
+   params->view_id = draw->pt.user.viewid;
+}
+
+
+static struct vertex_header *
+llvm_alloc_vertices(struct llvm_middle_end *fpme, unsigned count)
+{
+   return (struct vertex_header *)
+      MALLOC(fpme->vertex_size *
+             align(count, lp_native_vector_width / 32) +
+             DRAW_EXTRA_VERTICES_PADDING);
+}
+
+
+/**
+ * Run the vertex fetch shader, returns whether any vertex is clipped.
+ * This is safe to call from several threads at once.
+ */
+static bool
+llvm_vs_run(struct llvm_middle_end *fpme,
+            const struct llvm_vs_params *params,
+            struct vertex_header *verts)
+{
+   struct draw_context *draw = fpme->draw;
+
+   return fpme->current_variant->jit_func(&fpme->llvm->vs_jit_context,
+                                          &fpme->llvm->jit_resources[PIPE_SHADER_VERTEX],
+                                          verts,
+                                          draw->pt.user.vbuffer,
+                                          params->count,
+                                          params->start,
+                                          fpme->vertex_size,
+                                          draw->pt.vertex_buffer,
+                                          params->instance_id,
+                                          params->vertex_id_offset,
+                                          params->start_instance,
+                                          params->elts,
+                                          params->draw_id,
+                                          params->view_id);
+}
+
+
+/**
+ * Run the rest of the pipeline on the shaded vertices of a run: tessellation,
+ * geometry shader, stream output, clipping and emission.  These stages keep
+ * state from one run to the next, hence runs must come in submission order.
+ * Takes ownership of vs_vert_info->verts.
+ */
+static void
+llvm_pipeline_finish(struct llvm_middle_end *fpme,
+                     struct draw_vertex_info *vs_vert_info,
+                     const struct draw_prim_info *in_prim_info,
+                     bool clipped)
 {
-   struct llvm_middle_end *fpme = llvm_middle_end(middle);
    struct draw_context *draw = fpme->draw;
    struct draw_geometry_shader *gshader = draw->gs.geometry_shader;
    struct draw_tess_ctrl_shader *tcs_shader = draw->tcs.tess_ctrl_shader;
@@ -502,77 +626,16 @@ llvm_pipeline_generic(struct draw_pt_middle_end *middle,
    struct draw_prim_info tcs_prim_info;
    struct draw_prim_info tes_prim_info;
    struct draw_prim_info gs_prim_info[TGSI_MAX_VERTEX_STREAMS];
-   struct draw_vertex_info llvm_vert_info;
    struct draw_vertex_info tcs_vert_info;
    struct draw_vertex_info tes_vert_info;
-   struct draw_vertex_info *vert_info;
+   struct draw_vertex_info *vert_info = vs_vert_info;
    struct draw_prim_info ia_prim_info;
    struct draw_vertex_info ia_vert_info;
    const struct draw_prim_info *prim_info = in_prim_info;
    bool free_prim_info = false;
    unsigned opt = fpme->opt;
-   bool clipped = 0;
    uint16_t *tes_elts_out = NULL;
 
-   assert(fetch_info->count > 0);
-
-   llvm_vert_info.count = fetch_info->count;
-   llvm_vert_info.vertex_size = fpme->vertex_size;
-   llvm_vert_info.stride = fpme->vertex_size;
-   llvm_vert_info.verts = (struct vertex_header *)
-      MALLOC(fpme->vertex_size *
-             align(fetch_info->count, lp_native_vector_width / 32) +
-             DRAW_EXTRA_VERTICES_PADDING);
-   if (!llvm_vert_info.verts) {
-      assert(0);
-      return;
-   }
-
-   if (draw->collect_statistics) {
-      draw->statistics.ia_vertices += prim_info->count;
-      if (prim_info->prim == MESA_PRIM_PATCHES)
-         draw->statistics.ia_primitives +=
-            prim_info->count / draw->pt.vertices_per_patch;
-      else
-         draw->statistics.ia_primitives +=
-            u_decomposed_prims_for_vertices(prim_info->prim, prim_info->count);
-      draw->statistics.vs_invocations += fetch_info->count;
-   }
-
-   {
-      unsigned start, vertex_id_offset;
-      const unsigned *elts;
-
-      if (fetch_info->linear) {
-         start = fetch_info->start;
-         vertex_id_offset = draw->start_index;
-         elts = NULL;
-      } else {
-         start = draw->pt.user.eltMax;
-         vertex_id_offset = draw->pt.user.eltBias;
-         elts = fetch_info->elts;
-      }
-      /* Run vertex fetch shader */
-      clipped = fpme->current_variant->jit_func(&fpme->llvm->vs_jit_context,
-                                                &fpme->llvm->jit_resources[PIPE_SHADER_VERTEX],
-                                                llvm_vert_info.verts,
-                                                draw->pt.user.vbuffer,
-                                                fetch_info->count,
-                                                start,
-                                                fpme->vertex_size,
-                                                draw->pt.vertex_buffer,
-                                                draw->instance_id,
-                                                vertex_id_offset,
-                                                draw->start_instance,
-                                                elts,
-                                                draw->pt.user.drawid,
-                                                draw->pt.user.viewid);
-
-      /* Finished with fetch and vs */
-      fetch_info = NULL;
-      vert_info = &llvm_vert_info;
-   }
-
    /* Keep track of the patch lengths if we have a geometry shader, this way we can increment
     * gl_PrimitiveID once per patch, instead of per tessellation output primitive.
     * The Vulkan and OpenGL specs say:
@@ -741,6 +804,238 @@ llvm_pipeline_generic(struct draw_pt_middle_end *middle,
 }
 
 
+static void
+llvm_vs_job_execute(void *data, void *gdata, int thread_index)
+{
+   struct llvm_vs_job *job = data;
+
+   /* Same as draw_vbo() does for the calling thread */
+   util_fpstate_set_denorms_to_zero(util_fpstate_get());
+
+   job->clipped = llvm_vs_run(job->fpme, &job->params, job->vert_info.verts);
+}
+
+
+static bool
+llvm_vs_queue_init(struct llvm_middle_end *fpme)
+{
+   const unsigned num_threads = fpme->draw->pt.num_threads;
+
+   if (fpme->vs_queue_initialized)
+      return fpme->vs_jobs != NULL;
+
+   fpme->vs_queue_initialized = true;
+
+   if (!num_threads)
+      return false;
+
+   /* Two runs per thread keep the workers busy while the calling thread
+    * completes the oldest one.
+    */
+   fpme->max_vs_jobs = 2 * num_threads;
+   fpme->vs_jobs = CALLOC(fpme->max_vs_jobs, sizeof(*fpme->vs_jobs));
+   if (!fpme->vs_jobs)
+      return false;
+
+   if (!util_queue_init(&fpme->vs_queue, "drawvs", fpme->max_vs_jobs,
+                        num_threads, 0, NULL)) {
+      FREE(fpme->vs_jobs);
+      fpme->vs_jobs = NULL;
+      return false;
+   }
+
+   for (unsigned i = 0; i < fpme->max_vs_jobs; i++)
+      util_queue_fence_init(&fpme->vs_jobs[i].fence);
+
+   return true;
+}
+
+
+static void
+llvm_vs_queue_destroy(struct llvm_middle_end *fpme)
+{
+   if (!fpme->vs_jobs)
+      return;
+
+   util_queue_destroy(&fpme->vs_queue);
+
+   for (unsigned i = 0; i < fpme->max_vs_jobs; i++) {
+      util_queue_fence_destroy(&fpme->vs_jobs[i].fence);
+      FREE(fpme->vs_jobs[i].fetch_elts);
+      FREE(fpme->vs_jobs[i].draw_elts);
+   }
+
+   FREE(fpme->vs_jobs);
+   fpme->vs_jobs = NULL;
+}
+
+
+/**
+ * Wait for the oldest queued run and push its vertices down the pipeline.
+ */
+static void
+llvm_vs_queue_complete_job(struct llvm_middle_end *fpme)
+{
+   struct llvm_vs_job *job = &fpme->vs_jobs[fpme->first_vs_job];
+
+   util_queue_fence_wait(&job->fence);
+
+   fpme->first_vs_job = (fpme->first_vs_job + 1) % fpme->max_vs_jobs;
+   fpme->num_vs_jobs--;
+
+   /* The pipeline may flush the draw module, which mustn't complete the
+    * next runs before this one is done.
+    */
+   fpme->completing_vs_jobs = true;
+   llvm_pipeline_finish(fpme, &job->vert_info, &job->prim_info,
+                        job->clipped);
+   fpme->completing_vs_jobs = false;
+}
+
+
+static void
+llvm_middle_end_flush(struct draw_pt_middle_end *middle)
+{
+   struct llvm_middle_end *fpme = llvm_middle_end(middle);
+
+   if (fpme->completing_vs_jobs)
+      return;
+
+   while (fpme->num_vs_jobs)
+      llvm_vs_queue_complete_job(fpme);
+}
+
+
+static bool
+llvm_vs_job_copy_elts(struct llvm_vs_job *job,
+                      const struct llvm_vs_params *params,
+                      const struct draw_prim_info *prim_info)
+{
+   if (params->elts && job->fetch_elts_size < params->count) {
+      FREE(job->fetch_elts);
+      job->fetch_elts = MALLOC(params->count * sizeof(*job->fetch_elts));
+      job->fetch_elts_size = job->fetch_elts ? params->count : 0;
+      if (!job->fetch_elts)
+         return false;
+   }
+
+   if (prim_info->elts && job->draw_elts_size < prim_info->count) {
+      FREE(job->draw_elts);
+      job->draw_elts = MALLOC(prim_info->count * sizeof(*job->draw_elts));
+      job->draw_elts_size = job->draw_elts ? prim_info->count : 0;
+      if (!job->draw_elts)
+         return false;
+   }
+
+   job->params = *params;
+   if (params->elts) {
+      memcpy(job->fetch_elts, params->elts,
+             params->count * sizeof(*job->fetch_elts));
+      job->params.elts = job->fetch_elts;
+   }
+
+   job->prim_info = *prim_info;
+   if (prim_info->elts) {
+      memcpy(job->draw_elts, prim_info->elts,
+             prim_info->count * sizeof(*job->draw_elts));
+      job->prim_info.elts = job->draw_elts;
+   }
+
+   assert(prim_info->primitive_count == 1);
+   job->primitive_length = prim_info->primitive_lengths[0];
+   job->prim_info.primitive_lengths = &job->primitive_length;
+
+   return true;
+}
+
+
+/**
+ * Queue the vertex shading of a run on the worker threads.  The run is
+ * completed later on, by llvm_vs_queue_complete_job().  Returns false if
+ * the run must be processed right away.
+ */
+static bool
+llvm_vs_queue_run(struct llvm_middle_end *fpme,
+                  const struct llvm_vs_params *params,
+                  const struct draw_prim_info *prim_info)
+{
+   if (!fpme->num_vs_jobs && params->count < LLVM_VS_JOB_MIN_VERTICES)
+      return false;
+
+   if (fpme->completing_vs_jobs || !llvm_vs_queue_init(fpme))
+      return false;
+
+   if (fpme->num_vs_jobs == fpme->max_vs_jobs)
+      llvm_vs_queue_complete_job(fpme);
+
+   unsigned idx = (fpme->first_vs_job + fpme->num_vs_jobs) % fpme->max_vs_jobs;
+   struct llvm_vs_job *job = &fpme->vs_jobs[idx];
+
+   if (!llvm_vs_job_copy_elts(job, params, prim_info))
+      return false;
+
+   job->fpme = fpme;
+   job->vert_info.count = params->count;
+   job->vert_info.vertex_size = fpme->vertex_size;
+   job->vert_info.stride = fpme->vertex_size;
+   job->vert_info.verts = llvm_alloc_vertices(fpme, params->count);
+   if (!job->vert_info.verts)
+      return false;
+
+   util_queue_add_job(&fpme->vs_queue, job, &job->fence,
+                      llvm_vs_job_execute, NULL, 0);
+   fpme->num_vs_jobs++;
+
+   return true;
+}
+
+
+static void
+llvm_pipeline_generic(struct draw_pt_middle_end *middle,
+                      const struct draw_fetch_info *fetch_info,
+                      const struct draw_prim_info *prim_info)
+{
+   struct llvm_middle_end *fpme = llvm_middle_end(middle);
+   struct draw_context *draw = fpme->draw;
+   struct draw_vertex_info vert_info;
+   struct llvm_vs_params vs_params;
+
+   assert(fetch_info->count > 0);
+
+   if (draw->collect_statistics) {
+      draw->statistics.ia_vertices += prim_info->count;
+      if (prim_info->prim == MESA_PRIM_PATCHES)
+         draw->statistics.ia_primitives +=
+            prim_info->count / draw->pt.vertices_per_patch;
+      else
+         draw->statistics.ia_primitives +=
+            u_decomposed_prims_for_vertices(prim_info->prim, prim_info->count);
+      draw->statistics.vs_invocations += fetch_info->count;
+   }
+
+   llvm_vs_params_init(fpme, fetch_info, &vs_params);
+
+   if (llvm_vs_queue_run(fpme, &vs_params, prim_info))
+      return;
+
+   /* Complete the queued runs first to keep the submission order */
+   llvm_middle_end_flush(middle);
+
+   vert_info.count = fetch_info->count;
+   vert_info.vertex_size = fpme->vertex_size;
+   vert_info.stride = fpme->vertex_size;
+   vert_info.verts = llvm_alloc_vertices(fpme, fetch_info->count);
+   if (!vert_info.verts) {
+      assert(0);
+      return;
+   }
+
+   bool clipped = llvm_vs_run(fpme, &vs_params, vert_info.verts);
+
+   llvm_pipeline_finish(fpme, &vert_info, prim_info, clipped);
+}
+
+
 static inline enum mesa_prim
 prim_type(enum mesa_prim prim, unsigned flags)
 {
@@ -845,7 +1140,7 @@ llvm_middle_end_linear_run_elts(struct draw_pt_middle_end *middle,
 static void
 llvm_middle_end_finish(struct draw_pt_middle_end *middle)
 {
-   /* nothing to do */
+   llvm_middle_end_flush(middle);
 }
 
 
@@ -854,6 +1149,9 @@ llvm_middle_end_destroy(struct draw_pt_middle_end *middle)
 {
    struct llvm_middle_end *fpme = llvm_middle_end(middle);
 
+   llvm_middle_end_flush(middle);
+   llvm_vs_queue_destroy(fpme);
+
    if (fpme->fetch)
       draw_pt_fetch_destroy(fpme->fetch);
 
@@ -887,6 +1185,7 @@ draw_pt_fetch_pipeline_or_emit_llvm(struct draw_context *draw)
    fpme->base.run             = llvm_middle_end_run;
    fpme->base.run_linear      = llvm_middle_end_linear_run;
    fpme->base.run_linear_elts = llvm_middle_end_linear_run_elts;
+   fpme->base.flush           = llvm_middle_end_flush;
    fpme->base.finish          = llvm_middle_end_finish;
    fpme->base.destroy         = llvm_middle_end_destroy;
 
@@ -242,6 +242,10 @@ vsplit_flush(struct draw_pt_front_end *frontend, unsigned flags)
 {
    struct vsplit_frontend *vsplit = (struct vsplit_frontend *) frontend;
 
+   /* Vertices shaded asynchronously depend on the current state */
+   if (vsplit->middle && vsplit->middle->flush)
+      vsplit->middle->flush(vsplit->middle);
+
    if (flags & DRAW_FLUSH_STATE_CHANGE) {
       vsplit->middle->finish(vsplit->middle);
       vsplit->middle = NULL;
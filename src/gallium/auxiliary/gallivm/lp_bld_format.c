@@ -26,8 +26,120 @@
  **************************************************************************/
 
 
+#include "util/detect_os.h"
+#include "util/format/u_format.h"
+#include "util/u_call_once.h"
+#include "util/u_math.h"
+
+#if DETECT_OS_POSIX
+#include <unistd.h>
+#endif
+
 #include "lp_bld_format.h"
 
+
+static unsigned format_cache_size = LP_BUILD_FORMAT_CACHE_MIN_SIZE;
+
+static void
+init_format_cache_size(void)
+{
+#ifdef _SC_LEVEL2_CACHE_SIZE
+   /* Let the decoded blocks take up about an eighth of the L2, leaving the
+    * rest for the compressed data itself and the framebuffer tiles.
+    */
+   const long l2_size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+   const unsigned entry_size = sizeof(uint32_t) * 16 + sizeof(uint64_t);
+   if (l2_size > 0) {
+      unsigned entries = l2_size / 8 / entry_size;
+      if (entries > LP_BUILD_FORMAT_CACHE_MIN_SIZE)
+         format_cache_size = MIN2(1u << util_logbase2(entries),
+                                  LP_BUILD_FORMAT_CACHE_SIZE);
+   }
+#endif
+}
+
+
+/**
+ * Number of entries of the block cache used by generated code.
+ */
+unsigned
+lp_build_format_cache_size(void)
+{
+   static util_once_flag once = UTIL_ONCE_FLAG_INIT;
+   util_call_once(&once, init_format_cache_size);
+   return format_cache_size;
+}
+
+
+/**
+ * Whether lp_build_fetch_rgba_aos() can use the block cache for this format.
+ *
+ * S3TC blocks are decoded by generated code, everything else goes through
+ * lp_build_format_cache_fill_block(), which needs 4x4 blocks decoding
+ * exactly to 8 bits per channel.
+ */
+bool
+lp_build_format_cache_supported(const struct util_format_description *format_desc)
+{
+   if (format_desc->layout == UTIL_FORMAT_LAYOUT_S3TC)
+      return true;
+
+   const enum pipe_format format = util_format_linear(format_desc->format);
+   switch (format) {
+   case PIPE_FORMAT_ETC1_RGB8:
+   case PIPE_FORMAT_ETC2_RGB8:
+   case PIPE_FORMAT_ETC2_RGB8A1:
+   case PIPE_FORMAT_ETC2_RGBA8:
+   case PIPE_FORMAT_BPTC_RGBA_UNORM:
+      return util_format_unpack_description(format)->unpack_rgba_8unorm_rect != NULL;
+   default:
+      return false;
+   }
+}
+
+
+/**
+ * Drop all entries.  Needed whenever the memory of a cached texture may
+ * have been rewritten or reused.
+ */
+void
+lp_build_format_cache_invalidate(struct lp_build_format_cache *cache)
+{
+   /* Clear all of it, code compiled elsewhere may use a bigger cache */
+   memset(cache->cache_tags, 0, sizeof(cache->cache_tags));
+#if LP_BUILD_FORMAT_CACHE_DEBUG
+   cache->cache_access_total = 0;
+   cache->cache_access_miss = 0;
+#endif
+}
+
+
+/**
+ * Decode a block into the cache, called from generated code on a miss.
+ *
+ * Texels are stored in the order the lookup expects, i.e. indexed by
+ * x * 4 + y.
+ */
+void
+lp_build_format_cache_fill_block(struct lp_build_format_cache *cache,
+                                 uint32_t hash_index,
+                                 const uint8_t *block,
+                                 uint32_t format)
+{
+   const struct util_format_unpack_description *unpack =
+      util_format_unpack_description(format);
+   uint8_t rgba[4][4][4];
+
+   unpack->unpack_rgba_8unorm_rect(&rgba[0][0][0], sizeof(rgba[0]),
+                                   block, 0, 4, 4);
+
+   for (unsigned y = 0; y < 4; y++)
+      for (unsigned x = 0; x < 4; x++)
+         memcpy(&cache->cache_data[hash_index][x][y], rgba[y][x], 4);
+
+   cache->cache_tags[hash_index] = (uintptr_t)block;
+}
+
 LLVMTypeRef lp_build_format_cache_elem_type(struct gallivm_state *gallivm, enum cache_member member) {
    assert(member == LP_BUILD_FORMAT_CACHE_MEMBER_DATA || member == LP_BUILD_FORMAT_CACHE_MEMBER_TAGS);
    switch (member) {
@@ -49,10 +49,15 @@ struct lp_build_context;
  * Block cache
  *
  * Optional block cache to be used when unpacking big pixel blocks.
- * Must be a power of 2
+ * Direct mapped and tagged with the block address.
+ *
+ * The storage is sized for LP_BUILD_FORMAT_CACHE_SIZE entries, but the
+ * generated code only uses lp_build_format_cache_size() of them, which
+ * depends on the L2 size.  Both must be a power of 2.
  */
 
-#define LP_BUILD_FORMAT_CACHE_SIZE 128
+#define LP_BUILD_FORMAT_CACHE_SIZE 1024
+#define LP_BUILD_FORMAT_CACHE_MIN_SIZE 128
 
 /*
  * Note: cache_data needs 16 byte alignment.
@@ -88,6 +93,31 @@ lp_build_format_cache_member_type(struct gallivm_state *gallivm, enum cache_memb
 LLVMTypeRef
 lp_build_format_cache_elem_type(struct gallivm_state *gallivm, enum cache_member member);
 
+unsigned
+lp_build_format_cache_size(void);
+
+bool
+lp_build_format_cache_supported(const struct util_format_description *format_desc);
+
+void
+lp_build_format_cache_invalidate(struct lp_build_format_cache *cache);
+
+void
+lp_build_format_cache_fill_block(struct lp_build_format_cache *cache,
+                                 uint32_t hash_index,
+                                 const uint8_t *block,
+                                 uint32_t format);
+
+LLVMValueRef
+lp_build_fetch_cached_texels(struct gallivm_state *gallivm,
+                             const struct util_format_description *format_desc,
+                             unsigned n,
+                             LLVMValueRef base_ptr,
+                             LLVMValueRef offset,
+                             LLVMValueRef i,
+                             LLVMValueRef j,
+                             LLVMValueRef cache);
+
 /*
  * AoS
  */
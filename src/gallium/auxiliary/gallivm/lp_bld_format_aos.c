@@ -787,6 +787,37 @@ lp_build_fetch_rgba_aos(struct gallivm_state *gallivm,
        return tmp;
    }
 
+   /*
+    * Other compressed formats which the block cache can hold (etc, bptc),
+    * decoding whole blocks at a time.
+    */
+
+   if (cache &&
+       format_desc->colorspace != UTIL_FORMAT_COLORSPACE_SRGB &&
+       lp_build_format_cache_supported(format_desc)) {
+      struct lp_type tmp_type;
+      LLVMValueRef tmp;
+
+      memset(&tmp_type, 0, sizeof tmp_type);
+      tmp_type.width = 8;
+      tmp_type.length = num_pixels * 4;
+      tmp_type.norm = true;
+
+      tmp = lp_build_fetch_cached_texels(gallivm,
+                                         format_desc,
+                                         num_pixels,
+                                         base_ptr,
+                                         offset,
+                                         i, j,
+                                         cache);
+
+      lp_build_conv(gallivm,
+                    tmp_type, type,
+                    &tmp, 1, &tmp, 1);
+
+      return tmp;
+   }
+
    /*
     * Fallback to util_format_description::fetch_rgba_8unorm().
     */
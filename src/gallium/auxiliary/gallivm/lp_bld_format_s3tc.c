@@ -38,6 +38,7 @@
 
 #include "util/format/u_format.h"
 #include "util/u_math.h"
+#include "util/u_pointer.h"
 #include "util/u_string.h"
 #include "util/u_cpu_detect.h"
 #include "util/u_debug.h"
@@ -57,6 +58,7 @@
 #include "lp_bld_init.h"
 #include "lp_bld_debug.h"
 #include "lp_bld_intr.h"
+#include "lp_bld_misc.h"
 
 
 /**
@@ -1969,6 +1971,47 @@ generate_update_cache_one_block(struct gallivm_state *gallivm,
 }
 
 
+/*
+ * Decode a block of a format without a generated decoder by calling
+ * lp_build_format_cache_fill_block().
+ */
+static void
+update_cached_block_fallback(struct gallivm_state *gallivm,
+                             const struct util_format_description *format_desc,
+                             LLVMValueRef ptr_addr,
+                             LLVMValueRef hash_index,
+                             LLVMValueRef cache)
+{
+   LLVMTypeRef i32t = LLVMInt32TypeInContext(gallivm->context);
+   LLVMTypeRef arg_types[4];
+   LLVMValueRef args[4];
+
+   arg_types[0] = LLVMTypeOf(cache);
+   arg_types[1] = i32t;
+   arg_types[2] = LLVMTypeOf(ptr_addr);
+   arg_types[3] = i32t;
+   LLVMTypeRef function_type =
+      LLVMFunctionType(LLVMVoidTypeInContext(gallivm->context),
+                       arg_types, ARRAY_SIZE(arg_types), 0);
+
+   /* The function pointer is only valid in this process */
+   if (gallivm->cache)
+      gallivm->cache->dont_cache = true;
+   LLVMValueRef function =
+      lp_build_const_func_pointer_from_type(gallivm,
+                                            func_to_pointer((func_pointer)lp_build_format_cache_fill_block),
+                                            function_type,
+                                            "format_cache_fill_block");
+
+   args[0] = cache;
+   args[1] = hash_index;
+   args[2] = ptr_addr;
+   args[3] = lp_build_const_int32(gallivm, format_desc->format);
+   LLVMBuildCall2(gallivm->builder, function_type, function,
+                  args, ARRAY_SIZE(args), "");
+}
+
+
 static void
 update_cached_block(struct gallivm_state *gallivm,
                     const struct util_format_description *format_desc,
@@ -1986,6 +2029,12 @@ update_cached_block(struct gallivm_state *gallivm,
    LLVMBasicBlockRef bb;
    LLVMValueRef args[3];
 
+   if (format_desc->layout != UTIL_FORMAT_LAYOUT_S3TC) {
+      update_cached_block_fallback(gallivm, format_desc, ptr_addr,
+                                   hash_index, cache);
+      return;
+   }
+
    snprintf(name, sizeof name, "%s_update_cache_one_block",
             format_desc->short_name);
    function = LLVMGetNamedFunction(module, name);
@@ -2019,18 +2068,21 @@ update_cached_block(struct gallivm_state *gallivm,
    LLVMSetInstructionCallConv(inst, LLVMFastCallConv);
 }
 
-/*
- * cached lookup
+/**
+ * Fetch n texels of a compressed format through the block cache, see
+ * lp_build_format_cache_supported().
+ *
+ * \return  the texels as n * 4 unorm8 values
  */
-static LLVMValueRef
-compressed_fetch_cached(struct gallivm_state *gallivm,
-                        const struct util_format_description *format_desc,
-                        unsigned n,
-                        LLVMValueRef base_ptr,
-                        LLVMValueRef offset,
-                        LLVMValueRef i,
-                        LLVMValueRef j,
-                        LLVMValueRef cache)
+LLVMValueRef
+lp_build_fetch_cached_texels(struct gallivm_state *gallivm,
+                             const struct util_format_description *format_desc,
+                             unsigned n,
+                             LLVMValueRef base_ptr,
+                             LLVMValueRef offset,
+                             LLVMValueRef i,
+                             LLVMValueRef j,
+                             LLVMValueRef cache)
 
 {
    LLVMBuilderRef builder = gallivm->builder;
@@ -2059,7 +2111,7 @@ compressed_fetch_cached(struct gallivm_state *gallivm,
     */
 
    low_bit = util_logbase2(format_desc->block.bits / 8);
-   log2size = util_logbase2(LP_BUILD_FORMAT_CACHE_SIZE);
+   log2size = util_logbase2(lp_build_format_cache_size());
    addr = LLVMBuildPtrToInt(builder, base_ptr, i64t, "");
    ptr_addrtrunc = LLVMBuildPtrToInt(builder, base_ptr, i32t, "");
    ptr_addrtrunc = lp_build_broadcast_scalar(&bld32, ptr_addrtrunc);
@@ -2077,7 +2129,7 @@ compressed_fetch_cached(struct gallivm_state *gallivm,
                        lp_build_const_int_vec(gallivm, type, log2size), "");
    hash_index = LLVMBuildXor(builder, hash_index, tmp, "");
 
-   hash_mask = lp_build_const_int_vec(gallivm, type, LP_BUILD_FORMAT_CACHE_SIZE - 1);
+   hash_mask = lp_build_const_int_vec(gallivm, type, lp_build_format_cache_size() - 1);
    hash_index = LLVMBuildAnd(builder, hash_index, hash_mask, "");
    ij_index = LLVMBuildShl(builder, i, lp_build_const_int_vec(gallivm, type, 2), "");
    ij_index = LLVMBuildAdd(builder, ij_index, j, "");
@@ -2197,8 +2249,8 @@ lp_build_fetch_s3tc_rgba_aos(struct gallivm_state *gallivm,
 
 /*   debug_printf("format = %d\n", format_desc->format);*/
    if (cache) {
-      rgba = compressed_fetch_cached(gallivm, format_desc, n,
-                                     base_ptr, offset, i, j, cache);
+      rgba = lp_build_fetch_cached_texels(gallivm, format_desc, n,
+                                          base_ptr, offset, i, j, cache);
       return rgba;
    }
 
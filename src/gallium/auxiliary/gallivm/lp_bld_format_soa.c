@@ -766,7 +766,8 @@ lp_build_fetch_rgba_soa(struct gallivm_state *gallivm,
    if ((format_desc->layout != UTIL_FORMAT_LAYOUT_PLAIN) &&
        (util_format_fits_8unorm(format_desc) ||
         format_desc->layout == UTIL_FORMAT_LAYOUT_RGTC ||
-        format_desc->layout == UTIL_FORMAT_LAYOUT_S3TC) &&
+        format_desc->layout == UTIL_FORMAT_LAYOUT_S3TC ||
+        (cache && lp_build_format_cache_supported(format_desc))) &&
        type.floating && type.width == 32 &&
        (type.length == 1 || (type.length % 4 == 0))) {
       struct lp_type tmp_type;
@@ -803,7 +804,7 @@ lp_build_fetch_rgba_soa(struct gallivm_state *gallivm,
        */
       frgba8_desc = util_format_description(is_signed ? PIPE_FORMAT_R8G8B8A8_SNORM : PIPE_FORMAT_R8G8B8A8_UNORM);
       if (format_desc->colorspace == UTIL_FORMAT_COLORSPACE_SRGB) {
-         assert(format_desc->layout == UTIL_FORMAT_LAYOUT_S3TC);
+         assert(lp_build_format_cache_supported(format_desc));
          frgba8_desc = util_format_description(PIPE_FORMAT_R8G8B8A8_SRGB);
       }
       lp_build_unpack_rgba_soa(gallivm,
@@ -3886,7 +3886,8 @@ lp_build_sample_gen_func(struct gallivm_state *gallivm,
                          unsigned sampler_index,
                          LLVMValueRef function,
                          unsigned num_args,
-                         unsigned sample_key)
+                         unsigned sample_key,
+                         bool need_cache)
 {
    LLVMBuilderRef old_builder;
    LLVMBasicBlockRef block;
@@ -3901,7 +3902,6 @@ lp_build_sample_gen_func(struct gallivm_state *gallivm,
    struct lp_derivatives *deriv_ptr = NULL;
    unsigned num_param = 0;
    unsigned num_coords, num_derivs, num_offsets, layer;
-   bool need_cache = false;
 
    const enum lp_sampler_lod_control lod_control =
        (sample_key & LP_SAMPLER_LOD_CONTROL_MASK)
@@ -3917,14 +3917,6 @@ lp_build_sample_gen_func(struct gallivm_state *gallivm,
    if (layer && op_type == LP_SAMPLER_OP_LODQ)
       layer = 0;
 
-   if (dynamic_state->cache_ptr) {
-      const struct util_format_description *format_desc;
-      format_desc = util_format_description(static_texture_state->format);
-      if (format_desc->layout == UTIL_FORMAT_LAYOUT_S3TC) {
-         need_cache = true;
-      }
-   }
-
    /* "unpack" arguments */
    resources_ptr = LLVMGetParam(function, num_param++);
    if (need_cache) {
@@ -4039,11 +4031,12 @@ lp_build_sample_soa_func(struct gallivm_state *gallivm,
    if (layer && op_type == LP_SAMPLER_OP_LODQ)
       layer = 0;
 
+   /* Callers without per-thread data (e.g. compute) get no cache */
    bool need_cache = false;
-   if (dynamic_state->cache_ptr) {
+   if (dynamic_state->cache_ptr && params->thread_data_ptr) {
       const struct util_format_description *format_desc;
       format_desc = util_format_description(static_texture_state->format);
-      if (format_desc->layout == UTIL_FORMAT_LAYOUT_S3TC) {
+      if (lp_build_format_cache_supported(format_desc)) {
          need_cache = true;
       }
    }
@@ -4134,7 +4127,8 @@ lp_build_sample_soa_func(struct gallivm_state *gallivm,
                                sampler_index,
                                function,
                                num_param,
-                               sample_key);
+                               sample_key,
+                               need_cache);
    }
 
    unsigned num_args = 0;
@@ -1317,6 +1317,12 @@ hud_parse_env_var(struct hud_context *hud, struct pipe_screen *screen,
       else if (strcmp(name, "API-thread-num-batches") == 0) {
          hud_thread_counter_install(pane, name, HUD_COUNTER_BATCHES);
       }
+      else if (strcmp(name, "API-thread-num-stalls") == 0) {
+         hud_thread_counter_install(pane, name, HUD_COUNTER_STALLS);
+      }
+      else if (strcmp(name, "API-thread-batch-fill") == 0) {
+         hud_thread_counter_install(pane, name, HUD_COUNTER_BATCH_FILL);
+      }
       else if (strcmp(name, "main-thread-busy") == 0) {
          hud_thread_busy_install(pane, name, true);
       }
@@ -424,6 +424,17 @@ static unsigned get_counter(struct hud_graph *gr, enum hud_counter counter)
       value = mon->num_batches;
       mon->num_batches = 0;
       return value;
+   case HUD_COUNTER_STALLS:
+      value = mon->num_stalls;
+      mon->num_stalls = 0;
+      return value;
+   case HUD_COUNTER_BATCH_FILL:
+      /* The average fill percentage of the batches. */
+      value = mon->num_filled_batches ?
+                 mon->batch_fill / mon->num_filled_batches : 0;
+      mon->batch_fill = 0;
+      mon->num_filled_batches = 0;
+      return value;
    default:
       assert(0);
       return 0;
@@ -40,6 +40,7 @@
 #include "util/u_upload_mgr.h"
 #include "lp_clear.h"
 #include "lp_context.h"
+#include "lp_debug.h"
 #include "lp_flush.h"
 #include "lp_perf.h"
 #include "lp_state.h"
@@ -48,6 +49,7 @@
 #include "lp_setup.h"
 #include "lp_screen.h"
 #include "lp_fence.h"
+#include "lp_texture.h"
 
 static void
 llvmpipe_destroy(struct pipe_context *pipe)
@@ -59,6 +61,12 @@ llvmpipe_destroy(struct pipe_context *pipe)
    mtx_lock(&lp_screen->ctx_mutex);
    list_del(&llvmpipe->list);
    mtx_unlock(&lp_screen->ctx_mutex);
+
+   /* Background compiles reference this context, let them finish */
+   if (llvmpipe->fs_compile_queue_enabled)
+      util_queue_destroy(&llvmpipe->fs_compile_queue);
+   llvmpipe_fs_precompile_fini(llvmpipe);
+
    lp_print_counters();
 
    if (llvmpipe->csctx) {
@@ -272,6 +280,21 @@ llvmpipe_create_context(struct pipe_screen *screen, void *priv,
    if (!llvmpipe->context.ref)
       goto fail;
 
+   /* Background fragment shader compilation needs a private LLVM context
+    * per job, so it can't be used with the global one.
+    */
+#ifndef USE_GLOBAL_LLVM_CONTEXT
+   unsigned num_compile_threads =
+      debug_get_num_option("LP_ASYNC_FS_COMPILE", 0);
+   if (num_compile_threads) {
+      llvmpipe->fs_compile_queue_enabled =
+         util_queue_init(&llvmpipe->fs_compile_queue, "lpfs", 64,
+                         MIN2(num_compile_threads, 16),
+                         UTIL_QUEUE_INIT_RESIZE_IF_FULL |
+                         UTIL_QUEUE_INIT_USE_MINIMUM_PRIORITY, NULL);
+   }
+#endif
+
    /*
     * Create drawing context and plug our rendering stage into it.
     */
@@ -288,6 +311,9 @@ llvmpipe_create_context(struct pipe_screen *screen, void *priv,
    draw_set_constant_buffer_stride(llvmpipe->draw,
                                    lp_get_constant_buffer_stride(screen));
 
+   if (!(LP_PERF & PERF_NO_DRAW_THREADS))
+      draw_set_num_threads(llvmpipe->draw, lp_screen->num_threads);
+
    /* FIXME: devise alternative to draw_texture_samplers */
 
    llvmpipe->setup = lp_setup_create(&llvmpipe->pipe, llvmpipe->draw);
@@ -347,7 +373,18 @@ llvmpipe_create_context(struct pipe_screen *screen, void *priv,
    mtx_lock(&lp_screen->ctx_mutex);
    list_addtail(&llvmpipe->list, &lp_screen->ctx_list);
    mtx_unlock(&lp_screen->ctx_mutex);
-   return &llvmpipe->pipe;
+
+   if (!(flags & PIPE_CONTEXT_PREFER_THREADED))
+      return &llvmpipe->pipe;
+
+   return threaded_context_create(&llvmpipe->pipe,
+                                  &lp_screen->transfer_pool,
+                                  llvmpipe_replace_buffer_storage,
+                                  &(struct threaded_context_options) {
+                                     .is_resource_busy = llvmpipe_is_resource_busy,
+                                     .unsynchronized_texture_subdata = true,
+                                  },
+                                  &llvmpipe->tc);
 
  fail:
    llvmpipe_destroy(&llvmpipe->pipe);
@@ -34,7 +34,9 @@
 #include "pipe/p_context.h"
 
 #include "draw/draw_vertex.h"
+#include "util/simple_mtx.h"
 #include "util/u_blitter.h"
+#include "util/u_dynarray.h"
 
 #include "lp_tex_sample.h"
 #include "lp_jit.h"
@@ -55,11 +57,16 @@ struct lp_blend_state;
 struct lp_setup_context;
 struct lp_setup_variant;
 struct lp_velems_state;
+struct threaded_context;
 
 struct llvmpipe_context {
    struct pipe_context pipe;  /**< base class */
 
    struct list_head list;
+
+   /** Set when wrapped by u_threaded_context */
+   struct threaded_context *tc;
+
    /** Constant state objects */
    const struct pipe_blend_state *blend;
    struct pipe_sampler_state *samplers[PIPE_SHADER_MESH_TYPES][PIPE_MAX_SAMPLERS];
@@ -192,6 +199,17 @@ struct llvmpipe_context {
    /** The LLVMContext to use for LLVM related work */
    lp_context_ref context;
 
+   /** Background fragment shader compiles, see LP_ASYNC_FS_COMPILE */
+   struct util_queue fs_compile_queue;
+   bool fs_compile_queue_enabled;
+   struct list_head fs_precompiles;   /**< all jobs not freed yet */
+
+   /** Shaders created since the last draw, which may be on another thread
+    * with u_threaded_context.  Protected by fs_precompile_lock.
+    */
+   simple_mtx_t fs_precompile_lock;
+   struct util_dynarray fs_precompile_pending;
+
    int max_global_buffers;
    struct pipe_resource **global_buffers;
 
@@ -28,61 +28,208 @@
  * based on threadpool.c but modified heavily to be compute shader tuned.
  */
 
+#include "util/detect.h"
+#include "util/u_atomic.h"
 #include "util/u_thread.h"
 #include "util/u_memory.h"
+#include "util/thread_sched.h"
 #include "lp_cs_tpool.h"
+#include "lp_debug.h"
+
+#if DETECT_ARCH_SSE
+#include <xmmintrin.h>
+#endif
+
+/* Chunks handed to each range, more gives finer grained stealing. */
+#define LP_CS_CHUNKS_PER_THREAD 4
+
+/* How long idle workers and waiters poll before going to sleep. */
+#define LP_CS_SPIN_COUNT 1024
+
+static inline void
+cpu_relax(void)
+{
+#if DETECT_ARCH_SSE
+   _mm_pause();
+#elif DETECT_ARCH_AARCH64 && defined(__GNUC__)
+   __asm__ volatile("yield");
+#endif
+}
+
+/**
+ * Take one chunk from the given range: from the head for the owning
+ * thread, from the tail when stealing.  Returns false if it is empty.
+ */
+static bool
+range_pop(struct lp_cs_tpool_range *r, bool steal, unsigned *chunk)
+{
+   uint64_t old = p_atomic_read(&r->range);
+
+   while (1) {
+      const uint32_t head = old & 0xffffffff;
+      const uint32_t tail = old >> 32;
+      uint64_t range;
+
+      if (head >= tail)
+         return false;
+
+      if (steal)
+         range = ((uint64_t)(tail - 1) << 32) | head;
+      else
+         range = ((uint64_t)tail << 32) | (head + 1);
+
+      const uint64_t prev = p_atomic_cmpxchg(&r->range, old, range);
+      if (prev == old) {
+         *chunk = steal ? tail - 1 : head;
+         return true;
+      }
+      old = prev;
+   }
+}
+
+static bool
+task_pop_chunk(struct lp_cs_tpool_task *task, unsigned own, bool steal,
+               unsigned *chunk)
+{
+   if (range_pop(&task->ranges[own], false, chunk))
+      return true;
+
+   if (!steal)
+      return false;
+
+   /* Steal from the range with the most chunks left. */
+   while (1) {
+      unsigned victim = own, max_left = 0;
+
+      for (unsigned r = 0; r < task->num_ranges; r++) {
+         const uint64_t range = p_atomic_read(&task->ranges[r].range);
+         const uint32_t head = range & 0xffffffff;
+         const uint32_t tail = range >> 32;
+         if (tail > head && tail - head > max_left) {
+            max_left = tail - head;
+            victim = r;
+         }
+      }
+
+      if (max_left == 0)
+         return false;
+
+      if (range_pop(&task->ranges[victim], true, chunk))
+         return true;
+   }
+}
+
+/**
+ * Run chunks of the task until there are none left for this thread.
+ */
+static void
+task_run_chunks(struct lp_cs_tpool_task *task, unsigned own, bool steal,
+                struct lp_cs_local_mem *lmem)
+{
+   unsigned chunk;
+
+   while (task_pop_chunk(task, own, steal, &chunk)) {
+      const unsigned start = chunk * task->chunk_size;
+      const unsigned end = MIN2(start + task->chunk_size, task->iter_total);
+
+      for (unsigned i = start; i < end; i++)
+         task->work(task->data, i, lmem);
+
+      p_atomic_add(&task->iter_finished, end - start);
+   }
+}
+
+static inline bool
+task_done(struct lp_cs_tpool_task *task)
+{
+   return p_atomic_read(&task->iter_finished) == task->iter_total &&
+          p_atomic_read(&task->users) == 0;
+}
 
 static int
 lp_cs_tpool_worker(void *data)
 {
-   struct lp_cs_tpool *pool = data;
-   struct lp_cs_local_mem lmem;
+   struct lp_cs_tpool_thread *thread = data;
+   struct lp_cs_tpool *pool = thread->pool;
 
-   memset(&lmem, 0, sizeof(lmem));
    mtx_lock(&pool->m);
 
    while (!pool->shutdown) {
       struct lp_cs_tpool_task *task;
-      unsigned iter_per_thread;
 
-      while (list_is_empty(&pool->workqueue) && !pool->shutdown)
-         cnd_wait(&pool->new_work, &pool->m);
+      while (list_is_empty(&pool->workqueue) && !pool->shutdown) {
+         const unsigned seq = pool->work_seq;
+
+         /* Poll for a while before sleeping, new work usually follows
+          * soon after the previous dispatch.
+          */
+         mtx_unlock(&pool->m);
+         for (unsigned i = 0; i < LP_CS_SPIN_COUNT &&
+                 p_atomic_read(&pool->work_seq) == seq; i++)
+            cpu_relax();
+         mtx_lock(&pool->m);
+
+         if (list_is_empty(&pool->workqueue) && !pool->shutdown &&
+             pool->work_seq == seq) {
+            pool->num_sleeping++;
+            cnd_wait(&pool->new_work, &pool->m);
+            pool->num_sleeping--;
+         }
+      }
 
       if (pool->shutdown)
          break;
 
       task = list_first_entry(&pool->workqueue, struct lp_cs_tpool_task,
                               list);
-
-      unsigned this_iter = task->iter_start;
-
-      iter_per_thread = task->iter_per_thread;
-
-      if (task->iter_remainder &&
-          task->iter_start + task->iter_remainder == task->iter_total) {
-         task->iter_remainder--;
-         iter_per_thread = 1;
-      }
-
-      task->iter_start += iter_per_thread;
-
-      if (task->iter_start == task->iter_total)
-         list_del(&task->list);
-
+      /* Rotate the queue so that the next worker takes the next task.
+       * When several contexts dispatch at once, e.g. the queues of a
+       * lavapipe device, each of them gets a share of the workers instead
+       * of the oldest dispatch taking all of them.
+       */
+      list_del(&task->list);
+      list_addtail(&task->list, &pool->workqueue);
+      p_atomic_inc(&task->users);
       mtx_unlock(&pool->m);
-      for (unsigned i = 0; i < iter_per_thread; i++)
-         task->work(task->data, this_iter + i, &lmem);
 
+      task_run_chunks(task, thread->index, pool->steal, &thread->lmem);
+
+      /* Nothing left to hand out, so later workers can skip the task.
+       * The waiter frees it once the last user is gone.
+       */
       mtx_lock(&pool->m);
-      task->iter_finished += iter_per_thread;
-      if (task->iter_finished == task->iter_total)
-         cnd_broadcast(&task->finish);
+      list_delinit(&task->list);
+      p_atomic_dec(&task->users);
+      if (task_done(task))
+         cnd_broadcast(&pool->finished);
    }
    mtx_unlock(&pool->m);
-   FREE(lmem.local_mem_ptr);
    return 0;
 }
 
+/**
+ * Grab the waiters' local memory, or fall back to a temporary one if
+ * another thread is using it.
+ */
+static struct lp_cs_local_mem *
+caller_lmem_get(struct lp_cs_tpool *pool, struct lp_cs_local_mem *tmp)
+{
+   if (p_atomic_cmpxchg(&pool->caller_lmem_busy, 0, 1) == 0)
+      return &pool->caller_lmem;
+
+   memset(tmp, 0, sizeof(*tmp));
+   return tmp;
+}
+
+static void
+caller_lmem_put(struct lp_cs_tpool *pool, struct lp_cs_local_mem *lmem)
+{
+   if (lmem == &pool->caller_lmem)
+      p_atomic_xchg(&pool->caller_lmem_busy, 0);
+   else
+      FREE(lmem->local_mem_ptr);
+}
+
 struct lp_cs_tpool *
 lp_cs_tpool_create(unsigned num_threads)
 {
@@ -93,16 +240,32 @@ lp_cs_tpool_create(unsigned num_threads)
 
    (void) mtx_init(&pool->m, mtx_plain);
    cnd_init(&pool->new_work);
+   cnd_init(&pool->finished);
 
    list_inithead(&pool->workqueue);
+   pool->steal = !(LP_PERF & PERF_NO_CS_STEAL);
    assert (num_threads <= LP_MAX_THREADS);
+   pool->threads = CALLOC(MAX2(1, num_threads), sizeof(*pool->threads));
+   pool->thread_data = CALLOC(MAX2(1, num_threads),
+                              sizeof(*pool->thread_data));
+   if (!pool->threads || !pool->thread_data)
+      num_threads = 0;
    for (unsigned i = 0; i < num_threads; i++) {
-      if (thrd_success != u_thread_create(pool->threads + i, lp_cs_tpool_worker, pool)) {
+      pool->thread_data[i].pool = pool;
+      pool->thread_data[i].index = i;
+      if (thrd_success != u_thread_create(pool->threads + i, lp_cs_tpool_worker,
+                                          &pool->thread_data[i])) {
          num_threads = i;  /* previous thread is max */
          break;
       }
    }
    pool->num_threads = num_threads;
+
+   /* Same L3 grouping as the rasterizer threads. */
+   if (!(LP_PERF & PERF_NO_PIN_THREADS)) {
+      for (unsigned i = 0; i < num_threads; i++)
+         util_thread_sched_pin_to_L3(pool->threads[i], i, num_threads);
+   }
    return pool;
 }
 
@@ -114,15 +277,21 @@ lp_cs_tpool_destroy(struct lp_cs_tpool *pool)
 
    mtx_lock(&pool->m);
    pool->shutdown = true;
+   p_atomic_inc(&pool->work_seq);
    cnd_broadcast(&pool->new_work);
    mtx_unlock(&pool->m);
 
    for (unsigned i = 0; i < pool->num_threads; i++) {
       thrd_join(pool->threads[i], NULL);
+      FREE(pool->thread_data[i].lmem.local_mem_ptr);
    }
 
+   cnd_destroy(&pool->finished);
    cnd_destroy(&pool->new_work);
    mtx_destroy(&pool->m);
+   FREE(pool->caller_lmem.local_mem_ptr);
+   FREE(pool->thread_data);
+   FREE(pool->threads);
    FREE(pool);
 }
 
@@ -133,16 +302,21 @@ lp_cs_tpool_queue_task(struct lp_cs_tpool *pool,
    struct lp_cs_tpool_task *task;
 
    if (pool->num_threads == 0) {
-      struct lp_cs_local_mem lmem;
+      struct lp_cs_local_mem tmp;
+      struct lp_cs_local_mem *lmem = caller_lmem_get(pool, &tmp);
 
-      memset(&lmem, 0, sizeof(lmem));
       for (unsigned t = 0; t < num_iters; t++) {
-         work(data, t, &lmem);
+         work(data, t, lmem);
       }
-      FREE(lmem.local_mem_ptr);
+      caller_lmem_put(pool, lmem);
       return NULL;
    }
-   task = CALLOC_STRUCT(lp_cs_tpool_task);
+
+   /* One range per worker, the last one for the waiting thread. */
+   const unsigned num_ranges = pool->num_threads + 1;
+
+   task = align_calloc(sizeof(*task) + num_ranges * sizeof(task->ranges[0]),
+                       CACHE_LINE_SIZE);
    if (!task) {
       return NULL;
    }
@@ -150,36 +324,63 @@ lp_cs_tpool_queue_task(struct lp_cs_tpool *pool,
    task->work = work;
    task->data = data;
    task->iter_total = num_iters;
+   task->num_ranges = num_ranges;
+   list_inithead(&task->list);
+
+   task->chunk_size = MAX2(1, num_iters / (num_ranges * LP_CS_CHUNKS_PER_THREAD));
+   const unsigned num_chunks = DIV_ROUND_UP(num_iters, task->chunk_size);
 
-   task->iter_per_thread = num_iters / pool->num_threads;
-   task->iter_remainder = num_iters % pool->num_threads;
+   for (unsigned r = 0; r < num_ranges; r++) {
+      const uint64_t head = (uint64_t)num_chunks * r / num_ranges;
+      const uint64_t tail = (uint64_t)num_chunks * (r + 1) / num_ranges;
+      task->ranges[r].range = (tail << 32) | head;
+   }
 
-   cnd_init(&task->finish);
+   /* A single chunk lands in the waiter's range, don't wake anybody. */
+   if (num_chunks <= 1)
+      return task;
 
    mtx_lock(&pool->m);
 
    list_addtail(&task->list, &pool->workqueue);
+   p_atomic_inc(&pool->work_seq);
 
-   cnd_broadcast(&pool->new_work);
+   if (pool->num_sleeping)
+      cnd_broadcast(&pool->new_work);
    mtx_unlock(&pool->m);
    return task;
 }
 
+/**
+ * Wait for all iterations of the task to finish and free it.  The calling
+ * thread runs chunks itself until there are none left to take.
+ */
 void
 lp_cs_tpool_wait_for_task(struct lp_cs_tpool *pool,
                           struct lp_cs_tpool_task **task_handle)
 {
    struct lp_cs_tpool_task *task = *task_handle;
+   struct lp_cs_local_mem tmp;
 
    if (!pool || !task)
       return;
 
+   /* Always steal: with PERF_NO_CS_STEAL this picks up ranges of workers
+    * which were busy elsewhere.
+    */
+   struct lp_cs_local_mem *lmem = caller_lmem_get(pool, &tmp);
+   task_run_chunks(task, task->num_ranges - 1, true, lmem);
+   caller_lmem_put(pool, lmem);
+
+   for (unsigned i = 0; i < LP_CS_SPIN_COUNT && !task_done(task); i++)
+      cpu_relax();
+
    mtx_lock(&pool->m);
-   while (task->iter_finished < task->iter_total)
-      cnd_wait(&task->finish, &pool->m);
+   list_delinit(&task->list);
+   while (!task_done(task))
+      cnd_wait(&pool->finished, &pool->m);
    mtx_unlock(&pool->m);
 
-   cnd_destroy(&task->finish);
-   FREE(task);
+   align_free(task);
    *task_handle = NULL;
 }
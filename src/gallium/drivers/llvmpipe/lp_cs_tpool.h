@@ -30,44 +30,84 @@
  * structs with just unique indexes in them.
  * It also supports a local memory support struct to be passed from
  * outside the thread exec function.
+ *
+ * The iterations of a task are grouped into chunks, and the chunks are
+ * split into one range per worker thread plus one for the thread waiting
+ * on the task.  Each thread takes chunks from the head of its own range
+ * and, once that is empty, steals from the tail of the fullest other
+ * range, so no lock is taken per chunk.  Idle workers and waiters spin
+ * for a short while before sleeping, which keeps back-to-back small
+ * dispatches from paying for a wakeup each.
  */
 #ifndef LP_CS_QUEUE
 #define LP_CS_QUEUE
 
 #include "util/compiler.h"
 
+#include "util/u_memory.h"
 #include "util/u_thread.h"
 #include "util/list.h"
 
 #include "lp_limits.h"
 
+struct lp_cs_local_mem {
+   unsigned local_size;
+   void *local_mem_ptr;
+};
+
+typedef void (*lp_cs_tpool_task_func)(void *data, int iter_idx, struct lp_cs_local_mem *lmem);
+
+/**
+ * Chunks [head, tail) of a task, with both ends packed into one word
+ * (head in the low 32 bits) so that each pop is a single compare-and-swap.
+ * Padded to a cache line to avoid false sharing.
+ */
+struct lp_cs_tpool_range {
+   uint64_t range;
+   uint8_t pad[CACHE_LINE_SIZE - sizeof(uint64_t)];
+};
+
+/**
+ * Per worker thread state.  The local memory is kept for the lifetime of
+ * the pool so it only gets reallocated when a shader needs more of it.
+ */
+struct lp_cs_tpool_thread {
+   struct lp_cs_tpool *pool;
+   unsigned index;
+   struct lp_cs_local_mem lmem;
+};
+
 struct lp_cs_tpool {
    mtx_t m;
    cnd_t new_work;
+   cnd_t finished;
 
-   thrd_t threads[LP_MAX_THREADS];
+   thrd_t *threads;
+   struct lp_cs_tpool_thread *thread_data;
    unsigned num_threads;
    struct list_head workqueue;
+   unsigned num_sleeping;   /**< workers waiting on new_work */
+   unsigned work_seq;       /**< bumped whenever work is queued */
+   bool steal;
    bool shutdown;
-};
 
-struct lp_cs_local_mem {
-   unsigned local_size;
-   void *local_mem_ptr;
+   /* Local memory for the threads waiting on tasks, see
+    * lp_cs_tpool_wait_for_task().
+    */
+   struct lp_cs_local_mem caller_lmem;
+   unsigned caller_lmem_busy;
 };
 
-typedef void (*lp_cs_tpool_task_func)(void *data, int iter_idx, struct lp_cs_local_mem *lmem);
-
 struct lp_cs_tpool_task {
    lp_cs_tpool_task_func work;
    void *data;
    struct list_head list;
-   cnd_t finish;
    unsigned iter_total;
-   unsigned iter_start;
-   unsigned iter_finished;
-   unsigned iter_per_thread;
-   unsigned iter_remainder;
+   unsigned iter_finished;  /**< atomic */
+   unsigned chunk_size;     /**< iterations per chunk */
+   unsigned users;          /**< workers currently running chunks, atomic */
+   unsigned num_ranges;
+   struct lp_cs_tpool_range ranges[];
 };
 
 struct lp_cs_tpool *lp_cs_tpool_create(unsigned num_threads);
@@ -45,7 +45,7 @@
 #define DEBUG_MEM           0x4000
 #define DEBUG_FS            0x8000
 #define DEBUG_CS            0x10000
-// unused                   0x40000
+#define DEBUG_RAST_STATS    0x40000
 #define DEBUG_NO_FASTPATH   0x80000
 #define DEBUG_LINEAR        0x100000
 #define DEBUG_LINEAR2       0x200000
@@ -65,6 +65,11 @@
 #define PERF_NO_ALPHATEST   0x80  	/* disable alpha testing */
 #define PERF_NO_RAST_LINEAR 0x100  	/* disable linear rast */
 #define PERF_NO_SHADE       0x200  	/* disable fragment shaders */
+#define PERF_NO_BIN_STEAL   0x400  	/* rasterize bins in raster order, no work stealing */
+#define PERF_NO_PIN_THREADS 0x800  	/* don't group worker threads by L3 cache */
+#define PERF_NO_TEXCACHE    0x1000 	/* don't cache decoded compressed texels */
+#define PERF_NO_CS_STEAL    0x2000 	/* static compute dispatch split, no work stealing */
+#define PERF_NO_DRAW_THREADS 0x4000	/* shade vertices on the calling thread only */
 
 
 extern int LP_PERF;
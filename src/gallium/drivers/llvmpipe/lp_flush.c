@@ -147,3 +147,22 @@ llvmpipe_flush_resource(struct pipe_context *pipe,
 
    return true;
 }
+
+
+/**
+ * u_threaded_context callback, called from the application thread.  Returns
+ * whether mapping the resource with the given usage would have to wait for
+ * rasterization in any context.
+ */
+bool
+llvmpipe_is_resource_busy(struct pipe_screen *screen,
+                          struct pipe_resource *resource,
+                          unsigned usage)
+{
+   struct llvmpipe_resource *lpr = llvmpipe_resource(resource);
+
+   if (usage & PIPE_MAP_WRITE)
+      return p_atomic_read(&lpr->scene_refs) != 0;
+
+   return p_atomic_read(&lpr->scene_write_refs) != 0;
+}
@@ -33,6 +33,7 @@
 struct pipe_context;
 struct pipe_fence_handle;
 struct pipe_resource;
+struct pipe_screen;
 
 void
 llvmpipe_flush(struct pipe_context *pipe,
@@ -52,4 +53,9 @@ llvmpipe_flush_resource(struct pipe_context *pipe,
                         bool do_not_block,
                         const char *reason);
 
+bool
+llvmpipe_is_resource_busy(struct pipe_screen *screen,
+                          struct pipe_resource *resource,
+                          unsigned usage);
+
 #endif
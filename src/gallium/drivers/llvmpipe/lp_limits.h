@@ -66,7 +66,11 @@
 
 #define LP_MAX_SAMPLES 4
 
-#define LP_MAX_THREADS 32
+/**
+ * Upper bound for LP_NUM_THREADS.  All per-thread state is sized by the
+ * actual thread count at runtime, so this only guards against nonsense.
+ */
+#define LP_MAX_THREADS 1024
 
 
 /**
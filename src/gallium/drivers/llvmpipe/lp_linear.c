@@ -374,5 +374,9 @@ fail:
 void
 lp_linear_check_variant(struct lp_fragment_shader_variant *variant)
 {
+   /* The spanline shader runner needs SSE2, but the whole-shader
+    * fastpaths only depend on lp_linear_kernels.
+    */
+   lp_linear_check_fastpath(variant);
 }
 #endif
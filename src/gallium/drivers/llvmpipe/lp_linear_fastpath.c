@@ -39,6 +39,7 @@
 #include "lp_debug.h"
 #include "lp_state_fs.h"
 #include "lp_linear_priv.h"
+#include "lp_linear_kernels.h"
 
 
 /* This file contains various special-case fastpaths which implement
@@ -48,11 +49,11 @@
  *
  * These functions fully implement the linear path and do not need to
  * be combined with blending, interpolation or sampling routines.
+ * They only use the lp_linear_kernels row kernels, so unlike the rest
+ * of the linear path they are available on every architecture.
  */
 
 
-#if DETECT_ARCH_SSE
-
 /* Linear shader which implements the BLIT_RGBA shader with the
  * additional constraints imposed by lp_setup_is_blit().
  */
@@ -144,13 +145,8 @@ lp_linear_blit_rgb1_blit(const struct lp_rast_state *state,
       return false;
 
    for (y = 0; y < height; y++) {
-      const uint32_t *src_row = (const uint32_t *)src;
-      uint32_t *dst_row = (uint32_t *)color;
-
-      for (x = 0; x < width; x++) {
-         *dst_row++ = *src_row++ | 0xff000000;
-      }
-
+      lp_linear_kernels->rgbx_row((uint32_t *)color,
+                                  (const uint32_t *)src, width);
       color += stride;
       src += src_stride;
    }
@@ -227,13 +223,3 @@ lp_linear_check_fastpath(struct lp_fragment_shader_variant *variant)
     */
    return variant->jit_linear != NULL;
 }
-
-#else
-
-bool
-lp_linear_check_fastpath(struct lp_fragment_shader_variant *variant)
-{
-   return false;
-}
-
-#endif
@@ -0,0 +1,362 @@
+/**************************************************************************
+ *
+ * Copyright 2010-2021 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ **************************************************************************/
+
+
+#include <string.h>
+
+#include "util/detect.h"
+
+#include "util/u_math.h"
+#include "util/u_cpu_detect.h"
+#include "util/u_debug.h"
+#include "util/u_sse.h"
+
+#include "lp_linear_kernels.h"
+
+
+/*
+ * Generic C kernels.  These define the exact results every other
+ * implementation must match, including the truncation of the 8-bit
+ * lerp and the saturation of the premultiplied blend.
+ */
+
+static inline uint32_t
+lerp_8unorm_4(uint32_t a, uint32_t b, unsigned weight)
+{
+   uint32_t res = 0;
+
+   for (unsigned shift = 0; shift < 32; shift += 8) {
+      int ac = (a >> shift) & 0xff;
+      int bc = (b >> shift) & 0xff;
+      uint16_t t = (uint16_t)((bc - ac) * (int)weight);
+      res |= (uint32_t)((ac + (t >> 8)) & 0xff) << shift;
+   }
+
+   return res;
+}
+
+
+static inline uint32_t
+blend_premul_8unorm_4(uint32_t src, uint32_t dst)
+{
+   const unsigned sa = src >> 24;
+   uint32_t res = 0;
+
+   for (unsigned shift = 0; shift < 32; shift += 8) {
+      unsigned sc = (src >> shift) & 0xff;
+      unsigned dc = (dst >> shift) & 0xff;
+      unsigned rc = sc + dc - ((dc * sa) >> 8);
+      res |= MIN2(rc, 0xff) << shift;
+   }
+
+   return res;
+}
+
+
+static void
+rgbx_row_c(uint32_t *dst, const uint32_t *src, unsigned width)
+{
+   for (unsigned i = 0; i < width; i++)
+      dst[i] = src[i] | 0xff000000;
+}
+
+
+static void
+rb_swap_row_c(uint32_t *dst, const uint32_t *src, unsigned width)
+{
+   for (unsigned i = 0; i < width; i++) {
+      uint32_t s = src[i];
+      dst[i] = (s & 0xff00ff00) | ((s & 0xff) << 16) | ((s >> 16) & 0xff);
+   }
+}
+
+
+static void
+rbx_swap_row_c(uint32_t *dst, const uint32_t *src, unsigned width)
+{
+   for (unsigned i = 0; i < width; i++) {
+      uint32_t s = src[i];
+      dst[i] = 0xff000000 | (s & 0xff00) |
+               ((s & 0xff) << 16) | ((s >> 16) & 0xff);
+   }
+}
+
+
+static void
+stretch_row_c(uint32_t *dst, const uint32_t *src, unsigned width,
+              int32_t src_x, int32_t src_xstep)
+{
+   for (unsigned i = 0; i < width; i++) {
+      const uint32_t *s = &src[src_x >> 16];
+      dst[i] = lerp_8unorm_4(s[0], s[1], (src_x >> 8) & 0xff);
+      src_x += src_xstep;
+   }
+}
+
+
+static void
+lerp_rows_c(uint32_t *dst, const uint32_t *src0, const uint32_t *src1,
+            unsigned width, unsigned weight)
+{
+   for (unsigned i = 0; i < width; i++)
+      dst[i] = lerp_8unorm_4(src0[i], src1[i], weight);
+}
+
+
+static void
+blend_premul_row_c(uint32_t *dst, const uint32_t *src, unsigned width)
+{
+   for (unsigned i = 0; i < width; i++)
+      dst[i] = blend_premul_8unorm_4(src[i], dst[i]);
+}
+
+
+const struct lp_linear_kernels lp_linear_kernels_c = {
+   .name = "c",
+   .rgbx_row = rgbx_row_c,
+   .rb_swap_row = rb_swap_row_c,
+   .rbx_swap_row = rbx_swap_row_c,
+   .stretch_row = stretch_row_c,
+   .lerp_rows = lerp_rows_c,
+   .blend_premul_row = blend_premul_row_c,
+};
+
+
+#if DETECT_ARCH_SSE
+
+/*
+ * SSE2 kernels, four pixels at a time.  This is the baseline on x86.
+ */
+
+static void
+rgbx_row_sse2(uint32_t *dst, const uint32_t *src, unsigned width)
+{
+   const __m128i mask_a = _mm_set1_epi32(0xff000000);
+   unsigned i;
+
+   for (i = 0; i + 4 <= width; i += 4) {
+      __m128i s = _mm_loadu_si128((const __m128i *)&src[i]);
+      _mm_storeu_si128((__m128i *)&dst[i], _mm_or_si128(s, mask_a));
+   }
+
+   rgbx_row_c(dst + i, src + i, width - i);
+}
+
+
+static inline __m128i
+rb_swap_4_sse2(__m128i s)
+{
+   const __m128i mask_ga = _mm_set1_epi32(0xff00ff00);
+   const __m128i mask_r = _mm_set1_epi32(0xff);
+
+   __m128i r = _mm_and_si128(_mm_srli_epi32(s, 16), mask_r);
+   __m128i b = _mm_slli_epi32(_mm_and_si128(s, mask_r), 16);
+
+   return _mm_or_si128(_mm_and_si128(s, mask_ga), _mm_or_si128(r, b));
+}
+
+
+static void
+rb_swap_row_sse2(uint32_t *dst, const uint32_t *src, unsigned width)
+{
+   unsigned i;
+
+   for (i = 0; i + 4 <= width; i += 4) {
+      __m128i s = _mm_loadu_si128((const __m128i *)&src[i]);
+      _mm_storeu_si128((__m128i *)&dst[i], rb_swap_4_sse2(s));
+   }
+
+   rb_swap_row_c(dst + i, src + i, width - i);
+}
+
+
+static void
+rbx_swap_row_sse2(uint32_t *dst, const uint32_t *src, unsigned width)
+{
+   const __m128i mask_a = _mm_set1_epi32(0xff000000);
+   unsigned i;
+
+   for (i = 0; i + 4 <= width; i += 4) {
+      __m128i s = _mm_loadu_si128((const __m128i *)&src[i]);
+      _mm_storeu_si128((__m128i *)&dst[i],
+                       _mm_or_si128(rb_swap_4_sse2(s), mask_a));
+   }
+
+   rbx_swap_row_c(dst + i, src + i, width - i);
+}
+
+
+static void
+stretch_row_sse2(uint32_t *dst, const uint32_t *src, unsigned width,
+                 int32_t src_x, int32_t src_xstep)
+{
+   unsigned i;
+
+   for (i = 0; i + 4 <= width; i += 4) {
+      const int32_t x0 = src_x;
+      const int32_t x1 = x0 + src_xstep;
+      const int32_t x2 = x1 + src_xstep;
+      const int32_t x3 = x2 + src_xstep;
+
+      /* Fetch each pair of neighbouring texels with one 64bit load. */
+      __m128i p0 = _mm_loadl_epi64((const __m128i *)&src[x0 >> 16]);
+      __m128i p1 = _mm_loadl_epi64((const __m128i *)&src[x1 >> 16]);
+      __m128i p2 = _mm_loadl_epi64((const __m128i *)&src[x2 >> 16]);
+      __m128i p3 = _mm_loadl_epi64((const __m128i *)&src[x3 >> 16]);
+
+      __m128i p01 = _mm_unpacklo_epi32(p0, p1);
+      __m128i p23 = _mm_unpacklo_epi32(p2, p3);
+      __m128i left = _mm_unpacklo_epi64(p01, p23);
+      __m128i right = _mm_unpackhi_epi64(p01, p23);
+
+      __m128i w_lo = _mm_setr_epi16((x0 >> 8) & 0xff, (x0 >> 8) & 0xff,
+                                    (x0 >> 8) & 0xff, (x0 >> 8) & 0xff,
+                                    (x1 >> 8) & 0xff, (x1 >> 8) & 0xff,
+                                    (x1 >> 8) & 0xff, (x1 >> 8) & 0xff);
+      __m128i w_hi = _mm_setr_epi16((x2 >> 8) & 0xff, (x2 >> 8) & 0xff,
+                                    (x2 >> 8) & 0xff, (x2 >> 8) & 0xff,
+                                    (x3 >> 8) & 0xff, (x3 >> 8) & 0xff,
+                                    (x3 >> 8) & 0xff, (x3 >> 8) & 0xff);
+
+      _mm_storeu_si128((__m128i *)&dst[i],
+                       util_sse2_lerp_epi8_fixed88(left, right,
+                                                   &w_lo, &w_hi));
+
+      src_x = x3 + src_xstep;
+   }
+
+   stretch_row_c(dst + i, src, width - i, src_x, src_xstep);
+}
+
+
+static void
+lerp_rows_sse2(uint32_t *dst, const uint32_t *src0, const uint32_t *src1,
+               unsigned width, unsigned weight)
+{
+   const __m128i w = _mm_set1_epi16(weight);
+   unsigned i;
+
+   for (i = 0; i + 4 <= width; i += 4) {
+      __m128i a = _mm_loadu_si128((const __m128i *)&src0[i]);
+      __m128i b = _mm_loadu_si128((const __m128i *)&src1[i]);
+      _mm_storeu_si128((__m128i *)&dst[i],
+                       util_sse2_lerp_epi8_fixed88(a, b, &w, &w));
+   }
+
+   lerp_rows_c(dst + i, src0 + i, src1 + i, width - i, weight);
+}
+
+
+static void
+blend_premul_row_sse2(uint32_t *dst, const uint32_t *src, unsigned width)
+{
+   unsigned i;
+
+   for (i = 0; i + 4 <= width; i += 4) {
+      __m128i s = _mm_loadu_si128((const __m128i *)&src[i]);
+      __m128i d = _mm_loadu_si128((const __m128i *)&dst[i]);
+      _mm_storeu_si128((__m128i *)&dst[i], util_sse2_blend_premul_4(s, d));
+   }
+
+   blend_premul_row_c(dst + i, src + i, width - i);
+}
+
+
+const struct lp_linear_kernels lp_linear_kernels_sse2 = {
+   .name = "sse2",
+   .rgbx_row = rgbx_row_sse2,
+   .rb_swap_row = rb_swap_row_sse2,
+   .rbx_swap_row = rbx_swap_row_sse2,
+   .stretch_row = stretch_row_sse2,
+   .lerp_rows = lerp_rows_sse2,
+   .blend_premul_row = blend_premul_row_sse2,
+};
+
+#endif /* DETECT_ARCH_SSE */
+
+
+const struct lp_linear_kernels *lp_linear_kernels = &lp_linear_kernels_c;
+
+
+/**
+ * Return the kernel tables the host CPU can run, from the generic C one
+ * up to the widest instruction set.
+ */
+unsigned
+lp_linear_kernels_supported(const struct lp_linear_kernels **tables,
+                            unsigned max_tables)
+{
+   ASSERTED const struct util_cpu_caps_t *caps = util_get_cpu_caps();
+   unsigned n = 0;
+
+   if (n < max_tables)
+      tables[n++] = &lp_linear_kernels_c;
+
+#if DETECT_ARCH_SSE
+   if (n < max_tables && caps->has_sse2)
+      tables[n++] = &lp_linear_kernels_sse2;
+#endif
+
+#ifdef LP_LINEAR_AVX2
+   if (n < max_tables && caps->has_avx2)
+      tables[n++] = &lp_linear_kernels_avx2;
+#endif
+
+#ifdef LP_LINEAR_AVX512
+   if (n < max_tables && caps->has_avx512bw && caps->has_avx512vl)
+      tables[n++] = &lp_linear_kernels_avx512;
+#endif
+
+#if DETECT_ARCH_AARCH64
+   if (n < max_tables)
+      tables[n++] = &lp_linear_kernels_neon;
+#endif
+
+   return n;
+}
+
+
+/**
+ * Pick the widest kernels the CPU supports.  LP_LINEAR_KERNELS=<name>
+ * forces a narrower set, which is useful for comparisons.
+ */
+void
+lp_linear_kernels_init(void)
+{
+   const struct lp_linear_kernels *tables[8];
+   const unsigned n = lp_linear_kernels_supported(tables, ARRAY_SIZE(tables));
+   const char *name = debug_get_option("LP_LINEAR_KERNELS", NULL);
+
+   lp_linear_kernels = tables[n - 1];
+
+   if (name) {
+      for (unsigned i = 0; i < n; i++) {
+         if (strcmp(name, tables[i]->name) == 0)
+            lp_linear_kernels = tables[i];
+      }
+   }
+}
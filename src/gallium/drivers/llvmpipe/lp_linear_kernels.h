@@ -0,0 +1,117 @@
+/**************************************************************************
+ *
+ * Copyright 2010-2021 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ **************************************************************************/
+
+/**
+ * @file
+ * Row kernels for the linear (2D compositing) path.
+ *
+ * Every kernel operates on a single span of packed 8-bit 4-channel pixels.
+ * There is one table per instruction set; the best one supported by the
+ * host is picked once at screen creation and exposed as lp_linear_kernels.
+ * All tables produce bit-identical results to the generic C one.
+ *
+ * Unless noted otherwise, widths are exact (no rounding up to a multiple
+ * of the vector size), pointers need no particular alignment, and dst may
+ * be equal to src.
+ */
+
+#ifndef LP_LINEAR_KERNELS_H
+#define LP_LINEAR_KERNELS_H
+
+#include <stdint.h>
+
+#include "util/detect.h"
+
+
+struct lp_linear_kernels {
+   const char *name;
+
+   /** dst[i] = src[i] with alpha forced to 0xff */
+   void (*rgbx_row)(uint32_t *dst, const uint32_t *src, unsigned width);
+
+   /** dst[i] = src[i] with the red and blue channels swapped */
+   void (*rb_swap_row)(uint32_t *dst, const uint32_t *src, unsigned width);
+
+   /** rb_swap_row() and rgbx_row() combined */
+   void (*rbx_swap_row)(uint32_t *dst, const uint32_t *src, unsigned width);
+
+   /**
+    * Linearly filtered horizontal stretch.  src_x and src_xstep are 16.16
+    * fixed point; texels src[src_x >> 16] and the one to its right are
+    * blended using bits 8..15 of src_x as weight.  dst must not overlap
+    * src.
+    */
+   void (*stretch_row)(uint32_t *dst, const uint32_t *src, unsigned width,
+                       int32_t src_x, int32_t src_xstep);
+
+   /** dst[i] = lerp(src0[i], src1[i], weight / 256) */
+   void (*lerp_rows)(uint32_t *dst, const uint32_t *src0,
+                     const uint32_t *src1, unsigned width, unsigned weight);
+
+   /** ONE/INV_SRC_ALPHA blend of src over dst */
+   void (*blend_premul_row)(uint32_t *dst, const uint32_t *src,
+                            unsigned width);
+};
+
+
+/** The kernels selected for this CPU. */
+extern const struct lp_linear_kernels *lp_linear_kernels;
+
+
+extern const struct lp_linear_kernels lp_linear_kernels_c;
+
+#if DETECT_ARCH_SSE
+extern const struct lp_linear_kernels lp_linear_kernels_sse2;
+#endif
+
+#ifdef LP_LINEAR_AVX2
+extern const struct lp_linear_kernels lp_linear_kernels_avx2;
+
+void
+lp_linear_stretch_row_avx2(uint32_t *dst, const uint32_t *src,
+                           unsigned width,
+                           int32_t src_x, int32_t src_xstep);
+#endif
+
+#ifdef LP_LINEAR_AVX512
+extern const struct lp_linear_kernels lp_linear_kernels_avx512;
+#endif
+
+#if DETECT_ARCH_AARCH64
+extern const struct lp_linear_kernels lp_linear_kernels_neon;
+#endif
+
+
+void
+lp_linear_kernels_init(void);
+
+unsigned
+lp_linear_kernels_supported(const struct lp_linear_kernels **tables,
+                            unsigned max_tables);
+
+
+#endif /* LP_LINEAR_KERNELS_H */
@@ -0,0 +1,224 @@
+/**************************************************************************
+ *
+ * Copyright 2010-2021 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ **************************************************************************/
+
+/*
+ * AVX2 linear path kernels, eight pixels at a time.  This file is built
+ * with -mavx2 and must only be reached after checking
+ * util_get_cpu_caps()->has_avx2.  Spans that are not a multiple of eight
+ * finish in the generic C kernels.
+ */
+
+#include <immintrin.h>
+
+#include "lp_linear_kernels.h"
+
+
+static inline __m256i
+rb_swap_8_avx2(__m256i s)
+{
+   const __m256i shuf = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7,
+                                         10, 9, 8, 11, 14, 13, 12, 15,
+                                         2, 1, 0, 3, 6, 5, 4, 7,
+                                         10, 9, 8, 11, 14, 13, 12, 15);
+   return _mm256_shuffle_epi8(s, shuf);
+}
+
+
+/* ((b - a) * w >> 8) + a on 16 x i16, see util_sse2_lerp_epi16() */
+static inline __m256i
+lerp_epi16_avx2(__m256i w, __m256i a, __m256i b)
+{
+   __m256i res = _mm256_sub_epi16(b, a);
+   res = _mm256_mullo_epi16(res, w);
+   res = _mm256_srli_epi16(res, 8);
+   return _mm256_add_epi8(res, a);
+}
+
+
+/*
+ * Lerp eight pixels.  w_lo and w_hi hold the per-channel weights in the
+ * order produced by unpacking the low and high halves of each 128bit lane.
+ */
+static inline __m256i
+lerp_8unorm_avx2(__m256i a, __m256i b, __m256i w_lo, __m256i w_hi)
+{
+   const __m256i zero = _mm256_setzero_si256();
+
+   __m256i lo = lerp_epi16_avx2(w_lo,
+                                _mm256_unpacklo_epi8(a, zero),
+                                _mm256_unpacklo_epi8(b, zero));
+   __m256i hi = lerp_epi16_avx2(w_hi,
+                                _mm256_unpackhi_epi8(a, zero),
+                                _mm256_unpackhi_epi8(b, zero));
+
+   return _mm256_packus_epi16(lo, hi);
+}
+
+
+static void
+rgbx_row_avx2(uint32_t *dst, const uint32_t *src, unsigned width)
+{
+   const __m256i mask_a = _mm256_set1_epi32(0xff000000);
+   unsigned i;
+
+   for (i = 0; i + 8 <= width; i += 8) {
+      __m256i s = _mm256_loadu_si256((const __m256i *)&src[i]);
+      _mm256_storeu_si256((__m256i *)&dst[i], _mm256_or_si256(s, mask_a));
+   }
+
+   lp_linear_kernels_c.rgbx_row(dst + i, src + i, width - i);
+}
+
+
+static void
+rb_swap_row_avx2(uint32_t *dst, const uint32_t *src, unsigned width)
+{
+   unsigned i;
+
+   for (i = 0; i + 8 <= width; i += 8) {
+      __m256i s = _mm256_loadu_si256((const __m256i *)&src[i]);
+      _mm256_storeu_si256((__m256i *)&dst[i], rb_swap_8_avx2(s));
+   }
+
+   lp_linear_kernels_c.rb_swap_row(dst + i, src + i, width - i);
+}
+
+
+static void
+rbx_swap_row_avx2(uint32_t *dst, const uint32_t *src, unsigned width)
+{
+   const __m256i mask_a = _mm256_set1_epi32(0xff000000);
+   unsigned i;
+
+   for (i = 0; i + 8 <= width; i += 8) {
+      __m256i s = _mm256_loadu_si256((const __m256i *)&src[i]);
+      _mm256_storeu_si256((__m256i *)&dst[i],
+                          _mm256_or_si256(rb_swap_8_avx2(s), mask_a));
+   }
+
+   lp_linear_kernels_c.rbx_swap_row(dst + i, src + i, width - i);
+}
+
+
+/*
+ * Both texels of each pair are gathered, and the coordinate arithmetic
+ * stays in the vector unit so there is no scalar work per pixel.
+ */
+void
+lp_linear_stretch_row_avx2(uint32_t *dst, const uint32_t *src,
+                           unsigned width,
+                           int32_t src_x, int32_t src_xstep)
+{
+   const __m256i step = _mm256_set1_epi32(src_xstep * 8);
+   const __m256i mask_w = _mm256_set1_epi32(0xff);
+   __m256i x = _mm256_add_epi32(_mm256_set1_epi32(src_x),
+                                _mm256_mullo_epi32(_mm256_set1_epi32(src_xstep),
+                                                   _mm256_setr_epi32(0, 1, 2, 3,
+                                                                     4, 5, 6, 7)));
+   unsigned i;
+
+   for (i = 0; i + 8 <= width; i += 8) {
+      __m256i idx = _mm256_srai_epi32(x, 16);
+      __m256i left = _mm256_i32gather_epi32((const int *)src, idx, 4);
+      __m256i right = _mm256_i32gather_epi32((const int *)(src + 1), idx, 4);
+
+      /* Replicate each pixel's weight across its four channels. */
+      __m256i w = _mm256_and_si256(_mm256_srli_epi32(x, 8), mask_w);
+      w = _mm256_or_si256(w, _mm256_slli_epi32(w, 16));
+
+      _mm256_storeu_si256((__m256i *)&dst[i],
+                          lerp_8unorm_avx2(left, right,
+                                           _mm256_unpacklo_epi32(w, w),
+                                           _mm256_unpackhi_epi32(w, w)));
+
+      x = _mm256_add_epi32(x, step);
+   }
+
+   lp_linear_kernels_c.stretch_row(dst + i, src, width - i,
+                                   src_x + (int32_t)i * src_xstep, src_xstep);
+}
+
+
+static void
+lerp_rows_avx2(uint32_t *dst, const uint32_t *src0, const uint32_t *src1,
+               unsigned width, unsigned weight)
+{
+   const __m256i w = _mm256_set1_epi16(weight);
+   unsigned i;
+
+   for (i = 0; i + 8 <= width; i += 8) {
+      __m256i a = _mm256_loadu_si256((const __m256i *)&src0[i]);
+      __m256i b = _mm256_loadu_si256((const __m256i *)&src1[i]);
+      _mm256_storeu_si256((__m256i *)&dst[i], lerp_8unorm_avx2(a, b, w, w));
+   }
+
+   lp_linear_kernels_c.lerp_rows(dst + i, src0 + i, src1 + i,
+                                 width - i, weight);
+}
+
+
+/* s + d - (d * sa >> 8), saturated, see util_sse2_blend_premul_4() */
+static inline __m256i
+blend_premul_epi16_avx2(__m256i s, __m256i d)
+{
+   __m256i a = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(s, 0xff), 0xff);
+   __m256i da = _mm256_srli_epi16(_mm256_mullo_epi16(d, a), 8);
+   return _mm256_add_epi16(s, _mm256_sub_epi16(d, da));
+}
+
+
+static void
+blend_premul_row_avx2(uint32_t *dst, const uint32_t *src, unsigned width)
+{
+   const __m256i zero = _mm256_setzero_si256();
+   unsigned i;
+
+   for (i = 0; i + 8 <= width; i += 8) {
+      __m256i s = _mm256_loadu_si256((const __m256i *)&src[i]);
+      __m256i d = _mm256_loadu_si256((const __m256i *)&dst[i]);
+
+      __m256i lo = blend_premul_epi16_avx2(_mm256_unpacklo_epi8(s, zero),
+                                           _mm256_unpacklo_epi8(d, zero));
+      __m256i hi = blend_premul_epi16_avx2(_mm256_unpackhi_epi8(s, zero),
+                                           _mm256_unpackhi_epi8(d, zero));
+
+      _mm256_storeu_si256((__m256i *)&dst[i], _mm256_packus_epi16(lo, hi));
+   }
+
+   lp_linear_kernels_c.blend_premul_row(dst + i, src + i, width - i);
+}
+
+
+const struct lp_linear_kernels lp_linear_kernels_avx2 = {
+   .name = "avx2",
+   .rgbx_row = rgbx_row_avx2,
+   .rb_swap_row = rb_swap_row_avx2,
+   .rbx_swap_row = rbx_swap_row_avx2,
+   .stretch_row = lp_linear_stretch_row_avx2,
+   .lerp_rows = lerp_rows_avx2,
+   .blend_premul_row = blend_premul_row_avx2,
+};
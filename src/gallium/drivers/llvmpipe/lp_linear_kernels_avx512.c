@@ -0,0 +1,168 @@
+/**************************************************************************
+ *
+ * Copyright 2010-2021 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ **************************************************************************/
+
+/*
+ * AVX-512 (BW + VL) linear path kernels, sixteen pixels at a time.  Spans
+ * are at most a tile (64 pixels) wide, so the remainder is handed to the
+ * AVX2 kernels rather than masked.  The stretch uses the AVX2 version:
+ * it is bound by the gathers, which do not get faster at 512 bits.
+ */
+
+#include <immintrin.h>
+
+#include "lp_linear_kernels.h"
+
+
+static inline __m512i
+rb_swap_16_avx512(__m512i s)
+{
+   const __m512i shuf = _mm512_broadcast_i32x4(
+      _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15));
+   return _mm512_shuffle_epi8(s, shuf);
+}
+
+
+static inline __m512i
+lerp_epi16_avx512(__m512i w, __m512i a, __m512i b)
+{
+   __m512i res = _mm512_sub_epi16(b, a);
+   res = _mm512_mullo_epi16(res, w);
+   res = _mm512_srli_epi16(res, 8);
+   return _mm512_add_epi8(res, a);
+}
+
+
+static void
+rgbx_row_avx512(uint32_t *dst, const uint32_t *src, unsigned width)
+{
+   const __m512i mask_a = _mm512_set1_epi32(0xff000000);
+   unsigned i;
+
+   for (i = 0; i + 16 <= width; i += 16) {
+      __m512i s = _mm512_loadu_si512(&src[i]);
+      _mm512_storeu_si512(&dst[i], _mm512_or_si512(s, mask_a));
+   }
+
+   lp_linear_kernels_avx2.rgbx_row(dst + i, src + i, width - i);
+}
+
+
+static void
+rb_swap_row_avx512(uint32_t *dst, const uint32_t *src, unsigned width)
+{
+   unsigned i;
+
+   for (i = 0; i + 16 <= width; i += 16) {
+      __m512i s = _mm512_loadu_si512(&src[i]);
+      _mm512_storeu_si512(&dst[i], rb_swap_16_avx512(s));
+   }
+
+   lp_linear_kernels_avx2.rb_swap_row(dst + i, src + i, width - i);
+}
+
+
+static void
+rbx_swap_row_avx512(uint32_t *dst, const uint32_t *src, unsigned width)
+{
+   const __m512i mask_a = _mm512_set1_epi32(0xff000000);
+   unsigned i;
+
+   for (i = 0; i + 16 <= width; i += 16) {
+      __m512i s = _mm512_loadu_si512(&src[i]);
+      _mm512_storeu_si512(&dst[i],
+                          _mm512_or_si512(rb_swap_16_avx512(s), mask_a));
+   }
+
+   lp_linear_kernels_avx2.rbx_swap_row(dst + i, src + i, width - i);
+}
+
+
+static void
+lerp_rows_avx512(uint32_t *dst, const uint32_t *src0, const uint32_t *src1,
+                 unsigned width, unsigned weight)
+{
+   const __m512i zero = _mm512_setzero_si512();
+   const __m512i w = _mm512_set1_epi16(weight);
+   unsigned i;
+
+   for (i = 0; i + 16 <= width; i += 16) {
+      __m512i a = _mm512_loadu_si512(&src0[i]);
+      __m512i b = _mm512_loadu_si512(&src1[i]);
+
+      __m512i lo = lerp_epi16_avx512(w, _mm512_unpacklo_epi8(a, zero),
+                                     _mm512_unpacklo_epi8(b, zero));
+      __m512i hi = lerp_epi16_avx512(w, _mm512_unpackhi_epi8(a, zero),
+                                     _mm512_unpackhi_epi8(b, zero));
+
+      _mm512_storeu_si512(&dst[i], _mm512_packus_epi16(lo, hi));
+   }
+
+   lp_linear_kernels_avx2.lerp_rows(dst + i, src0 + i, src1 + i,
+                                    width - i, weight);
+}
+
+
+static inline __m512i
+blend_premul_epi16_avx512(__m512i s, __m512i d)
+{
+   __m512i a = _mm512_shufflehi_epi16(_mm512_shufflelo_epi16(s, 0xff), 0xff);
+   __m512i da = _mm512_srli_epi16(_mm512_mullo_epi16(d, a), 8);
+   return _mm512_add_epi16(s, _mm512_sub_epi16(d, da));
+}
+
+
+static void
+blend_premul_row_avx512(uint32_t *dst, const uint32_t *src, unsigned width)
+{
+   const __m512i zero = _mm512_setzero_si512();
+   unsigned i;
+
+   for (i = 0; i + 16 <= width; i += 16) {
+      __m512i s = _mm512_loadu_si512(&src[i]);
+      __m512i d = _mm512_loadu_si512(&dst[i]);
+
+      __m512i lo = blend_premul_epi16_avx512(_mm512_unpacklo_epi8(s, zero),
+                                             _mm512_unpacklo_epi8(d, zero));
+      __m512i hi = blend_premul_epi16_avx512(_mm512_unpackhi_epi8(s, zero),
+                                             _mm512_unpackhi_epi8(d, zero));
+
+      _mm512_storeu_si512(&dst[i], _mm512_packus_epi16(lo, hi));
+   }
+
+   lp_linear_kernels_avx2.blend_premul_row(dst + i, src + i, width - i);
+}
+
+
+const struct lp_linear_kernels lp_linear_kernels_avx512 = {
+   .name = "avx512",
+   .rgbx_row = rgbx_row_avx512,
+   .rb_swap_row = rb_swap_row_avx512,
+   .rbx_swap_row = rbx_swap_row_avx512,
+   .stretch_row = lp_linear_stretch_row_avx2,
+   .lerp_rows = lerp_rows_avx512,
+   .blend_premul_row = blend_premul_row_avx512,
+};
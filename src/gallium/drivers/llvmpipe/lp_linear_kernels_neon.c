@@ -0,0 +1,210 @@
+/**************************************************************************
+ *
+ * Copyright 2010-2021 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ **************************************************************************/
+
+/*
+ * AArch64 NEON linear path kernels, four pixels at a time.  NEON is part
+ * of the AArch64 baseline so no runtime check is needed.  The arithmetic
+ * mirrors the SSE2 kernels step by step so results are bit-identical.
+ */
+
+#include "util/detect.h"
+
+#if DETECT_ARCH_AARCH64
+
+#include <arm_neon.h>
+
+#include "lp_linear_kernels.h"
+
+
+static const uint8_t rb_swap_idx[16] = {
+   2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15
+};
+
+static const uint8_t alpha_idx[16] = {
+   3, 3, 3, 3, 7, 7, 7, 7, 11, 11, 11, 11, 15, 15, 15, 15
+};
+
+
+/* ((b - a) * w >> 8) + a, keeping only the low byte of each lane */
+static inline uint8x8_t
+lerp_u16_neon(uint16x8_t w, uint8x8_t a, uint8x8_t b)
+{
+   uint16x8_t a16 = vmovl_u8(a);
+   uint16x8_t res = vmulq_u16(vsubq_u16(vmovl_u8(b), a16), w);
+   return vmovn_u16(vaddq_u16(vshrq_n_u16(res, 8), a16));
+}
+
+
+static inline uint8x16_t
+lerp_8unorm_neon(uint8x16_t a, uint8x16_t b, uint16x8_t w_lo, uint16x8_t w_hi)
+{
+   return vcombine_u8(lerp_u16_neon(w_lo, vget_low_u8(a), vget_low_u8(b)),
+                      lerp_u16_neon(w_hi, vget_high_u8(a), vget_high_u8(b)));
+}
+
+
+static void
+rgbx_row_neon(uint32_t *dst, const uint32_t *src, unsigned width)
+{
+   const uint32x4_t mask_a = vdupq_n_u32(0xff000000);
+   unsigned i;
+
+   for (i = 0; i + 4 <= width; i += 4)
+      vst1q_u32(&dst[i], vorrq_u32(vld1q_u32(&src[i]), mask_a));
+
+   lp_linear_kernels_c.rgbx_row(dst + i, src + i, width - i);
+}
+
+
+static void
+rb_swap_row_neon(uint32_t *dst, const uint32_t *src, unsigned width)
+{
+   const uint8x16_t idx = vld1q_u8(rb_swap_idx);
+   unsigned i;
+
+   for (i = 0; i + 4 <= width; i += 4) {
+      uint8x16_t s = vld1q_u8((const uint8_t *)&src[i]);
+      vst1q_u8((uint8_t *)&dst[i], vqtbl1q_u8(s, idx));
+   }
+
+   lp_linear_kernels_c.rb_swap_row(dst + i, src + i, width - i);
+}
+
+
+static void
+rbx_swap_row_neon(uint32_t *dst, const uint32_t *src, unsigned width)
+{
+   const uint8x16_t idx = vld1q_u8(rb_swap_idx);
+   const uint32x4_t mask_a = vdupq_n_u32(0xff000000);
+   unsigned i;
+
+   for (i = 0; i + 4 <= width; i += 4) {
+      uint8x16_t s = vld1q_u8((const uint8_t *)&src[i]);
+      uint32x4_t d = vreinterpretq_u32_u8(vqtbl1q_u8(s, idx));
+      vst1q_u32(&dst[i], vorrq_u32(d, mask_a));
+   }
+
+   lp_linear_kernels_c.rbx_swap_row(dst + i, src + i, width - i);
+}
+
+
+static void
+stretch_row_neon(uint32_t *dst, const uint32_t *src, unsigned width,
+                 int32_t src_x, int32_t src_xstep)
+{
+   unsigned i;
+
+   for (i = 0; i + 4 <= width; i += 4) {
+      const int32_t x0 = src_x;
+      const int32_t x1 = x0 + src_xstep;
+      const int32_t x2 = x1 + src_xstep;
+      const int32_t x3 = x2 + src_xstep;
+
+      /* Load each pair of neighbouring texels, then split the pairs. */
+      uint32x4_t p01 = vcombine_u32(vld1_u32(&src[x0 >> 16]),
+                                    vld1_u32(&src[x1 >> 16]));
+      uint32x4_t p23 = vcombine_u32(vld1_u32(&src[x2 >> 16]),
+                                    vld1_u32(&src[x3 >> 16]));
+      uint8x16_t left = vreinterpretq_u8_u32(vuzp1q_u32(p01, p23));
+      uint8x16_t right = vreinterpretq_u8_u32(vuzp2q_u32(p01, p23));
+
+      uint16x8_t w_lo = vcombine_u16(vdup_n_u16((x0 >> 8) & 0xff),
+                                     vdup_n_u16((x1 >> 8) & 0xff));
+      uint16x8_t w_hi = vcombine_u16(vdup_n_u16((x2 >> 8) & 0xff),
+                                     vdup_n_u16((x3 >> 8) & 0xff));
+
+      vst1q_u8((uint8_t *)&dst[i], lerp_8unorm_neon(left, right, w_lo, w_hi));
+
+      src_x = x3 + src_xstep;
+   }
+
+   lp_linear_kernels_c.stretch_row(dst + i, src, width - i, src_x, src_xstep);
+}
+
+
+static void
+lerp_rows_neon(uint32_t *dst, const uint32_t *src0, const uint32_t *src1,
+               unsigned width, unsigned weight)
+{
+   const uint16x8_t w = vdupq_n_u16(weight);
+   unsigned i;
+
+   for (i = 0; i + 4 <= width; i += 4) {
+      uint8x16_t a = vld1q_u8((const uint8_t *)&src0[i]);
+      uint8x16_t b = vld1q_u8((const uint8_t *)&src1[i]);
+      vst1q_u8((uint8_t *)&dst[i], lerp_8unorm_neon(a, b, w, w));
+   }
+
+   lp_linear_kernels_c.lerp_rows(dst + i, src0 + i, src1 + i,
+                                 width - i, weight);
+}
+
+
+/* s + d - (d * sa >> 8), saturated to 8 bits */
+static inline uint8x8_t
+blend_premul_u16_neon(uint8x8_t s, uint8x8_t d, uint8x8_t a)
+{
+   uint16x8_t d16 = vmovl_u8(d);
+   uint16x8_t da = vshrq_n_u16(vmulq_u16(d16, vmovl_u8(a)), 8);
+   return vqmovn_u16(vaddq_u16(vmovl_u8(s), vsubq_u16(d16, da)));
+}
+
+
+static void
+blend_premul_row_neon(uint32_t *dst, const uint32_t *src, unsigned width)
+{
+   const uint8x16_t idx = vld1q_u8(alpha_idx);
+   unsigned i;
+
+   for (i = 0; i + 4 <= width; i += 4) {
+      uint8x16_t s = vld1q_u8((const uint8_t *)&src[i]);
+      uint8x16_t d = vld1q_u8((const uint8_t *)&dst[i]);
+      uint8x16_t a = vqtbl1q_u8(s, idx);
+
+      uint8x8_t lo = blend_premul_u16_neon(vget_low_u8(s), vget_low_u8(d),
+                                           vget_low_u8(a));
+      uint8x8_t hi = blend_premul_u16_neon(vget_high_u8(s), vget_high_u8(d),
+                                           vget_high_u8(a));
+
+      vst1q_u8((uint8_t *)&dst[i], vcombine_u8(lo, hi));
+   }
+
+   lp_linear_kernels_c.blend_premul_row(dst + i, src + i, width - i);
+}
+
+
+const struct lp_linear_kernels lp_linear_kernels_neon = {
+   .name = "neon",
+   .rgbx_row = rgbx_row_neon,
+   .rb_swap_row = rb_swap_row_neon,
+   .rbx_swap_row = rbx_swap_row_neon,
+   .stretch_row = stretch_row_neon,
+   .lerp_rows = lerp_rows_neon,
+   .blend_premul_row = blend_premul_row_neon,
+};
+
+#endif /* DETECT_ARCH_AARCH64 */
@@ -38,6 +38,7 @@
 #include "lp_debug.h"
 #include "lp_state_fs.h"
 #include "lp_linear_priv.h"
+#include "lp_linear_kernels.h"
 
 #if DETECT_ARCH_SSE
 
@@ -108,53 +109,6 @@ rbx_swap(uint32_t src_val)
    return dst_val;
 }
 
-/* set alpha channel of 128-bit 4xrgba values to 0xff. */
-static inline __m128i
-rgbx_128(const __m128i src_val)
-{
-   const __m128i mask = _mm_set1_epi32(0xff000000);
-   __m128i bgrx = _mm_or_si128(src_val, mask);
-   return bgrx;
-}
-
-/* swap red/blue channels of a 128-bit 4xrgba value. */
-/* ssse3 could use pshufb */
-static inline __m128i
-rb_swap_128(const __m128i src_val)
-{
-   const __m128i mask = _mm_set1_epi32(0xff00ff00);
-   const __m128i mask_r = _mm_set1_epi32(0xff);
-
-   __m128i rgba = _mm_and_si128(src_val, mask);
-   __m128i r = _mm_srli_epi32(src_val, 16);
-   __m128i b = _mm_and_si128(src_val, mask_r);
-   r = _mm_and_si128(r, mask_r);
-   b = _mm_slli_epi32(b, 16);
-   rgba = _mm_or_si128(rgba, r);
-   rgba = _mm_or_si128(rgba, b);
-   return rgba;
-}
-
-/* swap red/blue channels and set alpha to 0xff
- * of a 128-bit 4xrgbx value. */
-static inline __m128i
-rbx_swap_128(const __m128i src_val)
-{
-   const __m128i mask_a = _mm_set1_epi32(0xff000000);
-   const __m128i mask_g = _mm_set1_epi32(0xff00);
-   const __m128i mask_r = _mm_set1_epi32(0xff);
-
-   __m128i rgbx = _mm_and_si128(src_val, mask_g);
-   __m128i r = _mm_srli_epi32(src_val, 16);
-   __m128i b = _mm_and_si128(src_val, mask_r);
-   r = _mm_and_si128(r, mask_r);
-   b = _mm_slli_epi32(b, 16);
-   rgbx = _mm_or_si128(rgbx, mask_a);
-   rgbx = _mm_or_si128(rgbx, r);
-   rgbx = _mm_or_si128(rgbx, b);
-   return rgbx;
-}
-
 /*
  * Unstretched blit of a bgra texture.
  */
@@ -230,14 +184,10 @@ fetch_and_stretch_bgra_row(struct lp_linear_sampler *samp,
       }
 
       /* Copy the source texture */
-      for (int i = 0; i < width; i += 4) {
-         __m128i src = _mm_loadu_si128((const __m128i *)&src_row[i]);
-         *(__m128i *)&dst_row[i] = src;
-      }
+      memcpy(dst_row, src_row, align(width, 4) * sizeof *dst_row);
    } else {
-      util_sse2_stretch_row_8unorm((__m128i *)dst_row,
-                                   align(width, 4),
-                                   src_row, samp->s, samp->dsdx);
+      lp_linear_kernels->stretch_row(dst_row, src_row, align(width, 4),
+                                     samp->s, samp->dsdx);
    }
 
    samp->stretched_row_y[samp->stretched_row_index] = y;
@@ -270,16 +220,9 @@ fetch_axis_aligned_linear_bgra(struct lp_linear_elem *elem)
 
    const uint32_t * restrict src_row1 = fetch_and_stretch_bgra_row(samp, y + 1);
 
-   __m128i wt = _mm_set1_epi16(w);
-
    /* Combine the two rows using a constant weight.
     */
-   for (int i = 0; i < width; i += 4) {
-      __m128i srca = _mm_load_si128((const __m128i *)&src_row0[i]);
-      __m128i srcb = _mm_load_si128((const __m128i *)&src_row1[i]);
-
-      *(__m128i *)&row[i] = util_sse2_lerp_epi8_fixed88(srca, srcb, &wt, &wt);
-   }
+   lp_linear_kernels->lerp_rows(row, src_row0, src_row1, align(width, 4), w);
 
    return row;
 }
@@ -462,17 +405,17 @@ fetch_clamp_linear_bgra(struct lp_linear_elem *elem)
 
 #define FETCH_TYPE bgrx
 #define OP rgbx
-#define OP128 rgbx_128
+#define OP_ROW rgbx_row
 #include "lp_linear_sampler_tmp.h"
 
 #define FETCH_TYPE bgra_swapped
 #define OP rb_swap
-#define OP128 rb_swap_128
+#define OP_ROW rb_swap_row
 #include "lp_linear_sampler_tmp.h"
 
 #define FETCH_TYPE bgrx_swapped
 #define OP rbx_swap
-#define OP128 rbx_swap_128
+#define OP_ROW rbx_swap_row
 #include "lp_linear_sampler_tmp.h"
 
 static bool
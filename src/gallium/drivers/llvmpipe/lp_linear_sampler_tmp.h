@@ -18,9 +18,7 @@ CONCAT2(fetch_memcpy_, FETCH_TYPE)(struct lp_linear_elem *elem)
 
    src_row = &src_row[s >> FIXED16_SHIFT];
 
-   for (int i = 0; i < width; i++) {
-      row[i] = OP(src_row[i]);
-   }
+   lp_linear_kernels->OP_ROW(row, src_row, width);
 
    samp->t += samp->dtdy;
    return row;
@@ -126,7 +124,7 @@ CONCAT2(fetch_clamp_, FETCH_TYPE)(struct lp_linear_elem *elem)
    return row;
 }
 
-#ifdef OP128
+#ifdef OP_ROW
 static const uint32_t *
 CONCAT2(fetch_axis_aligned_linear_, FETCH_TYPE)(struct lp_linear_elem *elem)
 {
@@ -136,11 +134,7 @@ CONCAT2(fetch_axis_aligned_linear_, FETCH_TYPE)(struct lp_linear_elem *elem)
    const uint32_t *src_row = fetch_axis_aligned_linear_bgra(&samp->base);
    const int width = samp->width;
 
-   for (int i = 0; i < width; i += 4) {
-      __m128i bgra = *(__m128i *)&src_row[i];
-      __m128i rgba = OP128(bgra);
-      *(__m128i *)&dst_row[i] = rgba;
-   }
+   lp_linear_kernels->OP_ROW(dst_row, src_row, align(width, 4));
 
    return dst_row;
 }
@@ -154,11 +148,7 @@ CONCAT2(fetch_clamp_linear_, FETCH_TYPE)(struct lp_linear_elem *elem)
 
    fetch_clamp_linear_bgra(&samp->base);
 
-   for (int i = 0; i < width; i += 4) {
-      __m128i bgra = *(__m128i *)&row[i];
-      __m128i rgba = OP128(bgra);
-      *(__m128i *)&row[i] = rgba;
-   }
+   lp_linear_kernels->OP_ROW(row, row, align(width, 4));
 
    return row;
 }
@@ -172,17 +162,13 @@ CONCAT2(fetch_linear_, FETCH_TYPE)(struct lp_linear_elem *elem)
 
    fetch_linear_bgra(&samp->base);
 
-   for (int i = 0; i < width; i += 4) {
-      __m128i bgra = *(__m128i *)&row[i];
-      __m128i rgba = OP128(bgra);
-      *(__m128i *)&row[i] = rgba;
-   }
+   lp_linear_kernels->OP_ROW(row, row, align(width, 4));
 
    return row;
 }
 #endif
 
 #undef OP
-#undef OP128
+#undef OP_ROW
 #undef FETCH_TYPE
 #undef NO_MEMCPY
@@ -118,9 +118,21 @@ lp_print_counters(void)
       debug_printf("llvmpipe: nr_color_tile_load:           %9u\n", lp_count.nr_color_tile_load);
       debug_printf("llvmpipe: nr_color_tile_store:          %9u\n", lp_count.nr_color_tile_store);
 
+      debug_printf("llvmpipe: nr_scenes:                    %9u\n", lp_count.nr_scenes);
+      debug_printf("llvmpipe:   nr_scenes_overlapped:       %9u (%3.0f%% of %u)\n", lp_count.nr_scenes_overlapped,
+                   lp_count.nr_scenes ? 100.0 * (float) lp_count.nr_scenes_overlapped / (float) lp_count.nr_scenes : 0.0,
+                   lp_count.nr_scenes);
+      debug_printf("llvmpipe:   nr_scene_restarts:          %9u\n", lp_count.nr_scene_restarts);
+      debug_printf("llvmpipe:   nr_setup_stalls:            %9u\n", lp_count.nr_setup_stalls);
+      debug_printf("llvmpipe: total setup stall time:       %.2f sec\n", lp_count.setup_stall_time / 1000000.0);
+
       debug_printf("llvmpipe: nr_llvm_compiles:             %u\n", lp_count.nr_llvm_compiles);
       debug_printf("llvmpipe: total LLVM compile time:      %.2f sec\n", lp_count.llvm_compile_time / 1000000.0);
       debug_printf("llvmpipe: average LLVM compile time:    %.2f sec\n", lp_count.llvm_compile_time / 1000000.0 / lp_count.nr_llvm_compiles);
+      debug_printf("llvmpipe: nr_fs_precompiles:            %9u\n", lp_count.nr_fs_precompiles);
+      debug_printf("llvmpipe:   nr_fs_precompile_hits:      %9u\n", lp_count.nr_fs_precompile_hits);
+      debug_printf("llvmpipe:   nr_fs_precompile_unfinished:%9u\n", lp_count.nr_fs_precompile_unfinished);
+      debug_printf("llvmpipe:   nr_fs_precompile_misses:    %9u\n", lp_count.nr_fs_precompile_misses);
 
    }
 }
@@ -64,10 +64,20 @@ struct lp_counters
    unsigned nr_non_empty_4;
    unsigned nr_llvm_compiles;
    int64_t llvm_compile_time;  /**< total, in microseconds */
+   unsigned nr_fs_precompiles;           /**< background FS compiles queued */
+   unsigned nr_fs_precompile_hits;       /**< ready when the draw needed it */
+   unsigned nr_fs_precompile_unfinished; /**< not ready, draw compiled itself */
+   unsigned nr_fs_precompile_misses;     /**< key didn't match, discarded */
 
    unsigned nr_color_tile_clear;
    unsigned nr_color_tile_load;
    unsigned nr_color_tile_store;
+
+   unsigned nr_scenes;             /**< scenes queued for rasterization */
+   unsigned nr_scenes_overlapped;  /**< ... while the previous one was busy */
+   unsigned nr_scene_restarts;     /**< scenes split because they were full */
+   unsigned nr_setup_stalls;       /**< binning waited for a free scene */
+   int64_t setup_stall_time;       /**< total, in microseconds */
 };
 
 
@@ -57,8 +57,16 @@ llvmpipe_create_query(struct pipe_context *pipe,
 {
    assert(type < PIPE_QUERY_TYPES);
 
-   struct llvmpipe_query *pq = CALLOC_STRUCT(llvmpipe_query);
+   const unsigned num_threads =
+      MAX2(1, llvmpipe_screen(pipe->screen)->num_threads);
+
+   /* The per-thread start/end counters follow the query struct. */
+   struct llvmpipe_query *pq =
+      CALLOC(1, sizeof(*pq) + 2 * num_threads * sizeof(uint64_t));
    if (pq) {
+      pq->start = (uint64_t *)(pq + 1);
+      pq->end = pq->start + num_threads;
+      pq->num_threads = num_threads;
       pq->type = type;
       pq->index = index;
    }
@@ -403,8 +411,8 @@ llvmpipe_begin_query(struct pipe_context *pipe, struct pipe_query *q)
       llvmpipe_finish(pipe, __func__);
    }
 
-   memset(pq->start, 0, sizeof(pq->start));
-   memset(pq->end, 0, sizeof(pq->end));
+   memset(pq->start, 0, pq->num_threads * sizeof(*pq->start));
+   memset(pq->end, 0, pq->num_threads * sizeof(*pq->end));
    lp_setup_begin_query(llvmpipe->setup, pq);
 
    switch (pq->type) {
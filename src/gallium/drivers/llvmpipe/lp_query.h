@@ -35,6 +35,7 @@
 
 #include <limits.h>
 #include "util/u_thread.h"
+#include "util/u_threaded_context.h"
 #include "lp_limits.h"
 
 
@@ -42,8 +43,10 @@ struct llvmpipe_context;
 
 
 struct llvmpipe_query {
-   uint64_t start[LP_MAX_THREADS];  /* start count value for each thread */
-   uint64_t end[LP_MAX_THREADS];    /* end count value for each thread */
+   struct threaded_query base;
+   uint64_t *start;                 /* start count value for each thread */
+   uint64_t *end;                   /* end count value for each thread */
+   unsigned num_threads;            /* size of start/end arrays */
    struct lp_fence *fence;          /* fence from last scene this was binned in */
    enum pipe_query_type type;
    unsigned index;
@@ -35,6 +35,7 @@
 #include "util/u_thread.h"
 #include "util/u_memset.h"
 #include "util/os_time.h"
+#include "util/thread_sched.h"
 
 #include "lp_scene_queue.h"
 #include "lp_context.h"
@@ -78,13 +79,46 @@ lp_rast_begin(struct lp_rasterizer *rast,
    LP_DBG(DEBUG_RAST, "%s\n", __func__);
 
    lp_scene_begin_rasterization(scene);
-   lp_scene_bin_iter_begin(scene);
+}
+
+
+/**
+ * Report how well the bins of the last scene were balanced between the
+ * threads.  The tail is the time between the first and the last thread
+ * running out of bins, during which some threads sit idle.
+ */
+static void
+lp_rast_print_stats(struct lp_rasterizer *rast)
+{
+   const unsigned num_tasks = MAX2(1, rast->num_threads);
+   int64_t start = INT64_MAX, first_end = INT64_MAX, last_end = 0;
+   unsigned bins = 0, steals = 0;
+
+   for (unsigned i = 0; i < num_tasks; i++) {
+      const struct lp_rasterizer_task *task = &rast->tasks[i];
+      start = MIN2(start, task->stats.start);
+      first_end = MIN2(first_end, task->stats.end);
+      last_end = MAX2(last_end, task->stats.end);
+      bins += task->stats.bins;
+      steals += task->stats.steals;
+   }
+
+   debug_printf("llvmpipe: scene %u: %u bins (%u stolen) on %u threads, "
+                "%.3f ms, tail %.3f ms (%.1f%%)\n",
+                rast->stats_scene_count++, bins, steals, num_tasks,
+                (last_end - start) / 1000000.0,
+                (last_end - first_end) / 1000000.0,
+                last_end > start ?
+                100.0 * (last_end - first_end) / (last_end - start) : 0.0);
 }
 
 
 static void
 lp_rast_end(struct lp_rasterizer *rast)
 {
+   if (LP_DEBUG & DEBUG_RAST_STATS)
+      lp_rast_print_stats(rast);
+
    rast->curr_scene = NULL;
 }
 
@@ -1046,30 +1080,45 @@ rasterize_scene(struct lp_rasterizer_task *task,
 {
    task->scene = scene;
 
-   /* Clear the cache tags. This should not always be necessary but
-    * simpler for now.
+   /* The decoded blocks are tagged by address, so they stay valid across
+    * scenes until a compressed texture gets written or freed.
     */
 #if LP_USE_TEXTURE_CACHE
-   memset(task->thread_data.cache->cache_tags, 0,
-          sizeof(task->thread_data.cache->cache_tags));
-#if LP_BUILD_FORMAT_CACHE_DEBUG
-   task->thread_data.cache->cache_access_total = 0;
-   task->thread_data.cache->cache_access_miss = 0;
-#endif
+   if (task->texcache_epoch != scene->texcache_epoch) {
+      lp_build_format_cache_invalidate(task->thread_data.cache);
+      task->texcache_epoch = scene->texcache_epoch;
+   }
 #endif
 
+   const bool stats = LP_DEBUG & DEBUG_RAST_STATS;
+   if (stats) {
+      task->stats.start = os_time_get_nano();
+      task->stats.bins = 0;
+      task->stats.steals = 0;
+   }
+
    if (!task->rast->no_rast) {
       /* loop over scene bins, rasterize each */
       struct cmd_bin *bin;
       int i, j;
+      bool stolen;
 
       assert(scene);
-      while ((bin = lp_scene_bin_iter_next(scene, &i, &j))) {
+      while ((bin = lp_scene_bin_iter_next(scene, task->thread_index,
+                                           &i, &j, &stolen))) {
          if (!is_empty_bin(bin))
             rasterize_bin(task, bin, i, j);
+
+         if (stats) {
+            task->stats.bins++;
+            task->stats.steals += stolen;
+         }
       }
    }
 
+   if (stats)
+      task->stats.end = os_time_get_nano();
+
 #if LP_BUILD_FORMAT_CACHE_DEBUG
    {
       uint64_t total, miss;
@@ -1101,6 +1150,13 @@ lp_rast_queue_scene(struct lp_rasterizer *rast,
 {
    LP_DBG(DEBUG_SETUP, "%s\n", __func__);
 
+   /* Count scenes which were binned while the previous one was still
+    * being rasterized.
+    */
+   LP_COUNT(nr_scenes);
+   if (rast->last_fence && !lp_fence_signalled(rast->last_fence))
+      LP_COUNT(nr_scenes_overlapped);
+
    lp_fence_reference(&rast->last_fence, scene->fence);
    if (rast->last_fence)
       rast->last_fence->issued = true;
@@ -1246,6 +1302,15 @@ create_rast_threads(struct lp_rasterizer *rast)
          break;
       }
    }
+
+   /* Group the threads by L3 cache.  Each thread starts out with a
+    * contiguous range of bins, so this keeps neighbouring tiles (and the
+    * textures they sample) within one cache.
+    */
+   if (!(LP_PERF & PERF_NO_PIN_THREADS)) {
+      for (unsigned i = 0; i < rast->num_threads; i++)
+         util_thread_sched_pin_to_L3(rast->threads[i], i, rast->num_threads);
+   }
 }
 
 
@@ -1262,6 +1327,12 @@ lp_rast_create(unsigned num_threads)
       goto no_rast;
    }
 
+   rast->tasks = CALLOC(MAX2(1, num_threads), sizeof(*rast->tasks));
+   rast->threads = CALLOC(MAX2(1, num_threads), sizeof(*rast->threads));
+   if (!rast->tasks || !rast->threads) {
+      goto no_tasks;
+   }
+
    rast->full_scenes = lp_scene_queue_create();
    if (!rast->full_scenes) {
       goto no_full_scenes;
@@ -1276,6 +1347,7 @@ lp_rast_create(unsigned num_threads)
       if (!task->thread_data.cache) {
          goto no_thread_data_cache;
       }
+      lp_build_format_cache_invalidate(task->thread_data.cache);
    }
 
    rast->num_threads = num_threads;
@@ -1294,7 +1366,7 @@ lp_rast_create(unsigned num_threads)
    return rast;
 
 no_thread_data_cache:
-   for (unsigned i = 0; i < MAX2(1, rast->num_threads); i++) {
+   for (unsigned i = 0; i < MAX2(1, num_threads); i++) {
       if (rast->tasks[i].thread_data.cache) {
          align_free(rast->tasks[i].thread_data.cache);
       }
@@ -1302,6 +1374,9 @@ no_thread_data_cache:
 
    lp_scene_queue_destroy(rast->full_scenes);
 no_full_scenes:
+no_tasks:
+   FREE(rast->tasks);
+   FREE(rast->threads);
    FREE(rast);
 no_rast:
    return NULL;
@@ -1361,6 +1436,8 @@ lp_rast_destroy(struct lp_rasterizer *rast)
 
    lp_scene_queue_destroy(rast->full_scenes);
 
+   FREE(rast->tasks);
+   FREE(rast->threads);
    FREE(rast);
 }
 
@@ -100,6 +100,16 @@ struct lp_rasterizer_task
    /** Non-interpolated passthru state and occlude counter for visible pixels */
    struct lp_jit_thread_data thread_data;
 
+   /** Scene texcache_epoch the contents of thread_data.cache are valid for */
+   unsigned texcache_epoch;
+
+   /** Per-scene load balancing stats, for LP_DEBUG=rast_stats */
+   struct {
+      int64_t start, end;  /**< in nanoseconds */
+      unsigned bins;       /**< bins rasterized by this thread */
+      unsigned steals;     /**< how many of them were stolen */
+   } stats;
+
    util_semaphore work_ready;
    util_semaphore work_done;
 #ifdef _WIN32
@@ -124,16 +134,19 @@ struct lp_rasterizer
    /** The scene currently being rasterized by the threads */
    struct lp_scene *curr_scene;
 
-   /** A task object for each rasterization thread */
-   struct lp_rasterizer_task tasks[LP_MAX_THREADS];
+   /** A task object for each rasterization thread, MAX2(1, num_threads) */
+   struct lp_rasterizer_task *tasks;
 
    unsigned num_threads;
-   thrd_t threads[LP_MAX_THREADS];
+   thrd_t *threads;
 
    /** For synchronizing the rasterization threads */
    util_barrier barrier;
 
    struct lp_fence *last_fence;
+
+   /** Number of scenes reported by LP_DEBUG=rast_stats */
+   unsigned stats_scene_count;
 };
 
 
@@ -27,6 +27,7 @@
 
 #include "util/u_framebuffer.h"
 #include "util/u_math.h"
+#include "util/u_atomic.h"
 #include "util/u_memory.h"
 #include "util/reallocarray.h"
 #include "util/u_inlines.h"
@@ -73,6 +74,13 @@ lp_scene_create(struct lp_setup_context *setup)
    scene->setup = setup;
    scene->data.head = &scene->data.first;
 
+   scene->bin_queues = CALLOC(MAX2(1, setup->num_threads),
+                              sizeof(*scene->bin_queues));
+   if (!scene->bin_queues) {
+      slab_free_st(&setup->scene_slab, scene);
+      return NULL;
+   }
+
    (void) mtx_init(&scene->mutex, mtx_plain);
 
 #if MESA_DEBUG
@@ -103,6 +111,8 @@ lp_scene_destroy(struct lp_scene *scene)
    lp_scene_end_rasterization(scene);
    mtx_destroy(&scene->mutex);
    free(scene->tiles);
+   free(scene->bin_order);
+   FREE(scene->bin_queues);
    assert(scene->data.head == &scene->data.first);
    slab_free_st(&scene->setup->scene_slab, scene);
 }
@@ -200,6 +210,33 @@ lp_scene_begin_rasterization(struct lp_scene *scene)
 }
 
 
+/**
+ * Count the scene's framebuffer in the scene references of its textures, see
+ * llvmpipe_is_resource_busy().
+ */
+static void
+scene_fb_reference(const struct lp_scene *scene, bool ref)
+{
+   for (unsigned i = 0; i < scene->fb.nr_cbufs; i++) {
+      struct pipe_resource *texture = scene->fb.cbufs[i].texture;
+      if (!texture)
+         continue;
+      if (ref)
+         llvmpipe_resource_scene_ref(texture, true);
+      else
+         llvmpipe_resource_scene_unref(texture, true);
+   }
+
+   struct pipe_resource *texture = scene->fb.zsbuf.texture;
+   if (texture) {
+      if (ref)
+         llvmpipe_resource_scene_ref(texture, true);
+      else
+         llvmpipe_resource_scene_unref(texture, true);
+   }
+}
+
+
 /**
  * Free all the temporary data in a scene.
  */
@@ -248,6 +285,7 @@ lp_scene_end_rasterization(struct lp_scene *scene)
                          llvmpipe_resource_size(ref->resource[i]));
          j++;
          llvmpipe_resource_unmap(ref->resource[i], 0, 0);
+         llvmpipe_resource_scene_unref(ref->resource[i], false);
          pipe_resource_reference(&ref->resource[i], NULL);
       }
    }
@@ -264,6 +302,7 @@ lp_scene_end_rasterization(struct lp_scene *scene)
                          llvmpipe_resource_size(ref->resource[i]));
          j++;
          llvmpipe_resource_unmap(ref->resource[i], 0, 0);
+         llvmpipe_resource_scene_unref(ref->resource[i], true);
          pipe_resource_reference(&ref->resource[i], NULL);
       }
    }
@@ -312,6 +351,7 @@ lp_scene_end_rasterization(struct lp_scene *scene)
 
    scene->alloc_failed = false;
 
+   scene_fb_reference(scene, false);
    util_unreference_framebuffer_state(&scene->fb);
 
    mtx_unlock(&scene->mutex);
@@ -438,6 +478,7 @@ lp_scene_add_resource_reference(struct lp_scene *scene,
    /* Append the reference to the reference block.
     */
    pipe_resource_reference(&ref->resource[ref->count++], resource);
+   llvmpipe_resource_scene_ref(resource, writeable);
    scene->resource_reference_size += llvmpipe_resource_size(resource);
 
    /* Heuristic to advise scene flushes.  This isn't helpful in the
@@ -534,60 +575,158 @@ lp_scene_is_resource_referenced(const struct lp_scene *scene,
 }
 
 
-/** advance curr_x,y to the next bin */
-static bool
-next_bin(struct lp_scene *scene)
+/**
+ * Estimate the cost of rasterizing a bin from the number of commands
+ * binned into it.  Every non-empty bin also pays a fixed cost for the tile
+ * load/store.
+ */
+static unsigned
+lp_scene_bin_cost(const struct cmd_bin *bin)
 {
-   scene->curr_x++;
-   if (scene->curr_x >= scene->tiles_x) {
-      scene->curr_x = 0;
-      scene->curr_y++;
+   unsigned cost = 1;
+   for (const struct cmd_block *block = bin->head; block; block = block->next)
+      cost += block->count;
+   return cost;
+}
+
+
+/**
+ * Prepare the scene's bins for rasterization by num_queues threads.
+ *
+ * The non-empty bins are listed in raster order and split into num_queues
+ * contiguous ranges of roughly equal cost, one per thread.  Threads which
+ * run out of bins in their own range steal from the end of the others (see
+ * lp_scene_bin_iter_next()), so a few expensive tiles don't leave the other
+ * threads idle.
+ *
+ * Called by the binning thread when the scene is queued for rasterization.
+ */
+void
+lp_scene_bin_iter_begin(struct lp_scene *scene, unsigned num_queues)
+{
+   const unsigned num_bins = lp_scene_get_num_bins(scene);
+   uint64_t total_cost = 0;
+   unsigned num_order = 0;
+
+   assert(num_queues > 0 && num_queues <= MAX2(1, scene->setup->num_threads));
+
+   if (!scene->bin_order || num_bins > scene->num_alloced_tiles) {
+      scene->num_bin_queues = 0;
+      return;
    }
-   if (scene->curr_y >= scene->tiles_y) {
-      /* no more bins */
-      return false;
+
+   for (unsigned i = 0; i < num_bins; i++) {
+      const struct cmd_bin *bin = &scene->tiles[i];
+      if (bin->head) {
+         scene->bin_order[num_order++] = i;
+         total_cost += lp_scene_bin_cost(bin);
+      }
    }
-   return true;
+
+   /* Split the ordered bins into num_queues ranges by cumulative cost. */
+   uint64_t cost = 0;
+   unsigned head = 0, idx = 0;
+   for (unsigned q = 0; q < num_queues; q++) {
+      const uint64_t limit = total_cost * (q + 1) / num_queues;
+
+      if (q == num_queues - 1) {
+         idx = num_order;
+      } else {
+         while (idx < num_order && cost < limit)
+            cost += lp_scene_bin_cost(&scene->tiles[scene->bin_order[idx++]]);
+      }
+
+      scene->bin_queues[q].range = ((uint64_t)idx << 32) | head;
+      head = idx;
+   }
+
+   scene->num_bin_queues = num_queues;
 }
 
 
-void
-lp_scene_bin_iter_begin(struct lp_scene *scene)
+/**
+ * Take one bin from the given queue: from the head for the owning thread,
+ * from the tail when stealing.  Returns false if the queue is empty.
+ */
+static bool
+bin_queue_pop(struct lp_scene_bin_queue *queue, bool steal, unsigned *pos)
 {
-   scene->curr_x = scene->curr_y = -1;
+   uint64_t old = p_atomic_read(&queue->range);
+
+   while (1) {
+      const uint32_t head = old & 0xffffffff;
+      const uint32_t tail = old >> 32;
+      uint64_t range;
+
+      if (head >= tail)
+         return false;
+
+      if (steal)
+         range = ((uint64_t)(tail - 1) << 32) | head;
+      else
+         range = ((uint64_t)tail << 32) | (head + 1);
+
+      const uint64_t prev = p_atomic_cmpxchg(&queue->range, old, range);
+      if (prev == old) {
+         *pos = steal ? tail - 1 : head;
+         return true;
+      }
+      old = prev;
+   }
 }
 
 
 /**
- * Return pointer to next bin to be rendered.
- * The lp_scene::curr_x and ::curr_y fields will be advanced.
+ * Return pointer to next bin to be rendered by the thread owning the given
+ * queue, or NULL when all bins of the scene have been handed out.
  * Multiple rendering threads will call this function to get a chunk
- * of work (a bin) to work on.
+ * of work (a bin) to work on.  Empty bins are never returned.
+ * \param stolen  set to whether the bin was taken from another queue
  */
 struct cmd_bin *
-lp_scene_bin_iter_next(struct lp_scene *scene , int *x, int *y)
+lp_scene_bin_iter_next(struct lp_scene *scene, unsigned queue,
+                       int *x, int *y, bool *stolen)
 {
-   struct cmd_bin *bin = NULL;
+   const unsigned num_queues = scene->num_bin_queues;
+   unsigned pos;
 
-   mtx_lock(&scene->mutex);
+   if (num_queues == 0)
+      return NULL;
+
+   /* Threads without a queue of their own share the first one. */
+   queue = MIN2(queue, num_queues - 1);
+
+   *stolen = false;
+   if (!bin_queue_pop(&scene->bin_queues[queue], false, &pos)) {
+      /* Steal from the queue with the most bins left. */
+      while (1) {
+         unsigned victim = queue, max_left = 0;
+
+         for (unsigned q = 0; q < num_queues; q++) {
+            const uint64_t range = p_atomic_read(&scene->bin_queues[q].range);
+            const uint32_t head = range & 0xffffffff;
+            const uint32_t tail = range >> 32;
+            if (tail > head && tail - head > max_left) {
+               max_left = tail - head;
+               victim = q;
+            }
+         }
 
-   if (scene->curr_x < 0) {
-      /* first bin */
-      scene->curr_x = 0;
-      scene->curr_y = 0;
-   } else if (!next_bin(scene)) {
-      /* no more bins left */
-      goto end;
+         if (max_left == 0)
+            return NULL;
+
+         if (bin_queue_pop(&scene->bin_queues[victim], true, &pos)) {
+            *stolen = victim != queue;
+            break;
+         }
+      }
    }
 
-   bin = lp_scene_get_bin(scene, scene->curr_x, scene->curr_y);
-   *x = scene->curr_x;
-   *y = scene->curr_y;
+   const unsigned idx = scene->bin_order[pos];
+   *x = idx % scene->tiles_x;
+   *y = idx / scene->tiles_x;
 
-end:
-   /*printf("return bin %p at %d, %d\n", (void *) bin, *bin_x, *bin_y);*/
-   mtx_unlock(&scene->mutex);
-   return bin;
+   return &scene->tiles[idx];
 }
 
 
@@ -598,6 +737,7 @@ lp_scene_begin_binning(struct lp_scene *scene,
    assert(lp_scene_is_empty(scene));
 
    util_copy_framebuffer_state(&scene->fb, fb);
+   scene_fb_reference(scene, true);
 
    scene->tiles_x = align(fb->width, TILE_SIZE) / TILE_SIZE;
    scene->tiles_y = align(fb->height, TILE_SIZE) / TILE_SIZE;
@@ -606,6 +746,15 @@ lp_scene_begin_binning(struct lp_scene *scene,
 
    unsigned num_required_tiles = scene->tiles_x * scene->tiles_y;
    if (scene->num_alloced_tiles < num_required_tiles) {
+      /* Keep the old bin order on failure, lp_scene_bin_iter_begin checks
+       * num_alloced_tiles before using it.
+       */
+      unsigned *bin_order = reallocarray(scene->bin_order, num_required_tiles,
+                                         sizeof(unsigned));
+      if (!bin_order)
+         return;
+      scene->bin_order = bin_order;
+
       scene->tiles = reallocarray(scene->tiles, num_required_tiles,
                                   sizeof(struct cmd_bin));
       if (!scene->tiles)
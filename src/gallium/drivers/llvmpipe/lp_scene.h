@@ -35,9 +35,11 @@
 #ifndef LP_SCENE_H
 #define LP_SCENE_H
 
+#include "util/u_memory.h"
 #include "util/u_thread.h"
 #include "lp_rast.h"
 #include "lp_debug.h"
+#include "lp_limits.h"
 
 struct lp_scene_queue;
 struct lp_rast_state;
@@ -116,6 +118,20 @@ struct data_block_list {
    struct data_block *head;
 };
 
+/**
+ * Per-thread queue of bins for the work-stealing rasterizer.
+ * The queue owns the entries [head, tail) of lp_scene::bin_order.  The
+ * owning thread pops bins from the head (raster order, for locality) while
+ * idle threads steal bins from the tail.  Both ends are packed into a
+ * single word (head in the low 32 bits) so that each pop is a single
+ * compare-and-swap.  Padded to a cache line to avoid false sharing.
+ */
+struct lp_scene_bin_queue {
+   uint64_t range;
+   uint8_t pad[CACHE_LINE_SIZE - sizeof(uint64_t)];
+};
+
+
 struct resource_ref;
 
 struct shader_ref;
@@ -151,6 +167,9 @@ struct lp_scene {
    /* If queries were either active or there were begin/end query commands */
    bool had_queries;
 
+   /* llvmpipe_screen::texcache_epoch as of queuing this scene */
+   unsigned texcache_epoch;
+
    /* Framebuffer mappings - valid only between begin_rasterization()
     * and end_rasterization().
     */
@@ -197,7 +216,13 @@ struct lp_scene {
     */
    unsigned tiles_x, tiles_y;
 
-   int curr_x, curr_y;  /**< for iterating over bins */
+   /** Non-empty bin indices, split into per-thread queues, see
+    * lp_scene_bin_iter_begin().
+    */
+   unsigned *bin_order;
+   unsigned num_bin_queues;
+   struct lp_scene_bin_queue *bin_queues;  /**< one per rasterizer thread */
+
    mtx_t mutex;
 
    unsigned num_alloced_tiles;
@@ -398,10 +423,11 @@ lp_scene_get_num_bins(const struct lp_scene *scene)
 
 
 void
-lp_scene_bin_iter_begin(struct lp_scene *scene);
+lp_scene_bin_iter_begin(struct lp_scene *scene, unsigned num_queues);
 
 struct cmd_bin *
-lp_scene_bin_iter_next(struct lp_scene *scene, int *x, int *y);
+lp_scene_bin_iter_next(struct lp_scene *scene, unsigned queue,
+                       int *x, int *y, bool *stolen);
 
 
 
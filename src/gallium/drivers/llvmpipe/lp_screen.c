@@ -52,6 +52,7 @@
 #include "lp_debug.h"
 #include "lp_public.h"
 #include "lp_limits.h"
+#include "lp_linear_kernels.h"
 #include "lp_rast.h"
 #include "lp_cs_tpool.h"
 #include "lp_flush.h"
@@ -73,6 +74,7 @@ static const struct debug_named_value lp_debug_flags[] = {
    { "tex", DEBUG_TEX, NULL },
    { "setup", DEBUG_SETUP, NULL },
    { "rast", DEBUG_RAST, NULL },
+   { "rast_stats", DEBUG_RAST_STATS, NULL },
    { "query", DEBUG_QUERY, NULL },
    { "screen", DEBUG_SCREEN, NULL },
    { "counters", DEBUG_COUNTERS, NULL },
@@ -101,6 +103,11 @@ static const struct debug_named_value lp_perf_flags[] = {
    { "no_alphatest",   PERF_NO_ALPHATEST, NULL },
    { "no_rast_linear", PERF_NO_RAST_LINEAR, NULL },
    { "no_shade",       PERF_NO_SHADE, NULL },
+   { "no_bin_steal",   PERF_NO_BIN_STEAL, NULL },
+   { "no_pin_threads", PERF_NO_PIN_THREADS, NULL },
+   { "no_texcache",    PERF_NO_TEXCACHE, NULL },
+   { "no_cs_steal",    PERF_NO_CS_STEAL, NULL },
+   { "no_draw_threads", PERF_NO_DRAW_THREADS, NULL },
    DEBUG_NAMED_VALUE_END
 };
 
@@ -722,7 +729,8 @@ llvmpipe_flush_frontbuffer(struct pipe_screen *_screen,
 
    if (texture->dt) {
       if (_pipe)
-         llvmpipe_flush_resource(_pipe, resource, 0, true, true,
+         llvmpipe_flush_resource(threaded_context_unwrap_sync(_pipe),
+                                 resource, 0, true, true,
                                  false, "frontbuffer");
       winsys->displaytarget_display(winsys, texture->dt,
                                     context_private, nboxes, sub_box);
@@ -766,6 +774,9 @@ llvmpipe_destroy_screen(struct pipe_screen *_screen)
 #endif
    mtx_destroy(&screen->rast_mutex);
    mtx_destroy(&screen->cs_mutex);
+   mtx_destroy(&screen->retired_mutex);
+   slab_destroy_parent(&screen->transfer_pool);
+   util_idalloc_mt_fini(&screen->buffer_ids);
    FREE(screen);
 }
 
@@ -957,6 +968,8 @@ llvmpipe_create_screen(struct sw_winsys *winsys)
 
    LP_PERF = debug_get_flags_option("LP_PERF", lp_perf_flags, 0 );
 
+   lp_linear_kernels_init();
+
    screen = CALLOC_STRUCT(llvmpipe_screen);
    if (!screen)
       return NULL;
@@ -1023,6 +1036,11 @@ llvmpipe_create_screen(struct sw_winsys *winsys)
 
    (void) mtx_init(&screen->late_mutex, mtx_plain);
 
+   slab_create_parent(&screen->transfer_pool,
+                      sizeof(struct llvmpipe_transfer), 64);
+   util_idalloc_mt_init_tc(&screen->buffer_ids);
+   (void) mtx_init(&screen->retired_mutex, mtx_plain);
+
    llvmpipe_init_shader_caps(&screen->base);
    llvmpipe_init_compute_caps(&screen->base);
    llvmpipe_init_screen_caps(&screen->base);
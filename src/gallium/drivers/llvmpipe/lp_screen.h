@@ -38,6 +38,8 @@
 #include "pipe/p_defines.h"
 #include "util/u_thread.h"
 #include "util/list.h"
+#include "util/slab.h"
+#include "util/u_idalloc.h"
 #include "util/vma.h"
 #include "gallivm/lp_bld.h"
 #include "gallivm/lp_bld_misc.h"
@@ -57,6 +59,17 @@ struct llvmpipe_screen
     */
    unsigned timestamp;
 
+   /* Increments whenever a compressed texture may have been modified or
+    * freed, see llvmpipe_texcache_invalidate().
+    */
+   unsigned texcache_epoch;
+
+   /* Number of compressed resources whose memory can be written without
+    * us knowing, see llvmpipe_resource_is_external().  While there are
+    * any, cached texels don't outlive a scene.
+    */
+   unsigned num_external_compressed;
+
    struct lp_rasterizer *rast;
    mtx_t rast_mutex;
 
@@ -69,6 +82,11 @@ struct llvmpipe_screen
    mtx_t ctx_mutex;
    struct list_head ctx_list;
 
+   /* For u_threaded_context */
+   struct slab_parent_pool transfer_pool;
+   struct util_idalloc_mt buffer_ids;
+   mtx_t retired_mutex;  /**< protects llvmpipe_resource::retired */
+
    char renderer_string[100];
 
    struct disk_cache *disk_shader_cache;
@@ -45,6 +45,7 @@
 #include "util/os_time.h"
 #include "lp_context.h"
 #include "lp_memory.h"
+#include "lp_perf.h"
 #include "lp_scene.h"
 #include "lp_texture.h"
 #include "lp_debug.h"
@@ -68,12 +69,32 @@ try_update_scene_state(struct lp_setup_context *setup);
 static unsigned
 lp_setup_wait_empty_scene(struct lp_setup_context *setup)
 {
-   /* just use the first scene if we run out */
-   if (setup->scenes[0]->fence) {
-      lp_fence_wait(setup->scenes[0]->fence);
-      lp_scene_end_rasterization(setup->scenes[0]);
+   /* Scenes are rasterized in order, so the one with the oldest fence is
+    * the first to become available.
+    */
+   unsigned oldest = 0;
+   for (unsigned i = 0; i < setup->num_active_scenes; i++) {
+      const struct lp_fence *fence = setup->scenes[i]->fence;
+      if (!fence)
+         return i;
+      if ((int)(fence->id - setup->scenes[oldest]->fence->id) < 0)
+         oldest = i;
+   }
+
+   if (setup->scenes[oldest]->fence) {
+      int64_t start = 0;
+      if (LP_DEBUG & DEBUG_COUNTERS)
+         start = os_time_get();
+
+      lp_fence_wait(setup->scenes[oldest]->fence);
+      lp_scene_end_rasterization(setup->scenes[oldest]);
+
+      if (LP_DEBUG & DEBUG_COUNTERS) {
+         LP_COUNT(nr_setup_stalls);
+         LP_COUNT_ADD(setup_stall_time, os_time_get() - start);
+      }
    }
-   return 0;
+   return oldest;
 }
 
 
@@ -196,6 +217,39 @@ lp_setup_reset(struct lp_setup_context *setup)
 }
 
 
+/**
+ * Whether compressed texels cached by the rasterizer threads can go stale
+ * while this scene is rasterized: when rendering to a compressed texture
+ * through an uncompressed view, or when compressed memory we don't own
+ * exists at all.
+ */
+static bool
+scene_invalidates_texcache(const struct lp_setup_context *setup,
+                           struct llvmpipe_screen *screen)
+{
+   for (unsigned i = 0; i < setup->fb.nr_cbufs; i++) {
+      const struct pipe_resource *res = setup->fb.cbufs[i].texture;
+      if (res && util_format_is_compressed(res->format))
+         return true;
+   }
+
+   const struct pipe_resource *zs = setup->fb.zsbuf.texture;
+   if (zs && util_format_is_compressed(zs->format))
+      return true;
+
+   for (unsigned i = 0; i < ARRAY_SIZE(setup->images); i++) {
+      const struct pipe_resource *res = setup->images[i].current.resource;
+      if (res && util_format_is_compressed(res->format))
+         return true;
+   }
+
+   /* The bound textures don't tell which resources lavapipe samples
+    * through descriptors, so any external one will do.
+    */
+   return p_atomic_read(&screen->num_external_compressed) != 0;
+}
+
+
 /** Rasterize all scene's bins */
 static void
 lp_setup_rasterize_scene(struct lp_setup_context *setup)
@@ -203,12 +257,27 @@ lp_setup_rasterize_scene(struct lp_setup_context *setup)
    struct lp_scene *scene = setup->scene;
    struct llvmpipe_screen *screen = llvmpipe_screen(scene->pipe->screen);
 
+   /* Texels cached during such a scene must not outlive it either */
+   const bool invalidates_texcache = scene_invalidates_texcache(setup, screen);
+   if (invalidates_texcache || setup->texcache_dirty)
+      p_atomic_inc(&screen->texcache_epoch);
+   setup->texcache_dirty = invalidates_texcache;
+   scene->texcache_epoch = p_atomic_read(&screen->texcache_epoch);
+
    scene->num_active_queries = setup->active_binned_queries;
    memcpy(scene->active_queries, setup->active_queries,
           scene->num_active_queries * sizeof(scene->active_queries[0]));
 
    lp_scene_end_binning(scene);
 
+   /* Sort the bins into per-thread queues here rather than on the
+    * rasterizer threads, so that it overlaps with the rasterization of
+    * the previous scene.  With work stealing disabled all threads share a
+    * single queue in raster order.
+    */
+   lp_scene_bin_iter_begin(scene, (LP_PERF & PERF_NO_BIN_STEAL) ?
+                           1 : MAX2(1, setup->num_threads));
+
    mtx_lock(&screen->rast_mutex);
    lp_rast_queue_scene(screen->rast, scene);
    mtx_unlock(&screen->rast_mutex);
@@ -801,14 +870,19 @@ void
 lp_setup_set_linear_mode(struct lp_setup_context *setup,
                          bool mode)
 {
-   /* The linear rasterizer requires sse2 both at compile and runtime,
-    * in particular for the code in lp_rast_linear_fallback.c.  This
-    * is more than ten-year-old technology, so it's a reasonable
-    * baseline.
+   /* The linear rasterizer requires sse2 both at compile and runtime
+    * for the spanline shader runner in lp_linear.c.  This is more than
+    * ten-year-old technology, so it's a reasonable baseline.
+    *
+    * On AArch64 only the blit/composite fastpaths built on the NEON
+    * lp_linear_kernels are available, other variants are rasterized
+    * by lp_rast_linear_fallback.c.
     */
 #if DETECT_ARCH_SSE
    setup->permit_linear_rasterizer = (mode &&
                                       util_get_cpu_caps()->has_sse2);
+#elif DETECT_ARCH_AARCH64
+   setup->permit_linear_rasterizer = mode;
 #else
    setup->permit_linear_rasterizer = false;
 #endif
@@ -1520,6 +1594,8 @@ lp_setup_flush_and_restart(struct lp_setup_context *setup)
 
    assert(setup->state == SETUP_ACTIVE);
 
+   LP_COUNT(nr_scene_restarts);
+
    if (!set_scene_state(setup, SETUP_FLUSHED, __func__))
       return false;
 
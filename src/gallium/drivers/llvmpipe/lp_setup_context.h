@@ -29,6 +29,13 @@
 /**
  * The setup code is concerned with point/line/triangle setup and
  * putting commands/data into the bins.
+ *
+ * Binning of the next scene overlaps with rasterization of the queued
+ * ones, up to MAX_SCENES in flight.  There is no binning thread of its own:
+ * contexts behind u_threaded_context bin on its driver thread, and others
+ * bin on the application thread.  Scenes are ordered by whole-scene fences
+ * rather than per-bin dependencies, since a scene may sample anything the
+ * previous ones rendered.
  */
 
 
@@ -96,6 +103,9 @@ struct lp_setup_context
    struct lp_scene *scenes[MAX_SCENES];  /**< all the scenes */
    struct lp_scene *scene;               /**< current scene being built */
 
+   /** Last queued scene may have made cached compressed texels stale */
+   bool texcache_dirty;
+
    struct llvmpipe_query *active_queries[LP_MAX_ACTIVE_BINNED_QUERIES];
    unsigned active_binned_queries;
 
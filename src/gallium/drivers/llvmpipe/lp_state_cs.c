@@ -1689,10 +1689,14 @@ cs_exec_fn(void *init_data, int iter_idx, struct lp_cs_local_mem *lmem)
 
    memset(&thread_data, 0, sizeof(thread_data));
 
+   /* The local memory lives as long as the thread, grow it in powers of
+    * two so shaders with slightly different needs don't keep reallocating.
+    * The contents don't need to survive between work groups.
+    */
    if (lmem->local_size < job_info->req_local_mem) {
-      lmem->local_mem_ptr = REALLOC(lmem->local_mem_ptr, lmem->local_size,
-                                    job_info->req_local_mem);
-      lmem->local_size = job_info->req_local_mem;
+      FREE(lmem->local_mem_ptr);
+      lmem->local_size = util_next_power_of_two(job_info->req_local_mem);
+      lmem->local_mem_ptr = MALLOC(lmem->local_size);
    }
    if (job_info->zero_initialize_shared_memory)
       memset(lmem->local_mem_ptr, 0, job_info->req_local_mem);
@@ -1803,6 +1807,13 @@ llvmpipe_launch_grid(struct pipe_context *pipe,
       mtx_unlock(&screen->cs_mutex);
 
       lp_cs_tpool_wait_for_task(screen->cs_tpool, &task);
+
+      /* Compressed textures may have been written through image views */
+      for (unsigned i = 0; i < ARRAY_SIZE(llvmpipe->csctx->images); i++) {
+         struct pipe_resource *res = llvmpipe->csctx->images[i].current.resource;
+         if (res)
+            llvmpipe_texcache_invalidate(res);
+      }
    }
    if (!llvmpipe->queries_disabled)
       llvmpipe->pipeline_statistics.cs_invocations += num_tasks * info->block[0] * info->block[1] * info->block[2];
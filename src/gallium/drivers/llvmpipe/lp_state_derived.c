@@ -309,6 +309,9 @@ llvmpipe_update_derived(struct llvmpipe_context *llvmpipe)
                           LP_NEW_OCCLUSION_QUERY))
       llvmpipe_update_fs(llvmpipe);
 
+   /* Guess the state newly created shaders will be drawn with */
+   llvmpipe_fs_precompile_pending(llvmpipe);
+
    if (llvmpipe->dirty & (LP_NEW_FS |
                           LP_NEW_FRAMEBUFFER |
                           LP_NEW_RASTERIZER |
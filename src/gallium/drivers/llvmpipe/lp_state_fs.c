@@ -676,6 +676,7 @@ fs_fb_fetch(const struct lp_build_fs_iface *iface,
 static void
 generate_fs_loop(struct gallivm_state *gallivm,
                  struct lp_fragment_shader *shader,
+                 struct nir_shader *nir,
                  const struct lp_fragment_shader_variant_key *key,
                  LLVMBuilderRef builder,
                  struct lp_type type,
@@ -711,7 +712,6 @@ generate_fs_loop(struct gallivm_state *gallivm,
    LLVMValueRef z_out = NULL, s_out = NULL;
    struct lp_build_for_loop_state loop_state, sample_loop_state = {0};
    struct lp_build_mask_context mask;
-   struct nir_shader *nir = shader->base.ir.nir;
    const bool dual_source_blend = key->blend.rt[0].blend_enable &&
                                   util_blend_state_is_dual(&key->blend, 0);
    const bool post_depth_coverage = nir->info.fs.post_depth_coverage;
@@ -3156,7 +3156,7 @@ generate_fragment(struct llvmpipe_context *lp,
    assert(partial_mask == RAST_WHOLE ||
           partial_mask == RAST_EDGE_TEST);
 
-   struct nir_shader *nir = shader->base.ir.nir;
+   struct nir_shader *nir = variant->nir;
    struct gallivm_state *gallivm = variant->gallivm;
    struct lp_fragment_shader_variant_key *key = &variant->key;
    struct lp_shader_input inputs[PIPE_MAX_SHADER_INPUTS];
@@ -3449,7 +3449,7 @@ generate_fragment(struct llvmpipe_context *lp,
       }
 
       generate_fs_loop(gallivm,
-                       shader, key,
+                       shader, nir, key,
                        builder,
                        fs_type,
                        variant->jit_context_type,
@@ -3728,7 +3728,8 @@ lp_debug_fs_variant(struct lp_fragment_shader_variant *variant)
 {
    debug_printf("llvmpipe: Fragment shader #%u variant #%u:\n",
                 variant->shader->no, variant->no);
-   nir_print_shader(variant->shader->base.ir.nir, stderr);
+   nir_print_shader(variant->nir ? variant->nir : variant->shader->base.ir.nir,
+                    stderr);
    dump_fs_variant_key(&variant->key);
    debug_printf("variant->opaque = %u\n", variant->opaque);
    debug_printf("variant->potentially_opaque = %u\n", variant->potentially_opaque);
@@ -3747,7 +3748,7 @@ lp_fs_get_ir_cache_key(struct lp_fragment_shader_variant *variant,
    void *ir_binary;
 
    blob_init(&blob);
-   nir_serialize(&blob, variant->shader->base.ir.nir, true);
+   nir_serialize(&blob, variant->nir, true);
    ir_binary = blob.data;
    ir_size = blob.size;
 
@@ -3764,13 +3765,17 @@ lp_fs_get_ir_cache_key(struct lp_fragment_shader_variant *variant,
 /**
  * Generate a new fragment shader variant from the shader code and
  * other state indicated by the key.
+ *
+ * Compilation modifies the NIR, so it is either the shader's own, on the
+ * thread which draws, or a private copy.
  */
 static struct lp_fragment_shader_variant *
 generate_variant(struct llvmpipe_context *lp,
                  struct lp_fragment_shader *shader,
+                 struct nir_shader *nir,
+                 lp_context_ref *context,
                  const struct lp_fragment_shader_variant_key *key)
 {
-   struct nir_shader *nir = shader->base.ir.nir;
    struct lp_fragment_shader_variant *variant =
       MALLOC(sizeof *variant + shader->variant_key_size - sizeof variant->key);
    if (!variant)
@@ -3780,6 +3785,8 @@ generate_variant(struct llvmpipe_context *lp,
 
    pipe_reference_init(&variant->reference, 1);
    lp_fs_reference(lp, &variant->shader, shader);
+   variant->nir = nir;
+   variant->no = p_atomic_inc_return(&shader->variants_created) - 1;
 
    memcpy(&variant->key, key, shader->variant_key_size);
 
@@ -3787,7 +3794,7 @@ generate_variant(struct llvmpipe_context *lp,
    struct lp_cached_code cached = { 0 };
    unsigned char ir_sha1_cache_key[20];
    bool needs_caching = false;
-   if (shader->base.ir.nir) {
+   if (nir) {
       lp_fs_get_ir_cache_key(variant, ir_sha1_cache_key);
 
       lp_disk_cache_find_shader(screen, &cached, ir_sha1_cache_key);
@@ -3797,8 +3804,8 @@ generate_variant(struct llvmpipe_context *lp,
 
    char module_name[64];
    snprintf(module_name, sizeof(module_name), "fs%u_variant%u",
-            shader->no, shader->variants_created);
-   variant->gallivm = gallivm_create(module_name, &lp->context, &cached);
+            shader->no, variant->no);
+   variant->gallivm = gallivm_create(module_name, context, &cached);
    if (!variant->gallivm) {
       FREE(variant);
       return NULL;
@@ -3806,7 +3813,6 @@ generate_variant(struct llvmpipe_context *lp,
 
    variant->list_item_global.base = variant;
    variant->list_item_local.base = variant;
-   variant->no = shader->variants_created++;
 
    /*
     * Determine whether we are touching all channels in the color buffer.
@@ -4007,11 +4013,250 @@ generate_variant(struct llvmpipe_context *lp,
    }
 
    gallivm_free_ir(variant->gallivm);
+   variant->nir = NULL;
 
    return variant;
 }
 
 
+/*
+ * Background fragment shader compilation, see LP_ASYNC_FS_COMPILE.
+ *
+ * With u_threaded_context shaders are created on the application thread,
+ * while the bound state belongs to the driver thread.  So creation only
+ * queues the shader on fs_precompile_pending, and the next draw guesses
+ * that the shader will first be drawn with that draw's state.  The variant
+ * for it is compiled on the context's fs_compile_queue, from a copy of the
+ * NIR in a private LLVM context.  If the guess is right and the compile
+ * has finished, llvmpipe_update_fs() picks up the result instead of
+ * stalling the draw on LLVM.  Otherwise it compiles synchronously as
+ * before, and never waits for the background job.
+ *
+ * All jobs are on fs_precompiles until freed.  The one a shader may still
+ * use is also its shader->precompile, the others are freed once finished.
+ */
+
+static struct lp_fragment_shader_variant_key *
+make_variant_key(struct llvmpipe_context *lp,
+                 struct lp_fragment_shader *shader,
+                 char *store);
+
+static void
+lp_fs_precompile_execute(void *data, void *gdata, int thread_index)
+{
+   struct lp_fs_precompile *job = data;
+   const struct lp_fragment_shader_variant_key *key =
+      (const struct lp_fragment_shader_variant_key *)job->key;
+
+   int64_t t0 = os_time_get();
+
+   lp_context_create(&job->context);
+   if (!job->context.ref)
+      return;
+
+   job->variant = generate_variant(job->lp, job->shader, job->nir,
+                                   &job->context, key);
+
+   if (job->variant) {
+      /* the LLVM context now lives as long as the variant */
+      job->variant->context = job->context;
+      job->context.owned = false;
+   }
+
+   job->compile_time = os_time_get() - t0;
+}
+
+
+static void
+lp_fs_precompile_free(struct lp_fs_precompile *job)
+{
+   list_del(&job->link);
+   if (job->variant)
+      lp_fs_variant_reference(job->lp, &job->variant, NULL);
+   if (job->context.ref)
+      lp_context_destroy(&job->context);
+   ralloc_free(job->nir);
+   lp_fs_reference(job->lp, &job->shader, NULL);
+   util_queue_fence_destroy(&job->fence);
+   FREE(job);
+}
+
+
+/**
+ * Free the finished jobs which no shader is waiting for anymore.
+ */
+static void
+lp_fs_precompile_reap(struct llvmpipe_context *lp)
+{
+   list_for_each_entry_safe(struct lp_fs_precompile, job,
+                            &lp->fs_precompiles, link) {
+      if (job->shader->precompile != job &&
+          util_queue_fence_is_signalled(&job->fence))
+         lp_fs_precompile_free(job);
+   }
+}
+
+
+/**
+ * Queue a background compile of the variant the shader would get if it
+ * were drawn with the current state.
+ */
+static void
+lp_fs_precompile(struct llvmpipe_context *lp,
+                 struct lp_fragment_shader *shader)
+{
+   /* make_variant_key() needs these, and without them we have nothing
+    * useful to guess from anyway.
+    */
+   if (!lp->depth_stencil || !lp->rasterizer || !lp->blend)
+      return;
+
+   struct lp_fs_precompile *job = CALLOC_STRUCT(lp_fs_precompile);
+   if (!job)
+      return;
+
+   job->nir = nir_shader_clone(NULL, shader->base.ir.nir);
+   if (!job->nir) {
+      FREE(job);
+      return;
+   }
+
+   job->lp = lp;
+   lp_fs_reference(lp, &job->shader, shader);
+   make_variant_key(lp, shader, job->key);
+   util_queue_fence_init(&job->fence);
+   list_addtail(&job->link, &lp->fs_precompiles);
+
+   shader->precompile = job;
+   LP_COUNT(nr_fs_precompiles);
+
+   util_queue_add_job(&lp->fs_compile_queue, job, &job->fence,
+                      lp_fs_precompile_execute, NULL, 0);
+}
+
+
+/**
+ * Queue background compiles for the shaders created since the last draw,
+ * keyed on the current state.  Called at draw time, after the bound
+ * fragment shader was updated.
+ */
+void
+llvmpipe_fs_precompile_pending(struct llvmpipe_context *lp)
+{
+   if (!list_is_empty(&lp->fs_precompiles))
+      lp_fs_precompile_reap(lp);
+
+   if (!p_atomic_read(&lp->fs_precompile_pending.size))
+      return;
+
+   struct util_dynarray pending;
+   simple_mtx_lock(&lp->fs_precompile_lock);
+   pending = lp->fs_precompile_pending;
+   util_dynarray_init(&lp->fs_precompile_pending, NULL);
+   simple_mtx_unlock(&lp->fs_precompile_lock);
+
+   util_dynarray_foreach(&pending, struct lp_fragment_shader *, ptr) {
+      struct lp_fragment_shader *shader = *ptr;
+
+      /* Skip shaders which were already drawn with, or deleted, in which
+       * case the pending list holds the last reference.
+       */
+      if (!shader->variants_cached && !shader->precompile &&
+          p_atomic_read(&shader->reference.count) > 1)
+         lp_fs_precompile(lp, shader);
+
+      lp_fs_reference(lp, &shader, NULL);
+   }
+
+   util_dynarray_fini(&pending);
+}
+
+
+/**
+ * Drop the shader's pending background compile without waiting for it.
+ */
+static void
+lp_fs_precompile_discard(struct lp_fragment_shader *shader)
+{
+   struct lp_fs_precompile *job = shader->precompile;
+   if (!job)
+      return;
+
+   shader->precompile = NULL;
+   if (util_queue_fence_is_signalled(&job->fence))
+      lp_fs_precompile_free(job);
+}
+
+
+/**
+ * Return the background compiled variant for the given key, or NULL if
+ * there isn't a finished one.
+ */
+static struct lp_fragment_shader_variant *
+lp_fs_precompile_take(struct lp_fragment_shader *shader,
+                      const struct lp_fragment_shader_variant_key *key)
+{
+   struct lp_fs_precompile *job = shader->precompile;
+   if (!job)
+      return NULL;
+
+   if (!util_queue_fence_is_signalled(&job->fence)) {
+      /* A matching compile would produce the variant the draw is about to
+       * compile itself, so it is of no use anymore.  Leave a mismatching
+       * one running, the state may still change to match before it
+       * finishes.
+       */
+      if (memcmp(job->key, key, shader->variant_key_size) == 0) {
+         LP_COUNT(nr_fs_precompile_unfinished);
+         lp_fs_precompile_discard(shader);
+      }
+      return NULL;
+   }
+
+   if (memcmp(job->key, key, shader->variant_key_size) != 0) {
+      LP_COUNT(nr_fs_precompile_misses);
+      lp_fs_precompile_discard(shader);
+      return NULL;
+   }
+
+   LP_COUNT(nr_fs_precompile_hits);
+   shader->precompile = NULL;
+
+   struct lp_fragment_shader_variant *variant = job->variant;
+   job->variant = NULL;
+   if (variant) {
+      LP_COUNT_ADD(llvm_compile_time, job->compile_time);
+      LP_COUNT_ADD(nr_llvm_compiles, 2);  /* emit vs. omit in/out test */
+   }
+
+   lp_fs_precompile_free(job);
+   return variant;
+}
+
+
+/**
+ * Free all background compiles and pending shaders of the context.  The
+ * compile queue must have been destroyed already.
+ */
+void
+llvmpipe_fs_precompile_fini(struct llvmpipe_context *lp)
+{
+   util_dynarray_foreach(&lp->fs_precompile_pending,
+                         struct lp_fragment_shader *, ptr)
+      lp_fs_reference(lp, ptr, NULL);
+   util_dynarray_fini(&lp->fs_precompile_pending);
+
+   list_for_each_entry_safe(struct lp_fs_precompile, job,
+                            &lp->fs_precompiles, link) {
+      if (job->shader->precompile == job)
+         job->shader->precompile = NULL;
+      lp_fs_precompile_free(job);
+   }
+
+   simple_mtx_destroy(&lp->fs_precompile_lock);
+}
+
+
 static void *
 llvmpipe_create_fs_state(struct pipe_context *pipe,
                          const struct pipe_shader_state *templ)
@@ -4111,6 +4356,15 @@ llvmpipe_create_fs_state(struct pipe_context *pipe,
 
    llvmpipe_fs_analyse_nir(shader);
 
+   if (llvmpipe->fs_compile_queue_enabled) {
+      struct lp_fragment_shader *pending = NULL;
+      lp_fs_reference(llvmpipe, &pending, shader);
+      simple_mtx_lock(&llvmpipe->fs_precompile_lock);
+      util_dynarray_append(&llvmpipe->fs_precompile_pending,
+                           struct lp_fragment_shader *, pending);
+      simple_mtx_unlock(&llvmpipe->fs_precompile_lock);
+   }
+
    return shader;
 }
 
@@ -4167,6 +4421,7 @@ llvmpipe_destroy_shader_variant(struct llvmpipe_context *lp,
                                 struct lp_fragment_shader_variant *variant)
 {
    gallivm_destroy(variant->gallivm);
+   lp_context_destroy(&variant->context);
    lp_fs_reference(lp, &variant->shader, NULL);
    if (variant->function_name[RAST_EDGE_TEST])
       FREE(variant->function_name[RAST_EDGE_TEST]);
@@ -4187,6 +4442,7 @@ llvmpipe_destroy_fs(struct llvmpipe_context *llvmpipe,
 
    ralloc_free(shader->base.ir.nir);
    assert(shader->variants_cached == 0);
+   assert(!shader->precompile);
    FREE(shader);
 }
 
@@ -4198,6 +4454,11 @@ llvmpipe_delete_fs_state(struct pipe_context *pipe, void *fs)
    struct lp_fragment_shader *shader = fs;
    struct lp_fs_variant_list_item *li, *next;
 
+   /* A running compile holds a reference to the shader, it is freed once
+    * finished.
+    */
+   lp_fs_precompile_discard(shader);
+
    /* Delete all the variants */
    LIST_FOR_EACH_ENTRY_SAFE(li, next, &shader->variants.list, list) {
       struct lp_fragment_shader_variant *variant;
@@ -4758,14 +5019,19 @@ llvmpipe_update_fs(struct llvmpipe_context *lp)
       }
 
       /*
-       * Generate the new variant.
+       * Use the variant compiled in the background, if it matches,
+       * otherwise generate the new variant now.
        */
-      int64_t t0 = os_time_get();
-      variant = generate_variant(lp, shader, key);
-      int64_t t1 = os_time_get();
-      int64_t dt = t1 - t0;
-      LP_COUNT_ADD(llvm_compile_time, dt);
-      LP_COUNT_ADD(nr_llvm_compiles, 2);  /* emit vs. omit in/out test */
+      variant = lp_fs_precompile_take(shader, key);
+      if (!variant) {
+         int64_t t0 = os_time_get();
+         variant = generate_variant(lp, shader, shader->base.ir.nir,
+                                    &lp->context, key);
+         int64_t t1 = os_time_get();
+         int64_t dt = t1 - t0;
+         LP_COUNT_ADD(llvm_compile_time, dt);
+         LP_COUNT_ADD(nr_llvm_compiles, 2);  /* emit vs. omit in/out test */
+      }
 
       /* Put the new variant into the list */
       if (variant) {
@@ -4791,4 +5057,8 @@ llvmpipe_init_fs_funcs(struct llvmpipe_context *llvmpipe)
    llvmpipe->pipe.set_constant_buffer = llvmpipe_set_constant_buffer;
    llvmpipe->pipe.set_shader_buffers = llvmpipe_set_shader_buffers;
    llvmpipe->pipe.set_shader_images = llvmpipe_set_shader_images;
+
+   list_inithead(&llvmpipe->fs_precompiles);
+   simple_mtx_init(&llvmpipe->fs_precompile_lock, mtx_plain);
+   util_dynarray_init(&llvmpipe->fs_precompile_pending, NULL);
 }
@@ -38,6 +38,7 @@
 #include "gallivm/lp_bld_tgsi.h" /* for lp_tgsi_info */
 #include "lp_bld_interp.h" /* for struct lp_shader_input */
 #include "util/u_inlines.h"
+#include "util/u_queue.h"
 #include "lp_jit.h"
 
 struct lp_fragment_shader;
@@ -193,11 +194,42 @@ struct lp_fragment_shader_variant
    /* For debugging/profiling purposes */
    unsigned no;
 
+   /* LLVM context owned by this variant, if it was compiled in the
+    * background (see lp_fs_precompile).  NULL otherwise.
+    */
+   lp_context_ref context;
+
+   /* The NIR being compiled, only set during generate_variant().  Background
+    * compiles use a private copy of the shader's NIR.
+    */
+   struct nir_shader *nir;
+
    /* key is variable-sized, must be last */
    struct lp_fragment_shader_variant_key key;
 };
 
 
+/**
+ * A variant compiled ahead of time on the context's fs_compile_queue,
+ * picked up by llvmpipe_update_fs() if the draw-time key matches.
+ */
+struct lp_fs_precompile
+{
+   struct list_head link;  /**< in llvmpipe_context::fs_precompiles */
+   struct util_queue_fence fence;
+   struct llvmpipe_context *lp;
+   struct lp_fragment_shader *shader;
+   struct nir_shader *nir;  /**< private copy of the shader's NIR */
+   lp_context_ref context;
+   int64_t compile_time;   /**< in microseconds */
+
+   /* Result, NULL if compilation failed */
+   struct lp_fragment_shader_variant *variant;
+
+   char key[LP_FS_MAX_VARIANT_KEY_SIZE];
+};
+
+
 /** Subclass of pipe_shader_state */
 struct lp_fragment_shader
 {
@@ -219,6 +251,9 @@ struct lp_fragment_shader
    unsigned variants_created;
    unsigned variants_cached;
 
+   /* Pending background compile, if any */
+   struct lp_fs_precompile *precompile;
+
    /** Fragment shader input interpolation info */
    struct lp_shader_input inputs[PIPE_MAX_SHADER_INPUTS];
 };
@@ -251,6 +286,12 @@ void
 llvmpipe_destroy_fs(struct llvmpipe_context *llvmpipe,
                     struct lp_fragment_shader *shader);
 
+void
+llvmpipe_fs_precompile_pending(struct llvmpipe_context *llvmpipe);
+
+void
+llvmpipe_fs_precompile_fini(struct llvmpipe_context *llvmpipe);
+
 static inline void
 lp_fs_reference(struct llvmpipe_context *llvmpipe,
                 struct lp_fragment_shader **ptr,
@@ -39,11 +39,7 @@
 #include "lp_debug.h"
 #include "lp_state_fs.h"
 #include "lp_linear_priv.h"
-
-
-#if DETECT_ARCH_SSE
-
-#include <emmintrin.h>
+#include "lp_linear_kernels.h"
 
 
 struct nearest_sampler {
@@ -82,7 +78,6 @@ struct shader {
    alignas(16) uint32_t out0[64];
    const uint32_t *src0;
    const uint32_t *src1;
-   __m128i const0;
    int width;                   /* rounded up to multiple of 4 */
 };
 
@@ -100,32 +95,9 @@ struct shader {
 static void
 blend_premul(struct color_blend *blend)
 {
-   const uint32_t *src = blend->src;  /* aligned */
-   uint32_t *dst = (uint32_t *)blend->color;      /* unaligned */
-   const int width = blend->width;
-   int i;
-   union { __m128i m128; uint ui[4]; } dstreg;
-
+   lp_linear_kernels->blend_premul_row((uint32_t *)blend->color, blend->src,
+                                       blend->width);
    blend->color += blend->stride;
-
-   for (i = 0; i + 3 < width; i += 4) {
-      __m128i tmp;
-      tmp = _mm_loadu_si128((const __m128i *)&dst[i]);  /* UNALIGNED READ */
-      dstreg.m128 = util_sse2_blend_premul_4(*(const __m128i *)&src[i],
-                                             tmp);
-      _mm_storeu_si128((__m128i *)&dst[i], dstreg.m128); /* UNALIGNED WRITE */
-   }
-
-   if (i < width) {
-      int j;
-      for (j = 0; j < width - i ; j++) {
-         dstreg.ui[j] = dst[i+j];
-      }
-      dstreg.m128 = util_sse2_blend_premul_4(*(const __m128i *)&src[i],
-                                             dstreg.m128);
-      for (; i < width; i++)
-         dst[i] = dstreg.ui[i&3];
-   }
 }
 
 
@@ -315,17 +287,7 @@ init_nearest_sampler(struct nearest_sampler *samp,
 static const uint32_t *
 shade_rgb1(struct shader *shader)
 {
-   const __m128i rgb1 = _mm_set1_epi32(0xff000000);
-   const uint32_t *src0 = shader->src0;
-   uint32_t *dst = shader->out0;
-   int width = shader->width;
-   int i;
-
-   for (i = 0; i + 3 < width; i += 4) {
-      __m128i s = *(const __m128i *)&src0[i];
-      *(__m128i *)&dst[i] = _mm_or_si128(s, rgb1);
-   }
-
+   lp_linear_kernels->rgbx_row(shader->out0, shader->src0, shader->width);
    return shader->out0;
 }
 
@@ -435,13 +397,8 @@ blit_rgb1_blit(const struct lp_rast_state *state,
       return false;
 
    for (y = 0; y < height; y++) {
-      const uint32_t *src_row = (const uint32_t *)src;
-      uint32_t *dst_row = (uint32_t *)color;
-
-      for (x = 0; x < width; x++) {
-         *dst_row++ = *src_row++ | 0xff000000;
-      }
-
+      lp_linear_kernels->rgbx_row((uint32_t *)color,
+                                  (const uint32_t *)src, width);
       color += stride;
       src += src_stride;
    }
@@ -660,8 +617,7 @@ llvmpipe_fs_variant_linear_fastpath(struct lp_fragment_shader_variant *variant)
       if (variant->opaque) {
          variant->jit_linear_blit = blit_rgba_blit;
          variant->jit_linear = blit_rgba;
-      } else if (is_one_inv_src_alpha_blend(variant) &&
-                 util_get_cpu_caps()->has_sse2) {
+      } else if (is_one_inv_src_alpha_blend(variant)) {
          variant->jit_linear = blit_rgba_blend_premul;
       }
       return;
@@ -682,11 +638,4 @@ llvmpipe_fs_variant_linear_fastpath(struct lp_fragment_shader_variant *variant)
       return;
    }
 }
-#else
-void
-llvmpipe_fs_variant_linear_fastpath(struct lp_fragment_shader_variant *variant)
-{
-   /* don't bother if there is no SSE */
-}
-#endif
 
@@ -244,7 +244,7 @@ llvmpipe_fs_variant_linear_llvm(struct llvmpipe_context *lp,
           shader->kind == LP_FS_KIND_BLIT_RGB1 ||
           shader->kind == LP_FS_KIND_LLVM_LINEAR);
 
-   struct nir_shader *nir = shader->base.ir.nir;
+   struct nir_shader *nir = variant->nir;
    struct gallivm_state *gallivm = variant->gallivm;
    LLVMTypeRef int8t = LLVMInt8TypeInContext(gallivm->context);
    LLVMTypeRef int32t = LLVMInt32TypeInContext(gallivm->context);
@@ -261,8 +261,8 @@ llvmpipe_fs_variant_linear_llvm(struct llvmpipe_context *lp,
    fs_type.length = 16;
 
    if (LP_DEBUG & DEBUG_TGSI) {
-      if (shader->base.ir.nir) {
-         nir_print_shader(shader->base.ir.nir, stderr);
+      if (nir) {
+         nir_print_shader(nir, stderr);
       }
    }
 
@@ -0,0 +1,248 @@
+/**************************************************************************
+ *
+ * Copyright 2010-2021 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ **************************************************************************/
+
+
+/**
+ * @file
+ * Unit tests and micro-benchmarks for the compute shader thread pool.
+ *
+ * Tasks of various sizes are run on pools of various sizes, checking that
+ * every iteration runs exactly once.  "lp_test_cs_tpool -s" measures the
+ * dispatch latency, i.e. the time from queuing a task to it having
+ * finished, for tasks with very little work per iteration.
+ */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "util/os_time.h"
+#include "util/u_atomic.h"
+#include "util/u_cpu_detect.h"
+#include "util/u_math.h"
+#include "util/u_memory.h"
+
+#include "lp_cs_tpool.h"
+#include "lp_debug.h"
+#include "lp_test.h"
+
+
+#define MAX_ITERS 4096
+#define LOCAL_MEM_SIZE 256
+
+
+struct test_task {
+   unsigned counts[MAX_ITERS];
+   unsigned bad_lmem;
+};
+
+
+static void
+count_fn(void *data, int iter_idx, struct lp_cs_local_mem *lmem)
+{
+   struct test_task *t = data;
+
+   /* Same local memory handling as cs_exec_fn(). */
+   if (lmem->local_size < LOCAL_MEM_SIZE) {
+      FREE(lmem->local_mem_ptr);
+      lmem->local_size = LOCAL_MEM_SIZE;
+      lmem->local_mem_ptr = MALLOC(lmem->local_size);
+   }
+   if (!lmem->local_mem_ptr)
+      p_atomic_inc(&t->bad_lmem);
+   else
+      memset(lmem->local_mem_ptr, iter_idx, LOCAL_MEM_SIZE);
+
+   p_atomic_inc(&t->counts[iter_idx]);
+}
+
+
+static void
+nop_fn(void *data, int iter_idx, struct lp_cs_local_mem *lmem)
+{
+   p_atomic_inc((unsigned *)data);
+}
+
+
+void
+write_tsv_header(FILE *fp)
+{
+   fprintf(fp,
+           "result\t"
+           "threads\t"
+           "steal\t"
+           "iterations\n");
+
+   fflush(fp);
+}
+
+
+static bool
+test_pool(unsigned verbose, FILE *fp, unsigned num_threads, bool steal)
+{
+   static const unsigned iter_counts[] = { 1, 2, 3, 7, 16, 63, 100, 1000,
+                                           MAX_ITERS };
+   struct test_task *t = CALLOC_STRUCT(test_task);
+   struct lp_cs_tpool *pool;
+   bool success = true;
+   const int perf = LP_PERF;
+
+   /* The pool looks at this once, when it is created. */
+   LP_PERF = steal ? perf & ~PERF_NO_CS_STEAL : perf | PERF_NO_CS_STEAL;
+   pool = lp_cs_tpool_create(num_threads);
+   LP_PERF = perf;
+
+   if (!t || !pool) {
+      FREE(t);
+      lp_cs_tpool_destroy(pool);
+      return false;
+   }
+
+   for (unsigned i = 0; i < ARRAY_SIZE(iter_counts); i++) {
+      const unsigned n = iter_counts[i];
+      bool pass = true;
+
+      /* Back-to-back dispatches catch tasks being freed too early. */
+      for (unsigned rep = 0; rep < 16 && pass; rep++) {
+         struct lp_cs_tpool_task *task;
+
+         memset(t, 0, sizeof(*t));
+         task = lp_cs_tpool_queue_task(pool, count_fn, t, n);
+         lp_cs_tpool_wait_for_task(pool, &task);
+
+         for (unsigned j = 0; j < MAX_ITERS; j++) {
+            if (t->counts[j] != (j < n)) {
+               printf("FAILED %u threads, %u iterations: "
+                      "iteration %u ran %u times\n",
+                      num_threads, n, j, t->counts[j]);
+               pass = false;
+               break;
+            }
+         }
+
+         if (t->bad_lmem) {
+            printf("FAILED %u threads, %u iterations: no local memory\n",
+                   num_threads, n);
+            pass = false;
+         }
+      }
+
+      if (verbose)
+         printf("%u threads%s, %u iterations: %s\n", num_threads,
+                steal ? "" : " (no steal)", n, pass ? "pass" : "FAIL");
+
+      if (fp) {
+         fprintf(fp, "%s\t%u\t%u\t%u\n", pass ? "pass" : "fail",
+                 num_threads, steal, n);
+         fflush(fp);
+      }
+
+      success = success && pass;
+   }
+
+   lp_cs_tpool_destroy(pool);
+   FREE(t);
+   return success;
+}
+
+
+bool
+test_all(unsigned verbose, FILE *fp)
+{
+   const unsigned nr_cpus = util_get_cpu_caps()->nr_cpus;
+   const unsigned thread_counts[] = { 0, 1, 3, MIN2(nr_cpus, LP_MAX_THREADS) };
+   bool success = true;
+
+   for (unsigned i = 0; i < ARRAY_SIZE(thread_counts); i++) {
+      if (!test_pool(verbose, fp, thread_counts[i], true))
+         success = false;
+      if (!test_pool(verbose, fp, thread_counts[i], false))
+         success = false;
+   }
+
+   return success;
+}
+
+
+bool
+test_some(unsigned verbose, FILE *fp,
+          unsigned long n)
+{
+   return test_all(verbose, fp);
+}
+
+
+/**
+ * Return the average time from queuing to completion of a task with the
+ * given number of empty iterations, in microseconds.
+ */
+static double
+bench_dispatch(struct lp_cs_tpool *pool, unsigned num_iters)
+{
+   const unsigned dispatches = 10000;
+   unsigned count = 0;
+   int64_t start, end;
+
+   start = os_time_get_nano();
+   for (unsigned i = 0; i < dispatches; i++) {
+      struct lp_cs_tpool_task *task;
+
+      task = lp_cs_tpool_queue_task(pool, nop_fn, &count, num_iters);
+      lp_cs_tpool_wait_for_task(pool, &task);
+   }
+   end = os_time_get_nano();
+
+   assert(count == dispatches * num_iters);
+
+   return (double)(end - start) / dispatches * 1e-3;
+}
+
+
+bool
+test_single(unsigned verbose, FILE *fp)
+{
+   const unsigned nr_cpus = util_get_cpu_caps()->nr_cpus;
+   const unsigned num_threads = MIN2(nr_cpus, LP_MAX_THREADS);
+   static const unsigned iter_counts[] = { 1, 4, 16, 64, 256, 1024 };
+   struct lp_cs_tpool *pool = lp_cs_tpool_create(num_threads);
+
+   if (!pool)
+      return false;
+
+   printf("dispatch latency, %u threads\n", num_threads);
+   printf("%10s %12s\n", "iterations", "usec");
+
+   for (unsigned i = 0; i < ARRAY_SIZE(iter_counts); i++) {
+      printf("%10u %12.2f\n", iter_counts[i],
+             bench_dispatch(pool, iter_counts[i]));
+      fflush(stdout);
+   }
+
+   lp_cs_tpool_destroy(pool);
+   return true;
+}
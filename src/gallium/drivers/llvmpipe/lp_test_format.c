@@ -32,10 +32,12 @@
 
 #include "util/u_memory.h"
 #include "util/u_pointer.h"
+#include "util/u_math.h"
 #include "util/u_string.h"
 #include "util/format/u_format.h"
 #include "util/format/u_format_tests.h"
 #include "util/format/u_format_s3tc.h"
+#include "util/os_time.h"
 
 #include "gallivm/lp_bld.h"
 #include "gallivm/lp_bld_debug.h"
@@ -367,6 +369,7 @@ test_all(unsigned verbose, FILE *fp)
    unsigned use_cache;
 
    cache_ptr = align_malloc(sizeof(struct lp_build_format_cache), 16);
+   lp_build_format_cache_invalidate(cache_ptr);
 
    for (use_cache = 0; use_cache < 2; use_cache++) {
       for (format = 1; format < PIPE_FORMAT_COUNT; ++format) {
@@ -395,7 +398,7 @@ test_all(unsigned verbose, FILE *fp)
             continue;
 
          /* only test twice with formats which can use cache */
-         if (format_desc->layout != UTIL_FORMAT_LAYOUT_S3TC && use_cache) {
+         if (!lp_build_format_cache_supported(format_desc) && use_cache) {
             continue;
          }
 
@@ -418,9 +421,108 @@ test_some(unsigned verbose, FILE *fp,
 }
 
 
+#define BENCH_BLOCKS 64
+#define BENCH_PASSES 8
+
+
+/**
+ * Time the unorm8 fetch of a whole texture of blocks, either with or without
+ * the texel cache, and return the throughput in Mtexel/s.
+ */
+UTIL_ALIGN_STACK
+static double
+bench_format_unorm8(const struct util_format_description *desc,
+                    const uint8_t *texture, unsigned use_cache)
+{
+   const unsigned block_bytes = desc->block.bits / 8;
+   const unsigned width = BENCH_BLOCKS * desc->block.width;
+   const unsigned height = BENCH_BLOCKS * desc->block.height;
+   lp_context_ref context;
+   struct gallivm_state *gallivm;
+   LLVMValueRef fetch;
+   char fetch_name[MAX_NAME];
+   fetch_ptr_t fetch_ptr;
+   uint8_t unpacked[4];
+   int64_t start, end;
+   unsigned pass, x, y;
+
+   lp_context_create(&context);
+   gallivm = gallivm_create("bench_module_unorm8", &context, NULL);
+
+   fetch = add_fetch_rgba_test(gallivm, 0, desc,
+                               lp_unorm8_vec4_type(), use_cache, fetch_name);
+
+   gallivm_compile_module(gallivm);
+
+   fetch_ptr = (fetch_ptr_t) gallivm_jit_function(gallivm, fetch, fetch_name);
+
+   gallivm_free_ir(gallivm);
+
+   lp_build_format_cache_invalidate(cache_ptr);
+
+   start = os_time_get_nano();
+   for (pass = 0; pass < BENCH_PASSES; ++pass) {
+      for (y = 0; y < height; ++y) {
+         for (x = 0; x < width; ++x) {
+            const uint8_t *block =
+               texture + ((y / desc->block.height) * BENCH_BLOCKS +
+                          x / desc->block.width) * block_bytes;
+            fetch_ptr(unpacked, block,
+                      x % desc->block.width, y % desc->block.height,
+                      use_cache ? cache_ptr : NULL);
+         }
+      }
+   }
+   end = os_time_get_nano();
+
+   gallivm_destroy(gallivm);
+   lp_context_destroy(&context);
+
+   return (double)width * height * BENCH_PASSES / MAX2(end - start, 1) * 1e3;
+}
+
+
+/**
+ * Benchmark the texel cache against the uncached decode for every format
+ * the cache supports (run with "lp_test_format -s").
+ */
 bool
 test_single(unsigned verbose, FILE *fp)
 {
-   printf("no test_single()");
+   enum pipe_format format;
+   uint8_t *texture;
+   unsigned i;
+
+   cache_ptr = align_malloc(sizeof(struct lp_build_format_cache), 16);
+   texture = align_malloc(BENCH_BLOCKS * BENCH_BLOCKS * 16, 16);
+
+   /* Distinct blocks so that the cache sees realistic tag traffic. */
+   srand(0);
+   for (i = 0; i < BENCH_BLOCKS * BENCH_BLOCKS * 16; ++i)
+      texture[i] = rand() & 0xff;
+
+   printf("%-40s %12s %12s %8s\n",
+          "format", "uncached", "cached", "speedup");
+
+   for (format = 1; format < PIPE_FORMAT_COUNT; ++format) {
+      const struct util_format_description *desc =
+         util_format_description(format);
+      double uncached, cached;
+
+      if (!lp_build_format_cache_supported(desc) ||
+          !util_format_fetch_rgba_func(format))
+         continue;
+
+      uncached = bench_format_unorm8(desc, texture, 0);
+      cached = bench_format_unorm8(desc, texture, 1);
+
+      printf("%-40s %8.1f Mt/s %8.1f Mt/s %7.2fx\n",
+             desc->short_name, uncached, cached, cached / uncached);
+      fflush(stdout);
+   }
+
+   align_free(texture);
+   align_free(cache_ptr);
+
    return true;
 }
@@ -0,0 +1,291 @@
+/**************************************************************************
+ *
+ * Copyright 2010-2021 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ **************************************************************************/
+
+
+/**
+ * @file
+ * Unit tests and micro-benchmarks for the linear path row kernels.
+ *
+ * Every kernel table the CPU supports is checked against the generic C
+ * kernels for bit-exact results.  "lp_test_linear -s" times each kernel
+ * over tile-sized spans instead.
+ */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "util/os_time.h"
+#include "util/u_math.h"
+
+#include "lp_linear_kernels.h"
+#include "lp_test.h"
+
+
+#define MAX_TABLES 8
+#define MAX_WIDTH 67          /* a tile plus an odd remainder */
+#define SRC_TEXELS (4 * MAX_WIDTH + 2)
+
+
+enum kernel {
+   KERNEL_RGBX,
+   KERNEL_RB_SWAP,
+   KERNEL_RBX_SWAP,
+   KERNEL_STRETCH,
+   KERNEL_LERP,
+   KERNEL_BLEND_PREMUL,
+   KERNEL_COUNT
+};
+
+static const char *kernel_names[KERNEL_COUNT] = {
+   "rgbx",
+   "rb_swap",
+   "rbx_swap",
+   "stretch",
+   "lerp",
+   "blend_premul",
+};
+
+
+struct kernel_args {
+   unsigned width;
+   unsigned weight;
+   int32_t src_x;
+   int32_t src_xstep;
+};
+
+
+void
+write_tsv_header(FILE *fp)
+{
+   fprintf(fp,
+           "result\t"
+           "kernels\t"
+           "kernel\n");
+
+   fflush(fp);
+}
+
+
+static void
+write_tsv_row(FILE *fp, const struct lp_linear_kernels *kernels,
+              enum kernel kernel, bool success)
+{
+   fprintf(fp, "%s\t", success ? "pass" : "fail");
+   fprintf(fp, "%s\t", kernels->name);
+   fprintf(fp, "%s\n", kernel_names[kernel]);
+
+   fflush(fp);
+}
+
+
+static void
+random_pixels(uint32_t *pixels, unsigned count)
+{
+   for (unsigned i = 0; i < count; i++)
+      pixels[i] = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+}
+
+
+static void
+run_kernel(const struct lp_linear_kernels *kernels, enum kernel kernel,
+           uint32_t *dst, const uint32_t *src0, const uint32_t *src1,
+           const struct kernel_args *args)
+{
+   switch (kernel) {
+   case KERNEL_RGBX:
+      kernels->rgbx_row(dst, src0, args->width);
+      break;
+   case KERNEL_RB_SWAP:
+      kernels->rb_swap_row(dst, src0, args->width);
+      break;
+   case KERNEL_RBX_SWAP:
+      kernels->rbx_swap_row(dst, src0, args->width);
+      break;
+   case KERNEL_STRETCH:
+      kernels->stretch_row(dst, src0, args->width,
+                           args->src_x, args->src_xstep);
+      break;
+   case KERNEL_LERP:
+      kernels->lerp_rows(dst, src0, src1, args->width, args->weight);
+      break;
+   case KERNEL_BLEND_PREMUL:
+      kernels->blend_premul_row(dst, src0, args->width);
+      break;
+   default:
+      assert(0);
+   }
+}
+
+
+static void
+random_args(struct kernel_args *args, unsigned width)
+{
+   args->width = width;
+   args->weight = rand() & 0xff;
+
+   /* Anything from a 4:1 minification to a strong magnification, with
+    * every fetch (and its right neighbour) inside the source row.
+    */
+   args->src_xstep = rand() % (4 << 16);
+   args->src_x = rand() & 0xffff;
+}
+
+
+static bool
+test_kernel(unsigned verbose, FILE *fp,
+            const struct lp_linear_kernels *kernels, enum kernel kernel,
+            unsigned n)
+{
+   uint32_t src0[SRC_TEXELS], src1[SRC_TEXELS];
+   uint32_t ref[MAX_WIDTH + 1], res[MAX_WIDTH + 1];
+   bool success = true;
+
+   for (unsigned iter = 0; iter < n && success; iter++) {
+      struct kernel_args args;
+
+      random_args(&args, iter % (MAX_WIDTH + 1));
+      random_pixels(src0, ARRAY_SIZE(src0));
+      random_pixels(src1, ARRAY_SIZE(src1));
+
+      /* The blend reads dst, so both runs start from the same contents.
+       * The extra trailing pixel catches writes past the span.
+       */
+      random_pixels(ref, ARRAY_SIZE(ref));
+      memcpy(res, ref, sizeof res);
+
+      run_kernel(&lp_linear_kernels_c, kernel, ref, src0, src1, &args);
+      run_kernel(kernels, kernel, res, src0, src1, &args);
+
+      for (unsigned i = 0; i < ARRAY_SIZE(ref); i++) {
+         if (ref[i] != res[i]) {
+            printf("FAILED %s %s width %u: pixel %u is %08x, expected %08x\n",
+                   kernels->name, kernel_names[kernel], args.width,
+                   i, res[i], ref[i]);
+            success = false;
+            break;
+         }
+      }
+   }
+
+   if (verbose)
+      printf("%s %s: %s\n", kernels->name, kernel_names[kernel],
+             success ? "pass" : "FAIL");
+
+   if (fp)
+      write_tsv_row(fp, kernels, kernel, success);
+
+   return success;
+}
+
+
+/**
+ * Return the throughput of one kernel over tile-sized spans, in
+ * Mpixel/s.
+ */
+static double
+bench_kernel(const struct lp_linear_kernels *kernels, enum kernel kernel)
+{
+   const unsigned iterations = 1 << 16;
+   alignas(64) uint32_t src0[SRC_TEXELS], src1[SRC_TEXELS];
+   alignas(64) uint32_t dst[MAX_WIDTH + 1];
+   struct kernel_args args;
+   int64_t start, end;
+
+   random_pixels(src0, ARRAY_SIZE(src0));
+   random_pixels(src1, ARRAY_SIZE(src1));
+   random_pixels(dst, ARRAY_SIZE(dst));
+
+   args.width = 64;
+   args.weight = 0x55;
+   args.src_x = 0x8000;
+   args.src_xstep = 0x13333;     /* 1.2:1 minification */
+
+   start = os_time_get_nano();
+   for (unsigned i = 0; i < iterations; i++)
+      run_kernel(kernels, kernel, dst, src0, src1, &args);
+   end = os_time_get_nano();
+
+   return (double)iterations * args.width / MAX2(end - start, 1) * 1e3;
+}
+
+
+bool
+test_all(unsigned verbose, FILE *fp)
+{
+   const struct lp_linear_kernels *tables[MAX_TABLES];
+   unsigned num_tables = lp_linear_kernels_supported(tables, MAX_TABLES);
+   bool success = true;
+
+   srand(0);
+
+   /* tables[0] is the C reference */
+   for (unsigned t = 1; t < num_tables; t++) {
+      for (unsigned k = 0; k < KERNEL_COUNT; k++) {
+         if (!test_kernel(verbose, fp, tables[t], k, 1000))
+            success = false;
+      }
+   }
+
+   return success;
+}
+
+
+bool
+test_some(unsigned verbose, FILE *fp,
+          unsigned long n)
+{
+   return test_all(verbose, fp);
+}
+
+
+bool
+test_single(unsigned verbose, FILE *fp)
+{
+   const struct lp_linear_kernels *tables[MAX_TABLES];
+   unsigned num_tables = lp_linear_kernels_supported(tables, MAX_TABLES);
+
+   printf("%-14s", "kernel");
+   for (unsigned t = 0; t < num_tables; t++)
+      printf(" %16s", tables[t]->name);
+   printf("   (Mpixel/s, speedup vs c)\n");
+
+   for (unsigned k = 0; k < KERNEL_COUNT; k++) {
+      double base = bench_kernel(tables[0], k);
+
+      printf("%-14s %8.0f      ", kernel_names[k], base);
+      for (unsigned t = 1; t < num_tables; t++) {
+         double rate = bench_kernel(tables[t], k);
+         printf(" %8.0f (%4.1fx)", rate, rate / base);
+      }
+      printf("\n");
+      fflush(stdout);
+   }
+
+   return true;
+}
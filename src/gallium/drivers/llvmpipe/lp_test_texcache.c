@@ -0,0 +1,227 @@
+/**************************************************************************
+ *
+ * Copyright 2010-2021 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ **************************************************************************/
+
+
+/**
+ * @file
+ * Unit tests for the lifetime of the texel cache of the rasterizer threads.
+ *
+ * Decoded blocks of compressed textures are kept across scenes until the
+ * screen's texcache_epoch changes.  Rewriting a texture between two scenes,
+ * through a transfer or through the memory bound to it, must change the
+ * epoch the second scene is rasterized with.
+ */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "pipe/p_context.h"
+#include "pipe/p_screen.h"
+#include "util/os_time.h"
+#include "util/u_atomic.h"
+#include "util/u_inlines.h"
+#include "sw/null/null_sw_winsys.h"
+
+#include "lp_public.h"
+#include "lp_screen.h"
+#include "lp_test.h"
+
+
+void
+write_tsv_header(FILE *fp)
+{
+   fprintf(fp,
+           "result\t"
+           "test\n");
+
+   fflush(fp);
+}
+
+
+static bool
+check(unsigned verbose, FILE *fp, const char *name, bool pass)
+{
+   if (verbose || !pass)
+      printf("%s: %s\n", name, pass ? "pass" : "FAIL");
+
+   if (fp) {
+      fprintf(fp, "%s\t%s\n", pass ? "pass" : "fail", name);
+      fflush(fp);
+   }
+
+   return pass;
+}
+
+
+/**
+ * Rasterize a scene rendering to the given target, and return the texel
+ * cache epoch it was rasterized with.
+ */
+static unsigned
+run_scene(struct pipe_context *pipe, struct pipe_resource *target)
+{
+   struct pipe_screen *screen = pipe->screen;
+   struct pipe_fence_handle *fence = NULL;
+
+   struct pipe_framebuffer_state fb = {
+      .width = target->width0,
+      .height = target->height0,
+      .nr_cbufs = 1,
+      .cbufs[0] = {
+         .format = target->format,
+         .texture = target,
+      },
+   };
+   pipe->set_framebuffer_state(pipe, &fb);
+
+   /* The query starts the scene */
+   struct pipe_query *query =
+      pipe->create_query(pipe, PIPE_QUERY_OCCLUSION_COUNTER, 0);
+   pipe->begin_query(pipe, query);
+   pipe->end_query(pipe, query);
+   pipe->flush(pipe, &fence, 0);
+   screen->fence_finish(screen, NULL, fence, OS_TIMEOUT_INFINITE);
+   screen->fence_reference(screen, &fence, NULL);
+   pipe->destroy_query(pipe, query);
+
+   return p_atomic_read(&llvmpipe_screen(screen)->texcache_epoch);
+}
+
+
+static bool
+test_rewrite(unsigned verbose, FILE *fp)
+{
+   struct pipe_screen *screen = llvmpipe_create_screen(null_sw_create());
+   struct pipe_context *pipe = NULL;
+   struct pipe_resource *target = NULL, *texture = NULL, *backed = NULL;
+   struct pipe_memory_allocation *mem = NULL;
+   uint64_t size = 0;
+   void *map = NULL;
+   bool success = true;
+
+   if (!screen)
+      return false;
+
+   struct pipe_resource templ = {
+      .target = PIPE_TEXTURE_2D,
+      .format = PIPE_FORMAT_R8G8B8A8_UNORM,
+      .width0 = 64,
+      .height0 = 64,
+      .depth0 = 1,
+      .array_size = 1,
+      .bind = PIPE_BIND_RENDER_TARGET,
+   };
+   target = screen->resource_create(screen, &templ);
+
+   templ.format = PIPE_FORMAT_DXT1_RGBA;
+   templ.bind = PIPE_BIND_SAMPLER_VIEW;
+   texture = screen->resource_create(screen, &templ);
+
+   pipe = screen->context_create(screen, NULL, 0);
+   if (!pipe || !target || !texture) {
+      printf("setup failed\n");
+      success = false;
+      goto out;
+   }
+
+   unsigned epoch = run_scene(pipe, target);
+   success &= check(verbose, fp, "cache kept across scenes",
+                    run_scene(pipe, target) == epoch);
+
+   /* Rewrite the texture through a transfer */
+   struct pipe_box box = { .width = 64, .height = 64, .depth = 1 };
+   struct pipe_transfer *transfer;
+   void *data = pipe->texture_map(pipe, texture, 0, PIPE_MAP_WRITE, &box,
+                                  &transfer);
+   if (data) {
+      memset(data, 0x55, transfer->layer_stride);
+      pipe->texture_unmap(pipe, transfer);
+   }
+   success &= check(verbose, fp, "cache dropped after mapped write",
+                    data && run_scene(pipe, target) != epoch);
+
+   /* Rewrite a texture through its backing memory, the way lavapipe does
+    * with vkMapMemory, without telling the driver.
+    */
+   backed = screen->resource_create_unbacked(screen, &templ, &size);
+   if (backed)
+      mem = screen->allocate_memory(screen, size);
+   if (mem && screen->resource_bind_backing(screen, backed, mem, 0, 0, 0))
+      map = screen->map_memory(screen, mem);
+   if (!map) {
+      printf("backed texture setup failed\n");
+      success = false;
+      goto out;
+   }
+
+   epoch = run_scene(pipe, target);
+   memset(map, 0xaa, size);
+   success &= check(verbose, fp, "cache dropped after write to backing",
+                    run_scene(pipe, target) != epoch);
+
+   pipe_resource_reference(&backed, NULL);
+   epoch = run_scene(pipe, target);
+   success &= check(verbose, fp, "cache kept once backed texture is gone",
+                    run_scene(pipe, target) == epoch);
+
+out:
+   pipe_resource_reference(&backed, NULL);
+   if (map)
+      screen->unmap_memory(screen, mem);
+   if (mem)
+      screen->free_memory(screen, mem);
+   if (pipe)
+      pipe->destroy(pipe);
+   pipe_resource_reference(&texture, NULL);
+   pipe_resource_reference(&target, NULL);
+   screen->destroy(screen);
+   return success;
+}
+
+
+bool
+test_all(unsigned verbose, FILE *fp)
+{
+   return test_rewrite(verbose, fp);
+}
+
+
+bool
+test_some(unsigned verbose, FILE *fp,
+          unsigned long n)
+{
+   return test_all(verbose, fp);
+}
+
+
+bool
+test_single(unsigned verbose, FILE *fp)
+{
+   return test_all(verbose, fp);
+}
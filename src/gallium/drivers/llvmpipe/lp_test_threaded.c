@@ -0,0 +1,262 @@
+/**************************************************************************
+ *
+ * Copyright 2010-2021 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ **************************************************************************/
+
+
+/**
+ * @file
+ * Unit tests for the u_threaded_context callbacks of llvmpipe.
+ *
+ * Two contexts keep a constant buffer and a render target in unflushed
+ * scenes while the buffer storage is replaced from one of them, the way
+ * u_threaded_context invalidates buffers.  The busy state must reflect the
+ * scenes of both contexts, and the old storage must live until the last
+ * scene using it is done.
+ */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "pipe/p_context.h"
+#include "pipe/p_screen.h"
+#include "util/os_time.h"
+#include "util/u_inlines.h"
+#include "sw/null/null_sw_winsys.h"
+
+#include "lp_context.h"
+#include "lp_flush.h"
+#include "lp_public.h"
+#include "lp_texture.h"
+#include "lp_test.h"
+
+
+#define BUFFER_SIZE 256
+
+
+struct test_context {
+   struct pipe_context *pipe;
+   struct pipe_query *query;
+};
+
+
+void
+write_tsv_header(FILE *fp)
+{
+   fprintf(fp,
+           "result\t"
+           "test\n");
+
+   fflush(fp);
+}
+
+
+static bool
+check(unsigned verbose, FILE *fp, const char *name, bool pass)
+{
+   if (verbose || !pass)
+      printf("%s: %s\n", name, pass ? "pass" : "FAIL");
+
+   if (fp) {
+      fprintf(fp, "%s\t%s\n", pass ? "pass" : "fail", name);
+      fflush(fp);
+   }
+
+   return pass;
+}
+
+
+/**
+ * Start a scene which renders to the texture and reads the buffer as
+ * fragment shader constants.  The occlusion query keeps it unflushed.
+ */
+static bool
+begin_scene(struct test_context *ctx, struct pipe_resource *texture,
+            struct pipe_resource *buffer)
+{
+   struct pipe_context *pipe = ctx->pipe;
+
+   struct pipe_framebuffer_state fb = {
+      .width = texture->width0,
+      .height = texture->height0,
+      .nr_cbufs = 1,
+      .cbufs[0] = {
+         .format = texture->format,
+         .texture = texture,
+      },
+   };
+   pipe->set_framebuffer_state(pipe, &fb);
+
+   struct pipe_constant_buffer cb = {
+      .buffer = buffer,
+      .buffer_size = BUFFER_SIZE,
+   };
+   pipe->set_constant_buffer(pipe, PIPE_SHADER_FRAGMENT, 0, false, &cb);
+
+   ctx->query = pipe->create_query(pipe, PIPE_QUERY_OCCLUSION_COUNTER, 0);
+   if (!ctx->query)
+      return false;
+
+   return pipe->begin_query(pipe, ctx->query);
+}
+
+
+static void
+end_scene(struct pipe_screen *screen, struct test_context *ctx)
+{
+   struct pipe_context *pipe = ctx->pipe;
+   struct pipe_fence_handle *fence = NULL;
+
+   pipe->end_query(pipe, ctx->query);
+   pipe->flush(pipe, &fence, 0);
+   screen->fence_finish(screen, NULL, fence, OS_TIMEOUT_INFINITE);
+   screen->fence_reference(screen, &fence, NULL);
+
+   pipe->destroy_query(pipe, ctx->query);
+   ctx->query = NULL;
+
+   /* The context ends its rasterized scenes when it is destroyed. */
+   pipe->destroy(pipe);
+   ctx->pipe = NULL;
+}
+
+
+static bool
+test_replace_storage(unsigned verbose, FILE *fp)
+{
+   struct pipe_screen *screen = llvmpipe_create_screen(null_sw_create());
+   struct test_context ctx[2] = { 0 };
+   struct pipe_resource *texture, *buffer, *src;
+   bool success = true;
+
+   if (!screen)
+      return false;
+
+   struct pipe_resource templ = {
+      .target = PIPE_TEXTURE_2D,
+      .format = PIPE_FORMAT_R8G8B8A8_UNORM,
+      .width0 = 64,
+      .height0 = 64,
+      .depth0 = 1,
+      .array_size = 1,
+      .bind = PIPE_BIND_RENDER_TARGET | PIPE_BIND_SAMPLER_VIEW,
+   };
+   texture = screen->resource_create(screen, &templ);
+
+   templ.target = PIPE_BUFFER;
+   templ.format = PIPE_FORMAT_R8_UNORM;
+   templ.width0 = BUFFER_SIZE;
+   templ.height0 = 1;
+   templ.bind = PIPE_BIND_CONSTANT_BUFFER;
+   buffer = screen->resource_create(screen, &templ);
+   src = screen->resource_create(screen, &templ);
+
+   for (unsigned i = 0; i < ARRAY_SIZE(ctx); i++) {
+      ctx[i].pipe = screen->context_create(screen, NULL, 0);
+      if (!ctx[i].pipe || !begin_scene(&ctx[i], texture, buffer))
+         success = false;
+   }
+   if (!success || !texture || !buffer || !src) {
+      printf("setup failed\n");
+      goto out;
+   }
+
+   success &= check(verbose, fp, "buffer busy for write",
+                    llvmpipe_is_resource_busy(screen, buffer, PIPE_MAP_WRITE));
+   success &= check(verbose, fp, "buffer idle for read",
+                    !llvmpipe_is_resource_busy(screen, buffer, PIPE_MAP_READ));
+   success &= check(verbose, fp, "texture busy for read",
+                    llvmpipe_is_resource_busy(screen, texture, PIPE_MAP_READ));
+
+   /* Invalidate the buffer from the first context, like
+    * tc_invalidate_buffer() does.
+    */
+   struct llvmpipe_resource *lp_buffer = llvmpipe_resource(buffer);
+   struct llvmpipe_resource *lp_src = llvmpipe_resource(src);
+   uint32_t delete_buffer_id = lp_buffer->base.buffer_id_unique;
+   void *old_data = lp_buffer->data;
+
+   lp_buffer->base.buffer_id_unique = lp_src->base.buffer_id_unique;
+   lp_src->base.buffer_id_unique = 0;
+   llvmpipe_replace_buffer_storage(ctx[0].pipe, buffer, src, 0, 0,
+                                   delete_buffer_id);
+
+   success &= check(verbose, fp, "storage swapped",
+                    lp_buffer->data != old_data && lp_src->data == old_data);
+   success &= check(verbose, fp, "old storage retired",
+                    lp_buffer->retired == src);
+   pipe_resource_reference(&src, NULL);
+
+   end_scene(screen, &ctx[1]);
+
+   success &= check(verbose, fp, "retired while referenced by one context",
+                    lp_buffer->retired != NULL &&
+                    llvmpipe_is_resource_busy(screen, buffer, PIPE_MAP_WRITE));
+
+   end_scene(screen, &ctx[0]);
+
+   success &= check(verbose, fp, "old storage released",
+                    lp_buffer->retired == NULL);
+   success &= check(verbose, fp, "buffer idle",
+                    !llvmpipe_is_resource_busy(screen, buffer, PIPE_MAP_WRITE));
+   success &= check(verbose, fp, "texture idle",
+                    !llvmpipe_is_resource_busy(screen, texture, PIPE_MAP_WRITE));
+
+out:
+   for (unsigned i = 0; i < ARRAY_SIZE(ctx); i++) {
+      if (ctx[i].query)
+         ctx[i].pipe->destroy_query(ctx[i].pipe, ctx[i].query);
+      if (ctx[i].pipe)
+         ctx[i].pipe->destroy(ctx[i].pipe);
+   }
+   pipe_resource_reference(&src, NULL);
+   pipe_resource_reference(&buffer, NULL);
+   pipe_resource_reference(&texture, NULL);
+   screen->destroy(screen);
+   return success;
+}
+
+
+bool
+test_all(unsigned verbose, FILE *fp)
+{
+   return test_replace_storage(verbose, fp);
+}
+
+
+bool
+test_some(unsigned verbose, FILE *fp,
+          unsigned long n)
+{
+   return test_all(verbose, fp);
+}
+
+
+bool
+test_single(unsigned verbose, FILE *fp)
+{
+   return test_all(verbose, fp);
+}
@@ -44,6 +44,7 @@
 #include "util/u_memory.h"
 #include "util/u_resource.h"
 #include "util/u_transfer.h"
+#include "draw/draw_context.h"
 
 #if DETECT_OS_POSIX
 #include "util/os_mman.h"
@@ -83,6 +84,24 @@ static unsigned id_counter = 0;
 
 static const char *driver_id = "llvmpipe" MESA_GIT_SHA1;
 
+
+/**
+ * Called whenever the resource may have become external.  Writes to the
+ * memory of external compressed textures are invisible to us, e.g. when
+ * lavapipe maps the memory or aliases it with another image, so the
+ * rasterizer threads must not keep their texels across scenes.
+ */
+static void
+llvmpipe_texcache_update_external(struct llvmpipe_resource *lpr)
+{
+   if (!lpr->texcache_external &&
+       util_format_is_compressed(lpr->base.b.format) &&
+       llvmpipe_resource_is_external(&lpr->base.b)) {
+      lpr->texcache_external = true;
+      p_atomic_inc(&lpr->screen->num_external_compressed);
+   }
+}
+
 #endif
 
 /**
@@ -94,7 +113,7 @@ llvmpipe_texture_layout(struct llvmpipe_screen *screen,
                         struct llvmpipe_resource *lpr,
                         bool allocate)
 {
-   struct pipe_resource *pt = &lpr->base;
+   struct pipe_resource *pt = &lpr->base.b;
    unsigned width = pt->width0;
    unsigned height = pt->height0;
    unsigned depth = pt->depth0;
@@ -117,9 +136,9 @@ llvmpipe_texture_layout(struct llvmpipe_screen *screen,
     * for the virgl driver when host uses llvmpipe, causing Qemu and crosvm to
     * bail out on the KVM error.
     */
-   if (lpr->base.flags & PIPE_RESOURCE_FLAG_SPARSE)
+   if (lpr->base.b.flags & PIPE_RESOURCE_FLAG_SPARSE)
       mip_align = 64 * 1024;
-   else if (lpr->base.flags & PIPE_RESOURCE_FLAG_MAP_PERSISTENT)
+   else if (lpr->base.b.flags & PIPE_RESOURCE_FLAG_MAP_PERSISTENT)
       os_get_page_size(&mip_align);
 
    assert(LP_MAX_TEXTURE_2D_LEVELS <= LP_MAX_TEXTURE_LEVELS);
@@ -164,7 +183,7 @@ llvmpipe_texture_layout(struct llvmpipe_screen *screen,
          align_x = align_y = 1;
       } else {
          align_x = LP_RASTER_BLOCK_SIZE;
-         if (llvmpipe_resource_is_1d(&lpr->base))
+         if (llvmpipe_resource_is_1d(&lpr->base.b))
             align_y = 1;
          else
             align_y = LP_RASTER_BLOCK_SIZE;
@@ -192,16 +211,16 @@ llvmpipe_texture_layout(struct llvmpipe_screen *screen,
       lpr->img_stride[level] = (uint64_t)lpr->row_stride[level] * nblocksy;
 
       /* Number of 3D image slices, cube faces or texture array layers */
-      if (lpr->base.target == PIPE_TEXTURE_CUBE) {
+      if (lpr->base.b.target == PIPE_TEXTURE_CUBE) {
          assert(layers == 6);
       }
 
-      if (lpr->base.target == PIPE_TEXTURE_3D)
+      if (lpr->base.b.target == PIPE_TEXTURE_3D)
          num_slices = align(depth, align_z);
-      else if (lpr->base.target == PIPE_TEXTURE_1D_ARRAY ||
-               lpr->base.target == PIPE_TEXTURE_2D_ARRAY ||
-               lpr->base.target == PIPE_TEXTURE_CUBE ||
-               lpr->base.target == PIPE_TEXTURE_CUBE_ARRAY)
+      else if (lpr->base.b.target == PIPE_TEXTURE_1D_ARRAY ||
+               lpr->base.b.target == PIPE_TEXTURE_2D_ARRAY ||
+               lpr->base.b.target == PIPE_TEXTURE_CUBE ||
+               lpr->base.b.target == PIPE_TEXTURE_CUBE_ARRAY)
          num_slices = layers;
       else
          num_slices = 1;
@@ -232,7 +251,7 @@ llvmpipe_texture_layout(struct llvmpipe_screen *screen,
          memset(lpr->tex_data, 0, total_size);
       }
    }
-   if (lpr->base.flags & PIPE_RESOURCE_FLAG_SPARSE) {
+   if (lpr->base.b.flags & PIPE_RESOURCE_FLAG_SPARSE) {
       uint64_t page_align;
       os_get_page_size(&page_align);
       lpr->size_required = align64(lpr->size_required, page_align);
@@ -255,7 +274,7 @@ llvmpipe_can_create_resource(struct pipe_screen *screen,
 {
    struct llvmpipe_resource lpr;
    memset(&lpr, 0, sizeof(lpr));
-   lpr.base = *res;
+   lpr.base.b = *res;
    if (!llvmpipe_texture_layout(llvmpipe_screen(screen), &lpr, false))
       return false;
 
@@ -273,12 +292,12 @@ llvmpipe_displaytarget_layout(struct llvmpipe_screen *screen,
    /* Round up the surface size to a multiple of the tile size to
     * avoid tile clipping.
     */
-   const unsigned width = MAX2(1, align(lpr->base.width0, TILE_SIZE));
-   const unsigned height = MAX2(1, align(lpr->base.height0, TILE_SIZE));
+   const unsigned width = MAX2(1, align(lpr->base.b.width0, TILE_SIZE));
+   const unsigned height = MAX2(1, align(lpr->base.b.height0, TILE_SIZE));
 
    lpr->dt = winsys->displaytarget_create(winsys,
-                                          lpr->base.bind,
-                                          lpr->base.format,
+                                          lpr->base.b.bind,
+                                          lpr->base.b.format,
                                           width, height,
                                           64,
                                           map_front_private,
@@ -288,6 +307,38 @@ llvmpipe_displaytarget_layout(struct llvmpipe_screen *screen,
 }
 
 
+/**
+ * Set up the u_threaded_context part of a resource.  Buffers get an ID for
+ * busy tracking, shared ones keep their storage when invalidated.
+ */
+static void
+llvmpipe_resource_init_threaded(struct llvmpipe_screen *screen,
+                                struct llvmpipe_resource *lpr,
+                                bool is_shared)
+{
+   threaded_resource_init(&lpr->base.b, false);
+   lpr->base.is_shared = is_shared;
+
+   if (lpr->base.b.target == PIPE_BUFFER)
+      lpr->base.buffer_id_unique = util_idalloc_mt_alloc(&screen->buffer_ids);
+}
+
+
+/**
+ * Resources backed by application memory are never reallocated, and the
+ * whole of them is considered valid.
+ */
+static void
+llvmpipe_resource_init_user_ptr(struct llvmpipe_screen *screen,
+                                struct llvmpipe_resource *lpr)
+{
+   llvmpipe_resource_init_threaded(screen, lpr, false);
+   lpr->base.is_user_ptr = true;
+   util_range_add(&lpr->base.b, &lpr->base.valid_buffer_range,
+                  0, lpr->base.b.width0);
+}
+
+
 static struct pipe_resource *
 llvmpipe_resource_create_all(struct pipe_screen *_screen,
                              const struct pipe_resource *templat,
@@ -299,19 +350,19 @@ llvmpipe_resource_create_all(struct pipe_screen *_screen,
    if (!lpr)
       return NULL;
 
-   lpr->base = *templat;
+   lpr->base.b = *templat;
    lpr->screen = screen;
-   pipe_reference_init(&lpr->base.reference, 1);
-   lpr->base.screen = &screen->base;
+   pipe_reference_init(&lpr->base.b.reference, 1);
+   lpr->base.b.screen = &screen->base;
 
 #if defined(HAVE_LIBDRM) && defined(HAVE_LINUX_UDMABUF_H)
    lpr->dmabuf_alloc = NULL;
 #endif
 
-   /* assert(lpr->base.bind); */
+   /* assert(lpr->base.b.bind); */
 
-   if (llvmpipe_resource_is_texture(&lpr->base)) {
-      if (lpr->base.bind & (PIPE_BIND_DISPLAY_TARGET |
+   if (llvmpipe_resource_is_texture(&lpr->base.b)) {
+      if (lpr->base.b.bind & (PIPE_BIND_DISPLAY_TARGET |
                             PIPE_BIND_SCANOUT |
                             PIPE_BIND_SHARED)) {
          /* displayable surface */
@@ -378,6 +429,9 @@ llvmpipe_resource_create_all(struct pipe_screen *_screen,
       }
    }
 
+   llvmpipe_resource_init_threaded(screen, lpr, lpr->dt != NULL);
+   llvmpipe_texcache_update_external(lpr);
+
    lpr->id = id_counter++;
 
 #if MESA_DEBUG
@@ -386,7 +440,7 @@ llvmpipe_resource_create_all(struct pipe_screen *_screen,
    simple_mtx_unlock(&resource_list_mutex);
 #endif
 
-   return &lpr->base;
+   return &lpr->base.b;
 
  fail:
    FREE(lpr);
@@ -438,6 +492,9 @@ llvmpipe_resource_create_unbacked(struct pipe_screen *_screen,
       return pt;
    struct llvmpipe_resource *lpr = llvmpipe_resource(pt);
    lpr->backable = true;
+   llvmpipe_texcache_update_external(lpr);
+   /* The backing is bound by the caller, it can't be replaced */
+   lpr->base.is_shared = true;
    *size_required = lpr->size_required;
    return pt;
 }
@@ -503,13 +560,13 @@ llvmpipe_resource_from_memobj(struct pipe_screen *pscreen,
    struct llvmpipe_screen *screen = llvmpipe_screen(pscreen);
    struct llvmpipe_memory_object *lpmo = llvmpipe_memory_object(memobj);
    struct llvmpipe_resource *lpr = CALLOC_STRUCT(llvmpipe_resource);
-   lpr->base = *templat;
+   lpr->base.b = *templat;
 
    lpr->screen = screen;
-   pipe_reference_init(&lpr->base.reference, 1);
-   lpr->base.screen = &screen->base;
+   pipe_reference_init(&lpr->base.b.reference, 1);
+   lpr->base.b.screen = &screen->base;
 
-   if (llvmpipe_resource_is_texture(&lpr->base)) {
+   if (llvmpipe_resource_is_texture(&lpr->base.b)) {
       /* texture map */
       if (!llvmpipe_texture_layout(screen, lpr, false))
          goto fail;
@@ -543,9 +600,11 @@ llvmpipe_resource_from_memobj(struct pipe_screen *pscreen,
          goto fail;
       lpr->data = lpmo->mem_alloc->cpu_addr;
    }
+   llvmpipe_resource_init_threaded(screen, lpr, true);
    lpr->id = id_counter++;
    lpr->imported_memory = &lpmo->b;
    pipe_reference(NULL, &lpmo->reference);
+   llvmpipe_texcache_update_external(lpr);
 
 #if MESA_DEBUG
    simple_mtx_lock(&resource_list_mutex);
@@ -553,7 +612,7 @@ llvmpipe_resource_from_memobj(struct pipe_screen *pscreen,
    simple_mtx_unlock(&resource_list_mutex);
 #endif
 
-   return &lpr->base;
+   return &lpr->base.b;
 
 fail:
    free(lpr);
@@ -567,6 +626,11 @@ llvmpipe_resource_destroy(struct pipe_screen *pscreen,
    struct llvmpipe_screen *screen = llvmpipe_screen(pscreen);
    struct llvmpipe_resource *lpr = llvmpipe_resource(pt);
 
+   /* The memory may get reused for another texture */
+   llvmpipe_texcache_invalidate(pt);
+   if (lpr->texcache_external)
+      p_atomic_dec(&screen->num_external_compressed);
+
    if (!lpr->backable && !lpr->user_ptr) {
       if (lpr->dt) {
          /* display target */
@@ -598,7 +662,7 @@ llvmpipe_resource_destroy(struct pipe_screen *pscreen,
       pscreen->free_memory_fd(pscreen, (struct pipe_memory_allocation*)lpr->dmabuf_alloc);
 #endif
 
-   if (lpr->base.flags & PIPE_RESOURCE_FLAG_SPARSE) {
+   if (lpr->base.b.flags & PIPE_RESOURCE_FLAG_SPARSE) {
 #if DETECT_OS_LINUX
       if (llvmpipe_resource_is_texture(pt))
          munmap(lpr->tex_data, lpr->size_required);
@@ -609,6 +673,10 @@ llvmpipe_resource_destroy(struct pipe_screen *pscreen,
 
    free(lpr->residency);
 
+   threaded_resource_deinit(pt);
+   util_idalloc_mt_free(&screen->buffer_ids, lpr->base.buffer_id_unique);
+   pipe_resource_reference(&lpr->retired, NULL);
+
 #if MESA_DEBUG
    simple_mtx_lock(&resource_list_mutex);
    if (!list_is_empty(&lpr->list))
@@ -729,19 +797,19 @@ llvmpipe_resource_from_handle(struct pipe_screen *_screen,
       goto no_lpr;
    }
 
-   lpr->base = *template;
+   lpr->base.b = *template;
    lpr->screen = screen;
    lpr->dt_format = whandle->format;
-   pipe_reference_init(&lpr->base.reference, 1);
-   lpr->base.screen = _screen;
+   pipe_reference_init(&lpr->base.b.reference, 1);
+   lpr->base.b.screen = _screen;
 
    /*
     * Looks like unaligned displaytargets work just fine,
     * at least sampler/render ones.
     */
 #if 0
-   assert(lpr->base.width0 == width);
-   assert(lpr->base.height0 == height);
+   assert(lpr->base.b.width0 == width);
+   assert(lpr->base.b.height0 == height);
 #endif
 
    unsigned nblocksy = util_format_get_nblocksy(template->format, align(template->height0, LP_RASTER_BLOCK_SIZE));
@@ -785,13 +853,15 @@ llvmpipe_resource_from_handle(struct pipe_screen *_screen,
             goto no_dt;
       }
 
-      assert(llvmpipe_resource_is_texture(&lpr->base));
+      assert(llvmpipe_resource_is_texture(&lpr->base.b));
    } else {
       whandle->size = lpr->size_required;
       lpr->row_stride[0] = whandle->stride;
       lpr->backable = true;
    }
 
+   llvmpipe_resource_init_threaded(screen, lpr, true);
+   llvmpipe_texcache_update_external(lpr);
 
    lpr->id = id_counter++;
 
@@ -801,7 +871,7 @@ llvmpipe_resource_from_handle(struct pipe_screen *_screen,
    simple_mtx_unlock(&resource_list_mutex);
 #endif
 
-   return &lpr->base;
+   return &lpr->base.b;
 
 no_dt:
    FREE(lpr);
@@ -821,6 +891,9 @@ llvmpipe_resource_get_handle(struct pipe_screen *_screen,
    struct sw_winsys *winsys = screen->winsys;
    struct llvmpipe_resource *lpr = llvmpipe_resource(pt);
 
+   /* Others may access the storage from now on */
+   lpr->base.is_shared = true;
+
 #if defined(HAVE_LIBDRM) && defined(HAVE_LINUX_UDMABUF_H)
    if (!lpr->dt && whandle->type == WINSYS_HANDLE_TYPE_FD) {
       if (!lpr->dmabuf_alloc) {
@@ -845,6 +918,7 @@ llvmpipe_resource_get_handle(struct pipe_screen *_screen,
             lpr->data = lpr->dmabuf_alloc->cpu_addr;
          /* reuse lavapipe codepath to handle destruction */
          lpr->backable = true;
+         llvmpipe_texcache_update_external(lpr);
       } else {
          whandle->handle = os_dupfd_cloexec(lpr->dmabuf_alloc->dmabuf_fd);
       }
@@ -880,12 +954,12 @@ llvmpipe_resource_from_user_memory(struct pipe_screen *_screen,
       return NULL;
    }
 
-   lpr->base = *resource;
+   lpr->base.b = *resource;
    lpr->screen = screen;
-   pipe_reference_init(&lpr->base.reference, 1);
-   lpr->base.screen = _screen;
+   pipe_reference_init(&lpr->base.b.reference, 1);
+   lpr->base.b.screen = _screen;
 
-   if (llvmpipe_resource_is_texture(&lpr->base)) {
+   if (llvmpipe_resource_is_texture(&lpr->base.b)) {
       if (!llvmpipe_texture_layout(screen, lpr, false))
          goto fail;
 
@@ -893,18 +967,37 @@ llvmpipe_resource_from_user_memory(struct pipe_screen *_screen,
    } else
       lpr->data = user_memory;
    lpr->user_ptr = true;
+   llvmpipe_resource_init_user_ptr(screen, lpr);
+   llvmpipe_texcache_update_external(lpr);
 #if MESA_DEBUG
    simple_mtx_lock(&resource_list_mutex);
    list_addtail(&lpr->list, &resource_list.list);
    simple_mtx_unlock(&resource_list_mutex);
 #endif
-   return &lpr->base;
+   return &lpr->base.b;
 fail:
    FREE(lpr);
    return NULL;
 }
 
 
+static void
+llvmpipe_constant_buffer_written(struct llvmpipe_context *llvmpipe,
+                                 const struct pipe_resource *resource)
+{
+   if (!(resource->bind & PIPE_BIND_CONSTANT_BUFFER))
+      return;
+
+   for (unsigned i = 0; i < ARRAY_SIZE(llvmpipe->constants[PIPE_SHADER_FRAGMENT]); ++i) {
+      if (resource == llvmpipe->constants[PIPE_SHADER_FRAGMENT][i].buffer) {
+         /* constants may have changed */
+         llvmpipe->dirty |= LP_NEW_FS_CONSTANTS;
+         break;
+      }
+   }
+}
+
+
 void *
 llvmpipe_transfer_map_ms(struct pipe_context *pipe,
                          struct pipe_resource *resource,
@@ -925,6 +1018,9 @@ llvmpipe_transfer_map_ms(struct pipe_context *pipe,
    assert(resource);
    assert(level <= resource->last_level);
 
+   if (usage & PIPE_MAP_WRITE)
+      llvmpipe_texcache_invalidate(resource);
+
    /*
     * Transfers, like other pipe operations, must happen in order, so flush
     * the context if necessary.
@@ -946,23 +1042,18 @@ llvmpipe_transfer_map_ms(struct pipe_context *pipe,
       }
    }
 
-   /* Check if we're mapping a current constant buffer */
+   /* Check if we're mapping a current constant buffer.  Unsynchronized
+    * threaded context mappings are done from another thread, the context
+    * state is updated when they're unmapped.
+    */
    if ((usage & PIPE_MAP_WRITE) &&
-       (resource->bind & PIPE_BIND_CONSTANT_BUFFER)) {
-      unsigned i;
-      for (i = 0; i < ARRAY_SIZE(llvmpipe->constants[PIPE_SHADER_FRAGMENT]); ++i) {
-         if (resource == llvmpipe->constants[PIPE_SHADER_FRAGMENT][i].buffer) {
-            /* constants may have changed */
-            llvmpipe->dirty |= LP_NEW_FS_CONSTANTS;
-            break;
-         }
-      }
-   }
+       !(usage & (TC_TRANSFER_MAP_THREADED_UNSYNC | PIPE_MAP_THREAD_SAFE)))
+      llvmpipe_constant_buffer_written(llvmpipe, resource);
 
    lpt = CALLOC_STRUCT(llvmpipe_transfer);
    if (!lpt)
       return NULL;
-   pt = &lpt->base;
+   pt = &lpt->base.b;
    pipe_resource_reference(&pt->resource, resource);
    pt->box = *box;
    pt->level = level;
@@ -995,7 +1086,7 @@ llvmpipe_transfer_map_ms(struct pipe_context *pipe,
       printf("transfer map tex %u  mode %s\n", lpr->id, mode);
    }
 
-   format = lpr->base.format;
+   format = lpr->base.b.format;
 
    if (llvmpipe_resource_is_texture(resource) && (resource->flags & PIPE_RESOURCE_FLAG_SPARSE)) {
       map = llvmpipe_resource_map(resource, 0, 0, tex_usage);
@@ -1140,6 +1231,11 @@ llvmpipe_transfer_unmap(struct pipe_context *pipe,
 
    assert(resource);
 
+   if ((transfer->usage & PIPE_MAP_WRITE) &&
+       (transfer->usage & TC_TRANSFER_MAP_THREADED_UNSYNC) &&
+       !(transfer->usage & PIPE_MAP_THREAD_SAFE))
+      llvmpipe_constant_buffer_written(llvmpipe_context(pipe), resource);
+
    if (llvmpipe_resource_is_texture(resource) && (resource->flags & PIPE_RESOURCE_FLAG_SPARSE) &&
        (transfer->usage & PIPE_MAP_WRITE)) {
       uint32_t block_stride = util_format_get_blocksize(resource->format);
@@ -1165,6 +1261,10 @@ llvmpipe_transfer_unmap(struct pipe_context *pipe,
                            transfer->level,
                            transfer->box.z);
 
+   /* Scenes may have run since mapping, e.g. with a persistent mapping */
+   if (transfer->usage & PIPE_MAP_WRITE)
+      llvmpipe_texcache_invalidate(resource);
+
    pipe_resource_reference(&resource, NULL);
    free(lpt->map);
    FREE(transfer);
@@ -1189,6 +1289,150 @@ llvmpipe_is_resource_referenced(struct pipe_context *pipe,
 }
 
 
+/**
+ * Update the state which captured the storage address of a buffer.
+ */
+static void
+llvmpipe_rebind_buffer(struct llvmpipe_context *llvmpipe,
+                       struct pipe_resource *buffer)
+{
+   const uint8_t *data = llvmpipe_resource_data(buffer);
+
+   /* The draw module is handed the addresses up front, the other stages
+    * look them up when their state is validated.
+    */
+   for (enum pipe_shader_type sh = PIPE_SHADER_VERTEX;
+        sh <= PIPE_SHADER_TESS_EVAL; sh++) {
+      if (sh == PIPE_SHADER_FRAGMENT)
+         continue;
+
+      for (unsigned i = 0; i < ARRAY_SIZE(llvmpipe->constants[sh]); i++) {
+         const struct pipe_constant_buffer *cb = &llvmpipe->constants[sh][i];
+         if (cb->buffer == buffer)
+            draw_set_mapped_constant_buffer(llvmpipe->draw, sh, i,
+                                            data + cb->buffer_offset,
+                                            cb->buffer_size);
+      }
+
+      for (unsigned i = 0; i < ARRAY_SIZE(llvmpipe->ssbos[sh]); i++) {
+         const struct pipe_shader_buffer *sb = &llvmpipe->ssbos[sh][i];
+         if (sb->buffer == buffer)
+            draw_set_mapped_shader_buffer(llvmpipe->draw, sh, i,
+                                          data + sb->buffer_offset,
+                                          sb->buffer_size);
+      }
+   }
+
+   for (unsigned i = 0; i < llvmpipe->num_so_targets; i++) {
+      if (llvmpipe->so_targets[i] &&
+          llvmpipe->so_targets[i]->target.buffer == buffer)
+         llvmpipe->so_targets[i]->mapping = (void *)data;
+   }
+
+   llvmpipe->dirty |= LP_NEW_FS_CONSTANTS |
+                      LP_NEW_FS_SSBOS |
+                      LP_NEW_FS_IMAGES |
+                      LP_NEW_SAMPLER_VIEW |
+                      LP_NEW_TASK_CONSTANTS |
+                      LP_NEW_TASK_SSBOS |
+                      LP_NEW_TASK_IMAGES |
+                      LP_NEW_TASK_SAMPLER_VIEW |
+                      LP_NEW_MESH_CONSTANTS |
+                      LP_NEW_MESH_SSBOS |
+                      LP_NEW_MESH_IMAGES |
+                      LP_NEW_MESH_SAMPLER_VIEW;
+   llvmpipe->cs_dirty |= LP_CSNEW_CONSTANTS |
+                         LP_CSNEW_SSBOS |
+                         LP_CSNEW_IMAGES |
+                         LP_CSNEW_SAMPLER_VIEW;
+}
+
+
+/**
+ * Called when a scene of any context starts referencing the resource.
+ */
+void
+llvmpipe_resource_scene_ref(struct pipe_resource *resource, bool writeable)
+{
+   struct llvmpipe_resource *lpr = llvmpipe_resource(resource);
+
+   p_atomic_inc(&lpr->scene_refs);
+   if (writeable)
+      p_atomic_inc(&lpr->scene_write_refs);
+}
+
+
+/**
+ * Called when a scene is done with the resource.  The last one releases the
+ * storage which the buffer gave up while scenes were using it.
+ */
+void
+llvmpipe_resource_scene_unref(struct pipe_resource *resource, bool writeable)
+{
+   struct llvmpipe_resource *lpr = llvmpipe_resource(resource);
+   struct llvmpipe_screen *screen = llvmpipe_screen(resource->screen);
+   struct pipe_resource *retired = NULL;
+
+   if (writeable)
+      p_atomic_dec(&lpr->scene_write_refs);
+   if (!p_atomic_dec_zero(&lpr->scene_refs))
+      return;
+
+   /* Another scene may have started using the buffer in the meantime. */
+   mtx_lock(&screen->retired_mutex);
+   if (!p_atomic_read(&lpr->scene_refs)) {
+      retired = lpr->retired;
+      lpr->retired = NULL;
+   }
+   mtx_unlock(&screen->retired_mutex);
+
+   pipe_resource_reference(&retired, NULL);
+}
+
+
+/**
+ * u_threaded_context callback for buffer invalidation: dst takes over the
+ * storage of the freshly allocated src.  The old storage goes to src, which
+ * dst keeps alive as long as scenes of any context reference dst.
+ */
+void
+llvmpipe_replace_buffer_storage(struct pipe_context *pipe,
+                                struct pipe_resource *dst,
+                                struct pipe_resource *src,
+                                unsigned num_rebinds,
+                                uint32_t rebind_mask,
+                                uint32_t delete_buffer_id)
+{
+   struct llvmpipe_context *llvmpipe = llvmpipe_context(pipe);
+   struct llvmpipe_screen *screen = llvmpipe_screen(pipe->screen);
+   struct llvmpipe_resource *lp_dst = llvmpipe_resource(dst);
+   struct llvmpipe_resource *lp_src = llvmpipe_resource(src);
+
+   assert(dst->target == PIPE_BUFFER && src->target == PIPE_BUFFER);
+   assert(lp_dst->size_required == lp_src->size_required);
+   assert(!lp_dst->user_ptr && !lp_src->user_ptr);
+   assert(!lp_src->retired);
+
+   void *data = lp_dst->data;
+   lp_dst->data = lp_src->data;
+   lp_src->data = data;
+
+   mtx_lock(&screen->retired_mutex);
+   if (p_atomic_read(&lp_dst->scene_refs)) {
+      struct pipe_resource *retired = NULL;
+
+      pipe_resource_reference(&retired, src);
+      lp_src->retired = lp_dst->retired;
+      lp_dst->retired = retired;
+   }
+   mtx_unlock(&screen->retired_mutex);
+
+   llvmpipe_rebind_buffer(llvmpipe, dst);
+
+   util_idalloc_mt_free(&screen->buffer_ids, delete_buffer_id);
+}
+
+
 /**
  * Returns the largest possible alignment for a format in llvmpipe
  */
@@ -1233,20 +1477,21 @@ llvmpipe_user_buffer_create(struct pipe_screen *screen,
       return NULL;
 
    buffer->screen = llvmpipe_screen(screen);
-   pipe_reference_init(&buffer->base.reference, 1);
-   buffer->base.screen = screen;
-   buffer->base.format = PIPE_FORMAT_R8_UNORM; /* ?? */
-   buffer->base.bind = bind_flags;
-   buffer->base.usage = PIPE_USAGE_IMMUTABLE;
-   buffer->base.flags = 0;
-   buffer->base.width0 = bytes;
-   buffer->base.height0 = 1;
-   buffer->base.depth0 = 1;
-   buffer->base.array_size = 1;
+   pipe_reference_init(&buffer->base.b.reference, 1);
+   buffer->base.b.screen = screen;
+   buffer->base.b.format = PIPE_FORMAT_R8_UNORM; /* ?? */
+   buffer->base.b.bind = bind_flags;
+   buffer->base.b.usage = PIPE_USAGE_IMMUTABLE;
+   buffer->base.b.flags = 0;
+   buffer->base.b.width0 = bytes;
+   buffer->base.b.height0 = 1;
+   buffer->base.b.depth0 = 1;
+   buffer->base.b.array_size = 1;
    buffer->user_ptr = true;
    buffer->data = ptr;
+   llvmpipe_resource_init_user_ptr(buffer->screen, buffer);
 
-   return &buffer->base;
+   return &buffer->base.b;
 }
 
 
@@ -1269,7 +1514,7 @@ uint8_t *
 llvmpipe_get_texture_image_address(struct llvmpipe_resource *lpr,
                                    unsigned face_slice, unsigned level)
 {
-   assert(llvmpipe_resource_is_texture(&lpr->base));
+   assert(llvmpipe_resource_is_texture(&lpr->base.b));
 
    unsigned offset = lpr->mip_offsets[level];
 
@@ -1280,6 +1525,35 @@ llvmpipe_get_texture_image_address(struct llvmpipe_resource *lpr,
 }
 
 
+/**
+ * Called when the contents of a texture may change, or its memory may get
+ * reused.  The rasterizer threads cache decoded blocks of compressed
+ * textures by address across scenes, see rasterize_scene().
+ */
+void
+llvmpipe_texcache_invalidate(struct pipe_resource *resource)
+{
+   if (util_format_is_compressed(resource->format)) {
+      struct llvmpipe_screen *screen = llvmpipe_resource(resource)->screen;
+      p_atomic_inc(&screen->texcache_epoch);
+   }
+}
+
+
+/**
+ * Whether the resource's memory can be written without us knowing, in
+ * which case nothing derived from its contents may outlive a scene.
+ */
+bool
+llvmpipe_resource_is_external(const struct pipe_resource *resource)
+{
+   const struct llvmpipe_resource *lpr = llvmpipe_resource_const(resource);
+
+   return lpr->dt || lpr->user_ptr || lpr->backable ||
+          lpr->imported_memory || lpr->dmabuf;
+}
+
+
 /**
  * Return size of resource in bytes
  */
@@ -1596,11 +1870,14 @@ llvmpipe_resource_bind_backing(struct pipe_screen *pscreen,
    if (!lpr->backable)
       return false;
 
-   if ((lpr->base.flags & PIPE_RESOURCE_FLAG_SPARSE) && offset < lpr->size_required) {
+   /* The new memory may hold anything, at addresses seen before */
+   llvmpipe_texcache_invalidate(pt);
+
+   if ((lpr->base.b.flags & PIPE_RESOURCE_FLAG_SPARSE) && offset < lpr->size_required) {
 #if DETECT_OS_LINUX
       struct llvmpipe_memory_allocation *mem = (struct llvmpipe_memory_allocation *)pmem;
       if (mem) {
-         if (llvmpipe_resource_is_texture(&lpr->base)) {
+         if (llvmpipe_resource_is_texture(&lpr->base.b)) {
             mmap((char *)lpr->tex_data + offset, size, PROT_READ|PROT_WRITE,
                  MAP_SHARED|MAP_FIXED, mem->fd, mem->offset + fd_offset);
             BITSET_SET(lpr->residency, offset / (64 * 1024));
@@ -1609,7 +1886,7 @@ llvmpipe_resource_bind_backing(struct pipe_screen *pscreen,
                  MAP_SHARED|MAP_FIXED, mem->fd, mem->offset + fd_offset);
          }
       } else {
-         if (llvmpipe_resource_is_texture(&lpr->base)) {
+         if (llvmpipe_resource_is_texture(&lpr->base.b)) {
             mmap((char *)lpr->tex_data + offset, size, PROT_READ|PROT_WRITE,
                  MAP_SHARED|MAP_FIXED|MAP_ANONYMOUS, -1, 0);
             BITSET_CLEAR(lpr->residency, offset / (64 * 1024));
@@ -1625,7 +1902,7 @@ llvmpipe_resource_bind_backing(struct pipe_screen *pscreen,
 
    addr = llvmpipe_map_memory(pscreen, pmem);
 
-   if (llvmpipe_resource_is_texture(&lpr->base)) {
+   if (llvmpipe_resource_is_texture(&lpr->base.b)) {
       if (lpr->size_required > LP_MAX_TEXTURE_SIZE)
          return false;
 
@@ -1641,12 +1918,12 @@ llvmpipe_resource_bind_backing(struct pipe_screen *pscreen,
             /* Round up the surface size to a multiple of the tile size to
              * avoid tile clipping.
              */
-            const unsigned width = MAX2(1, align(lpr->base.width0, TILE_SIZE));
-            const unsigned height = MAX2(1, align(lpr->base.height0, TILE_SIZE));
+            const unsigned width = MAX2(1, align(lpr->base.b.width0, TILE_SIZE));
+            const unsigned height = MAX2(1, align(lpr->base.b.height0, TILE_SIZE));
 
             lpr->dt = winsys->displaytarget_create_mapped(winsys,
-                                                          lpr->base.bind,
-                                                          lpr->base.format,
+                                                          lpr->base.b.bind,
+                                                          lpr->base.b.format,
                                                           width, height,
                                                           lpr->row_stride[0],
                                                           lpr->tex_data);
@@ -1671,11 +1948,11 @@ llvmpipe_print_resources(void)
    debug_printf("LLVMPIPE: current resources:\n");
    simple_mtx_lock(&resource_list_mutex);
    LIST_FOR_EACH_ENTRY(lpr, &resource_list.list, list) {
-      unsigned size = llvmpipe_resource_size(&lpr->base);
+      unsigned size = llvmpipe_resource_size(&lpr->base.b);
       debug_printf("resource %u at %p, size %ux%ux%u: %u bytes, refcount %u\n",
                    lpr->id, (void *) lpr,
-                   lpr->base.width0, lpr->base.height0, lpr->base.depth0,
-                   size, lpr->base.reference.count);
+                   lpr->base.b.width0, lpr->base.b.height0, lpr->base.b.depth0,
+                   size, lpr->base.b.reference.count);
       total += size;
       n++;
    }
@@ -31,6 +31,7 @@
 
 #include "pipe/p_state.h"
 #include "util/u_debug.h"
+#include "util/u_threaded_context.h"
 #include "lp_limits.h"
 #include "util/bitset.h"
 #if MESA_DEBUG
@@ -68,7 +69,7 @@ struct sw_displaytarget;
  */
 struct llvmpipe_resource
 {
-   struct pipe_resource base;
+   struct threaded_resource base;
 
    /** an extra screen pointer to avoid crashing in driver trace */
    struct llvmpipe_screen *screen;
@@ -104,6 +105,20 @@ struct llvmpipe_resource
    bool user_ptr;  /** Is this a user-space buffer? */
    unsigned timestamp;
 
+   /**
+    * Number of references by the scenes of all contexts, and how many of
+    * them are for writing.  Dropped when the owning context ends the scene.
+    */
+   unsigned scene_refs;
+   unsigned scene_write_refs;
+
+   /**
+    * Buffers which took over storage of this one while scenes still
+    * referenced it, chained through their own retired field.  Released once
+    * scene_refs drops to zero.
+    */
+   struct pipe_resource *retired;
+
    unsigned id;  /**< temporary, for debugging */
 
    unsigned sample_stride;
@@ -116,6 +131,8 @@ struct llvmpipe_resource
    bool backable;
    struct pipe_memory_object *imported_memory;
    bool dmabuf;
+   /** Counted in llvmpipe_screen::num_external_compressed */
+   bool texcache_external;
 #if MESA_DEBUG
    struct list_head list;
 #endif
@@ -124,7 +141,7 @@ struct llvmpipe_resource
 
 struct llvmpipe_transfer
 {
-   struct pipe_transfer base;
+   struct threaded_transfer base;
    void *map;
    struct pipe_box block_box;
 };
@@ -293,6 +310,20 @@ llvmpipe_is_resource_referenced(struct pipe_context *pipe,
                                 struct pipe_resource *presource,
                                 unsigned level);
 
+void
+llvmpipe_resource_scene_ref(struct pipe_resource *resource, bool writeable);
+
+void
+llvmpipe_resource_scene_unref(struct pipe_resource *resource, bool writeable);
+
+void
+llvmpipe_replace_buffer_storage(struct pipe_context *pipe,
+                                struct pipe_resource *dst,
+                                struct pipe_resource *src,
+                                unsigned num_rebinds,
+                                uint32_t rebind_mask,
+                                uint32_t delete_buffer_id);
+
 unsigned
 llvmpipe_get_format_alignment(enum pipe_format format);
 
@@ -311,4 +342,10 @@ llvmpipe_get_texel_offset(struct pipe_resource *resource,
                           uint32_t level, uint32_t x,
                           uint32_t y, uint32_t z);
 
+void
+llvmpipe_texcache_invalidate(struct pipe_resource *resource);
+
+bool
+llvmpipe_resource_is_external(const struct pipe_resource *resource);
+
 #endif /* LP_TEXTURE_H */
@@ -8,6 +8,8 @@
 
 #include "radix_sort/radix_sort_u64.h"
 #include "bvh/vk_bvh.h"
+#include "util/u_cpu_detect.h"
+#include "util/u_debug.h"
 
 struct radix_sort_vk_target_config lvp_radix_sort_config = {
    .keyval_dwords = 2,
@@ -54,6 +56,28 @@ lvp_init_radix_sort(struct lvp_device *device)
    simple_mtx_unlock(&device->radix_sort_lock);
 }
 
+static void
+lvp_init_bvh_queue(struct lvp_device *device)
+{
+   simple_mtx_lock(&device->bvh_queue_lock);
+   if (util_queue_is_initialized(&device->bvh_queue)) {
+      simple_mtx_unlock(&device->bvh_queue_lock);
+      return;
+   }
+
+   /* The thread executing the build takes part in it, so one thread less
+    * than there are CPUs is needed. Without a queue, builds are done on a
+    * single thread.
+    */
+   unsigned num_threads = debug_get_num_option("LP_NUM_THREADS", util_get_cpu_caps()->nr_cpus);
+   if (num_threads > 1) {
+      util_queue_init(&device->bvh_queue, "lvpbvh", 64, num_threads - 1,
+                      UTIL_QUEUE_INIT_RESIZE_IF_FULL, NULL);
+   }
+
+   simple_mtx_unlock(&device->bvh_queue_lock);
+}
+
 static void
 lvp_write_buffer_cp(VkCommandBuffer cmdbuf, VkDeviceAddress addr,
                     void *data, uint32_t size)
@@ -180,13 +204,59 @@ lvp_enqueue_encode_as(VkCommandBuffer commandBuffer, const struct vk_acceleratio
    list_addtail(&entry->cmd_link, &cmd_buffer->vk.cmd_queue.cmds);
 }
 
+static void
+lvp_enqueue_build_as(VkCommandBuffer commandBuffer,
+                     const VkAccelerationStructureBuildGeometryInfoKHR *info,
+                     const VkAccelerationStructureBuildRangeInfoKHR *range_infos)
+{
+   VK_FROM_HANDLE(lvp_cmd_buffer, cmd_buffer, commandBuffer);
+
+   struct vk_cmd_queue_entry *entry =
+      vk_zalloc(cmd_buffer->vk.cmd_queue.alloc, sizeof(struct vk_cmd_queue_entry),
+                8, VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+   if (!entry)
+      return;
+
+   entry->type = LVP_CMD_BUILD_AS;
+
+   struct lvp_cmd_build_as *cmd =
+      vk_zalloc(cmd_buffer->vk.cmd_queue.alloc,
+                sizeof(struct lvp_cmd_build_as) + info->geometryCount * sizeof(struct lvp_bvh_geometry),
+                8, VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+   if (!cmd) {
+      vk_free(cmd_buffer->vk.cmd_queue.alloc, entry);
+      return;
+   }
+
+   cmd->dst = vk_acceleration_structure_from_handle(info->dstAccelerationStructure);
+   if (info->mode == VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR)
+      cmd->src = vk_acceleration_structure_from_handle(info->srcAccelerationStructure);
+   cmd->flags = info->flags;
+   cmd->geometry_type = vk_get_as_geometry_type(info);
+   cmd->geometry_count = info->geometryCount;
+
+   for (uint32_t i = 0; i < info->geometryCount; i++) {
+      const VkAccelerationStructureGeometryKHR *geometry =
+         info->pGeometries ? &info->pGeometries[i] : info->ppGeometries[i];
+
+      cmd->geometries[i].data = vk_fill_geometry_data(info->type, cmd->leaf_count, i, geometry,
+                                                      &range_infos[i]);
+      cmd->geometries[i].primitive_count = range_infos[i].primitiveCount;
+      cmd->leaf_count += range_infos[i].primitiveCount;
+   }
+
+   entry->driver_data = cmd;
+
+   list_addtail(&entry->cmd_link, &cmd_buffer->vk.cmd_queue.cmds);
+}
+
 static uint32_t
 ir_id_to_offset(uint32_t id)
 {
    return id & (~3u);
 }
 
-static uint32_t
+uint32_t
 lvp_pack_sbt_offset_and_flags(uint32_t sbt_offset, VkGeometryInstanceFlagsKHR flags)
 {
    uint32_t ret = sbt_offset;
@@ -201,13 +271,27 @@ lvp_pack_sbt_offset_and_flags(uint32_t sbt_offset, VkGeometryInstanceFlagsKHR fl
    return ret;
 }
 
+void
+lvp_instance_node_set_transform(struct lvp_bvh_instance_node *node, const mat3x4 *otw_matrix)
+{
+   node->otw_matrix = *otw_matrix;
+
+   float transform[16], inv_transform[16];
+   memcpy(transform, &otw_matrix->values, sizeof(otw_matrix->values));
+   transform[12] = transform[13] = transform[14] = 0.0f;
+   transform[15] = 1.0f;
+
+   util_invert_mat4x4(inv_transform, transform);
+   memcpy(node->wto_matrix.values, inv_transform, sizeof(node->wto_matrix.values));
+}
+
 static void
 lvp_select_subtrees_to_flatten(const struct vk_ir_header *header, const struct vk_ir_box_node *ir_box_nodes,
                                const uint32_t *node_depth, const uint32_t *child_counts, uint32_t root_offset,
                                uint32_t index, struct util_dynarray *subtrees, uint32_t *max_subtree_size)
 {
    uint32_t depth = node_depth[header->ir_internal_node_count - index - 1];
-   uint32_t available_depth = 23 - depth;
+   uint32_t available_depth = LVP_BVH_MAX_DEPTH - 1 - depth;
    uint32_t allowed_child_count = 1 << available_depth;
    uint32_t child_count = child_counts[index];
    bool flatten = child_count > allowed_child_count;
@@ -244,7 +328,7 @@ lvp_gather_subtree(const uint8_t *output, uint32_t offset, uint32_t *leaf_nodes,
                    vk_aabb *leaf_bounds, uint32_t *leaf_node_count, uint32_t *internal_nodes,
                    uint32_t *internal_node_count)
 {
-   const struct lvp_bvh_box_node *node = (void *)(output + offset);
+   const struct lvp_bvh_binary_node *node = (void *)(output + offset);
 
    for (uint32_t child_index = 0; child_index < 2; child_index++) {
       if (node->children[child_index] == VK_BVH_INVALID_NODE)
@@ -289,14 +373,14 @@ lvp_rebuild_subtree(const uint8_t *output, uint32_t *leaf_nodes, vk_aabb *leaf_b
    child_nodes[1] = lvp_rebuild_subtree(output, leaf_nodes + split_index, leaf_bounds + split_index, internal_nodes,
                                         leaf_node_count - split_index, internal_node_index);
 
-   struct lvp_bvh_box_node *node = (void *)(output + ir_id_to_offset(node_id));
+   struct lvp_bvh_binary_node *node = (void *)(output + ir_id_to_offset(node_id));
 
    for (uint32_t i = 0; i < 2; i++) {
       node->children[i] = child_nodes[i];
 
       uint32_t type = child_nodes[i] & 3;
       if (type == lvp_bvh_node_internal) {
-         const struct lvp_bvh_box_node *child_node =
+         const struct lvp_bvh_binary_node *child_node =
             (void *)(output + ir_id_to_offset(child_nodes[i]));
          node->bounds[i].min.x = MIN2(child_node->bounds[0].min.x, child_node->bounds[1].min.x);
          node->bounds[i].min.y = MIN2(child_node->bounds[0].min.y, child_node->bounds[1].min.y);
@@ -362,7 +446,7 @@ lvp_flatten_as(const struct vk_ir_header *header, const struct vk_ir_box_node *i
 
    util_dynarray_foreach(&subtrees, uint32_t, root_index) {
       uint32_t offset = sizeof(struct lvp_bvh_header) +
-         (header->ir_internal_node_count - 1 - *root_index) * sizeof(struct lvp_bvh_box_node);
+         (header->ir_internal_node_count - 1 - *root_index) * sizeof(struct lvp_bvh_binary_node);
 
       internal_nodes[0] = offset | lvp_bvh_node_internal;
 
@@ -404,10 +488,157 @@ lvp_get_leaf_node_size(VkGeometryTypeKHR geometry_type, uint32_t *ir_leaf_node_s
    }
 }
 
+static float
+lvp_aabb_half_area(const vk_aabb *aabb)
+{
+   float x = aabb->max.x - aabb->min.x;
+   float y = aabb->max.y - aabb->min.y;
+   float z = aabb->max.z - aabb->min.z;
+   return x * y + y * z + z * x;
+}
+
+struct lvp_collapse_state {
+   uint32_t width;
+   const uint8_t *tree;
+   uint8_t *output;
+   uint32_t box_node_count;
+};
+
+/* Replaces the internal child index of a box node with the children of the
+ * binary node.
+ */
+static void
+lvp_collapse_open_child(const struct lvp_collapse_state *state, uint32_t *children,
+                        vk_aabb *bounds, uint32_t *child_count, uint32_t index)
+{
+   const struct lvp_bvh_binary_node *node =
+      (const void *)(state->tree + ir_id_to_offset(children[index]));
+
+   children[index] = LVP_BVH_INVALID_NODE;
+   for (uint32_t i = 0; i < 2; i++) {
+      if (node->children[i] == LVP_BVH_INVALID_NODE)
+         continue;
+
+      uint32_t dst = children[index] == LVP_BVH_INVALID_NODE ? index : (*child_count)++;
+      children[dst] = node->children[i];
+      bounds[dst] = node->bounds[i];
+   }
+}
+
+static uint32_t
+lvp_collapse_node(struct lvp_collapse_state *state, uint32_t node_id)
+{
+   const struct lvp_bvh_binary_node *node = (const void *)(state->tree + ir_id_to_offset(node_id));
+   uint32_t width = state->width;
+
+   uint32_t children[LVP_BVH_MAX_WIDTH];
+   vk_aabb bounds[LVP_BVH_MAX_WIDTH];
+   uint32_t child_count = 0;
+
+   for (uint32_t i = 0; i < 2; i++) {
+      if (node->children[i] != LVP_BVH_INVALID_NODE) {
+         children[child_count] = node->children[i];
+         bounds[child_count++] = node->bounds[i];
+      }
+   }
+
+   /* Pull up log2(width) levels of the binary tree, so that every box node
+    * advances at least that many levels, see lvp_bvh_stack_size.
+    */
+   for (uint32_t level_width = 4; level_width <= width; level_width *= 2) {
+      uint32_t count = child_count;
+      for (uint32_t i = 0; i < count; i++) {
+         if ((children[i] & 3) == lvp_bvh_node_internal)
+            lvp_collapse_open_child(state, children, bounds, &child_count, i);
+      }
+   }
+
+   /* Fill up the node by opening the internal child with the largest
+    * surface area, which is the one that is most likely to be hit.
+    */
+   while (child_count < width) {
+      int32_t largest = -1;
+      float largest_area = 0.0f;
+      for (uint32_t i = 0; i < child_count; i++) {
+         if ((children[i] & 3) != lvp_bvh_node_internal)
+            continue;
+
+         float area = lvp_aabb_half_area(&bounds[i]);
+         if (largest < 0 || area > largest_area) {
+            largest = i;
+            largest_area = area;
+         }
+      }
+
+      if (largest < 0)
+         break;
+
+      lvp_collapse_open_child(state, children, bounds, &child_count, largest);
+   }
+
+   /* Box nodes are stored in pre-order, children always come after their
+    * parent.
+    */
+   uint32_t offset = LVP_BVH_ROOT_NODE_OFFSET + state->box_node_count * lvp_bvh_box_node_size(width);
+   state->box_node_count++;
+
+   uint8_t *box = state->output + offset;
+   uint32_t *box_children = lvp_bvh_box_children(box, width);
+
+   for (uint32_t i = 0; i < width; i++) {
+      if (i >= child_count || children[i] == LVP_BVH_INVALID_NODE) {
+         box_children[i] = LVP_BVH_INVALID_NODE;
+         lvp_bvh_box_set_child_bounds(box, width, i, &(vk_aabb) {
+            .min = { NAN, NAN, NAN },
+            .max = { NAN, NAN, NAN },
+         });
+         continue;
+      }
+
+      if ((children[i] & 3) == lvp_bvh_node_internal)
+         box_children[i] = lvp_collapse_node(state, children[i]);
+      else
+         box_children[i] = children[i];
+
+      lvp_bvh_box_set_child_bounds(box, width, i, &bounds[i]);
+   }
+
+   return offset | lvp_bvh_node_internal;
+}
+
+uint32_t
+lvp_bvh_max_box_node_count(uint32_t width, uint32_t leaf_count)
+{
+   /* Every box node has min(width, leaves of its subtree) children. Nodes
+    * with fewer children than width only have leaves as children and at
+    * least two of them, except for the root.
+    */
+   uint64_t count = (uint64_t)width / 2 * MAX2(leaf_count, 2) - 1;
+   return count / (width - 1);
+}
+
+/* Collapses the binary tree with its root at LVP_BVH_ROOT_NODE_OFFSET of
+ * tree into box nodes of the given width starting at the same offset of
+ * output, and returns the number of box nodes. Leaf node ids are kept.
+ */
+uint32_t
+lvp_bvh_collapse(uint32_t width, const uint8_t *tree, uint8_t *output)
+{
+   struct lvp_collapse_state state = {
+      .width = width,
+      .tree = tree,
+      .output = output,
+   };
+
+   lvp_collapse_node(&state, LVP_BVH_ROOT_NODE);
+
+   return state.box_node_count;
+}
+
 void
-lvp_encode_as(struct vk_acceleration_structure *dst, VkDeviceAddress intermediate_as_addr,
-              VkDeviceAddress intermediate_header_addr, uint32_t leaf_count,
-              VkGeometryTypeKHR geometry_type)
+lvp_encode_as(struct lvp_device *device, struct vk_acceleration_structure *dst,
+              VkDeviceAddress intermediate_as_addr, VkDeviceAddress intermediate_header_addr,
+              uint32_t leaf_count, VkGeometryTypeKHR geometry_type)
 {
    const struct vk_ir_header *header = (const void *)(uintptr_t)intermediate_header_addr;
    const uint8_t *ir_bvh = (const void *)(uintptr_t)intermediate_as_addr;
@@ -429,7 +660,9 @@ lvp_encode_as(struct vk_acceleration_structure *dst, VkDeviceAddress intermediat
    else
       output_header->instance_count = 0;
 
-   output_header->leaf_nodes_offset = sizeof(struct lvp_bvh_header) + header->ir_internal_node_count * sizeof(struct lvp_bvh_box_node);
+   output_header->leaf_nodes_offset = sizeof(struct lvp_bvh_header) +
+      lvp_bvh_max_box_node_count(device->bvh_width, header->active_leaf_count) *
+      lvp_bvh_box_node_size(device->bvh_width);
 
    output_header->serialization_size = sizeof(struct lvp_accel_struct_serialization_header) +
                                        sizeof(uint64_t) * output_header->instance_count + dst->size;
@@ -463,16 +696,7 @@ lvp_encode_as(struct vk_acceleration_structure *dst, VkDeviceAddress intermediat
             lvp_pack_sbt_offset_and_flags(ir_instance->sbt_offset_and_flags & 0xFFFFFF,
                                           ir_instance->sbt_offset_and_flags >> 24);
          output_instance->instance_id = ir_instance->instance_id;
-         output_instance->otw_matrix = ir_instance->otw_matrix;
-
-         float transform[16], inv_transform[16];
-         memcpy(transform, &ir_instance->otw_matrix.values, sizeof(ir_instance->otw_matrix.values));
-         transform[12] = transform[13] = transform[14] = 0.0f;
-         transform[15] = 1.0f;
-
-         util_invert_mat4x4(inv_transform, transform);
-         memcpy(output_instance->wto_matrix.values, inv_transform, sizeof(output_instance->wto_matrix.values));
-
+         lvp_instance_node_set_transform(output_instance, &ir_instance->otw_matrix);
          break;
       }
       default:
@@ -480,16 +704,21 @@ lvp_encode_as(struct vk_acceleration_structure *dst, VkDeviceAddress intermediat
       }
    }
 
+   /* The binary tree uses the node ids it would have in the acceleration
+    * structure, the space of the header is unused.
+    */
    uint32_t *node_depth = calloc(header->ir_internal_node_count, sizeof(uint32_t));
-   if (!node_depth)
-      return;
+   uint8_t *tree = malloc(sizeof(struct lvp_bvh_header) +
+                          header->ir_internal_node_count * sizeof(struct lvp_bvh_binary_node));
+   if (!node_depth || !tree)
+      goto out;
 
    uint32_t max_node_depth = 0;
 
    for (uint32_t i = 0; i < header->ir_internal_node_count; i++) {
       const struct vk_ir_box_node *ir_box = ir_box_nodes + (header->ir_internal_node_count - i - 1);
-      struct lvp_bvh_box_node *output_box =
-         (void *)(output + sizeof(struct lvp_bvh_header) + i * sizeof(struct lvp_bvh_box_node));
+      struct lvp_bvh_binary_node *output_box =
+         (void *)(tree + sizeof(struct lvp_bvh_header) + i * sizeof(struct lvp_bvh_binary_node));
 
       for (uint32_t child_index = 0; child_index < 2; child_index++) {
          if (ir_box->children[child_index] == VK_BVH_INVALID_NODE) {
@@ -530,7 +759,7 @@ lvp_encode_as(struct vk_acceleration_structure *dst, VkDeviceAddress intermediat
             uint32_t src_index = (ir_child_offset - root_offset) / sizeof(struct vk_ir_box_node);
             uint32_t dst_index = header->ir_internal_node_count - src_index - 1;
             output_box->children[child_index] =
-               sizeof(struct lvp_bvh_header) + dst_index * sizeof(struct lvp_bvh_box_node);
+               sizeof(struct lvp_bvh_header) + dst_index * sizeof(struct lvp_bvh_binary_node);
             output_box->children[child_index] |= lvp_bvh_node_internal;
 
             node_depth[dst_index] = node_depth[i] + 1;
@@ -542,16 +771,20 @@ lvp_encode_as(struct vk_acceleration_structure *dst, VkDeviceAddress intermediat
    /* The BVH exceeds the maximum depth supported by the traversal stack, 
     * flatten the offending parts of the tree.
     */
-   if (max_node_depth >= 24)
-      lvp_flatten_as(header, ir_box_nodes, root_offset, node_depth, output);
+   if (max_node_depth >= LVP_BVH_MAX_DEPTH)
+      lvp_flatten_as(header, ir_box_nodes, root_offset, node_depth, tree);
+
+   output_header->box_node_count = lvp_bvh_collapse(device->bvh_width, tree, output);
 
+out:
    free(node_depth);
+   free(tree);
 }
 
 static_assert(sizeof(struct lvp_bvh_triangle_node) % 8 == 0, "lvp_bvh_triangle_node is not padded");
 static_assert(sizeof(struct lvp_bvh_aabb_node) % 8 == 0, "lvp_bvh_aabb_node is not padded");
 static_assert(sizeof(struct lvp_bvh_instance_node) % 8 == 0, "lvp_bvh_instance_node is not padded");
-static_assert(sizeof(struct lvp_bvh_box_node) % 8 == 0, "lvp_bvh_box_node is not padded");
+static_assert(sizeof(struct lvp_bvh_binary_node) % 8 == 0, "lvp_bvh_binary_node is not padded");
 
 VKAPI_ATTR void VKAPI_CALL
 lvp_GetAccelerationStructureBuildSizesKHR(
@@ -587,13 +820,23 @@ lvp_BuildAccelerationStructuresKHR(
    return VK_ERROR_FEATURE_NOT_PRESENT;
 }
 
+void
+lvp_get_accel_struct_compat(const struct lvp_device *device, void *uuid)
+{
+   /* The layout of the box nodes depends on the width. */
+   lvp_device_get_cache_uuid(uuid);
+   ((uint8_t *)uuid)[VK_UUID_SIZE - 1] ^= device->bvh_width;
+}
+
 VKAPI_ATTR void VKAPI_CALL
 lvp_GetDeviceAccelerationStructureCompatibilityKHR(
    VkDevice _device, const VkAccelerationStructureVersionInfoKHR *pVersionInfo,
    VkAccelerationStructureCompatibilityKHR *pCompatibility)
 {
+   VK_FROM_HANDLE(lvp_device, device, _device);
+
    uint8_t uuid[VK_UUID_SIZE];
-   lvp_device_get_cache_uuid(uuid);
+   lvp_get_accel_struct_compat(device, uuid);
    bool compat = memcmp(pVersionInfo->pVersionData, uuid, VK_UUID_SIZE) == 0;
    *pCompatibility = compat ? VK_ACCELERATION_STRUCTURE_COMPATIBILITY_COMPATIBLE_KHR
                             : VK_ACCELERATION_STRUCTURE_COMPATIBILITY_INCOMPATIBLE_KHR;
@@ -624,10 +867,12 @@ lvp_CopyAccelerationStructureToMemoryKHR(VkDevice _device, VkDeferredOperationKH
 }
 
 static VkDeviceSize
-lvp_get_as_size(VkDevice device, const struct vk_acceleration_structure_build_state *state)
+lvp_get_as_size(VkDevice _device, const struct vk_acceleration_structure_build_state *state)
 {
-   uint32_t internal_node_count = MAX2(state->leaf_node_count, 2) - 1;
-   uint32_t nodes_size = internal_node_count * sizeof(struct lvp_bvh_box_node);
+   VK_FROM_HANDLE(lvp_device, device, _device);
+
+   uint32_t nodes_size = lvp_bvh_max_box_node_count(device->bvh_width, state->leaf_node_count) *
+                         lvp_bvh_box_node_size(device->bvh_width);
 
    uint32_t ir_leaf_node_size = 0;
    uint32_t output_leaf_node_size = 0;
@@ -664,6 +909,7 @@ lvp_device_init_accel_struct_state(struct lvp_device *device)
    device->vk.cmd_fill_buffer_addr = lvp_cmd_fill_buffer_addr;
 
    simple_mtx_init(&device->radix_sort_lock, mtx_plain);
+   simple_mtx_init(&device->bvh_queue_lock, mtx_plain);
 
    return VK_SUCCESS;
 }
@@ -672,6 +918,10 @@ void
 lvp_device_finish_accel_struct_state(struct lvp_device *device)
 {
    simple_mtx_destroy(&device->radix_sort_lock);
+   simple_mtx_destroy(&device->bvh_queue_lock);
+
+   if (util_queue_is_initialized(&device->bvh_queue))
+      util_queue_destroy(&device->bvh_queue);
 
    if (device->radix_sort)
       radix_sort_vk_destroy(device->radix_sort, lvp_device_to_handle(device), &device->vk.alloc);
@@ -716,6 +966,14 @@ lvp_CmdBuildAccelerationStructuresKHR(VkCommandBuffer commandBuffer, uint32_t in
 {
    VK_FROM_HANDLE(lvp_cmd_buffer, cmd_buffer, commandBuffer);
 
+   if (cmd_buffer->device->cpu_bvh_builder) {
+      lvp_init_bvh_queue(cmd_buffer->device);
+
+      for (uint32_t i = 0; i < infoCount; i++)
+         lvp_enqueue_build_as(commandBuffer, &pInfos[i], ppBuildRangeInfos[i]);
+      return;
+   }
+
    lvp_init_radix_sort(cmd_buffer->device);
 
    lvp_enqueue_save_state(commandBuffer);
@@ -61,8 +61,91 @@ struct lvp_bvh_instance_node {
    mat3x4 otw_matrix;
 };
 
-/* 56 bytes */
-struct lvp_bvh_box_node {
+/* Box nodes have lvp_device::bvh_width children. The bounds of the children
+ * are stored as a structure of arrays, so that traversal can test all of
+ * them with vector instructions:
+ *
+ *    float min_x[width], min_y[width], min_z[width];
+ *    float max_x[width], max_y[width], max_z[width];
+ *    uint32_t children[width];
+ *
+ * Unused children are LVP_BVH_INVALID_NODE and have NaN bounds.
+ */
+#define LVP_BVH_MIN_WIDTH 2
+#define LVP_BVH_MAX_WIDTH 8
+
+/* The maximum depth of a binary tree before it is collapsed to the box
+ * nodes, see lvp_flatten_as.
+ */
+#define LVP_BVH_MAX_DEPTH 24
+
+static inline uint32_t
+lvp_bvh_box_node_size(uint32_t width)
+{
+   return width * 7 * sizeof(uint32_t);
+}
+
+/* Returns the offset of component (min.x, min.y, min.z, max.x, max.y, max.z)
+ * of the bounds of the first child.
+ */
+static inline uint32_t
+lvp_bvh_box_bounds_offset(uint32_t width, uint32_t component)
+{
+   return component * width * sizeof(float);
+}
+
+static inline uint32_t
+lvp_bvh_box_children_offset(uint32_t width)
+{
+   return 6 * width * sizeof(float);
+}
+
+static inline uint32_t *
+lvp_bvh_box_children(void *node, uint32_t width)
+{
+   return (uint32_t *)((uint8_t *)node + lvp_bvh_box_children_offset(width));
+}
+
+static inline vk_aabb
+lvp_bvh_box_child_bounds(const void *node, uint32_t width, uint32_t child)
+{
+   const float *coords = node;
+   return (vk_aabb) {
+      .min.x = coords[0 * width + child],
+      .min.y = coords[1 * width + child],
+      .min.z = coords[2 * width + child],
+      .max.x = coords[3 * width + child],
+      .max.y = coords[4 * width + child],
+      .max.z = coords[5 * width + child],
+   };
+}
+
+static inline void
+lvp_bvh_box_set_child_bounds(void *node, uint32_t width, uint32_t child, const vk_aabb *bounds)
+{
+   float *coords = node;
+   coords[0 * width + child] = bounds->min.x;
+   coords[1 * width + child] = bounds->min.y;
+   coords[2 * width + child] = bounds->min.z;
+   coords[3 * width + child] = bounds->max.x;
+   coords[4 * width + child] = bounds->max.y;
+   coords[5 * width + child] = bounds->max.z;
+}
+
+/* The size of the traversal stack, which is shared by the TLAS and the BLAS.
+ * Collapsing pulls up log2(width) levels of the binary tree into every box
+ * node, and traversal pushes all but the closest child that is hit.
+ */
+static inline uint32_t
+lvp_bvh_stack_size(uint32_t width)
+{
+   return 2 * DIV_ROUND_UP(LVP_BVH_MAX_DEPTH, util_logbase2(width)) * (width - 1);
+}
+
+/* 56 bytes, the tree the builders produce before it is collapsed to box
+ * nodes of the device width.
+ */
+struct lvp_bvh_binary_node {
    vk_aabb bounds[2];
    uint32_t children[2];
 };
@@ -76,7 +159,8 @@ struct lvp_bvh_header {
    uint32_t instance_count;
    uint32_t leaf_nodes_offset;
 
-   uint32_t padding;
+   /* The number of box nodes that are in use, updates refit them. */
+   uint32_t box_node_count;
 };
 
 struct lvp_accel_struct_serialization_header {
@@ -93,6 +177,42 @@ struct lvp_accel_struct_serialization_header {
 #define LVP_BVH_ROOT_NODE        (LVP_BVH_ROOT_NODE_OFFSET | lvp_bvh_node_internal)
 #define LVP_BVH_INVALID_NODE     0xFFFFFFFF
 
+struct lvp_bvh_geometry {
+   struct vk_bvh_geometry_data data;
+   uint32_t primitive_count;
+};
+
+/* A build executed by the native BVH builder. */
+struct lvp_cmd_build_as {
+   struct vk_acceleration_structure *dst;
+   /* The acceleration structure that is updated, NULL for builds. */
+   struct vk_acceleration_structure *src;
+   VkBuildAccelerationStructureFlagsKHR flags;
+   VkGeometryTypeKHR geometry_type;
+   /* The number of primitives of all geometries. */
+   uint32_t leaf_count;
+   uint32_t geometry_count;
+   struct lvp_bvh_geometry geometries[];
+};
+
+void
+lvp_build_as(struct lvp_device *device, const struct lvp_cmd_build_as *build);
+
+uint32_t
+lvp_bvh_max_box_node_count(uint32_t width, uint32_t leaf_count);
+
+uint32_t
+lvp_bvh_collapse(uint32_t width, const uint8_t *tree, uint8_t *output);
+
+void
+lvp_get_accel_struct_compat(const struct lvp_device *device, void *uuid);
+
+uint32_t
+lvp_pack_sbt_offset_and_flags(uint32_t sbt_offset, VkGeometryInstanceFlagsKHR flags);
+
+void
+lvp_instance_node_set_transform(struct lvp_bvh_instance_node *node, const mat3x4 *otw_matrix);
+
 VkResult
 lvp_device_init_accel_struct_state(struct lvp_device *device);
 
@@ -0,0 +1,1214 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/*
+ * Native acceleration structure builder.
+ *
+ * Instead of running the compute shaders of vulkan/runtime/bvh on llvmpipe
+ * and converting the intermediate BVH with lvp_encode_as, the builder writes
+ * the lvp_bvh_* nodes directly:
+ *
+ * 1. The leaves are loaded from the geometries of the build and written to
+ *    the leaf area of the acceleration structure, inactive primitives are
+ *    dropped.
+ * 2. A binary tree is built top-down over the leaves with binned SAH. The
+ *    binary nodes are stored in pre-order: the subtree of a node with n
+ *    leaves occupies the n - 1 nodes starting at the node, so the location
+ *    of every subtree is known as soon as its leaves are partitioned.
+ * 3. Large nodes are binned and partitioned by all threads of the BVH
+ *    thread pool, smaller subtrees are built by one job each.
+ * 4. The binary tree is collapsed to the box nodes of the device width.
+ *
+ * Updates keep the tree of the source acceleration structure, reload the
+ * leaves and refit the bounds of the box nodes bottom-up.
+ */
+
+#include "lvp_acceleration_structure.h"
+
+#include "util/format/u_format.h"
+#include "util/u_atomic.h"
+#include "vk_format.h"
+
+/* Nodes with at least this many leaves are split by all threads. */
+#define LVP_BVH_PARALLEL_NODE_SIZE 16384
+
+/* The minimum number of leaves that is loaded or binned by one task. */
+#define LVP_BVH_TASK_SIZE 4096
+
+#define LVP_BVH_MAX_BINS 16
+#define LVP_BVH_FAST_BUILD_BINS 8
+
+/* A leaf that is being sorted into the tree. The bounds are stored with the
+ * index, which keeps the accesses to them sequential while partitioning.
+ */
+struct lvp_bvh_ref {
+   vk_aabb bounds;
+   uint32_t leaf;
+};
+
+struct lvp_bvh_bin {
+   vk_aabb bounds;
+   uint32_t count;
+};
+
+struct lvp_bvh_binning {
+   uint32_t bin_count;
+   float offset[3];
+   float scale[3];
+};
+
+struct lvp_bvh_split {
+   uint32_t axis;
+   /* The last bin of the left child. */
+   uint32_t bin;
+};
+
+/* A slice of the leaves of a node that is processed by one thread. */
+struct lvp_bvh_task {
+   struct lvp_bvh_builder *builder;
+
+   uint32_t begin;
+   uint32_t count;
+
+   const struct lvp_bvh_ref *refs;
+   struct lvp_bvh_ref *dst_refs;
+
+   struct lvp_bvh_binning binning;
+   struct lvp_bvh_split split;
+   struct lvp_bvh_bin bins[3][LVP_BVH_MAX_BINS];
+
+   uint32_t left_offset;
+   uint32_t right_offset;
+
+   /* The centroid bounds of the active leaves when gathering, and of the
+    * leaves of both children when partitioning.
+    */
+   vk_aabb centroid_bounds[2];
+   uint32_t active_count;
+
+   struct util_queue_fence fence;
+};
+
+/* A subtree that is built by one job. */
+struct lvp_bvh_job {
+   struct lvp_bvh_builder *builder;
+   struct lvp_bvh_ref *refs;
+   uint32_t begin;
+   uint32_t count;
+   vk_aabb centroid_bounds;
+   uint32_t slot;
+   uint32_t depth;
+   vk_aabb *bounds;
+};
+
+/* A node that was split on the thread executing the build. Its bounds
+ * depend on the jobs below it, so they are written once all jobs are done.
+ */
+struct lvp_bvh_parallel_node {
+   uint32_t slot;
+   vk_aabb *bounds;
+};
+
+struct lvp_bvh_builder {
+   const struct lvp_cmd_build_as *build;
+   struct util_queue *queue;
+
+   uint8_t *output;
+   uint32_t width;
+   uint32_t leaf_nodes_offset;
+   uint32_t leaf_node_size;
+   uint32_t leaf_type;
+   uint32_t bin_count;
+
+   /* The binary tree, which uses the node ids of the acceleration structure
+    * for the binary nodes.
+    */
+   uint8_t *tree;
+
+   /* The bounds of every leaf, indexed like the leaf nodes. */
+   vk_aabb *leaf_bounds;
+
+   struct lvp_bvh_task *tasks;
+   uint32_t max_task_count;
+
+   struct util_dynarray parallel_nodes;
+
+   /* Set when an allocation fails, the acceleration structure is left empty
+    * then, see lvp_bvh_init_empty.
+    */
+   bool failed;
+
+   /* The subtree jobs that are still running, plus one for the thread
+    * executing the build.
+    */
+   uint32_t pending_jobs;
+   struct util_queue_fence jobs_done;
+};
+
+static const vk_aabb lvp_bvh_empty_aabb = {
+   .min = { INFINITY, INFINITY, INFINITY },
+   .max = { -INFINITY, -INFINITY, -INFINITY },
+};
+
+static const vk_aabb lvp_bvh_invalid_aabb = {
+   .min = { NAN, NAN, NAN },
+   .max = { NAN, NAN, NAN },
+};
+
+static inline const float *
+aabb_min(const vk_aabb *aabb)
+{
+   return &aabb->min.x;
+}
+
+static inline const float *
+aabb_max(const vk_aabb *aabb)
+{
+   return &aabb->max.x;
+}
+
+static inline void
+aabb_extend(vk_aabb *aabb, const vk_aabb *other)
+{
+   aabb->min.x = MIN2(aabb->min.x, other->min.x);
+   aabb->min.y = MIN2(aabb->min.y, other->min.y);
+   aabb->min.z = MIN2(aabb->min.z, other->min.z);
+   aabb->max.x = MAX2(aabb->max.x, other->max.x);
+   aabb->max.y = MAX2(aabb->max.y, other->max.y);
+   aabb->max.z = MAX2(aabb->max.z, other->max.z);
+}
+
+static inline void
+aabb_extend_point(vk_aabb *aabb, const float point[3])
+{
+   aabb->min.x = MIN2(aabb->min.x, point[0]);
+   aabb->min.y = MIN2(aabb->min.y, point[1]);
+   aabb->min.z = MIN2(aabb->min.z, point[2]);
+   aabb->max.x = MAX2(aabb->max.x, point[0]);
+   aabb->max.y = MAX2(aabb->max.y, point[1]);
+   aabb->max.z = MAX2(aabb->max.z, point[2]);
+}
+
+static inline float
+aabb_half_area(const vk_aabb *aabb)
+{
+   float x = aabb->max.x - aabb->min.x;
+   float y = aabb->max.y - aabb->min.y;
+   float z = aabb->max.z - aabb->min.z;
+   return x * y + y * z + z * x;
+}
+
+static inline void
+aabb_centroid(const vk_aabb *aabb, float centroid[3])
+{
+   centroid[0] = (aabb->min.x + aabb->max.x) * 0.5f;
+   centroid[1] = (aabb->min.y + aabb->max.y) * 0.5f;
+   centroid[2] = (aabb->min.z + aabb->max.z) * 0.5f;
+}
+
+static inline uint32_t
+aabb_largest_axis(const vk_aabb *aabb)
+{
+   float x = aabb->max.x - aabb->min.x;
+   float y = aabb->max.y - aabb->min.y;
+   float z = aabb->max.z - aabb->min.z;
+   if (x >= y && x >= z)
+      return 0;
+   return y >= z ? 1 : 2;
+}
+
+static inline struct lvp_bvh_binary_node *
+lvp_bvh_box(const struct lvp_bvh_builder *builder, uint32_t slot)
+{
+   return (void *)(builder->tree + LVP_BVH_ROOT_NODE_OFFSET +
+                   slot * sizeof(struct lvp_bvh_binary_node));
+}
+
+static inline uint32_t
+lvp_bvh_box_id(uint32_t slot)
+{
+   return (LVP_BVH_ROOT_NODE_OFFSET + slot * sizeof(struct lvp_bvh_binary_node)) |
+          lvp_bvh_node_internal;
+}
+
+static inline uint32_t
+lvp_bvh_leaf_id(const struct lvp_bvh_builder *builder, uint32_t leaf)
+{
+   return (builder->leaf_nodes_offset + leaf * builder->leaf_node_size) | builder->leaf_type;
+}
+
+/* Returns the bounds of all valid children of a binary node. */
+static vk_aabb
+lvp_bvh_box_bounds(const struct lvp_bvh_binary_node *node)
+{
+   vk_aabb bounds = lvp_bvh_empty_aabb;
+   for (uint32_t i = 0; i < 2; i++) {
+      if (node->children[i] != LVP_BVH_INVALID_NODE)
+         aabb_extend(&bounds, &node->bounds[i]);
+   }
+   return bounds;
+}
+
+/* Returns the bounds of all valid children of a box node. */
+static vk_aabb
+lvp_bvh_wide_box_bounds(const struct lvp_bvh_builder *builder, const void *node)
+{
+   const uint32_t *children = lvp_bvh_box_children((void *)node, builder->width);
+   vk_aabb bounds = lvp_bvh_empty_aabb;
+   for (uint32_t i = 0; i < builder->width; i++) {
+      if (children[i] != LVP_BVH_INVALID_NODE) {
+         vk_aabb child_bounds = lvp_bvh_box_child_bounds(node, builder->width, i);
+         aabb_extend(&bounds, &child_bounds);
+      }
+   }
+   return bounds;
+}
+
+/* Leaves */
+
+static uint32_t
+lvp_bvh_load_index(const struct vk_bvh_geometry_data *data, uint32_t index)
+{
+   const void *indices = (const void *)(uintptr_t)data->indices;
+
+   switch (data->index_format) {
+   case VK_INDEX_TYPE_UINT16:
+      return ((const uint16_t *)indices)[index];
+   case VK_INDEX_TYPE_UINT32:
+      return ((const uint32_t *)indices)[index];
+   case VK_INDEX_TYPE_UINT8_EXT:
+      return ((const uint8_t *)indices)[index];
+   default:
+      return index;
+   }
+}
+
+static void
+lvp_bvh_load_vertex(const struct vk_bvh_geometry_data *data, uint32_t index, float vertex[3])
+{
+   const uint8_t *src = (const void *)(uintptr_t)(data->data + (uint64_t)index * data->stride);
+
+   switch (data->vertex_format) {
+   case VK_FORMAT_R32G32B32_SFLOAT:
+   case VK_FORMAT_R32G32B32A32_SFLOAT:
+      memcpy(vertex, src, 3 * sizeof(float));
+      break;
+   default: {
+      float rgba[4];
+      util_format_unpack_rgba(vk_format_to_pipe_format(data->vertex_format), rgba, src, 1);
+      memcpy(vertex, rgba, 3 * sizeof(float));
+      break;
+   }
+   }
+}
+
+static bool
+lvp_bvh_load_triangle(const struct vk_bvh_geometry_data *data, uint32_t id,
+                      struct lvp_bvh_triangle_node *node, vk_aabb *bounds)
+{
+   float vertices[3][3];
+   for (uint32_t i = 0; i < 3; i++)
+      lvp_bvh_load_vertex(data, lvp_bvh_load_index(data, id * 3 + i), vertices[i]);
+
+   /* An inactive triangle is one for which the X component of any vertex
+    * is NaN.
+    */
+   if (isnan(vertices[0][0]) || isnan(vertices[1][0]) || isnan(vertices[2][0]))
+      return false;
+
+   *bounds = lvp_bvh_empty_aabb;
+
+   const float *transform = (const void *)(uintptr_t)data->transform;
+   for (uint32_t i = 0; i < 3; i++) {
+      if (transform) {
+         for (uint32_t row = 0; row < 3; row++) {
+            node->coords[i][row] = transform[row * 4 + 0] * vertices[i][0] +
+                                   transform[row * 4 + 1] * vertices[i][1] +
+                                   transform[row * 4 + 2] * vertices[i][2] +
+                                   transform[row * 4 + 3];
+         }
+      } else {
+         memcpy(node->coords[i], vertices[i], sizeof(node->coords[i]));
+      }
+
+      aabb_extend_point(bounds, node->coords[i]);
+   }
+
+   node->primitive_id = id;
+   node->geometry_id_and_flags = data->geometry_id;
+
+   return true;
+}
+
+static bool
+lvp_bvh_load_aabb(const struct vk_bvh_geometry_data *data, uint32_t id,
+                  struct lvp_bvh_aabb_node *node, vk_aabb *bounds)
+{
+   const float *src = (const void *)(uintptr_t)(data->data + (uint64_t)id * data->stride);
+
+   /* An inactive AABB is one for which the minimum X coordinate is NaN. */
+   if (isnan(src[0]))
+      return false;
+
+   memcpy(bounds, src, sizeof(*bounds));
+
+   node->bounds = *bounds;
+   node->primitive_id = id;
+   node->geometry_id_and_flags = data->geometry_id;
+
+   return true;
+}
+
+static bool
+lvp_bvh_load_instance(const struct lvp_bvh_builder *builder, const struct vk_bvh_geometry_data *data,
+                      uint32_t id, struct lvp_bvh_instance_node *node, vk_aabb *bounds)
+{
+   const uint8_t *src = (const void *)(uintptr_t)(data->data + (uint64_t)id * data->stride);
+
+   /* arrayOfPointers */
+   if (data->stride == 8)
+      src = (const void *)(uintptr_t)*(const uint64_t *)src;
+
+   const VkAccelerationStructureInstanceKHR *instance = (const void *)src;
+
+   /* An instance without an acceleration structure is inactive. Instances
+    * without a mask can't be hit either, but they may only be dropped if
+    * they don't have to stay in the tree for updates.
+    */
+   if (!instance->accelerationStructureReference)
+      return false;
+   if (!instance->mask &&
+       !(builder->build->flags & VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR))
+      return false;
+
+   mat3x4 otw_matrix;
+   memcpy(otw_matrix.values, instance->transform.matrix, sizeof(otw_matrix.values));
+
+   node->bvh_ptr = instance->accelerationStructureReference;
+   node->custom_instance_and_mask = instance->instanceCustomIndex | ((uint32_t)instance->mask << 24);
+   node->sbt_offset_and_flags =
+      lvp_pack_sbt_offset_and_flags(instance->instanceShaderBindingTableRecordOffset,
+                                    instance->flags);
+   node->instance_id = id;
+   lvp_instance_node_set_transform(node, &otw_matrix);
+
+   const struct lvp_bvh_header *blas =
+      (const void *)(uintptr_t)instance->accelerationStructureReference;
+   const float *blas_min = aabb_min(&blas->bounds);
+   const float *blas_max = aabb_max(&blas->bounds);
+
+   float *min = &bounds->min.x;
+   float *max = &bounds->max.x;
+   for (uint32_t comp = 0; comp < 3; comp++) {
+      min[comp] = max[comp] = otw_matrix.values[comp][3];
+      for (uint32_t col = 0; col < 3; col++) {
+         float a = otw_matrix.values[comp][col] * blas_min[col];
+         float b = otw_matrix.values[comp][col] * blas_max[col];
+         min[comp] += MIN2(a, b);
+         max[comp] += MAX2(a, b);
+      }
+   }
+
+   return true;
+}
+
+static bool
+lvp_bvh_load_leaf(const struct lvp_bvh_builder *builder, const struct vk_bvh_geometry_data *data,
+                  uint32_t id, void *node, vk_aabb *bounds)
+{
+   switch (builder->build->geometry_type) {
+   case VK_GEOMETRY_TYPE_TRIANGLES_KHR:
+      return lvp_bvh_load_triangle(data, id, node, bounds);
+   case VK_GEOMETRY_TYPE_AABBS_KHR:
+      return lvp_bvh_load_aabb(data, id, node, bounds);
+   case VK_GEOMETRY_TYPE_INSTANCES_KHR:
+      return lvp_bvh_load_instance(builder, data, id, node, bounds);
+   default:
+      return false;
+   }
+}
+
+/* Loads the leaves of the task into the leaf nodes with the same index as
+ * the primitive. Inactive leaves get NaN bounds and are compacted later.
+ */
+static void
+lvp_bvh_gather_task(void *data, void *gdata, int thread_index)
+{
+   struct lvp_bvh_task *task = data;
+   const struct lvp_bvh_builder *builder = task->builder;
+   const struct lvp_cmd_build_as *build = builder->build;
+   uint32_t end = task->begin + task->count;
+
+   task->active_count = 0;
+   task->centroid_bounds[0] = lvp_bvh_empty_aabb;
+
+   for (uint32_t g = 0; g < build->geometry_count; g++) {
+      const struct lvp_bvh_geometry *geometry = &build->geometries[g];
+      uint32_t first_id = geometry->data.first_id;
+      uint32_t begin = MAX2(task->begin, first_id);
+      uint32_t last = MIN2(end, first_id + geometry->primitive_count);
+
+      for (uint32_t i = begin; i < last; i++) {
+         void *node = builder->output + builder->leaf_nodes_offset + i * builder->leaf_node_size;
+         vk_aabb *bounds = &builder->leaf_bounds[i];
+
+         /* The compaction relies on NaN bounds, so leaves whose bounds
+          * became NaN, e.g. from a transform, are dropped as well.
+          */
+         if (!lvp_bvh_load_leaf(builder, &geometry->data, i - first_id, node, bounds) ||
+             isnan(bounds->min.x)) {
+            *bounds = lvp_bvh_invalid_aabb;
+            continue;
+         }
+
+         float centroid[3];
+         aabb_centroid(bounds, centroid);
+         aabb_extend_point(&task->centroid_bounds[0], centroid);
+         task->active_count++;
+      }
+   }
+}
+
+/* Tasks */
+
+/* Splits [begin, begin + count) into tasks of at least LVP_BVH_TASK_SIZE
+ * leaves, at most one per thread.
+ */
+static uint32_t
+lvp_bvh_init_tasks(struct lvp_bvh_builder *builder, uint32_t begin, uint32_t count)
+{
+   uint32_t task_count = CLAMP(count / LVP_BVH_TASK_SIZE, 1, builder->max_task_count);
+
+   for (uint32_t i = 0; i < task_count; i++) {
+      struct lvp_bvh_task *task = &builder->tasks[i];
+      uint32_t task_begin = (uint64_t)count * i / task_count;
+      uint32_t task_end = (uint64_t)count * (i + 1) / task_count;
+
+      task->builder = builder;
+      task->begin = begin + task_begin;
+      task->count = task_end - task_begin;
+   }
+
+   return task_count;
+}
+
+/* Runs the first task on the calling thread and the others on the thread
+ * pool, and waits for all of them.
+ */
+static void
+lvp_bvh_run_tasks(struct lvp_bvh_builder *builder, uint32_t task_count,
+                  util_queue_execute_func execute)
+{
+   for (uint32_t i = 1; i < task_count; i++) {
+      util_queue_add_job(builder->queue, &builder->tasks[i], &builder->tasks[i].fence,
+                         execute, NULL, 0);
+   }
+
+   execute(&builder->tasks[0], NULL, 0);
+
+   for (uint32_t i = 1; i < task_count; i++)
+      util_queue_fence_wait(&builder->tasks[i].fence);
+}
+
+/* Splitting */
+
+static bool
+lvp_bvh_init_binning(const struct lvp_bvh_builder *builder, uint32_t count,
+                     const vk_aabb *centroid_bounds, struct lvp_bvh_binning *binning)
+{
+   bool splittable = false;
+
+   /* Small nodes don't need more bins than leaves. */
+   binning->bin_count = MIN2(builder->bin_count, count);
+   for (uint32_t axis = 0; axis < 3; axis++) {
+      float min = aabb_min(centroid_bounds)[axis];
+      float extent = aabb_max(centroid_bounds)[axis] - min;
+
+      binning->offset[axis] = min;
+      binning->scale[axis] = extent > 0.0f ? binning->bin_count / extent : 0.0f;
+      splittable |= extent > 0.0f;
+   }
+
+   return splittable;
+}
+
+static inline uint32_t
+lvp_bvh_bin_index(const struct lvp_bvh_binning *binning, uint32_t axis, float centroid)
+{
+   float bin = (centroid - binning->offset[axis]) * binning->scale[axis];
+
+   /* This also maps NaN to the first bin. */
+   return bin > 0.0f ? (uint32_t)MIN2(bin, binning->bin_count - 1) : 0;
+}
+
+static void
+lvp_bvh_bin_refs(const struct lvp_bvh_builder *builder, const struct lvp_bvh_ref *refs,
+                 uint32_t begin, uint32_t count, const struct lvp_bvh_binning *binning,
+                 struct lvp_bvh_bin bins[3][LVP_BVH_MAX_BINS])
+{
+   for (uint32_t axis = 0; axis < 3; axis++) {
+      for (uint32_t i = 0; i < binning->bin_count; i++) {
+         bins[axis][i].bounds = lvp_bvh_empty_aabb;
+         bins[axis][i].count = 0;
+      }
+   }
+
+   for (uint32_t i = begin; i < begin + count; i++) {
+      const vk_aabb *bounds = &refs[i].bounds;
+      float centroid[3];
+      aabb_centroid(bounds, centroid);
+
+      for (uint32_t axis = 0; axis < 3; axis++) {
+         struct lvp_bvh_bin *bin = &bins[axis][lvp_bvh_bin_index(binning, axis, centroid[axis])];
+         aabb_extend(&bin->bounds, bounds);
+         bin->count++;
+      }
+   }
+}
+
+/* Returns the split with the lowest SAH cost that doesn't exceed the
+ * depth limit.
+ */
+static bool
+lvp_bvh_find_split(const struct lvp_bvh_binning *binning, struct lvp_bvh_bin bins[3][LVP_BVH_MAX_BINS],
+                   uint32_t count, uint32_t max_child_count, struct lvp_bvh_split *split)
+{
+   float best_cost = INFINITY;
+
+   for (uint32_t axis = 0; axis < 3; axis++) {
+      if (binning->scale[axis] == 0.0f)
+         continue;
+
+      float right_cost[LVP_BVH_MAX_BINS];
+      vk_aabb right = lvp_bvh_empty_aabb;
+      uint32_t right_count = 0;
+      for (uint32_t i = binning->bin_count - 1; i > 0; i--) {
+         aabb_extend(&right, &bins[axis][i].bounds);
+         right_count += bins[axis][i].count;
+         right_cost[i - 1] = right_count ? aabb_half_area(&right) * right_count : 0.0f;
+      }
+
+      vk_aabb left = lvp_bvh_empty_aabb;
+      uint32_t left_count = 0;
+      for (uint32_t i = 0; i < binning->bin_count - 1; i++) {
+         aabb_extend(&left, &bins[axis][i].bounds);
+         left_count += bins[axis][i].count;
+
+         if (!left_count || left_count == count)
+            continue;
+         if (left_count > max_child_count || count - left_count > max_child_count)
+            continue;
+
+         float cost = aabb_half_area(&left) * left_count + right_cost[i];
+         if (cost < best_cost) {
+            best_cost = cost;
+            split->axis = axis;
+            split->bin = i;
+         }
+      }
+   }
+
+   return best_cost < INFINITY;
+}
+
+static void
+lvp_bvh_centroid_bounds(const struct lvp_bvh_builder *builder, const struct lvp_bvh_ref *refs,
+                        uint32_t begin, uint32_t count, vk_aabb *centroid_bounds)
+{
+   *centroid_bounds = lvp_bvh_empty_aabb;
+   for (uint32_t i = begin; i < begin + count; i++) {
+      float centroid[3];
+      aabb_centroid(&refs[i].bounds, centroid);
+      aabb_extend_point(centroid_bounds, centroid);
+   }
+}
+
+static inline float
+lvp_bvh_centroid(const struct lvp_bvh_ref *ref, uint32_t axis)
+{
+   return (aabb_min(&ref->bounds)[axis] + aabb_max(&ref->bounds)[axis]) * 0.5f;
+}
+
+/* Splits the leaves in half at the median centroid along the largest axis.
+ * Used when the leaves can't be binned, or when the SAH split would exceed
+ * the depth limit.
+ */
+static uint32_t
+lvp_bvh_split_median(const struct lvp_bvh_builder *builder, struct lvp_bvh_ref *refs, uint32_t begin,
+                     uint32_t count, const vk_aabb *centroid_bounds, vk_aabb child_centroid_bounds[2])
+{
+   uint32_t axis = aabb_largest_axis(centroid_bounds);
+   int32_t nth = begin + count / 2;
+   int32_t lo = begin;
+   int32_t hi = begin + count - 1;
+
+   while (lo < hi) {
+      float pivot = lvp_bvh_centroid(&refs[lo + (hi - lo) / 2], axis);
+      int32_t i = lo, j = hi;
+
+      while (i <= j) {
+         while (lvp_bvh_centroid(&refs[i], axis) < pivot)
+            i++;
+         while (lvp_bvh_centroid(&refs[j], axis) > pivot)
+            j--;
+         if (i <= j) {
+            struct lvp_bvh_ref tmp = refs[i];
+            refs[i++] = refs[j];
+            refs[j--] = tmp;
+         }
+      }
+
+      if (nth <= j)
+         hi = j;
+      else if (nth >= i)
+         lo = i;
+      else
+         break;
+   }
+
+   uint32_t left_count = count / 2;
+   lvp_bvh_centroid_bounds(builder, refs, begin, left_count, &child_centroid_bounds[0]);
+   lvp_bvh_centroid_bounds(builder, refs, begin + left_count, count - left_count,
+                           &child_centroid_bounds[1]);
+
+   return left_count;
+}
+
+/* Nodes at depth d can have at most 1 << (LVP_BVH_MAX_DEPTH - 1 - d) leaves,
+ * which keeps the tree within the traversal stack, see lvp_flatten_as.
+ */
+static inline uint32_t
+lvp_bvh_max_child_count(uint32_t depth)
+{
+   return depth < LVP_BVH_MAX_DEPTH - 2 ? 1u << (LVP_BVH_MAX_DEPTH - 2 - depth) : 1;
+}
+
+/* Partitions the leaves of a node in place, and returns the number of
+ * leaves of the left child.
+ */
+static uint32_t
+lvp_bvh_split(const struct lvp_bvh_builder *builder, struct lvp_bvh_ref *refs, uint32_t begin,
+              uint32_t count, const vk_aabb *centroid_bounds, uint32_t depth,
+              vk_aabb child_centroid_bounds[2])
+{
+   struct lvp_bvh_binning binning;
+   struct lvp_bvh_split split;
+   struct lvp_bvh_bin bins[3][LVP_BVH_MAX_BINS];
+
+   /* Any split of two leaves is as good as the other. */
+   if (count == 2 || !lvp_bvh_init_binning(builder, count, centroid_bounds, &binning))
+      return lvp_bvh_split_median(builder, refs, begin, count, centroid_bounds, child_centroid_bounds);
+
+   lvp_bvh_bin_refs(builder, refs, begin, count, &binning, bins);
+
+   if (!lvp_bvh_find_split(&binning, bins, count, lvp_bvh_max_child_count(depth), &split))
+      return lvp_bvh_split_median(builder, refs, begin, count, centroid_bounds, child_centroid_bounds);
+
+   child_centroid_bounds[0] = lvp_bvh_empty_aabb;
+   child_centroid_bounds[1] = lvp_bvh_empty_aabb;
+
+   uint32_t i = begin, j = begin + count;
+   while (i < j) {
+      struct lvp_bvh_ref ref = refs[i];
+      float centroid[3];
+      aabb_centroid(&ref.bounds, centroid);
+
+      if (lvp_bvh_bin_index(&binning, split.axis, centroid[split.axis]) <= split.bin) {
+         aabb_extend_point(&child_centroid_bounds[0], centroid);
+         i++;
+      } else {
+         aabb_extend_point(&child_centroid_bounds[1], centroid);
+         refs[i] = refs[--j];
+         refs[j] = ref;
+      }
+   }
+
+   return i - begin;
+}
+
+static void
+lvp_bvh_bin_task(void *data, void *gdata, int thread_index)
+{
+   struct lvp_bvh_task *task = data;
+   lvp_bvh_bin_refs(task->builder, task->refs, task->begin, task->count,
+                    &task->binning, task->bins);
+}
+
+static void
+lvp_bvh_partition_task(void *data, void *gdata, int thread_index)
+{
+   struct lvp_bvh_task *task = data;
+   uint32_t axis = task->split.axis;
+
+   task->centroid_bounds[0] = lvp_bvh_empty_aabb;
+   task->centroid_bounds[1] = lvp_bvh_empty_aabb;
+
+   uint32_t left = task->left_offset;
+   uint32_t right = task->right_offset;
+   for (uint32_t i = task->begin; i < task->begin + task->count; i++) {
+      const struct lvp_bvh_ref *ref = &task->refs[i];
+      float centroid[3];
+      aabb_centroid(&ref->bounds, centroid);
+
+      if (lvp_bvh_bin_index(&task->binning, axis, centroid[axis]) <= task->split.bin) {
+         aabb_extend_point(&task->centroid_bounds[0], centroid);
+         task->dst_refs[left++] = *ref;
+      } else {
+         aabb_extend_point(&task->centroid_bounds[1], centroid);
+         task->dst_refs[right++] = *ref;
+      }
+   }
+}
+
+/* Like lvp_bvh_split, but bins and partitions the leaves with all threads.
+ * The leaves are partitioned from refs into temp, and the array that holds
+ * the partitioned leaves is returned.
+ */
+static struct lvp_bvh_ref *
+lvp_bvh_split_parallel(struct lvp_bvh_builder *builder, struct lvp_bvh_ref *refs, struct lvp_bvh_ref *temp,
+                       uint32_t begin, uint32_t count, const vk_aabb *centroid_bounds,
+                       uint32_t depth, vk_aabb child_centroid_bounds[2], uint32_t *left_count)
+{
+   struct lvp_bvh_binning binning;
+   struct lvp_bvh_split split;
+   struct lvp_bvh_bin bins[3][LVP_BVH_MAX_BINS];
+
+   if (!lvp_bvh_init_binning(builder, count, centroid_bounds, &binning)) {
+      *left_count = lvp_bvh_split_median(builder, refs, begin, count, centroid_bounds,
+                                         child_centroid_bounds);
+      return refs;
+   }
+
+   uint32_t task_count = lvp_bvh_init_tasks(builder, begin, count);
+   for (uint32_t i = 0; i < task_count; i++) {
+      builder->tasks[i].refs = refs;
+      builder->tasks[i].binning = binning;
+   }
+
+   lvp_bvh_run_tasks(builder, task_count, lvp_bvh_bin_task);
+
+   for (uint32_t axis = 0; axis < 3; axis++) {
+      for (uint32_t b = 0; b < binning.bin_count; b++) {
+         bins[axis][b] = builder->tasks[0].bins[axis][b];
+         for (uint32_t i = 1; i < task_count; i++) {
+            aabb_extend(&bins[axis][b].bounds, &builder->tasks[i].bins[axis][b].bounds);
+            bins[axis][b].count += builder->tasks[i].bins[axis][b].count;
+         }
+      }
+   }
+
+   if (!lvp_bvh_find_split(&binning, bins, count, lvp_bvh_max_child_count(depth), &split)) {
+      *left_count = lvp_bvh_split_median(builder, refs, begin, count, centroid_bounds,
+                                         child_centroid_bounds);
+      return refs;
+   }
+
+   /* The bins of each task tell where its leaves go. */
+   *left_count = 0;
+   for (uint32_t b = 0; b <= split.bin; b++)
+      *left_count += bins[split.axis][b].count;
+
+   uint32_t left_offset = begin;
+   uint32_t right_offset = begin + *left_count;
+   for (uint32_t i = 0; i < task_count; i++) {
+      struct lvp_bvh_task *task = &builder->tasks[i];
+
+      uint32_t task_left_count = 0;
+      for (uint32_t b = 0; b <= split.bin; b++)
+         task_left_count += task->bins[split.axis][b].count;
+
+      task->split = split;
+      task->dst_refs = temp;
+      task->left_offset = left_offset;
+      task->right_offset = right_offset;
+
+      left_offset += task_left_count;
+      right_offset += task->count - task_left_count;
+   }
+
+   lvp_bvh_run_tasks(builder, task_count, lvp_bvh_partition_task);
+
+   child_centroid_bounds[0] = lvp_bvh_empty_aabb;
+   child_centroid_bounds[1] = lvp_bvh_empty_aabb;
+   for (uint32_t i = 0; i < task_count; i++) {
+      aabb_extend(&child_centroid_bounds[0], &builder->tasks[i].centroid_bounds[0]);
+      aabb_extend(&child_centroid_bounds[1], &builder->tasks[i].centroid_bounds[1]);
+   }
+
+   return temp;
+}
+
+/* Tree construction */
+
+static void
+lvp_bvh_build_subtree(const struct lvp_bvh_builder *builder, struct lvp_bvh_ref *refs, uint32_t begin,
+                      uint32_t count, const vk_aabb *centroid_bounds, uint32_t slot,
+                      uint32_t depth, vk_aabb *bounds);
+
+/* Builds child child_index of a node from the leaves [begin, begin + count)
+ * and writes its id and its bounds to the node.
+ */
+static void
+lvp_bvh_build_child(const struct lvp_bvh_builder *builder, struct lvp_bvh_ref *refs, uint32_t begin,
+                    uint32_t count, const vk_aabb *centroid_bounds, uint32_t slot, uint32_t depth,
+                    struct lvp_bvh_binary_node *node, uint32_t child_index)
+{
+   if (count == 1) {
+      node->children[child_index] = lvp_bvh_leaf_id(builder, refs[begin].leaf);
+      node->bounds[child_index] = refs[begin].bounds;
+      return;
+   }
+
+   node->children[child_index] = lvp_bvh_box_id(slot);
+   lvp_bvh_build_subtree(builder, refs, begin, count, centroid_bounds, slot, depth,
+                         &node->bounds[child_index]);
+}
+
+/* Builds the subtree of count > 1 leaves with its root at box node slot on
+ * the calling thread.
+ */
+static void
+lvp_bvh_build_subtree(const struct lvp_bvh_builder *builder, struct lvp_bvh_ref *refs, uint32_t begin,
+                      uint32_t count, const vk_aabb *centroid_bounds, uint32_t slot,
+                      uint32_t depth, vk_aabb *bounds)
+{
+   struct lvp_bvh_binary_node *node = lvp_bvh_box(builder, slot);
+   vk_aabb child_centroid_bounds[2];
+
+   uint32_t left_count = lvp_bvh_split(builder, refs, begin, count, centroid_bounds, depth,
+                                       child_centroid_bounds);
+
+   lvp_bvh_build_child(builder, refs, begin, left_count, &child_centroid_bounds[0],
+                       slot + 1, depth + 1, node, 0);
+   lvp_bvh_build_child(builder, refs, begin + left_count, count - left_count,
+                       &child_centroid_bounds[1], slot + left_count, depth + 1, node, 1);
+
+   *bounds = lvp_bvh_box_bounds(node);
+}
+
+static void
+lvp_bvh_subtree_job(void *data, void *gdata, int thread_index)
+{
+   struct lvp_bvh_job *job = data;
+   struct lvp_bvh_builder *builder = job->builder;
+
+   lvp_bvh_build_subtree(builder, job->refs, job->begin, job->count, &job->centroid_bounds,
+                         job->slot, job->depth, job->bounds);
+   free(job);
+
+   if (p_atomic_dec_zero(&builder->pending_jobs))
+      util_queue_fence_signal(&builder->jobs_done);
+}
+
+static void
+lvp_bvh_build_parallel(struct lvp_bvh_builder *builder, struct lvp_bvh_ref *refs, struct lvp_bvh_ref *temp,
+                       uint32_t begin, uint32_t count, const vk_aabb *centroid_bounds,
+                       uint32_t slot, uint32_t depth, vk_aabb *bounds)
+{
+   struct lvp_bvh_binary_node *node = lvp_bvh_box(builder, slot);
+   vk_aabb child_centroid_bounds[2];
+   uint32_t left_count;
+
+   struct lvp_bvh_ref *child_refs =
+      lvp_bvh_split_parallel(builder, refs, temp, begin, count, centroid_bounds, depth,
+                             child_centroid_bounds, &left_count);
+   struct lvp_bvh_ref *child_temp = child_refs == temp ? refs : temp;
+
+   struct lvp_bvh_parallel_node *parallel_node =
+      util_dynarray_grow(&builder->parallel_nodes, struct lvp_bvh_parallel_node, 1);
+   if (parallel_node)
+      *parallel_node = (struct lvp_bvh_parallel_node) { slot, bounds };
+   else
+      builder->failed = true;
+
+   uint32_t child_begin[2] = { begin, begin + left_count };
+   uint32_t child_count[2] = { left_count, count - left_count };
+   uint32_t child_slot[2] = { slot + 1, slot + left_count };
+
+   for (uint32_t i = 0; i < 2; i++) {
+      if (child_count[i] >= LVP_BVH_PARALLEL_NODE_SIZE) {
+         node->children[i] = lvp_bvh_box_id(child_slot[i]);
+         lvp_bvh_build_parallel(builder, child_refs, child_temp, child_begin[i], child_count[i],
+                                &child_centroid_bounds[i], child_slot[i], depth + 1,
+                                &node->bounds[i]);
+         continue;
+      }
+
+      struct lvp_bvh_job *job = child_count[i] > 1 ? malloc(sizeof(*job)) : NULL;
+      if (!job) {
+         lvp_bvh_build_child(builder, child_refs, child_begin[i], child_count[i],
+                             &child_centroid_bounds[i], child_slot[i], depth + 1, node, i);
+         continue;
+      }
+
+      *job = (struct lvp_bvh_job) {
+         .builder = builder,
+         .refs = child_refs,
+         .begin = child_begin[i],
+         .count = child_count[i],
+         .centroid_bounds = child_centroid_bounds[i],
+         .slot = child_slot[i],
+         .depth = depth + 1,
+         .bounds = &node->bounds[i],
+      };
+
+      node->children[i] = lvp_bvh_box_id(child_slot[i]);
+
+      p_atomic_inc(&builder->pending_jobs);
+      util_queue_add_job(builder->queue, job, NULL, lvp_bvh_subtree_job, NULL, 0);
+   }
+}
+
+/* Builds the tree over the leaves [0, leaf_count) into the box nodes and
+ * returns its bounds.
+ */
+static vk_aabb
+lvp_bvh_build_tree(struct lvp_bvh_builder *builder, uint32_t leaf_count,
+                   const vk_aabb *centroid_bounds)
+{
+   struct lvp_bvh_binary_node *root = lvp_bvh_box(builder, 0);
+   vk_aabb bounds = lvp_bvh_invalid_aabb;
+
+   if (leaf_count < 2) {
+      for (uint32_t i = 0; i < 2; i++) {
+         root->children[i] = LVP_BVH_INVALID_NODE;
+         root->bounds[i] = lvp_bvh_invalid_aabb;
+      }
+
+      if (leaf_count) {
+         root->children[0] = lvp_bvh_leaf_id(builder, 0);
+         root->bounds[0] = builder->leaf_bounds[0];
+         bounds = builder->leaf_bounds[0];
+      }
+
+      return bounds;
+   }
+
+   bool parallel = builder->queue && leaf_count >= LVP_BVH_PARALLEL_NODE_SIZE;
+   struct lvp_bvh_ref *refs = malloc(leaf_count * sizeof(struct lvp_bvh_ref) * (parallel ? 2 : 1));
+   if (!refs) {
+      builder->failed = true;
+      return bounds;
+   }
+
+   for (uint32_t i = 0; i < leaf_count; i++) {
+      refs[i].bounds = builder->leaf_bounds[i];
+      refs[i].leaf = i;
+   }
+
+   if (!parallel) {
+      lvp_bvh_build_subtree(builder, refs, 0, leaf_count, centroid_bounds, 0, 0, &bounds);
+      free(refs);
+      return bounds;
+   }
+
+   util_dynarray_init(&builder->parallel_nodes, NULL);
+   util_queue_fence_init(&builder->jobs_done);
+   util_queue_fence_reset(&builder->jobs_done);
+   builder->pending_jobs = 1;
+
+   lvp_bvh_build_parallel(builder, refs, refs + leaf_count, 0, leaf_count, centroid_bounds,
+                          0, 0, &bounds);
+
+   if (p_atomic_dec_zero(&builder->pending_jobs))
+      util_queue_fence_signal(&builder->jobs_done);
+   util_queue_fence_wait(&builder->jobs_done);
+   util_queue_fence_destroy(&builder->jobs_done);
+
+   /* The nodes were recorded in pre-order, so the children come first when
+    * walking the list backwards.
+    */
+   util_dynarray_foreach_reverse(&builder->parallel_nodes, struct lvp_bvh_parallel_node, node)
+      *node->bounds = lvp_bvh_box_bounds(lvp_bvh_box(builder, node->slot));
+
+   util_dynarray_fini(&builder->parallel_nodes);
+   free(refs);
+
+   return bounds;
+}
+
+/* Refits the bounds of the box nodes of an existing tree to the leaves and
+ * returns the bounds of the tree. Children are always stored after their
+ * parent, so walking the box nodes backwards visits them first.
+ */
+static vk_aabb
+lvp_bvh_refit(const struct lvp_bvh_builder *builder, uint32_t box_count)
+{
+   uint32_t box_node_size = lvp_bvh_box_node_size(builder->width);
+   uint8_t *boxes = builder->output + LVP_BVH_ROOT_NODE_OFFSET;
+
+   for (int32_t slot = box_count - 1; slot >= 0; slot--) {
+      uint8_t *node = boxes + slot * box_node_size;
+      const uint32_t *children = lvp_bvh_box_children(node, builder->width);
+
+      for (uint32_t i = 0; i < builder->width; i++) {
+         uint32_t child = children[i];
+         if (child == LVP_BVH_INVALID_NODE)
+            continue;
+
+         uint32_t offset = child & ~3u;
+         vk_aabb bounds;
+         if ((child & 3) == lvp_bvh_node_internal) {
+            bounds = lvp_bvh_wide_box_bounds(builder, builder->output + offset);
+         } else {
+            uint32_t leaf = (offset - builder->leaf_nodes_offset) / builder->leaf_node_size;
+            bounds = builder->leaf_bounds[leaf];
+         }
+         lvp_bvh_box_set_child_bounds(node, builder->width, i, &bounds);
+      }
+   }
+
+   return lvp_bvh_wide_box_bounds(builder, boxes);
+}
+
+/* Writes an acceleration structure without any leaves, which is used when
+ * the build fails so that traversal never follows uninitialized nodes.
+ */
+static void
+lvp_bvh_init_empty(const struct lvp_bvh_builder *builder)
+{
+   struct lvp_bvh_header *header = (void *)builder->output;
+   uint8_t *root = builder->output + LVP_BVH_ROOT_NODE_OFFSET;
+   uint32_t *children = lvp_bvh_box_children(root, builder->width);
+
+   for (uint32_t i = 0; i < builder->width; i++) {
+      children[i] = LVP_BVH_INVALID_NODE;
+      lvp_bvh_box_set_child_bounds(root, builder->width, i, &lvp_bvh_invalid_aabb);
+   }
+
+   header->bounds = lvp_bvh_invalid_aabb;
+   header->instance_count = 0;
+   /* No update matches this, so the tree is rebuilt by the next update. */
+   header->leaf_nodes_offset = 0;
+   header->box_node_count = 1;
+   header->serialization_size = sizeof(struct lvp_accel_struct_serialization_header) +
+                                builder->build->dst->size;
+}
+
+static uint32_t
+lvp_bvh_leaf_nodes_offset(uint32_t width, uint32_t leaf_count)
+{
+   return LVP_BVH_ROOT_NODE_OFFSET +
+          lvp_bvh_max_box_node_count(width, leaf_count) * lvp_bvh_box_node_size(width);
+}
+
+void
+lvp_build_as(struct lvp_device *device, const struct lvp_cmd_build_as *build)
+{
+   struct lvp_bvh_builder builder = {
+      .build = build,
+      .queue = util_queue_is_initialized(&device->bvh_queue) ? &device->bvh_queue : NULL,
+      .output = (void *)(uintptr_t)vk_acceleration_structure_get_va(build->dst),
+      .width = device->bvh_width,
+      .bin_count = build->flags & VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_BUILD_BIT_KHR
+                   ? LVP_BVH_FAST_BUILD_BINS : LVP_BVH_MAX_BINS,
+   };
+   struct lvp_bvh_header *header = (void *)builder.output;
+
+   switch (build->geometry_type) {
+   case VK_GEOMETRY_TYPE_TRIANGLES_KHR:
+      builder.leaf_node_size = sizeof(struct lvp_bvh_triangle_node);
+      builder.leaf_type = lvp_bvh_node_triangle;
+      break;
+   case VK_GEOMETRY_TYPE_AABBS_KHR:
+      builder.leaf_node_size = sizeof(struct lvp_bvh_aabb_node);
+      builder.leaf_type = lvp_bvh_node_aabb;
+      break;
+   case VK_GEOMETRY_TYPE_INSTANCES_KHR:
+      builder.leaf_node_size = sizeof(struct lvp_bvh_instance_node);
+      builder.leaf_type = lvp_bvh_node_instance;
+      break;
+   default:
+      break;
+   }
+
+   builder.max_task_count = builder.queue ? builder.queue->num_threads + 1 : 1;
+   builder.tasks = calloc(builder.max_task_count, sizeof(struct lvp_bvh_task));
+   builder.leaf_bounds = malloc(MAX2(build->leaf_count, 1) * sizeof(vk_aabb));
+   if (!builder.tasks || !builder.leaf_bounds) {
+      builder.failed = true;
+      goto out;
+   }
+
+   for (uint32_t i = 0; i < builder.max_task_count; i++)
+      util_queue_fence_init(&builder.tasks[i].fence);
+
+   /* The leaves are loaded to the location they would have if all of them
+    * were active, which is past the box nodes of any smaller tree.
+    */
+   builder.leaf_nodes_offset = lvp_bvh_leaf_nodes_offset(builder.width, build->leaf_count);
+
+   uint32_t task_count = lvp_bvh_init_tasks(&builder, 0, build->leaf_count);
+   lvp_bvh_run_tasks(&builder, task_count, lvp_bvh_gather_task);
+
+   uint32_t leaf_count = 0;
+   vk_aabb centroid_bounds = lvp_bvh_empty_aabb;
+   for (uint32_t i = 0; i < task_count; i++) {
+      leaf_count += builder.tasks[i].active_count;
+      aabb_extend(&centroid_bounds, &builder.tasks[i].centroid_bounds[0]);
+   }
+
+   /* Compact the active leaves. Leaves only ever move towards the start of
+    * the acceleration structure, so this can be done in place.
+    */
+   uint32_t leaf_nodes_offset = lvp_bvh_leaf_nodes_offset(builder.width, leaf_count);
+   if (leaf_count < build->leaf_count) {
+      uint32_t dst = 0;
+      for (uint32_t src = 0; src < build->leaf_count; src++) {
+         if (isnan(builder.leaf_bounds[src].min.x))
+            continue;
+
+         memmove(builder.output + leaf_nodes_offset + dst * builder.leaf_node_size,
+                 builder.output + builder.leaf_nodes_offset + src * builder.leaf_node_size,
+                 builder.leaf_node_size);
+         builder.leaf_bounds[dst++] = builder.leaf_bounds[src];
+      }
+      builder.leaf_nodes_offset = leaf_nodes_offset;
+   }
+
+   /* An update has to have the same active primitives as the source, if it
+    * doesn't the tree is rebuilt.
+    */
+   const struct lvp_bvh_header *src_header = build->src ?
+      (const void *)(uintptr_t)vk_acceleration_structure_get_va(build->src) : NULL;
+
+   if (src_header && src_header->leaf_nodes_offset == leaf_nodes_offset) {
+      if (build->src != build->dst)
+         memcpy(builder.output, src_header, leaf_nodes_offset);
+
+      header->bounds = lvp_bvh_refit(&builder, src_header->box_node_count);
+   } else {
+      builder.tree = malloc(LVP_BVH_ROOT_NODE_OFFSET +
+                            (MAX2(leaf_count, 2) - 1) * sizeof(struct lvp_bvh_binary_node));
+      if (!builder.tree) {
+         builder.failed = true;
+         goto out;
+      }
+
+      header->bounds = lvp_bvh_build_tree(&builder, leaf_count, &centroid_bounds);
+      if (builder.failed)
+         goto out;
+
+      header->box_node_count = lvp_bvh_collapse(builder.width, builder.tree, builder.output);
+   }
+
+   header->instance_count =
+      build->geometry_type == VK_GEOMETRY_TYPE_INSTANCES_KHR ? leaf_count : 0;
+   header->leaf_nodes_offset = leaf_nodes_offset;
+   header->serialization_size = sizeof(struct lvp_accel_struct_serialization_header) +
+                                sizeof(uint64_t) * header->instance_count + build->dst->size;
+
+out:
+   if (builder.failed)
+      lvp_bvh_init_empty(&builder);
+
+   if (builder.tasks) {
+      for (uint32_t i = 0; i < builder.max_task_count; i++)
+         util_queue_fence_destroy(&builder.tasks[i].fence);
+   }
+   free(builder.tasks);
+   free(builder.leaf_bounds);
+   free(builder.tree);
+}
+
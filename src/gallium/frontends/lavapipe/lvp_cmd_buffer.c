@@ -28,10 +28,14 @@
 #include "vk_common_entrypoints.h"
 
 static void
-lvp_cmd_buffer_destroy(struct vk_command_buffer *cmd_buffer)
+lvp_cmd_buffer_destroy(struct vk_command_buffer *vk_cmd_buffer)
 {
-   vk_command_buffer_finish(cmd_buffer);
-   vk_free(&cmd_buffer->pool->alloc, cmd_buffer);
+   struct lvp_cmd_buffer *cmd_buffer =
+      container_of(vk_cmd_buffer, struct lvp_cmd_buffer, vk);
+
+   util_dynarray_fini(&cmd_buffer->cmd_stream);
+   vk_command_buffer_finish(vk_cmd_buffer);
+   vk_free(&vk_cmd_buffer->pool->alloc, cmd_buffer);
 }
 
 static VkResult
@@ -56,6 +60,7 @@ lvp_create_cmd_buffer(struct vk_command_pool *pool,
    }
 
    cmd_buffer->device = device;
+   util_dynarray_init(&cmd_buffer->cmd_stream, NULL);
 
    *cmd_buffer_out = &cmd_buffer->vk;
 
@@ -66,6 +71,10 @@ static void
 lvp_reset_cmd_buffer(struct vk_command_buffer *vk_cmd_buffer,
                      UNUSED VkCommandBufferResetFlags flags)
 {
+   struct lvp_cmd_buffer *cmd_buffer =
+      container_of(vk_cmd_buffer, struct lvp_cmd_buffer, vk);
+
+   util_dynarray_clear(&cmd_buffer->cmd_stream);
    vk_command_buffer_reset(vk_cmd_buffer);
 }
 
@@ -82,6 +91,7 @@ VKAPI_ATTR VkResult VKAPI_CALL lvp_BeginCommandBuffer(
    LVP_FROM_HANDLE(lvp_cmd_buffer, cmd_buffer, commandBuffer);
 
    vk_command_buffer_begin(&cmd_buffer->vk, pBeginInfo);
+   cmd_buffer->usage_flags = pBeginInfo->flags;
 
    return VK_SUCCESS;
 }
@@ -91,5 +101,9 @@ VKAPI_ATTR VkResult VKAPI_CALL lvp_EndCommandBuffer(
 {
    LVP_FROM_HANDLE(lvp_cmd_buffer, cmd_buffer, commandBuffer);
 
-   return vk_command_buffer_end(&cmd_buffer->vk);
+   VkResult result = vk_command_buffer_end(&cmd_buffer->vk);
+   if (result == VK_SUCCESS)
+      lvp_compile_cmd_buffer(cmd_buffer);
+
+   return result;
 }
@@ -188,7 +188,7 @@ VKAPI_ATTR VkResult VKAPI_CALL lvp_CreateDescriptorSetLayout(
 
    if (set_layout->binding_count == set_layout->immutable_sampler_count) {
       /* create a bindable set with all the immutable samplers */
-      lvp_descriptor_set_create(device, set_layout, &set_layout->immutable_set);
+      lvp_descriptor_set_create(device, set_layout, NULL, &set_layout->immutable_set);
       vk_descriptor_set_layout_unref(&device->vk, &set_layout->vk);
       set_layout->vk.destroy = lvp_descriptor_set_layout_destroy;
    }
@@ -315,47 +315,68 @@ get_image_handle_bda(struct lvp_device *device, VkDeviceAddress address, size_t
    return *handle;
 }
 
-VkResult
-lvp_descriptor_set_create(struct lvp_device *device,
-                          struct lvp_descriptor_set_layout *layout,
-                          struct lvp_descriptor_set **out_set)
-{
-   struct lvp_descriptor_set *set = vk_zalloc(&device->vk.alloc /* XXX: Use the pool */,
-      sizeof(struct lvp_descriptor_set), 8, VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
-   if (!set)
-      return vk_error(device, VK_ERROR_OUT_OF_HOST_MEMORY);
-
-   vk_object_base_init(&device->vk, &set->base,
-                       VK_OBJECT_TYPE_DESCRIPTOR_SET);
-   set->layout = layout;
-   vk_descriptor_set_layout_ref(&layout->vk);
+/* util_vma_heap can't hand out offset 0, so the arena starts at this offset. */
+#define POOL_HEAP_OFFSET 64
+#define DESCRIPTOR_SET_ALIGNMENT 64
+/* Sets which don't fit into the arena get their own buffer. */
+#define MAX_POOL_ARENA_SIZE (256 * 1024 * 1024)
 
+static uint32_t
+descriptor_set_bo_size(const struct lvp_descriptor_set_layout *layout)
+{
    uint64_t bo_size = layout->size * sizeof(struct lp_descriptor);
 
    for (unsigned i = 0; i < layout->binding_count; i++)
       bo_size += layout->binding[i].uniform_block_size;
 
-   bo_size = MAX2(bo_size, 64);
+   return MAX2(bo_size, 64);
+}
 
+static struct pipe_resource *
+descriptor_bo_create(struct lvp_device *device, uint64_t size,
+                     struct pipe_memory_allocation **pmem, void **map)
+{
    struct pipe_resource template = {
       .bind = PIPE_BIND_CONSTANT_BUFFER,
       .screen = device->pscreen,
       .target = PIPE_BUFFER,
       .format = PIPE_FORMAT_R8_UNORM,
-      .width0 = bo_size,
+      .width0 = size,
       .height0 = 1,
       .depth0 = 1,
       .array_size = 1,
       .flags = PIPE_RESOURCE_FLAG_DONT_OVER_ALLOCATE,
    };
 
-   set->bo = device->pscreen->resource_create_unbacked(device->pscreen, &template, &bo_size);
-   set->pmem = device->pscreen->allocate_memory(device->pscreen, bo_size);
+   struct pipe_resource *bo = device->pscreen->resource_create_unbacked(device->pscreen, &template, &size);
+   if (!bo)
+      return NULL;
+
+   *pmem = device->pscreen->allocate_memory(device->pscreen, size);
+   if (!*pmem) {
+      pipe_resource_reference(&bo, NULL);
+      return NULL;
+   }
+
+   *map = device->pscreen->map_memory(device->pscreen, *pmem);
 
-   set->map = device->pscreen->map_memory(device->pscreen, set->pmem);
-   memset(set->map, 0, bo_size);
+   device->pscreen->resource_bind_backing(device->pscreen, bo, *pmem, 0, 0, 0);
 
-   device->pscreen->resource_bind_backing(device->pscreen, set->bo, set->pmem, 0, 0, 0);
+   return bo;
+}
+
+/* Initializes a set whose descriptor memory is already set up. */
+static void
+descriptor_set_init(struct lvp_device *device,
+                    struct lvp_descriptor_set_layout *layout,
+                    struct lvp_descriptor_set *set)
+{
+   vk_object_base_init(&device->vk, &set->base,
+                       VK_OBJECT_TYPE_DESCRIPTOR_SET);
+   set->layout = layout;
+   vk_descriptor_set_layout_ref(&layout->vk);
+
+   memset(set->map, 0, set->bo_size);
 
    for (uint32_t binding_index = 0; binding_index < layout->binding_count; binding_index++) {
       const struct lvp_descriptor_set_binding_layout *bind_layout = &set->layout->binding[binding_index];
@@ -374,6 +395,42 @@ lvp_descriptor_set_create(struct lvp_device *device,
          }
       }
    }
+}
+
+/**
+ * Creates a set outside of a descriptor pool.  If uploader is set, the
+ * descriptors are sub-allocated from it, which is how the transient sets of
+ * push descriptors and dynamic offsets are created.  Otherwise the set gets
+ * its own buffer.
+ */
+VkResult
+lvp_descriptor_set_create(struct lvp_device *device,
+                          struct lvp_descriptor_set_layout *layout,
+                          struct u_upload_mgr *uploader,
+                          struct lvp_descriptor_set **out_set)
+{
+   struct lvp_descriptor_set *set = vk_zalloc(&device->vk.alloc,
+      sizeof(struct lvp_descriptor_set), 8, VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+   if (!set)
+      return vk_error(device, VK_ERROR_OUT_OF_HOST_MEMORY);
+
+   set->bo_size = descriptor_set_bo_size(layout);
+
+   if (uploader) {
+      unsigned offset;
+      u_upload_alloc(uploader, 0, set->bo_size, DESCRIPTOR_SET_ALIGNMENT,
+                     &offset, &set->bo, &set->map);
+      set->bo_offset = offset;
+   } else {
+      set->bo = descriptor_bo_create(device, set->bo_size, &set->pmem, &set->map);
+   }
+
+   if (!set->bo) {
+      vk_free(&device->vk.alloc, set);
+      return vk_error(device, VK_ERROR_OUT_OF_DEVICE_MEMORY);
+   }
+
+   descriptor_set_init(device, layout, set);
 
    *out_set = set;
 
@@ -385,14 +442,63 @@ lvp_descriptor_set_destroy(struct lvp_device *device,
                            struct lvp_descriptor_set *set)
 {
    pipe_resource_reference(&set->bo, NULL);
-   device->pscreen->unmap_memory(device->pscreen, set->pmem);
-   device->pscreen->free_memory(device->pscreen, set->pmem);
+   if (set->pmem) {
+      device->pscreen->unmap_memory(device->pscreen, set->pmem);
+      device->pscreen->free_memory(device->pscreen, set->pmem);
+   }
 
    vk_descriptor_set_layout_unref(&device->vk, &set->layout->vk);
    vk_object_base_finish(&set->base);
    vk_free(&device->vk.alloc, set);
 }
 
+static VkResult
+descriptor_pool_alloc_set(struct lvp_device *device,
+                          struct lvp_descriptor_pool *pool,
+                          struct lvp_descriptor_set_layout *layout,
+                          struct lvp_descriptor_set **out_set)
+{
+   uint32_t bo_size = descriptor_set_bo_size(layout);
+
+   uint64_t offset = 0;
+   if (pool->bo)
+      offset = util_vma_heap_alloc(&pool->heap, bo_size, DESCRIPTOR_SET_ALIGNMENT);
+
+   /* The arena is full or too fragmented. */
+   if (!offset)
+      return lvp_descriptor_set_create(device, layout, NULL, out_set);
+
+   struct lvp_descriptor_set *set = vk_zalloc(&device->vk.alloc,
+      sizeof(struct lvp_descriptor_set), 8, VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+   if (!set) {
+      util_vma_heap_free(&pool->heap, offset, bo_size);
+      return vk_error(device, VK_ERROR_OUT_OF_HOST_MEMORY);
+   }
+
+   pipe_resource_reference(&set->bo, pool->bo);
+   set->bo_offset = offset - POOL_HEAP_OFFSET;
+   set->bo_size = bo_size;
+   set->map = (uint8_t *)pool->map + set->bo_offset;
+
+   descriptor_set_init(device, layout, set);
+
+   *out_set = set;
+
+   return VK_SUCCESS;
+}
+
+static void
+descriptor_pool_free_set(struct lvp_device *device,
+                         struct lvp_descriptor_pool *pool,
+                         struct lvp_descriptor_set *set)
+{
+   if (set->bo == pool->bo)
+      util_vma_heap_free(&pool->heap, set->bo_offset + POOL_HEAP_OFFSET, set->bo_size);
+
+   list_del(&set->link);
+   lvp_descriptor_set_destroy(device, set);
+}
+
 VKAPI_ATTR VkResult VKAPI_CALL lvp_AllocateDescriptorSets(
     VkDevice                                    _device,
     const VkDescriptorSetAllocateInfo*          pAllocateInfo,
@@ -408,7 +514,7 @@ VKAPI_ATTR VkResult VKAPI_CALL lvp_AllocateDescriptorSets(
       LVP_FROM_HANDLE(lvp_descriptor_set_layout, layout,
                       pAllocateInfo->pSetLayouts[i]);
 
-      result = lvp_descriptor_set_create(device, layout, &set);
+      result = descriptor_pool_alloc_set(device, pool, layout, &set);
       if (result != VK_SUCCESS)
          break;
 
@@ -430,13 +536,13 @@ VKAPI_ATTR VkResult VKAPI_CALL lvp_FreeDescriptorSets(
     const VkDescriptorSet*                      pDescriptorSets)
 {
    LVP_FROM_HANDLE(lvp_device, device, _device);
+   LVP_FROM_HANDLE(lvp_descriptor_pool, pool, descriptorPool);
    for (uint32_t i = 0; i < count; i++) {
       LVP_FROM_HANDLE(lvp_descriptor_set, set, pDescriptorSets[i]);
 
       if (!set)
          continue;
-      list_del(&set->link);
-      lvp_descriptor_set_destroy(device, set);
+      descriptor_pool_free_set(device, pool, set);
    }
    return VK_SUCCESS;
 }
@@ -688,7 +794,37 @@ VKAPI_ATTR VkResult VKAPI_CALL lvp_CreateDescriptorPool(
    vk_object_base_init(&device->vk, &pool->base,
                        VK_OBJECT_TYPE_DESCRIPTOR_POOL);
    pool->flags = pCreateInfo->flags;
+   pool->max_sets = pCreateInfo->maxSets;
    list_inithead(&pool->sets);
+
+   uint64_t arena_size = 0;
+   for (uint32_t i = 0; i < pCreateInfo->poolSizeCount; i++) {
+      const VkDescriptorPoolSize *pool_size = &pCreateInfo->pPoolSizes[i];
+
+      /* The size of inline uniform blocks is in bytes. */
+      if (pool_size->type == VK_DESCRIPTOR_TYPE_INLINE_UNIFORM_BLOCK)
+         arena_size += pool_size->descriptorCount;
+      else
+         arena_size += (uint64_t)pool_size->descriptorCount * sizeof(struct lp_descriptor);
+   }
+
+   const VkDescriptorPoolInlineUniformBlockCreateInfo *inline_info =
+      vk_find_struct_const(pCreateInfo->pNext, DESCRIPTOR_POOL_INLINE_UNIFORM_BLOCK_CREATE_INFO);
+   if (inline_info)
+      arena_size += inline_info->maxInlineUniformBlockBindings * sizeof(struct lp_descriptor);
+
+   /* Room for the alignment and the minimum size of each set. */
+   arena_size += (uint64_t)pCreateInfo->maxSets * DESCRIPTOR_SET_ALIGNMENT;
+   arena_size = MIN2(arena_size, MAX_POOL_ARENA_SIZE);
+
+   /* Without an arena every set gets its own buffer. */
+   pool->bo = descriptor_bo_create(device, arena_size, &pool->pmem, &pool->map);
+   if (pool->bo) {
+      pool->size = arena_size;
+      util_vma_heap_init(&pool->heap, POOL_HEAP_OFFSET, pool->size);
+      pool->heap.alloc_high = false;
+   }
+
    *pDescriptorPool = lvp_descriptor_pool_to_handle(pool);
    return VK_SUCCESS;
 }
@@ -701,6 +837,13 @@ static void lvp_reset_descriptor_pool(struct lvp_device *device,
       list_del(&set->link);
       lvp_descriptor_set_destroy(device, set);
    }
+
+   /* Drop all the sub-allocations at once. */
+   if (pool->bo) {
+      util_vma_heap_finish(&pool->heap);
+      util_vma_heap_init(&pool->heap, POOL_HEAP_OFFSET, pool->size);
+      pool->heap.alloc_high = false;
+   }
 }
 
 VKAPI_ATTR void VKAPI_CALL lvp_DestroyDescriptorPool(
@@ -715,6 +858,12 @@ VKAPI_ATTR void VKAPI_CALL lvp_DestroyDescriptorPool(
       return;
 
    lvp_reset_descriptor_pool(device, pool);
+   if (pool->bo) {
+      util_vma_heap_finish(&pool->heap);
+      pipe_resource_reference(&pool->bo, NULL);
+      device->pscreen->unmap_memory(device->pscreen, pool->pmem);
+      device->pscreen->free_memory(device->pscreen, pool->pmem);
+   }
    vk_object_base_finish(&pool->base);
    vk_free2(&device->vk.alloc, pAllocator, pool);
 }
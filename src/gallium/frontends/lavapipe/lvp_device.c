@@ -1503,25 +1503,34 @@ VKAPI_ATTR void VKAPI_CALL lvp_GetPhysicalDeviceQueueFamilyProperties2(
 {
    VK_OUTARRAY_MAKE_TYPED(VkQueueFamilyProperties2, out, pQueueFamilyProperties, pCount);
 
-   VkQueueFamilyGlobalPriorityPropertiesKHR *prio = vk_find_struct(pQueueFamilyProperties, QUEUE_FAMILY_GLOBAL_PRIORITY_PROPERTIES_KHR);
-   if (prio) {
-      prio->priorityCount = 4;
-      prio->priorities[0] = VK_QUEUE_GLOBAL_PRIORITY_LOW_KHR;
-      prio->priorities[1] = VK_QUEUE_GLOBAL_PRIORITY_MEDIUM_KHR;
-      prio->priorities[2] = VK_QUEUE_GLOBAL_PRIORITY_HIGH_KHR;
-      prio->priorities[3] = VK_QUEUE_GLOBAL_PRIORITY_REALTIME_KHR;
-   }
+   const VkQueueFlags queue_flags[LVP_QUEUE_FAMILY_COUNT] = {
+      VK_QUEUE_GRAPHICS_BIT |
+      VK_QUEUE_COMPUTE_BIT |
+      VK_QUEUE_TRANSFER_BIT |
+      (DETECT_OS_LINUX ? VK_QUEUE_SPARSE_BINDING_BIT : 0),
+      /* for async compute */
+      VK_QUEUE_COMPUTE_BIT |
+      VK_QUEUE_TRANSFER_BIT,
+   };
 
-   vk_outarray_append_typed(VkQueueFamilyProperties2, &out, p) {
-      p->queueFamilyProperties = (VkQueueFamilyProperties) {
-         .queueFlags = VK_QUEUE_GRAPHICS_BIT |
-         VK_QUEUE_COMPUTE_BIT |
-         VK_QUEUE_TRANSFER_BIT |
-         (DETECT_OS_LINUX ? VK_QUEUE_SPARSE_BINDING_BIT : 0),
-         .queueCount = 1,
-         .timestampValidBits = 64,
-         .minImageTransferGranularity = (VkExtent3D) { 1, 1, 1 },
-      };
+   for (uint32_t i = 0; i < LVP_QUEUE_FAMILY_COUNT; i++) {
+      vk_outarray_append_typed(VkQueueFamilyProperties2, &out, p) {
+         p->queueFamilyProperties = (VkQueueFamilyProperties) {
+            .queueFlags = queue_flags[i],
+            .queueCount = LVP_MAX_QUEUES_PER_FAMILY,
+            .timestampValidBits = 64,
+            .minImageTransferGranularity = (VkExtent3D) { 1, 1, 1 },
+         };
+
+         VkQueueFamilyGlobalPriorityPropertiesKHR *prio = vk_find_struct(p, QUEUE_FAMILY_GLOBAL_PRIORITY_PROPERTIES_KHR);
+         if (prio) {
+            prio->priorityCount = 4;
+            prio->priorities[0] = VK_QUEUE_GLOBAL_PRIORITY_LOW_KHR;
+            prio->priorities[1] = VK_QUEUE_GLOBAL_PRIORITY_MEDIUM_KHR;
+            prio->priorities[2] = VK_QUEUE_GLOBAL_PRIORITY_HIGH_KHR;
+            prio->priorities[3] = VK_QUEUE_GLOBAL_PRIORITY_REALTIME_KHR;
+         }
+      }
    }
 }
 
@@ -1614,13 +1623,17 @@ VKAPI_ATTR PFN_vkVoidFunction VKAPI_CALL vk_icdGetInstanceProcAddr(
 }
 
 static void
-destroy_pipelines(struct lvp_queue *queue)
+destroy_pipelines(struct lvp_device *device)
 {
-   simple_mtx_lock(&queue->lock);
-   while (util_dynarray_contains(&queue->pipeline_destroys, struct lvp_pipeline*)) {
-      lvp_pipeline_destroy(queue->device, util_dynarray_pop(&queue->pipeline_destroys, struct lvp_pipeline*), true);
-   }
-   simple_mtx_unlock(&queue->lock);
+   simple_mtx_lock(&device->pipeline_destroys_lock);
+   struct util_dynarray destroys = device->pipeline_destroys;
+   util_dynarray_init(&device->pipeline_destroys, NULL);
+   simple_mtx_unlock(&device->pipeline_destroys_lock);
+
+   /* Takes the locks of the queues, which may still be executing. */
+   util_dynarray_foreach(&destroys, struct lvp_pipeline *, pipeline)
+      lvp_pipeline_destroy(device, *pipeline, false);
+   util_dynarray_fini(&destroys);
 }
 
 static VkResult
@@ -1672,7 +1685,7 @@ lvp_queue_submit(struct vk_queue *vk_queue,
          vk_sync_as_lvp_pipe_sync(submit->signals[i].sync);
       lvp_pipe_sync_signal_with_fence(queue->device, sync, queue->last_fence);
    }
-   destroy_pipelines(queue);
+   destroy_pipelines(queue->device);
 
    return VK_SUCCESS;
 }
@@ -1694,33 +1707,89 @@ lvp_queue_init(struct lvp_device *device, struct lvp_queue *queue,
    }
 
    queue->device = device;
+   queue->index = device->queue_count;
 
    queue->ctx = device->pscreen->context_create(device->pscreen, NULL, PIPE_CONTEXT_ROBUST_BUFFER_ACCESS);
    queue->cso = cso_create_context(queue->ctx, CSO_NO_VBUF);
    queue->uploader = u_upload_create(queue->ctx, 1024 * 1024, PIPE_BIND_CONSTANT_BUFFER, PIPE_USAGE_STREAM, 0);
 
+   nir_builder b = nir_builder_init_simple_shader(MESA_SHADER_FRAGMENT, device->physical_device->drv_options[MESA_SHADER_FRAGMENT], "dummy_frag");
+   struct pipe_shader_state shstate = {0};
+   shstate.type = PIPE_SHADER_IR_NIR;
+   shstate.ir.nir = b.shader;
+   queue->noop_fs = queue->ctx->create_fs_state(queue->ctx, &shstate);
+
    queue->vk.driver_submit = lvp_queue_submit;
 
    simple_mtx_init(&queue->lock, mtx_plain);
-   util_dynarray_init(&queue->pipeline_destroys, NULL);
 
    return VK_SUCCESS;
 }
 
+/* The submit thread is stopped separately by vk_queue_finish(). */
 static void
 lvp_queue_finish(struct lvp_queue *queue)
 {
-   vk_queue_finish(&queue->vk);
-
-   destroy_pipelines(queue);
    simple_mtx_destroy(&queue->lock);
-   util_dynarray_fini(&queue->pipeline_destroys);
 
+   if (queue->last_fence)
+      queue->device->pscreen->fence_reference(queue->device->pscreen, &queue->last_fence, NULL);
+
+   queue->ctx->delete_fs_state(queue->ctx, queue->noop_fs);
    u_upload_destroy(queue->uploader);
    cso_destroy_context(queue->cso);
    queue->ctx->destroy(queue->ctx);
 }
 
+static void
+lvp_device_finish_queues(struct lvp_device *device)
+{
+   for (uint32_t i = device->queue_count; i-- > 1;) {
+      lvp_queue_finish(device->queues[i]);
+      vk_free(&device->vk.alloc, device->queues[i]);
+   }
+   if (device->queue_count)
+      lvp_queue_finish(&device->queue);
+   device->queue_count = 0;
+}
+
+static VkResult
+lvp_device_init_queues(struct lvp_device *device,
+                       const VkDeviceCreateInfo *pCreateInfo)
+{
+   size_t state_size = lvp_get_rendering_state_size();
+
+   for (uint32_t i = 0; i < pCreateInfo->queueCreateInfoCount; i++) {
+      const VkDeviceQueueCreateInfo *create_info = &pCreateInfo->pQueueCreateInfos[i];
+
+      assert(create_info->queueFamilyIndex < LVP_QUEUE_FAMILY_COUNT);
+      assert(create_info->queueCount <= LVP_MAX_QUEUES_PER_FAMILY);
+
+      for (uint32_t j = 0; j < create_info->queueCount; j++) {
+         /* The first queue and its rendering state are part of the device. */
+         struct lvp_queue *queue = &device->queue;
+         if (device->queue_count) {
+            queue = vk_zalloc(&device->vk.alloc, sizeof(*queue) + state_size, 8,
+                              VK_SYSTEM_ALLOCATION_SCOPE_DEVICE);
+            if (!queue)
+               return vk_error(device, VK_ERROR_OUT_OF_HOST_MEMORY);
+            queue->state = queue + 1;
+         }
+
+         VkResult result = lvp_queue_init(device, queue, create_info, j);
+         if (result != VK_SUCCESS) {
+            if (queue != &device->queue)
+               vk_free(&device->vk.alloc, queue);
+            return result;
+         }
+
+         device->queues[device->queue_count++] = queue;
+      }
+   }
+
+   return VK_SUCCESS;
+}
+
 VKAPI_ATTR VkResult VKAPI_CALL lvp_CreateDevice(
    VkPhysicalDevice                            physicalDevice,
    const VkDeviceCreateInfo*                   pCreateInfo,
@@ -1743,6 +1812,15 @@ VKAPI_ATTR VkResult VKAPI_CALL lvp_CreateDevice(
    device->queue.state = device + 1;
    device->poison_mem = debug_get_bool_option("LVP_POISON_MEMORY", false);
    device->print_cmds = debug_get_bool_option("LVP_CMD_DEBUG", false);
+   device->compile_cmds = debug_get_bool_option("LVP_COMPILE_CMDS", true);
+   device->cpu_bvh_builder = debug_get_bool_option("LVP_CPU_BVH", true);
+   /* Acceleration structures and shaders that trace rays are not compatible
+    * between different widths, so this is for debugging and benchmarking.
+    */
+   device->bvh_width = debug_get_num_option("LVP_BVH_WIDTH", 4);
+   if (!util_is_power_of_two_nonzero(device->bvh_width) ||
+       device->bvh_width < LVP_BVH_MIN_WIDTH || device->bvh_width > LVP_BVH_MAX_WIDTH)
+      device->bvh_width = 4;
 
    struct vk_device_dispatch_table dispatch_table;
    vk_device_dispatch_table_from_entrypoints(&dispatch_table,
@@ -1767,20 +1845,18 @@ VKAPI_ATTR VkResult VKAPI_CALL lvp_CreateDevice(
 
    device->pscreen = physical_device->pscreen;
 
-   assert(pCreateInfo->queueCreateInfoCount == 1);
-   assert(pCreateInfo->pQueueCreateInfos[0].queueFamilyIndex == 0);
-   assert(pCreateInfo->pQueueCreateInfos[0].queueCount == 1);
-   result = lvp_queue_init(device, &device->queue, pCreateInfo->pQueueCreateInfos, 0);
+   simple_mtx_init(&device->pipeline_destroys_lock, mtx_plain);
+   util_dynarray_init(&device->pipeline_destroys, NULL);
+
+   result = lvp_device_init_queues(device, pCreateInfo);
    if (result != VK_SUCCESS) {
+      for (uint32_t i = device->queue_count; i-- > 0;)
+         vk_queue_finish(&device->queues[i]->vk);
+      lvp_device_finish_queues(device);
       vk_free(&device->vk.alloc, device);
       return result;
    }
 
-   nir_builder b = nir_builder_init_simple_shader(MESA_SHADER_FRAGMENT, physical_device->drv_options[MESA_SHADER_FRAGMENT], "dummy_frag");
-   struct pipe_shader_state shstate = {0};
-   shstate.type = PIPE_SHADER_IR_NIR;
-   shstate.ir.nir = b.shader;
-   device->noop_fs = device->queue.ctx->create_fs_state(device->queue.ctx, &shstate);
    _mesa_hash_table_init(&device->bda, NULL, _mesa_hash_pointer, _mesa_key_pointer_equal);
    simple_mtx_init(&device->bda_lock, mtx_plain);
 
@@ -1817,6 +1893,10 @@ VKAPI_ATTR void VKAPI_CALL lvp_DestroyDevice(
 {
    LVP_FROM_HANDLE(lvp_device, device, _device);
 
+   /* Stop the submit threads before destroying anything they may use. */
+   for (uint32_t i = device->queue_count; i-- > 0;)
+      vk_queue_finish(&device->queues[i]->vk);
+
    lvp_device_finish_accel_struct_state(device);
 
    vk_meta_device_finish(&device->vk, &device->meta);
@@ -1834,15 +1914,16 @@ VKAPI_ATTR void VKAPI_CALL lvp_DestroyDevice(
    device->queue.ctx->delete_texture_handle(device->queue.ctx, (uint64_t)(uintptr_t)device->null_texture_handle);
    device->queue.ctx->delete_image_handle(device->queue.ctx, (uint64_t)(uintptr_t)device->null_image_handle);
 
-   device->queue.ctx->delete_fs_state(device->queue.ctx, device->noop_fs);
-
-   if (device->queue.last_fence)
-      device->pscreen->fence_reference(device->pscreen, &device->queue.last_fence, NULL);
    ralloc_free(device->bda.table);
    simple_mtx_destroy(&device->bda_lock);
    pipe_resource_reference(&device->zero_buffer, NULL);
 
-   lvp_queue_finish(&device->queue);
+   /* The deferred destroys need the contexts of all queues. */
+   destroy_pipelines(device);
+   simple_mtx_destroy(&device->pipeline_destroys_lock);
+   util_dynarray_fini(&device->pipeline_destroys);
+
+   lvp_device_finish_queues(device);
    vk_device_finish(&device->vk);
    vk_free(&device->vk.alloc, device);
 }
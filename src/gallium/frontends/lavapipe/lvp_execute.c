@@ -90,6 +90,7 @@ struct lvp_conditional_rendering_state {
 struct rendering_state {
    struct pipe_context *pctx;
    struct lvp_device *device;
+   struct lvp_queue *queue;
    struct u_upload_mgr *uploader;
    struct cso_context *cso;
 
@@ -321,7 +322,7 @@ static void emit_compute_state(struct rendering_state *state)
    }
 
    if (state->compute_shader_dirty)
-      state->pctx->bind_compute_state(state->pctx, state->shaders[MESA_SHADER_COMPUTE]->shader_cso);
+      state->pctx->bind_compute_state(state->pctx, lvp_shader_get_cso(state->queue, state->shaders[MESA_SHADER_COMPUTE], false));
 
    state->compute_shader_dirty = false;
 
@@ -373,7 +374,7 @@ static void update_vertex_elements_buffer_index(struct rendering_state *state)
 static void emit_state(struct rendering_state *state)
 {
    if (!state->shaders[MESA_SHADER_FRAGMENT] && !state->noop_fs_bound) {
-      state->pctx->bind_fs_state(state->pctx, state->device->noop_fs);
+      state->pctx->bind_fs_state(state->pctx, state->queue->noop_fs);
       state->noop_fs_bound = true;
    }
    if (state->blend_dirty) {
@@ -608,37 +609,37 @@ handle_graphics_stages(struct rendering_state *state, VkShaderStageFlagBits shad
 
       switch (vk_stage) {
       case VK_SHADER_STAGE_FRAGMENT_BIT:
-         state->pctx->bind_fs_state(state->pctx, state->shaders[MESA_SHADER_FRAGMENT]->shader_cso);
+         state->pctx->bind_fs_state(state->pctx, lvp_shader_get_cso(state->queue, state->shaders[MESA_SHADER_FRAGMENT], false));
          state->noop_fs_bound = false;
          break;
       case VK_SHADER_STAGE_VERTEX_BIT:
-         state->pctx->bind_vs_state(state->pctx, state->shaders[MESA_SHADER_VERTEX]->shader_cso);
+         state->pctx->bind_vs_state(state->pctx, lvp_shader_get_cso(state->queue, state->shaders[MESA_SHADER_VERTEX], false));
          break;
       case VK_SHADER_STAGE_GEOMETRY_BIT:
-         state->pctx->bind_gs_state(state->pctx, state->shaders[MESA_SHADER_GEOMETRY]->shader_cso);
+         state->pctx->bind_gs_state(state->pctx, lvp_shader_get_cso(state->queue, state->shaders[MESA_SHADER_GEOMETRY], false));
          state->gs_output_lines = state->shaders[MESA_SHADER_GEOMETRY]->pipeline_nir->nir->info.gs.output_primitive == MESA_PRIM_LINES ? GS_OUTPUT_LINES : GS_OUTPUT_NOT_LINES;
          break;
       case VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT:
-         state->pctx->bind_tcs_state(state->pctx, state->shaders[MESA_SHADER_TESS_CTRL]->shader_cso);
+         state->pctx->bind_tcs_state(state->pctx, lvp_shader_get_cso(state->queue, state->shaders[MESA_SHADER_TESS_CTRL], false));
          break;
       case VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT:
          state->tess_states[0] = NULL;
          state->tess_states[1] = NULL;
          if (dynamic_tess_origin) {
-            state->tess_states[0] = state->shaders[MESA_SHADER_TESS_EVAL]->shader_cso;
-            state->tess_states[1] = state->shaders[MESA_SHADER_TESS_EVAL]->tess_ccw_cso;
+            state->tess_states[0] = lvp_shader_get_cso(state->queue, state->shaders[MESA_SHADER_TESS_EVAL], false);
+            state->tess_states[1] = lvp_shader_get_cso(state->queue, state->shaders[MESA_SHADER_TESS_EVAL], true);
             state->pctx->bind_tes_state(state->pctx, state->tess_states[state->tess_ccw]);
          } else {
-            state->pctx->bind_tes_state(state->pctx, state->shaders[MESA_SHADER_TESS_EVAL]->shader_cso);
+            state->pctx->bind_tes_state(state->pctx, lvp_shader_get_cso(state->queue, state->shaders[MESA_SHADER_TESS_EVAL], false));
          }
          if (!dynamic_tess_origin)
             state->tess_ccw = false;
          break;
       case VK_SHADER_STAGE_TASK_BIT_EXT:
-         state->pctx->bind_ts_state(state->pctx, state->shaders[MESA_SHADER_TASK]->shader_cso);
+         state->pctx->bind_ts_state(state->pctx, lvp_shader_get_cso(state->queue, state->shaders[MESA_SHADER_TASK], false));
          break;
       case VK_SHADER_STAGE_MESH_BIT_EXT:
-         state->pctx->bind_ms_state(state->pctx, state->shaders[MESA_SHADER_MESH]->shader_cso);
+         state->pctx->bind_ms_state(state->pctx, lvp_shader_get_cso(state->queue, state->shaders[MESA_SHADER_MESH], false));
          break;
       default:
          assert(0);
@@ -702,7 +703,7 @@ static void handle_graphics_pipeline(struct lvp_pipeline *pipeline,
                                      struct rendering_state *state)
 {
    const struct vk_graphics_pipeline_state *ps = &pipeline->graphics_state;
-   lvp_pipeline_shaders_compile(pipeline, true);
+   lvp_pipeline_shaders_compile(pipeline, state->queue);
    bool dynamic_tess_origin = BITSET_TEST(ps->dynamic, MESA_VK_DYNAMIC_TS_DOMAIN_ORIGIN);
    unbind_graphics_stages(state,
                           (~pipeline->graphics_state.shader_stages) &
@@ -1084,12 +1085,13 @@ static void
 handle_set_stage_buffer(struct rendering_state *state,
                         struct pipe_resource *bo,
                         size_t offset,
+                        size_t size,
                         gl_shader_stage stage,
                         uint32_t index)
 {
    state->const_buffer[stage][index].buffer = bo;
    state->const_buffer[stage][index].buffer_offset = offset;
-   state->const_buffer[stage][index].buffer_size = bo->width0;
+   state->const_buffer[stage][index].buffer_size = size;
    state->const_buffer[stage][index].user_buffer = NULL;
 
    state->constbuf_dirty[stage] = true;
@@ -1105,7 +1107,7 @@ static void handle_set_stage(struct rendering_state *state,
                              uint32_t index)
 {
    state->desc_sets[pipeline_type][index] = set;
-   handle_set_stage_buffer(state, set->bo, 0, stage, index);
+   handle_set_stage_buffer(state, set->bo, set->bo_offset, set->bo_size, stage, index);
 }
 
 static void
@@ -1118,11 +1120,11 @@ apply_dynamic_offsets(struct lvp_descriptor_set **out_set, const uint32_t *offse
    struct lvp_descriptor_set *in_set = *out_set;
 
    struct lvp_descriptor_set *set;
-   lvp_descriptor_set_create(state->device, in_set->layout, &set);
+   lvp_descriptor_set_create(state->device, in_set->layout, state->uploader, &set);
 
    util_dynarray_append(&state->push_desc_sets, struct lvp_descriptor_set *, set);
 
-   memcpy(set->map, in_set->map, in_set->bo->width0);
+   memcpy(set->map, in_set->map, in_set->bo_size);
 
    *out_set = set;
 
@@ -2680,6 +2682,18 @@ static void handle_draw_indirect(struct vk_cmd_queue_entry *cmd,
    pipe_resource_reference(&index, NULL);
 }
 
+static void handle_draw_non_indexed_indirect(struct vk_cmd_queue_entry *cmd,
+                                             struct rendering_state *state)
+{
+   handle_draw_indirect(cmd, state, false);
+}
+
+static void handle_draw_indexed_indirect(struct vk_cmd_queue_entry *cmd,
+                                         struct rendering_state *state)
+{
+   handle_draw_indirect(cmd, state, true);
+}
+
 static void handle_index_buffer(struct vk_cmd_queue_entry *cmd,
                                 struct rendering_state *state)
 {
@@ -2771,14 +2785,19 @@ static void handle_push_constants(struct vk_cmd_queue_entry *cmd,
 }
 
 static void lvp_execute_cmd_buffer(struct list_head *cmds,
-                                   struct rendering_state *state, bool print_cmds);
+                                   struct rendering_state *state);
+static void lvp_execute_cmd_stream(const struct util_dynarray *stream,
+                                   struct rendering_state *state);
 
 static void handle_execute_commands(struct vk_cmd_queue_entry *cmd,
-                                    struct rendering_state *state, bool print_cmds)
+                                    struct rendering_state *state)
 {
    for (unsigned i = 0; i < cmd->u.execute_commands.command_buffer_count; i++) {
       LVP_FROM_HANDLE(lvp_cmd_buffer, secondary_buf, cmd->u.execute_commands.command_buffers[i]);
-      lvp_execute_cmd_buffer(&secondary_buf->vk.cmd_queue.cmds, state, print_cmds);
+      if (secondary_buf->cmd_stream.size)
+         lvp_execute_cmd_stream(&secondary_buf->cmd_stream, state);
+      else
+         lvp_execute_cmd_buffer(&secondary_buf->vk.cmd_queue.cmds, state);
    }
 }
 
@@ -2846,6 +2865,7 @@ static void handle_begin_query(struct vk_cmd_queue_entry *cmd,
          enum pipe_query_type qtype = pool->base_type;
          pool->queries[qcmd->query + idx] = state->pctx->create_query(state->pctx,
                                                                qtype, 0);
+         pool->query_ctxs[qcmd->query + idx] = state->pctx;
       }
 
       state->pctx->begin_query(state->pctx, pool->queries[qcmd->query + idx]);
@@ -2883,6 +2903,7 @@ static void handle_begin_query_indexed_ext(struct vk_cmd_queue_entry *cmd,
          enum pipe_query_type qtype = pool->base_type;
          pool->queries[qcmd->query + idx] = state->pctx->create_query(state->pctx,
                                                                       qtype, qcmd->index);
+         pool->query_ctxs[qcmd->query + idx] = state->pctx;
       }
 
       state->pctx->begin_query(state->pctx, pool->queries[qcmd->query + idx]);
@@ -2910,12 +2931,7 @@ static void handle_reset_query_pool(struct vk_cmd_queue_entry *cmd,
    if (pool->base_type >= PIPE_QUERY_TYPES)
       return;
 
-   for (unsigned i = qcmd->first_query; i < qcmd->first_query + qcmd->query_count; i++) {
-      if (pool->queries[i]) {
-         state->pctx->destroy_query(state->pctx, pool->queries[i]);
-         pool->queries[i] = NULL;
-      }
-   }
+   lvp_query_pool_destroy_queries(pool, qcmd->first_query, qcmd->query_count);
 }
 
 static void handle_write_timestamp2(struct vk_cmd_queue_entry *cmd,
@@ -2931,6 +2947,7 @@ static void handle_write_timestamp2(struct vk_cmd_queue_entry *cmd,
    for (unsigned idx = 0; idx < count; idx++) {
       if (!pool->queries[qcmd->query + idx]) {
          pool->queries[qcmd->query + idx] = state->pctx->create_query(state->pctx, PIPE_QUERY_TIMESTAMP, 0);
+         pool->query_ctxs[qcmd->query + idx] = state->pctx;
       }
 
       state->pctx->end_query(state->pctx, pool->queries[qcmd->query + idx]);
@@ -3246,6 +3263,18 @@ static void handle_draw_indirect_count(struct vk_cmd_queue_entry *cmd,
    pipe_resource_reference(&index, NULL);
 }
 
+static void handle_draw_non_indexed_indirect_count(struct vk_cmd_queue_entry *cmd,
+                                                   struct rendering_state *state)
+{
+   handle_draw_indirect_count(cmd, state, false);
+}
+
+static void handle_draw_indexed_indirect_count(struct vk_cmd_queue_entry *cmd,
+                                               struct rendering_state *state)
+{
+   handle_draw_indirect_count(cmd, state, true);
+}
+
 static void handle_push_descriptor_set(struct vk_cmd_queue_entry *cmd,
                                        struct rendering_state *state)
 {
@@ -3254,7 +3283,7 @@ static void handle_push_descriptor_set(struct vk_cmd_queue_entry *cmd,
    struct lvp_descriptor_set_layout *set_layout = (struct lvp_descriptor_set_layout *)layout->vk.set_layouts[pds->set];
 
    struct lvp_descriptor_set *set;
-   lvp_descriptor_set_create(state->device, set_layout, &set);
+   lvp_descriptor_set_create(state->device, set_layout, state->uploader, &set);
 
    util_dynarray_append(&state->push_desc_sets, struct lvp_descriptor_set *, set);
 
@@ -3262,7 +3291,7 @@ static void handle_push_descriptor_set(struct vk_cmd_queue_entry *cmd,
    u_foreach_bit(pipeline_type, types) {
       struct lvp_descriptor_set *base = state->desc_sets[pipeline_type][pds->set];
       if (base)
-         memcpy(set->map, base->map, MIN2(set->bo->width0, base->bo->width0));
+         memcpy(set->map, base->map, MIN2(set->bo_size, base->bo_size));
 
       VkDescriptorSet set_handle = lvp_descriptor_set_to_handle(set);
 
@@ -3292,13 +3321,13 @@ static void handle_push_descriptor_set_with_template(struct vk_cmd_queue_entry *
    struct lvp_descriptor_set_layout *set_layout = (struct lvp_descriptor_set_layout *)layout->vk.set_layouts[pds->set];
 
    struct lvp_descriptor_set *set;
-   lvp_descriptor_set_create(state->device, set_layout, &set);
+   lvp_descriptor_set_create(state->device, set_layout, state->uploader, &set);
 
    util_dynarray_append(&state->push_desc_sets, struct lvp_descriptor_set *, set);
 
    struct lvp_descriptor_set *base = state->desc_sets[lvp_pipeline_type_from_bind_point(templ->bind_point)][pds->set];
    if (base)
-      memcpy(set->map, base->map, MIN2(set->bo->width0, base->bo->width0));
+      memcpy(set->map, base->map, MIN2(set->bo_size, base->bo_size));
 
    VkDescriptorSet set_handle = lvp_descriptor_set_to_handle(set);
    lvp_descriptor_set_update_with_template(lvp_device_to_handle(state->device), set_handle,
@@ -3425,7 +3454,8 @@ static void handle_begin_conditional_rendering(struct vk_cmd_queue_entry *cmd,
    lvp_emit_conditional_rendering(state);
 }
 
-static void handle_end_conditional_rendering(struct rendering_state *state)
+static void handle_end_conditional_rendering(struct vk_cmd_queue_entry *cmd,
+                                             struct rendering_state *state)
 {
    state->conditional_rendering.enabled = false;
    lvp_emit_conditional_rendering(state);
@@ -4130,8 +4160,9 @@ process_sequence_ext(struct rendering_state *state,
 }
 
 static void
-handle_preprocess_generated_commands_ext(struct vk_cmd_queue_entry *cmd, struct rendering_state *state, bool print_cmds)
+handle_preprocess_generated_commands_ext(struct vk_cmd_queue_entry *cmd, struct rendering_state *state)
 {
+   bool print_cmds = state->device->print_cmds;
    VkGeneratedCommandsInfoEXT *pre = cmd->u.preprocess_generated_commands_ext.generated_commands_info;
    VK_FROM_HANDLE(lvp_indirect_command_layout_ext, elayout, pre->indirectCommandsLayout);
    VK_FROM_HANDLE(lvp_indirect_execution_set, iset, pre->indirectExecutionSet);
@@ -4161,21 +4192,21 @@ handle_preprocess_generated_commands_ext(struct vk_cmd_queue_entry *cmd, struct
 }
 
 static void
-handle_execute_generated_commands_ext(struct vk_cmd_queue_entry *cmd, struct rendering_state *state, bool print_cmds)
+handle_execute_generated_commands_ext(struct vk_cmd_queue_entry *cmd, struct rendering_state *state)
 {
    VkGeneratedCommandsInfoEXT *gen = cmd->u.execute_generated_commands_ext.generated_commands_info;
    struct vk_cmd_execute_generated_commands_ext *exec = &cmd->u.execute_generated_commands_ext;
    if (!exec->is_preprocessed) {
       struct vk_cmd_queue_entry pre;
       pre.u.preprocess_generated_commands_ext.generated_commands_info = exec->generated_commands_info;
-      handle_preprocess_generated_commands_ext(&pre, state, print_cmds);
+      handle_preprocess_generated_commands_ext(&pre, state);
    }
    uint8_t *p = (void*)(uintptr_t)gen->preprocessAddress;
    struct list_head *list = (void*)p;
 
    struct vk_cmd_queue_entry *exec_cmd = list_first_entry(list, struct vk_cmd_queue_entry, cmd_link);
    if (exec_cmd)
-      lvp_execute_cmd_buffer(list, state, print_cmds);
+      lvp_execute_cmd_buffer(list, state);
 }
 
 static void
@@ -4242,10 +4273,12 @@ bind_db_samplers(struct rendering_state *state, enum lvp_pipeline_type pipeline_
       if (set_layout->immutable_set) {
          state->desc_sets[pipeline_type][set] = set_layout->immutable_set;
          if (pipeline_type == LVP_PIPELINE_RAY_TRACING) {
-            handle_set_stage_buffer(state, set_layout->immutable_set->bo, 0, MESA_SHADER_RAYGEN, set);
+            handle_set_stage_buffer(state, set_layout->immutable_set->bo, set_layout->immutable_set->bo_offset,
+                                    set_layout->immutable_set->bo_size, MESA_SHADER_RAYGEN, set);
          } else {
             u_foreach_bit(stage, set_layout->shader_stages)
-               handle_set_stage_buffer(state, set_layout->immutable_set->bo, 0, vk_to_mesa_shader_stage(1<<stage), set);
+               handle_set_stage_buffer(state, set_layout->immutable_set->bo, set_layout->immutable_set->bo_offset,
+                                       set_layout->immutable_set->bo_size, vk_to_mesa_shader_stage(1<<stage), set);
          }
       }
       return;
@@ -4309,14 +4342,15 @@ handle_descriptor_buffer_offsets(struct vk_cmd_queue_entry *cmd, struct renderin
          state->desc_buffer_offsets[pipeline_type][idx].buffer_index = dbo->pBufferIndices[i];
          state->desc_buffer_offsets[pipeline_type][idx].offset = dbo->pOffsets[i];
          const struct lvp_descriptor_set_layout *set_layout = get_set_layout(layout, idx);
+         struct pipe_resource *desc_buffer = state->desc_buffers[dbo->pBufferIndices[i]];
 
          if (pipeline_type == LVP_PIPELINE_RAY_TRACING) {
-            handle_set_stage_buffer(state, state->desc_buffers[dbo->pBufferIndices[i]], dbo->pOffsets[i], MESA_SHADER_RAYGEN, idx);
+            handle_set_stage_buffer(state, desc_buffer, dbo->pOffsets[i], desc_buffer->width0, MESA_SHADER_RAYGEN, idx);
          } else {
             /* set for all stages */
             u_foreach_bit(stage, set_layout->shader_stages) {
                gl_shader_stage pstage = vk_to_mesa_shader_stage(1<<stage);
-               handle_set_stage_buffer(state, state->desc_buffers[dbo->pBufferIndices[i]], dbo->pOffsets[i], pstage, idx);
+               handle_set_stage_buffer(state, desc_buffer, dbo->pOffsets[i], desc_buffer->width0, pstage, idx);
             }
          }
          bind_db_samplers(state, pipeline_type, idx);
@@ -4494,7 +4528,7 @@ handle_copy_acceleration_structure_to_memory(struct vk_cmd_queue_entry *cmd, str
    struct lvp_accel_struct_serialization_header *dst = copy->info->dst.hostAddress;
 
    lvp_device_get_cache_uuid(dst->driver_uuid);
-   lvp_device_get_cache_uuid(dst->accel_struct_compat);
+   lvp_get_accel_struct_compat(state->device, dst->accel_struct_compat);
    dst->serialization_size = src->serialization_size;
    dst->compacted_size = accel_struct->size;
    dst->instance_count = src->instance_count;
@@ -4560,7 +4594,7 @@ lvp_trace_rays(struct rendering_state *state, VkTraceRaysIndirectCommand2KHR *co
       state->constbuf_dirty[MESA_SHADER_RAYGEN] = false;
    }
 
-   state->pctx->bind_compute_state(state->pctx, state->shaders[MESA_SHADER_RAYGEN]->shader_cso);
+   state->pctx->bind_compute_state(state->pctx, lvp_shader_get_cso(state->queue, state->shaders[MESA_SHADER_RAYGEN], false));
 
    state->pcbuf_dirty[MESA_SHADER_COMPUTE] = true;
    state->constbuf_dirty[MESA_SHADER_COMPUTE] = true;
@@ -4733,11 +4767,21 @@ handle_encode_as(struct vk_cmd_queue_entry *cmd, struct rendering_state *state)
 
    finish_fence(state);
 
-   lvp_encode_as(encode->dst, encode->intermediate_as_addr,
+   lvp_encode_as(state->device, encode->dst, encode->intermediate_as_addr,
                  encode->intermediate_header_addr, encode->leaf_count,
                  encode->geometry_type);
 }
 
+static void
+handle_build_as(struct vk_cmd_queue_entry *cmd, struct rendering_state *state)
+{
+   struct lvp_cmd_build_as *build = cmd->driver_data;
+
+   finish_fence(state);
+
+   lvp_build_as(state->device, build);
+}
+
 static void
 handle_save_state(struct vk_cmd_queue_entry *cmd, struct rendering_state *state)
 {
@@ -4765,7 +4809,7 @@ void lvp_add_enqueue_cmd_entrypoints(struct vk_device_dispatch_table *disp)
    assert(cmd_enqueue_dispatch.CmdName != NULL); \
    disp->CmdName = cmd_enqueue_dispatch.CmdName;
 
-   /* This list needs to match what's in lvp_execute_cmd_buffer exactly */
+   /* This list needs to match what's in lvp_cmd_handlers exactly */
    ENQUEUE_CMD(CmdBindPipeline)
    ENQUEUE_CMD(CmdSetViewport)
    ENQUEUE_CMD(CmdSetViewportWithCount)
@@ -4914,421 +4958,377 @@ void lvp_add_enqueue_cmd_entrypoints(struct vk_device_dispatch_table *disp)
 #undef ENQUEUE_CMD
 }
 
+static void
+handle_nop(struct vk_cmd_queue_entry *cmd, struct rendering_state *state)
+{
+}
+
+enum lvp_cmd_emit {
+   LVP_EMIT_NONE,
+   LVP_EMIT_GRAPHICS,
+   LVP_EMIT_COMPUTE,
+};
+
+struct lvp_cmd_handler {
+   void (*exec)(struct vk_cmd_queue_entry *cmd, struct rendering_state *state);
+
+   /* The state that has to be emitted before the command is executed. */
+   enum lvp_cmd_emit emit;
+
+   /* The command only sets dynamic state, independently of the state set
+    * by the other replaceable commands, so a later command of the same type
+    * setting the same state makes it dead.
+    */
+   bool replaceable;
+};
+
+static const struct lvp_cmd_handler lvp_cmd_handlers[LVP_CMD_TYPE_COUNT] = {
+   [VK_CMD_BIND_PIPELINE] = { handle_pipeline },
+   [VK_CMD_SET_VIEWPORT] = { handle_set_viewport, .replaceable = true },
+   [VK_CMD_SET_VIEWPORT_WITH_COUNT] = { handle_set_viewport_with_count },
+   [VK_CMD_SET_SCISSOR] = { handle_set_scissor, .replaceable = true },
+   [VK_CMD_SET_SCISSOR_WITH_COUNT] = { handle_set_scissor_with_count },
+   [VK_CMD_SET_LINE_WIDTH] = { handle_set_line_width, .replaceable = true },
+   [VK_CMD_SET_DEPTH_BIAS] = { handle_set_depth_bias, .replaceable = true },
+   [VK_CMD_SET_BLEND_CONSTANTS] = { handle_set_blend_constants, .replaceable = true },
+   [VK_CMD_SET_DEPTH_BOUNDS] = { handle_set_depth_bounds, .replaceable = true },
+   [VK_CMD_SET_STENCIL_COMPARE_MASK] = { handle_set_stencil_compare_mask, .replaceable = true },
+   [VK_CMD_SET_STENCIL_WRITE_MASK] = { handle_set_stencil_write_mask, .replaceable = true },
+   [VK_CMD_SET_STENCIL_REFERENCE] = { handle_set_stencil_reference, .replaceable = true },
+   [VK_CMD_BIND_DESCRIPTOR_SETS2] = { handle_descriptor_sets_cmd },
+   [VK_CMD_BIND_INDEX_BUFFER] = { handle_index_buffer },
+   [VK_CMD_BIND_INDEX_BUFFER2] = { handle_index_buffer2 },
+   [VK_CMD_BIND_VERTEX_BUFFERS2] = { handle_vertex_buffers2 },
+   [VK_CMD_DRAW] = { handle_draw, LVP_EMIT_GRAPHICS },
+   [VK_CMD_DRAW_MULTI_EXT] = { handle_draw_multi, LVP_EMIT_GRAPHICS },
+   [VK_CMD_DRAW_INDEXED] = { handle_draw_indexed, LVP_EMIT_GRAPHICS },
+   [VK_CMD_DRAW_INDIRECT] = { handle_draw_non_indexed_indirect, LVP_EMIT_GRAPHICS },
+   [VK_CMD_DRAW_INDEXED_INDIRECT] = { handle_draw_indexed_indirect, LVP_EMIT_GRAPHICS },
+   [VK_CMD_DRAW_MULTI_INDEXED_EXT] = { handle_draw_multi_indexed, LVP_EMIT_GRAPHICS },
+   [VK_CMD_DISPATCH] = { handle_dispatch, LVP_EMIT_COMPUTE },
+   [VK_CMD_DISPATCH_BASE] = { handle_dispatch_base, LVP_EMIT_COMPUTE },
+   [VK_CMD_DISPATCH_INDIRECT] = { handle_dispatch_indirect, LVP_EMIT_COMPUTE },
+   [VK_CMD_COPY_BUFFER2] = { handle_copy_buffer },
+   [VK_CMD_COPY_IMAGE2] = { handle_copy_image },
+   [VK_CMD_BLIT_IMAGE2] = { handle_blit_image },
+   [VK_CMD_COPY_BUFFER_TO_IMAGE2] = { handle_copy_buffer_to_image },
+   [VK_CMD_COPY_IMAGE_TO_BUFFER2] = { handle_copy_image_to_buffer2 },
+   [VK_CMD_UPDATE_BUFFER] = { handle_update_buffer },
+   [VK_CMD_FILL_BUFFER] = { handle_fill_buffer },
+   [VK_CMD_CLEAR_COLOR_IMAGE] = { handle_clear_color_image },
+   [VK_CMD_CLEAR_DEPTH_STENCIL_IMAGE] = { handle_clear_ds_image },
+   [VK_CMD_CLEAR_ATTACHMENTS] = { handle_clear_attachments },
+   [VK_CMD_RESOLVE_IMAGE2] = { handle_resolve_image },
+   [VK_CMD_PIPELINE_BARRIER2] = { handle_pipeline_barrier },
+   [VK_CMD_BEGIN_QUERY_INDEXED_EXT] = { handle_begin_query_indexed_ext },
+   [VK_CMD_END_QUERY_INDEXED_EXT] = { handle_end_query_indexed_ext },
+   [VK_CMD_BEGIN_QUERY] = { handle_begin_query },
+   [VK_CMD_END_QUERY] = { handle_end_query },
+   [VK_CMD_RESET_QUERY_POOL] = { handle_reset_query_pool },
+   [VK_CMD_COPY_QUERY_POOL_RESULTS] = { handle_copy_query_pool_results },
+   [VK_CMD_PUSH_CONSTANTS2] = { handle_push_constants },
+   [VK_CMD_EXECUTE_COMMANDS] = { handle_execute_commands },
+   [VK_CMD_DRAW_INDIRECT_COUNT] = { handle_draw_non_indexed_indirect_count, LVP_EMIT_GRAPHICS },
+   [VK_CMD_DRAW_INDEXED_INDIRECT_COUNT] = { handle_draw_indexed_indirect_count, LVP_EMIT_GRAPHICS },
+   [VK_CMD_PUSH_DESCRIPTOR_SET2] = { handle_push_descriptor_set },
+   [VK_CMD_PUSH_DESCRIPTOR_SET_WITH_TEMPLATE2] = { handle_push_descriptor_set_with_template },
+   [VK_CMD_BIND_TRANSFORM_FEEDBACK_BUFFERS_EXT] = { handle_bind_transform_feedback_buffers },
+   [VK_CMD_BEGIN_TRANSFORM_FEEDBACK_EXT] = { handle_begin_transform_feedback },
+   [VK_CMD_END_TRANSFORM_FEEDBACK_EXT] = { handle_end_transform_feedback },
+   [VK_CMD_DRAW_INDIRECT_BYTE_COUNT_EXT] = { handle_draw_indirect_byte_count, LVP_EMIT_GRAPHICS },
+   [VK_CMD_BEGIN_CONDITIONAL_RENDERING_EXT] = { handle_begin_conditional_rendering },
+   [VK_CMD_END_CONDITIONAL_RENDERING_EXT] = { handle_end_conditional_rendering },
+   [VK_CMD_SET_VERTEX_INPUT_EXT] = { handle_set_vertex_input },
+   [VK_CMD_SET_CULL_MODE] = { handle_set_cull_mode, .replaceable = true },
+   [VK_CMD_SET_FRONT_FACE] = { handle_set_front_face, .replaceable = true },
+   [VK_CMD_SET_PRIMITIVE_TOPOLOGY] = { handle_set_primitive_topology, .replaceable = true },
+   [VK_CMD_SET_DEPTH_TEST_ENABLE] = { handle_set_depth_test_enable, .replaceable = true },
+   [VK_CMD_SET_DEPTH_WRITE_ENABLE] = { handle_set_depth_write_enable, .replaceable = true },
+   [VK_CMD_SET_DEPTH_COMPARE_OP] = { handle_set_depth_compare_op, .replaceable = true },
+   [VK_CMD_SET_DEPTH_BOUNDS_TEST_ENABLE] = { handle_set_depth_bounds_test_enable, .replaceable = true },
+   [VK_CMD_SET_STENCIL_TEST_ENABLE] = { handle_set_stencil_test_enable, .replaceable = true },
+   [VK_CMD_SET_STENCIL_OP] = { handle_set_stencil_op, .replaceable = true },
+   [VK_CMD_SET_LINE_STIPPLE] = { handle_set_line_stipple, .replaceable = true },
+   [VK_CMD_SET_DEPTH_BIAS_ENABLE] = { handle_set_depth_bias_enable, .replaceable = true },
+   [VK_CMD_SET_LOGIC_OP_EXT] = { handle_set_logic_op, .replaceable = true },
+   [VK_CMD_SET_PATCH_CONTROL_POINTS_EXT] = { handle_set_patch_control_points, .replaceable = true },
+   [VK_CMD_SET_PRIMITIVE_RESTART_ENABLE] = { handle_set_primitive_restart_enable, .replaceable = true },
+   [VK_CMD_SET_RASTERIZER_DISCARD_ENABLE] = { handle_set_rasterizer_discard_enable, .replaceable = true },
+   [VK_CMD_SET_COLOR_WRITE_ENABLE_EXT] = { handle_set_color_write_enable, .replaceable = true },
+   [VK_CMD_BEGIN_RENDERING] = { handle_begin_rendering },
+   [VK_CMD_END_RENDERING] = { handle_end_rendering },
+   [VK_CMD_SET_DEVICE_MASK] = { handle_nop },
+   [VK_CMD_RESET_EVENT2] = { handle_event_reset2 },
+   [VK_CMD_SET_EVENT2] = { handle_event_set2 },
+   [VK_CMD_WAIT_EVENTS2] = { handle_wait_events2 },
+   [VK_CMD_WRITE_TIMESTAMP2] = { handle_write_timestamp2 },
+   [VK_CMD_SET_POLYGON_MODE_EXT] = { handle_set_polygon_mode, .replaceable = true },
+   [VK_CMD_SET_TESSELLATION_DOMAIN_ORIGIN_EXT] = { handle_set_tessellation_domain_origin },
+   [VK_CMD_SET_DEPTH_CLAMP_ENABLE_EXT] = { handle_set_depth_clamp_enable, .replaceable = true },
+   [VK_CMD_SET_DEPTH_CLIP_ENABLE_EXT] = { handle_set_depth_clip_enable, .replaceable = true },
+   [VK_CMD_SET_LOGIC_OP_ENABLE_EXT] = { handle_set_logic_op_enable, .replaceable = true },
+   [VK_CMD_SET_SAMPLE_MASK_EXT] = { handle_set_sample_mask, .replaceable = true },
+   [VK_CMD_SET_RASTERIZATION_SAMPLES_EXT] = { handle_set_samples, .replaceable = true },
+   [VK_CMD_SET_ALPHA_TO_COVERAGE_ENABLE_EXT] = { handle_set_alpha_to_coverage, .replaceable = true },
+   [VK_CMD_SET_ALPHA_TO_ONE_ENABLE_EXT] = { handle_set_alpha_to_one },
+   [VK_CMD_SET_DEPTH_CLIP_NEGATIVE_ONE_TO_ONE_EXT] = { handle_set_halfz },
+   [VK_CMD_SET_LINE_RASTERIZATION_MODE_EXT] = { handle_set_line_rasterization_mode, .replaceable = true },
+   [VK_CMD_SET_LINE_STIPPLE_ENABLE_EXT] = { handle_set_line_stipple_enable, .replaceable = true },
+   [VK_CMD_SET_PROVOKING_VERTEX_MODE_EXT] = { handle_set_provoking_vertex_mode, .replaceable = true },
+   [VK_CMD_SET_COLOR_BLEND_ENABLE_EXT] = { handle_set_color_blend_enable, .replaceable = true },
+   [VK_CMD_SET_COLOR_WRITE_MASK_EXT] = { handle_set_color_write_mask, .replaceable = true },
+   [VK_CMD_SET_COLOR_BLEND_EQUATION_EXT] = { handle_set_color_blend_equation, .replaceable = true },
+   [VK_CMD_BIND_SHADERS_EXT] = { handle_shaders },
+   [VK_CMD_SET_ATTACHMENT_FEEDBACK_LOOP_ENABLE_EXT] = { handle_nop },
+   [VK_CMD_DRAW_MESH_TASKS_EXT] = { handle_draw_mesh_tasks, LVP_EMIT_GRAPHICS },
+   [VK_CMD_DRAW_MESH_TASKS_INDIRECT_EXT] = { handle_draw_mesh_tasks_indirect, LVP_EMIT_GRAPHICS },
+   [VK_CMD_DRAW_MESH_TASKS_INDIRECT_COUNT_EXT] = { handle_draw_mesh_tasks_indirect_count, LVP_EMIT_GRAPHICS },
+   [VK_CMD_PREPROCESS_GENERATED_COMMANDS_EXT] = { handle_preprocess_generated_commands_ext },
+   [VK_CMD_EXECUTE_GENERATED_COMMANDS_EXT] = { handle_execute_generated_commands_ext },
+   [VK_CMD_BIND_DESCRIPTOR_BUFFERS_EXT] = { handle_descriptor_buffers },
+   [VK_CMD_SET_DESCRIPTOR_BUFFER_OFFSETS2_EXT] = { handle_descriptor_buffer_offsets },
+   [VK_CMD_BIND_DESCRIPTOR_BUFFER_EMBEDDED_SAMPLERS2_EXT] = { handle_descriptor_buffer_embedded_samplers },
+#ifdef VK_ENABLE_BETA_EXTENSIONS
+   [VK_CMD_INITIALIZE_GRAPH_SCRATCH_MEMORY_AMDX] = { handle_nop },
+   [VK_CMD_DISPATCH_GRAPH_INDIRECT_COUNT_AMDX] = { handle_nop },
+   [VK_CMD_DISPATCH_GRAPH_INDIRECT_AMDX] = { handle_nop },
+   [VK_CMD_DISPATCH_GRAPH_AMDX] = { handle_dispatch_graph },
+#endif
+   [VK_CMD_SET_RENDERING_ATTACHMENT_LOCATIONS] = { handle_rendering_attachment_locations },
+   [VK_CMD_SET_RENDERING_INPUT_ATTACHMENT_INDICES] = { handle_rendering_input_attachment_indices },
+   [VK_CMD_COPY_ACCELERATION_STRUCTURE_KHR] = { handle_copy_acceleration_structure },
+   [VK_CMD_COPY_MEMORY_TO_ACCELERATION_STRUCTURE_KHR] = { handle_copy_memory_to_acceleration_structure },
+   [VK_CMD_COPY_ACCELERATION_STRUCTURE_TO_MEMORY_KHR] = { handle_copy_acceleration_structure_to_memory },
+   [VK_CMD_BUILD_ACCELERATION_STRUCTURES_INDIRECT_KHR] = { handle_nop },
+   [VK_CMD_WRITE_ACCELERATION_STRUCTURES_PROPERTIES_KHR] = { handle_write_acceleration_structures_properties },
+   [VK_CMD_SET_RAY_TRACING_PIPELINE_STACK_SIZE_KHR] = { handle_nop },
+   [VK_CMD_TRACE_RAYS_INDIRECT2_KHR] = { handle_trace_rays_indirect2 },
+   [VK_CMD_TRACE_RAYS_INDIRECT_KHR] = { handle_trace_rays_indirect },
+   [VK_CMD_TRACE_RAYS_KHR] = { handle_trace_rays },
+
+   [LVP_CMD_WRITE_BUFFER_CP] = { handle_write_buffer_cp },
+   [LVP_CMD_DISPATCH_UNALIGNED] = { handle_dispatch_unaligned, LVP_EMIT_COMPUTE },
+   [LVP_CMD_FILL_BUFFER_ADDR] = { handle_fill_buffer_addr },
+   [LVP_CMD_ENCODE_AS] = { handle_encode_as },
+   [LVP_CMD_BUILD_AS] = { handle_build_as },
+   [LVP_CMD_SAVE_STATE] = { handle_save_state },
+   [LVP_CMD_RESTORE_STATE] = { handle_restore_state },
+};
+
+static const struct lvp_cmd_handler *
+lvp_get_cmd_handler(const struct vk_cmd_queue_entry *cmd)
+{
+   const struct lvp_cmd_handler *handler = &lvp_cmd_handlers[cmd->type];
+
+   if (!handler->exec) {
+      fprintf(stderr, "Unsupported command %s\n", vk_cmd_queue_type_names[cmd->type]);
+      unreachable("Unsupported command");
+   }
+
+   return handler;
+}
+
+static inline void
+lvp_execute_cmd(const struct lvp_cmd_handler *handler,
+                struct vk_cmd_queue_entry *cmd, struct rendering_state *state)
+{
+   if (state->device->print_cmds && cmd->type < VK_CMD_TYPE_COUNT)
+      fprintf(stderr, "%s\n", vk_cmd_queue_type_names[cmd->type]);
+
+   if (handler->emit == LVP_EMIT_GRAPHICS)
+      emit_state(state);
+   else if (handler->emit == LVP_EMIT_COMPUTE)
+      emit_compute_state(state);
+
+   handler->exec(cmd, state);
+}
+
 static void lvp_execute_cmd_buffer(struct list_head *cmds,
-                                   struct rendering_state *state, bool print_cmds)
+                                   struct rendering_state *state)
 {
    struct vk_cmd_queue_entry *cmd;
    bool did_flush = false;
 
    LIST_FOR_EACH_ENTRY(cmd, cmds, cmd_link) {
-      if (cmd->type >= VK_CMD_TYPE_COUNT) {
-         uint32_t type = cmd->type;
-         if (type == LVP_CMD_WRITE_BUFFER_CP) {
-            handle_write_buffer_cp(cmd, state);
-         } else if (type == LVP_CMD_DISPATCH_UNALIGNED) {
-            emit_compute_state(state);
-            handle_dispatch_unaligned(cmd, state);
-         } else if (type == LVP_CMD_FILL_BUFFER_ADDR) {
-            handle_fill_buffer_addr(cmd, state);
-         } else if (type == LVP_CMD_ENCODE_AS) {
-            handle_encode_as(cmd, state);
-         } else if (type == LVP_CMD_SAVE_STATE) {
-            handle_save_state(cmd, state);
-         } else if (type == LVP_CMD_RESTORE_STATE) {
-            handle_restore_state(cmd, state);
-         }
-         continue;
-      }
-
-      if (print_cmds)
-         fprintf(stderr, "%s\n", vk_cmd_queue_type_names[cmd->type]);
-      switch ((unsigned)cmd->type) {
-      case VK_CMD_BIND_PIPELINE:
-         handle_pipeline(cmd, state);
-         break;
-      case VK_CMD_SET_VIEWPORT:
-         handle_set_viewport(cmd, state);
-         break;
-      case VK_CMD_SET_VIEWPORT_WITH_COUNT:
-         handle_set_viewport_with_count(cmd, state);
-         break;
-      case VK_CMD_SET_SCISSOR:
-         handle_set_scissor(cmd, state);
-         break;
-      case VK_CMD_SET_SCISSOR_WITH_COUNT:
-         handle_set_scissor_with_count(cmd, state);
-         break;
-      case VK_CMD_SET_LINE_WIDTH:
-         handle_set_line_width(cmd, state);
-         break;
-      case VK_CMD_SET_DEPTH_BIAS:
-         handle_set_depth_bias(cmd, state);
-         break;
-      case VK_CMD_SET_BLEND_CONSTANTS:
-         handle_set_blend_constants(cmd, state);
-         break;
-      case VK_CMD_SET_DEPTH_BOUNDS:
-         handle_set_depth_bounds(cmd, state);
-         break;
-      case VK_CMD_SET_STENCIL_COMPARE_MASK:
-         handle_set_stencil_compare_mask(cmd, state);
-         break;
-      case VK_CMD_SET_STENCIL_WRITE_MASK:
-         handle_set_stencil_write_mask(cmd, state);
-         break;
-      case VK_CMD_SET_STENCIL_REFERENCE:
-         handle_set_stencil_reference(cmd, state);
-         break;
-      case VK_CMD_BIND_DESCRIPTOR_SETS2:
-         handle_descriptor_sets_cmd(cmd, state);
-         break;
-      case VK_CMD_BIND_INDEX_BUFFER:
-         handle_index_buffer(cmd, state);
-         break;
-      case VK_CMD_BIND_INDEX_BUFFER2:
-         handle_index_buffer2(cmd, state);
-         break;
-      case VK_CMD_BIND_VERTEX_BUFFERS2:
-         handle_vertex_buffers2(cmd, state);
-         break;
-      case VK_CMD_DRAW:
-         emit_state(state);
-         handle_draw(cmd, state);
-         break;
-      case VK_CMD_DRAW_MULTI_EXT:
-         emit_state(state);
-         handle_draw_multi(cmd, state);
-         break;
-      case VK_CMD_DRAW_INDEXED:
-         emit_state(state);
-         handle_draw_indexed(cmd, state);
-         break;
-      case VK_CMD_DRAW_INDIRECT:
-         emit_state(state);
-         handle_draw_indirect(cmd, state, false);
-         break;
-      case VK_CMD_DRAW_INDEXED_INDIRECT:
-         emit_state(state);
-         handle_draw_indirect(cmd, state, true);
-         break;
-      case VK_CMD_DRAW_MULTI_INDEXED_EXT:
-         emit_state(state);
-         handle_draw_multi_indexed(cmd, state);
-         break;
-      case VK_CMD_DISPATCH:
-         emit_compute_state(state);
-         handle_dispatch(cmd, state);
-         break;
-      case VK_CMD_DISPATCH_BASE:
-         emit_compute_state(state);
-         handle_dispatch_base(cmd, state);
-         break;
-      case VK_CMD_DISPATCH_INDIRECT:
-         emit_compute_state(state);
-         handle_dispatch_indirect(cmd, state);
-         break;
-      case VK_CMD_COPY_BUFFER2:
-         handle_copy_buffer(cmd, state);
-         break;
-      case VK_CMD_COPY_IMAGE2:
-         handle_copy_image(cmd, state);
-         break;
-      case VK_CMD_BLIT_IMAGE2:
-         handle_blit_image(cmd, state);
-         break;
-      case VK_CMD_COPY_BUFFER_TO_IMAGE2:
-         handle_copy_buffer_to_image(cmd, state);
-         break;
-      case VK_CMD_COPY_IMAGE_TO_BUFFER2:
-         handle_copy_image_to_buffer2(cmd, state);
-         break;
-      case VK_CMD_UPDATE_BUFFER:
-         handle_update_buffer(cmd, state);
-         break;
-      case VK_CMD_FILL_BUFFER:
-         handle_fill_buffer(cmd, state);
-         break;
-      case VK_CMD_CLEAR_COLOR_IMAGE:
-         handle_clear_color_image(cmd, state);
-         break;
-      case VK_CMD_CLEAR_DEPTH_STENCIL_IMAGE:
-         handle_clear_ds_image(cmd, state);
-         break;
-      case VK_CMD_CLEAR_ATTACHMENTS:
-         handle_clear_attachments(cmd, state);
-         break;
-      case VK_CMD_RESOLVE_IMAGE2:
-         handle_resolve_image(cmd, state);
-         break;
-      case VK_CMD_PIPELINE_BARRIER2:
+      if (cmd->type == VK_CMD_PIPELINE_BARRIER2) {
          /* flushes are actually stalls, so multiple flushes are redundant */
          if (did_flush)
             continue;
-         handle_pipeline_barrier(cmd, state);
          did_flush = true;
-         continue;
-      case VK_CMD_BEGIN_QUERY_INDEXED_EXT:
-         handle_begin_query_indexed_ext(cmd, state);
-         break;
-      case VK_CMD_END_QUERY_INDEXED_EXT:
-         handle_end_query_indexed_ext(cmd, state);
-         break;
-      case VK_CMD_BEGIN_QUERY:
-         handle_begin_query(cmd, state);
-         break;
-      case VK_CMD_END_QUERY:
-         handle_end_query(cmd, state);
-         break;
-      case VK_CMD_RESET_QUERY_POOL:
-         handle_reset_query_pool(cmd, state);
-         break;
-      case VK_CMD_COPY_QUERY_POOL_RESULTS:
-         handle_copy_query_pool_results(cmd, state);
-         break;
-      case VK_CMD_PUSH_CONSTANTS2:
-         handle_push_constants(cmd, state);
-         break;
-      case VK_CMD_EXECUTE_COMMANDS:
-         handle_execute_commands(cmd, state, print_cmds);
-         break;
-      case VK_CMD_DRAW_INDIRECT_COUNT:
-         emit_state(state);
-         handle_draw_indirect_count(cmd, state, false);
-         break;
-      case VK_CMD_DRAW_INDEXED_INDIRECT_COUNT:
-         emit_state(state);
-         handle_draw_indirect_count(cmd, state, true);
-         break;
-      case VK_CMD_PUSH_DESCRIPTOR_SET2:
-         handle_push_descriptor_set(cmd, state);
-         break;
-      case VK_CMD_PUSH_DESCRIPTOR_SET_WITH_TEMPLATE2:
-         handle_push_descriptor_set_with_template(cmd, state);
-         break;
-      case VK_CMD_BIND_TRANSFORM_FEEDBACK_BUFFERS_EXT:
-         handle_bind_transform_feedback_buffers(cmd, state);
-         break;
-      case VK_CMD_BEGIN_TRANSFORM_FEEDBACK_EXT:
-         handle_begin_transform_feedback(cmd, state);
-         break;
-      case VK_CMD_END_TRANSFORM_FEEDBACK_EXT:
-         handle_end_transform_feedback(cmd, state);
-         break;
-      case VK_CMD_DRAW_INDIRECT_BYTE_COUNT_EXT:
-         emit_state(state);
-         handle_draw_indirect_byte_count(cmd, state);
-         break;
-      case VK_CMD_BEGIN_CONDITIONAL_RENDERING_EXT:
-         handle_begin_conditional_rendering(cmd, state);
-         break;
-      case VK_CMD_END_CONDITIONAL_RENDERING_EXT:
-         handle_end_conditional_rendering(state);
-         break;
-      case VK_CMD_SET_VERTEX_INPUT_EXT:
-         handle_set_vertex_input(cmd, state);
-         break;
-      case VK_CMD_SET_CULL_MODE:
-         handle_set_cull_mode(cmd, state);
-         break;
-      case VK_CMD_SET_FRONT_FACE:
-         handle_set_front_face(cmd, state);
-         break;
-      case VK_CMD_SET_PRIMITIVE_TOPOLOGY:
-         handle_set_primitive_topology(cmd, state);
-         break;
-      case VK_CMD_SET_DEPTH_TEST_ENABLE:
-         handle_set_depth_test_enable(cmd, state);
-         break;
-      case VK_CMD_SET_DEPTH_WRITE_ENABLE:
-         handle_set_depth_write_enable(cmd, state);
-         break;
-      case VK_CMD_SET_DEPTH_COMPARE_OP:
-         handle_set_depth_compare_op(cmd, state);
-         break;
-      case VK_CMD_SET_DEPTH_BOUNDS_TEST_ENABLE:
-         handle_set_depth_bounds_test_enable(cmd, state);
-         break;
-      case VK_CMD_SET_STENCIL_TEST_ENABLE:
-         handle_set_stencil_test_enable(cmd, state);
-         break;
-      case VK_CMD_SET_STENCIL_OP:
-         handle_set_stencil_op(cmd, state);
-         break;
-      case VK_CMD_SET_LINE_STIPPLE:
-         handle_set_line_stipple(cmd, state);
-         break;
-      case VK_CMD_SET_DEPTH_BIAS_ENABLE:
-         handle_set_depth_bias_enable(cmd, state);
-         break;
-      case VK_CMD_SET_LOGIC_OP_EXT:
-         handle_set_logic_op(cmd, state);
-         break;
-      case VK_CMD_SET_PATCH_CONTROL_POINTS_EXT:
-         handle_set_patch_control_points(cmd, state);
-         break;
-      case VK_CMD_SET_PRIMITIVE_RESTART_ENABLE:
-         handle_set_primitive_restart_enable(cmd, state);
-         break;
-      case VK_CMD_SET_RASTERIZER_DISCARD_ENABLE:
-         handle_set_rasterizer_discard_enable(cmd, state);
-         break;
-      case VK_CMD_SET_COLOR_WRITE_ENABLE_EXT:
-         handle_set_color_write_enable(cmd, state);
-         break;
-      case VK_CMD_BEGIN_RENDERING:
-         handle_begin_rendering(cmd, state);
-         break;
-      case VK_CMD_END_RENDERING:
-         handle_end_rendering(cmd, state);
-         break;
-      case VK_CMD_SET_DEVICE_MASK:
-         /* no-op */
-         break;
-      case VK_CMD_RESET_EVENT2:
-         handle_event_reset2(cmd, state);
-         break;
-      case VK_CMD_SET_EVENT2:
-         handle_event_set2(cmd, state);
-         break;
-      case VK_CMD_WAIT_EVENTS2:
-         handle_wait_events2(cmd, state);
-         break;
-      case VK_CMD_WRITE_TIMESTAMP2:
-         handle_write_timestamp2(cmd, state);
-         break;
-      case VK_CMD_SET_POLYGON_MODE_EXT:
-         handle_set_polygon_mode(cmd, state);
-         break;
-      case VK_CMD_SET_TESSELLATION_DOMAIN_ORIGIN_EXT:
-         handle_set_tessellation_domain_origin(cmd, state);
-         break;
-      case VK_CMD_SET_DEPTH_CLAMP_ENABLE_EXT:
-         handle_set_depth_clamp_enable(cmd, state);
-         break;
-      case VK_CMD_SET_DEPTH_CLIP_ENABLE_EXT:
-         handle_set_depth_clip_enable(cmd, state);
-         break;
-      case VK_CMD_SET_LOGIC_OP_ENABLE_EXT:
-         handle_set_logic_op_enable(cmd, state);
-         break;
-      case VK_CMD_SET_SAMPLE_MASK_EXT:
-         handle_set_sample_mask(cmd, state);
-         break;
-      case VK_CMD_SET_RASTERIZATION_SAMPLES_EXT:
-         handle_set_samples(cmd, state);
-         break;
-      case VK_CMD_SET_ALPHA_TO_COVERAGE_ENABLE_EXT:
-         handle_set_alpha_to_coverage(cmd, state);
-         break;
-      case VK_CMD_SET_ALPHA_TO_ONE_ENABLE_EXT:
-         handle_set_alpha_to_one(cmd, state);
-         break;
-      case VK_CMD_SET_DEPTH_CLIP_NEGATIVE_ONE_TO_ONE_EXT:
-         handle_set_halfz(cmd, state);
-         break;
-      case VK_CMD_SET_LINE_RASTERIZATION_MODE_EXT:
-         handle_set_line_rasterization_mode(cmd, state);
-         break;
-      case VK_CMD_SET_LINE_STIPPLE_ENABLE_EXT:
-         handle_set_line_stipple_enable(cmd, state);
-         break;
-      case VK_CMD_SET_PROVOKING_VERTEX_MODE_EXT:
-         handle_set_provoking_vertex_mode(cmd, state);
-         break;
-      case VK_CMD_SET_COLOR_BLEND_ENABLE_EXT:
-         handle_set_color_blend_enable(cmd, state);
-         break;
-      case VK_CMD_SET_COLOR_WRITE_MASK_EXT:
-         handle_set_color_write_mask(cmd, state);
-         break;
-      case VK_CMD_SET_COLOR_BLEND_EQUATION_EXT:
-         handle_set_color_blend_equation(cmd, state);
-         break;
-      case VK_CMD_BIND_SHADERS_EXT:
-         handle_shaders(cmd, state);
-         break;
-      case VK_CMD_SET_ATTACHMENT_FEEDBACK_LOOP_ENABLE_EXT:
-         break;
-      case VK_CMD_DRAW_MESH_TASKS_EXT:
-         emit_state(state);
-         handle_draw_mesh_tasks(cmd, state);
-         break;
-      case VK_CMD_DRAW_MESH_TASKS_INDIRECT_EXT:
-         emit_state(state);
-         handle_draw_mesh_tasks_indirect(cmd, state);
-         break;
-      case VK_CMD_DRAW_MESH_TASKS_INDIRECT_COUNT_EXT:
-         emit_state(state);
-         handle_draw_mesh_tasks_indirect_count(cmd, state);
-         break;
-      case VK_CMD_PREPROCESS_GENERATED_COMMANDS_EXT:
-         handle_preprocess_generated_commands_ext(cmd, state, print_cmds);
-         break;
-      case VK_CMD_EXECUTE_GENERATED_COMMANDS_EXT:
-         handle_execute_generated_commands_ext(cmd, state, print_cmds);
-         break;
-      case VK_CMD_BIND_DESCRIPTOR_BUFFERS_EXT:
-         handle_descriptor_buffers(cmd, state);
-         break;
-      case VK_CMD_SET_DESCRIPTOR_BUFFER_OFFSETS2_EXT:
-         handle_descriptor_buffer_offsets(cmd, state);
-         break;
-      case VK_CMD_BIND_DESCRIPTOR_BUFFER_EMBEDDED_SAMPLERS2_EXT:
-         handle_descriptor_buffer_embedded_samplers(cmd, state);
-         break;
-#ifdef VK_ENABLE_BETA_EXTENSIONS
-      case VK_CMD_INITIALIZE_GRAPH_SCRATCH_MEMORY_AMDX:
-         break;
-      case VK_CMD_DISPATCH_GRAPH_INDIRECT_COUNT_AMDX:
-         break;
-      case VK_CMD_DISPATCH_GRAPH_INDIRECT_AMDX:
-         break;
-      case VK_CMD_DISPATCH_GRAPH_AMDX:
-         handle_dispatch_graph(cmd, state);
-         break;
-#endif
-      case VK_CMD_SET_RENDERING_ATTACHMENT_LOCATIONS:
-         handle_rendering_attachment_locations(cmd, state);
-         break;
-      case VK_CMD_SET_RENDERING_INPUT_ATTACHMENT_INDICES:
-         handle_rendering_input_attachment_indices(cmd, state);
-         break;
-      case VK_CMD_COPY_ACCELERATION_STRUCTURE_KHR:
-         handle_copy_acceleration_structure(cmd, state);
-         break;
-      case VK_CMD_COPY_MEMORY_TO_ACCELERATION_STRUCTURE_KHR:
-         handle_copy_memory_to_acceleration_structure(cmd, state);
-         break;
-      case VK_CMD_COPY_ACCELERATION_STRUCTURE_TO_MEMORY_KHR:
-         handle_copy_acceleration_structure_to_memory(cmd, state);
-         break;
-      case VK_CMD_BUILD_ACCELERATION_STRUCTURES_INDIRECT_KHR:
-         break;
-      case VK_CMD_WRITE_ACCELERATION_STRUCTURES_PROPERTIES_KHR:
-         handle_write_acceleration_structures_properties(cmd, state);
-         break;
-      case VK_CMD_SET_RAY_TRACING_PIPELINE_STACK_SIZE_KHR:
-         break;
-      case VK_CMD_TRACE_RAYS_INDIRECT2_KHR:
-         handle_trace_rays_indirect2(cmd, state);
-         break;
-      case VK_CMD_TRACE_RAYS_INDIRECT_KHR:
-         handle_trace_rays_indirect(cmd, state);
-         break;
-      case VK_CMD_TRACE_RAYS_KHR:
-         handle_trace_rays(cmd, state);
-         break;
-      default:
-         fprintf(stderr, "Unsupported command %s\n", vk_cmd_queue_type_names[cmd->type]);
-         unreachable("Unsupported command");
-         break;
+      } else if (cmd->type < VK_CMD_TYPE_COUNT) {
+         did_flush = false;
       }
-      did_flush = false;
+
+      lvp_execute_cmd(lvp_get_cmd_handler(cmd), cmd, state);
+
       if (!cmd->cmd_link.next)
          break;
    }
 }
 
+/* A command of a command buffer with its handler looked up already. */
+struct lvp_cmd_stream_entry {
+   const struct lvp_cmd_handler *handler;
+   struct vk_cmd_queue_entry *cmd;
+};
+
+/* Whether cmd sets all of the state set by the earlier command prev. */
+static bool
+lvp_cmd_overwrites(const struct vk_cmd_queue_entry *cmd,
+                   const struct vk_cmd_queue_entry *prev)
+{
+   if (cmd->type != prev->type)
+      return false;
+
+   switch (cmd->type) {
+   case VK_CMD_SET_VIEWPORT:
+      return cmd->u.set_viewport.first_viewport == prev->u.set_viewport.first_viewport &&
+             cmd->u.set_viewport.viewport_count == prev->u.set_viewport.viewport_count;
+   case VK_CMD_SET_SCISSOR:
+      return cmd->u.set_scissor.first_scissor == prev->u.set_scissor.first_scissor &&
+             cmd->u.set_scissor.scissor_count == prev->u.set_scissor.scissor_count;
+   case VK_CMD_SET_STENCIL_COMPARE_MASK:
+      return !(prev->u.set_stencil_compare_mask.face_mask & ~cmd->u.set_stencil_compare_mask.face_mask);
+   case VK_CMD_SET_STENCIL_WRITE_MASK:
+      return !(prev->u.set_stencil_write_mask.face_mask & ~cmd->u.set_stencil_write_mask.face_mask);
+   case VK_CMD_SET_STENCIL_REFERENCE:
+      return !(prev->u.set_stencil_reference.face_mask & ~cmd->u.set_stencil_reference.face_mask);
+   case VK_CMD_SET_STENCIL_OP:
+      return !(prev->u.set_stencil_op.face_mask & ~cmd->u.set_stencil_op.face_mask);
+   case VK_CMD_SET_COLOR_BLEND_ENABLE_EXT:
+      return cmd->u.set_color_blend_enable_ext.first_attachment == prev->u.set_color_blend_enable_ext.first_attachment &&
+             cmd->u.set_color_blend_enable_ext.attachment_count == prev->u.set_color_blend_enable_ext.attachment_count;
+   case VK_CMD_SET_COLOR_WRITE_MASK_EXT:
+      return cmd->u.set_color_write_mask_ext.first_attachment == prev->u.set_color_write_mask_ext.first_attachment &&
+             cmd->u.set_color_write_mask_ext.attachment_count == prev->u.set_color_write_mask_ext.attachment_count;
+   case VK_CMD_SET_COLOR_BLEND_EQUATION_EXT:
+      return cmd->u.set_color_blend_equation_ext.first_attachment == prev->u.set_color_blend_equation_ext.first_attachment &&
+             cmd->u.set_color_blend_equation_ext.attachment_count == prev->u.set_color_blend_equation_ext.attachment_count;
+   default:
+      return true;
+   }
+}
+
+/* Whether the command only binds resources or waits, without reading or
+ * changing the pipeline and dynamic state.
+ */
+static bool
+lvp_cmd_binds_resources(const struct vk_cmd_queue_entry *cmd)
+{
+   switch (cmd->type) {
+   case VK_CMD_BIND_DESCRIPTOR_SETS2:
+   case VK_CMD_BIND_INDEX_BUFFER:
+   case VK_CMD_BIND_INDEX_BUFFER2:
+   case VK_CMD_BIND_VERTEX_BUFFERS2:
+   case VK_CMD_PUSH_CONSTANTS2:
+   case VK_CMD_PUSH_DESCRIPTOR_SET2:
+   case VK_CMD_PUSH_DESCRIPTOR_SET_WITH_TEMPLATE2:
+   case VK_CMD_PIPELINE_BARRIER2:
+      return true;
+   default:
+      return false;
+   }
+}
+
+/* Translates the command list of a command buffer into a flat array of
+ * commands with their handlers resolved, so that submitting the command
+ * buffer again doesn't have to do it.
+ *
+ * The part of the translation which doesn't depend on descriptors is done
+ * here as well: commands without effect, redundant barriers, binds of the
+ * graphics pipeline which is bound already and dynamic state which is set
+ * again before anything uses it are left out, so they cost neither a
+ * handler call nor a CSO lookup on every submission.
+ *
+ * The rest of the translation to gallium state still happens at submit
+ * time, because it depends on the contents of descriptor sets and buffers,
+ * which can change between submissions, and because CSOs belong to the
+ * context of the queue the command buffer is submitted to.
+ */
+void
+lvp_compile_cmd_buffer(struct lvp_cmd_buffer *cmd_buffer)
+{
+   struct util_dynarray *stream = &cmd_buffer->cmd_stream;
+   struct vk_cmd_queue_entry *cmd;
+   struct lvp_pipeline *gfx_pipeline = NULL;
+   unsigned state_start = 0;
+   bool did_flush = false;
+
+   util_dynarray_clear(stream);
+
+   /* Compiling doesn't pay off for command buffers which are submitted
+    * once.
+    */
+   if (!cmd_buffer->device->compile_cmds ||
+       (cmd_buffer->usage_flags & VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT))
+      return;
+
+   LIST_FOR_EACH_ENTRY(cmd, &cmd_buffer->vk.cmd_queue.cmds, cmd_link) {
+      const struct lvp_cmd_handler *handler = lvp_get_cmd_handler(cmd);
+
+      if (handler->exec == handle_nop)
+         continue;
+
+      if (cmd->type == VK_CMD_PIPELINE_BARRIER2) {
+         if (did_flush)
+            continue;
+         did_flush = true;
+      } else if (cmd->type < VK_CMD_TYPE_COUNT) {
+         did_flush = false;
+      }
+
+      if (cmd->type == VK_CMD_BIND_PIPELINE) {
+         LVP_FROM_HANDLE(lvp_pipeline, pipeline, cmd->u.bind_pipeline.pipeline);
+         if (pipeline->type == LVP_PIPELINE_GRAPHICS) {
+            if (pipeline == gfx_pipeline)
+               continue;
+            gfx_pipeline = pipeline;
+         }
+      } else if (handler->emit == LVP_EMIT_NONE &&
+                 !lvp_cmd_binds_resources(cmd)) {
+         /* Binding the pipeline again would undo what this did. */
+         gfx_pipeline = NULL;
+      }
+
+      unsigned count = util_dynarray_num_elements(stream, struct lvp_cmd_stream_entry);
+
+      if (handler->replaceable) {
+         /* Drop the command this one overwrites if nothing used its state
+          * in between.
+          */
+         struct lvp_cmd_stream_entry *entries = stream->data;
+         for (unsigned i = state_start; i < count; i++) {
+            if (lvp_cmd_overwrites(cmd, entries[i].cmd)) {
+               memmove(&entries[i], &entries[i + 1],
+                       (count - i - 1) * sizeof(*entries));
+               stream->size -= sizeof(*entries);
+               break;
+            }
+         }
+      } else if (!lvp_cmd_binds_resources(cmd)) {
+         state_start = count + 1;
+      }
+
+      struct lvp_cmd_stream_entry *entry =
+         util_dynarray_grow(stream, struct lvp_cmd_stream_entry, 1);
+      if (!entry) {
+         /* Replay the command list instead. */
+         util_dynarray_clear(stream);
+         return;
+      }
+
+      entry->handler = handler;
+      entry->cmd = cmd;
+   }
+}
+
+static void lvp_execute_cmd_stream(const struct util_dynarray *stream,
+                                   struct rendering_state *state)
+{
+   util_dynarray_foreach(stream, struct lvp_cmd_stream_entry, entry)
+      lvp_execute_cmd(entry->handler, entry->cmd, state);
+}
+
 VkResult lvp_execute_cmds(struct lvp_device *device,
                           struct lvp_queue *queue,
                           struct lvp_cmd_buffer *cmd_buffer)
@@ -5337,6 +5337,7 @@ VkResult lvp_execute_cmds(struct lvp_device *device,
    memset(state, 0, sizeof(*state));
    state->pctx = queue->ctx;
    state->device = device;
+   state->queue = queue;
    state->uploader = queue->uploader;
    state->cso = queue->cso;
    state->blend_dirty = true;
@@ -5372,7 +5373,10 @@ VkResult lvp_execute_cmds(struct lvp_device *device,
    state->index_buffer = state->device->zero_buffer;
 
    /* create a gallium context */
-   lvp_execute_cmd_buffer(&cmd_buffer->vk.cmd_queue.cmds, state, device->print_cmds);
+   if (cmd_buffer->cmd_stream.size)
+      lvp_execute_cmd_stream(&cmd_buffer->cmd_stream, state);
+   else
+      lvp_execute_cmd_buffer(&cmd_buffer->vk.cmd_queue.cmds, state);
 
    state->start_vb = -1;
    state->num_vb = 0;
@@ -44,34 +44,56 @@
 
 typedef void (*cso_destroy_func)(struct pipe_context*, void*);
 
+static void
+shader_cso_destroy(struct pipe_context *ctx, gl_shader_stage stage, void *cso)
+{
+   cso_destroy_func destroy[] = {
+      ctx->delete_vs_state,
+      ctx->delete_tcs_state,
+      ctx->delete_tes_state,
+      ctx->delete_gs_state,
+      ctx->delete_fs_state,
+      ctx->delete_compute_state,
+      ctx->delete_ts_state,
+      ctx->delete_ms_state,
+   };
+
+   destroy[stage](ctx, cso);
+}
+
 static void
 shader_destroy(struct lvp_device *device, struct lvp_shader *shader, bool locked)
 {
    if (!shader->pipeline_nir)
       return;
    gl_shader_stage stage = shader->pipeline_nir->nir->info.stage;
-   cso_destroy_func destroy[] = {
-      device->queue.ctx->delete_vs_state,
-      device->queue.ctx->delete_tcs_state,
-      device->queue.ctx->delete_tes_state,
-      device->queue.ctx->delete_gs_state,
-      device->queue.ctx->delete_fs_state,
-      device->queue.ctx->delete_compute_state,
-      device->queue.ctx->delete_ts_state,
-      device->queue.ctx->delete_ms_state,
-   };
 
    if (!locked)
       simple_mtx_lock(&device->queue.lock);
 
    if (shader->shader_cso)
-      destroy[stage](device->queue.ctx, shader->shader_cso);
+      shader_cso_destroy(device->queue.ctx, stage, shader->shader_cso);
    if (shader->tess_ccw_cso)
-      destroy[stage](device->queue.ctx, shader->tess_ccw_cso);
+      shader_cso_destroy(device->queue.ctx, stage, shader->tess_ccw_cso);
 
    if (!locked)
       simple_mtx_unlock(&device->queue.lock);
 
+   for (uint32_t i = 1; i < device->queue_count; i++) {
+      struct lvp_queue *queue = device->queues[i];
+      void **csos = shader->queue_csos[i - 1];
+
+      if (!csos[0] && !csos[1])
+         continue;
+
+      simple_mtx_lock(&queue->lock);
+      for (unsigned j = 0; j < 2; j++) {
+         if (csos[j])
+            shader_cso_destroy(queue->ctx, stage, csos[j]);
+      }
+      simple_mtx_unlock(&queue->lock);
+   }
+
    lvp_pipeline_nir_ref(&shader->pipeline_nir, NULL);
    lvp_pipeline_nir_ref(&shader->tess_ccw, NULL);
 }
@@ -98,6 +120,9 @@ lvp_pipeline_destroy(struct lvp_device *device, struct lvp_pipeline *pipeline, b
    free(pipeline->rt.stages);
    free(pipeline->rt.groups);
 
+   if (pipeline->type == LVP_PIPELINE_GRAPHICS)
+      simple_mtx_destroy(&pipeline->compile_lock);
+
    vk_free(&device->vk.alloc, pipeline->state_data);
    vk_object_base_finish(&pipeline->base);
    vk_free(&device->vk.alloc, pipeline);
@@ -115,9 +140,9 @@ VKAPI_ATTR void VKAPI_CALL lvp_DestroyPipeline(
       return;
 
    if (pipeline->used) {
-      simple_mtx_lock(&device->queue.lock);
-      util_dynarray_append(&device->queue.pipeline_destroys, struct lvp_pipeline*, pipeline);
-      simple_mtx_unlock(&device->queue.lock);
+      simple_mtx_lock(&device->pipeline_destroys_lock);
+      util_dynarray_append(&device->pipeline_destroys, struct lvp_pipeline*, pipeline);
+      simple_mtx_unlock(&device->pipeline_destroys_lock);
    } else {
       lvp_pipeline_destroy(device, pipeline, false);
    }
@@ -383,7 +408,7 @@ lvp_shader_lower(struct lvp_device *pdevice, nir_shader *nir, struct lvp_pipelin
 
    lvp_lower_pipeline_layout(pdevice, layout, nir);
 
-   NIR_PASS(_, nir, lvp_nir_lower_ray_queries);
+   NIR_PASS(_, nir, lvp_nir_lower_ray_queries, pdevice->bvh_width);
 
    if (nir->info.stage == MESA_SHADER_COMPUTE ||
        nir->info.stage == MESA_SHADER_TASK ||
@@ -573,14 +598,14 @@ lvp_pipeline_xfb_init(struct lvp_pipeline *pipeline)
 }
 
 static void *
-lvp_shader_compile_stage(struct lvp_device *device, struct lvp_shader *shader, nir_shader *nir)
+lvp_shader_compile_stage(struct pipe_context *ctx, struct lvp_shader *shader, nir_shader *nir)
 {
    if (nir->info.stage == MESA_SHADER_COMPUTE) {
       struct pipe_compute_state shstate = {0};
       shstate.prog = nir;
       shstate.ir_type = PIPE_SHADER_IR_NIR;
       shstate.static_shared_mem = nir->info.shared_size;
-      return device->queue.ctx->create_compute_state(device->queue.ctx, &shstate);
+      return ctx->create_compute_state(ctx, &shstate);
    } else {
       struct pipe_shader_state shstate = {0};
       shstate.type = PIPE_SHADER_IR_NIR;
@@ -589,19 +614,19 @@ lvp_shader_compile_stage(struct lvp_device *device, struct lvp_shader *shader, n
 
       switch (nir->info.stage) {
       case MESA_SHADER_FRAGMENT:
-         return device->queue.ctx->create_fs_state(device->queue.ctx, &shstate);
+         return ctx->create_fs_state(ctx, &shstate);
       case MESA_SHADER_VERTEX:
-         return device->queue.ctx->create_vs_state(device->queue.ctx, &shstate);
+         return ctx->create_vs_state(ctx, &shstate);
       case MESA_SHADER_GEOMETRY:
-         return device->queue.ctx->create_gs_state(device->queue.ctx, &shstate);
+         return ctx->create_gs_state(ctx, &shstate);
       case MESA_SHADER_TESS_CTRL:
-         return device->queue.ctx->create_tcs_state(device->queue.ctx, &shstate);
+         return ctx->create_tcs_state(ctx, &shstate);
       case MESA_SHADER_TESS_EVAL:
-         return device->queue.ctx->create_tes_state(device->queue.ctx, &shstate);
+         return ctx->create_tes_state(ctx, &shstate);
       case MESA_SHADER_TASK:
-         return device->queue.ctx->create_ts_state(device->queue.ctx, &shstate);
+         return ctx->create_ts_state(ctx, &shstate);
       case MESA_SHADER_MESH:
-         return device->queue.ctx->create_ms_state(device->queue.ctx, &shstate);
+         return ctx->create_ms_state(ctx, &shstate);
       default:
          unreachable("illegal shader");
          break;
@@ -618,7 +643,7 @@ lvp_shader_compile(struct lvp_device *device, struct lvp_shader *shader, nir_sha
    if (!locked)
       simple_mtx_lock(&device->queue.lock);
 
-   void *state = lvp_shader_compile_stage(device, shader, nir);
+   void *state = lvp_shader_compile_stage(device->queue.ctx, shader, nir);
 
    if (!locked)
       simple_mtx_unlock(&device->queue.lock);
@@ -626,6 +651,31 @@ lvp_shader_compile(struct lvp_device *device, struct lvp_shader *shader, nir_sha
    return state;
 }
 
+/**
+ * Returns the CSO of the shader for the context of the queue.  CSOs can't be
+ * shared between llvmpipe contexts, so the other queues compile their own
+ * copy the first time they bind the shader.  Called with the queue's lock
+ * held.
+ */
+void *
+lvp_shader_get_cso(struct lvp_queue *queue, struct lvp_shader *shader, bool tess_ccw)
+{
+   if (queue->index == 0)
+      return tess_ccw ? shader->tess_ccw_cso : shader->shader_cso;
+
+   void **cso = &shader->queue_csos[queue->index - 1][tess_ccw];
+   struct lvp_pipeline_nir *pipeline_nir = tess_ccw ? shader->tess_ccw : shader->pipeline_nir;
+   if (!*cso && pipeline_nir) {
+      struct pipe_screen *pscreen = queue->device->pscreen;
+      nir_shader *nir = nir_shader_clone(NULL, pipeline_nir->nir);
+
+      pscreen->finalize_nir(pscreen, nir);
+      *cso = lvp_shader_compile_stage(queue->ctx, shader, nir);
+   }
+
+   return *cso;
+}
+
 #ifndef NDEBUG
 static bool
 layouts_equal(const struct lvp_descriptor_set_layout *a, const struct lvp_descriptor_set_layout *b)
@@ -736,10 +786,30 @@ copy_shader_sanitized(struct lvp_shader *dst, const struct lvp_shader *src)
    *dst = *src;
    dst->pipeline_nir = NULL; //this gets handled later
    dst->tess_ccw = NULL; //this gets handled later
+   /* the other queues compile their own CSOs for the new pipeline */
+   memset(dst->queue_csos, 0, sizeof(dst->queue_csos));
    assert(!dst->shader_cso);
    assert(!dst->tess_ccw_cso);
 }
 
+static void
+lvp_pipeline_compile_csos(struct lvp_pipeline *pipeline, bool locked)
+{
+   for (uint32_t i = 0; i < ARRAY_SIZE(pipeline->shaders); i++) {
+      if (!pipeline->shaders[i].pipeline_nir)
+         continue;
+
+      gl_shader_stage stage = i;
+      assert(stage == pipeline->shaders[i].pipeline_nir->nir->info.stage);
+
+      pipeline->shaders[stage].shader_cso = lvp_shader_compile(pipeline->device, &pipeline->shaders[stage],
+         nir_shader_clone(NULL, pipeline->shaders[stage].pipeline_nir->nir), locked);
+      if (pipeline->shaders[MESA_SHADER_TESS_EVAL].tess_ccw)
+         pipeline->shaders[MESA_SHADER_TESS_EVAL].tess_ccw_cso = lvp_shader_compile(pipeline->device, &pipeline->shaders[stage],
+            nir_shader_clone(NULL, pipeline->shaders[MESA_SHADER_TESS_EVAL].tess_ccw->nir), locked);
+   }
+}
+
 static VkResult
 lvp_graphics_pipeline_init(struct lvp_pipeline *pipeline,
                            struct lvp_device *device,
@@ -895,8 +965,10 @@ lvp_graphics_pipeline_init(struct lvp_pipeline *pipeline,
          pipeline->line_rectangular = true;
       lvp_pipeline_xfb_init(pipeline);
    }
-   if (!libstate && !pipeline->library)
-      lvp_pipeline_shaders_compile(pipeline, false);
+   if (!libstate && !pipeline->library) {
+      lvp_pipeline_compile_csos(pipeline, false);
+      pipeline->compiled = true;
+   }
 
    return VK_SUCCESS;
 
@@ -909,25 +981,24 @@ fail:
    return result;
 }
 
+/**
+ * Compiles the CSOs of a pipeline that was linked without them when it is
+ * first bound.  Called with the queue's lock held.  Only the first queue uses
+ * these CSOs, the others compile their own in lvp_shader_get_cso().
+ */
 void
-lvp_pipeline_shaders_compile(struct lvp_pipeline *pipeline, bool locked)
+lvp_pipeline_shaders_compile(struct lvp_pipeline *pipeline, struct lvp_queue *queue)
 {
-   if (pipeline->compiled)
+   if (queue->index != 0 || p_atomic_read(&pipeline->compiled))
       return;
-   for (uint32_t i = 0; i < ARRAY_SIZE(pipeline->shaders); i++) {
-      if (!pipeline->shaders[i].pipeline_nir)
-         continue;
-
-      gl_shader_stage stage = i;
-      assert(stage == pipeline->shaders[i].pipeline_nir->nir->info.stage);
 
-      pipeline->shaders[stage].shader_cso = lvp_shader_compile(pipeline->device, &pipeline->shaders[stage],
-         nir_shader_clone(NULL, pipeline->shaders[stage].pipeline_nir->nir), locked);
-      if (pipeline->shaders[MESA_SHADER_TESS_EVAL].tess_ccw)
-         pipeline->shaders[MESA_SHADER_TESS_EVAL].tess_ccw_cso = lvp_shader_compile(pipeline->device, &pipeline->shaders[stage],
-            nir_shader_clone(NULL, pipeline->shaders[MESA_SHADER_TESS_EVAL].tess_ccw->nir), locked);
+   simple_mtx_lock(&pipeline->compile_lock);
+   if (!pipeline->compiled) {
+      lvp_pipeline_compile_csos(pipeline, true);
+      /* Publishes the CSOs to the unlocked check above. */
+      p_atomic_set(&pipeline->compiled, true);
    }
-   pipeline->compiled = true;
+   simple_mtx_unlock(&pipeline->compile_lock);
 }
 
 static VkResult
@@ -953,9 +1024,11 @@ lvp_graphics_pipeline_create(
 
    vk_object_base_init(&device->vk, &pipeline->base,
                        VK_OBJECT_TYPE_PIPELINE);
+   simple_mtx_init(&pipeline->compile_lock, mtx_plain);
    uint64_t t0 = os_time_get_nano();
    result = lvp_graphics_pipeline_init(pipeline, device, cache, pCreateInfo, flags);
    if (result != VK_SUCCESS) {
+      simple_mtx_destroy(&pipeline->compile_lock);
       vk_free(&device->vk.alloc, pipeline);
       return result;
    }
@@ -37,6 +37,7 @@
 #include "util/simple_mtx.h"
 #include "util/u_queue.h"
 #include "util/u_upload_mgr.h"
+#include "util/vma.h"
 
 #include "compiler/shader_enums.h"
 #include "pipe/p_screen.h"
@@ -108,6 +109,10 @@ extern "C" {
 #define MAX_DGC_TOKENS 16
 /* Currently lavapipe does not support more than 1 image plane */
 #define LVP_MAX_PLANE_COUNT 1
+/* A universal queue family and a compute/transfer one */
+#define LVP_QUEUE_FAMILY_COUNT 2
+#define LVP_MAX_QUEUES_PER_FAMILY 4
+#define LVP_MAX_QUEUES (LVP_QUEUE_FAMILY_COUNT * LVP_MAX_QUEUES_PER_FAMILY)
 
 #ifdef _WIN32
 #define lvp_printflike(a, b)
@@ -189,12 +194,14 @@ bool lvp_physical_device_extension_supported(struct lvp_physical_device *dev,
 struct lvp_queue {
    struct vk_queue vk;
    struct lvp_device *                         device;
+   /* Position in lvp_device::queues, 0 is lvp_device::queue */
+   uint32_t index;
    struct pipe_context *ctx;
    struct cso_context *cso;
    struct u_upload_mgr *uploader;
    struct pipe_fence_handle *last_fence;
+   void *noop_fs;
    void *state;
-   struct util_dynarray pipeline_destroys;
    simple_mtx_t lock;
 };
 
@@ -207,16 +214,21 @@ struct lvp_pipeline_cache {
 struct lvp_device {
    struct vk_device vk;
 
+   /* The first queue, its context also creates the device's objects */
    struct lvp_queue queue;
+   struct lvp_queue *queues[LVP_MAX_QUEUES];
+   uint32_t queue_count;
    struct lvp_instance *                       instance;
    struct lvp_physical_device *physical_device;
    struct pipe_screen *pscreen;
-   void *noop_fs;
+   simple_mtx_t pipeline_destroys_lock;
+   struct util_dynarray pipeline_destroys;
    simple_mtx_t bda_lock;
    struct hash_table bda;
    struct pipe_resource *zero_buffer; /* for zeroed bda */
    bool poison_mem;
    bool print_cmds;
+   bool compile_cmds;
 
    struct lp_texture_handle *null_texture_handle;
    struct lp_texture_handle *null_image_handle;
@@ -229,6 +241,15 @@ struct lvp_device {
    radix_sort_vk_t *radix_sort;
    simple_mtx_t radix_sort_lock;
    struct vk_acceleration_structure_build_args accel_struct_args;
+
+   /* Build acceleration structures with lvp_build_as instead of the
+    * compute shaders of the runtime.
+    */
+   bool cpu_bvh_builder;
+   /* The number of children of the box nodes, see lvp_bvh_box_node_size. */
+   uint32_t bvh_width;
+   struct util_queue bvh_queue;
+   simple_mtx_t bvh_queue_lock;
 };
 
 void lvp_device_get_cache_uuid(void *uuid);
@@ -374,9 +395,14 @@ struct lvp_descriptor_set {
    struct lvp_descriptor_set_layout *layout;
    struct list_head link;
 
-   /* Buffer holding the descriptors. */
+   /* Range of bo holding the descriptors.  The memory is only owned by the
+    * set if pmem is set, otherwise it's part of the pool's arena or of an
+    * upload buffer.
+    */
    struct pipe_memory_allocation *pmem;
    struct pipe_resource *bo;
+   uint32_t bo_offset;
+   uint32_t bo_size;
    void *map;
 };
 
@@ -386,11 +412,19 @@ struct lvp_descriptor_pool {
    uint32_t max_sets;
 
    struct list_head sets;
+
+   /* Arena the descriptors of the sets are sub-allocated from. */
+   struct pipe_memory_allocation *pmem;
+   struct pipe_resource *bo;
+   void *map;
+   uint64_t size;
+   struct util_vma_heap heap;
 };
 
 VkResult
 lvp_descriptor_set_create(struct lvp_device *device,
                           struct lvp_descriptor_set_layout *layout,
+                          struct u_upload_mgr *uploader,
                           struct lvp_descriptor_set **out_set);
 
 void
@@ -446,6 +480,8 @@ struct lvp_shader {
    struct lvp_pipeline_nir *tess_ccw;
    void *shader_cso;
    void *tess_ccw_cso;
+   /* CSOs for the contexts of the other queues, see lvp_shader_get_cso() */
+   void *queue_csos[LVP_MAX_QUEUES - 1][2];
    struct pipe_stream_output_info stream_output;
    struct blob blob; //preserved for GetShaderBinaryDataEXT
    uint32_t push_constant_size;
@@ -526,7 +562,9 @@ struct lvp_pipeline {
    bool disable_multisample;
    bool line_rectangular;
    bool library;
+   /* Set once the CSOs of the first queue exist, see lvp_pipeline_shaders_compile() */
    bool compiled;
+   simple_mtx_t compile_lock;
    bool used;
 
    struct {
@@ -565,7 +603,7 @@ struct lvp_exec_graph_internal_data {
 };
 
 void
-lvp_pipeline_shaders_compile(struct lvp_pipeline *pipeline, bool locked);
+lvp_pipeline_shaders_compile(struct lvp_pipeline *pipeline, struct lvp_queue *queue);
 
 struct lvp_event {
    struct vk_object_base base;
@@ -605,15 +643,27 @@ struct lvp_query_pool {
    VkQueryPipelineStatisticFlags pipeline_stats;
    enum pipe_query_type base_type;
    void *data; /* Used by queries that are not implemented by pipe_query */
+   /* The context of the queue that created each pipe_query */
+   struct pipe_context **query_ctxs;
    struct pipe_query *queries[0];
 };
 
+void
+lvp_query_pool_destroy_queries(struct lvp_query_pool *pool, uint32_t first, uint32_t count);
+
 struct lvp_cmd_buffer {
    struct vk_command_buffer vk;
 
    struct lvp_device *                          device;
 
    uint8_t push_constants[MAX_PUSH_CONSTANTS_SIZE];
+
+   VkCommandBufferUsageFlags usage_flags;
+
+   /* The commands of vk.cmd_queue with their handlers resolved, built by
+    * vkEndCommandBuffer. If it's empty, vk.cmd_queue is executed directly.
+    */
+   struct util_dynarray cmd_stream;
 };
 
 struct lvp_indirect_command_layout_nv {
@@ -723,6 +773,7 @@ VkResult lvp_image_bind_sparse(struct lvp_device *device,
                                struct lvp_queue *queue,
                                VkSparseImageMemoryBindInfo *bind);
 
+void lvp_compile_cmd_buffer(struct lvp_cmd_buffer *cmd_buffer);
 VkResult lvp_execute_cmds(struct lvp_device *device,
                           struct lvp_queue *queue,
                           struct lvp_cmd_buffer *cmd_buffer);
@@ -802,6 +853,8 @@ lvp_shader_optimize(nir_shader *nir);
 
 void *
 lvp_shader_compile(struct lvp_device *device, struct lvp_shader *shader, nir_shader *nir, bool locked);
+void *
+lvp_shader_get_cso(struct lvp_queue *queue, struct lvp_shader *shader, bool tess_ccw);
 
 enum vk_cmd_type
 lvp_nv_dgc_token_to_cmd_type(const VkIndirectCommandsLayoutTokenNV *token);
@@ -833,9 +886,9 @@ struct lvp_cmd_fill_buffer_addr {
 };
 
 void
-lvp_encode_as(struct vk_acceleration_structure *dst, VkDeviceAddress intermediate_as_addr,
-              VkDeviceAddress intermediate_header_addr, uint32_t leaf_count,
-              VkGeometryTypeKHR geometry_type);
+lvp_encode_as(struct lvp_device *device, struct vk_acceleration_structure *dst,
+              VkDeviceAddress intermediate_as_addr, VkDeviceAddress intermediate_header_addr,
+              uint32_t leaf_count, VkGeometryTypeKHR geometry_type);
 
 struct lvp_cmd_encode_as {
    struct vk_acceleration_structure *dst;
@@ -850,8 +903,10 @@ enum {
    LVP_CMD_DISPATCH_UNALIGNED,
    LVP_CMD_FILL_BUFFER_ADDR,
    LVP_CMD_ENCODE_AS,
+   LVP_CMD_BUILD_AS,
    LVP_CMD_SAVE_STATE,
    LVP_CMD_RESTORE_STATE,
+   LVP_CMD_TYPE_COUNT,
 };
 
 #ifdef __cplusplus
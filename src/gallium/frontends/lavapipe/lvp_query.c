@@ -32,7 +32,7 @@ VKAPI_ATTR VkResult VKAPI_CALL lvp_CreateQueryPool(
 {
    LVP_FROM_HANDLE(lvp_device, device, _device);
 
-   uint32_t query_size = sizeof(struct pipe_query *);
+   uint32_t query_size = sizeof(struct pipe_query *) + sizeof(struct pipe_context *);
    enum pipe_query_type pipeq;
    switch (pCreateInfo->queryType) {
    case VK_QUERY_TYPE_OCCLUSION:
@@ -88,6 +88,8 @@ VKAPI_ATTR VkResult VKAPI_CALL lvp_CreateQueryPool(
    pool->base_type = pipeq;
    pool->pipeline_stats = pCreateInfo->pipelineStatistics;
    pool->data = &pool->queries;
+   if (pipeq < PIPE_QUERY_TYPES)
+      pool->query_ctxs = (struct pipe_context **)(pool->queries + pool->count);
 
    *pQueryPool = lvp_query_pool_to_handle(pool);
    return VK_SUCCESS;
@@ -104,11 +106,8 @@ VKAPI_ATTR void VKAPI_CALL lvp_DestroyQueryPool(
    if (!pool)
       return;
 
-   if (pool->base_type < PIPE_QUERY_TYPES) {
-      for (unsigned i = 0; i < pool->count; i++)
-         if (pool->queries[i])
-            device->queue.ctx->destroy_query(device->queue.ctx, pool->queries[i]);
-   }
+   if (pool->base_type < PIPE_QUERY_TYPES)
+      lvp_query_pool_destroy_queries(pool, 0, pool->count);
    vk_object_base_finish(&pool->base);
    vk_free2(&device->vk.alloc, pAllocator, pool);
 }
@@ -152,10 +151,10 @@ VKAPI_ATTR VkResult VKAPI_CALL lvp_GetQueryPoolResults(
       }
 
       if (pool->queries[i]) {
-         ready = device->queue.ctx->get_query_result(device->queue.ctx,
-                                                     pool->queries[i],
-                                                     (flags & VK_QUERY_RESULT_WAIT_BIT),
-                                                     &result);
+         struct pipe_context *ctx = pool->query_ctxs[i];
+         ready = ctx->get_query_result(ctx, pool->queries[i],
+                                       (flags & VK_QUERY_RESULT_WAIT_BIT),
+                                       &result);
       } else {
          result.u64 = 0;
       }
@@ -222,24 +221,28 @@ VKAPI_ATTR VkResult VKAPI_CALL lvp_GetQueryPoolResults(
    return vk_result;
 }
 
+/* Queries are destroyed by the context of the queue that created them. */
+void
+lvp_query_pool_destroy_queries(struct lvp_query_pool *pool, uint32_t first, uint32_t count)
+{
+   for (uint32_t i = first; i < first + count; i++) {
+      if (pool->queries[i]) {
+         pool->query_ctxs[i]->destroy_query(pool->query_ctxs[i], pool->queries[i]);
+         pool->queries[i] = NULL;
+      }
+   }
+}
+
 VKAPI_ATTR void VKAPI_CALL lvp_ResetQueryPool(
    VkDevice                                    _device,
    VkQueryPool                                 queryPool,
    uint32_t                                    firstQuery,
    uint32_t                                    queryCount)
 {
-   LVP_FROM_HANDLE(lvp_device, device, _device);
    LVP_FROM_HANDLE(lvp_query_pool, pool, queryPool);
 
    if (pool->base_type >= PIPE_QUERY_TYPES)
       return;
 
-   for (uint32_t i = 0; i < queryCount; i++) {
-      uint32_t idx = i + firstQuery;
-
-      if (pool->queries[idx]) {
-         device->queue.ctx->destroy_query(device->queue.ctx, pool->queries[idx]);
-         pool->queries[idx] = NULL;
-      }
-   }
+   lvp_query_pool_destroy_queries(pool, firstQuery, queryCount);
 }
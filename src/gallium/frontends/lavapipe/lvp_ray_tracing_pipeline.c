@@ -347,7 +347,8 @@ lvp_ray_tracing_state_init(nir_shader *nir, struct lvp_ray_tracing_pipeline_comp
 }
 
 static void
-lvp_ray_traversal_state_init(nir_function_impl *impl, struct lvp_ray_traversal_state *state)
+lvp_ray_traversal_state_init(nir_function_impl *impl, uint32_t bvh_width,
+                             struct lvp_ray_traversal_state *state)
 {
    state->origin = nir_local_variable_create(impl, glsl_vec_type(3), "traversal.origin");
    state->dir = nir_local_variable_create(impl, glsl_vec_type(3), "traversal.dir");
@@ -356,7 +357,8 @@ lvp_ray_traversal_state_init(nir_function_impl *impl, struct lvp_ray_traversal_s
    state->current_node = nir_local_variable_create(impl, glsl_uint_type(), "traversal.current_node");
    state->stack_base = nir_local_variable_create(impl, glsl_uint_type(), "traversal.stack_base");
    state->stack_ptr = nir_local_variable_create(impl, glsl_uint_type(), "traversal.stack_ptr");
-   state->stack = nir_local_variable_create(impl, glsl_array_type(glsl_uint_type(), 24 * 2, 0), "traversal.stack");
+   state->stack = nir_local_variable_create(impl, glsl_array_type(glsl_uint_type(), lvp_bvh_stack_size(bvh_width), 0),
+                                            "traversal.stack");
    state->hit = nir_local_variable_create(impl, glsl_bool_type(), "traversal.hit");
 
    state->instance_addr = nir_local_variable_create(impl, glsl_uint64_t_type(), "traversal.instance_addr");
@@ -745,7 +747,7 @@ lvp_trace_ray(nir_builder *b, struct lvp_ray_tracing_pipeline_compiler *compiler
 
    nir_store_var(b, state->shader_call_data_offset, nir_iadd_imm(b, payload, -stack_size), 0x1);
 
-   lvp_ray_traversal_state_init(b->impl, &state->traversal);
+   lvp_ray_traversal_state_init(b->impl, compiler->pipeline->device->bvh_width, &state->traversal);
 
    nir_store_var(b, state->bvh_base, accel_struct, 0x1);
    nir_store_var(b, state->flags, flags, 0x1);
@@ -789,6 +791,7 @@ lvp_trace_ray(nir_builder *b, struct lvp_ray_tracing_pipeline_compiler *compiler
       .origin = origin,
       .tmin = tmin,
       .dir = dir,
+      .bvh_width = compiler->pipeline->device->bvh_width,
       .vars = vars,
       .aabb_cb = (compiler->flags & VK_PIPELINE_CREATE_2_RAY_TRACING_SKIP_AABBS_BIT_KHR) ?
                  NULL : lvp_handle_aabb_intersection,
@@ -87,6 +87,9 @@ struct lvp_ray_traversal_args {
    nir_def *tmin;
    nir_def *dir;
 
+   /* The number of children of the box nodes, see lvp_bvh_box_node_size. */
+   uint32_t bvh_width;
+
    struct lvp_ray_traversal_vars vars;
 
    lvp_aabb_intersection_cb aabb_cb;
@@ -114,7 +117,7 @@ void lvp_lower_pipeline_layout(const struct lvp_device *device,
                                struct lvp_pipeline_layout *layout,
                                nir_shader *shader);
 
-bool lvp_nir_lower_ray_queries(struct nir_shader *shader);
+bool lvp_nir_lower_ray_queries(struct nir_shader *shader, uint32_t bvh_width);
 
 bool lvp_nir_lower_sparse_residency(struct nir_shader *shader);
 
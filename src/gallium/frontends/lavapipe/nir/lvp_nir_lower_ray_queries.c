@@ -143,6 +143,8 @@ struct ray_query_vars {
 
    rq_variable *incomplete;
 
+   uint32_t bvh_width;
+
    struct ray_query_intersection_vars closest;
    struct ray_query_intersection_vars candidate;
 
@@ -154,7 +156,7 @@ struct ray_query_vars {
 
 static struct ray_query_traversal_vars
 init_ray_query_traversal_vars(void *ctx, nir_shader *shader, unsigned array_length,
-                              const char *base_name)
+                              uint32_t bvh_width, const char *base_name)
 {
    struct ray_query_traversal_vars result;
 
@@ -171,7 +173,9 @@ init_ray_query_traversal_vars(void *ctx, nir_shader *shader, unsigned array_leng
    result.stack_base =
       rq_variable_create(ctx, shader, array_length, glsl_uint_type(), VAR_NAME("_stack_base"));
    result.stack_ptr = rq_variable_create(ctx, shader, array_length, glsl_uint_type(), VAR_NAME("_stack_ptr"));
-   result.stack = rq_variable_create(ctx, shader, array_length, glsl_array_type(glsl_uint_type(), 24 * 2, 0), VAR_NAME("_stack"));
+   result.stack = rq_variable_create(ctx, shader, array_length,
+                                     glsl_array_type(glsl_uint_type(), lvp_bvh_stack_size(bvh_width), 0),
+                                     VAR_NAME("_stack"));
    return result;
 }
 
@@ -207,8 +211,8 @@ init_ray_query_intersection_vars(void *ctx, nir_shader *shader, unsigned array_l
 }
 
 static void
-init_ray_query_vars(nir_shader *shader, unsigned array_length, struct ray_query_vars *dst,
-                    const char *base_name)
+init_ray_query_vars(nir_shader *shader, unsigned array_length, uint32_t bvh_width,
+                    struct ray_query_vars *dst, const char *base_name)
 {
    void *ctx = dst;
    const struct glsl_type *vec3_type = glsl_vector_type(GLSL_TYPE_FLOAT, 3);
@@ -226,17 +230,20 @@ init_ray_query_vars(nir_shader *shader, unsigned array_length, struct ray_query_
    dst->incomplete =
       rq_variable_create(dst, shader, array_length, glsl_bool_type(), VAR_NAME("_incomplete"));
 
+   dst->bvh_width = bvh_width;
+
    dst->closest = init_ray_query_intersection_vars(dst, shader, array_length, VAR_NAME("_closest"));
    dst->candidate =
       init_ray_query_intersection_vars(dst, shader, array_length, VAR_NAME("_candidate"));
 
-   dst->trav = init_ray_query_traversal_vars(dst, shader, array_length, VAR_NAME("_top"));
+   dst->trav = init_ray_query_traversal_vars(dst, shader, array_length, bvh_width, VAR_NAME("_top"));
 }
 
 #undef VAR_NAME
 
 static void
-lower_ray_query(nir_shader *shader, nir_variable *ray_query, struct hash_table *ht)
+lower_ray_query(nir_shader *shader, nir_variable *ray_query, uint32_t bvh_width,
+                struct hash_table *ht)
 {
    struct ray_query_vars *vars = ralloc(ht, struct ray_query_vars);
 
@@ -244,7 +251,8 @@ lower_ray_query(nir_shader *shader, nir_variable *ray_query, struct hash_table *
    if (glsl_type_is_array(ray_query->type))
       array_length = glsl_get_length(ray_query->type);
 
-   init_ray_query_vars(shader, array_length, vars, ray_query->name == NULL ? "" : ray_query->name);
+   init_ray_query_vars(shader, array_length, bvh_width, vars,
+                       ray_query->name == NULL ? "" : ray_query->name);
 
    _mesa_hash_table_insert(ht, ray_query, vars);
 }
@@ -532,6 +540,7 @@ lower_rq_proceed(nir_builder *b, nir_def *index, struct ray_query_vars *vars)
       .origin = rq_load_var(b, index, vars->origin),
       .tmin = rq_load_var(b, index, vars->tmin),
       .dir = rq_load_var(b, index, vars->direction),
+      .bvh_width = vars->bvh_width,
       .vars = trav_vars,
       .aabb_cb = handle_candidate_aabb,
       .triangle_cb = handle_candidate_triangle,
@@ -557,7 +566,7 @@ lower_rq_terminate(nir_builder *b, nir_def *index, nir_intrinsic_instr *instr,
 }
 
 bool
-lvp_nir_lower_ray_queries(struct nir_shader *shader)
+lvp_nir_lower_ray_queries(struct nir_shader *shader, uint32_t bvh_width)
 {
    bool progress = false;
    struct hash_table *query_ht = _mesa_pointer_hash_table_create(NULL);
@@ -566,7 +575,7 @@ lvp_nir_lower_ray_queries(struct nir_shader *shader)
       if (!var->data.ray_query)
          continue;
 
-      lower_ray_query(shader, var, query_ht);
+      lower_ray_query(shader, var, bvh_width, query_ht);
 
       progress = true;
    }
@@ -581,7 +590,7 @@ lvp_nir_lower_ray_queries(struct nir_shader *shader)
          if (!var->data.ray_query)
             continue;
 
-         lower_ray_query(shader, var, query_ht);
+         lower_ray_query(shader, var, bvh_width, query_ht);
 
          progress = true;
       }
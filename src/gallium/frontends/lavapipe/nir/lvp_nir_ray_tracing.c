@@ -62,92 +62,96 @@ lvp_load_vertex_position(nir_builder *b, nir_def *primitive_addr, uint32_t index
 }
 
 static nir_def *
-lvp_build_intersect_ray_box(nir_builder *b, nir_def **node_data, nir_def *ray_tmax,
-                            nir_def *origin, nir_def *dir, nir_def *inv_dir)
+lvp_load_node_data_vec(nir_builder *b, nir_def *addr, nir_def **node_data, uint32_t offset,
+                       uint32_t num_components)
 {
-   const struct glsl_type *vec2_type = glsl_vector_type(GLSL_TYPE_FLOAT, 2);
-   const struct glsl_type *uvec2_type = glsl_vector_type(GLSL_TYPE_UINT, 2);
+   if (offset + num_components * 4 <= LVP_BVH_NODE_PREFETCH_SIZE && node_data)
+      return nir_vec(b, node_data + offset / 4, num_components);
 
-   nir_variable *distances =
-      nir_variable_create(b->shader, nir_var_shader_temp, vec2_type, "distances");
-   nir_store_var(b, distances, nir_imm_vec2(b, INFINITY, INFINITY), 0xf);
+   return nir_build_load_global(b, num_components, 32, nir_iadd_imm(b, addr, offset));
+}
 
-   nir_variable *child_indices =
-      nir_variable_create(b->shader, nir_var_shader_temp, uvec2_type, "child_indices");
-   nir_store_var(b, child_indices, nir_imm_ivec2(b, 0xffffffffu, 0xffffffffu), 0xf);
+/* Tests the ray against the bounds of all children of a box node and returns
+ * the children sorted by distance, children that are not hit are
+ * LVP_BVH_INVALID_NODE and come last.
+ */
+static void
+lvp_build_intersect_ray_box(nir_builder *b, uint32_t width, nir_def *node_addr, nir_def **node_data,
+                            nir_def *ray_tmax, nir_def *origin, nir_def *dir, nir_def *inv_dir,
+                            nir_def **children)
+{
+   /* Test up to 4 children at once, wider vectors are not handled by all of
+    * the NIR passes.
+    */
+   const uint32_t group_size = MIN2(width, 4);
 
    inv_dir = nir_bcsel(b, nir_feq_imm(b, dir, 0), nir_imm_float(b, FLT_MAX), inv_dir);
 
-   for (int i = 0; i < 2; i++) {
-      const uint32_t child_offset = offsetof(struct lvp_bvh_box_node, children[i]);
-      const uint32_t coord_offsets[2] = {
-         offsetof(struct lvp_bvh_box_node, bounds[i].min.x),
-         offsetof(struct lvp_bvh_box_node, bounds[i].max.x),
-      };
-
-      nir_def *child_index = lvp_load_node_data(b, NULL, node_data, child_offset);
-
-      nir_def *node_coords[2] = {
-         nir_vec3(b,
-            lvp_load_node_data(b, NULL, node_data, coord_offsets[0] + 0),
-            lvp_load_node_data(b, NULL, node_data, coord_offsets[0] + 4),
-            lvp_load_node_data(b, NULL, node_data, coord_offsets[0] + 8)
-         ),
-         nir_vec3(b,
-            lvp_load_node_data(b, NULL, node_data, coord_offsets[1] + 0),
-            lvp_load_node_data(b, NULL, node_data, coord_offsets[1] + 4),
-            lvp_load_node_data(b, NULL, node_data, coord_offsets[1] + 8)
-         ),
-      };
+   nir_def *distances[LVP_BVH_MAX_WIDTH];
+
+   for (uint32_t base = 0; base < width; base += group_size) {
+      nir_def *coords[6];
+      for (uint32_t i = 0; i < 6; i++) {
+         coords[i] = lvp_load_node_data_vec(b, node_addr, node_data,
+                                            lvp_bvh_box_bounds_offset(width, i) + base * 4,
+                                            group_size);
+      }
+
+      nir_def *child_indices =
+         lvp_load_node_data_vec(b, node_addr, node_data,
+                                lvp_bvh_box_children_offset(width) + base * 4, group_size);
+
+      nir_def *tmin = NULL;
+      nir_def *tmax = NULL;
+      for (uint32_t i = 0; i < 3; i++) {
+         nir_def *axis_origin = nir_replicate(b, nir_channel(b, origin, i), group_size);
+         nir_def *axis_inv_dir = nir_replicate(b, nir_channel(b, inv_dir, i), group_size);
+
+         nir_def *bound0 = nir_fmul(b, nir_fsub(b, coords[i], axis_origin), axis_inv_dir);
+         nir_def *bound1 = nir_fmul(b, nir_fsub(b, coords[i + 3], axis_origin), axis_inv_dir);
+
+         nir_def *axis_tmin = nir_fmin(b, bound0, bound1);
+         nir_def *axis_tmax = nir_fmax(b, bound0, bound1);
+         tmin = tmin ? nir_fmax(b, tmin, axis_tmin) : axis_tmin;
+         tmax = tmax ? nir_fmin(b, tmax, axis_tmax) : axis_tmax;
+      }
 
       /* If x of the aabb min is NaN, then this is an inactive aabb.
        * We don't need to care about any other components being NaN as that is UB.
        * https://registry.khronos.org/vulkan/specs/latest/html/vkspec.html#acceleration-structure-inactive-prims
        */
-      nir_def *min_x = nir_channel(b, node_coords[0], 0);
-      nir_def *min_x_is_not_nan =
-         nir_inot(b, nir_fneu(b, min_x, min_x)); /* NaN != NaN -> true */
-
-      nir_def *bound0 = nir_fmul(b, nir_fsub(b, node_coords[0], origin), inv_dir);
-      nir_def *bound1 = nir_fmul(b, nir_fsub(b, node_coords[1], origin), inv_dir);
-
-      nir_def *tmin =
-         nir_fmax(b,
-                  nir_fmax(b, nir_fmin(b, nir_channel(b, bound0, 0), nir_channel(b, bound1, 0)),
-                           nir_fmin(b, nir_channel(b, bound0, 1), nir_channel(b, bound1, 1))),
-                  nir_fmin(b, nir_channel(b, bound0, 2), nir_channel(b, bound1, 2)));
-
-      nir_def *tmax =
-         nir_fmin(b,
-                  nir_fmin(b, nir_fmax(b, nir_channel(b, bound0, 0), nir_channel(b, bound1, 0)),
-                           nir_fmax(b, nir_channel(b, bound0, 1), nir_channel(b, bound1, 1))),
-                  nir_fmax(b, nir_channel(b, bound0, 2), nir_channel(b, bound1, 2)));
-
-      nir_push_if(b,
-                  nir_iand(b, min_x_is_not_nan,
-                           nir_iand(b, nir_fge(b, tmax, nir_fmax(b, nir_imm_float(b, 0.0f), tmin)),
-                                    nir_flt(b, tmin, ray_tmax))));
-      {
-         nir_def *new_child_indices[2] = {child_index, child_index};
-         nir_store_var(b, child_indices, nir_vec(b, new_child_indices, 2), 1u << i);
+      nir_def *min_x_is_not_nan = nir_feq(b, coords[0], coords[0]);
+
+      nir_def *hit =
+         nir_iand(b, min_x_is_not_nan,
+                  nir_iand(b, nir_fge(b, tmax, nir_fmax(b, nir_imm_float(b, 0.0f), tmin)),
+                           nir_flt(b, tmin, nir_replicate(b, ray_tmax, group_size))));
 
-         nir_def *new_distances[2] = {tmin, tmin};
-         nir_store_var(b, distances, nir_vec(b, new_distances, 2), 1u << i);
+      tmin = nir_bcsel(b, hit, tmin, nir_imm_float(b, INFINITY));
+      child_indices = nir_bcsel(b, hit, child_indices, nir_imm_int(b, LVP_BVH_INVALID_NODE));
+
+      for (uint32_t i = 0; i < group_size; i++) {
+         distances[base + i] = nir_channel(b, tmin, i);
+         children[base + i] = nir_channel(b, child_indices, i);
       }
-      nir_pop_if(b, NULL);
    }
 
-   nir_def *ssa_distances = nir_load_var(b, distances);
-   nir_def *ssa_indices = nir_load_var(b, child_indices);
-   nir_push_if(b, nir_flt(b, nir_channel(b, ssa_distances, 1), nir_channel(b, ssa_distances, 0)));
-   {
-      nir_store_var(b, child_indices,
-                    nir_vec2(b, nir_channel(b, ssa_indices, 1), nir_channel(b, ssa_indices, 0)),
-                    0b11);
-   }
-   nir_pop_if(b, NULL);
+   /* Sort the children by distance with a compare-exchange network, which
+    * keeps the traversal free of branches until the children are pushed.
+    */
+   for (uint32_t i = 0; i < width - 1; i++) {
+      for (uint32_t j = 0; j < width - 1 - i; j++) {
+         nir_def *swap = nir_flt(b, distances[j + 1], distances[j]);
+
+         nir_def *distance = distances[j];
+         distances[j] = nir_bcsel(b, swap, distances[j + 1], distance);
+         distances[j + 1] = nir_bcsel(b, swap, distance, distances[j + 1]);
 
-   return nir_load_var(b, child_indices);
+         nir_def *child = children[j];
+         children[j] = nir_bcsel(b, swap, children[j + 1], child);
+         children[j + 1] = nir_bcsel(b, swap, child, children[j + 1]);
+      }
+   }
 }
 
 static nir_def *
@@ -513,18 +517,24 @@ lvp_build_ray_traversal(nir_builder *b, const struct lvp_ray_traversal_args *arg
          }
          nir_push_else(b, NULL);
          {
-            nir_def *result = lvp_build_intersect_ray_box(
-               b, node_data, tmax,
+            nir_def *children[LVP_BVH_MAX_WIDTH];
+            lvp_build_intersect_ray_box(
+               b, args->bvh_width, node_addr, node_data, tmax,
                nir_load_deref(b, args->vars.origin), nir_load_deref(b, args->vars.dir),
-               nir_load_deref(b, args->vars.inv_dir));
+               nir_load_deref(b, args->vars.inv_dir), children);
 
-            nir_store_deref(b, args->vars.current_node, nir_channel(b, result, 0), 0x1);
+            nir_store_deref(b, args->vars.current_node, children[0], 0x1);
 
-            nir_push_if(b, nir_ine_imm(b, nir_channel(b, result, 1), LVP_BVH_INVALID_NODE));
-            {
-               lvp_build_push_stack(b, args, nir_channel(b, result, 1));
+            /* Push the other children far to near, so that the nearest one is
+             * popped first.
+             */
+            for (int32_t i = args->bvh_width - 1; i > 0; i--) {
+               nir_push_if(b, nir_ine_imm(b, children[i], LVP_BVH_INVALID_NODE));
+               {
+                  lvp_build_push_stack(b, args, children[i]);
+               }
+               nir_pop_if(b, NULL);
             }
-            nir_pop_if(b, NULL);
          }
          nir_pop_if(b, NULL);
       }
@@ -0,0 +1,752 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/*
+ * Measures how long it takes to build acceleration structures, from
+ * vkQueueSubmit until the fence is signaled.
+ *
+ * Three kinds of builds are measured for a number of sizes: a bottom level
+ * acceleration structure with random triangles, an update of such an
+ * acceleration structure, and a top level acceleration structure with
+ * random instances of a small bottom level acceleration structure.
+ *
+ * Every measurement is done once with the BVHs built by the compute shaders
+ * of the common Vulkan runtime and once with the native builder
+ * (LVP_CPU_BVH). The native builds are also measured for every supported
+ * box node width (LVP_BVH_WIDTH), since collapsing the tree into wider nodes
+ * is part of the build.
+ *
+ * Ray query throughput is measured by tracing a grid of parallel rays
+ * through top level acceleration structures with box nodes of every
+ * supported width (LVP_BVH_WIDTH), width 2 being the binary layout, and
+ * through the trees of both builders, which shows whether the native builder
+ * trades trace performance for build time.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vulkan/vulkan_core.h>
+
+#include "util/macros.h"
+#include "util/os_time.h"
+
+#define DEVICE_FUNCTIONS \
+   ITEM(AllocateCommandBuffers) \
+   ITEM(AllocateMemory) \
+   ITEM(BeginCommandBuffer) \
+   ITEM(BindBufferMemory) \
+   ITEM(CmdBindPipeline) \
+   ITEM(CmdBuildAccelerationStructuresKHR) \
+   ITEM(CmdDispatch) \
+   ITEM(CmdPushConstants) \
+   ITEM(CreateAccelerationStructureKHR) \
+   ITEM(CreateBuffer) \
+   ITEM(CreateCommandPool) \
+   ITEM(CreateComputePipelines) \
+   ITEM(CreateFence) \
+   ITEM(CreatePipelineLayout) \
+   ITEM(CreateShaderModule) \
+   ITEM(DestroyDevice) \
+   ITEM(DeviceWaitIdle) \
+   ITEM(EndCommandBuffer) \
+   ITEM(GetAccelerationStructureBuildSizesKHR) \
+   ITEM(GetAccelerationStructureDeviceAddressKHR) \
+   ITEM(GetBufferDeviceAddress) \
+   ITEM(GetBufferMemoryRequirements) \
+   ITEM(GetDeviceQueue) \
+   ITEM(MapMemory) \
+   ITEM(QueueSubmit) \
+   ITEM(ResetFences) \
+   ITEM(WaitForFences)
+
+#include "lvp_test_common.h"
+
+/* Number of primitives of the bottom level acceleration structure that is
+ * instanced by the top level acceleration structures.
+ */
+#define INSTANCED_TRIANGLES 64
+
+/* The ray query shader traces one ray in +z direction per invocation from a
+ * grid of RAY_GRID_WIDTH x RAY_GRID_HEIGHT points in the xy unit square.
+ */
+#define RAY_GRID_WIDTH 1024
+#define RAY_GRID_HEIGHT 256
+#define RAY_COUNT (RAY_GRID_WIDTH * RAY_GRID_HEIGHT)
+
+/* Assembled from:
+ *
+ * #version 460
+ * #extension GL_EXT_ray_query : require
+ * #extension GL_EXT_buffer_reference : require
+ *
+ * layout(local_size_x = 64) in;
+ *
+ * layout(buffer_reference, std430) buffer Result { float t[]; };
+ *
+ * layout(push_constant) uniform Constants {
+ *    uint64_t tlas;
+ *    Result result;
+ * };
+ *
+ * void main()
+ * {
+ *    uint i = gl_GlobalInvocationID.x;
+ *    vec3 origin = vec3((i & 1023) / 1024.0, (i >> 10) / 256.0, -1.0);
+ *
+ *    rayQueryEXT rq;
+ *    rayQueryInitializeEXT(rq, accelerationStructureEXT(tlas), gl_RayFlagsOpaqueEXT,
+ *                          0xff, origin, 0.0, vec3(0, 0, 1), 10.0);
+ *    while (rayQueryProceedEXT(rq)) {
+ *    }
+ *
+ *    bool hit = rayQueryGetIntersectionTypeEXT(rq, true) !=
+ *               gl_RayQueryCommittedIntersectionNoneEXT;
+ *    result.t[i] = hit ? rayQueryGetIntersectionTEXT(rq, true) : -1.0;
+ * }
+ */
+static const uint32_t ray_query_spirv[] = {
+   0x07230203, 0x00010500, 0x00000000, 0x0000003e, 0x00000000, 0x00020011,
+   0x00000001, 0x00020011, 0x0000000b, 0x00020011, 0x00001178, 0x00020011,
+   0x000014e3, 0x0006000a, 0x5f565053, 0x5f52484b, 0x5f796172, 0x72657571,
+   0x00000079, 0x0003000e, 0x000014e4, 0x00000001, 0x0007000f, 0x00000005,
+   0x00000001, 0x6e69616d, 0x00000000, 0x00000002, 0x00000003, 0x00060010,
+   0x00000001, 0x00000011, 0x00000040, 0x00000001, 0x00000001, 0x00040047,
+   0x00000002, 0x0000000b, 0x0000001c, 0x00030047, 0x00000004, 0x00000002,
+   0x00050048, 0x00000004, 0x00000000, 0x00000023, 0x00000000, 0x00050048,
+   0x00000004, 0x00000001, 0x00000023, 0x00000008, 0x00020013, 0x00000005,
+   0x00030021, 0x00000006, 0x00000005, 0x00020014, 0x00000007, 0x00040015,
+   0x00000008, 0x00000020, 0x00000000, 0x00040015, 0x00000009, 0x00000040,
+   0x00000000, 0x00030016, 0x0000000a, 0x00000020, 0x00040017, 0x0000000b,
+   0x00000008, 0x00000003, 0x00040017, 0x0000000c, 0x0000000a, 0x00000003,
+   0x000214dd, 0x0000000d, 0x00021178, 0x0000000e, 0x0004001e, 0x00000004,
+   0x00000009, 0x00000009, 0x00040020, 0x0000000f, 0x00000009, 0x00000004,
+   0x00040020, 0x00000010, 0x00000009, 0x00000009, 0x00040020, 0x00000011,
+   0x00000001, 0x0000000b, 0x00040020, 0x00000012, 0x000014e5, 0x0000000a,
+   0x00040020, 0x00000013, 0x00000007, 0x0000000e, 0x0004002b, 0x00000008,
+   0x00000014, 0x00000000, 0x0004002b, 0x00000008, 0x00000015, 0x00000001,
+   0x0004002b, 0x00000008, 0x00000016, 0x0000000a, 0x0004002b, 0x00000008,
+   0x00000017, 0x000003ff, 0x0004002b, 0x00000008, 0x00000018, 0x000000ff,
+   0x0005002b, 0x00000009, 0x00000019, 0x00000004, 0x00000000, 0x0004002b,
+   0x0000000a, 0x0000001a, 0x00000000, 0x0004002b, 0x0000000a, 0x0000001b,
+   0x3f800000, 0x0004002b, 0x0000000a, 0x0000001c, 0xbf800000, 0x0004002b,
+   0x0000000a, 0x0000001d, 0x41200000, 0x0004002b, 0x0000000a, 0x0000001e,
+   0x3a800000, 0x0004002b, 0x0000000a, 0x0000001f, 0x3b800000, 0x0006002c,
+   0x0000000c, 0x00000020, 0x0000001a, 0x0000001a, 0x0000001b, 0x0004003b,
+   0x00000011, 0x00000002, 0x00000001, 0x0004003b, 0x0000000f, 0x00000003,
+   0x00000009, 0x00050036, 0x00000005, 0x00000001, 0x00000000, 0x00000006,
+   0x000200f8, 0x00000021, 0x0004003b, 0x00000013, 0x00000022, 0x00000007,
+   0x0004003d, 0x0000000b, 0x00000023, 0x00000002, 0x00050051, 0x00000008,
+   0x00000024, 0x00000023, 0x00000000, 0x000500c7, 0x00000008, 0x00000025,
+   0x00000024, 0x00000017, 0x000500c2, 0x00000008, 0x00000026, 0x00000024,
+   0x00000016, 0x00040070, 0x0000000a, 0x00000027, 0x00000025, 0x00040070,
+   0x0000000a, 0x00000028, 0x00000026, 0x00050085, 0x0000000a, 0x00000029,
+   0x00000027, 0x0000001e, 0x00050085, 0x0000000a, 0x0000002a, 0x00000028,
+   0x0000001f, 0x00060050, 0x0000000c, 0x0000002b, 0x00000029, 0x0000002a,
+   0x0000001c, 0x00050041, 0x00000010, 0x0000002c, 0x00000003, 0x00000014,
+   0x0004003d, 0x00000009, 0x0000002d, 0x0000002c, 0x0004115f, 0x0000000d,
+   0x0000002e, 0x0000002d, 0x00091179, 0x00000022, 0x0000002e, 0x00000015,
+   0x00000018, 0x0000002b, 0x0000001a, 0x00000020, 0x0000001d, 0x000200f9,
+   0x0000002f, 0x000200f8, 0x0000002f, 0x000400f6, 0x00000030, 0x00000031,
+   0x00000000, 0x000200f9, 0x00000032, 0x000200f8, 0x00000032, 0x0004117d,
+   0x00000007, 0x00000033, 0x00000022, 0x000400fa, 0x00000033, 0x00000031,
+   0x00000030, 0x000200f8, 0x00000031, 0x000200f9, 0x0000002f, 0x000200f8,
+   0x00000030, 0x0005117f, 0x00000008, 0x00000034, 0x00000022, 0x00000015,
+   0x00051782, 0x0000000a, 0x00000035, 0x00000022, 0x00000015, 0x000500ab,
+   0x00000007, 0x00000036, 0x00000034, 0x00000014, 0x000600a9, 0x0000000a,
+   0x00000037, 0x00000036, 0x00000035, 0x0000001c, 0x00050041, 0x00000010,
+   0x00000038, 0x00000003, 0x00000015, 0x0004003d, 0x00000009, 0x00000039,
+   0x00000038, 0x00040071, 0x00000009, 0x0000003a, 0x00000024, 0x00050084,
+   0x00000009, 0x0000003b, 0x0000003a, 0x00000019, 0x00050080, 0x00000009,
+   0x0000003c, 0x00000039, 0x0000003b, 0x00040078, 0x00000012, 0x0000003d,
+   0x0000003c, 0x0005003e, 0x0000003d, 0x00000037, 0x00000002, 0x00000004,
+   0x000100fd, 0x00010038
+};
+
+struct ray_query_constants {
+   VkDeviceAddress tlas;
+   VkDeviceAddress result;
+};
+
+enum bench_type {
+   BENCH_TRIANGLES,
+   BENCH_UPDATE,
+   BENCH_INSTANCES,
+};
+
+static uint32_t rand_state = 1;
+
+static float
+rand_float(void)
+{
+   rand_state = rand_state * 1664525u + 1013904223u;
+   return (rand_state >> 8) / (float)(1 << 24);
+}
+
+/* Creates a host visible buffer and returns its device address. */
+static VkDeviceAddress
+create_buffer(VkDevice device, VkDeviceSize size, VkBufferUsageFlags usage,
+              VkBuffer *buffer, void **map)
+{
+   VkBufferCreateInfo buffer_info = {
+      .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+      .size = MAX2(size, 1),
+      .usage = usage | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+   };
+   CHECK(CreateBuffer(device, &buffer_info, NULL, buffer));
+
+   VkMemoryRequirements reqs;
+   GetBufferMemoryRequirements(device, *buffer, &reqs);
+
+   VkMemoryAllocateFlagsInfo flags_info = {
+      .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO,
+      .flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT,
+   };
+   VkMemoryAllocateInfo alloc_info = {
+      .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+      .pNext = &flags_info,
+      .allocationSize = reqs.size,
+      .memoryTypeIndex = find_memory_type(reqs.memoryTypeBits,
+                                          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT),
+   };
+   VkDeviceMemory memory;
+   CHECK(AllocateMemory(device, &alloc_info, NULL, &memory));
+   CHECK(BindBufferMemory(device, *buffer, memory, 0));
+
+   if (map)
+      CHECK(MapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, map));
+
+   VkBufferDeviceAddressInfo address_info = {
+      .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+      .buffer = *buffer,
+   };
+   return GetBufferDeviceAddress(device, &address_info);
+}
+
+static VkDevice
+open_device(bool cpu_bvh, unsigned bvh_width, VkQueue *queue)
+{
+   char width[16];
+   snprintf(width, sizeof(width), "%u", bvh_width);
+
+   /* lavapipe reads these when the device is created. */
+   setenv("LVP_CPU_BVH", cpu_bvh ? "true" : "false", 1);
+   setenv("LVP_BVH_WIDTH", width, 1);
+
+   VkPhysicalDeviceRayQueryFeaturesKHR ray_query_features = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_RAY_QUERY_FEATURES_KHR,
+      .rayQuery = true,
+   };
+   VkPhysicalDeviceAccelerationStructureFeaturesKHR as_features = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ACCELERATION_STRUCTURE_FEATURES_KHR,
+      .pNext = &ray_query_features,
+      .accelerationStructure = true,
+   };
+   VkPhysicalDeviceVulkan12Features features12 = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+      .pNext = &as_features,
+      .bufferDeviceAddress = true,
+   };
+   const char *extensions[] = {
+      VK_KHR_ACCELERATION_STRUCTURE_EXTENSION_NAME,
+      VK_KHR_DEFERRED_HOST_OPERATIONS_EXTENSION_NAME,
+      VK_KHR_RAY_QUERY_EXTENSION_NAME,
+   };
+   VkDevice device = create_device(&features12, extensions,
+                                   ARRAY_SIZE(extensions), 1);
+
+   GetDeviceQueue(device, 0, 0, queue);
+   return device;
+}
+
+/* Fills a geometry with count random triangles in the unit cube. */
+static void
+init_triangles(VkDevice device, unsigned count,
+               VkAccelerationStructureGeometryKHR *geometry)
+{
+   VkBuffer buffer;
+   float *vertices;
+   VkDeviceAddress address =
+      create_buffer(device, count * 9 * sizeof(float),
+                    VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
+                    &buffer, (void **)&vertices);
+
+   for (unsigned i = 0; i < count; i++) {
+      float x = rand_float(), y = rand_float(), z = rand_float();
+      for (unsigned v = 0; v < 3; v++) {
+         vertices[i * 9 + v * 3 + 0] = x + rand_float() * 0.01f;
+         vertices[i * 9 + v * 3 + 1] = y + rand_float() * 0.01f;
+         vertices[i * 9 + v * 3 + 2] = z + rand_float() * 0.01f;
+      }
+   }
+
+   *geometry = (VkAccelerationStructureGeometryKHR) {
+      .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR,
+      .geometryType = VK_GEOMETRY_TYPE_TRIANGLES_KHR,
+      .geometry.triangles = {
+         .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR,
+         .vertexFormat = VK_FORMAT_R32G32B32_SFLOAT,
+         .vertexData.deviceAddress = address,
+         .vertexStride = 3 * sizeof(float),
+         .maxVertex = count * 3 - 1,
+         .indexType = VK_INDEX_TYPE_NONE_KHR,
+      },
+      .flags = VK_GEOMETRY_OPAQUE_BIT_KHR,
+   };
+}
+
+/* Fills a geometry with count random instances of blas and returns them. */
+static VkAccelerationStructureInstanceKHR *
+init_instances(VkDevice device, unsigned count, VkDeviceAddress blas,
+               VkAccelerationStructureGeometryKHR *geometry)
+{
+   VkBuffer buffer;
+   VkAccelerationStructureInstanceKHR *instances;
+   VkDeviceAddress address =
+      create_buffer(device, count * sizeof(*instances),
+                    VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
+                    &buffer, (void **)&instances);
+
+   for (unsigned i = 0; i < count; i++) {
+      float scale = 0.01f + rand_float() * 0.04f;
+      instances[i] = (VkAccelerationStructureInstanceKHR) {
+         .transform.matrix = {
+            { scale, 0, 0, rand_float() },
+            { 0, scale, 0, rand_float() },
+            { 0, 0, scale, rand_float() },
+         },
+         .instanceCustomIndex = i,
+         .mask = 0xff,
+         .accelerationStructureReference = blas,
+      };
+   }
+
+   *geometry = (VkAccelerationStructureGeometryKHR) {
+      .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_KHR,
+      .geometryType = VK_GEOMETRY_TYPE_INSTANCES_KHR,
+      .geometry.instances = {
+         .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_INSTANCES_DATA_KHR,
+         .data.deviceAddress = address,
+      },
+   };
+
+   return instances;
+}
+
+/* Creates an acceleration structure for build_info and points build_info
+ * at it and at a scratch buffer that is large enough to build or update it.
+ */
+static VkDeviceAddress
+create_as(VkDevice device, VkAccelerationStructureBuildGeometryInfoKHR *build_info,
+          uint32_t primitive_count)
+{
+   VkAccelerationStructureBuildSizesInfoKHR sizes = {
+      .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_SIZES_INFO_KHR,
+   };
+   GetAccelerationStructureBuildSizesKHR(device,
+                                         VK_ACCELERATION_STRUCTURE_BUILD_TYPE_DEVICE_KHR,
+                                         build_info, &primitive_count, &sizes);
+
+   VkBuffer buffer;
+   create_buffer(device, sizes.accelerationStructureSize,
+                 VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR,
+                 &buffer, NULL);
+
+   VkAccelerationStructureCreateInfoKHR as_info = {
+      .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_CREATE_INFO_KHR,
+      .buffer = buffer,
+      .size = sizes.accelerationStructureSize,
+      .type = build_info->type,
+   };
+   CHECK(CreateAccelerationStructureKHR(device, &as_info, NULL,
+                                        &build_info->dstAccelerationStructure));
+
+   VkBuffer scratch;
+   build_info->scratchData.deviceAddress =
+      create_buffer(device, MAX2(sizes.buildScratchSize, sizes.updateScratchSize),
+                    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, &scratch, NULL);
+
+   VkAccelerationStructureDeviceAddressInfoKHR address_info = {
+      .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_DEVICE_ADDRESS_INFO_KHR,
+      .accelerationStructure = build_info->dstAccelerationStructure,
+   };
+   return GetAccelerationStructureDeviceAddressKHR(device, &address_info);
+}
+
+/* Records a command buffer that builds or updates build_info. */
+static VkCommandBuffer
+record_build(VkDevice device, VkCommandPool cmd_pool,
+             const VkAccelerationStructureBuildGeometryInfoKHR *build_info,
+             uint32_t primitive_count)
+{
+   VkCommandBufferAllocateInfo cmd_info = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+      .commandPool = cmd_pool,
+      .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+      .commandBufferCount = 1,
+   };
+   VkCommandBuffer cmd;
+   CHECK(AllocateCommandBuffers(device, &cmd_info, &cmd));
+
+   VkCommandBufferBeginInfo begin_info = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+   };
+   CHECK(BeginCommandBuffer(cmd, &begin_info));
+
+   VkAccelerationStructureBuildRangeInfoKHR range = {
+      .primitiveCount = primitive_count,
+   };
+   const VkAccelerationStructureBuildRangeInfoKHR *ranges = &range;
+   CmdBuildAccelerationStructuresKHR(cmd, 1, build_info, &ranges);
+
+   CHECK(EndCommandBuffer(cmd));
+   return cmd;
+}
+
+static void
+submit_and_wait(VkDevice device, VkQueue queue, VkCommandBuffer cmd,
+                VkFence fence)
+{
+   VkSubmitInfo submit_info = {
+      .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+      .commandBufferCount = 1,
+      .pCommandBuffers = &cmd,
+   };
+   CHECK(QueueSubmit(queue, 1, &submit_info, fence));
+   CHECK(WaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX));
+   CHECK(ResetFences(device, 1, &fence));
+}
+
+/* Returns the median build time in nanoseconds of acceleration structures
+ * with box nodes of bvh_width children.
+ */
+static int64_t
+measure(bool cpu_bvh, unsigned bvh_width, enum bench_type type, unsigned count,
+        unsigned iterations)
+{
+   VkQueue queue;
+   VkDevice device = open_device(cpu_bvh, bvh_width, &queue);
+
+   /* Use the same primitives for every builder and width. */
+   rand_state = 1;
+
+   VkFenceCreateInfo fence_info = {
+      .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+   };
+   VkFence fence;
+   CHECK(CreateFence(device, &fence_info, NULL, &fence));
+
+   VkCommandPoolCreateInfo cmd_pool_info = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+      .queueFamilyIndex = 0,
+   };
+   VkCommandPool cmd_pool;
+   CHECK(CreateCommandPool(device, &cmd_pool_info, NULL, &cmd_pool));
+
+   VkAccelerationStructureGeometryKHR geometry;
+   VkAccelerationStructureBuildGeometryInfoKHR build_info = {
+      .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
+      .type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+      .flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR,
+      .mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR,
+      .geometryCount = 1,
+      .pGeometries = &geometry,
+   };
+
+   if (type == BENCH_INSTANCES) {
+      init_triangles(device, INSTANCED_TRIANGLES, &geometry);
+      VkDeviceAddress blas = create_as(device, &build_info, INSTANCED_TRIANGLES);
+      submit_and_wait(device, queue,
+                      record_build(device, cmd_pool, &build_info,
+                                   INSTANCED_TRIANGLES),
+                      fence);
+
+      init_instances(device, count, blas, &geometry);
+      build_info.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
+   } else {
+      init_triangles(device, count, &geometry);
+   }
+
+   if (type == BENCH_UPDATE)
+      build_info.flags |= VK_BUILD_ACCELERATION_STRUCTURE_ALLOW_UPDATE_BIT_KHR;
+
+   create_as(device, &build_info, count);
+
+   if (type == BENCH_UPDATE) {
+      /* Build once and update the acceleration structure in place. */
+      submit_and_wait(device, queue,
+                      record_build(device, cmd_pool, &build_info, count),
+                      fence);
+
+      build_info.mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_UPDATE_KHR;
+      build_info.srcAccelerationStructure = build_info.dstAccelerationStructure;
+   }
+
+   VkCommandBuffer cmd = record_build(device, cmd_pool, &build_info, count);
+
+   int64_t *times = malloc(iterations * sizeof(*times));
+   if (!times)
+      exit(1);
+
+   for (unsigned i = 0; i < iterations; i++) {
+      int64_t start = os_time_get_nano();
+      submit_and_wait(device, queue, cmd, fence);
+      times[i] = os_time_get_nano() - start;
+   }
+
+   qsort(times, iterations, sizeof(*times), compare_int64);
+   int64_t median = times[iterations / 2];
+   free(times);
+
+   /* Everything else is freed with the device. */
+   CHECK(DeviceWaitIdle(device));
+   DestroyDevice(device, NULL);
+
+   return median;
+}
+
+static VkPipeline
+create_ray_query_pipeline(VkDevice device, VkPipelineLayout *layout)
+{
+   VkShaderModuleCreateInfo module_info = {
+      .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+      .codeSize = sizeof(ray_query_spirv),
+      .pCode = ray_query_spirv,
+   };
+   VkShaderModule module;
+   CHECK(CreateShaderModule(device, &module_info, NULL, &module));
+
+   VkPushConstantRange push_constant_range = {
+      .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+      .size = sizeof(struct ray_query_constants),
+   };
+   VkPipelineLayoutCreateInfo layout_info = {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+      .pushConstantRangeCount = 1,
+      .pPushConstantRanges = &push_constant_range,
+   };
+   CHECK(CreatePipelineLayout(device, &layout_info, NULL, layout));
+
+   VkComputePipelineCreateInfo pipeline_info = {
+      .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+      .stage = {
+         .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+         .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+         .module = module,
+         .pName = "main",
+      },
+      .layout = *layout,
+   };
+   VkPipeline pipeline;
+   CHECK(CreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipeline_info, NULL,
+                                &pipeline));
+   return pipeline;
+}
+
+/* Returns the median time in nanoseconds it takes to trace RAY_COUNT rays
+ * through a top level acceleration structure with box nodes of bvh_width
+ * children, built by the native builder if cpu_bvh is set. The scene is
+ * either a single instance of a bottom level acceleration structure with
+ * count triangles or count instances of a small one.
+ */
+static int64_t
+measure_ray_queries(bool cpu_bvh, unsigned bvh_width, enum bench_type type,
+                    unsigned count, unsigned iterations)
+{
+   VkQueue queue;
+   VkDevice device = open_device(cpu_bvh, bvh_width, &queue);
+
+   /* Trace the same scene for every builder and width. */
+   rand_state = 1;
+
+   VkFenceCreateInfo fence_info = {
+      .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+   };
+   VkFence fence;
+   CHECK(CreateFence(device, &fence_info, NULL, &fence));
+
+   VkCommandPoolCreateInfo cmd_pool_info = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+      .queueFamilyIndex = 0,
+   };
+   VkCommandPool cmd_pool;
+   CHECK(CreateCommandPool(device, &cmd_pool_info, NULL, &cmd_pool));
+
+   unsigned triangle_count = type == BENCH_INSTANCES ? INSTANCED_TRIANGLES : count;
+   unsigned instance_count = type == BENCH_INSTANCES ? count : 1;
+
+   VkAccelerationStructureGeometryKHR geometry;
+   VkAccelerationStructureBuildGeometryInfoKHR build_info = {
+      .sType = VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_BUILD_GEOMETRY_INFO_KHR,
+      .type = VK_ACCELERATION_STRUCTURE_TYPE_BOTTOM_LEVEL_KHR,
+      .flags = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR,
+      .mode = VK_BUILD_ACCELERATION_STRUCTURE_MODE_BUILD_KHR,
+      .geometryCount = 1,
+      .pGeometries = &geometry,
+   };
+
+   init_triangles(device, triangle_count, &geometry);
+   VkDeviceAddress blas = create_as(device, &build_info, triangle_count);
+   submit_and_wait(device, queue,
+                   record_build(device, cmd_pool, &build_info, triangle_count),
+                   fence);
+
+   VkAccelerationStructureInstanceKHR *instances =
+      init_instances(device, instance_count, blas, &geometry);
+
+   /* The triangles fill the unit cube on their own. */
+   if (type != BENCH_INSTANCES) {
+      instances[0].transform = (VkTransformMatrixKHR) {
+         .matrix = {
+            { 1, 0, 0, 0 },
+            { 0, 1, 0, 0 },
+            { 0, 0, 1, 0 },
+         },
+      };
+   }
+
+   build_info.type = VK_ACCELERATION_STRUCTURE_TYPE_TOP_LEVEL_KHR;
+
+   struct ray_query_constants constants = {
+      .tlas = create_as(device, &build_info, instance_count),
+   };
+   submit_and_wait(device, queue,
+                   record_build(device, cmd_pool, &build_info, instance_count),
+                   fence);
+
+   VkBuffer result;
+   constants.result = create_buffer(device, RAY_COUNT * sizeof(float),
+                                    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                                    &result, NULL);
+
+   VkPipelineLayout layout;
+   VkPipeline pipeline = create_ray_query_pipeline(device, &layout);
+
+   VkCommandBufferAllocateInfo cmd_info = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+      .commandPool = cmd_pool,
+      .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+      .commandBufferCount = 1,
+   };
+   VkCommandBuffer cmd;
+   CHECK(AllocateCommandBuffers(device, &cmd_info, &cmd));
+
+   VkCommandBufferBeginInfo begin_info = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+   };
+   CHECK(BeginCommandBuffer(cmd, &begin_info));
+   CmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+   CmdPushConstants(cmd, layout, VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                    sizeof(constants), &constants);
+   CmdDispatch(cmd, RAY_COUNT / 64, 1, 1);
+   CHECK(EndCommandBuffer(cmd));
+
+   int64_t *times = malloc(iterations * sizeof(*times));
+   if (!times)
+      exit(1);
+
+   for (unsigned i = 0; i < iterations; i++) {
+      int64_t start = os_time_get_nano();
+      submit_and_wait(device, queue, cmd, fence);
+      times[i] = os_time_get_nano() - start;
+   }
+
+   qsort(times, iterations, sizeof(*times), compare_int64);
+   int64_t median = times[iterations / 2];
+   free(times);
+
+   /* Everything else is freed with the device. */
+   CHECK(DeviceWaitIdle(device));
+   DestroyDevice(device, NULL);
+
+   return median;
+}
+
+int
+main(int argc, char **argv)
+{
+   unsigned iterations = 10;
+   static const struct {
+      enum bench_type type;
+      const char *name;
+      unsigned counts[3];
+   } benches[] = {
+      { BENCH_TRIANGLES, "triangles", { 4096, 65536, 262144 } },
+      { BENCH_UPDATE, "update", { 4096, 65536, 262144 } },
+      { BENCH_INSTANCES, "instances", { 1024, 16384, 65536 } },
+   };
+
+   if (argc > 1)
+      iterations = MAX2(atoi(argv[1]), 1);
+
+   if (!create_instance("lvp_bvh_bench"))
+      return 1;
+
+   printf("acceleration structure builds, median of %u builds:\n", iterations);
+   for (unsigned i = 0; i < ARRAY_SIZE(benches); i++) {
+      for (unsigned j = 0; j < ARRAY_SIZE(benches[i].counts); j++) {
+         unsigned n = benches[i].counts[j];
+         int64_t runtime = measure(false, 4, benches[i].type, n, iterations);
+         int64_t native = measure(true, 4, benches[i].type, n, iterations);
+
+         printf("%9s %7u: runtime %9.2f ms, native %9.2f ms\n",
+                benches[i].name, n, runtime / 1000000.0, native / 1000000.0);
+      }
+   }
+
+   printf("\nnative builds by width, median of %u builds, ms:\n", iterations);
+   for (unsigned i = 0; i < ARRAY_SIZE(benches); i++) {
+      for (unsigned j = 0; j < ARRAY_SIZE(benches[i].counts); j++) {
+         unsigned n = benches[i].counts[j];
+         printf("%9s %7u:", benches[i].name, n);
+
+         for (unsigned width = 2; width <= 8; width *= 2) {
+            int64_t time = measure(true, width, benches[i].type, n, iterations);
+            printf(" width %u %9.2f", width, time / 1000000.0);
+         }
+         printf("\n");
+      }
+   }
+
+   printf("\nray queries, median of %u dispatches of %u rays, Mrays/s:\n",
+          iterations, RAY_COUNT);
+   for (unsigned i = 0; i < ARRAY_SIZE(benches); i++) {
+      if (benches[i].type == BENCH_UPDATE)
+         continue;
+
+      for (unsigned j = 0; j < ARRAY_SIZE(benches[i].counts); j++) {
+         unsigned n = benches[i].counts[j];
+         printf("%9s %7u:", benches[i].name, n);
+
+         for (unsigned width = 2; width <= 8; width *= 2) {
+            int64_t time = measure_ray_queries(true, width, benches[i].type, n,
+                                               iterations);
+            printf(" width %u %8.2f", width, RAY_COUNT * 1000.0 / time);
+         }
+         printf("\n");
+      }
+   }
+
+   printf("\nray queries by builder, width 4, Mrays/s:\n");
+   for (unsigned i = 0; i < ARRAY_SIZE(benches); i++) {
+      if (benches[i].type == BENCH_UPDATE)
+         continue;
+
+      for (unsigned j = 0; j < ARRAY_SIZE(benches[i].counts); j++) {
+         unsigned n = benches[i].counts[j];
+         int64_t runtime = measure_ray_queries(false, 4, benches[i].type, n,
+                                               iterations);
+         int64_t native = measure_ray_queries(true, 4, benches[i].type, n,
+                                              iterations);
+
+         printf("%9s %7u: runtime %8.2f, native %8.2f\n", benches[i].name, n,
+                RAY_COUNT * 1000.0 / runtime, RAY_COUNT * 1000.0 / native);
+      }
+   }
+
+   DestroyInstance(instance, NULL);
+   return 0;
+}
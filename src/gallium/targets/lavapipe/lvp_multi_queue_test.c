@@ -0,0 +1,356 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/*
+ * Checks that a submission to the second queue completes while the first
+ * queue is busy.
+ *
+ * The first queue runs a dispatch, then waits on an event that the host only
+ * sets once the second queue is done, so it stays inside its submission the
+ * whole time. The second queue runs the same compute pipeline, which makes it
+ * compile its own copy of the shader, and writes timestamps to a query pool
+ * that is read and destroyed afterwards.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vulkan/vulkan_core.h>
+
+#include "c11/threads.h"
+#include "util/macros.h"
+
+#define DEVICE_FUNCTIONS \
+   ITEM(AllocateCommandBuffers) \
+   ITEM(AllocateMemory) \
+   ITEM(BeginCommandBuffer) \
+   ITEM(BindBufferMemory) \
+   ITEM(CmdBindPipeline) \
+   ITEM(CmdDispatch) \
+   ITEM(CmdPushConstants) \
+   ITEM(CmdResetQueryPool) \
+   ITEM(CmdSetEvent) \
+   ITEM(CmdWaitEvents) \
+   ITEM(CmdWriteTimestamp) \
+   ITEM(CreateBuffer) \
+   ITEM(CreateCommandPool) \
+   ITEM(CreateComputePipelines) \
+   ITEM(CreateEvent) \
+   ITEM(CreateFence) \
+   ITEM(CreatePipelineLayout) \
+   ITEM(CreateQueryPool) \
+   ITEM(CreateShaderModule) \
+   ITEM(DestroyDevice) \
+   ITEM(DestroyPipeline) \
+   ITEM(DestroyQueryPool) \
+   ITEM(DeviceWaitIdle) \
+   ITEM(EndCommandBuffer) \
+   ITEM(GetBufferDeviceAddress) \
+   ITEM(GetBufferMemoryRequirements) \
+   ITEM(GetDeviceQueue) \
+   ITEM(GetEventStatus) \
+   ITEM(GetFenceStatus) \
+   ITEM(GetQueryPoolResults) \
+   ITEM(MapMemory) \
+   ITEM(QueueSubmit) \
+   ITEM(SetEvent) \
+   ITEM(WaitForFences)
+
+#include "lvp_test_common.h"
+
+/* How long the second queue may take, in nanoseconds. */
+#define QUEUE_TIMEOUT 10000000000ull
+
+/* Assembled from:
+ *
+ * #version 460
+ * #extension GL_EXT_buffer_reference : require
+ *
+ * layout(local_size_x = 1) in;
+ *
+ * layout(buffer_reference, std430) buffer Result { uint value; };
+ *
+ * layout(push_constant) uniform Constants {
+ *    Result result;
+ *    uint value;
+ * };
+ *
+ * void main()
+ * {
+ *    result.value = value;
+ * }
+ */
+static const uint32_t store_spirv[] = {
+   0x07230203, 0x00010500, 0x00000000, 0x00000014, 0x00000000, 0x00020011,
+   0x00000001, 0x00020011, 0x0000000b, 0x00020011, 0x000014e3, 0x0003000e,
+   0x000014e4, 0x00000001, 0x0006000f, 0x00000005, 0x00000001, 0x6e69616d,
+   0x00000000, 0x00000002, 0x00060010, 0x00000001, 0x00000011, 0x00000001,
+   0x00000001, 0x00000001, 0x00030047, 0x00000003, 0x00000002, 0x00050048,
+   0x00000003, 0x00000000, 0x00000023, 0x00000000, 0x00050048, 0x00000003,
+   0x00000001, 0x00000023, 0x00000008, 0x00020013, 0x00000004, 0x00030021,
+   0x00000005, 0x00000004, 0x00040015, 0x00000006, 0x00000020, 0x00000000,
+   0x00040015, 0x00000007, 0x00000040, 0x00000000, 0x0004001e, 0x00000003,
+   0x00000007, 0x00000006, 0x00040020, 0x00000008, 0x00000009, 0x00000003,
+   0x00040020, 0x00000009, 0x00000009, 0x00000007, 0x00040020, 0x0000000a,
+   0x00000009, 0x00000006, 0x00040020, 0x0000000b, 0x000014e5, 0x00000006,
+   0x0004002b, 0x00000006, 0x0000000c, 0x00000000, 0x0004002b, 0x00000006,
+   0x0000000d, 0x00000001, 0x0004003b, 0x00000008, 0x00000002, 0x00000009,
+   0x00050036, 0x00000004, 0x00000001, 0x00000000, 0x00000005, 0x000200f8,
+   0x0000000e, 0x00050041, 0x00000009, 0x0000000f, 0x00000002, 0x0000000c,
+   0x0004003d, 0x00000007, 0x00000010, 0x0000000f, 0x00050041, 0x0000000a,
+   0x00000011, 0x00000002, 0x0000000d, 0x0004003d, 0x00000006, 0x00000012,
+   0x00000011, 0x00040078, 0x0000000b, 0x00000013, 0x00000010, 0x0005003e,
+   0x00000013, 0x00000012, 0x00000002, 0x00000004, 0x000100fd, 0x00010038,
+};
+
+struct store_constants {
+   uint64_t address;
+   uint32_t value;
+};
+
+static VkDevice device;
+static VkPipelineLayout layout;
+static VkPipeline pipeline;
+
+static void
+create_pipeline(void)
+{
+   VkShaderModuleCreateInfo module_info = {
+      .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+      .codeSize = sizeof(store_spirv),
+      .pCode = store_spirv,
+   };
+   VkShaderModule module;
+   CHECK(CreateShaderModule(device, &module_info, NULL, &module));
+
+   VkPushConstantRange push_range = {
+      .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+      .size = sizeof(struct store_constants),
+   };
+   VkPipelineLayoutCreateInfo layout_info = {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+      .pushConstantRangeCount = 1,
+      .pPushConstantRanges = &push_range,
+   };
+   CHECK(CreatePipelineLayout(device, &layout_info, NULL, &layout));
+
+   VkComputePipelineCreateInfo pipeline_info = {
+      .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+      .stage = {
+         .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+         .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+         .module = module,
+         .pName = "main",
+      },
+      .layout = layout,
+   };
+   CHECK(CreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipeline_info,
+                                NULL, &pipeline));
+}
+
+static void
+record_store(VkCommandBuffer cmd, uint64_t address, uint32_t value)
+{
+   struct store_constants constants = { address, value };
+
+   CmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+   CmdPushConstants(cmd, layout, VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                    sizeof(constants), &constants);
+   CmdDispatch(cmd, 1, 1, 1);
+}
+
+struct submit_job {
+   VkQueue queue;
+   VkCommandBuffer cmd;
+   VkFence fence;
+};
+
+/* Runs on its own thread, vkQueueSubmit may execute the commands before it
+ * returns.
+ */
+static int
+submit_thread(void *data)
+{
+   struct submit_job *job = data;
+   VkSubmitInfo submit_info = {
+      .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+      .commandBufferCount = 1,
+      .pCommandBuffers = &job->cmd,
+   };
+
+   CHECK(QueueSubmit(job->queue, 1, &submit_info, job->fence));
+   return 0;
+}
+
+int
+main(void)
+{
+   if (!create_instance("lvp_multi_queue_test"))
+      return 1;
+
+   VkPhysicalDeviceVulkan12Features features12 = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
+      .bufferDeviceAddress = VK_TRUE,
+   };
+   device = create_device(&features12, NULL, 0, 2);
+
+   VkQueue queues[2];
+   GetDeviceQueue(device, 0, 0, &queues[0]);
+   GetDeviceQueue(device, 0, 1, &queues[1]);
+
+   /* One value written by each queue. */
+   VkBufferCreateInfo buffer_info = {
+      .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+      .size = 2 * sizeof(uint32_t),
+      .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+               VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+   };
+   VkBuffer buffer;
+   CHECK(CreateBuffer(device, &buffer_info, NULL, &buffer));
+
+   VkMemoryRequirements reqs;
+   GetBufferMemoryRequirements(device, buffer, &reqs);
+   VkMemoryAllocateFlagsInfo flags_info = {
+      .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO,
+      .flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT,
+   };
+   VkMemoryAllocateInfo alloc_info = {
+      .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+      .pNext = &flags_info,
+      .allocationSize = reqs.size,
+      .memoryTypeIndex = find_memory_type(reqs.memoryTypeBits,
+                                          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT),
+   };
+   VkDeviceMemory memory;
+   CHECK(AllocateMemory(device, &alloc_info, NULL, &memory));
+   CHECK(BindBufferMemory(device, buffer, memory, 0));
+
+   volatile uint32_t *values;
+   CHECK(MapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, (void **)&values));
+   values[0] = values[1] = 0;
+
+   VkBufferDeviceAddressInfo address_info = {
+      .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+      .buffer = buffer,
+   };
+   uint64_t address = GetBufferDeviceAddress(device, &address_info);
+
+   create_pipeline();
+
+   VkEventCreateInfo event_info = {
+      .sType = VK_STRUCTURE_TYPE_EVENT_CREATE_INFO,
+   };
+   VkEvent started, release;
+   CHECK(CreateEvent(device, &event_info, NULL, &started));
+   CHECK(CreateEvent(device, &event_info, NULL, &release));
+
+   VkFenceCreateInfo fence_info = {
+      .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+   };
+   VkFence fences[2];
+   CHECK(CreateFence(device, &fence_info, NULL, &fences[0]));
+   CHECK(CreateFence(device, &fence_info, NULL, &fences[1]));
+
+   VkQueryPoolCreateInfo query_info = {
+      .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+      .queryType = VK_QUERY_TYPE_TIMESTAMP,
+      .queryCount = 2,
+   };
+   VkQueryPool query_pool;
+   CHECK(CreateQueryPool(device, &query_info, NULL, &query_pool));
+
+   VkCommandPoolCreateInfo cmd_pool_info = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+      .queueFamilyIndex = 0,
+   };
+   VkCommandPool cmd_pool;
+   CHECK(CreateCommandPool(device, &cmd_pool_info, NULL, &cmd_pool));
+
+   VkCommandBufferAllocateInfo cmd_info = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+      .commandPool = cmd_pool,
+      .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+      .commandBufferCount = 2,
+   };
+   VkCommandBuffer cmds[2];
+   CHECK(AllocateCommandBuffers(device, &cmd_info, cmds));
+
+   VkCommandBufferBeginInfo begin_info = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+   };
+
+   /* The first queue stays busy until the host sets the release event. */
+   CHECK(BeginCommandBuffer(cmds[0], &begin_info));
+   record_store(cmds[0], address, 1);
+   CmdSetEvent(cmds[0], started, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+   CmdWaitEvents(cmds[0], 1, &release, VK_PIPELINE_STAGE_HOST_BIT,
+                 VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, NULL, 0, NULL, 0, NULL);
+   record_store(cmds[0], address, 2);
+   CHECK(EndCommandBuffer(cmds[0]));
+
+   CHECK(BeginCommandBuffer(cmds[1], &begin_info));
+   CmdResetQueryPool(cmds[1], query_pool, 0, 2);
+   CmdWriteTimestamp(cmds[1], VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, query_pool, 0);
+   record_store(cmds[1], address + sizeof(uint32_t), 3);
+   CmdWriteTimestamp(cmds[1], VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, query_pool, 1);
+   CHECK(EndCommandBuffer(cmds[1]));
+
+   struct submit_job jobs[2];
+   for (unsigned i = 0; i < 2; i++)
+      jobs[i] = (struct submit_job) { queues[i], cmds[i], fences[i] };
+
+   thrd_t thread;
+   if (thrd_create(&thread, submit_thread, &jobs[0]) != thrd_success) {
+      fprintf(stderr, "failed to create the submit thread\n");
+      return 1;
+   }
+   while (GetEventStatus(device, started) != VK_EVENT_SET)
+      thrd_yield();
+
+   submit_thread(&jobs[1]);
+
+   int ret = 0;
+   VkResult result = WaitForFences(device, 1, &fences[1], VK_TRUE, QUEUE_TIMEOUT);
+   if (result != VK_SUCCESS) {
+      fprintf(stderr, "the second queue waited for the first one: %d\n", result);
+      ret = 1;
+   } else if (GetFenceStatus(device, fences[0]) != VK_NOT_READY) {
+      fprintf(stderr, "the first queue finished before it was released\n");
+      ret = 1;
+   } else if (values[1] != 3) {
+      fprintf(stderr, "the second queue wrote %u instead of 3\n", values[1]);
+      ret = 1;
+   }
+
+   CHECK(SetEvent(device, release));
+   thrd_join(thread, NULL);
+   CHECK(WaitForFences(device, 1, &fences[0], VK_TRUE, UINT64_MAX));
+   if (values[0] != 2) {
+      fprintf(stderr, "the first queue wrote %u instead of 2\n", values[0]);
+      ret = 1;
+   }
+
+   uint64_t timestamps[2];
+   CHECK(GetQueryPoolResults(device, query_pool, 0, 2, sizeof(timestamps),
+                             timestamps, sizeof(timestamps[0]),
+                             VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+   if (timestamps[1] < timestamps[0]) {
+      fprintf(stderr, "the timestamps of the second queue are out of order\n");
+      ret = 1;
+   }
+
+   /* Both are destroyed with queries and CSOs of the second queue alive. */
+   DestroyQueryPool(device, query_pool, NULL);
+   DestroyPipeline(device, pipeline, NULL);
+
+   CHECK(DeviceWaitIdle(device));
+   DestroyDevice(device, NULL);
+   DestroyInstance(instance, NULL);
+
+   if (!ret)
+      printf("OK\n");
+   return ret;
+}
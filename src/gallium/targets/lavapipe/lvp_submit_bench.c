@@ -0,0 +1,377 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/*
+ * Measures the latency from vkQueueSubmit to the first draw of a command
+ * buffer that is recorded once and submitted repeatedly, like the command
+ * buffers of a frame that doesn't change.
+ *
+ * The command buffer starts with a number of state blocks (dynamic state,
+ * descriptor sets, push constants and barriers), followed by an event that
+ * is set right before the render pass with the first draw. The host spins
+ * on the event after submitting, so the measured time is how long the queue
+ * takes to get through the commands before the first draw.
+ *
+ * Every measurement is done once with the command buffers replayed from
+ * the command list and once with the command buffers compiled at
+ * vkEndCommandBuffer (LVP_COMPILE_CMDS). Compiling drops the redundant
+ * barriers, and the viewport and scissor of every state block but the last,
+ * which are set again before the draw.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vulkan/vulkan_core.h>
+
+#include "c11/threads.h"
+#include "util/macros.h"
+#include "util/os_time.h"
+
+#define DEVICE_FUNCTIONS \
+   ITEM(AllocateCommandBuffers) \
+   ITEM(AllocateDescriptorSets) \
+   ITEM(AllocateMemory) \
+   ITEM(BeginCommandBuffer) \
+   ITEM(BindBufferMemory) \
+   ITEM(BindImageMemory) \
+   ITEM(CmdBeginRendering) \
+   ITEM(CmdBindDescriptorSets) \
+   ITEM(CmdEndRendering) \
+   ITEM(CmdPipelineBarrier2) \
+   ITEM(CmdPushConstants) \
+   ITEM(CmdSetEvent2) \
+   ITEM(CmdSetScissor) \
+   ITEM(CmdSetViewport) \
+   ITEM(CreateBuffer) \
+   ITEM(CreateCommandPool) \
+   ITEM(CreateDescriptorPool) \
+   ITEM(CreateDescriptorSetLayout) \
+   ITEM(CreateEvent) \
+   ITEM(CreateFence) \
+   ITEM(CreateImage) \
+   ITEM(CreateImageView) \
+   ITEM(CreatePipelineLayout) \
+   ITEM(DestroyDevice) \
+   ITEM(DeviceWaitIdle) \
+   ITEM(EndCommandBuffer) \
+   ITEM(GetBufferMemoryRequirements) \
+   ITEM(GetDeviceQueue) \
+   ITEM(GetEventStatus) \
+   ITEM(GetImageMemoryRequirements) \
+   ITEM(QueueSubmit) \
+   ITEM(ResetEvent) \
+   ITEM(ResetFences) \
+   ITEM(UpdateDescriptorSets) \
+   ITEM(WaitForFences)
+
+#include "lvp_test_common.h"
+
+#define IMAGE_SIZE 256
+
+
+static VkDeviceMemory
+allocate_memory(VkDevice device, const VkMemoryRequirements *reqs)
+{
+   VkMemoryAllocateInfo alloc_info = {
+      .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+      .allocationSize = reqs->size,
+      .memoryTypeIndex = find_memory_type(reqs->memoryTypeBits, 0),
+   };
+   VkDeviceMemory memory;
+   CHECK(AllocateMemory(device, &alloc_info, NULL, &memory));
+   return memory;
+}
+
+static VkDevice
+open_device(bool compile_cmds, VkQueue *queue)
+{
+   /* lavapipe reads this when the device is created. */
+   setenv("LVP_COMPILE_CMDS", compile_cmds ? "true" : "false", 1);
+
+   VkPhysicalDeviceVulkan13Features features13 = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES,
+      .synchronization2 = true,
+      .dynamicRendering = true,
+   };
+   VkDevice device = create_device(&features13, NULL, 0, 1);
+
+   GetDeviceQueue(device, 0, 0, queue);
+   return device;
+}
+
+/* Records the command buffer of a frame with num_blocks state blocks
+ * before the render pass.
+ */
+static VkCommandBuffer
+record_frame(VkDevice device, VkEvent event, unsigned num_blocks)
+{
+   /* The render target. */
+   VkImageCreateInfo image_info = {
+      .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+      .imageType = VK_IMAGE_TYPE_2D,
+      .format = VK_FORMAT_R8G8B8A8_UNORM,
+      .extent = { IMAGE_SIZE, IMAGE_SIZE, 1 },
+      .mipLevels = 1,
+      .arrayLayers = 1,
+      .samples = VK_SAMPLE_COUNT_1_BIT,
+      .tiling = VK_IMAGE_TILING_OPTIMAL,
+      .usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+   };
+   VkImage image;
+   CHECK(CreateImage(device, &image_info, NULL, &image));
+
+   VkMemoryRequirements reqs;
+   GetImageMemoryRequirements(device, image, &reqs);
+   CHECK(BindImageMemory(device, image, allocate_memory(device, &reqs), 0));
+
+   VkImageViewCreateInfo view_info = {
+      .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+      .image = image,
+      .viewType = VK_IMAGE_VIEW_TYPE_2D,
+      .format = image_info.format,
+      .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 },
+   };
+   VkImageView view;
+   CHECK(CreateImageView(device, &view_info, NULL, &view));
+
+   /* A uniform buffer bound through a descriptor set. */
+   VkBufferCreateInfo buffer_info = {
+      .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+      .size = 256,
+      .usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+   };
+   VkBuffer buffer;
+   CHECK(CreateBuffer(device, &buffer_info, NULL, &buffer));
+
+   GetBufferMemoryRequirements(device, buffer, &reqs);
+   CHECK(BindBufferMemory(device, buffer, allocate_memory(device, &reqs), 0));
+
+   VkDescriptorSetLayoutBinding binding = {
+      .binding = 0,
+      .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+      .descriptorCount = 1,
+      .stageFlags = VK_SHADER_STAGE_ALL_GRAPHICS,
+   };
+   VkDescriptorSetLayoutCreateInfo set_layout_info = {
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+      .bindingCount = 1,
+      .pBindings = &binding,
+   };
+   VkDescriptorSetLayout set_layout;
+   CHECK(CreateDescriptorSetLayout(device, &set_layout_info, NULL, &set_layout));
+
+   VkPushConstantRange push_range = {
+      .stageFlags = VK_SHADER_STAGE_ALL_GRAPHICS,
+      .size = 128,
+   };
+   VkPipelineLayoutCreateInfo layout_info = {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+      .setLayoutCount = 1,
+      .pSetLayouts = &set_layout,
+      .pushConstantRangeCount = 1,
+      .pPushConstantRanges = &push_range,
+   };
+   VkPipelineLayout layout;
+   CHECK(CreatePipelineLayout(device, &layout_info, NULL, &layout));
+
+   VkDescriptorPoolSize pool_size = { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1 };
+   VkDescriptorPoolCreateInfo pool_info = {
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+      .maxSets = 1,
+      .poolSizeCount = 1,
+      .pPoolSizes = &pool_size,
+   };
+   VkDescriptorPool pool;
+   CHECK(CreateDescriptorPool(device, &pool_info, NULL, &pool));
+
+   VkDescriptorSetAllocateInfo set_info = {
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+      .descriptorPool = pool,
+      .descriptorSetCount = 1,
+      .pSetLayouts = &set_layout,
+   };
+   VkDescriptorSet set;
+   CHECK(AllocateDescriptorSets(device, &set_info, &set));
+
+   VkDescriptorBufferInfo desc_buffer_info = { buffer, 0, VK_WHOLE_SIZE };
+   VkWriteDescriptorSet write = {
+      .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+      .dstSet = set,
+      .descriptorCount = 1,
+      .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+      .pBufferInfo = &desc_buffer_info,
+   };
+   UpdateDescriptorSets(device, 1, &write, 0, NULL);
+
+   VkCommandPoolCreateInfo cmd_pool_info = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+      .queueFamilyIndex = 0,
+   };
+   VkCommandPool cmd_pool;
+   CHECK(CreateCommandPool(device, &cmd_pool_info, NULL, &cmd_pool));
+
+   VkCommandBufferAllocateInfo cmd_info = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+      .commandPool = cmd_pool,
+      .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+      .commandBufferCount = 1,
+   };
+   VkCommandBuffer cmd;
+   CHECK(AllocateCommandBuffers(device, &cmd_info, &cmd));
+
+   VkCommandBufferBeginInfo begin_info = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+   };
+   CHECK(BeginCommandBuffer(cmd, &begin_info));
+
+   VkMemoryBarrier2 barrier = {
+      .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+      .srcStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+      .srcAccessMask = VK_ACCESS_2_MEMORY_WRITE_BIT,
+      .dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+      .dstAccessMask = VK_ACCESS_2_MEMORY_READ_BIT,
+   };
+   VkDependencyInfo dep_info = {
+      .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+      .memoryBarrierCount = 1,
+      .pMemoryBarriers = &barrier,
+   };
+   VkViewport viewport = { 0, 0, IMAGE_SIZE, IMAGE_SIZE, 0, 1 };
+   VkRect2D scissor = { { 0, 0 }, { IMAGE_SIZE, IMAGE_SIZE } };
+   uint32_t push_data[32] = { 0 };
+
+   for (unsigned i = 0; i < num_blocks; i++) {
+      CmdPipelineBarrier2(cmd, &dep_info);
+      CmdPipelineBarrier2(cmd, &dep_info);
+      CmdSetViewport(cmd, 0, 1, &viewport);
+      CmdSetScissor(cmd, 0, 1, &scissor);
+      CmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, layout,
+                            0, 1, &set, 0, NULL);
+      CmdPushConstants(cmd, layout, VK_SHADER_STAGE_ALL_GRAPHICS, 0,
+                       sizeof(push_data), push_data);
+   }
+
+   VkDependencyInfo event_dep_info = {
+      .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+   };
+   CmdSetEvent2(cmd, event, &event_dep_info);
+
+   VkImageMemoryBarrier2 image_barrier = {
+      .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+      .dstStageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+      .dstAccessMask = VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+      .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+      .newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+      .image = image,
+      .subresourceRange = view_info.subresourceRange,
+   };
+   VkDependencyInfo image_dep_info = {
+      .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+      .imageMemoryBarrierCount = 1,
+      .pImageMemoryBarriers = &image_barrier,
+   };
+   CmdPipelineBarrier2(cmd, &image_dep_info);
+
+   VkRenderingAttachmentInfo color_att = {
+      .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+      .imageView = view,
+      .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+      .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+      .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+   };
+   VkRenderingInfo rendering_info = {
+      .sType = VK_STRUCTURE_TYPE_RENDERING_INFO,
+      .renderArea = scissor,
+      .layerCount = 1,
+      .colorAttachmentCount = 1,
+      .pColorAttachments = &color_att,
+   };
+   CmdBeginRendering(cmd, &rendering_info);
+   CmdEndRendering(cmd);
+
+   CHECK(EndCommandBuffer(cmd));
+
+   /* Everything else is freed with the device. */
+   return cmd;
+}
+
+/* Returns the median latency in nanoseconds. */
+static int64_t
+measure(bool compile_cmds, unsigned num_blocks, unsigned iterations)
+{
+   VkQueue queue;
+   VkDevice device = open_device(compile_cmds, &queue);
+
+   VkEventCreateInfo event_info = {
+      .sType = VK_STRUCTURE_TYPE_EVENT_CREATE_INFO,
+   };
+   VkEvent event;
+   CHECK(CreateEvent(device, &event_info, NULL, &event));
+
+   VkFenceCreateInfo fence_info = {
+      .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+   };
+   VkFence fence;
+   CHECK(CreateFence(device, &fence_info, NULL, &fence));
+
+   VkCommandBuffer cmd = record_frame(device, event, num_blocks);
+   VkSubmitInfo submit_info = {
+      .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+      .commandBufferCount = 1,
+      .pCommandBuffers = &cmd,
+   };
+
+   int64_t *times = malloc(iterations * sizeof(*times));
+   if (!times)
+      exit(1);
+
+   for (unsigned i = 0; i < iterations; i++) {
+      CHECK(ResetEvent(device, event));
+
+      int64_t start = os_time_get_nano();
+      CHECK(QueueSubmit(queue, 1, &submit_info, fence));
+      while (GetEventStatus(device, event) != VK_EVENT_SET)
+         thrd_yield();
+      times[i] = os_time_get_nano() - start;
+
+      CHECK(WaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX));
+      CHECK(ResetFences(device, 1, &fence));
+   }
+
+   qsort(times, iterations, sizeof(*times), compare_int64);
+   int64_t median = times[iterations / 2];
+   free(times);
+
+   CHECK(DeviceWaitIdle(device));
+   DestroyDevice(device, NULL);
+
+   return median;
+}
+
+int
+main(int argc, char **argv)
+{
+   unsigned iterations = 1000;
+   unsigned num_blocks[] = { 1, 16, 256 };
+
+   if (argc > 1)
+      iterations = MAX2(atoi(argv[1]), 1);
+
+   if (!create_instance("lvp_submit_bench"))
+      return 1;
+
+   printf("submit to first draw, median of %u submissions:\n", iterations);
+   for (unsigned i = 0; i < ARRAY_SIZE(num_blocks); i++) {
+      int64_t replayed = measure(false, num_blocks[i], iterations);
+      int64_t compiled = measure(true, num_blocks[i], iterations);
+
+      printf("%4u state blocks: replayed %7.2f us, compiled %7.2f us\n",
+             num_blocks[i], replayed / 1000.0, compiled / 1000.0);
+   }
+
+   DestroyInstance(instance, NULL);
+   return 0;
+}
@@ -0,0 +1,146 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/*
+ * Vulkan bootstrap shared by the lavapipe tests and benchmarks, which call
+ * into the driver directly instead of going through the loader.
+ *
+ * DEVICE_FUNCTIONS has to be defined as a list of ITEM(name) entries for the
+ * device level entrypoints the program uses before this header is included.
+ * They are loaded by create_device().
+ */
+
+#ifndef LVP_TEST_COMMON_H
+#define LVP_TEST_COMMON_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vulkan/vulkan_core.h>
+
+#include "util/macros.h"
+
+#ifndef DEVICE_FUNCTIONS
+#error "DEVICE_FUNCTIONS has to be defined before including lvp_test_common.h"
+#endif
+
+PFN_vkVoidFunction VKAPI_CALL vk_icdGetInstanceProcAddr(VkInstance instance,
+                                                        const char *pName);
+
+#define INSTANCE_FUNCTIONS \
+   ITEM(CreateDevice) \
+   ITEM(DestroyInstance) \
+   ITEM(EnumeratePhysicalDevices) \
+   ITEM(GetDeviceProcAddr) \
+   ITEM(GetPhysicalDeviceMemoryProperties)
+
+#define ITEM(n) static PFN_vk##n n;
+INSTANCE_FUNCTIONS
+DEVICE_FUNCTIONS
+#undef ITEM
+
+#define CHECK(x) \
+   do { \
+      VkResult _result = (x); \
+      if (_result != VK_SUCCESS) { \
+         fprintf(stderr, "%s failed: %d\n", #x, _result); \
+         exit(1); \
+      } \
+   } while (0)
+
+#define MAX_TEST_QUEUES 4
+
+static VkInstance instance;
+static VkPhysicalDevice physical_device;
+
+/* Creates the instance and picks the physical device. Returns false if
+ * there is none.
+ */
+static inline bool
+create_instance(const char *name)
+{
+   VkApplicationInfo app_info = {
+      .sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
+      .pApplicationName = name,
+      .apiVersion = VK_API_VERSION_1_3,
+   };
+   VkInstanceCreateInfo instance_info = {
+      .sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
+      .pApplicationInfo = &app_info,
+   };
+   CHECK(((PFN_vkCreateInstance)vk_icdGetInstanceProcAddr(NULL, "vkCreateInstance"))(
+      &instance_info, NULL, &instance));
+
+#define ITEM(n) n = (PFN_vk##n)vk_icdGetInstanceProcAddr(instance, "vk" #n);
+   INSTANCE_FUNCTIONS
+#undef ITEM
+
+   uint32_t count = 1;
+   VkResult result = EnumeratePhysicalDevices(instance, &count, &physical_device);
+   if ((result != VK_SUCCESS && result != VK_INCOMPLETE) || !count) {
+      fprintf(stderr, "no physical device\n");
+      return false;
+   }
+
+   return true;
+}
+
+static inline uint32_t
+find_memory_type(uint32_t type_bits, VkMemoryPropertyFlags flags)
+{
+   VkPhysicalDeviceMemoryProperties props;
+   GetPhysicalDeviceMemoryProperties(physical_device, &props);
+
+   for (uint32_t i = 0; i < props.memoryTypeCount; i++) {
+      if ((type_bits & BITFIELD_BIT(i)) &&
+          (props.memoryTypes[i].propertyFlags & flags) == flags)
+         return i;
+   }
+
+   fprintf(stderr, "no memory type found\n");
+   exit(1);
+}
+
+/* Creates a device with queue_count queues of the first queue family, the
+ * features chained to features and the given extensions enabled, and loads
+ * DEVICE_FUNCTIONS from it.
+ */
+static inline VkDevice
+create_device(const void *features, const char *const *extensions,
+              uint32_t extension_count, uint32_t queue_count)
+{
+   const float priorities[MAX_TEST_QUEUES] = { 1.0f, 1.0f, 1.0f, 1.0f };
+   VkDeviceQueueCreateInfo queue_info = {
+      .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+      .queueFamilyIndex = 0,
+      .queueCount = MIN2(queue_count, MAX_TEST_QUEUES),
+      .pQueuePriorities = priorities,
+   };
+   VkDeviceCreateInfo device_info = {
+      .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+      .pNext = features,
+      .queueCreateInfoCount = 1,
+      .pQueueCreateInfos = &queue_info,
+      .enabledExtensionCount = extension_count,
+      .ppEnabledExtensionNames = extensions,
+   };
+   VkDevice device;
+   CHECK(CreateDevice(physical_device, &device_info, NULL, &device));
+
+#define ITEM(n) n = (PFN_vk##n)GetDeviceProcAddr(device, "vk" #n);
+   DEVICE_FUNCTIONS
+#undef ITEM
+
+   return device;
+}
+
+static inline int
+compare_int64(const void *a, const void *b)
+{
+   int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+   return x < y ? -1 : x > y;
+}
+
+#endif /* LVP_TEST_COMMON_H */
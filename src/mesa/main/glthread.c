@@ -151,9 +151,8 @@ glthread_unmarshal_batch(void *job, void *gdata, int thread_index)
    assert(pos == used);
    batch->used = 0;
 
-   unsigned batch_index = batch - ctx->GLThread.batches;
-   _mesa_glthread_signal_call(&ctx->GLThread.LastProgramChangeBatch, batch_index);
-   _mesa_glthread_signal_call(&ctx->GLThread.LastDListChangeBatchIndex, batch_index);
+   _mesa_glthread_signal_call(&ctx->GLThread.LastProgramChangeBatch, batch->index);
+   _mesa_glthread_signal_call(&ctx->GLThread.LastDListChangeBatchIndex, batch->index);
 
    p_atomic_inc(&ctx->GLThread.stats.num_batches);
 }
@@ -207,6 +206,44 @@ _mesa_glthread_init_dispatch(struct gl_context *ctx,
    _mesa_glthread_init_dispatch7(ctx, table);
 }
 
+/* Adds a batch to the ring that follows the batch at index "after". */
+static bool
+glthread_add_batch(struct gl_context *ctx, unsigned after)
+{
+   struct glthread_state *glthread = &ctx->GLThread;
+   assert(glthread->num_batches < MARSHAL_MAX_BATCHES);
+
+   struct glthread_batch *batch = malloc(sizeof(*batch));
+   if (!batch)
+      return false;
+
+   batch->ctx = ctx;
+   batch->index = glthread->num_batches;
+   batch->used = 0;
+   util_queue_fence_init(&batch->fence);
+
+   if (glthread->num_batches) {
+      glthread->ring_next[batch->index] = glthread->ring_next[after];
+      glthread->ring_next[after] = batch->index;
+   } else {
+      glthread->ring_next[batch->index] = batch->index;
+   }
+
+   glthread->batches[glthread->num_batches++] = batch;
+   return true;
+}
+
+static void
+glthread_free_batches(struct glthread_state *glthread)
+{
+   for (unsigned i = 0; i < glthread->num_batches; i++) {
+      util_queue_fence_destroy(&glthread->batches[i]->fence);
+      free(glthread->batches[i]);
+      glthread->batches[i] = NULL;
+   }
+   glthread->num_batches = 0;
+}
+
 void
 _mesa_glthread_init(struct gl_context *ctx)
 {
@@ -218,11 +255,23 @@ _mesa_glthread_init(struct gl_context *ctx)
        !screen->caps.allow_mapped_buffers_during_execution)
       return;
 
-   if (!util_queue_init(&glthread->queue, "gl", MARSHAL_MAX_BATCHES - 2,
+   /* The queue can hold all batches but the one being filled, so adding
+    * a job never blocks. The application thread waits for the batch slot
+    * instead, see _mesa_glthread_flush_batch.
+    */
+   if (!util_queue_init(&glthread->queue, "gl", MARSHAL_MAX_BATCHES - 1,
                         1, 0, NULL)) {
       return;
    }
 
+   for (unsigned i = 0; i < MARSHAL_MIN_BATCHES; i++) {
+      if (!glthread_add_batch(ctx, i ? i - 1 : 0)) {
+         glthread_free_batches(glthread);
+         util_queue_destroy(&glthread->queue);
+         return;
+      }
+   }
+
    _mesa_InitHashTable(&glthread->VAOs);
    _mesa_glthread_reset_vao(&glthread->DefaultVAO);
    glthread->CurrentVAO = &glthread->DefaultVAO;
@@ -230,6 +279,7 @@ _mesa_glthread_init(struct gl_context *ctx)
    ctx->MarshalExec = _mesa_alloc_dispatch_table(true);
    if (!ctx->MarshalExec) {
       _mesa_DeinitHashTable(&glthread->VAOs, NULL, NULL);
+      glthread_free_batches(glthread);
       util_queue_destroy(&glthread->queue);
       return;
    }
@@ -237,12 +287,9 @@ _mesa_glthread_init(struct gl_context *ctx)
    _mesa_glthread_init_dispatch(ctx, ctx->MarshalExec);
    _mesa_init_pixelstore_attrib(ctx, &glthread->Unpack);
 
-   for (unsigned i = 0; i < MARSHAL_MAX_BATCHES; i++) {
-      glthread->batches[i].ctx = ctx;
-      util_queue_fence_init(&glthread->batches[i].fence);
-   }
-   glthread->next_batch = &glthread->batches[glthread->next];
+   glthread->next_batch = glthread->batches[glthread->next];
    glthread->used = 0;
+   glthread->flush_limit = MARSHAL_MAX_CMD_SIZE / 8;
    glthread->stats.queue = &glthread->queue;
 
    _mesa_glthread_init_call_fence(&glthread->LastProgramChangeBatch);
@@ -279,9 +326,7 @@ _mesa_glthread_destroy(struct gl_context *ctx)
 
    if (util_queue_is_initialized(&glthread->queue)) {
       util_queue_destroy(&glthread->queue);
-
-      for (unsigned i = 0; i < MARSHAL_MAX_BATCHES; i++)
-         util_queue_fence_destroy(&glthread->batches[i].fence);
+      glthread_free_batches(glthread);
 
       _mesa_DeinitHashTable(&glthread->VAOs, free_vao, NULL);
       _mesa_glthread_release_upload_buffer(ctx);
@@ -345,6 +390,9 @@ glthread_finalize_batch(struct glthread_state *glthread,
    last->cmd_id = NUM_DISPATCH_CMD;
 
    p_atomic_add(num_items_counter, glthread->used);
+   p_atomic_add(&glthread->stats.batch_fill,
+                glthread->used * 100 / (MARSHAL_MAX_CMD_SIZE / 8));
+   p_atomic_inc(&glthread->stats.num_filled_batches);
    next->used = glthread->used;
    glthread->used = 0;
 
@@ -371,13 +419,42 @@ _mesa_glthread_flush_batch(struct gl_context *ctx)
    glthread_apply_thread_sched_policy(ctx, false);
    glthread_finalize_batch(glthread, &glthread->stats.num_offloaded_items);
 
+   /* If the worker thread has already executed everything, it's waiting for
+    * this batch, and smaller batches would let it start earlier. If it's
+    * still busy, larger batches reduce the number of handoffs.
+    */
+   if (util_queue_fence_is_signalled(&glthread->batches[glthread->last]->fence)) {
+      glthread->flush_limit = MAX2(glthread->flush_limit -
+                                   MARSHAL_MIN_FLUSH_SIZE / 8,
+                                   MARSHAL_MIN_FLUSH_SIZE / 8);
+   } else {
+      glthread->flush_limit = MIN2(glthread->flush_limit * 2,
+                                   MARSHAL_MAX_CMD_SIZE / 8);
+   }
+
    struct glthread_batch *next = glthread->next_batch;
 
    util_queue_add_job(&glthread->queue, next, &next->fence,
                       glthread_unmarshal_batch, NULL, 0);
    glthread->last = glthread->next;
-   glthread->next = (glthread->next + 1) % MARSHAL_MAX_BATCHES;
-   glthread->next_batch = &glthread->batches[glthread->next];
+   glthread->next = glthread->ring_next[glthread->last];
+
+   /* If the next batch slot is still in flight, all slots are, and it's the
+    * oldest one. Grow the ring instead of waiting, unless it has reached its
+    * maximum size. The new batch is inserted before the oldest one, so that
+    * the ring stays in submission order.
+    */
+   if (!util_queue_fence_is_signalled(&glthread->batches[glthread->next]->fence)) {
+      if (glthread->num_batches < MARSHAL_MAX_BATCHES &&
+          glthread_add_batch(ctx, glthread->last)) {
+         glthread->next = glthread->ring_next[glthread->last];
+      } else {
+         p_atomic_inc(&glthread->stats.num_stalls);
+         util_queue_fence_wait(&glthread->batches[glthread->next]->fence);
+      }
+   }
+
+   glthread->next_batch = glthread->batches[glthread->next];
 }
 
 /**
@@ -401,7 +478,7 @@ _mesa_glthread_finish(struct gl_context *ctx)
    if (u_thread_is_self(glthread->queue.threads[0]))
       return;
 
-   struct glthread_batch *last = &glthread->batches[glthread->last];
+   struct glthread_batch *last = glthread->batches[glthread->last];
    struct glthread_batch *next = glthread->next_batch;
    bool synced = false;
 
@@ -45,8 +45,20 @@
  * One batch is being executed, one batch is being filled, the rest are
  * waiting batches. There must be at least 1 slot for a waiting batch,
  * so the minimum number of batches is 3.
+ *
+ * The ring starts with MARSHAL_MIN_BATCHES slots and grows up to
+ * MARSHAL_MAX_BATCHES slots when the application thread would have to wait
+ * for a batch slot to become free.
+ */
+#define MARSHAL_MIN_BATCHES 8
+#define MARSHAL_MAX_BATCHES 32
+
+/* The lowest size at which a batch is flushed. The flush limit adapts between
+ * this and MARSHAL_MAX_CMD_SIZE: it shrinks while the worker thread is idle,
+ * so that it can start executing calls earlier, and grows while the worker
+ * thread is busy, so that the u_queue overhead is amortized over more calls.
  */
-#define MARSHAL_MAX_BATCHES 8
+#define MARSHAL_MIN_FLUSH_SIZE 1024
 
 /* Special value for glEnableClientState(GL_PRIMITIVE_RESTART_NV). */
 #define VERT_ATTRIB_PRIMITIVE_RESTART_NV -1
@@ -148,6 +160,9 @@ struct glthread_batch
    /** The worker thread will access the context with this. */
    struct gl_context *ctx;
 
+   /** Index of the batch in glthread_state::batches. */
+   unsigned index;
+
    /**
     * Number of uint64_t elements filled already.
     * This is 0 when it's being filled because glthread::used holds the real
@@ -217,8 +232,16 @@ struct glthread_state
    unsigned pin_thread_counter;
    unsigned thread_sched_state;
 
-   /** The ring of batches in memory. */
-   struct glthread_batch batches[MARSHAL_MAX_BATCHES];
+   /** The ring of batches in memory. Only num_batches are allocated. */
+   struct glthread_batch *batches[MARSHAL_MAX_BATCHES];
+   unsigned num_batches;
+
+   /**
+    * The index of the batch that follows each batch in ring order. Batches
+    * keep their index for the call fences, so a new batch is linked in
+    * after the last submitted batch when the ring grows.
+    */
+   uint8_t ring_next[MARSHAL_MAX_BATCHES];
 
    /** Pointer to the batch currently being filled. */
    struct glthread_batch *next_batch;
@@ -232,6 +255,9 @@ struct glthread_state
    /** Number of uint64_t elements filled already. */
    unsigned used;
 
+   /** Number of uint64_t elements after which the batch is flushed. */
+   unsigned flush_limit;
+
    /** Upload buffer. */
    struct gl_buffer_object *upload_buffer;
    uint8_t *upload_ptr;
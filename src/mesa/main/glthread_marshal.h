@@ -98,7 +98,7 @@ _mesa_glthread_allocate_command(struct gl_context *ctx,
 
    assert (num_elements <= MARSHAL_MAX_CMD_SIZE / 8);
 
-   if (unlikely(glthread->used + num_elements > MARSHAL_MAX_CMD_SIZE / 8))
+   if (unlikely(glthread->used + num_elements > glthread->flush_limit))
       _mesa_glthread_flush_batch(ctx);
 
    struct glthread_batch *next = glthread->next_batch;
@@ -775,7 +775,7 @@ _mesa_glthread_wait_for_call(struct gl_context *ctx,
 {
    int batch = p_atomic_read(last_batch_index_where_called);
    if (batch != -1) {
-      util_queue_fence_wait(&ctx->GLThread.batches[batch].fence);
+      util_queue_fence_wait(&ctx->GLThread.batches[batch]->fence);
       assert(p_atomic_read(last_batch_index_where_called) == -1);
    }
 }
@@ -3438,6 +3438,12 @@ struct gl_context
     */
    struct nir_shader *SoftFP64;
 
+   /**
+    * Queue used to run the per-stage parts of linking in parallel, or NULL
+    * if the stages of a program are linked one after another.
+    */
+   struct util_queue *LinkQueue;
+
    struct gl_query_state Query;  /**< occlusion, timer queries */
 
    struct gl_transform_feedback_state TransformFeedback;
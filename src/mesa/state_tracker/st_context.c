@@ -352,6 +352,11 @@ st_destroy_context_priv(struct st_context *st, bool destroy_pipe)
 
    cso_destroy_context(st->cso_context);
 
+   if (st->ctx->LinkQueue) {
+      util_queue_destroy(st->ctx->LinkQueue);
+      st->ctx->LinkQueue = NULL;
+   }
+
    if (st->pipe && destroy_pipe)
       st->pipe->destroy(st->pipe);
 
@@ -877,6 +882,36 @@ destroy_framebuffer_attachment_sampler_cb(void *data, void *userData)
    }
 }
 
+/**
+ * Create the threads that link the stages of a program in parallel.
+ *
+ * This is done on the first link, so that contexts that never link a
+ * program with more than one stage don't start any threads.
+ */
+void
+st_init_link_queue(struct st_context *st)
+{
+   if (st->link_queue_initialized)
+      return;
+
+   st->link_queue_initialized = true;
+
+   /* The thread calling glLinkProgram links one of the stages itself, and
+    * there are at most 5 stages to link in parallel.
+    */
+   unsigned num_threads =
+      MIN2(util_get_cpu_caps()->nr_cpus, MESA_SHADER_FRAGMENT + 1) - 1;
+   num_threads = debug_get_num_option("MESA_GLSL_LINK_THREADS", num_threads);
+   num_threads = MIN3(num_threads, MESA_SHADER_FRAGMENT,
+                      st->ctx->Hint.MaxShaderCompilerThreads);
+   if (!num_threads)
+      return;
+
+   if (util_queue_init(&st->link_queue, "gllink", MESA_SHADER_STAGES,
+                       num_threads, UTIL_QUEUE_INIT_RESIZE_IF_FULL, NULL))
+      st->ctx->LinkQueue = &st->link_queue;
+}
+
 void
 st_destroy_context(struct st_context *st)
 {
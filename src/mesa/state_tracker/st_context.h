@@ -400,6 +400,12 @@ struct st_context
    } zombie_shaders;
 
    struct hash_table *hw_select_shaders;
+
+   /* Threads for linking the stages of a program in parallel, created on
+    * the first link. ctx->LinkQueue points to it if it was created.
+    */
+   struct util_queue link_queue;
+   bool link_queue_initialized;
 };
 
 /**
@@ -454,6 +460,9 @@ st_create_context(gl_api api, struct pipe_context *pipe,
 extern void
 st_destroy_context(struct st_context *st);
 
+extern void
+st_init_link_queue(struct st_context *st);
+
 extern void
 st_context_flush(struct st_context *st, unsigned flags,
                  struct pipe_fence_handle **fence,
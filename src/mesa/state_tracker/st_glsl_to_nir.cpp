@@ -203,24 +203,18 @@ filter_64_bit_instr(const nir_instr *const_instr, UNUSED const void *data)
    return lower;
 }
 
-/* Second third of converting glsl_to_nir. This creates uniforms, gathers
- * info on varyings, etc after NIR link time opts have been applied.
+/* Make a pass over the IR to add state references for any built-in
+ * uniforms that are used.  This has to be done now (during linking).
+ * Code generation doesn't happen until the first time this shader is
+ * used for rendering.  Waiting until then to generate the parameters is
+ * too late.  At that point, the values for the built-in uniforms won't
+ * get sent to the shader.
  */
-static char *
-st_glsl_to_nir_post_opts(struct st_context *st, struct gl_program *prog,
-                         struct gl_shader_program *shader_program)
+static void
+st_glsl_to_nir_add_state_references(struct st_context *st,
+                                    struct gl_program *prog)
 {
-   nir_shader *nir = prog->nir;
-   struct pipe_screen *screen = st->screen;
-
-   /* Make a pass over the IR to add state references for any built-in
-    * uniforms that are used.  This has to be done now (during linking).
-    * Code generation doesn't happen until the first time this shader is
-    * used for rendering.  Waiting until then to generate the parameters is
-    * too late.  At that point, the values for the built-in uniforms won't
-    * get sent to the shader.
-    */
-   nir_foreach_uniform_variable(var, nir) {
+   nir_foreach_uniform_variable(var, prog->nir) {
       const nir_state_slot *const slots = var->state_slots;
       if (slots != NULL) {
          const struct glsl_type *type = glsl_without_array(var->type);
@@ -243,12 +237,21 @@ st_glsl_to_nir_post_opts(struct st_context *st, struct gl_program *prog,
          }
       }
    }
+}
 
-   /* Avoid reallocation of the program parameter list, because the uniform
-    * storage is only associated with the original parameter list.
-    * This should be enough for Bitmap and DrawPixels constants.
-    */
-   _mesa_ensure_and_associate_uniform_storage(st->ctx, shader_program, prog, 28);
+/* Second third of converting glsl_to_nir. This creates uniforms, gathers
+ * info on varyings, etc after NIR link time opts have been applied.
+ *
+ * The uniform storage must already be associated with the parameter list.
+ * This only changes the program it is given, so it can run for all stages
+ * at the same time.
+ */
+static char *
+st_glsl_to_nir_post_opts(struct st_context *st, struct gl_program *prog,
+                         struct gl_shader_program *shader_program)
+{
+   nir_shader *nir = prog->nir;
+   struct pipe_screen *screen = st->screen;
 
    /* None of the builtins being lowered here can be produced by SPIR-V.  See
     * _mesa_builtin_uniform_desc. Also drivers that support packed uniform
@@ -325,15 +328,6 @@ st_glsl_to_nir_post_opts(struct st_context *st, struct gl_program *prog,
          msg = screen->finalize_nir(screen, nir);
    }
 
-   if (st->ctx->_Shader->Flags & GLSL_DUMP) {
-      _mesa_log("\n");
-      _mesa_log("NIR IR for linked %s program %d:\n",
-             _mesa_shader_stage_to_string(prog->info.stage),
-             shader_program->Name);
-      nir_print_shader(nir, mesa_log_get_file());
-      _mesa_log("\n\n");
-   }
-
    return msg;
 }
 
@@ -384,6 +378,72 @@ st_nir_lower_wpos_ytransform(struct nir_shader *nir,
    return progress;
 }
 
+struct st_link_stage_state {
+   struct st_context *st;
+   struct gl_shader_program *shader_program;
+
+   /* Error message of each stage, reported in stage order. */
+   char *msg[MESA_SHADER_STAGES];
+};
+
+static void
+st_link_lower_stage(struct gl_linked_shader *shader, void *data)
+{
+   struct st_link_stage_state *state = (struct st_link_stage_state *)data;
+   struct st_context *st = state->st;
+   nir_shader *nir = shader->Program->nir;
+   gl_shader_stage stage = shader->Stage;
+   const struct gl_shader_compiler_options *options =
+         &st->ctx->Const.ShaderCompilerOptions[stage];
+
+   /* Since IO is lowered, we won't need the IO variables from now on.
+    * nir_build_program_resource_list was the last pass that needed them.
+    */
+   NIR_PASS(_, nir, nir_remove_dead_variables,
+            nir_var_shader_in | nir_var_shader_out, NULL);
+
+   /* If there are forms of indirect addressing that the driver
+    * cannot handle, perform the lowering pass.
+    */
+   if (options->EmitNoIndirectTemp || options->EmitNoIndirectUniform) {
+      nir_variable_mode mode = (nir_variable_mode)0;
+
+      mode |= options->EmitNoIndirectTemp ?
+         nir_var_function_temp : (nir_variable_mode)0;
+      mode |= options->EmitNoIndirectUniform ?
+         nir_var_uniform | nir_var_mem_ubo | nir_var_mem_ssbo :
+         (nir_variable_mode)0;
+
+      if (mode)
+         nir_lower_indirect_derefs(nir, mode, UINT32_MAX);
+   }
+
+   /* This needs to run after the initial pass of nir_lower_vars_to_ssa, so
+    * that the buffer indices are constants in nir where they where
+    * constants in GLSL. */
+   NIR_PASS(_, nir, gl_nir_lower_buffers, state->shader_program);
+
+   NIR_PASS(_, nir, st_nir_lower_wpos_ytransform, shader->Program,
+            st->screen);
+
+   /* needed to lower base_workgroup_id and base_global_invocation_id */
+   struct nir_lower_compute_system_values_options cs_options = {};
+   NIR_PASS(_, nir, nir_lower_system_values);
+   NIR_PASS(_, nir, nir_lower_compute_system_values, &cs_options);
+
+   st_glsl_to_nir_add_state_references(st, shader->Program);
+}
+
+static void
+st_link_post_opts_stage(struct gl_linked_shader *shader, void *data)
+{
+   struct st_link_stage_state *state = (struct st_link_stage_state *)data;
+
+   state->msg[shader->Stage] =
+      st_glsl_to_nir_post_opts(state->st, shader->Program,
+                               state->shader_program);
+}
+
 static bool
 st_link_glsl_to_nir(struct gl_context *ctx,
                     struct gl_shader_program *shader_program)
@@ -401,6 +461,9 @@ st_link_glsl_to_nir(struct gl_context *ctx,
 
    assert(shader_program->data->LinkStatus);
 
+   if (shader_program->NumShaders > 1)
+      st_init_link_queue(st);
+
    if (!shader_program->data->spirv) {
       if (!gl_nir_link_glsl(ctx, shader_program))
          return GL_FALSE;
@@ -466,47 +529,47 @@ st_link_glsl_to_nir(struct gl_context *ctx,
    nir_build_program_resource_list(&ctx->Const, shader_program,
                                    shader_program->data->spirv);
 
-   for (unsigned i = 0; i < num_shaders; i++) {
-      struct gl_linked_shader *shader = linked_shader[i];
-      nir_shader *nir = shader->Program->nir;
-      gl_shader_stage stage = shader->Stage;
-      const struct gl_shader_compiler_options *options =
-            &ctx->Const.ShaderCompilerOptions[stage];
+   struct st_link_stage_state state;
+   memset(&state, 0, sizeof(state));
+   state.st = st;
+   state.shader_program = shader_program;
 
-      /* Since IO is lowered, we won't need the IO variables from now on.
-       * nir_build_program_resource_list was the last pass that needed them.
-       */
-      NIR_PASS(_, nir, nir_remove_dead_variables,
-               nir_var_shader_in | nir_var_shader_out, NULL);
+   /* The per-stage parts of linking run in parallel if the context has a
+    * link queue. Everything that depends on other stages is done in stage
+    * order in between, so the result does not depend on the scheduling.
+    */
+   gl_nir_link_foreach_stage(ctx->LinkQueue, linked_shader, num_shaders,
+                             st_link_lower_stage, &state);
 
-      /* If there are forms of indirect addressing that the driver
-       * cannot handle, perform the lowering pass.
+   for (unsigned i = 0; i < num_shaders; i++) {
+      /* Avoid reallocation of the program parameter list, because the
+       * uniform storage is only associated with the original parameter list.
+       * This should be enough for Bitmap and DrawPixels constants.
+       *
+       * The uniform storage is shared by all stages.
        */
-      if (options->EmitNoIndirectTemp || options->EmitNoIndirectUniform) {
-         nir_variable_mode mode = (nir_variable_mode)0;
-
-         mode |= options->EmitNoIndirectTemp ?
-            nir_var_function_temp : (nir_variable_mode)0;
-         mode |= options->EmitNoIndirectUniform ?
-            nir_var_uniform | nir_var_mem_ubo | nir_var_mem_ssbo :
-            (nir_variable_mode)0;
+      _mesa_ensure_and_associate_uniform_storage(ctx, shader_program,
+                                                 linked_shader[i]->Program,
+                                                 28);
+   }
 
-         if (mode)
-            nir_lower_indirect_derefs(nir, mode, UINT32_MAX);
-      }
+   gl_nir_link_foreach_stage(ctx->LinkQueue, linked_shader, num_shaders,
+                             st_link_post_opts_stage, &state);
 
-      /* This needs to run after the initial pass of nir_lower_vars_to_ssa, so
-       * that the buffer indices are constants in nir where they where
-       * constants in GLSL. */
-      NIR_PASS(_, nir, gl_nir_lower_buffers, shader_program);
+   char *msg = NULL;
+   for (unsigned i = 0; i < num_shaders; i++) {
+      gl_shader_stage stage = linked_shader[i]->Stage;
 
-      NIR_PASS(_, nir, st_nir_lower_wpos_ytransform, shader->Program,
-               st->screen);
+      if (!msg)
+         msg = state.msg[stage];
+      else
+         free(state.msg[stage]);
+   }
 
-      /* needed to lower base_workgroup_id and base_global_invocation_id */
-      struct nir_lower_compute_system_values_options cs_options = {};
-      NIR_PASS(_, nir, nir_lower_system_values);
-      NIR_PASS(_, nir, nir_lower_compute_system_values, &cs_options);
+   if (msg) {
+      linker_error(shader_program, "%s", msg);
+      free(msg);
+      return false;
    }
 
    struct shader_info *prev_info = NULL;
@@ -515,10 +578,13 @@ st_link_glsl_to_nir(struct gl_context *ctx,
       struct gl_linked_shader *shader = linked_shader[i];
       struct shader_info *info = &shader->Program->nir->info;
 
-      char *msg = st_glsl_to_nir_post_opts(st, shader->Program, shader_program);
-      if (msg) {
-         linker_error(shader_program, msg);
-         return false;
+      if (ctx->_Shader->Flags & GLSL_DUMP) {
+         _mesa_log("\n");
+         _mesa_log("NIR IR for linked %s program %d:\n",
+                _mesa_shader_stage_to_string(shader->Stage),
+                shader_program->Name);
+         nir_print_shader(shader->Program->nir, mesa_log_get_file());
+         _mesa_log("\n\n");
       }
 
       if (prev_info &&
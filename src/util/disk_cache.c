@@ -39,6 +39,7 @@
 
 #include "util/compress.h"
 #include "util/crc32.h"
+#include "util/hash_table.h"
 #include "util/u_debug.h"
 #include "util/rand_xor.h"
 #include "util/u_atomic.h"
@@ -70,6 +71,16 @@ do {                                       \
    _dst += _src_size;                      \
 } while (0);
 
+/* An item requested by disk_cache_prefetch(), see disk_cache_get(). */
+struct disk_cache_prefetch_entry {
+   cache_key key;
+
+   /* Signalled once data and size are set. */
+   struct util_queue_fence ready;
+   void *data;
+   size_t size;
+};
+
 static bool
 disk_cache_init_queue(struct disk_cache *cache)
 {
@@ -115,6 +126,8 @@ disk_cache_type_create(const char *gpu_name,
    if (cache == NULL)
       goto fail;
 
+   simple_mtx_init(&cache->prefetch_lock, mtx_plain);
+
    /* Assume failure. */
    cache->path_init_failed = true;
    cache->type = DISK_CACHE_NONE;
@@ -144,6 +157,9 @@ disk_cache_type_create(const char *gpu_name,
    } else if (cache_type == DISK_CACHE_DATABASE) {
       if (!disk_cache_db_load_cache_index(local, cache))
          goto path_fail;
+   } else if (cache_type == DISK_CACHE_PACK) {
+      if (!disk_cache_pack_load_cache_index(local, cache, max_size))
+         goto path_fail;
    }
 
    if (!getenv("MESA_SHADER_CACHE_DIR") && !getenv("MESA_GLSL_CACHE_DIR"))
@@ -207,8 +223,10 @@ disk_cache_type_create(const char *gpu_name,
    return cache;
 
  fail:
-   if (cache)
+   if (cache) {
+      simple_mtx_destroy(&cache->prefetch_lock);
       ralloc_free(cache);
+   }
    ralloc_free(local);
 
    return NULL;
@@ -232,6 +250,8 @@ disk_cache_create(const char *gpu_name, const char *driver_id,
        */
       if (!getenv("MESA_SHADER_CACHE_DIR") && !getenv("MESA_GLSL_CACHE_DIR") && disk_cache_enabled())
          disk_cache_delete_old_cache();
+   } else if (debug_get_bool_option("MESA_DISK_CACHE_PACK", false)) {
+      cache_type = DISK_CACHE_PACK;
    } else if (debug_get_bool_option("MESA_DISK_CACHE_MULTI_FILE", true)) {
       cache_type = DISK_CACHE_MULTI_FILE;
    } else {
@@ -308,6 +328,17 @@ disk_cache_create(const char *gpu_name, const char *driver_id,
                                                    max_size);
    }
 
+   /* Record the keys looked up by this process, the header line has what
+    * disk_cache_replay needs to open the same cache again.
+    */
+   const char *key_log = debug_get_option("MESA_SHADER_CACHE_KEY_LOG", NULL);
+   if (key_log && !cache->path_init_failed) {
+      cache->key_log = fopen(key_log, "a");
+      if (cache->key_log)
+         fprintf(cache->key_log, "#\t%s\t%s\t%" PRIx64 "\n",
+                 gpu_name, driver_id, driver_flags);
+   }
+
    return cache;
 }
 
@@ -333,6 +364,16 @@ disk_cache_destroy(struct disk_cache *cache)
       util_queue_finish(&cache->cache_queue);
       util_queue_destroy(&cache->cache_queue);
 
+      /* All prefetch jobs have finished, drop what was never retrieved. */
+      if (cache->prefetched) {
+         hash_table_foreach(cache->prefetched, entry) {
+            struct disk_cache_prefetch_entry *pf = entry->data;
+            free(pf->data);
+            util_queue_fence_destroy(&pf->ready);
+            free(pf);
+         }
+      }
+
       if (cache->foz_ro_cache)
          disk_cache_destroy(cache->foz_ro_cache);
 
@@ -342,9 +383,18 @@ disk_cache_destroy(struct disk_cache *cache)
       if (cache->type == DISK_CACHE_DATABASE)
          mesa_cache_db_multipart_close(&cache->cache_db);
 
+      if (cache->type == DISK_CACHE_PACK)
+         mesa_cache_pack_close(&cache->cache_pack);
+
       disk_cache_destroy_mmap(cache);
    }
 
+   if (cache) {
+      if (cache->key_log)
+         fclose(cache->key_log);
+      simple_mtx_destroy(&cache->prefetch_lock);
+   }
+
    ralloc_free(cache);
 }
 
@@ -362,6 +412,11 @@ disk_cache_remove(struct disk_cache *cache, const cache_key key)
       return;
    }
 
+   if (cache->type == DISK_CACHE_PACK) {
+      mesa_cache_pack_entry_remove(&cache->cache_pack, key);
+      return;
+   }
+
    char *filename = disk_cache_get_cache_filename(cache, key);
    if (filename == NULL) {
       return;
@@ -457,6 +512,8 @@ cache_put(void *job, void *gdata, int thread_index)
       disk_cache_write_item_to_disk_foz(dc_job);
    } else if (dc_job->cache->type == DISK_CACHE_DATABASE) {
       disk_cache_db_write_item_to_disk(dc_job);
+   } else if (dc_job->cache->type == DISK_CACHE_PACK) {
+      disk_cache_pack_write_item_to_disk(dc_job);
    } else if (dc_job->cache->type == DISK_CACHE_MULTI_FILE) {
       filename = disk_cache_get_cache_filename(dc_job->cache, dc_job->key);
       if (filename == NULL)
@@ -597,6 +654,176 @@ disk_cache_put_nocopy(struct disk_cache *cache, const cache_key key,
    }
 }
 
+static void
+disk_cache_log_key(struct disk_cache *cache, const cache_key key)
+{
+   char hex[41];
+
+   _mesa_sha1_format(hex, key);
+   fprintf(cache->key_log, "%s\n", hex);
+}
+
+static void
+disk_cache_update_stats(struct disk_cache *cache, bool hit)
+{
+   if (hit)
+      p_atomic_inc(&cache->stats.hits);
+   else
+      p_atomic_inc(&cache->stats.misses);
+}
+
+/* Look up all keys whose data[] slot is still NULL.  Unlike the one key
+ * path, the single file and database backends get each group of keys in
+ * one call so they can take their lock once and read in file order.
+ */
+static void
+disk_cache_load_items(struct disk_cache *cache, unsigned num_keys,
+                      const uint8_t *const *keys, void **data, size_t *sizes)
+{
+   if (cache->foz_ro_cache)
+      disk_cache_load_items_foz(cache->foz_ro_cache, num_keys, keys,
+                                data, sizes);
+
+   if (cache->blob_get_cb) {
+      for (unsigned i = 0; i < num_keys; i++) {
+         if (!data[i])
+            data[i] = blob_get_compressed(cache, keys[i], &sizes[i]);
+      }
+   } else if (cache->type == DISK_CACHE_SINGLE_FILE) {
+      disk_cache_load_items_foz(cache, num_keys, keys, data, sizes);
+   } else if (cache->type == DISK_CACHE_DATABASE) {
+      disk_cache_db_load_items(cache, num_keys, keys, data, sizes);
+   } else if (cache->type == DISK_CACHE_PACK) {
+      for (unsigned i = 0; i < num_keys; i++) {
+         if (!data[i])
+            data[i] = disk_cache_pack_load_item(cache, keys[i], &sizes[i]);
+      }
+   } else if (cache->type == DISK_CACHE_MULTI_FILE) {
+      for (unsigned i = 0; i < num_keys; i++) {
+         if (data[i])
+            continue;
+
+         char *filename = disk_cache_get_cache_filename(cache, keys[i]);
+         if (filename)
+            data[i] = disk_cache_load_item(cache, filename, &sizes[i]);
+      }
+   }
+}
+
+struct disk_cache_get_job {
+   struct util_queue_fence fence;
+   struct disk_cache *cache;
+   unsigned num_keys;
+   const uint8_t *const *keys;
+   void **data;
+   size_t *sizes;
+};
+
+static void
+cache_get(void *job, void *gdata, int thread_index)
+{
+   struct disk_cache_get_job *dc_job = (struct disk_cache_get_job *) job;
+
+   disk_cache_load_items(dc_job->cache, dc_job->num_keys, dc_job->keys,
+                         dc_job->data, dc_job->sizes);
+}
+
+/* Don't bother the worker threads with fewer keys than this. */
+#define DISK_CACHE_GET_JOB_MIN_KEYS 8
+
+struct disk_cache_prefetch_job {
+   struct disk_cache *cache;
+   unsigned num_entries;
+   struct disk_cache_prefetch_entry *entries[];
+};
+
+/* Unretrieved prefetched items are capped at this many. */
+#define DISK_CACHE_PREFETCH_MAX_ENTRIES 4096
+
+static void
+cache_prefetch(void *job, void *gdata, int thread_index)
+{
+   struct disk_cache_prefetch_job *pf_job =
+      (struct disk_cache_prefetch_job *) job;
+   const unsigned num_entries = pf_job->num_entries;
+   const uint8_t **keys = malloc(num_entries * sizeof(*keys));
+   void **data = calloc(num_entries, sizeof(*data));
+   size_t *sizes = calloc(num_entries, sizeof(*sizes));
+
+   if (keys && data && sizes) {
+      for (unsigned i = 0; i < num_entries; i++)
+         keys[i] = pf_job->entries[i]->key;
+
+      disk_cache_load_items(pf_job->cache, num_entries, keys, data, sizes);
+   }
+
+   /* Entries can be freed by disk_cache_get() as soon as they are
+    * signalled, so don't touch them afterwards.
+    */
+   for (unsigned i = 0; i < num_entries; i++) {
+      struct disk_cache_prefetch_entry *pf = pf_job->entries[i];
+      pf->data = data ? data[i] : NULL;
+      pf->size = sizes ? sizes[i] : 0;
+      util_queue_fence_signal(&pf->ready);
+   }
+
+   free(keys);
+   free(data);
+   free(sizes);
+}
+
+static void
+destroy_prefetch_job(void *job, void *gdata, int thread_index)
+{
+   free(job);
+}
+
+static uint32_t
+cache_key_hash(const void *key)
+{
+   uint32_t hash;
+   memcpy(&hash, key, sizeof(hash));
+   return hash;
+}
+
+static bool
+cache_key_equals(const void *a, const void *b)
+{
+   return memcmp(a, b, CACHE_KEY_SIZE) == 0;
+}
+
+/* Take the item for key out of the prefetched ones, waiting for it to be
+ * loaded if needed.  Returns false if the key wasn't prefetched.
+ */
+static bool
+disk_cache_take_prefetched(struct disk_cache *cache, const cache_key key,
+                           void **data, size_t *size)
+{
+   struct disk_cache_prefetch_entry *pf = NULL;
+
+   simple_mtx_lock(&cache->prefetch_lock);
+   struct hash_entry *entry = _mesa_hash_table_search(cache->prefetched, key);
+   if (entry) {
+      pf = entry->data;
+      _mesa_hash_table_remove(cache->prefetched, entry);
+      p_atomic_dec(&cache->num_prefetched);
+   }
+   simple_mtx_unlock(&cache->prefetch_lock);
+
+   if (!pf)
+      return false;
+
+   util_queue_fence_wait(&pf->ready);
+   util_queue_fence_destroy(&pf->ready);
+
+   *data = pf->data;
+   if (size)
+      *size = pf->size;
+
+   free(pf);
+   return true;
+}
+
 void *
 disk_cache_get(struct disk_cache *cache, const cache_key key, size_t *size)
 {
@@ -605,6 +832,13 @@ disk_cache_get(struct disk_cache *cache, const cache_key key, size_t *size)
    if (size)
       *size = 0;
 
+   if (unlikely(cache->key_log))
+      disk_cache_log_key(cache, key);
+
+   if (p_atomic_read(&cache->num_prefetched) &&
+       disk_cache_take_prefetched(cache, key, &buf, size))
+      goto out;
+
    if (cache->foz_ro_cache)
       buf = disk_cache_load_item_foz(cache->foz_ro_cache, key, size);
 
@@ -615,6 +849,8 @@ disk_cache_get(struct disk_cache *cache, const cache_key key, size_t *size)
          buf = disk_cache_load_item_foz(cache, key, size);
       } else if (cache->type == DISK_CACHE_DATABASE) {
          buf = disk_cache_db_load_item(cache, key, size);
+      } else if (cache->type == DISK_CACHE_PACK) {
+         buf = disk_cache_pack_load_item(cache, key, size);
       } else if (cache->type == DISK_CACHE_MULTI_FILE) {
          char *filename = disk_cache_get_cache_filename(cache, key);
          if (filename)
@@ -622,14 +858,190 @@ disk_cache_get(struct disk_cache *cache, const cache_key key, size_t *size)
       }
    }
 
+out:
+   if (unlikely(cache->stats.enabled))
+      disk_cache_update_stats(cache, buf != NULL);
+
+   return buf;
+}
+
+bool
+disk_cache_get_view(struct disk_cache *cache, const cache_key key,
+                    struct disk_cache_view *view)
+{
+   view->data = NULL;
+   view->size = 0;
+   view->copy = NULL;
+
+   /* Only the pack can hand out items in place, and only when nothing in
+    * front of it could have the item.
+    */
+   if (cache->type != DISK_CACHE_PACK || cache->blob_get_cb ||
+       cache->foz_ro_cache || p_atomic_read(&cache->num_prefetched)) {
+      view->copy = disk_cache_get(cache, key, &view->size);
+      view->data = view->copy;
+      return view->copy != NULL;
+   }
+
+   if (unlikely(cache->key_log))
+      disk_cache_log_key(cache, key);
+
+   bool found = disk_cache_pack_get_view(cache, key, view);
+
+   if (unlikely(cache->stats.enabled))
+      disk_cache_update_stats(cache, found);
+
+   return found;
+}
+
+void
+disk_cache_release_view(struct disk_cache_view *view)
+{
+   free(view->copy);
+   view->data = NULL;
+   view->size = 0;
+   view->copy = NULL;
+}
+
+void
+disk_cache_get_batch(struct disk_cache *cache, unsigned num_keys,
+                     const cache_key *keys, void **data, size_t *sizes)
+{
+   const uint8_t **key_ptrs;
+   struct disk_cache_get_job *jobs = NULL;
+   unsigned num_groups = 1;
+
+   for (unsigned i = 0; i < num_keys; i++) {
+      data[i] = NULL;
+      sizes[i] = 0;
+
+      if (unlikely(cache->key_log))
+         disk_cache_log_key(cache, keys[i]);
+
+      if (p_atomic_read(&cache->num_prefetched))
+         disk_cache_take_prefetched(cache, keys[i], &data[i], &sizes[i]);
+   }
+
+   key_ptrs = malloc(num_keys * sizeof(*key_ptrs));
+   if (!key_ptrs)
+      goto out;
+
+   for (unsigned i = 0; i < num_keys; i++)
+      key_ptrs[i] = keys[i];
+
+   /* One group per worker thread plus one for the calling thread, which
+    * the worker threads don't outrun at their minimum priority.
+    */
+   if (util_queue_is_initialized(&cache->cache_queue)) {
+      num_groups = MIN2(DIV_ROUND_UP(num_keys, DISK_CACHE_GET_JOB_MIN_KEYS),
+                        cache->cache_queue.num_threads + 1);
+      num_groups = MAX2(num_groups, 1);
+   }
+
+   if (num_groups > 1) {
+      jobs = calloc(num_groups - 1, sizeof(*jobs));
+      if (!jobs)
+         num_groups = 1;
+   }
+
+   const unsigned group_size = DIV_ROUND_UP(num_keys, num_groups);
+
+   for (unsigned g = 1; g < num_groups; g++) {
+      struct disk_cache_get_job *job = &jobs[g - 1];
+      const unsigned start = g * group_size;
+
+      job->cache = cache;
+      job->num_keys = MIN2(group_size, num_keys - MIN2(start, num_keys));
+      job->keys = key_ptrs + start;
+      job->data = data + start;
+      job->sizes = sizes + start;
+
+      util_queue_fence_init(&job->fence);
+      if (job->num_keys)
+         util_queue_add_job(&cache->cache_queue, job, &job->fence,
+                            cache_get, NULL, 0);
+   }
+
+   disk_cache_load_items(cache, MIN2(group_size, num_keys), key_ptrs,
+                         data, sizes);
+
+   for (unsigned g = 1; g < num_groups; g++) {
+      util_queue_fence_wait(&jobs[g - 1].fence);
+      util_queue_fence_destroy(&jobs[g - 1].fence);
+   }
+
+   free(jobs);
+   free(key_ptrs);
+
+out:
    if (unlikely(cache->stats.enabled)) {
-      if (buf)
-         p_atomic_inc(&cache->stats.hits);
-      else
-         p_atomic_inc(&cache->stats.misses);
+      for (unsigned i = 0; i < num_keys; i++)
+         disk_cache_update_stats(cache, data[i] != NULL);
    }
+}
 
-   return buf;
+void
+disk_cache_prefetch(struct disk_cache *cache, unsigned num_keys,
+                    const cache_key *keys)
+{
+   if (!util_queue_is_initialized(&cache->cache_queue) || !num_keys)
+      return;
+
+   const unsigned num_jobs =
+      MIN2(DIV_ROUND_UP(num_keys, DISK_CACHE_GET_JOB_MIN_KEYS),
+           cache->cache_queue.num_threads);
+   const unsigned job_size = DIV_ROUND_UP(num_keys, num_jobs);
+   unsigned k = 0;
+
+   simple_mtx_lock(&cache->prefetch_lock);
+
+   if (!cache->prefetched) {
+      cache->prefetched = _mesa_hash_table_create(cache, cache_key_hash,
+                                                  cache_key_equals);
+      if (!cache->prefetched)
+         goto out;
+   }
+
+   for (unsigned j = 0; j < num_jobs && k < num_keys; j++) {
+      struct disk_cache_prefetch_job *job =
+         malloc(sizeof(*job) + job_size * sizeof(job->entries[0]));
+      if (!job)
+         break;
+
+      job->cache = cache;
+      job->num_entries = 0;
+
+      for (; k < num_keys && job->num_entries < job_size; k++) {
+         if (cache->num_prefetched >= DISK_CACHE_PREFETCH_MAX_ENTRIES)
+            break;
+
+         if (_mesa_hash_table_search(cache->prefetched, keys[k]))
+            continue;
+
+         struct disk_cache_prefetch_entry *pf = calloc(1, sizeof(*pf));
+         if (!pf)
+            break;
+
+         memcpy(pf->key, keys[k], CACHE_KEY_SIZE);
+         util_queue_fence_init(&pf->ready);
+         util_queue_fence_reset(&pf->ready);
+
+         _mesa_hash_table_insert(cache->prefetched, pf->key, pf);
+         p_atomic_inc(&cache->num_prefetched);
+         job->entries[job->num_entries++] = pf;
+      }
+
+      if (!job->num_entries) {
+         free(job);
+         break;
+      }
+
+      util_queue_add_job(&cache->cache_queue, job, NULL, cache_prefetch,
+                         destroy_prefetch_job, 0);
+   }
+
+out:
+   simple_mtx_unlock(&cache->prefetch_lock);
 }
 
 void
@@ -46,6 +46,7 @@ extern "C" {
 #define CACHE_DIR_NAME "mesa_shader_cache"
 #define CACHE_DIR_NAME_SF "mesa_shader_cache_sf"
 #define CACHE_DIR_NAME_DB "mesa_shader_cache_db"
+#define CACHE_DIR_NAME_PACK "mesa_shader_cache_pack"
 
 typedef uint8_t cache_key[CACHE_KEY_SIZE];
 
@@ -77,6 +78,17 @@ struct cache_item_metadata {
    uint32_t num_keys;
 };
 
+/**
+ * A read-only reference to a cached item, see disk_cache_get_view().
+ */
+struct disk_cache_view {
+   const void *data;
+   size_t size;
+
+   /* Private copy of the item when it couldn't be referenced in place. */
+   void *copy;
+};
+
 struct disk_cache;
 
 #ifdef HAVE_DLADDR
@@ -234,6 +246,52 @@ disk_cache_put_nocopy(struct disk_cache *cache, const cache_key key,
 void *
 disk_cache_get(struct disk_cache *cache, const cache_key key, size_t *size);
 
+/**
+ * Retrieve several items at once.
+ *
+ * Equivalent to calling disk_cache_get() for each of the \num_keys keys, but
+ * the lookups are shared between the cache's worker threads and the calling
+ * thread, and the single file and database caches read each group of keys
+ * under one lock, in file order.
+ *
+ * On return \data[i] is the malloc'ed item stored under \keys[i], or NULL,
+ * and \sizes[i] is its size.
+ */
+void
+disk_cache_get_batch(struct disk_cache *cache, unsigned num_keys,
+                     const cache_key *keys, void **data, size_t *sizes);
+
+/**
+ * Start loading the items stored under \keys in the background.
+ *
+ * A later disk_cache_get() or disk_cache_get_batch() of one of the keys
+ * returns the loaded item, waiting for it if it is still being read,
+ * instead of going to the disk again.  Items which are never retrieved are
+ * freed along with the cache, so only prefetch keys which are about to be
+ * looked up.
+ */
+void
+disk_cache_prefetch(struct disk_cache *cache, unsigned num_keys,
+                    const cache_key *keys);
+
+/**
+ * Retrieve an item without copying it, if the cache allows it.
+ *
+ * With the pack cache (MESA_DISK_CACHE_PACK) an uncompressed item is
+ * returned as a pointer into the read-only mapping of the pack, which is
+ * shared with other processes through the page cache.  Other caches fall
+ * back to a private copy.  Either way \view->data stays valid until
+ * disk_cache_release_view() or the destruction of the cache.
+ *
+ * \return True if the item was found.
+ */
+bool
+disk_cache_get_view(struct disk_cache *cache, const cache_key key,
+                    struct disk_cache_view *view);
+
+void
+disk_cache_release_view(struct disk_cache_view *view);
+
 /**
  * Store the name \key within the cache, (without any associated data).
  *
@@ -317,6 +375,37 @@ disk_cache_get(struct disk_cache *cache, const cache_key key, size_t *size)
    return NULL;
 }
 
+static inline void
+disk_cache_get_batch(struct disk_cache *cache, unsigned num_keys,
+                     const cache_key *keys, void **data, size_t *sizes)
+{
+   for (unsigned i = 0; i < num_keys; i++) {
+      data[i] = NULL;
+      sizes[i] = 0;
+   }
+}
+
+static inline void
+disk_cache_prefetch(struct disk_cache *cache, unsigned num_keys,
+                    const cache_key *keys)
+{
+}
+
+static inline bool
+disk_cache_get_view(struct disk_cache *cache, const cache_key key,
+                    struct disk_cache_view *view)
+{
+   view->data = NULL;
+   view->size = 0;
+   view->copy = NULL;
+   return false;
+}
+
+static inline void
+disk_cache_release_view(struct disk_cache_view *view)
+{
+}
+
 static inline void
 disk_cache_put_key(struct disk_cache *cache, const cache_key key)
 {
@@ -547,34 +547,37 @@ disk_cache_evict_item(struct disk_cache *cache, char *filename)
       p_atomic_add(&cache->size->value, - (uint64_t)sb.st_blocks * 512);
 }
 
-static void *
-parse_and_validate_cache_item(struct disk_cache *cache, void *cache_item,
-                              size_t cache_item_size, size_t *size)
+/* Skip the header of a cache item, checking that it belongs to this cache.
+ * Returns the stored, possibly compressed, data.
+ */
+static const uint8_t *
+parse_cache_item_header(struct disk_cache *cache, const void *cache_item,
+                        size_t cache_item_size,
+                        struct cache_entry_file_data *cf_data,
+                        size_t *cache_data_size)
 {
-   uint8_t *uncompressed_data = NULL;
-
    struct blob_reader ci_blob_reader;
    blob_reader_init(&ci_blob_reader, cache_item, cache_item_size);
 
    size_t header_size = cache->driver_keys_blob_size;
    const void *keys_blob = blob_read_bytes(&ci_blob_reader, header_size);
    if (ci_blob_reader.overrun)
-      goto fail;
+      return NULL;
 
    /* Check for extremely unlikely hash collisions */
    if (memcmp(cache->driver_keys_blob, keys_blob, header_size) != 0) {
       assert(!"Mesa cache keys mismatch!");
-      goto fail;
+      return NULL;
    }
 
    uint32_t md_type = blob_read_uint32(&ci_blob_reader);
    if (ci_blob_reader.overrun)
-      goto fail;
+      return NULL;
 
    if (md_type == CACHE_ITEM_TYPE_GLSL) {
       uint32_t num_keys = blob_read_uint32(&ci_blob_reader);
       if (ci_blob_reader.overrun)
-         goto fail;
+         return NULL;
 
       /* The cache item metadata is currently just used for distributing
        * precompiled shaders, they are not used by Mesa so just skip them for
@@ -585,41 +588,54 @@ parse_and_validate_cache_item(struct disk_cache *cache, void *cache_item,
       const void UNUSED *metadata =
          blob_read_bytes(&ci_blob_reader, num_keys * sizeof(cache_key));
       if (ci_blob_reader.overrun)
-         goto fail;
+         return NULL;
    }
 
    /* Load the CRC that was created when the file was written. */
-   struct cache_entry_file_data *cf_data =
-      (struct cache_entry_file_data *)
-         blob_read_bytes(&ci_blob_reader, sizeof(struct cache_entry_file_data));
+   blob_copy_bytes(&ci_blob_reader, cf_data, sizeof(*cf_data));
    if (ci_blob_reader.overrun)
-      goto fail;
+      return NULL;
+
+   *cache_data_size = ci_blob_reader.end - ci_blob_reader.current;
+   return (const uint8_t *) blob_read_bytes(&ci_blob_reader, *cache_data_size);
+}
+
+static void *
+parse_and_validate_cache_item(struct disk_cache *cache, const void *cache_item,
+                              size_t cache_item_size, size_t *size)
+{
+   uint8_t *uncompressed_data = NULL;
+   struct cache_entry_file_data cf_data;
+   size_t cache_data_size;
 
-   size_t cache_data_size = ci_blob_reader.end - ci_blob_reader.current;
-   const uint8_t *data = (uint8_t *) blob_read_bytes(&ci_blob_reader, cache_data_size);
+   const uint8_t *data = parse_cache_item_header(cache, cache_item,
+                                                 cache_item_size, &cf_data,
+                                                 &cache_data_size);
+   if (!data)
+      goto fail;
 
    /* Check the data for corruption */
-   if (cf_data->crc32 != util_hash_crc32(data, cache_data_size))
+   if (cf_data.crc32 != util_hash_crc32(data, cache_data_size))
       goto fail;
 
    /* Uncompress the cache data */
-   uncompressed_data = malloc(cf_data->uncompressed_size);
+   uncompressed_data = malloc(cf_data.uncompressed_size);
    if (!uncompressed_data)
       goto fail;
 
    if (cache->compression_disabled) {
-      if (cf_data->uncompressed_size != cache_data_size)
+      if (cf_data.uncompressed_size != cache_data_size)
          goto fail;
 
       memcpy(uncompressed_data, data, cache_data_size);
    } else {
       if (!util_compress_inflate(data, cache_data_size, uncompressed_data,
-                                 cf_data->uncompressed_size))
+                                 cf_data.uncompressed_size))
          goto fail;
    }
 
    if (size)
-      *size = cf_data->uncompressed_size;
+      *size = cf_data.uncompressed_size;
 
    return uncompressed_data;
 
@@ -889,6 +905,7 @@ disk_cache_write_item_to_disk(struct disk_cache_put_job *dc_job,
  *  - For DISK_CACHE_MULTI_FILE: mesa_shader_cache
  *  - For DISK_CACHE_SINGLE_FILE: mesa_shader_cache_sf
  *  - For DISK_CACHE_DATABASE: mesa_shader_cache_db
+ *  - For DISK_CACHE_PACK: mesa_shader_cache_pack
  *
  * If the mkdir param is set we create the directory if it doesn't already
  * exist, if it does not exist and the param is false NULL will be returned.
@@ -911,6 +928,8 @@ disk_cache_generate_cache_dir(void *mem_ctx, const char *gpu_name,
          cache_dir_name = CACHE_DIR_NAME_SF;
       else if (cache_type == DISK_CACHE_DATABASE)
          cache_dir_name = CACHE_DIR_NAME_DB;
+      else if (cache_type == DISK_CACHE_PACK)
+         cache_dir_name = CACHE_DIR_NAME_PACK;
    }
 
    char *path = secure_getenv("MESA_SHADER_CACHE_DIR");
@@ -1055,6 +1074,43 @@ disk_cache_load_item_foz(struct disk_cache *cache, const cache_key key,
    return uncompressed_data;
 }
 
+/* Unpack the raw items read by a batched backend lookup into the still
+ * empty slots of data[].
+ */
+static void
+parse_and_validate_cache_items(struct disk_cache *cache, unsigned num_keys,
+                               void **items, size_t *item_sizes,
+                               void **data, size_t *sizes)
+{
+   for (unsigned i = 0; i < num_keys; i++) {
+      if (data[i] || !items[i])
+         continue;
+
+      data[i] = parse_and_validate_cache_item(cache, items[i], item_sizes[i],
+                                              &sizes[i]);
+      free(items[i]);
+   }
+}
+
+void
+disk_cache_load_items_foz(struct disk_cache *cache, unsigned num_keys,
+                          const uint8_t *const *keys,
+                          void **data, size_t *sizes)
+{
+   void **items = malloc(num_keys * (sizeof(void *) + sizeof(size_t)));
+   if (!items)
+      return;
+
+   size_t *item_sizes = (size_t *)(items + num_keys);
+
+   /* Already loaded slots are skipped by the lookup as well. */
+   memcpy(items, data, num_keys * sizeof(void *));
+   foz_read_entries(&cache->foz_db, num_keys, keys, items, item_sizes);
+   parse_and_validate_cache_items(cache, num_keys, items, item_sizes,
+                                  data, sizes);
+   free(items);
+}
+
 bool
 disk_cache_write_item_to_disk_foz(struct disk_cache_put_job *dc_job)
 {
@@ -1194,6 +1250,25 @@ disk_cache_db_load_item(struct disk_cache *cache, const cache_key key,
    return uncompressed_data;
 }
 
+void
+disk_cache_db_load_items(struct disk_cache *cache, unsigned num_keys,
+                         const uint8_t *const *keys,
+                         void **data, size_t *sizes)
+{
+   void **items = malloc(num_keys * (sizeof(void *) + sizeof(size_t)));
+   if (!items)
+      return;
+
+   size_t *item_sizes = (size_t *)(items + num_keys);
+
+   memcpy(items, data, num_keys * sizeof(void *));
+   mesa_cache_db_multipart_read_entries(&cache->cache_db, num_keys, keys,
+                                        items, item_sizes);
+   parse_and_validate_cache_items(cache, num_keys, items, item_sizes,
+                                  data, sizes);
+   free(items);
+}
+
 bool
 disk_cache_db_write_item_to_disk(struct disk_cache_put_job *dc_job)
 {
@@ -1217,6 +1292,93 @@ disk_cache_db_load_cache_index(void *mem_ctx, struct disk_cache *cache)
    return mesa_cache_db_multipart_open(&cache->cache_db, cache->path);
 }
 
+void *
+disk_cache_pack_load_item(struct disk_cache *cache, const cache_key key,
+                          size_t *size)
+{
+   size_t cache_item_size = 0;
+   void *copy;
+   const void *cache_item =
+      mesa_cache_pack_read_entry(&cache->cache_pack, key, &cache_item_size,
+                                 &copy);
+   if (!cache_item)
+      return NULL;
+
+   uint8_t *uncompressed_data =
+       parse_and_validate_cache_item(cache, cache_item, cache_item_size, size);
+   free(copy);
+
+   return uncompressed_data;
+}
+
+bool
+disk_cache_pack_get_view(struct disk_cache *cache, const cache_key key,
+                         struct disk_cache_view *view)
+{
+   struct cache_entry_file_data cf_data;
+   size_t cache_item_size = 0, cache_data_size;
+   void *copy;
+   const void *cache_item =
+      mesa_cache_pack_read_entry(&cache->cache_pack, key, &cache_item_size,
+                                 &copy);
+   if (!cache_item)
+      return false;
+
+   /* The item had to be read or inflated, unpack that copy as usual. */
+   if (copy) {
+      view->copy = parse_and_validate_cache_item(cache, copy, cache_item_size,
+                                                 &view->size);
+      view->data = view->copy;
+      free(copy);
+      return view->copy != NULL;
+   }
+
+   /* Items are stored uncompressed by the disk cache.  The pack file may
+    * have been damaged since it was built, so check the mapped data too.
+    */
+   const uint8_t *data = parse_cache_item_header(cache, cache_item,
+                                                 cache_item_size, &cf_data,
+                                                 &cache_data_size);
+   if (!data || cf_data.uncompressed_size != cache_data_size ||
+       cf_data.crc32 != util_hash_crc32(data, cache_data_size))
+      return false;
+
+   view->data = data;
+   view->size = cache_data_size;
+   return true;
+}
+
+bool
+disk_cache_pack_write_item_to_disk(struct disk_cache_put_job *dc_job)
+{
+   struct blob cache_blob;
+   blob_init(&cache_blob);
+
+   if (!create_cache_item_header_and_blob(dc_job, &cache_blob))
+      return false;
+
+   bool r = mesa_cache_pack_entry_write(&dc_job->cache->cache_pack,
+                                        dc_job->key, cache_blob.data,
+                                        cache_blob.size);
+
+   blob_finish(&cache_blob);
+   return r;
+}
+
+bool
+disk_cache_pack_load_cache_index(void *mem_ctx, struct disk_cache *cache,
+                                 uint64_t max_size)
+{
+   /* Items are stored uncompressed so that they can be used in place, the
+    * pack compresses them itself if asked to.
+    */
+   cache->compression_disabled = true;
+
+   return mesa_cache_pack_open(&cache->cache_pack, cache->path, max_size,
+                               debug_get_bool_option("MESA_DISK_CACHE_PACK_COMPRESS",
+                                                     false));
+}
+
 static void
 delete_dir(const char* path)
 {
@@ -35,6 +35,9 @@
 #include "util/fossilize_db.h"
 #include "util/mesa_cache_db.h"
 #include "util/mesa_cache_db_multipart.h"
+#include "util/mesa_cache_pack.h"
+
+struct hash_table;
 
 #ifdef __cplusplus
 extern "C" {
@@ -54,6 +57,7 @@ enum disk_cache_type {
    DISK_CACHE_MULTI_FILE,
    DISK_CACHE_SINGLE_FILE,
    DISK_CACHE_DATABASE,
+   DISK_CACHE_PACK,
 };
 
 struct disk_cache {
@@ -68,6 +72,8 @@ struct disk_cache {
 
    struct mesa_cache_db_multipart cache_db;
 
+   struct mesa_cache_pack cache_pack;
+
    enum disk_cache_type type;
 
    /* Seed for rand, which is used to pick a random directory */
@@ -93,7 +99,9 @@ struct disk_cache {
    disk_cache_put_cb blob_put_cb;
    disk_cache_get_cb blob_get_cb;
 
-   /* Don't compress cached data. This is for testing purposes only. */
+   /* Don't compress cached data. This is for testing purposes only, and
+    * for the pack cache which compresses entries itself.
+    */
    bool compression_disabled;
 
    struct {
@@ -104,6 +112,18 @@ struct disk_cache {
 
    /* Internal RO FOZ cache for combined use of RO and RW caches. */
    struct disk_cache *foz_ro_cache;
+
+   /* Items requested with disk_cache_prefetch() that haven't been
+    * retrieved yet, keyed by cache key.
+    */
+   simple_mtx_t prefetch_lock;
+   struct hash_table *prefetched;
+   unsigned num_prefetched;
+
+   /* Where disk_cache_get() logs the requested keys, for replaying them
+    * with disk_cache_replay.
+    */
+   FILE *key_log;
 };
 
 struct cache_entry_file_data {
@@ -144,6 +164,11 @@ void *
 disk_cache_load_item_foz(struct disk_cache *cache, const cache_key key,
                          size_t *size);
 
+void
+disk_cache_load_items_foz(struct disk_cache *cache, unsigned num_keys,
+                          const uint8_t *const *keys,
+                          void **data, size_t *sizes);
+
 void *
 disk_cache_load_item(struct disk_cache *cache, char *filename, size_t *size);
 
@@ -177,12 +202,32 @@ void *
 disk_cache_db_load_item(struct disk_cache *cache, const cache_key key,
                         size_t *size);
 
+void
+disk_cache_db_load_items(struct disk_cache *cache, unsigned num_keys,
+                         const uint8_t *const *keys,
+                         void **data, size_t *sizes);
+
 bool
 disk_cache_db_write_item_to_disk(struct disk_cache_put_job *dc_job);
 
 bool
 disk_cache_db_load_cache_index(void *mem_ctx, struct disk_cache *cache);
 
+void *
+disk_cache_pack_load_item(struct disk_cache *cache, const cache_key key,
+                          size_t *size);
+
+bool
+disk_cache_pack_get_view(struct disk_cache *cache, const cache_key key,
+                         struct disk_cache_view *view);
+
+bool
+disk_cache_pack_write_item_to_disk(struct disk_cache_put_job *dc_job);
+
+bool
+disk_cache_pack_load_cache_index(void *mem_ctx, struct disk_cache *cache,
+                                 uint64_t max_size);
+
 void
 disk_cache_delete_old_cache(void);
 
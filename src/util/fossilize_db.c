@@ -577,33 +577,15 @@ foz_destroy(struct foz_db *foz_db)
    memset(foz_db, 0, sizeof(*foz_db));
 }
 
-/* Here we lookup a cache entry in the index hash table. If an entry is found
- * we use the retrieved offset to read the cache entry from disk.
+/* Read the payload of an index entry, with foz_db->mtx held.  Returns
+ * NULL if the entry can't be read or doesn't match the full key.
  */
-void *
-foz_read_entry(struct foz_db *foz_db, const uint8_t *cache_key_160bit,
-               size_t *size)
+static void *
+foz_read_entry_locked(struct foz_db *foz_db, struct foz_db_entry *entry,
+                      const uint8_t *cache_key_160bit, size_t *size)
 {
-   uint64_t hash = truncate_hash_to_64bits(cache_key_160bit);
-
    void *data = NULL;
 
-   if (!foz_db->alive)
-      return NULL;
-
-   simple_mtx_lock(&foz_db->mtx);
-
-   struct foz_db_entry *entry =
-      _mesa_hash_table_u64_search(foz_db->index_db, hash);
-   if (!entry && foz_db->db_idx) {
-      update_foz_index(foz_db, foz_db->db_idx, 0);
-      entry = _mesa_hash_table_u64_search(foz_db->index_db, hash);
-   }
-   if (!entry) {
-      simple_mtx_unlock(&foz_db->mtx);
-      return NULL;
-   }
-
    uint8_t file_idx = entry->file_idx;
    if (fseek(foz_db->file[file_idx], entry->offset, SEEK_SET) < 0)
       goto fail;
@@ -632,8 +614,6 @@ foz_read_entry(struct foz_db *foz_db, const uint8_t *cache_key_160bit,
          goto fail;
    }
 
-   simple_mtx_unlock(&foz_db->mtx);
-
    if (size)
       *size = data_sz;
 
@@ -641,11 +621,109 @@ foz_read_entry(struct foz_db *foz_db, const uint8_t *cache_key_160bit,
 
 fail:
    free(data);
+   return NULL;
+}
+
+void *
+foz_read_entry(struct foz_db *foz_db, const uint8_t *cache_key_160bit,
+               size_t *size)
+{
+   uint64_t hash = truncate_hash_to_64bits(cache_key_160bit);
+
+   void *data = NULL;
+
+   if (!foz_db->alive)
+      return NULL;
+
+   simple_mtx_lock(&foz_db->mtx);
+
+   struct foz_db_entry *entry =
+      _mesa_hash_table_u64_search(foz_db->index_db, hash);
+   if (!entry && foz_db->db_idx) {
+      update_foz_index(foz_db, foz_db->db_idx, 0);
+      entry = _mesa_hash_table_u64_search(foz_db->index_db, hash);
+   }
+   if (entry)
+      data = foz_read_entry_locked(foz_db, entry, cache_key_160bit, size);
 
-   /* reading db entry failed. reset the file offset */
    simple_mtx_unlock(&foz_db->mtx);
 
-   return NULL;
+   return data;
+}
+
+struct foz_read_request {
+   struct foz_db_entry *entry;
+   unsigned idx;
+};
+
+static int
+foz_read_request_sort(const void *_a, const void *_b)
+{
+   const struct foz_read_request *a = _a;
+   const struct foz_read_request *b = _b;
+
+   if (a->entry->file_idx != b->entry->file_idx)
+      return a->entry->file_idx > b->entry->file_idx ? 1 : -1;
+   if (a->entry->offset == b->entry->offset)
+      return 0;
+   return a->entry->offset > b->entry->offset ? 1 : -1;
+}
+
+/* Read several entries at once.  The db is locked and the index refreshed
+ * only once, and the entries are read in file order so the reads are as
+ * close to sequential as the db layout allows.  Only entries whose data[]
+ * slot is NULL are looked up.
+ */
+void
+foz_read_entries(struct foz_db *foz_db, unsigned num_entries,
+                 const uint8_t *const *cache_keys_160bit,
+                 void **data, size_t *sizes)
+{
+   struct foz_read_request *requests;
+   unsigned num_requests = 0;
+   bool index_updated = false;
+
+   if (!foz_db->alive || !num_entries)
+      return;
+
+   requests = malloc(num_entries * sizeof(*requests));
+   if (!requests)
+      return;
+
+   simple_mtx_lock(&foz_db->mtx);
+
+   for (unsigned i = 0; i < num_entries; i++) {
+      if (data[i])
+         continue;
+
+      uint64_t hash = truncate_hash_to_64bits(cache_keys_160bit[i]);
+      struct foz_db_entry *entry =
+         _mesa_hash_table_u64_search(foz_db->index_db, hash);
+
+      if (!entry && foz_db->db_idx && !index_updated) {
+         update_foz_index(foz_db, foz_db->db_idx, 0);
+         index_updated = true;
+         entry = _mesa_hash_table_u64_search(foz_db->index_db, hash);
+      }
+
+      if (entry) {
+         requests[num_requests].entry = entry;
+         requests[num_requests].idx = i;
+         num_requests++;
+      }
+   }
+
+   qsort(requests, num_requests, sizeof(*requests), foz_read_request_sort);
+
+   for (unsigned r = 0; r < num_requests; r++) {
+      const unsigned i = requests[r].idx;
+      data[i] = foz_read_entry_locked(foz_db, requests[r].entry,
+                                      cache_keys_160bit[i], &sizes[i]);
+   }
+
+   simple_mtx_unlock(&foz_db->mtx);
+
+   free(requests);
 }
 
 /* Here we write the cache entry to disk and store its offset in the index db.
@@ -776,6 +854,13 @@ foz_read_entry(struct foz_db *foz_db, const uint8_t *cache_key_160bit,
    return false;
 }
 
+void
+foz_read_entries(struct foz_db *foz_db, unsigned num_entries,
+                 const uint8_t *const *cache_keys_160bit,
+                 void **data, size_t *sizes)
+{
+}
+
 bool
 foz_write_entry(struct foz_db *foz_db, const uint8_t *cache_key_160bit,
                 const void *blob, size_t size)
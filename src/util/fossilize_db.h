@@ -105,6 +105,11 @@ void *
 foz_read_entry(struct foz_db *foz_db, const uint8_t *cache_key_160bit,
                size_t *size);
 
+void
+foz_read_entries(struct foz_db *foz_db, unsigned num_entries,
+                 const uint8_t *const *cache_keys_160bit,
+                 void **data, size_t *sizes);
+
 bool
 foz_write_entry(struct foz_db *foz_db, const uint8_t *cache_key_160bit,
                 const void *blob, size_t size);
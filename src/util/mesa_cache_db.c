@@ -16,6 +16,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/file.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include "crc32.h"
@@ -108,29 +109,55 @@ mesa_db_flock(FILE *file, int op)
    return ret;
 }
 
+static bool
+mesa_db_file_replaced(struct mesa_cache_db_file *db_file)
+{
+   struct stat file_stat, path_stat;
+
+   if (fstat(fileno(db_file->file), &file_stat) < 0 ||
+       stat(db_file->path, &path_stat) < 0)
+      return true;
+
+   return file_stat.st_ino != path_stat.st_ino ||
+          file_stat.st_dev != path_stat.st_dev;
+}
+
+/* Only writers lock the DB. They serialize on an exclusive lock of the
+ * cache file, which also keeps out the older Mesa versions that lock the
+ * cache file before the index file.
+ *
+ * Compaction replaces the DB files, hence a writer that waited for the
+ * lock may end up holding the lock of a retired cache file. In that case
+ * it retries with the published one. The index file is opened once the
+ * lock is taken, so that it always belongs to the locked cache file.
+ */
 static bool
 mesa_db_lock(struct mesa_cache_db *db)
 {
    simple_mtx_lock(&db->flock_mtx);
 
-   if (!mesa_db_reopen_file(&db->index) ||
-       !mesa_db_reopen_file(&db->cache))
-      goto close_files;
+   for (;;) {
+      if (!mesa_db_reopen_file(&db->cache))
+         goto fail;
 
-   if (mesa_db_flock(db->cache.file, LOCK_EX) < 0)
-      goto close_files;
+      if (mesa_db_flock(db->cache.file, LOCK_EX) < 0)
+         goto close_files;
 
-   if (mesa_db_flock(db->index.file, LOCK_EX) < 0)
-      goto unlock_cache;
+      if (!mesa_db_file_replaced(&db->cache))
+         break;
+
+      mesa_db_close_file(&db->cache);
+   }
+
+   if (!mesa_db_reopen_file(&db->index))
+      goto close_files;
 
    return true;
 
-unlock_cache:
-   mesa_db_flock(db->cache.file, LOCK_UN);
 close_files:
    mesa_db_close_file(&db->index);
    mesa_db_close_file(&db->cache);
-
+fail:
    simple_mtx_unlock(&db->flock_mtx);
 
    return false;
@@ -139,7 +166,6 @@ close_files:
 static void
 mesa_db_unlock(struct mesa_cache_db *db)
 {
-   mesa_db_flock(db->index.file, LOCK_UN);
    mesa_db_flock(db->cache.file, LOCK_UN);
 
    mesa_db_close_file(&db->index);
@@ -148,6 +174,40 @@ mesa_db_unlock(struct mesa_cache_db *db)
    simple_mtx_unlock(&db->flock_mtx);
 }
 
+/* Readers don't lock the DB, they never wait for writers of other
+ * processes. This works because a cache entry is never modified once
+ * its index entry is visible, and because compaction publishes new files
+ * instead of rewriting the old ones in place. A reader thus sees either
+ * the old or the new DB; a cache and index file of different generations
+ * don't pass the UUID check. Whatever else a reader may run into is
+ * caught by the key and CRC checks and treated as a cache miss.
+ */
+static bool
+mesa_db_begin_read(struct mesa_cache_db *db)
+{
+   simple_mtx_lock(&db->flock_mtx);
+
+   if (mesa_db_reopen_file(&db->cache) &&
+       mesa_db_reopen_file(&db->index))
+      return true;
+
+   mesa_db_close_file(&db->index);
+   mesa_db_close_file(&db->cache);
+
+   simple_mtx_unlock(&db->flock_mtx);
+
+   return false;
+}
+
+static void
+mesa_db_end_read(struct mesa_cache_db *db)
+{
+   mesa_db_close_file(&db->index);
+   mesa_db_close_file(&db->cache);
+
+   simple_mtx_unlock(&db->flock_mtx);
+}
+
 static uint64_t to_mesa_cache_db_hash(const uint8_t *cache_key_160bit)
 {
    uint64_t hash = 0;
@@ -212,26 +272,25 @@ static bool mesa_db_uuid_changed(struct mesa_cache_db *db)
 }
 
 static bool
-mesa_db_write_header(struct mesa_cache_db_file *db_file,
-                     uint64_t uuid, bool reset)
+mesa_db_write_header(FILE *file, uint64_t uuid, bool reset)
 {
    struct mesa_db_file_header header;
 
-   rewind(db_file->file);
+   rewind(file);
 
    sprintf(header.magic, "MESA_DB");
    header.version = MESA_CACHE_DB_VERSION;
    header.uuid = uuid;
 
-   if (!mesa_db_write(db_file->file, &header))
+   if (!mesa_db_write(file, &header))
       return false;
 
    if (reset) {
-      if (!mesa_db_truncate(db_file->file, ftell(db_file->file)))
+      if (!mesa_db_truncate(file, ftell(file)))
          return false;
    }
 
-   fflush(db_file->file);
+   fflush(file);
 
    return true;
 }
@@ -244,6 +303,9 @@ mesa_db_write_header(struct mesa_cache_db_file *db_file,
  * reliably. Normally cache shall never get corrupted and losing cache
  * entries is acceptable, hence it's more practical to repair DB using
  * the simplest method.
+ *
+ * Only writers zap the DB. Readers don't hold the lock and can't tell a
+ * corrupted DB from a concurrent update, so for them an error is a miss.
  */
 static bool
 mesa_db_zap(struct mesa_cache_db *db)
@@ -346,8 +408,8 @@ mesa_db_recreate_files(struct mesa_cache_db *db)
 {
    db->uuid = mesa_db_generate_uuid();
 
-   if (!mesa_db_write_header(&db->cache, db->uuid, true) ||
-       !mesa_db_write_header(&db->index, db->uuid, true))
+   if (!mesa_db_write_header(db->cache.file, db->uuid, true) ||
+       !mesa_db_write_header(db->index.file, db->uuid, true))
          return false;
 
    return true;
@@ -412,6 +474,57 @@ mesa_db_reload(struct mesa_cache_db *db)
    return mesa_db_load(db, true);
 }
 
+/* Bring the in-memory index up to date without holding the lock. The index
+ * is loaded from scratch if the DB was replaced or if reload is requested,
+ * otherwise only the entries appended since the last update are read.
+ * Returns false if the files don't form a valid DB at the moment.
+ */
+static bool
+mesa_db_sync_index(struct mesa_cache_db *db, bool reload)
+{
+   struct mesa_db_file_header cache_header;
+   struct mesa_db_file_header index_header;
+
+   if (!mesa_db_read_header(db->cache.file, &cache_header) ||
+       !mesa_db_read_header(db->index.file, &index_header) ||
+       cache_header.uuid != index_header.uuid)
+      return false;
+
+   if (reload || cache_header.uuid != db->uuid) {
+      mesa_db_hash_table_reset(db);
+      db->uuid = cache_header.uuid;
+      db->index.offset = sizeof(index_header);
+   }
+
+   /* A writer may be appending an index entry right now. Only complete
+    * entries are taken, the rest is picked up by the next update.
+    */
+   mesa_db_update_index(db);
+
+   return true;
+}
+
+/* Load the DB without taking the lock if it's already set up, which is
+ * the common case when many processes start up with a warm cache.
+ */
+static bool
+mesa_db_load_unlocked(struct mesa_cache_db *db)
+{
+   bool loaded;
+
+   if (!mesa_db_begin_read(db))
+      return false;
+
+   loaded = mesa_db_sync_index(db, true);
+
+   mesa_db_end_read(db);
+
+   if (loaded)
+      db->alive = true;
+
+   return loaded;
+}
+
 static FILE *
 mesa_db_fopen(const char *path)
 {
@@ -525,18 +638,26 @@ static uint32_t blob_file_size(uint32_t blob_size)
    return sizeof(struct mesa_cache_db_file_entry) + blob_size;
 }
 
+/* Compaction writes the remaining entries to new files under a new UUID
+ * and renames them over the old files, the index file first. Readers that
+ * opened the old files keep reading them undisturbed, and a failed
+ * compaction leaves the old DB intact. The new cache file is locked before
+ * it's published, so that writers opening it wait for the compaction to
+ * complete.
+ */
 static bool
 mesa_db_compact(struct mesa_cache_db *db, int64_t blob_size,
                 struct mesa_index_db_hash_entry *remove_entry)
 {
    uint32_t num_entries, buffer_size = sizeof(struct mesa_index_db_file_entry);
-   struct mesa_db_file_header cache_header, index_header;
+   char *compacted_cache_path = NULL, *compacted_index_path = NULL;
    FILE *compacted_cache = NULL, *compacted_index = NULL;
    struct mesa_index_db_file_entry index_entry;
    struct mesa_index_db_hash_entry **entries;
-   bool success = false, compact = false;
+   bool success = false;
    void *buffer = NULL;
    unsigned int i = 0;
+   uint64_t uuid;
 
    /* reload index to sync the last access times */
    if (!remove_entry && !mesa_db_reload(db))
@@ -550,19 +671,6 @@ mesa_db_compact(struct mesa_cache_db *db, int64_t blob_size,
    if (!entries)
       return false;
 
-   compacted_cache = mesa_db_fopen(db->cache.path);
-   compacted_index = mesa_db_fopen(db->index.path);
-   if (!compacted_cache || !compacted_index)
-      goto cleanup;
-
-   /* The database file has been replaced if UUID changed. We opened
-    * some other cache, stop processing this database. */
-   if (!mesa_db_read_header(compacted_cache, &cache_header) ||
-       !mesa_db_read_header(compacted_index, &index_header) ||
-       cache_header.uuid != db->uuid ||
-       index_header.uuid != db->uuid)
-      goto cleanup;
-
    hash_table_foreach(db->index_db->table, entry) {
       entries[i] = entry->data;
       entries[i]->evicted = (entries[i] == remove_entry);
@@ -589,15 +697,33 @@ mesa_db_compact(struct mesa_cache_db *db, int64_t blob_size,
    if (!buffer)
       goto cleanup;
 
-   /* Mark cache file invalid by writing zero-UUID header. If compaction will
-    * fail, then the file will remain to be invalid since we can't repair it. */
-   if (!mesa_db_write_header(&db->cache, 0, false) ||
-       !mesa_db_write_header(&db->index, 0, false))
+   if (asprintf(&compacted_cache_path, "%s.tmp", db->cache.path) == -1) {
+      compacted_cache_path = NULL;
+      goto cleanup;
+   }
+
+   if (asprintf(&compacted_index_path, "%s.tmp", db->index.path) == -1) {
+      compacted_index_path = NULL;
+      goto cleanup;
+   }
+
+   compacted_cache = mesa_db_fopen(compacted_cache_path);
+   compacted_index = mesa_db_fopen(compacted_index_path);
+   if (!compacted_cache || !compacted_index)
+      goto cleanup;
+
+   if (mesa_db_flock(compacted_cache, LOCK_EX) < 0)
       goto cleanup;
 
-   /* Sync the file pointers */
-   if (!mesa_db_seek(compacted_cache, ftell(db->cache.file)) ||
-       !mesa_db_seek(compacted_index, ftell(db->index.file)))
+   uuid = mesa_db_generate_uuid();
+
+   /* Resetting the files drops whatever a failed compaction left behind */
+   if (!mesa_db_write_header(compacted_cache, uuid, true) ||
+       !mesa_db_write_header(compacted_index, uuid, true))
+      goto cleanup;
+
+   if (!mesa_db_seek(db->cache.file, sizeof(struct mesa_db_file_header)) ||
+       !mesa_db_seek(db->index.file, sizeof(struct mesa_db_file_header)))
       goto cleanup;
 
    /* Do the compaction */
@@ -614,65 +740,63 @@ mesa_db_compact(struct mesa_cache_db *db, int64_t blob_size,
              !mesa_db_seek_cur(db->index.file, sizeof(index_entry)))
             goto cleanup;
 
-         compact = true;
          continue;
       }
 
-      if (compact) {
-         /* Compact the cache file */
-         if (!mesa_db_read_data(db->cache.file,   buffer, blob_size) ||
-             !mesa_db_cache_entry_valid(buffer) ||
-             !mesa_db_write_data(compacted_cache, buffer, blob_size))
-            goto cleanup;
+      /* Copy the cache entry */
+      if (!mesa_db_read_data(db->cache.file, buffer, blob_size) ||
+          !mesa_db_cache_entry_valid(buffer) ||
+          !mesa_db_write_data(compacted_cache, buffer, blob_size))
+         goto cleanup;
 
-         /* Compact the index file */
-         if (!mesa_db_read(db->index.file, &index_entry) ||
-             !mesa_db_index_entry_valid(&index_entry) ||
-             index_entry.cache_db_file_offset != entries[i]->cache_db_file_offset ||
-             index_entry.size != entries[i]->size)
-            goto cleanup;
+      /* Copy the index entry */
+      if (!mesa_db_read(db->index.file, &index_entry) ||
+          !mesa_db_index_entry_valid(&index_entry) ||
+          index_entry.cache_db_file_offset != entries[i]->cache_db_file_offset ||
+          index_entry.size != entries[i]->size)
+         goto cleanup;
 
-         index_entry.cache_db_file_offset = ftell(compacted_cache) - blob_size;
+      index_entry.cache_db_file_offset = ftell(compacted_cache) - blob_size;
 
-         if (!mesa_db_write(compacted_index, &index_entry))
-            goto cleanup;
-      } else {
-         /* Sanity-check the cache-write offset */
-         if (ftell(compacted_cache) != entries[i]->cache_db_file_offset)
-            goto cleanup;
-
-         /* Jump over the unchanged entry */
-         if (!mesa_db_seek_cur(db->index.file,  sizeof(index_entry)) ||
-             !mesa_db_seek_cur(compacted_index, sizeof(index_entry)) ||
-             !mesa_db_seek_cur(db->cache.file,  blob_size) ||
-             !mesa_db_seek_cur(compacted_cache, blob_size))
-            goto cleanup;
-      }
+      if (!mesa_db_write(compacted_index, &index_entry))
+         goto cleanup;
    }
 
    fflush(compacted_cache);
    fflush(compacted_index);
 
-   /* Cut off the the freed space left after compaction */
-   if (!mesa_db_truncate(db->cache.file, ftell(compacted_cache)) ||
-       !mesa_db_truncate(db->index.file, ftell(compacted_index)))
+   /* Publish the compacted DB. A reader that opens the files in between
+    * the renames gets a UUID mismatch, which is a cache miss for it.
+    */
+   if (rename(compacted_index_path, db->index.path) < 0 ||
+       rename(compacted_cache_path, db->cache.path) < 0)
       goto cleanup;
 
-   /* Set the new UUID to let all cache readers know that the cache was changed */
-   db->uuid = mesa_db_generate_uuid();
+   /* Switch over to the new files, this releases the lock of the retired
+    * cache file while the lock of the new one is kept.
+    */
+   mesa_db_close_file(&db->cache);
+   mesa_db_close_file(&db->index);
 
-   if (!mesa_db_write_header(&db->cache, db->uuid, false) ||
-       !mesa_db_write_header(&db->index, db->uuid, false))
-      goto cleanup;
+   db->cache.file = compacted_cache;
+   db->index.file = compacted_index;
+   compacted_cache = NULL;
+   compacted_index = NULL;
 
    success = true;
 
 cleanup:
-   free(buffer);
    if (compacted_index)
       fclose(compacted_index);
    if (compacted_cache)
       fclose(compacted_cache);
+   if (!success && compacted_cache_path && compacted_index_path) {
+      unlink(compacted_cache_path);
+      unlink(compacted_index_path);
+   }
+   free(compacted_index_path);
+   free(compacted_cache_path);
+   free(buffer);
    free(entries);
 
    /* reload compacted index */
@@ -701,7 +825,7 @@ mesa_cache_db_open(struct mesa_cache_db *db, const char *cache_path)
    if (!db->index_db)
       goto destroy_mtx;
 
-   if (!mesa_db_load(db, false))
+   if (!mesa_db_load_unlocked(db) && !mesa_db_load(db, false))
       goto destroy_hash;
 
    return true;
@@ -760,79 +884,208 @@ mesa_cache_db_file_entry_size(void)
    return sizeof(struct mesa_cache_db_file_entry);
 }
 
+/* Unlike reading, bumping access times writes to the index, which older
+ * Mesa versions rewrite in place while holding the exclusive lock. So a
+ * reader updates the times under a shared lock of the cache file, if it
+ * can get it right away and the files it read are still the current
+ * generation. Otherwise the update is skipped, the times are only a hint
+ * for eviction.
+ */
+static bool
+mesa_db_begin_access_time_update(struct mesa_cache_db *db)
+{
+   struct mesa_db_file_header header;
+
+   if (mesa_db_flock(db->cache.file, LOCK_SH | LOCK_NB) < 0)
+      return false;
+
+   if (!mesa_db_file_replaced(&db->cache) &&
+       mesa_db_read_header(db->cache.file, &header) &&
+       header.uuid == db->uuid)
+      return true;
+
+   mesa_db_flock(db->cache.file, LOCK_UN);
+   return false;
+}
+
+static void
+mesa_db_end_access_time_update(struct mesa_cache_db *db)
+{
+   fflush(db->index.file);
+   mesa_db_flock(db->cache.file, LOCK_UN);
+}
+
+/* Read the blob of an index entry. This doesn't need the lock: the key
+ * and CRC checks reject anything that isn't the requested entry. *data is
+ * left NULL on a miss.
+ */
+static void
+mesa_db_read_entry_data(struct mesa_cache_db *db,
+                        const uint8_t *cache_key_160bit,
+                        struct mesa_index_db_hash_entry *hash_entry,
+                        void **data, size_t *size)
+{
+   struct mesa_cache_db_file_entry cache_entry;
+
+   *data = NULL;
+
+   if (!mesa_db_seek(db->cache.file, hash_entry->cache_db_file_offset) ||
+       !mesa_db_read(db->cache.file, &cache_entry) ||
+       !mesa_db_cache_entry_valid(&cache_entry) ||
+       cache_entry.size != hash_entry->size)
+      return;
+
+   if (memcmp(cache_entry.key, cache_key_160bit, sizeof(cache_entry.key)))
+      return;
+
+   void *blob = malloc(cache_entry.size);
+   if (!blob)
+      return;
+
+   if (!mesa_db_read_data(db->cache.file, blob, cache_entry.size) ||
+       util_hash_crc32(blob, cache_entry.size) != cache_entry.crc) {
+      free(blob);
+      return;
+   }
+
+   *data = blob;
+   *size = cache_entry.size;
+}
+
+/* Called between mesa_db_begin/end_access_time_update(). */
+static void
+mesa_db_update_access_time(struct mesa_cache_db *db,
+                           const uint8_t *cache_key_160bit,
+                           struct mesa_index_db_hash_entry *hash_entry)
+{
+   const long access_time_offset =
+      offsetof(struct mesa_index_db_file_entry, last_access_time);
+   struct mesa_index_db_file_entry index_entry;
+
+   if (mesa_db_seek(db->index.file, hash_entry->index_db_file_offset) &&
+       mesa_db_read(db->index.file, &index_entry) &&
+       index_entry.hash == to_mesa_cache_db_hash(cache_key_160bit) &&
+       index_entry.cache_db_file_offset == hash_entry->cache_db_file_offset) {
+      index_entry.last_access_time = os_time_get_nano();
+      hash_entry->last_access_time = index_entry.last_access_time;
+
+      if (mesa_db_seek(db->index.file, hash_entry->index_db_file_offset +
+                                       access_time_offset))
+         mesa_db_write(db->index.file, &index_entry.last_access_time);
+   }
+}
+
 void *
 mesa_cache_db_read_entry(struct mesa_cache_db *db,
                          const uint8_t *cache_key_160bit,
                          size_t *size)
 {
    uint64_t hash = to_mesa_cache_db_hash(cache_key_160bit);
-   struct mesa_cache_db_file_entry cache_entry;
-   struct mesa_index_db_file_entry index_entry;
    struct mesa_index_db_hash_entry *hash_entry;
    void *data = NULL;
 
-   if (!mesa_db_lock(db))
+   if (!mesa_db_begin_read(db))
       return NULL;
 
-   if (!db->alive)
-      goto fail;
+   if (!db->alive || !mesa_db_sync_index(db, false))
+      goto out;
 
-   if (mesa_db_uuid_changed(db) && !mesa_db_reload(db))
-      goto fail_fatal;
+   hash_entry = _mesa_hash_table_u64_search(db->index_db, hash);
+   if (hash_entry)
+      mesa_db_read_entry_data(db, cache_key_160bit, hash_entry, &data, size);
 
-   if (!mesa_db_update_index(db))
-      goto fail_fatal;
+   if (data && mesa_db_begin_access_time_update(db)) {
+      mesa_db_update_access_time(db, cache_key_160bit, hash_entry);
+      mesa_db_end_access_time_update(db);
+   }
 
-   hash_entry = _mesa_hash_table_u64_search(db->index_db, hash);
-   if (!hash_entry)
-      goto fail;
+out:
+   mesa_db_end_read(db);
 
-   if (!mesa_db_seek(db->cache.file, hash_entry->cache_db_file_offset) ||
-       !mesa_db_read(db->cache.file, &cache_entry) ||
-       !mesa_db_cache_entry_valid(&cache_entry))
-      goto fail_fatal;
+   return data;
+}
 
-   if (memcmp(cache_entry.key, cache_key_160bit, sizeof(cache_entry.key)))
-      goto fail;
+struct mesa_db_read_request {
+   struct mesa_index_db_hash_entry *hash_entry;
+   unsigned idx;
+};
 
-   data = malloc(cache_entry.size);
-   if (!data)
-      goto fail;
+static int
+read_request_sort_offset(const void *_a, const void *_b)
+{
+   const struct mesa_db_read_request *a = _a;
+   const struct mesa_db_read_request *b = _b;
 
-   if (!mesa_db_read_data(db->cache.file, data, cache_entry.size) ||
-       util_hash_crc32(data, cache_entry.size) != cache_entry.crc)
-      goto fail_fatal;
+   if (a->hash_entry->cache_db_file_offset ==
+       b->hash_entry->cache_db_file_offset)
+      return 0;
 
-   if (!mesa_db_seek(db->index.file, hash_entry->index_db_file_offset) ||
-       !mesa_db_read(db->index.file, &index_entry) ||
-       !mesa_db_index_entry_valid(&index_entry) ||
-       index_entry.cache_db_file_offset != hash_entry->cache_db_file_offset ||
-       index_entry.size != hash_entry->size)
-      goto fail_fatal;
+   return a->hash_entry->cache_db_file_offset >
+          b->hash_entry->cache_db_file_offset ? 1 : -1;
+}
 
-   index_entry.last_access_time = os_time_get_nano();
-   hash_entry->last_access_time = index_entry.last_access_time;
+/* Read several entries with a single index update. The blobs are read in
+ * file order and the access time updates are flushed once at the end.
+ * Only entries whose data[] slot is NULL are looked up, so the same arrays
+ * can be passed to several DBs in turn.
+ */
+void
+mesa_cache_db_read_entries(struct mesa_cache_db *db, unsigned num_entries,
+                           const uint8_t *const *cache_keys_160bit,
+                           void **data, size_t *sizes)
+{
+   struct mesa_db_read_request *requests;
+   unsigned num_requests = 0;
 
-   if (!mesa_db_seek(db->index.file, hash_entry->index_db_file_offset) ||
-       !mesa_db_write(db->index.file, &index_entry))
-      goto fail_fatal;
+   requests = malloc(num_entries * sizeof(*requests));
+   if (!requests)
+      return;
 
-   fflush(db->index.file);
+   if (!mesa_db_begin_read(db))
+      goto out;
 
-   mesa_db_unlock(db);
+   if (!db->alive || !mesa_db_sync_index(db, false))
+      goto end_read;
 
-   *size = cache_entry.size;
+   for (unsigned i = 0; i < num_entries; i++) {
+      if (data[i])
+         continue;
 
-   return data;
+      uint64_t hash = to_mesa_cache_db_hash(cache_keys_160bit[i]);
+      struct mesa_index_db_hash_entry *hash_entry =
+         _mesa_hash_table_u64_search(db->index_db, hash);
 
-fail_fatal:
-   mesa_db_zap(db);
-fail:
-   free(data);
+      if (hash_entry) {
+         requests[num_requests].hash_entry = hash_entry;
+         requests[num_requests].idx = i;
+         num_requests++;
+      }
+   }
 
-   mesa_db_unlock(db);
+   qsort(requests, num_requests, sizeof(*requests), read_request_sort_offset);
+
+   for (unsigned r = 0; r < num_requests; r++) {
+      const unsigned i = requests[r].idx;
+
+      mesa_db_read_entry_data(db, cache_keys_160bit[i],
+                              requests[r].hash_entry, &data[i], &sizes[i]);
+   }
+
+   if (num_requests && mesa_db_begin_access_time_update(db)) {
+      for (unsigned r = 0; r < num_requests; r++) {
+         const unsigned i = requests[r].idx;
+
+         if (data[i])
+            mesa_db_update_access_time(db, cache_keys_160bit[i],
+                                       requests[r].hash_entry);
+      }
+      mesa_db_end_access_time_update(db);
+   }
 
-   return NULL;
+end_read:
+   mesa_db_end_read(db);
+out:
+   free(requests);
 }
 
 static bool
@@ -908,11 +1161,15 @@ mesa_cache_db_entry_write(struct mesa_cache_db *db,
    hash_entry->size = index_entry.size;
 
    if (!mesa_db_write(db->cache.file, &cache_entry) ||
-       !mesa_db_write_data(db->cache.file, blob, blob_size) ||
-       !mesa_db_write(db->index.file, &index_entry))
+       !mesa_db_write_data(db->cache.file, blob, blob_size))
       goto fail_fatal;
 
+   /* The cache entry must be complete before readers can find it */
    fflush(db->cache.file);
+
+   if (!mesa_db_write(db->index.file, &index_entry))
+      goto fail_fatal;
+
    fflush(db->index.file);
 
    db->index.offset = ftell(db->index.file);
@@ -981,28 +1238,23 @@ fail:
    return false;
 }
 
+/* This is only a hint for picking the DB part to write to, the writer
+ * checks the space again with the DB locked.
+ */
 bool
 mesa_cache_db_has_space(struct mesa_cache_db *db, size_t blob_size)
 {
-   bool has_space;
+   bool has_space = false;
 
-   if (!mesa_db_lock(db))
+   if (!mesa_db_begin_read(db))
       return false;
 
-   if (!mesa_db_seek_end(db->cache.file))
-      goto fail_fatal;
-
-   has_space = mesa_cache_db_has_space_locked(db, blob_size);
+   if (mesa_db_seek_end(db->cache.file))
+      has_space = mesa_cache_db_has_space_locked(db, blob_size);
 
-   mesa_db_unlock(db);
+   mesa_db_end_read(db);
 
    return has_space;
-
-fail_fatal:
-   mesa_db_zap(db);
-   mesa_db_unlock(db);
-
-   return false;
 }
 
 static uint64_t
@@ -1028,19 +1280,17 @@ mesa_cache_db_eviction_score(struct mesa_cache_db *db)
    unsigned num_entries, i = 0;
    double eviction_score = 0;
 
-   if (!mesa_db_lock(db))
+   if (!mesa_db_begin_read(db))
       return 0;
 
-   if (!db->alive)
-      goto fail;
-
-   if (!mesa_db_reload(db))
-      goto fail_fatal;
+   /* Reload the index to get the last access times of other processes */
+   if (!db->alive || !mesa_db_sync_index(db, true))
+      goto out;
 
    num_entries = _mesa_hash_table_num_entries(db->index_db->table);
    entries = calloc(num_entries, sizeof(*entries));
    if (!entries)
-      goto fail;
+      goto out;
 
    hash_table_foreach(db->index_db->table, entry)
       entries[i++] = entry->data;
@@ -1065,16 +1315,10 @@ mesa_cache_db_eviction_score(struct mesa_cache_db *db)
 
    free(entries);
 
-   mesa_db_unlock(db);
+out:
+   mesa_db_end_read(db);
 
    return eviction_score;
-
-fail_fatal:
-   mesa_db_zap(db);
-fail:
-   mesa_db_unlock(db);
-
-   return 0;
 }
 
 #endif /* DETECT_OS_WINDOWS */
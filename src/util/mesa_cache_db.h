@@ -58,6 +58,11 @@ mesa_cache_db_read_entry(struct mesa_cache_db *db,
                          const uint8_t *cache_key_160bit,
                          size_t *size);
 
+void
+mesa_cache_db_read_entries(struct mesa_cache_db *db, unsigned num_entries,
+                           const uint8_t *const *cache_keys_160bit,
+                           void **data, size_t *sizes);
+
 bool
 mesa_cache_db_entry_write(struct mesa_cache_db *db,
                           const uint8_t *cache_key_160bit,
@@ -107,6 +112,13 @@ mesa_cache_db_read_entry(struct mesa_cache_db *db,
    return NULL;
 }
 
+static inline void
+mesa_cache_db_read_entries(struct mesa_cache_db *db, unsigned num_entries,
+                           const uint8_t *const *cache_keys_160bit,
+                           void **data, size_t *sizes)
+{
+}
+
 static inline bool
 mesa_cache_db_entry_write(struct mesa_cache_db *db,
                           const uint8_t *cache_key_160bit,
@@ -148,6 +148,38 @@ mesa_cache_db_multipart_read_entry(struct mesa_cache_db_multipart *db,
    return NULL;
 }
 
+void
+mesa_cache_db_multipart_read_entries(struct mesa_cache_db_multipart *db,
+                                     unsigned num_entries,
+                                     const uint8_t *const *cache_keys_160bit,
+                                     void **data, size_t *sizes)
+{
+   unsigned last_read_part = db->last_read_part;
+   unsigned num_found = 0;
+
+   for (unsigned e = 0; e < num_entries; e++)
+      num_found += data[e] != NULL;
+
+   for (unsigned int i = 0; i < db->num_parts && num_found < num_entries; i++) {
+      unsigned int part = (last_read_part + i) % db->num_parts;
+
+      if (!mesa_cache_db_multipart_init_part(db, part))
+         break;
+
+      mesa_cache_db_read_entries(db->parts[part], num_entries,
+                                 cache_keys_160bit, data, sizes);
+
+      unsigned found = 0;
+      for (unsigned e = 0; e < num_entries; e++)
+         found += data[e] != NULL;
+
+      /* Likely that the next lookup will hit the same DB part. */
+      if (found > num_found)
+         db->last_read_part = part;
+      num_found = found;
+   }
+}
+
 static unsigned
 mesa_cache_db_multipart_select_victim_part(struct mesa_cache_db_multipart *db)
 {
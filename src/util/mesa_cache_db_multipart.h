@@ -36,6 +36,12 @@ mesa_cache_db_multipart_read_entry(struct mesa_cache_db_multipart *db,
                                    const uint8_t *cache_key_160bit,
                                    size_t *size);
 
+void
+mesa_cache_db_multipart_read_entries(struct mesa_cache_db_multipart *db,
+                                     unsigned num_entries,
+                                     const uint8_t *const *cache_keys_160bit,
+                                     void **data, size_t *sizes);
+
 bool
 mesa_cache_db_multipart_entry_write(struct mesa_cache_db_multipart *db,
                                     const uint8_t *cache_key_160bit,
@@ -0,0 +1,860 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+/*
+ * Read-optimized single file cache.
+ *
+ * The pack file holds a key-sorted index followed by the entry payloads.
+ * It is never modified once written, so it is mapped read-only: a lookup
+ * is a binary search without locks, uncompressed entries are handed out
+ * as pointers into the mapping, and all processes using the cache share
+ * the pages through the page cache.
+ *
+ * Entries added or removed afterwards are appended to a journal next to
+ * the pack.  When the cache is opened with a journal that has grown to a
+ * fraction of the pack, the journal is merged into a new pack which
+ * atomically replaces the old one.  Other processes keep the old pack
+ * mapped until they exit.
+ */
+
+#include "detect_os.h"
+
+#if DETECT_OS_WINDOWS == 0
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "compress.h"
+#include "crc32.h"
+#include "disk_cache.h"
+#include "hash_table.h"
+#include "mesa_cache_pack.h"
+#include "os_time.h"
+#include "ralloc.h"
+#include "u_atomic.h"
+#include "u_math.h"
+
+#define MESA_CACHE_PACK_VERSION        1
+#define MESA_CACHE_PACK_MAGIC          "MESAPACK"
+#define MESA_CACHE_JOURNAL_MAGIC       "MESAJRNL"
+
+/* Payload alignment within the pack. */
+#define MESA_CACHE_PACK_ALIGNMENT      16
+
+/* The journal is merged once it is this fraction of the pack, so each
+ * merge rewrites a bounded multiple of what was added since the last one.
+ */
+#define MESA_CACHE_PACK_MERGE_RATIO    4
+
+#define MESA_CACHE_PACK_ENTRY_COMPRESSED (1 << 0)
+
+struct PACKED mesa_cache_pack_header {
+   char magic[8];
+   uint32_t version;
+   uint32_t num_entries;
+};
+
+struct PACKED mesa_cache_pack_entry {
+   cache_key key;
+   uint32_t flags;
+   uint32_t size;
+   uint32_t uncompressed_size;
+   uint64_t offset;
+};
+
+struct PACKED mesa_cache_journal_header {
+   char magic[8];
+   uint32_t version;
+   uint64_t uuid;
+};
+
+/* A record with a size of zero removes the entry. */
+struct PACKED mesa_cache_journal_record {
+   cache_key key;
+   uint32_t crc;
+   uint32_t size;
+};
+
+struct mesa_cache_journal_entry {
+   cache_key key;
+   uint64_t offset;
+   bool removed;
+};
+
+/* An entry of the pack being built. */
+struct mesa_cache_pack_build_entry {
+   const uint8_t *key;
+   const uint8_t *data;
+   void *compressed;
+   uint32_t seq;
+   uint32_t flags;
+   uint32_t size;
+   uint32_t uncompressed_size;
+};
+
+static int
+mesa_pack_flock(int fd, int op)
+{
+   int ret;
+
+   do {
+      ret = flock(fd, op);
+   } while (ret < 0 && errno == EINTR);
+
+   return ret;
+}
+
+static bool
+mesa_pack_pread(int fd, void *buf, size_t size, uint64_t offset)
+{
+   while (size) {
+      ssize_t ret = pread(fd, buf, size, offset);
+      if (ret <= 0) {
+         if (ret < 0 && errno == EINTR)
+            continue;
+         return false;
+      }
+      buf = (uint8_t *)buf + ret;
+      size -= ret;
+      offset += ret;
+   }
+
+   return true;
+}
+
+static bool
+mesa_pack_write(int fd, const void *buf, size_t size)
+{
+   while (size) {
+      ssize_t ret = write(fd, buf, size);
+      if (ret < 0) {
+         if (errno == EINTR)
+            continue;
+         return false;
+      }
+      buf = (const uint8_t *)buf + ret;
+      size -= ret;
+   }
+
+   return true;
+}
+
+/* The keys are SHA-1 hashes already. */
+static uint32_t
+mesa_journal_key_hash(const void *key)
+{
+   uint32_t hash;
+
+   memcpy(&hash, key, sizeof(hash));
+   return hash;
+}
+
+static bool
+mesa_journal_key_equal(const void *a, const void *b)
+{
+   return !memcmp(a, b, CACHE_KEY_SIZE);
+}
+
+static bool
+mesa_pack_map(struct mesa_cache_pack *pack, const char *path)
+{
+   const struct mesa_cache_pack_header *header;
+   struct stat sb;
+   void *map;
+
+   int fd = open(path, O_RDONLY | O_CLOEXEC);
+   if (fd == -1)
+      return errno == ENOENT;
+
+   if (fstat(fd, &sb) == -1 || sb.st_size < sizeof(*header)) {
+      close(fd);
+      return true;
+   }
+
+   map = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+   close(fd);
+   if (map == MAP_FAILED)
+      return false;
+
+   /* A broken pack is treated as empty, the next merge replaces it. */
+   header = map;
+   if (memcmp(header->magic, MESA_CACHE_PACK_MAGIC, sizeof(header->magic)) ||
+       header->version != MESA_CACHE_PACK_VERSION ||
+       header->num_entries > (sb.st_size - sizeof(*header)) /
+                             sizeof(struct mesa_cache_pack_entry)) {
+      munmap(map, sb.st_size);
+      return true;
+   }
+
+   pack->map = map;
+   pack->map_size = sb.st_size;
+   pack->index = (const struct mesa_cache_pack_entry *)(header + 1);
+   pack->num_entries = header->num_entries;
+
+   return true;
+}
+
+static void
+mesa_pack_unmap(struct mesa_cache_pack *pack)
+{
+   if (pack->map)
+      munmap((void *)pack->map, pack->map_size);
+
+   pack->map = NULL;
+   pack->map_size = 0;
+   pack->index = NULL;
+   pack->num_entries = 0;
+}
+
+static const struct mesa_cache_pack_entry *
+mesa_pack_find_entry(const struct mesa_cache_pack *pack,
+                     const uint8_t *cache_key_160bit)
+{
+   uint32_t lo = 0, hi = pack->num_entries;
+
+   while (lo < hi) {
+      uint32_t mid = lo + (hi - lo) / 2;
+      int cmp = memcmp(pack->index[mid].key, cache_key_160bit,
+                       CACHE_KEY_SIZE);
+
+      if (cmp == 0)
+         return &pack->index[mid];
+
+      if (cmp < 0)
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+
+   return NULL;
+}
+
+static bool
+mesa_pack_entry_valid(const struct mesa_cache_pack *pack,
+                      const struct mesa_cache_pack_entry *entry)
+{
+   return entry->size && entry->offset <= pack->map_size &&
+          entry->size <= pack->map_size - entry->offset;
+}
+
+static const void *
+mesa_pack_entry_data(const struct mesa_cache_pack *pack,
+                     const struct mesa_cache_pack_entry *entry,
+                     size_t *size, void **copy)
+{
+   if (!mesa_pack_entry_valid(pack, entry))
+      return NULL;
+
+   const uint8_t *data = pack->map + entry->offset;
+
+   if (!(entry->flags & MESA_CACHE_PACK_ENTRY_COMPRESSED)) {
+      *size = entry->size;
+      return data;
+   }
+
+#ifdef HAVE_COMPRESSION
+   uint8_t *uncompressed = malloc(entry->uncompressed_size);
+   if (!uncompressed)
+      return NULL;
+
+   if (!util_compress_inflate(data, entry->size, uncompressed,
+                              entry->uncompressed_size)) {
+      free(uncompressed);
+      return NULL;
+   }
+
+   *copy = uncompressed;
+   *size = entry->uncompressed_size;
+   return uncompressed;
+#else
+   return NULL;
+#endif
+}
+
+static uint64_t
+mesa_pack_generate_uuid(void)
+{
+   return os_time_get_nano() ^ ((uint64_t)getpid() << 32);
+}
+
+static bool
+mesa_journal_read_header(int fd, struct mesa_cache_journal_header *header)
+{
+   return mesa_pack_pread(fd, header, sizeof(*header), 0) &&
+          !memcmp(header->magic, MESA_CACHE_JOURNAL_MAGIC,
+                  sizeof(header->magic)) &&
+          header->version == MESA_CACHE_PACK_VERSION;
+}
+
+/* Start a new journal, the caller holds the exclusive lock. */
+static bool
+mesa_journal_reset(struct mesa_cache_pack *pack)
+{
+   struct mesa_cache_journal_header header;
+
+   if (ftruncate(pack->journal_fd, 0))
+      return false;
+
+   memcpy(header.magic, MESA_CACHE_JOURNAL_MAGIC, sizeof(header.magic));
+   header.version = MESA_CACHE_PACK_VERSION;
+   header.uuid = mesa_pack_generate_uuid();
+
+   return mesa_pack_write(pack->journal_fd, &header, sizeof(header));
+}
+
+/* Index the records appended since the last call, by any process.  The
+ * caller holds journal_mtx.
+ */
+static void
+mesa_journal_update_index(struct mesa_cache_pack *pack)
+{
+   struct mesa_cache_journal_header header;
+   struct stat sb;
+
+   if (fstat(pack->journal_fd, &sb) == -1 ||
+       !mesa_journal_read_header(pack->journal_fd, &header))
+      return;
+
+   /* Another process merged the journal into a new pack.  Entries indexed
+    * so far are checked against their record when read, and removals stay
+    * in effect for the pack mapped by this process.
+    */
+   if (header.uuid != pack->journal_uuid) {
+      pack->journal_uuid = header.uuid;
+      pack->journal_offset = sizeof(header);
+   }
+
+   if (sb.st_size <= pack->journal_offset)
+      return;
+
+   size_t length = sb.st_size - pack->journal_offset;
+   uint8_t *records = malloc(length);
+   if (!records)
+      return;
+
+   if (!mesa_pack_pread(pack->journal_fd, records, length,
+                        pack->journal_offset)) {
+      free(records);
+      return;
+   }
+
+   size_t pos = 0;
+   while (pos + sizeof(struct mesa_cache_journal_record) <= length) {
+      struct mesa_cache_journal_record record;
+      memcpy(&record, records + pos, sizeof(record));
+
+      /* Stop at a record that is still being appended. */
+      if (record.size > length - pos - sizeof(record))
+         break;
+
+      struct mesa_cache_journal_entry *entry;
+      struct hash_entry *he =
+         _mesa_hash_table_search(pack->journal_index, record.key);
+      if (he) {
+         entry = he->data;
+      } else {
+         entry = ralloc(pack->mem_ctx, struct mesa_cache_journal_entry);
+         if (!entry)
+            break;
+         memcpy(entry->key, record.key, CACHE_KEY_SIZE);
+         _mesa_hash_table_insert(pack->journal_index, entry->key, entry);
+      }
+
+      entry->offset = pack->journal_offset + pos;
+      entry->removed = !record.size;
+      if (entry->removed)
+         p_atomic_inc(&pack->num_removed);
+
+      pos += sizeof(record) + record.size;
+   }
+
+   pack->journal_offset += pos;
+   free(records);
+}
+
+static void *
+mesa_journal_read_record(struct mesa_cache_pack *pack,
+                         const struct mesa_cache_journal_entry *entry,
+                         const uint8_t *cache_key_160bit, size_t *size)
+{
+   struct mesa_cache_journal_record record;
+
+   if (!mesa_pack_pread(pack->journal_fd, &record, sizeof(record),
+                        entry->offset) ||
+       memcmp(record.key, cache_key_160bit, CACHE_KEY_SIZE) || !record.size)
+      return NULL;
+
+   void *data = malloc(record.size);
+   if (!data)
+      return NULL;
+
+   if (!mesa_pack_pread(pack->journal_fd, data, record.size,
+                        entry->offset + sizeof(record)) ||
+       util_hash_crc32(data, record.size) != record.crc) {
+      free(data);
+      return NULL;
+   }
+
+   *size = record.size;
+   return data;
+}
+
+static bool
+mesa_journal_append(struct mesa_cache_pack *pack,
+                    const uint8_t *cache_key_160bit,
+                    const void *blob, size_t blob_size)
+{
+   struct mesa_cache_journal_record *record;
+   struct stat sb;
+   bool ret = false;
+
+   if (pack->journal_fd == -1 || blob_size > UINT32_MAX)
+      return false;
+
+   record = malloc(sizeof(*record) + blob_size);
+   if (!record)
+      return false;
+
+   memcpy(record->key, cache_key_160bit, CACHE_KEY_SIZE);
+   record->crc = blob_size ? util_hash_crc32(blob, blob_size) : 0;
+   record->size = blob_size;
+   if (blob_size)
+      memcpy(record + 1, blob, blob_size);
+
+   /* Appends of several processes can interleave, they only have to be
+    * kept apart from a merge.
+    */
+   if (mesa_pack_flock(pack->journal_fd, LOCK_SH) < 0)
+      goto out;
+
+   if (!fstat(pack->journal_fd, &sb) &&
+       sb.st_size + sizeof(*record) + blob_size <= pack->max_size)
+      ret = mesa_pack_write(pack->journal_fd, record,
+                            sizeof(*record) + blob_size);
+
+   mesa_pack_flock(pack->journal_fd, LOCK_UN);
+
+out:
+   free(record);
+   return ret;
+}
+
+static int
+mesa_pack_build_entry_compare(const void *a, const void *b)
+{
+   const struct mesa_cache_pack_build_entry *entry_a = a;
+   const struct mesa_cache_pack_build_entry *entry_b = b;
+   int cmp = memcmp(entry_a->key, entry_b->key, CACHE_KEY_SIZE);
+
+   if (cmp)
+      return cmp;
+
+   return entry_a->seq < entry_b->seq ? -1 : entry_a->seq > entry_b->seq;
+}
+
+/* Collect the journal records, the last record of each key wins. */
+static struct mesa_cache_pack_build_entry *
+mesa_pack_collect_journal(const uint8_t *records, size_t length,
+                          unsigned *num_entries)
+{
+   struct mesa_cache_pack_build_entry *entries;
+   unsigned count = 0, max_entries = 0;
+   size_t pos = 0;
+
+   while (pos + sizeof(struct mesa_cache_journal_record) <= length) {
+      struct mesa_cache_journal_record record;
+      memcpy(&record, records + pos, sizeof(record));
+      if (record.size > length - pos - sizeof(record))
+         break;
+      pos += sizeof(record) + record.size;
+      max_entries++;
+   }
+
+   entries = malloc(MAX2(max_entries, 1) * sizeof(*entries));
+   if (!entries)
+      return NULL;
+
+   pos = 0;
+   for (unsigned i = 0; i < max_entries; i++) {
+      const uint8_t *start = records + pos;
+      const uint8_t *data = start + sizeof(struct mesa_cache_journal_record);
+      struct mesa_cache_journal_record record;
+      memcpy(&record, start, sizeof(record));
+      pos += sizeof(record) + record.size;
+
+      /* Drop corrupted records. */
+      if (record.size && util_hash_crc32(data, record.size) != record.crc)
+         continue;
+
+      entries[count++] = (struct mesa_cache_pack_build_entry) {
+         .key = start + offsetof(struct mesa_cache_journal_record, key),
+         .data = data,
+         .seq = i,
+         .size = record.size,
+         .uncompressed_size = record.size,
+      };
+   }
+
+   qsort(entries, count, sizeof(*entries), mesa_pack_build_entry_compare);
+
+   unsigned num_unique = 0;
+   for (unsigned i = 0; i < count; i++) {
+      if (i + 1 < count &&
+          !memcmp(entries[i].key, entries[i + 1].key, CACHE_KEY_SIZE))
+         continue;
+      entries[num_unique++] = entries[i];
+   }
+
+   *num_entries = num_unique;
+   return entries;
+}
+
+static void
+mesa_pack_compress_entry(struct mesa_cache_pack_build_entry *entry)
+{
+#ifdef HAVE_COMPRESSION
+   size_t max_size = util_compress_max_compressed_len(entry->size);
+   uint8_t *compressed = malloc(max_size);
+   if (!compressed)
+      return;
+
+   size_t size = util_compress_deflate(entry->data, entry->size,
+                                       compressed, max_size);
+   if (!size || size >= entry->size) {
+      free(compressed);
+      return;
+   }
+
+   entry->compressed = compressed;
+   entry->data = compressed;
+   entry->flags |= MESA_CACHE_PACK_ENTRY_COMPRESSED;
+   entry->size = size;
+#endif
+}
+
+static bool
+mesa_pack_write_file(const char *path,
+                     const struct mesa_cache_pack_build_entry *entries,
+                     unsigned num_entries)
+{
+   static const uint8_t padding[MESA_CACHE_PACK_ALIGNMENT];
+   struct mesa_cache_pack_header header;
+   uint64_t offset;
+   bool ret = false;
+
+   FILE *file = fopen(path, "wb");
+   if (!file)
+      return false;
+
+   memcpy(header.magic, MESA_CACHE_PACK_MAGIC, sizeof(header.magic));
+   header.version = MESA_CACHE_PACK_VERSION;
+   header.num_entries = num_entries;
+
+   if (fwrite(&header, sizeof(header), 1, file) != 1)
+      goto out;
+
+   offset = align64(sizeof(header) +
+                    (uint64_t)num_entries * sizeof(struct mesa_cache_pack_entry),
+                    MESA_CACHE_PACK_ALIGNMENT);
+
+   for (unsigned i = 0; i < num_entries; i++) {
+      struct mesa_cache_pack_entry entry;
+
+      memcpy(entry.key, entries[i].key, CACHE_KEY_SIZE);
+      entry.flags = entries[i].flags;
+      entry.size = entries[i].size;
+      entry.uncompressed_size = entries[i].uncompressed_size;
+      entry.offset = offset;
+
+      if (fwrite(&entry, sizeof(entry), 1, file) != 1)
+         goto out;
+
+      offset = align64(offset + entry.size, MESA_CACHE_PACK_ALIGNMENT);
+   }
+
+   offset = ftell(file);
+   for (unsigned i = 0; i < num_entries; i++) {
+      size_t pad = align64(offset, MESA_CACHE_PACK_ALIGNMENT) - offset;
+
+      if (fwrite(padding, 1, pad, file) != pad ||
+          fwrite(entries[i].data, 1, entries[i].size, file) != entries[i].size)
+         goto out;
+
+      offset += pad + entries[i].size;
+   }
+
+   /* The pack replaces the journal, it has to be on disk first. */
+   ret = !fflush(file) && !fdatasync(fileno(file));
+
+out:
+   if (fclose(file))
+      ret = false;
+
+   return ret;
+}
+
+/* Merge the journal into a new pack, the caller holds the exclusive lock
+ * and has mapped the current pack.
+ */
+static bool
+mesa_pack_rebuild(struct mesa_cache_pack *pack, const char *path,
+                  uint64_t journal_size)
+{
+   const size_t length = journal_size -
+                         sizeof(struct mesa_cache_journal_header);
+   struct mesa_cache_pack_build_entry *journal, *entries = NULL;
+   unsigned num_journal = 0, num_entries = 0;
+   uint64_t journal_bytes = 0, pack_bytes = 0;
+   bool ret = false;
+
+   uint8_t *records = malloc(length);
+   if (!records)
+      return false;
+
+   if (!mesa_pack_pread(pack->journal_fd, records, length,
+                        sizeof(struct mesa_cache_journal_header))) {
+      free(records);
+      return false;
+   }
+
+   journal = mesa_pack_collect_journal(records, length, &num_journal);
+   if (!journal)
+      goto out;
+
+   entries = malloc(MAX2(num_journal + pack->num_entries, 1) *
+                    sizeof(*entries));
+   if (!entries)
+      goto out;
+
+   for (unsigned i = 0; i < num_journal; i++)
+      journal_bytes += journal[i].size;
+   for (unsigned i = 0; i < pack->num_entries; i++)
+      pack_bytes += pack->index[i].size;
+
+   /* There are no access times to evict by, so if everything doesn't fit
+    * start over with the entries that were added last.
+    */
+   const bool keep_pack = journal_bytes + pack_bytes <= pack->max_size;
+
+   /* Both lists are sorted by key, the journal takes precedence. */
+   unsigned i = 0, j = 0;
+   while (i < pack->num_entries || j < num_journal) {
+      const struct mesa_cache_pack_entry *old =
+         i < pack->num_entries ? &pack->index[i] : NULL;
+      int cmp = !old ? 1 : j == num_journal ? -1 :
+                memcmp(old->key, journal[j].key, CACHE_KEY_SIZE);
+
+      if (cmp < 0) {
+         if (keep_pack && mesa_pack_entry_valid(pack, old)) {
+            entries[num_entries++] = (struct mesa_cache_pack_build_entry) {
+               .key = old->key,
+               .data = pack->map + old->offset,
+               .flags = old->flags,
+               .size = old->size,
+               .uncompressed_size = old->uncompressed_size,
+            };
+         }
+         i++;
+         continue;
+      }
+
+      if (journal[j].size) {
+         if (pack->compress)
+            mesa_pack_compress_entry(&journal[j]);
+         entries[num_entries++] = journal[j];
+      }
+
+      if (cmp == 0)
+         i++;
+      j++;
+   }
+
+   char *tmp_path = ralloc_asprintf(NULL, "%s.tmp", path);
+   if (tmp_path &&
+       mesa_pack_write_file(tmp_path, entries, num_entries) &&
+       !rename(tmp_path, path)) {
+      ret = mesa_journal_reset(pack);
+   } else if (tmp_path) {
+      unlink(tmp_path);
+   }
+   ralloc_free(tmp_path);
+
+out:
+   if (journal) {
+      for (unsigned k = 0; k < num_journal; k++)
+         free(journal[k].compressed);
+   }
+   free(journal);
+   free(entries);
+   free(records);
+
+   return ret;
+}
+
+bool
+mesa_cache_pack_open(struct mesa_cache_pack *pack, const char *cache_path,
+                     uint64_t max_size, bool compress)
+{
+   struct mesa_cache_journal_header header;
+   struct stat sb;
+
+   pack->max_size = max_size;
+   pack->compress = compress;
+
+   pack->mem_ctx = ralloc_context(NULL);
+   if (!pack->mem_ctx)
+      return false;
+
+   char *path = ralloc_asprintf(pack->mem_ctx, "%s/mesa_cache.pack",
+                                cache_path);
+   char *journal_path = ralloc_asprintf(pack->mem_ctx, "%s/mesa_cache.journal",
+                                        cache_path);
+   if (!path || !journal_path)
+      goto free_mem_ctx;
+
+   pack->journal_index = _mesa_hash_table_create(pack->mem_ctx,
+                                                 mesa_journal_key_hash,
+                                                 mesa_journal_key_equal);
+   if (!pack->journal_index)
+      goto free_mem_ctx;
+
+   pack->journal_fd = open(journal_path,
+                           O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+   if (pack->journal_fd == -1)
+      goto free_mem_ctx;
+
+   if (mesa_pack_flock(pack->journal_fd, LOCK_EX) < 0)
+      goto close_journal;
+
+   if (!mesa_journal_read_header(pack->journal_fd, &header) &&
+       !mesa_journal_reset(pack))
+      goto unlock;
+
+   if (!mesa_pack_map(pack, path))
+      goto unlock;
+
+   /* Rewriting the pack on every start would cost more than reading a
+    * small journal along with it.  If the merge fails, the journal is
+    * simply read along with the old pack as well.
+    */
+   if (!fstat(pack->journal_fd, &sb) && sb.st_size > sizeof(header) &&
+       (sb.st_size - sizeof(header)) * MESA_CACHE_PACK_MERGE_RATIO >=
+       pack->map_size &&
+       mesa_pack_rebuild(pack, path, sb.st_size)) {
+      mesa_pack_unmap(pack);
+      if (!mesa_pack_map(pack, path))
+         goto unlock;
+   }
+
+   mesa_pack_flock(pack->journal_fd, LOCK_UN);
+
+   simple_mtx_init(&pack->journal_mtx, mtx_plain);
+
+   return true;
+
+unlock:
+   mesa_pack_unmap(pack);
+   mesa_pack_flock(pack->journal_fd, LOCK_UN);
+close_journal:
+   close(pack->journal_fd);
+   pack->journal_fd = -1;
+free_mem_ctx:
+   ralloc_free(pack->mem_ctx);
+   pack->mem_ctx = NULL;
+
+   return false;
+}
+
+void
+mesa_cache_pack_close(struct mesa_cache_pack *pack)
+{
+   mesa_pack_unmap(pack);
+   close(pack->journal_fd);
+   simple_mtx_destroy(&pack->journal_mtx);
+   ralloc_free(pack->mem_ctx);
+}
+
+/* Returns the entry for the key, or NULL if there is none.  Uncompressed
+ * entries of the pack point into the mapping and stay valid until the
+ * pack is closed.  Others are read into a buffer which is also returned
+ * in copy and has to be freed by the caller.
+ */
+const void *
+mesa_cache_pack_read_entry(struct mesa_cache_pack *pack,
+                           const uint8_t *cache_key_160bit,
+                           size_t *size, void **copy)
+{
+   const struct mesa_cache_pack_entry *entry;
+   bool searched_pack = false, removed = false;
+
+   *copy = NULL;
+
+   /* Removals are the only reason to look at the journal first. */
+   if (!p_atomic_read(&pack->num_removed)) {
+      entry = mesa_pack_find_entry(pack, cache_key_160bit);
+      if (entry)
+         return mesa_pack_entry_data(pack, entry, size, copy);
+      searched_pack = true;
+   }
+
+   simple_mtx_lock(&pack->journal_mtx);
+
+   mesa_journal_update_index(pack);
+
+   struct hash_entry *he =
+      _mesa_hash_table_search(pack->journal_index, cache_key_160bit);
+   if (he) {
+      const struct mesa_cache_journal_entry *journal_entry = he->data;
+      removed = journal_entry->removed;
+      *copy = mesa_journal_read_record(pack, journal_entry, cache_key_160bit,
+                                       size);
+   }
+
+   simple_mtx_unlock(&pack->journal_mtx);
+
+   if (*copy)
+      return *copy;
+
+   if (removed || searched_pack)
+      return NULL;
+
+   entry = mesa_pack_find_entry(pack, cache_key_160bit);
+   return entry ? mesa_pack_entry_data(pack, entry, size, copy) : NULL;
+}
+
+bool
+mesa_cache_pack_entry_write(struct mesa_cache_pack *pack,
+                            const uint8_t *cache_key_160bit,
+                            const void *blob, size_t blob_size)
+{
+   if (!blob_size)
+      return false;
+
+   return mesa_journal_append(pack, cache_key_160bit, blob, blob_size);
+}
+
+bool
+mesa_cache_pack_entry_remove(struct mesa_cache_pack *pack,
+                             const uint8_t *cache_key_160bit)
+{
+   if (!mesa_journal_append(pack, cache_key_160bit, NULL, 0))
+      return false;
+
+   /* Make the removal visible to this process right away. */
+   simple_mtx_lock(&pack->journal_mtx);
+   mesa_journal_update_index(pack);
+   simple_mtx_unlock(&pack->journal_mtx);
+
+   return true;
+}
+
+#endif /* DETECT_OS_WINDOWS == 0 */
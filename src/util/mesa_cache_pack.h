@@ -0,0 +1,105 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef MESA_CACHE_PACK_H
+#define MESA_CACHE_PACK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "detect_os.h"
+#include "simple_mtx.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct hash_table;
+struct mesa_cache_pack_entry;
+
+struct mesa_cache_pack {
+   /* Read-only mapping of the pack file, never modified once created. */
+   const uint8_t *map;
+   size_t map_size;
+   const struct mesa_cache_pack_entry *index;
+   uint32_t num_entries;
+
+   /* Entries added or removed since the pack was built. */
+   simple_mtx_t journal_mtx;
+   int journal_fd;
+   uint64_t journal_uuid;
+   uint64_t journal_offset;
+   struct hash_table *journal_index;
+   unsigned num_removed;
+
+   uint64_t max_size;
+   bool compress;
+   void *mem_ctx;
+};
+
+#if DETECT_OS_WINDOWS == 0
+bool
+mesa_cache_pack_open(struct mesa_cache_pack *pack, const char *cache_path,
+                     uint64_t max_size, bool compress);
+
+void
+mesa_cache_pack_close(struct mesa_cache_pack *pack);
+
+const void *
+mesa_cache_pack_read_entry(struct mesa_cache_pack *pack,
+                           const uint8_t *cache_key_160bit,
+                           size_t *size, void **copy);
+
+bool
+mesa_cache_pack_entry_write(struct mesa_cache_pack *pack,
+                            const uint8_t *cache_key_160bit,
+                            const void *blob, size_t blob_size);
+
+bool
+mesa_cache_pack_entry_remove(struct mesa_cache_pack *pack,
+                             const uint8_t *cache_key_160bit);
+#else
+static inline bool
+mesa_cache_pack_open(struct mesa_cache_pack *pack, const char *cache_path,
+                     uint64_t max_size, bool compress)
+{
+   return false;
+}
+
+static inline void
+mesa_cache_pack_close(struct mesa_cache_pack *pack)
+{
+}
+
+static inline const void *
+mesa_cache_pack_read_entry(struct mesa_cache_pack *pack,
+                           const uint8_t *cache_key_160bit,
+                           size_t *size, void **copy)
+{
+   *copy = NULL;
+   return NULL;
+}
+
+static inline bool
+mesa_cache_pack_entry_write(struct mesa_cache_pack *pack,
+                            const uint8_t *cache_key_160bit,
+                            const void *blob, size_t blob_size)
+{
+   return false;
+}
+
+static inline bool
+mesa_cache_pack_entry_remove(struct mesa_cache_pack *pack,
+                             const uint8_t *cache_key_160bit)
+{
+   return false;
+}
+#endif /* DETECT_OS_WINDOWS == 0 */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MESA_CACHE_PACK_H */
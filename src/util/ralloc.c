@@ -584,6 +584,13 @@ ralloc_vasprintf_rewrite_tail(char **str, size_t *start, const char *fmt,
 
 #define NUM_FREELIST_BUCKETS (MAX_FREELIST_SIZE / FREELIST_ALIGNMENT)
 
+/* Bucket values for objects that are not in a freelist slab: objects larger
+ * than MAX_FREELIST_SIZE are allocated directly with ralloc, and objects of
+ * linear contexts are allocated from linear slabs.
+ */
+#define GC_DIRECT_BUCKET NUM_FREELIST_BUCKETS
+#define GC_LINEAR_BUCKET (NUM_FREELIST_BUCKETS + 1)
+
 /* The size of a slab. */
 #define SLAB_SIZE (32 * 1024)
 
@@ -616,6 +623,10 @@ typedef struct
 
 /* This structure is at the start of the slab. Objects inside a slab are
  * allocated using a freelist backed by a simple linear allocator.
+ *
+ * Slabs of linear contexts only use the linear allocator and objects of any
+ * size are packed together. Their "num_free" counts the live objects found
+ * while sweeping instead.
  */
 typedef struct gc_slab {
    alignas(HEADER_ALIGN)
@@ -662,6 +673,10 @@ struct gc_ctx {
       struct list_head free_slabs;
    } slabs[NUM_FREELIST_BUCKETS];
 
+   /* Slabs of a linear context. The last one is the one allocated from. */
+   bool linear;
+   struct list_head linear_slabs;
+
    uint8_t current_gen;
    void *rubbish;
 };
@@ -713,12 +728,21 @@ gc_context(const void *parent)
       list_inithead(&ctx->slabs[i].slabs);
       list_inithead(&ctx->slabs[i].free_slabs);
    }
+   list_inithead(&ctx->linear_slabs);
 #ifndef NDEBUG
    ctx->canary = GC_CONTEXT_CANARY;
 #endif
    return ctx;
 }
 
+gc_ctx *
+gc_context_linear(const void *parent)
+{
+   gc_ctx *ctx = gc_context(parent);
+   ctx->linear = true;
+   return ctx;
+}
+
 static_assert(UINT32_MAX >= MAX_FREELIST_SIZE, "Freelist sizes use uint32_t");
 
 static uint32_t
@@ -839,6 +863,52 @@ create_slab(gc_ctx *ctx, unsigned bucket)
    return slab;
 }
 
+static gc_block_header *
+alloc_linear(gc_ctx *ctx, uint32_t size, uint32_t alignment)
+{
+   gc_slab *slab = list_is_empty(&ctx->linear_slabs) ? NULL :
+      list_last_entry(&ctx->linear_slabs, gc_slab, link);
+
+   char *ptr = slab ? (char *)align_uintptr((uintptr_t)slab->next_available, alignment) : NULL;
+   if (!slab || ptr + size > (char *)slab + SLAB_SIZE) {
+      slab = ralloc_size(ctx, SLAB_SIZE);
+      if (unlikely(!slab))
+         return NULL;
+
+      slab->ctx = ctx;
+      slab->freelist = NULL;
+      slab->num_allocated = 0;
+      slab->num_free = 0;
+      list_inithead(&slab->free_link);
+      list_addtail(&slab->link, &ctx->linear_slabs);
+
+      ptr = (char *)(slab + 1);
+   }
+
+   gc_block_header *header = (gc_block_header *)ptr;
+   header->slab_offset = ptr - (char *)slab;
+   header->bucket = GC_LINEAR_BUCKET;
+
+   slab->next_available = ptr + size;
+   slab->num_allocated++;
+   return header;
+}
+
+static void
+free_linear(gc_block_header *header)
+{
+   gc_slab *slab = get_gc_slab(header);
+
+   /* The space is not reused until the whole slab is empty. */
+   if (--slab->num_allocated > 0)
+      return;
+
+   if (slab == list_last_entry(&slab->ctx->linear_slabs, gc_slab, link))
+      slab->next_available = (char *)(slab + 1);
+   else
+      free_slab(slab);
+}
+
 void *
 gc_alloc_size(gc_ctx *ctx, size_t size, size_t alignment)
 {
@@ -860,7 +930,11 @@ gc_alloc_size(gc_ctx *ctx, size_t size, size_t alignment)
    size += header_size;
 
    gc_block_header *header = NULL;
-   if (size <= MAX_FREELIST_SIZE) {
+   if (ctx->linear && size <= MAX_FREELIST_SIZE) {
+      header = alloc_linear(ctx, size, alignment);
+      if (unlikely(!header))
+         return NULL;
+   } else if (size <= MAX_FREELIST_SIZE) {
       uint32_t bucket = gc_bucket_for_size((uint32_t)size);
       if (list_is_empty(&ctx->slabs[bucket].free_slabs) && !create_slab(ctx, bucket))
          return NULL;
@@ -871,7 +945,7 @@ gc_alloc_size(gc_ctx *ctx, size_t size, size_t alignment)
       if (unlikely(!header))
          return NULL;
       /* Mark the header as allocated directly, so we know to actually free it. */
-      header->bucket = NUM_FREELIST_BUCKETS;
+      header->bucket = GC_DIRECT_BUCKET;
    }
 
    header->flags = ctx->current_gen | IS_USED;
@@ -909,6 +983,8 @@ gc_free(void *ptr)
 
    if (header->bucket < NUM_FREELIST_BUCKETS)
       free_from_slab(header, true);
+   else if (header->bucket == GC_LINEAR_BUCKET)
+      free_linear(header);
    else
       ralloc_free(header);
 }
@@ -917,7 +993,7 @@ gc_ctx *gc_get_context(void *ptr)
 {
    gc_block_header *header = get_gc_header(ptr);
 
-   if (header->bucket < NUM_FREELIST_BUCKETS)
+   if (header->bucket != GC_DIRECT_BUCKET)
       return get_gc_slab(header)->ctx;
    else
       return ralloc_parent(header);
@@ -928,6 +1004,9 @@ gc_sweep_start(gc_ctx *ctx)
 {
    ctx->current_gen ^= CURRENT_GENERATION;
 
+   list_for_each_entry(gc_slab, slab, &ctx->linear_slabs, link)
+      slab->num_free = 0;
+
    ctx->rubbish = ralloc_context(NULL);
    ralloc_adopt(ctx->rubbish, ctx);
 }
@@ -938,6 +1017,8 @@ gc_mark_live(gc_ctx *ctx, const void *mem)
    gc_block_header *header = get_gc_header(mem);
    if (header->bucket < NUM_FREELIST_BUCKETS)
       header->flags ^= CURRENT_GENERATION;
+   else if (header->bucket == GC_LINEAR_BUCKET)
+      get_gc_slab(header)->num_free++;
    else
       ralloc_steal(ctx, header);
 }
@@ -980,10 +1061,57 @@ gc_sweep_end(gc_ctx *ctx)
       }
    }
 
+   /* Dead objects of linear slabs are only reclaimed once the whole slab is
+    * dead.
+    */
+   list_for_each_entry_safe(gc_slab, slab, &ctx->linear_slabs, link) {
+      slab->num_allocated = slab->num_free;
+      if (slab->num_allocated)
+         ralloc_steal(ctx, slab);
+      else
+         free_slab(slab);
+   }
+
    ralloc_free(ctx->rubbish);
    ctx->rubbish = NULL;
 }
 
+void
+gc_context_merge(gc_ctx *dst, gc_ctx *src)
+{
+   assert(!dst->rubbish && !src->rubbish);
+
+   /* This moves the slabs and the objects allocated directly. */
+   ralloc_adopt(dst, src);
+
+   for (unsigned i = 0; i < NUM_FREELIST_BUCKETS; i++) {
+      unsigned obj_size = gc_bucket_obj_size(i);
+      list_for_each_entry(gc_slab, slab, &src->slabs[i].slabs, link) {
+         slab->ctx = dst;
+
+         if (src->current_gen == dst->current_gen)
+            continue;
+
+         for (char *ptr = (char*)(slab + 1); ptr != slab->next_available; ptr += obj_size) {
+            gc_block_header *header = (gc_block_header *)ptr;
+            if (header->flags & IS_USED)
+               header->flags ^= CURRENT_GENERATION;
+         }
+      }
+
+      list_splicetail(&src->slabs[i].slabs, &dst->slabs[i].slabs);
+      list_splicetail(&src->slabs[i].free_slabs, &dst->slabs[i].free_slabs);
+      list_inithead(&src->slabs[i].slabs);
+      list_inithead(&src->slabs[i].free_slabs);
+   }
+
+   /* Keep allocating from the last linear slab of dst. */
+   list_for_each_entry(gc_slab, slab, &src->linear_slabs, link)
+      slab->ctx = dst;
+   list_splice(&src->linear_slabs, &dst->linear_slabs);
+   list_inithead(&src->linear_slabs);
+}
+
 /***************************************************************************
  * Linear allocator for short-lived allocations.
  ***************************************************************************
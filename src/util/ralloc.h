@@ -505,6 +505,14 @@ typedef struct gc_ctx gc_ctx;
  */
 gc_ctx *gc_context(const void *parent);
 
+/**
+ * Allocate a new garbage collection context whose small children are packed
+ * in allocation order instead of being grouped by size. Space is only
+ * reclaimed once all objects sharing a slab are freed, so this suits users
+ * that periodically sweep or rebuild their data and care about locality.
+ */
+gc_ctx *gc_context_linear(const void *parent);
+
 #define gc_alloc(ctx, type, count) gc_alloc_size(ctx, sizeof(type) * (count), alignof(type))
 #define gc_zalloc(ctx, type, count) gc_zalloc_size(ctx, sizeof(type) * (count), alignof(type))
 
@@ -522,6 +530,12 @@ void gc_sweep_start(gc_ctx *ctx);
 void gc_mark_live(gc_ctx *ctx, const void *mem);
 void gc_sweep_end(gc_ctx *ctx);
 
+/**
+ * Move all objects of \p src to \p dst, leaving \p src empty. Neither
+ * context may be in the middle of a sweep.
+ */
+void gc_context_merge(gc_ctx *dst, gc_ctx *src);
+
 /**
  * Declare C++ new and delete operators which use ralloc.
  *
@@ -37,6 +37,9 @@
 #include <time.h>
 #include <unistd.h>
 #include <utime.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/wait.h>
 
 #include "util/detect_os.h"
 #include "util/mesa-sha1.h"
@@ -564,6 +567,194 @@ test_put_and_get_between_instances(const char *driver_id)
    disk_cache_destroy(cache2);
 }
 
+/* Look up many items at once, with disk_cache_get_batch() and with
+ * disk_cache_prefetch() followed by single gets.  A few of the keys were
+ * never stored.
+ */
+static void
+test_get_batch(const char *driver_id)
+{
+   const unsigned num_stored = 50, num_keys = 56;
+   cache_key keys[56];
+   char blobs[56][32];
+   void *data[56];
+   size_t sizes[56];
+
+#ifdef SHADER_CACHE_DISABLE_BY_DEFAULT
+   setenv("MESA_SHADER_CACHE_DISABLE", "false", 1);
+#endif /* SHADER_CACHE_DISABLE_BY_DEFAULT */
+
+   /* All the items have to fit, whatever limit earlier tests set. */
+   unsetenv("MESA_SHADER_CACHE_MAX_SIZE");
+
+   struct disk_cache *cache = disk_cache_create("test_get_batch",
+                                                driver_id, 0);
+
+   for (unsigned i = 0; i < num_keys; i++) {
+      snprintf(blobs[i], sizeof(blobs[i]), "batch item number %u", i);
+      disk_cache_compute_key(cache, blobs[i], sizeof(blobs[i]), keys[i]);
+      if (i < num_stored)
+         disk_cache_put(cache, keys[i], blobs[i], sizeof(blobs[i]), NULL);
+   }
+
+   /* disk_cache_put() hands things off to a thread so wait for it. */
+   disk_cache_wait_for_idle(cache);
+
+   disk_cache_get_batch(cache, num_keys, keys, data, sizes);
+   for (unsigned i = 0; i < num_keys; i++) {
+      if (i < num_stored) {
+         EXPECT_STREQ((char *) data[i], blobs[i]) << "disk_cache_get_batch item " << i;
+         EXPECT_EQ(sizes[i], sizeof(blobs[i])) << "disk_cache_get_batch size " << i;
+      } else {
+         EXPECT_EQ(data[i], nullptr) << "disk_cache_get_batch missing item " << i;
+         EXPECT_EQ(sizes[i], 0) << "disk_cache_get_batch missing size " << i;
+      }
+      free(data[i]);
+   }
+
+   disk_cache_prefetch(cache, num_keys, keys);
+   for (unsigned i = 0; i < num_keys; i++) {
+      size_t size;
+      char *result = (char *) disk_cache_get(cache, keys[i], &size);
+      if (i < num_stored) {
+         EXPECT_STREQ(result, blobs[i]) << "disk_cache_get of prefetched item " << i;
+         EXPECT_EQ(size, sizeof(blobs[i])) << "disk_cache_get of prefetched size " << i;
+      } else {
+         EXPECT_EQ(result, nullptr) << "disk_cache_get of prefetched missing item " << i;
+      }
+      free(result);
+   }
+
+   /* Prefetched items can also be taken by a batch, and the ones which are
+    * never retrieved must not leak.
+    */
+   disk_cache_prefetch(cache, num_keys / 2, keys);
+   disk_cache_get_batch(cache, 8, keys, data, sizes);
+   for (unsigned i = 0; i < 8; i++) {
+      EXPECT_STREQ((char *) data[i], blobs[i]) << "disk_cache_get_batch of prefetched item " << i;
+      free(data[i]);
+   }
+
+   disk_cache_destroy(cache);
+}
+
+/* Items written to the pack cache are read back from its journal until the
+ * next disk_cache_create() merges the journal into the pack, from then on
+ * uncompressed items are handed out in place.
+ */
+static void
+test_pack_get_view(const char *driver_id, bool compressed)
+{
+   char blob[] = "This is a blob of thirty-seven bytes";
+   uint8_t blob_key[20];
+   char string[] = "While this string has thirty-four";
+   uint8_t string_key[20];
+   struct disk_cache_view view;
+   struct disk_cache *cache;
+
+#ifdef SHADER_CACHE_DISABLE_BY_DEFAULT
+   setenv("MESA_SHADER_CACHE_DISABLE", "false", 1);
+#endif /* SHADER_CACHE_DISABLE_BY_DEFAULT */
+
+   unsetenv("MESA_SHADER_CACHE_MAX_SIZE");
+
+   cache = disk_cache_create("test_pack_get_view", driver_id, 0);
+
+   disk_cache_compute_key(cache, blob, sizeof(blob), blob_key);
+   disk_cache_compute_key(cache, string, sizeof(string), string_key);
+
+   EXPECT_FALSE(disk_cache_get_view(cache, blob_key, &view)) << "disk_cache_get_view with non-existent item";
+   EXPECT_EQ(view.data, nullptr) << "disk_cache_get_view with non-existent item (pointer)";
+   EXPECT_EQ(view.size, 0) << "disk_cache_get_view with non-existent item (size)";
+
+   disk_cache_put(cache, blob_key, blob, sizeof(blob), NULL);
+
+   /* disk_cache_put() hands things off to a thread so wait for it. */
+   disk_cache_wait_for_idle(cache);
+
+   EXPECT_TRUE(disk_cache_get_view(cache, blob_key, &view)) << "disk_cache_get_view of journal item";
+   EXPECT_STREQ((const char *) view.data, blob) << "disk_cache_get_view of journal item (pointer)";
+   EXPECT_EQ(view.size, sizeof(blob)) << "disk_cache_get_view of journal item (size)";
+   EXPECT_NE(view.copy, nullptr) << "disk_cache_get_view of journal item is a copy";
+   disk_cache_release_view(&view);
+
+   disk_cache_destroy(cache);
+
+   cache = disk_cache_create("test_pack_get_view", driver_id, 0);
+
+   EXPECT_TRUE(disk_cache_get_view(cache, blob_key, &view)) << "disk_cache_get_view of pack item";
+   EXPECT_STREQ((const char *) view.data, blob) << "disk_cache_get_view of pack item (pointer)";
+   EXPECT_EQ(view.size, sizeof(blob)) << "disk_cache_get_view of pack item (size)";
+   if (!compressed)
+      EXPECT_EQ(view.copy, nullptr) << "disk_cache_get_view of pack item is in place";
+
+   /* Adding and removing items doesn't touch the pack. */
+   disk_cache_put(cache, string_key, string, sizeof(string), NULL);
+   disk_cache_wait_for_idle(cache);
+   disk_cache_remove(cache, blob_key);
+
+   EXPECT_STREQ((const char *) view.data, blob) << "disk_cache_get_view of removed item stays valid";
+   disk_cache_release_view(&view);
+
+   EXPECT_FALSE(does_cache_contain(cache, blob_key)) << "disk_cache_get of removed pack item";
+   EXPECT_TRUE(does_cache_contain(cache, string_key)) << "disk_cache_get of journal item";
+
+   disk_cache_destroy(cache);
+
+   /* The removal is merged into the pack as well. */
+   cache = disk_cache_create("test_pack_get_view", driver_id, 0);
+
+   EXPECT_FALSE(does_cache_contain(cache, blob_key)) << "disk_cache_get of removed item after merge";
+
+   EXPECT_TRUE(disk_cache_get_view(cache, string_key, &view)) << "2nd disk_cache_get_view of pack item";
+   EXPECT_STREQ((const char *) view.data, string) << "2nd disk_cache_get_view of pack item (pointer)";
+   EXPECT_EQ(view.size, sizeof(string)) << "2nd disk_cache_get_view of pack item (size)";
+   disk_cache_release_view(&view);
+
+   disk_cache_destroy(cache);
+}
+
+/* Journal items whose keys only differ after the first eight bytes. */
+static void
+test_pack_similar_keys(const char *driver_id)
+{
+   char blob[] = "This is a blob of thirty-seven bytes";
+   char string[] = "While this string has thirty-four";
+   cache_key blob_key, string_key;
+   struct disk_cache *cache;
+   char *result;
+   size_t size;
+
+#ifdef SHADER_CACHE_DISABLE_BY_DEFAULT
+   setenv("MESA_SHADER_CACHE_DISABLE", "false", 1);
+#endif /* SHADER_CACHE_DISABLE_BY_DEFAULT */
+
+   cache = disk_cache_create("test_pack_similar_keys", driver_id, 0);
+
+   memset(blob_key, 0x5a, sizeof(blob_key));
+   memcpy(string_key, blob_key, sizeof(string_key));
+   string_key[CACHE_KEY_SIZE - 1] ^= 1;
+
+   disk_cache_put(cache, blob_key, blob, sizeof(blob), NULL);
+   disk_cache_put(cache, string_key, string, sizeof(string), NULL);
+   disk_cache_wait_for_idle(cache);
+
+   result = (char *) disk_cache_get(cache, blob_key, &size);
+   EXPECT_STREQ(result, blob) << "disk_cache_get of 1st of similar keys";
+   free(result);
+
+   result = (char *) disk_cache_get(cache, string_key, &size);
+   EXPECT_STREQ(result, string) << "disk_cache_get of 2nd of similar keys";
+   free(result);
+
+   disk_cache_remove(cache, string_key);
+
+   EXPECT_TRUE(does_cache_contain(cache, blob_key)) << "disk_cache_get after removing a similar key";
+   EXPECT_FALSE(does_cache_contain(cache, string_key)) << "disk_cache_get of removed similar key";
+
+   disk_cache_destroy(cache);
+}
+
 static void
 test_put_and_get_between_instances_with_eviction(const char *driver_id)
 {
@@ -760,6 +951,8 @@ run_tests:
 
    test_put_key_and_get_key(driver_id);
 
+   test_get_batch(driver_id);
+
    setenv("MESA_DISK_CACHE_MULTI_FILE", "false", 1);
 
    int err = rmrf_local(CACHE_TEST_TMP);
@@ -800,6 +993,8 @@ run_tests:
 
    test_put_and_get_between_instances(driver_id);
 
+   test_get_batch(driver_id);
+
    setenv("MESA_DISK_CACHE_SINGLE_FILE", "false", 1);
 
    int err = rmrf_local(CACHE_TEST_TMP);
@@ -847,6 +1042,8 @@ TEST_F(Cache, Database)
 
    test_put_big_sized_entry_to_empty_cache(driver_id);
 
+   test_get_batch(driver_id);
+
    setenv("MESA_DISK_CACHE_DATABASE", "false", 1);
    unsetenv("MESA_DISK_CACHE_DATABASE_NUM_PARTS");
 
@@ -855,6 +1052,52 @@ TEST_F(Cache, Database)
 #endif
 }
 
+TEST_F(Cache, Pack)
+{
+   const char *driver_id = "make_check";
+
+#ifndef ENABLE_SHADER_CACHE
+   GTEST_SKIP() << "ENABLE_SHADER_CACHE not defined.";
+#else
+   setenv("MESA_DISK_CACHE_MULTI_FILE", "false", 1);
+   setenv("MESA_DISK_CACHE_PACK", "true", 1);
+
+   test_disk_cache_create(mem_ctx, CACHE_DIR_NAME_PACK, driver_id);
+
+   /* The pack only enforces the size limit when merging the journal, which
+    * the eviction tests don't expect.
+    */
+   test_put_and_get(false, driver_id);
+
+   test_put_key_and_get_key(driver_id);
+
+   test_put_and_get_between_instances(driver_id);
+
+   test_get_batch(driver_id);
+
+   /* Start with an empty pack, so reopening merges the journal. */
+   int err = rmrf_local(CACHE_TEST_TMP);
+   EXPECT_EQ(err, 0) << "Removing " CACHE_TEST_TMP " again";
+
+   test_pack_get_view(driver_id, false);
+
+   test_pack_similar_keys(driver_id);
+
+   err = rmrf_local(CACHE_TEST_TMP);
+   EXPECT_EQ(err, 0) << "Removing " CACHE_TEST_TMP " again";
+
+   setenv("MESA_DISK_CACHE_PACK_COMPRESS", "true", 1);
+
+   test_pack_get_view(driver_id, true);
+
+   unsetenv("MESA_DISK_CACHE_PACK_COMPRESS");
+   setenv("MESA_DISK_CACHE_PACK", "false", 1);
+
+   err = rmrf_local(CACHE_TEST_TMP);
+   EXPECT_EQ(err, 0) << "Removing " CACHE_TEST_TMP " again";
+#endif
+}
+
 TEST_F(Cache, Combined)
 {
    const char *driver_id = "make_check";
@@ -1349,6 +1592,261 @@ TEST_F(Cache, DatabaseMultipartEviction)
 #endif
 }
 
+#ifdef ENABLE_SHADER_CACHE
+
+#define DB_STRESS_PATH CACHE_TEST_TMP "/db-stress"
+#define DB_STRESS_NUM_KEYS 256
+#define DB_STRESS_NUM_OPS 1000
+#define DB_STRESS_MAX_SIZE (64 * 1024)
+
+/* Entry n of the stress test. The content is derived from the key, so
+ * that a reader can check any blob it gets without knowing who wrote it.
+ */
+static size_t
+db_stress_entry(unsigned n, cache_key key, uint8_t *blob)
+{
+   size_t size = 64 + (n % 16) * 64;
+
+   memset(key, 0xa5, sizeof(cache_key));
+   memcpy(key, &n, sizeof(n));
+
+   for (unsigned i = 0; i < size; i++)
+      blob[i] = n * 31 + i;
+
+   return size;
+}
+
+static unsigned
+db_stress_writer(unsigned seed)
+{
+   struct mesa_cache_db db;
+   uint8_t blob[1024];
+   cache_key key;
+
+   if (!mesa_cache_db_open(&db, DB_STRESS_PATH))
+      return 1;
+
+   /* Small enough to keep compacting the DB all the time */
+   mesa_cache_db_set_size_limit(&db, DB_STRESS_MAX_SIZE);
+
+   for (unsigned i = 0; i < DB_STRESS_NUM_OPS; i++) {
+      unsigned n = rand_r(&seed) % DB_STRESS_NUM_KEYS;
+      size_t size = db_stress_entry(n, key, blob);
+
+      if (i % 16 == 15)
+         mesa_cache_db_entry_remove(&db, key);
+      else
+         mesa_cache_db_entry_write(&db, key, blob, size);
+   }
+
+   mesa_cache_db_close(&db);
+
+   return 0;
+}
+
+/* Exit codes of the reader processes */
+#define DB_STRESS_CORRUPTED 1
+#define DB_STRESS_NO_HITS 2
+
+static unsigned
+db_stress_reader(unsigned seed)
+{
+   uint8_t blob[1024], batch_keys[4][sizeof(cache_key)];
+   const uint8_t *batch_key_ptrs[4];
+   unsigned errors = 0, hits = 0, n;
+   struct mesa_cache_db db;
+   void *batch_data[4];
+   size_t batch_sizes[4];
+   cache_key key;
+   size_t size;
+
+   if (!mesa_cache_db_open(&db, DB_STRESS_PATH))
+      return 1;
+
+   for (unsigned i = 0; i < DB_STRESS_NUM_OPS; i++) {
+      n = rand_r(&seed) % DB_STRESS_NUM_KEYS;
+      size_t expected_size = db_stress_entry(n, key, blob);
+
+      void *data = mesa_cache_db_read_entry(&db, key, &size);
+      if (data && (size != expected_size || memcmp(data, blob, size)))
+         errors++;
+      hits += data != NULL;
+      free(data);
+
+      if (i % 8)
+         continue;
+
+      for (unsigned k = 0; k < ARRAY_SIZE(batch_keys); k++) {
+         db_stress_entry(n + k, batch_keys[k], blob);
+         batch_key_ptrs[k] = batch_keys[k];
+         batch_data[k] = NULL;
+      }
+
+      mesa_cache_db_read_entries(&db, ARRAY_SIZE(batch_keys), batch_key_ptrs,
+                                 batch_data, batch_sizes);
+
+      for (unsigned k = 0; k < ARRAY_SIZE(batch_keys); k++) {
+         if (batch_data[k]) {
+            cache_key expected_key;
+
+            expected_size = db_stress_entry(n + k, expected_key, blob);
+            if (batch_sizes[k] != expected_size ||
+                memcmp(batch_data[k], blob, expected_size))
+               errors++;
+            hits++;
+         }
+         free(batch_data[k]);
+      }
+   }
+
+   mesa_cache_db_close(&db);
+
+   if (errors)
+      return DB_STRESS_CORRUPTED;
+
+   return hits ? 0 : DB_STRESS_NO_HITS;
+}
+
+/* Check every entry left in the DB, returns the number of them. */
+static unsigned
+db_stress_check_db(void)
+{
+   struct mesa_cache_db db;
+   uint8_t blob[1024];
+   unsigned num_entries = 0;
+   cache_key key;
+   size_t size;
+
+   if (!mesa_cache_db_open(&db, DB_STRESS_PATH)) {
+      ADD_FAILURE() << "mesa_cache_db_open after stress";
+      return 0;
+   }
+
+   for (unsigned n = 0; n < DB_STRESS_NUM_KEYS; n++) {
+      size_t expected_size = db_stress_entry(n, key, blob);
+      void *data = mesa_cache_db_read_entry(&db, key, &size);
+
+      if (data) {
+         EXPECT_EQ(size, expected_size) << "size of entry " << n << " after stress";
+         EXPECT_EQ(memcmp(data, blob, MIN2(size, expected_size)), 0)
+            << "data of entry " << n << " after stress";
+         num_entries++;
+      }
+      free(data);
+   }
+
+   mesa_cache_db_close(&db);
+
+   return num_entries;
+}
+
+/* Hammer one DB with writer and reader processes, each of the readers
+ * must only ever get intact entries, and must get some.
+ */
+static void
+test_db_multi_process_stress(void)
+{
+   const unsigned num_writers = 4, num_readers = 4;
+   pid_t pids[num_writers + num_readers];
+   unsigned i;
+
+   /* Fill the DB first, so that readers don't depend on the writers
+    * getting ahead of them to find anything.
+    */
+   ASSERT_EQ(db_stress_writer(ARRAY_SIZE(pids)), 0) << "filling the DB";
+
+   for (i = 0; i < ARRAY_SIZE(pids); i++) {
+      pids[i] = fork();
+      ASSERT_GE(pids[i], 0) << "fork";
+
+      if (!pids[i]) {
+         unsigned errors = i < num_writers ? db_stress_writer(i) :
+                                             db_stress_reader(i);
+         _exit(errors ? 1 : 0);
+      }
+   }
+
+   for (i = 0; i < ARRAY_SIZE(pids); i++) {
+      int status;
+
+      ASSERT_EQ(waitpid(pids[i], &status, 0), pids[i]) << "waitpid";
+      ASSERT_TRUE(WIFEXITED(status))
+         << (i < num_writers ? "writer" : "reader") << " process " << i;
+
+      if (i < num_writers) {
+         EXPECT_EQ(WEXITSTATUS(status), 0) << "writer process " << i;
+      } else {
+         EXPECT_NE(WEXITSTATUS(status), DB_STRESS_CORRUPTED)
+            << "reader process " << i << " got corrupted entries";
+         EXPECT_NE(WEXITSTATUS(status), DB_STRESS_NO_HITS)
+            << "reader process " << i << " got no hits";
+         EXPECT_EQ(WEXITSTATUS(status), 0) << "reader process " << i;
+      }
+   }
+
+   /* Neither the readers' access time updates nor the compactions may have
+    * damaged what's left.
+    */
+   EXPECT_GT(db_stress_check_db(), 0) << "entries left after stress";
+}
+
+/* Readers must not wait for the lock held by a writer. */
+static void
+test_db_read_while_locked(void)
+{
+   struct mesa_cache_db db;
+   uint8_t blob[1024];
+   cache_key key;
+   size_t size;
+
+   ASSERT_TRUE(mesa_cache_db_open(&db, DB_STRESS_PATH)) << "mesa_cache_db_open";
+   mesa_cache_db_set_size_limit(&db, DB_STRESS_MAX_SIZE);
+
+   size_t expected_size = db_stress_entry(DB_STRESS_NUM_KEYS, key, blob);
+   EXPECT_TRUE(mesa_cache_db_entry_write(&db, key, blob, expected_size))
+      << "mesa_cache_db_entry_write";
+
+   /* The lock belongs to the open file description, so this fd conflicts
+    * with the DB's own one just as another process would.
+    */
+   int fd = open(DB_STRESS_PATH "/mesa_cache.db", O_RDWR | O_CLOEXEC);
+   ASSERT_GE(fd, 0) << "open mesa_cache.db";
+   ASSERT_EQ(flock(fd, LOCK_EX), 0) << "flock mesa_cache.db";
+
+   void *data = mesa_cache_db_read_entry(&db, key, &size);
+   EXPECT_NE(data, nullptr) << "mesa_cache_db_read_entry with DB locked";
+   EXPECT_EQ(size, expected_size) << "mesa_cache_db_read_entry with DB locked (size)";
+   if (data)
+      EXPECT_EQ(memcmp(data, blob, size), 0) << "mesa_cache_db_read_entry with DB locked (data)";
+   free(data);
+
+   EXPECT_GT(mesa_cache_db_eviction_score(&db), 0) << "mesa_cache_db_eviction_score with DB locked";
+
+   close(fd);
+
+   mesa_cache_db_close(&db);
+}
+
+#endif /* ENABLE_SHADER_CACHE */
+
+TEST_F(Cache, DatabaseMultiProcess)
+{
+#ifndef ENABLE_SHADER_CACHE
+   GTEST_SKIP() << "ENABLE_SHADER_CACHE not defined.";
+#else
+   int err = mkdir(CACHE_TEST_TMP, 0755);
+   ASSERT_TRUE(err == 0 || errno == EEXIST) << "mkdir " CACHE_TEST_TMP;
+   ASSERT_EQ(mkdir(DB_STRESS_PATH, 0755), 0) << "mkdir " DB_STRESS_PATH;
+
+   test_db_multi_process_stress();
+
+   test_db_read_while_locked();
+
+   err = rmrf_local(CACHE_TEST_TMP);
+   EXPECT_EQ(err, 0) << "Removing " CACHE_TEST_TMP " again";
+#endif
+}
+
 static void
 test_put_and_get_disabled(const char *driver_id)
 {
@@ -0,0 +1,266 @@
+/*
+ * Copyright © 2014 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * Startup benchmark for the shader cache.
+ *
+ * Replays the lookups recorded by running an application with
+ * MESA_SHADER_CACHE_KEY_LOG=<file> against the same cache, once with one
+ * disk_cache_get() per key, once with disk_cache_get_batch(), once with
+ * disk_cache_prefetch() followed by single gets and once with
+ * disk_cache_get_view().  Each mode opens the cache afresh; use -m to run
+ * a single mode, e.g. after dropping the page cache.
+ *
+ *    disk_cache_replay [-m serial|batch|prefetch|view] [-b batch_size] <key log>
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "util/disk_cache.h"
+#include "util/mesa-sha1.h"
+#include "util/os_time.h"
+#include "util/u_math.h"
+
+struct key_log {
+   char gpu_name[256];
+   char driver_id[256];
+   uint64_t driver_flags;
+   cache_key *keys;
+   unsigned num_keys;
+};
+
+enum replay_mode {
+   REPLAY_SERIAL,
+   REPLAY_BATCH,
+   REPLAY_PREFETCH,
+   REPLAY_VIEW,
+   REPLAY_COUNT,
+};
+
+static const char *mode_names[REPLAY_COUNT] = {
+   "serial",
+   "batch",
+   "prefetch",
+   "view",
+};
+
+/* Only the keys of the first cache in the log are replayed. */
+static bool
+read_key_log(const char *filename, struct key_log *log)
+{
+   FILE *fp = fopen(filename, "r");
+   char line[1024];
+   unsigned max_keys = 0;
+   bool have_header = false, replaying = false;
+
+   if (!fp) {
+      fprintf(stderr, "can't open %s\n", filename);
+      return false;
+   }
+
+   memset(log, 0, sizeof(*log));
+
+   while (fgets(line, sizeof(line), fp)) {
+      if (line[0] == '#') {
+         char gpu_name[256], driver_id[256];
+         uint64_t driver_flags;
+
+         if (sscanf(line, "#\t%255[^\t]\t%255[^\t]\t%" SCNx64,
+                    gpu_name, driver_id, &driver_flags) != 3)
+            continue;
+
+         if (!have_header) {
+            strcpy(log->gpu_name, gpu_name);
+            strcpy(log->driver_id, driver_id);
+            log->driver_flags = driver_flags;
+            have_header = true;
+         }
+
+         replaying = !strcmp(gpu_name, log->gpu_name) &&
+                     !strcmp(driver_id, log->driver_id) &&
+                     driver_flags == log->driver_flags;
+         continue;
+      }
+
+      if (!replaying || strlen(line) < 40)
+         continue;
+
+      if (log->num_keys == max_keys) {
+         max_keys = MAX2(1024, max_keys * 2);
+         log->keys = realloc(log->keys, max_keys * sizeof(cache_key));
+         if (!log->keys) {
+            fclose(fp);
+            return false;
+         }
+      }
+
+      line[40] = '\0';
+      _mesa_sha1_hex_to_sha1(log->keys[log->num_keys++], line);
+   }
+
+   fclose(fp);
+
+   if (!have_header) {
+      fprintf(stderr, "%s is not a MESA_SHADER_CACHE_KEY_LOG file\n",
+              filename);
+      return false;
+   }
+
+   return true;
+}
+
+static void
+replay(const struct key_log *log, enum replay_mode mode, unsigned batch_size)
+{
+   unsigned hits = 0;
+   uint64_t bytes = 0;
+   int64_t start, end;
+
+   struct disk_cache *cache = disk_cache_create(log->gpu_name, log->driver_id,
+                                                log->driver_flags);
+   if (!cache) {
+      fprintf(stderr, "can't open the cache\n");
+      return;
+   }
+
+   void **data = malloc(batch_size * sizeof(*data));
+   size_t *sizes = malloc(batch_size * sizeof(*sizes));
+
+   start = os_time_get_nano();
+
+   switch (mode) {
+   case REPLAY_SERIAL:
+   case REPLAY_PREFETCH:
+      if (mode == REPLAY_PREFETCH)
+         disk_cache_prefetch(cache, log->num_keys, log->keys);
+
+      for (unsigned i = 0; i < log->num_keys; i++) {
+         size_t size;
+         void *item = disk_cache_get(cache, log->keys[i], &size);
+         if (item) {
+            hits++;
+            bytes += size;
+            free(item);
+         }
+      }
+      break;
+   case REPLAY_BATCH:
+      for (unsigned i = 0; i < log->num_keys; i += batch_size) {
+         unsigned n = MIN2(batch_size, log->num_keys - i);
+
+         disk_cache_get_batch(cache, n, &log->keys[i], data, sizes);
+         for (unsigned j = 0; j < n; j++) {
+            if (data[j]) {
+               hits++;
+               bytes += sizes[j];
+               free(data[j]);
+            }
+         }
+      }
+      break;
+   case REPLAY_VIEW:
+      for (unsigned i = 0; i < log->num_keys; i++) {
+         struct disk_cache_view view;
+
+         /* Touch every page, a view of a mapped item isn't read yet. */
+         if (disk_cache_get_view(cache, log->keys[i], &view)) {
+            const volatile uint8_t *item = view.data;
+
+            for (size_t b = 0; b < view.size; b += 4096)
+               (void)item[b];
+
+            hits++;
+            bytes += view.size;
+            disk_cache_release_view(&view);
+         }
+      }
+      break;
+   default:
+      unreachable("bad replay mode");
+   }
+
+   end = os_time_get_nano();
+
+   printf("%-10s %8u keys %8u hits %10.1f KiB %10.2f ms\n",
+          mode_names[mode], log->num_keys, hits, bytes / 1024.0,
+          (end - start) / 1e6);
+
+   free(data);
+   free(sizes);
+   disk_cache_destroy(cache);
+}
+
+int
+main(int argc, char **argv)
+{
+   unsigned batch_size = 256;
+   int mode = -1;
+   struct key_log log;
+   int opt;
+
+   while ((opt = getopt(argc, argv, "m:b:")) != -1) {
+      switch (opt) {
+      case 'm':
+         for (unsigned m = 0; m < REPLAY_COUNT; m++) {
+            if (!strcmp(optarg, mode_names[m]))
+               mode = m;
+         }
+         if (mode < 0) {
+            fprintf(stderr, "unknown mode %s\n", optarg);
+            return 1;
+         }
+         break;
+      case 'b':
+         batch_size = MAX2(1, atoi(optarg));
+         break;
+      default:
+         fprintf(stderr, "usage: %s [-m serial|batch|prefetch|view] "
+                 "[-b batch_size] <key log>\n", argv[0]);
+         return 1;
+      }
+   }
+
+   if (optind >= argc) {
+      fprintf(stderr, "usage: %s [-m serial|batch|prefetch|view] "
+              "[-b batch_size] <key log>\n", argv[0]);
+      return 1;
+   }
+
+   if (!read_key_log(argv[optind], &log))
+      return 1;
+
+   /* Don't append the replayed lookups to a log. */
+   unsetenv("MESA_SHADER_CACHE_KEY_LOG");
+
+   for (unsigned m = 0; m < REPLAY_COUNT; m++) {
+      if (mode < 0 || mode == m)
+         replay(&log, m, batch_size);
+   }
+
+   free(log.keys);
+   return 0;
+}
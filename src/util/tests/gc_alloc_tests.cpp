@@ -46,3 +46,94 @@ TEST(gc_alloc, align)
       }
    }
 }
+
+TEST(gc_alloc, linear_align)
+{
+   for (size_t size = 4; size <= 256; size += 4) {
+      for (size_t align = 4; align <= HEADER_ALIGN; align *= 2) {
+         gc_ctx *ctx = gc_context_linear(NULL);
+
+         for (unsigned i = 0; i < 16; i++) {
+            uintptr_t ptr = (uintptr_t)gc_alloc_size(ctx, size, align);
+            EXPECT_EQ(ptr % align, 0);
+         }
+
+         ralloc_free(ctx);
+      }
+   }
+}
+
+TEST(gc_alloc, linear_sweep)
+{
+   gc_ctx *ctx = gc_context_linear(NULL);
+   void *ptrs[4096];
+
+   /* Consecutive allocations are packed in order. */
+   for (unsigned i = 0; i < ARRAY_SIZE(ptrs); i++) {
+      ptrs[i] = gc_alloc_size(ctx, 24 + (i % 3) * 8, 8);
+      memset(ptrs[i], i & 0xff, 24);
+      EXPECT_EQ(gc_get_context(ptrs[i]), ctx);
+   }
+   EXPECT_LT((uintptr_t)ptrs[0], (uintptr_t)ptrs[1]);
+   EXPECT_LT((uintptr_t)ptrs[1], (uintptr_t)ptrs[2]);
+
+   /* Free the first half explicitly and sweep every other object of the
+    * second half.
+    */
+   for (unsigned i = 0; i < ARRAY_SIZE(ptrs) / 2; i++)
+      gc_free(ptrs[i]);
+
+   gc_sweep_start(ctx);
+   for (unsigned i = ARRAY_SIZE(ptrs) / 2; i < ARRAY_SIZE(ptrs); i += 2)
+      gc_mark_live(ctx, ptrs[i]);
+   gc_sweep_end(ctx);
+
+   for (unsigned i = ARRAY_SIZE(ptrs) / 2; i < ARRAY_SIZE(ptrs); i += 2) {
+      EXPECT_EQ(*(uint8_t *)ptrs[i], i & 0xff);
+      gc_free(ptrs[i]);
+   }
+
+   void *ptr = gc_alloc_size(ctx, 64, 8);
+   EXPECT_EQ(gc_get_context(ptr), ctx);
+   gc_free(ptr);
+
+   ralloc_free(ctx);
+}
+
+TEST(gc_alloc, merge)
+{
+   gc_ctx *dst = gc_context(NULL);
+   gc_ctx *src = gc_context(NULL);
+
+   /* Make the generations of the contexts differ. */
+   void *old = gc_alloc_size(dst, 32, 8);
+   gc_sweep_start(dst);
+   gc_mark_live(dst, old);
+   gc_sweep_end(dst);
+
+   void *small = gc_alloc_size(src, 32, 8);
+   void *dead = gc_alloc_size(src, 32, 8);
+   void *large = gc_alloc_size(src, 4096, 8);
+
+   gc_context_merge(dst, src);
+   ralloc_free(src);
+
+   EXPECT_EQ(gc_get_context(small), dst);
+   EXPECT_EQ(gc_get_context(large), dst);
+
+   /* Merged objects are swept like the others. */
+   gc_sweep_start(dst);
+   gc_mark_live(dst, old);
+   gc_mark_live(dst, small);
+   gc_mark_live(dst, large);
+   gc_sweep_end(dst);
+
+   memset(small, 0xff, 32);
+   memset(large, 0xff, 4096);
+   (void)dead;
+
+   gc_free(small);
+   gc_free(large);
+   gc_free(old);
+   ralloc_free(dst);
+}
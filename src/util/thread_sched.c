@@ -89,3 +89,29 @@ util_thread_sched_apply_policy(thrd_t thread, enum util_thread_name name,
    return false;
 #endif
 }
+
+/**
+ * Pin thread "index" of a pool of "count" worker threads to one L3 cache.
+ *
+ * The threads are spread evenly over all L3 caches, with contiguous ranges
+ * of thread indices sharing the same L3.  Pools which hand out neighbouring
+ * work to neighbouring threads thus keep the shared data in one cache
+ * instead of bouncing it between core complexes (or sockets).
+ */
+bool
+util_thread_sched_pin_to_L3(thrd_t thread, unsigned index, unsigned count)
+{
+#if DETECT_ARCH_X86 || DETECT_ARCH_X86_64
+   const struct util_cpu_caps_t *caps = util_get_cpu_caps();
+
+   if (caps->num_L3_caches <= 1 || !caps->L3_affinity_mask || index >= count)
+      return false;
+
+   unsigned L3_cache = index * caps->num_L3_caches / count;
+
+   return util_set_thread_affinity(thread, caps->L3_affinity_mask[L3_cache],
+                                   NULL, caps->num_cpu_mask_bits);
+#else
+   return false;
+#endif
+}
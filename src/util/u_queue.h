@@ -293,6 +293,11 @@ struct util_queue_monitoring
    unsigned num_direct_items;
    unsigned num_syncs;
    unsigned num_batches;
+   unsigned num_stalls;
+
+   /* The sum of the fill percentages of num_filled_batches batches. */
+   unsigned batch_fill;
+   unsigned num_filled_batches;
 };
 
 #ifdef __cplusplus